@@ -1,6 +1,8 @@
 SUBMAKEFILES := \
     radclient.mk \
+    raddetail.mk \
     radict.mk \
+    radlog.mk \
     radiusd.mk \
     radsniff.mk \
     radwho.mk \
@@ -0,0 +1,433 @@
+/*
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ */
+
+/**
+ * $Id$
+ *
+ * @file raddetail.c
+ * @brief Convert detail files between the text and binary formats
+ *
+ * @copyright 2020 The FreeRADIUS server project
+ */
+RCSID("$Id$")
+
+#include <freeradius-devel/server/base.h>
+#include <freeradius-devel/server/detail.h>
+#include <freeradius-devel/radius/defs.h>
+#include <freeradius-devel/util/base.h>
+#include <freeradius-devel/autoconf.h>
+
+#include <fcntl.h>
+
+#ifdef HAVE_GETOPT_H
+#  include <getopt.h>
+#endif
+
+static fr_dict_t const *dict_freeradius;
+static fr_dict_t const *dict_radius;
+
+extern fr_dict_autoload_t raddetail_dict[];
+fr_dict_autoload_t raddetail_dict[] = {
+	{ .out = &dict_freeradius, .proto = "freeradius" },
+	{ .out = &dict_radius, .proto = "radius" },
+	{ NULL }
+};
+
+static fr_dict_attr_t const *attr_packet_type;
+
+extern fr_dict_attr_autoload_t raddetail_dict_attr[];
+fr_dict_attr_autoload_t raddetail_dict_attr[] = {
+	{ .out = &attr_packet_type, .name = "Packet-Type", .type = FR_TYPE_UINT32, .dict = &dict_radius },
+	{ NULL }
+};
+
+static bool to_binary = false;
+
+static void NEVER_RETURNS usage(int ret)
+{
+	fprintf(stderr, "usage: raddetail [OPTS] [file...]\n");
+	fprintf(stderr, "  -b               Convert to binary records.  The default is to convert to text.\n");
+	fprintf(stderr, "  -d <raddb>       Set user dictionary directory (defaults to " RADDBDIR ").\n");
+	fprintf(stderr, "  -D <dictdir>     Set main dictionary directory (defaults to " DICTDIR ").\n");
+	fprintf(stderr, "  -h               Print this help message.\n");
+	fprintf(stderr, "\n");
+	fprintf(stderr, "Convert detail files to text, or to binary records, and write them to stdout.\n");
+	fprintf(stderr, "Reads stdin if no files are given.  Entries already in the output format are copied unchanged.\n");
+	fr_exit_now(ret);
+}
+
+/** Read all of a file into memory
+ *
+ */
+static uint8_t *raddetail_read(TALLOC_CTX *ctx, int fd, size_t *len)
+{
+	uint8_t	*buff;
+	size_t	size = 65536, used = 0;
+
+	buff = talloc_array(ctx, uint8_t, size);
+	if (!buff) return NULL;
+
+	for (;;) {
+		ssize_t slen;
+
+		if (used == size) {
+			size *= 2;
+			buff = talloc_realloc(ctx, buff, uint8_t, size);
+			if (!buff) return NULL;
+		}
+
+		slen = read(fd, buff + used, size - used);
+		if (slen < 0) {
+			if (errno == EINTR) continue;
+			fr_strerror_printf("Failed reading: %s", fr_syserror(errno));
+			talloc_free(buff);
+			return NULL;
+		}
+		if (slen == 0) break;
+
+		used += slen;
+	}
+
+	*len = used;
+	return buff;
+}
+
+/** Print a binary record as a text entry
+ *
+ */
+static int raddetail_to_text(TALLOC_CTX *ctx, uint8_t const *data, size_t data_len)
+{
+	fr_cursor_t	cursor;
+	VALUE_PAIR	*vp, *head = NULL;
+	fr_dict_t const	*dict;
+	unsigned int	code;
+	fr_unix_time_t	when;
+	time_t		timeval;
+	char		buffer[64], *p;
+
+	fr_cursor_init(&cursor, &head);
+	if (fr_detail_binary_decode(ctx, &cursor, &dict, &code, &when, data, data_len) < 0) {
+		fr_pair_list_free(&head);
+		return -1;
+	}
+
+	timeval = fr_unix_time_to_sec(when);
+	CTIME_R(&timeval, buffer, sizeof(buffer));
+	p = strrchr(buffer, '\n');
+	if (p) p[0] = '\0';
+
+	printf("%s\n", buffer);
+	for (vp = fr_cursor_head(&cursor);
+	     vp;
+	     vp = fr_cursor_next(&cursor)) {
+		vp->op = T_OP_EQ;
+		fr_pair_fprint(stdout, vp);
+	}
+	printf("\t%s = %lu\n\n", fr_detail_binary_is_done(data) ? "Donestamp" : "Timestamp",
+	       (unsigned long) timeval);
+
+	fr_pair_list_free(&head);
+
+	return 0;
+}
+
+/** Write a text entry as a binary record
+ *
+ */
+static int raddetail_to_binary(TALLOC_CTX *ctx, char *entry)
+{
+	fr_detail_binary_t	record;
+	VALUE_PAIR		*vp, *head = NULL;
+	fr_cursor_t		cursor;
+	unsigned int		code = FR_CODE_ACCOUNTING_REQUEST;
+	fr_unix_time_t		when = 0;
+	bool			done = false;
+	char			*line, *next;
+
+	/*
+	 *	The first line is the header, which we don't need.
+	 */
+	line = strchr(entry, '\n');
+	for (; line; line = next) {
+		next = strchr(line + 1, '\n');
+		if (next) *next = '\0';
+
+		line++;
+		while (isspace((uint8_t) *line)) line++;
+		if (!*line) continue;
+
+		if (strncasecmp(line, "Timestamp = ", 12) == 0) {
+			when = fr_unix_time_from_sec(strtoul(line + 12, NULL, 10));
+			continue;
+		}
+
+		if (strncasecmp(line, "Donestamp = ", 12) == 0) {
+			when = fr_unix_time_from_sec(strtoul(line + 12, NULL, 10));
+			done = true;
+			continue;
+		}
+
+		/*
+		 *	Skip this for backwards compatability.
+		 */
+		if (strncasecmp(line, "Request-Authenticator", 21) == 0) continue;
+
+		if (fr_pair_list_afrom_str(ctx, dict_radius, line, &head) == T_INVALID) {
+			fr_perror("raddetail: Ignoring line \"%s\"", line);
+			continue;
+		}
+	}
+
+	/*
+	 *	Nothing to write.
+	 */
+	if (!head) return 0;
+
+	vp = fr_pair_find_by_da(head, attr_packet_type, TAG_ANY);
+	if (vp) code = vp->vp_uint32;
+
+	if (fr_detail_binary_init(ctx, &record, dict_radius, code, when) < 0) {
+	error:
+		fr_pair_list_free(&head);
+		return -1;
+	}
+
+	for (vp = fr_cursor_init(&cursor, &head);
+	     vp;
+	     vp = fr_cursor_next(&cursor)) {
+		if (fr_detail_binary_add(&record, vp) < 0) {
+			talloc_free(record.tb.buff);
+			goto error;
+		}
+	}
+
+	fr_detail_binary_finish(&record);
+	if (done) memcpy(record.tb.buff + FR_DETAIL_BINARY_DONE_OFFSET, "Done", 4);
+
+	fwrite(record.tb.buff, 1, record.tb.used, stdout);
+
+	talloc_free(record.tb.buff);
+	fr_pair_list_free(&head);
+
+	return 0;
+}
+
+/** Convert every entry in a detail file
+ *
+ */
+static int raddetail_convert(TALLOC_CTX *ctx, uint8_t *data, size_t len)
+{
+	uint8_t	*p = data, *end = data + len;
+
+	while (p < end) {
+		uint8_t	*eor;
+
+		/*
+		 *	Binary records
+		 */
+		if (fr_detail_binary_is_record(p, end - p)) {
+			ssize_t slen;
+
+			slen = fr_detail_binary_length(p, end - p);
+			if ((slen <= 0) || (slen > (end - p))) {
+				fr_strerror_printf("Malformed binary record at offset %zu", (size_t)(p - data));
+				return -1;
+			}
+
+			if (to_binary) {
+				fwrite(p, 1, slen, stdout);
+			} else if (raddetail_to_text(ctx, p, slen) < 0) {
+				fr_strerror_printf_push("Failed converting record at offset %zu", (size_t)(p - data));
+				return -1;
+			}
+
+			p += slen;
+			continue;
+		}
+
+		/*
+		 *	Text entries end with a blank line, or at
+		 *	the end of the file.
+		 */
+		for (eor = p; eor < end; eor++) {
+			eor = memchr(eor, '\n', end - eor);
+			if (!eor) {
+				eor = end;
+				break;
+			}
+			if (((eor + 1) < end) && (eor[1] == '\n')) {
+				eor += 2;
+				break;
+			}
+		}
+
+		if (!to_binary) {
+			fwrite(p, 1, eor - p, stdout);
+
+		} else {
+			char	*entry;
+
+			entry = talloc_strndup(ctx, (char const *) p, eor - p);
+			if (!entry) {
+				fr_strerror_printf("Out of memory");
+				return -1;
+			}
+
+			if (raddetail_to_binary(entry, entry) < 0) {
+				fr_strerror_printf_push("Failed converting entry at offset %zu", (size_t)(p - data));
+				talloc_free(entry);
+				return -1;
+			}
+			talloc_free(entry);
+		}
+
+		p = eor;
+	}
+
+	return 0;
+}
+
+/** Convert a detail file
+ *
+ * @param[in] ctx	to allocate the file contents in.
+ * @param[in] file	to read, or "-" for stdin.
+ * @return
+ *	- 0 on success.
+ *	- -1 on failure.
+ */
+static int raddetail_file(TALLOC_CTX *ctx, char const *file)
+{
+	int		fd = STDIN_FILENO;
+	uint8_t		*data;
+	size_t		len;
+	int		ret;
+
+	if (strcmp(file, "-") != 0) {
+		fd = open(file, O_RDONLY);
+		if (fd < 0) {
+			fr_strerror_printf("Failed opening %s: %s", file, fr_syserror(errno));
+			return -1;
+		}
+	}
+
+	data = raddetail_read(ctx, fd, &len);
+	if (fd != STDIN_FILENO) close(fd);
+	if (!data) return -1;
+
+	ret = raddetail_convert(ctx, data, len);
+
+	talloc_free(data);
+
+	return ret;
+}
+
+int main(int argc, char *argv[])
+{
+	int		c;
+	int		ret = EXIT_SUCCESS;
+	char const	*raddb_dir = RADDBDIR;
+	char const	*dict_dir = DICTDIR;
+	TALLOC_CTX	*autofree;
+
+	/*
+	 *	Must be called first, so the handler is called last
+	 */
+	fr_thread_local_atexit_setup();
+
+	autofree = talloc_autofree_context();
+
+#ifndef NDEBUG
+	if (fr_fault_setup(autofree, getenv("PANIC_ACTION"), argv[0]) < 0) {
+		fr_perror("raddetail");
+		fr_exit(EXIT_FAILURE);
+	}
+#endif
+
+	talloc_set_log_stderr();
+
+	while ((c = getopt(argc, argv, "bd:D:h")) != -1) switch (c) {
+		case 'b':
+			to_binary = true;
+			break;
+
+		case 'd':
+			raddb_dir = optarg;
+			break;
+
+		case 'D':
+			dict_dir = optarg;
+			break;
+
+		case 'h':
+			usage(EXIT_SUCCESS);
+
+		default:
+			usage(EXIT_FAILURE);
+	}
+	argc -= optind;
+	argv += optind;
+
+	if (fr_check_lib_magic(RADIUSD_MAGIC_NUMBER) < 0) {
+		fr_perror("raddetail");
+		ret = EXIT_FAILURE;
+		goto finish;
+	}
+
+	if (!fr_dict_global_ctx_init(autofree, dict_dir)) {
+		fr_perror("raddetail");
+		ret = EXIT_FAILURE;
+		goto finish;
+	}
+
+	if (fr_dict_autoload(raddetail_dict) < 0) {
+		fr_perror("raddetail");
+		ret = EXIT_FAILURE;
+		goto finish;
+	}
+
+	if (fr_dict_attr_autoload(raddetail_dict_attr) < 0) {
+		fr_perror("raddetail");
+		ret = EXIT_FAILURE;
+		goto finish;
+	}
+
+	if (fr_dict_read(fr_dict_unconst(dict_freeradius), raddb_dir, FR_DICTIONARY_FILE) == -1) {
+		fr_perror("raddetail");
+		ret = EXIT_FAILURE;
+		goto finish;
+	}
+	fr_strerror();	/* Clear the error buffer */
+
+	if (argc == 0) {
+		if (raddetail_file(autofree, "-") < 0) {
+			fr_perror("raddetail");
+			ret = EXIT_FAILURE;
+		}
+		goto finish;
+	}
+
+	while (argc-- > 0) {
+		if (raddetail_file(autofree, *argv++) < 0) {
+			fr_perror("raddetail");
+			ret = EXIT_FAILURE;
+		}
+	}
+
+finish:
+	fr_dict_autofree(raddetail_dict);
+	talloc_free(autofree);
+	return ret;
+}
@@ -766,6 +766,15 @@ int main(int argc, char *argv[])
 	 */
 	if (log_global_init(&default_log, config->daemonize) < 0) EXIT_WITH_FAILURE;
 
+	/*
+	 *	Start the log writer thread.  This has to be done
+	 *	post-fork, as threads aren't inherited by the child.
+	 */
+	if (config->log_async.enabled && (fr_log_async_start(&config->log_async) < 0)) {
+		PERROR("Failed starting log writer");
+		EXIT_WITH_FAILURE;
+	}
+
 	/*
 	 *	Start the network / worker threads.
 	 */
@@ -794,6 +803,17 @@ int main(int argc, char *argv[])
 			EXIT_WITH_FAILURE;
 		}
 
+		/*
+		 *	Start the threads which run blocking module
+		 *	calls for "parallel offload" sections.
+		 */
+		if (config->spawn_workers &&
+		    (unlang_offload_start(config->num_offload, config->max_offload_queue,
+					  thread_instantiate, thread_detach) < 0)) {
+			PERROR("Failed starting offload threads");
+			EXIT_WITH_FAILURE;
+		}
+
 		/*
 		 *	Tell the virtual servers to open their sockets.
 		 */
@@ -965,6 +985,12 @@ int main(int argc, char *argv[])
 	if (status == 2) trigger_exec(NULL, NULL, "server.signal.term", true, NULL);
 	trigger_exec(NULL, NULL, "server.stop", false, NULL);
 
+	/*
+	 *  Stop the offload threads first, as they return their
+	 *  results to the workers.
+	 */
+	unlang_offload_stop();
+
 	/*
 	 *  Stop the scheduler, this signals the network and worker threads
 	 *  to exit gracefully.  fr_schedule_destroy only returns once all
@@ -1011,8 +1037,15 @@ cleanup:
 	 *	This may not have been done earlier if we're
 	 *	exiting due to a startup error.
 	 */
+	unlang_offload_stop();
 	(void) fr_schedule_destroy(&sc);
 
+	/*
+	 *  Write out any queued log messages.  Anything logged
+	 *  after this point is written synchronously.
+	 */
+	fr_log_async_stop();
+
 	/*
 	 *  Frees request specific logging resources which is OK
 	 *  because all the requests will have been stopped.
@@ -0,0 +1,375 @@
+/*
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ */
+
+/**
+ * $Id$
+ *
+ * @file radlog.c
+ * @brief Utility to print log files written in binary format
+ *
+ * @copyright 2020 The FreeRADIUS server project
+ */
+RCSID("$Id$")
+
+#include <freeradius-devel/util/base.h>
+#include <freeradius-devel/util/log_record.h>
+#include <freeradius-devel/autoconf.h>
+
+#include <fcntl.h>
+
+#ifdef HAVE_GETOPT_H
+#  include <getopt.h>
+#endif
+
+/** A format string read from the log file
+ *
+ */
+typedef struct {
+	char const	*fmt;		//!< Format string.
+	char const	*file;		//!< src file the format string came from.
+} radlog_format_t;
+
+static radlog_format_t	*formats;	//!< Indexed by format ID.
+static uint32_t		formats_num;	//!< Size of the formats array.
+
+static bool		print_location = false;
+static bool		dates_utc = false;
+
+static void usage(void)
+{
+	fprintf(stderr, "usage: radlog [OPTS] [file...]\n");
+	fprintf(stderr, "  -l               Print the source file and line of each message.\n");
+	fprintf(stderr, "  -u               Print timestamps in UTC.\n");
+	fprintf(stderr, "  -h               Print this help message.\n");
+	fprintf(stderr, "\n");
+	fprintf(stderr, "Print log files written with 'format = binary'.  Reads stdin if no files are given.\n");
+	fprintf(stderr, "Lines which aren't binary log records are printed unchanged.\n");
+}
+
+/** Read all of a file into memory
+ *
+ */
+static uint8_t *radlog_read(TALLOC_CTX *ctx, int fd, size_t *len)
+{
+	uint8_t	*buff;
+	size_t	size = 65536, used = 0;
+
+	buff = talloc_array(ctx, uint8_t, size);
+	if (!buff) return NULL;
+
+	for (;;) {
+		ssize_t slen;
+
+		if (used == size) {
+			size *= 2;
+			buff = talloc_realloc(ctx, buff, uint8_t, size);
+			if (!buff) return NULL;
+		}
+
+		slen = read(fd, buff + used, size - used);
+		if (slen < 0) {
+			if (errno == EINTR) continue;
+			fr_strerror_printf("Failed reading: %s", fr_syserror(errno));
+			talloc_free(buff);
+			return NULL;
+		}
+		if (slen == 0) break;
+
+		used += slen;
+	}
+
+	*len = used;
+	return buff;
+}
+
+/** Check whether the data at p is a complete, well formed record
+ *
+ */
+static fr_log_record_hdr_t const *radlog_record(uint8_t const *p, uint8_t const *end)
+{
+	fr_log_record_hdr_t const *hdr = (fr_log_record_hdr_t const *)p;
+
+	if ((size_t)(end - p) < sizeof(*hdr)) return NULL;
+	if ((hdr->len < sizeof(*hdr)) || (hdr->len > FR_LOG_RECORD_MAX)) return NULL;
+	if (hdr->len > (size_t)(end - p)) return NULL;
+
+	switch (hdr->kind) {
+	case FR_LOG_RECORD_START:
+	{
+		fr_log_record_start_t const *start = (fr_log_record_start_t const *)p;
+
+		if (hdr->len != sizeof(*start)) return NULL;
+		if (memcmp(start->magic, FR_LOG_RECORD_MAGIC, sizeof(start->magic)) != 0) return NULL;
+	}
+		break;
+
+	case FR_LOG_RECORD_FORMAT:
+	{
+		fr_log_record_format_t const *format = (fr_log_record_format_t const *)p;
+
+		if (hdr->len < sizeof(*format)) return NULL;
+		if (format->id >= FR_LOG_RECORD_MAX) return NULL;
+		if ((uint64_t)hdr->len != ((uint64_t)sizeof(*format) + format->fmt_len + format->file_len)) return NULL;
+	}
+		break;
+
+	case FR_LOG_RECORD_MESSAGE:
+	{
+		fr_log_record_message_t const *msg = (fr_log_record_message_t const *)p;
+
+		if (hdr->len < sizeof(*msg)) return NULL;
+		if (msg->prefix_len > (hdr->len - sizeof(*msg))) return NULL;
+	}
+		break;
+
+	default:
+		return NULL;
+	}
+
+	return hdr;
+}
+
+/** Print a message record
+ *
+ */
+static void radlog_message(TALLOC_CTX *ctx, fr_log_record_message_t const *msg)
+{
+	uint8_t const	*prefix = (uint8_t const *)(msg + 1);
+	uint8_t const	*args = prefix + msg->prefix_len;
+	char		time_buff[64];
+	char		*p, *out;
+	time_t		timeval = msg->when / NSEC;
+
+	if ((msg->id >= formats_num) || !formats[msg->id].fmt) {
+		printf("<unknown format %u>\n", msg->id);
+		return;
+	}
+
+#ifdef HAVE_GMTIME_R
+	if (dates_utc) {
+		struct tm utc;
+		gmtime_r(&timeval, &utc);
+		ASCTIME_R(&utc, time_buff, sizeof(time_buff));
+	} else
+#endif
+	{
+		CTIME_R(&timeval, time_buff, sizeof(time_buff));
+	}
+	p = strrchr(time_buff, '\n');
+	if (p) p[0] = '\0';
+
+	out = fr_log_record_args_print(ctx, formats[msg->id].fmt, args, msg->hdr.len - sizeof(*msg) - msg->prefix_len);
+
+	if (print_location) printf("%s:%i : ", formats[msg->id].file, msg->line);
+	printf("%s : %s%.*s%s\n", time_buff, fr_table_str_by_value(fr_log_levels, msg->type, ": "),
+	       (int)msg->prefix_len, prefix, out ? out : "<invalid log arguments>");
+
+	talloc_free(out);
+}
+
+/** Print every record in a binary log file
+ *
+ */
+static int radlog_print(TALLOC_CTX *ctx, uint8_t const *data, size_t len)
+{
+	uint8_t const	*p = data, *end = data + len;
+
+	while (p < end) {
+		fr_log_record_hdr_t const	*hdr = NULL;
+		fr_log_record_hdr_t		aligned;
+		uint8_t				*copy = NULL;
+		uint8_t const			*eol;
+
+		/*
+		 *	Records are only aligned if everything before
+		 *	them was, so copy them before looking at them.
+		 */
+		if ((size_t)(end - p) >= sizeof(aligned)) {
+			memcpy(&aligned, p, sizeof(aligned));
+			if ((aligned.len >= sizeof(aligned)) && (aligned.len <= (size_t)(end - p))) {
+				copy = talloc_memdup(ctx, p, aligned.len);
+				if (!copy) return -1;
+
+				hdr = radlog_record(copy, copy + aligned.len);
+			}
+		}
+
+		/*
+		 *	Not a record, print it as text.
+		 */
+		if (!hdr) {
+			talloc_free(copy);
+
+			eol = memchr(p, '\n', end - p);
+			eol = eol ? eol + 1 : end;
+
+			fwrite(p, 1, eol - p, stdout);
+			p = eol;
+			continue;
+		}
+
+		switch (hdr->kind) {
+		case FR_LOG_RECORD_START:
+			TALLOC_FREE(formats);
+			formats_num = 0;
+			break;
+
+		case FR_LOG_RECORD_FORMAT:
+		{
+			fr_log_record_format_t const *format = (fr_log_record_format_t const *)hdr;
+			char const *str = (char const *)(format + 1);
+
+			if (format->id >= formats_num) {
+				uint32_t num = formats_num ? formats_num : 64;
+
+				while (num <= format->id) num *= 2;
+
+				formats = talloc_realloc(ctx, formats, radlog_format_t, num);
+				if (!formats) return -1;
+				memset(formats + formats_num, 0, sizeof(formats[0]) * (num - formats_num));
+				formats_num = num;
+			}
+
+			formats[format->id].fmt = talloc_strndup(formats, str, format->fmt_len);
+			formats[format->id].file = talloc_strndup(formats, str + format->fmt_len, format->file_len);
+		}
+			break;
+
+		case FR_LOG_RECORD_MESSAGE:
+			radlog_message(ctx, (fr_log_record_message_t const *)hdr);
+			break;
+
+		default:
+			break;
+		}
+
+		p += hdr->len;
+		talloc_free(copy);
+	}
+
+	return 0;
+}
+
+/** Print a binary log file
+ *
+ * @param[in] ctx	to allocate the file contents in.
+ * @param[in] file	to read, or "-" for stdin.
+ * @return
+ *	- 0 on success.
+ *	- -1 on failure.
+ */
+static int radlog_file(TALLOC_CTX *ctx, char const *file)
+{
+	int		fd = STDIN_FILENO;
+	uint8_t		*data;
+	size_t		len;
+	int		ret;
+
+	if (strcmp(file, "-") != 0) {
+		fd = open(file, O_RDONLY);
+		if (fd < 0) {
+			fr_strerror_printf("Failed opening %s: %s", file, fr_syserror(errno));
+			return -1;
+		}
+	}
+
+	data = radlog_read(ctx, fd, &len);
+	if (fd != STDIN_FILENO) close(fd);
+	if (!data) return -1;
+
+	/*
+	 *	Format IDs don't carry over between files.
+	 */
+	TALLOC_FREE(formats);
+	formats_num = 0;
+
+	ret = radlog_print(ctx, data, len);
+	if (ret < 0) fr_strerror_printf("Out of memory");
+
+	talloc_free(data);
+
+	return ret;
+}
+
+int main(int argc, char *argv[])
+{
+	int		c;
+	int		ret = EXIT_SUCCESS;
+	TALLOC_CTX	*autofree;
+
+	/*
+	 *	Must be called first, so the handler is called last
+	 */
+	fr_thread_local_atexit_setup();
+
+	autofree = talloc_autofree_context();
+
+#ifndef NDEBUG
+	if (fr_fault_setup(autofree, getenv("PANIC_ACTION"), argv[0]) < 0) {
+		fr_perror("radlog");
+		fr_exit(EXIT_FAILURE);
+	}
+#endif
+
+	talloc_set_log_stderr();
+
+	while ((c = getopt(argc, argv, "luh")) != -1) switch (c) {
+		case 'l':
+			print_location = true;
+			break;
+
+		case 'u':
+			dates_utc = true;
+			break;
+
+		case 'h':
+		default:
+			usage();
+			ret = EXIT_FAILURE;
+			goto finish;
+	}
+	argc -= optind;
+	argv += optind;
+
+	/*
+	 *	The binary format is specific to the version
+	 *	of the library which wrote it.
+	 */
+	if (fr_check_lib_magic(RADIUSD_MAGIC_NUMBER) < 0) {
+		fr_perror("radlog");
+		ret = EXIT_FAILURE;
+		goto finish;
+	}
+
+	if (argc == 0) {
+		if (radlog_file(autofree, "-") < 0) {
+			fr_perror("radlog");
+			ret = EXIT_FAILURE;
+		}
+		goto finish;
+	}
+
+	while (argc-- > 0) {
+		if (radlog_file(autofree, *argv++) < 0) {
+			fr_perror("radlog");
+			ret = EXIT_FAILURE;
+		}
+	}
+
+finish:
+	talloc_free(autofree);
+	return ret;
+}
@@ -0,0 +1,5 @@
+TARGET		:= radlog
+SOURCES		:= radlog.c
+
+TGT_PREREQS	:= libfreeradius-util.a
+TGT_LDLIBS	:= $(LIBS)
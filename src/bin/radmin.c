@@ -465,6 +465,26 @@ static int cmd_uptime(FILE *fp, UNUSED FILE *fp_err, UNUSED void *ctx, UNUSED fr
 	return 0;
 }
 
+static int cmd_stats_log(FILE *fp, UNUSED FILE *fp_err, UNUSED void *ctx, UNUSED fr_cmd_info_t const *info)
+{
+	fr_log_async_stats_t stats;
+
+	if (!radmin_main_config->log_async.enabled) {
+		fprintf(fp, "Statistics are only available when 'log { async { enable = yes } }' is set.\n");
+		return -1;
+	}
+
+	fr_log_async_stats(&stats);
+
+	fprintf(fp, "queued\t\t%" PRIu64 "\n", stats.queued);
+	fprintf(fp, "written\t\t%" PRIu64 "\n", stats.written);
+	fprintf(fp, "pending\t\t%" PRIu64 "\n", stats.pending);
+	fprintf(fp, "dropped\t\t%" PRIu64 "\n", stats.dropped);
+	fprintf(fp, "errors\t\t%" PRIu64 "\n", stats.errors);
+
+	return 0;
+}
+
 static int cmd_stats_memory(FILE *fp, FILE *fp_err, UNUSED void *ctx, fr_cmd_info_t const *info)
 {
 	if (!radmin_main_config->talloc_memory_report) {
@@ -984,6 +1004,14 @@ static fr_cmd_table_t cmd_table[] = {
 		.read_only = true
 	},
 
+	{
+		.parent = "stats",
+		.name = "log",
+		.func = cmd_stats_log,
+		.help = "Show statistics for the asynchronous log writer.",
+		.read_only = true,
+	},
+
 	{
 		.parent = "stats",
 		.name = "memory",
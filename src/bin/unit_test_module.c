@@ -107,6 +107,25 @@ fr_dict_attr_autoload_t unit_test_module_dict_attr[] = {
  */
 static void usage(main_config_t const *config, int status);
 
+/** Create module and xlat per-thread instances for an offload thread
+ *
+ */
+static int offload_thread_instantiate(TALLOC_CTX *ctx, fr_event_list_t *el, UNUSED void *uctx)
+{
+	if (modules_thread_instantiate(ctx, el) < 0) return -1;
+	if (xlat_thread_instantiate(ctx) < 0) return -1;
+
+	return 0;
+}
+
+/** Free module and xlat resources for an offload thread
+ *
+ */
+static void offload_thread_detach(UNUSED void *uctx)
+{
+	modules_thread_detach();
+	xlat_thread_detach();
+}
 
 static RADCLIENT *client_alloc(TALLOC_CTX *ctx, char const *ip, char const *name)
 {
@@ -918,6 +937,16 @@ int main(int argc, char *argv[])
 	if (modules_thread_instantiate(thread_ctx, el) < 0) EXIT_WITH_FAILURE;
 	if (xlat_thread_instantiate(thread_ctx) < 0) EXIT_WITH_FAILURE;
 
+	/*
+	 *	Start any offload threads, so that "parallel offload"
+	 *	sections can be tested.
+	 */
+	if (unlang_offload_start(config->num_offload, config->max_offload_queue,
+				 offload_thread_instantiate, offload_thread_detach) < 0) {
+		PERROR("Failed starting offload threads");
+		EXIT_WITH_FAILURE;
+	}
+
 	state = fr_state_tree_init(autofree, attr_state, false, 256, 10, 0);
 
 	/*
@@ -1062,6 +1091,12 @@ int main(int argc, char *argv[])
 	INFO("Exiting normally");
 
 cleanup:
+	/*
+	 *	Offloaded jobs are returned via the event list,
+	 *	so the offload threads must be stopped first.
+	 */
+	unlang_offload_stop();
+
 	talloc_free(request);
 	talloc_free(state);
 
@@ -198,6 +198,25 @@ eap_session_t *eap_session_thaw(REQUEST *request)
 	return eap_session;
 }
 
+/** Allocate an eap_session_t to restore a serialised session into
+ *
+ * Used when a session started on another server is continued on this one.
+ * The caller is responsible for populating the session, and for adding it
+ * to the request as #REQUEST_DATA_EAP_SESSION.
+ *
+ * @param[in] ctx	to allocate the session in.
+ * @return A new, frozen, #eap_session_t.
+ */
+eap_session_t *eap_session_restore_alloc(TALLOC_CTX *ctx)
+{
+	eap_session_t *eap_session;
+
+	MEM(eap_session = talloc_zero(ctx, eap_session_t));
+	talloc_set_destructor(eap_session, _eap_session_free);
+
+	return eap_session;
+}
+
 /** Extract the EAP identity from EAP-Identity-Response packets
  *
  * @param[in] request		The current request.
@@ -77,6 +77,8 @@ void		eap_session_freeze(eap_session_t **eap_session);
 
 eap_session_t	*eap_session_thaw(REQUEST *request);
 
+eap_session_t	*eap_session_restore_alloc(TALLOC_CTX *ctx);
+
 eap_session_t 	*eap_session_continue(void *instance, eap_packet_raw_t **eap_packet, REQUEST *request) CC_HINT(nonnull);
 
 static inline eap_session_t *eap_session_get(REQUEST *request)
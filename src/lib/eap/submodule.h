@@ -24,9 +24,33 @@
  */
 #include <freeradius-devel/server/dl_module.h>
 #include <freeradius-devel/server/module.h>
+#include <freeradius-devel/eap/session.h>
 
 #define MAX_PROVIDED_METHODS	10
 
+/** Serialise method specific session data so the session can be continued by another server
+ *
+ * @param[out] out		Where to write the serialised data.
+ * @param[in] ctx		to allocate the serialised data in.
+ * @param[in] eap_session	to serialise.
+ * @return
+ *	- >0 the length of the serialised data.
+ *	- 0 if the session can't be serialised in its current state.
+ *	- -1 on error.
+ */
+typedef ssize_t (*eap_method_freeze_t)(uint8_t **out, TALLOC_CTX *ctx, eap_session_t const *eap_session);
+
+/** Restore method specific session data, and set the process function for the next round
+ *
+ * @param[in] eap_session	to restore data to.
+ * @param[in] in		Serialised data produced by #eap_method_freeze_t.
+ * @param[in] inlen		Length of the serialised data.
+ * @return
+ *	- 0 on success.
+ *	- -1 on error.
+ */
+typedef int (*eap_method_thaw_t)(eap_session_t *eap_session, uint8_t const *in, size_t inlen);
+
 /** Interface exported by EAP submodules
  *
  */
@@ -42,6 +66,11 @@ typedef struct {
 	module_method_t		entry_point;		//!< Callback for processing the next #eap_round_t of an
 							//!< #eap_session_t.
 
+	eap_method_freeze_t	freeze;			//!< Serialise method specific session data.  If NULL
+							///< sessions of this method are only available on the
+							///< server that started them.
+	eap_method_thaw_t	thaw;			//!< Restore method specific session data.
+
 	fr_dict_t const		**namespace;		//!< Namespace children should be allocated in.
 
 	bool			clone_parent_lists;	//!< HACK until all eap methods run their own sections.
@@ -71,6 +71,8 @@
 RCSID("$Id$")
 USES_APPLE_DEPRECATED_API	/* OpenSSL API has been deprecated by Apple */
 
+#include <freeradius-devel/unlang/interpret.h>
+
 #include "tls.h"
 #include "attrs.h"
 
@@ -79,6 +81,7 @@ fr_table_num_ordered_t const eap_tls_status_table[] = {
 	{ "established",		EAP_TLS_ESTABLISHED		},
 	{ "fail",			EAP_TLS_FAIL			},
 	{ "handled",			EAP_TLS_HANDLED			},
+	{ "yield",			EAP_TLS_YIELD			},
 
 	{ "start",			EAP_TLS_START_SEND		},
 	{ "request",			EAP_TLS_RECORD_SEND		},
@@ -332,6 +335,44 @@ int eap_tls_success(REQUEST *request, eap_session_t *eap_session,
 	return 0;
 }
 
+/** Send a session ticket once the session has been authorised
+ *
+ * EAP-TLS has no inner method, so the session is authorised as soon as the
+ * client certificate has been accepted.  That happens after the server's
+ * final handshake flight has been sent, so the ticket goes out in a request
+ * of its own, followed by the one byte commitment message from RFC 9190.
+ *
+ * The peer ACKs the request, and #eap_tls_process returns EAP_TLS_ESTABLISHED
+ * again, at which point the method should call #eap_tls_success.
+ *
+ * @param[in] request		The current subrequest.
+ * @param[in] eap_session	to send the ticket for.
+ * @return
+ *	- 1 if a ticket was sent.
+ *	- 0 if no ticket was sent, and the method should call #eap_tls_success.
+ *	- -1 on failure.
+ */
+int eap_tls_ticket(REQUEST *request, eap_session_t *eap_session)
+{
+	eap_tls_session_t	*eap_tls_session = talloc_get_type_abort(eap_session->opaque, eap_tls_session_t);
+	fr_tls_session_t	*tls_session = eap_tls_session->tls_session;
+	static uint8_t const	commitment = 0x00;
+
+	if (eap_tls_session->ticket_sent || (fr_tls_ticket_issue(request, tls_session) <= 0)) return 0;
+
+	/*
+	 *	OpenSSL writes the ticket before the first
+	 *	application data it's given.
+	 */
+	tls_session->record_from_buff(&tls_session->clean_in, &commitment, sizeof(commitment));
+	if (fr_tls_session_send(request, tls_session) < 0) return -1;
+
+	eap_tls_session->ticket_sent = true;
+	if (eap_tls_request(request, eap_session) < 0) return -1;
+
+	return 1;
+}
+
 /** Send an EAP-TLS failure
  *
  * Composes an EAP-TLS-Failure.  This is a message with code EAP_TLS_FAILURE.
@@ -834,10 +875,17 @@ static eap_tls_status_t eap_tls_handshake(REQUEST *request, eap_session_t *eap_s
 	/*
 	 *	Continue the TLS handshake
 	 */
-	if (fr_tls_session_handshake(request, tls_session) < 0) {
+	switch (fr_tls_session_handshake(request, tls_session)) {
+	case -1:
 		REDEBUG("TLS receive handshake failed during operation");
 		fr_tls_cache_deny(tls_session);
 		return EAP_TLS_FAIL;
+
+	case 2:
+		return EAP_TLS_YIELD;
+
+	default:
+		break;
 	}
 
 	/*
@@ -913,6 +961,16 @@ eap_tls_status_t eap_tls_process(REQUEST *request, eap_session_t *eap_session)
 
 	fr_assert(request->parent);	/* must be a subrequest */
 
+	/*
+	 *	We've been resumed after a private key operation
+	 *	completed.  The record was consumed the first time
+	 *	around, so just continue the handshake.
+	 */
+	if (tls_session->async_pending) {
+		RDEBUG2("Resuming EAP-TLS handshake");
+		return eap_tls_handshake(request, eap_session);
+	}
+
 	RDEBUG2("Continuing EAP-TLS");
 
 	/*
@@ -1016,6 +1074,15 @@ eap_tls_status_t eap_tls_process(REQUEST *request, eap_session_t *eap_session)
 	 *	We have fragments or records to send to the peer
 	 */
 	case EAP_TLS_RECORD_SEND:
+		/*
+		 *	The peer ACKed the last fragment of the ticket
+		 *	sent by eap_tls_ticket().
+		 */
+		if (eap_tls_session->ticket_sent && (tls_session->dirty_out.used == 0)) {
+			RDEBUG2("Peer ACKed our session ticket");
+			return EAP_TLS_ESTABLISHED;
+		}
+
 		/*
 		 *	Return a "yes we're done" if there's no more data to send,
 		 *	and we've just managed to finish the SSL session initialization.
@@ -1049,6 +1116,66 @@ eap_tls_status_t eap_tls_process(REQUEST *request, eap_session_t *eap_session)
 	return status;
 }
 
+/** Mark the request as resumable once the private key operation completes
+ *
+ */
+static void eap_tls_offload_done(UNUSED void *instance, UNUSED void *thread, REQUEST *request, void *rctx, int fd)
+{
+	(void) unlang_module_fd_delete(request, rctx, fd);
+	unlang_interpret_resumable(request);
+}
+
+/** Complete the paused handshake if the request is cancelled
+ *
+ * Otherwise the job would be leaked when the session is freed.
+ */
+static void eap_tls_offload_signal(UNUSED void *instance, UNUSED void *thread, REQUEST *request, void *rctx,
+				   fr_state_signal_t action)
+{
+	eap_session_t		*eap_session = talloc_get_type_abort(rctx, eap_session_t);
+	eap_tls_session_t	*eap_tls_session = talloc_get_type_abort(eap_session->opaque, eap_tls_session_t);
+	int			fd;
+
+	if (action != FR_SIGNAL_CANCEL) return;
+
+	RDEBUG2("Request cancelled - Completing paused private key operation");
+
+	fd = fr_tls_offload_fd(request, eap_tls_session->tls_session);
+	if (fd >= 0) (void) unlang_module_fd_delete(request, eap_session, fd);
+
+	fr_tls_offload_cancel(eap_tls_session->tls_session);
+}
+
+/** Yield until a private key operation being performed by the offload pool completes
+ *
+ * Should be called when #eap_tls_process returns #EAP_TLS_YIELD.  The resume
+ * function should call #eap_tls_process again, which will continue the
+ * handshake from where it was paused.
+ *
+ * @param[in] request		The current subrequest.
+ * @param[in] eap_session	with a paused handshake.
+ * @param[in] resume		Called when the operation completes.
+ * @return
+ *	- RLM_MODULE_YIELD on success.
+ *	- RLM_MODULE_FAIL on failure.
+ */
+rlm_rcode_t eap_tls_yield(REQUEST *request, eap_session_t *eap_session, fr_unlang_module_resume_t resume)
+{
+	eap_tls_session_t	*eap_tls_session = talloc_get_type_abort(eap_session->opaque, eap_tls_session_t);
+	int			fd;
+
+	fd = fr_tls_offload_fd(request, eap_tls_session->tls_session);
+	if (fd < 0) return RLM_MODULE_FAIL;
+
+	if (unlang_module_fd_add(request, eap_tls_offload_done, NULL, eap_tls_offload_done,
+				 eap_session, fd) < 0) {
+		RPEDEBUG("Failed waiting for private key operation");
+		return RLM_MODULE_FAIL;
+	}
+
+	return unlang_module_yield(request, resume, eap_tls_offload_signal, eap_session);
+}
+
 /** Create a new fr_tls_session_t associated with an #eap_session_t
  *
  * Creates a new server fr_tls_session_t and associates it with an #eap_session_t
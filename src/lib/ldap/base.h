@@ -12,6 +12,7 @@
 #include <freeradius-devel/server/base.h>
 #include <freeradius-devel/server/connection.h>
 #include <freeradius-devel/server/map.h>
+#include <freeradius-devel/server/trunk.h>
 
 #define LDAP_DEPRECATED 0	/* Quiet warnings about LDAP_DEPRECATED not being defined */
 
@@ -300,6 +301,9 @@ typedef struct {
 
 	fr_ldap_state_t		state;			//!< LDAP connection state machine.
 
+	rbtree_t		*queries;		//!< Operations sent over this connection, keyed by msgid.
+							///< Only used by trunk connections.
+
 	void			*uctx;			//!< User data associated with the handle.
 } fr_ldap_connection_t;
 
@@ -352,6 +356,51 @@ typedef enum {
 							//!< exit, and retry the operation with a NULL cookie.
 } fr_ldap_rcode_t;
 
+/** Types of operation which can be run over a trunk connection
+ *
+ */
+typedef enum {
+	FR_LDAP_QUERY_SEARCH = 0,			//!< Search for objects.
+	FR_LDAP_QUERY_BIND				//!< Simple bind.
+} fr_ldap_query_type_t;
+
+/** Parse the result of a successful search
+ *
+ * Called from the trunk connection's demux callback, in the thread which
+ * owns the connection, so that the connection's handle can be used.
+ *
+ * @param[in] handle	of the connection the result was received on.
+ * @param[in] result	of the search.  Contains at least one entry.
+ * @param[in] request	the search was run for.
+ * @param[in] uctx	from the query's parser_uctx field.
+ */
+typedef void (*fr_ldap_result_parse_t)(LDAP *handle, LDAPMessage *result, REQUEST *request, void *uctx);
+
+/** An operation being run over a trunk connection
+ *
+ */
+typedef struct {
+	fr_ldap_query_type_t	type;			//!< What kind of operation this is.
+	REQUEST			*request;		//!< Request the operation is being run for.
+
+	char const		*dn;			//!< Base DN for searches, or DN to bind as.
+	int			scope;			//!< Search scope.
+	char const		*filter;		//!< Search filter, may be NULL.
+	char const * const	*attrs;			//!< Attributes to retrieve, may be NULL.
+	char const		*password;		//!< To bind with, may be NULL.
+	LDAPControl		*serverctrls[LDAP_MAX_CONTROLS + 1];	//!< Extra controls to send with the operation.
+
+	fr_ldap_result_parse_t	parser;			//!< Called with the result of a successful search.
+	void			*parser_uctx;		//!< Passed to the parser.
+
+	fr_trunk_request_t	*treq;			//!< Trunk request, NULL once the operation is done.
+	int			msgid;			//!< libldap message ID, valid while the operation is
+							///< outstanding on a connection.
+
+	fr_ldap_rcode_t		ret;			//!< Result of the operation.
+	LDAPMessage		*result;		//!< Result of a successful search.  Freed with the query.
+} fr_ldap_query_t;
+
 /*
  *	Tables for resolving strings to LDAP constants
  */
@@ -495,7 +544,8 @@ fr_ldap_rcode_t	 fr_ldap_sasl_interactive(REQUEST *request,
 fr_ldap_connection_t *fr_ldap_connection_alloc(TALLOC_CTX *ctx);
 
 fr_connection_t	*fr_ldap_connection_state_alloc(TALLOC_CTX *ctx, fr_event_list_t *el,
-					        fr_ldap_config_t const *config, char *log_prefix);
+					        fr_connection_conf_t const *conn_conf,
+					        fr_ldap_config_t const *config, char const *log_prefix);
 
 int		fr_ldap_connection_configure(fr_ldap_connection_t *c, fr_ldap_config_t const *config);
 
@@ -537,6 +587,25 @@ int		fr_ldap_bind_async(fr_ldap_connection_t *c,
 				   LDAPControl **serverctrls, LDAPControl **clientctrls);
 
 
+/*
+ *	trunk.c - Run searches and binds over trunk connections
+ */
+int		fr_ldap_query_cmp(void const *one, void const *two);
+
+fr_trunk_t	*fr_ldap_trunk_alloc(TALLOC_CTX *ctx, fr_event_list_t *el, fr_ldap_config_t const *config,
+				     fr_trunk_conf_t const *conf, char const *log_prefix);
+
+fr_ldap_query_t	*fr_ldap_trunk_search_alloc(TALLOC_CTX *ctx, REQUEST *request,
+					    char const *base_dn, int scope, char const *filter,
+					    char const * const *attrs, LDAPControl **serverctrls);
+
+fr_ldap_query_t	*fr_ldap_trunk_bind_alloc(TALLOC_CTX *ctx, REQUEST *request,
+					  char const *bind_dn, char const *password, LDAPControl **serverctrls);
+
+int		fr_ldap_trunk_query_enqueue(fr_trunk_t *trunk, fr_ldap_query_t *query);
+
+void		fr_ldap_trunk_query_cancel(fr_ldap_query_t *query);
+
 /*
  *	uti.c - Utility functions
  */
@@ -425,11 +425,17 @@ fr_ldap_connection_t *fr_ldap_connection_alloc(TALLOC_CTX *ctx)
  */
 static fr_connection_state_t _ldap_connection_init(void **h, fr_connection_t *conn, void *uctx)
 {
-	fr_ldap_config_t const	*config = talloc_get_type_abort(uctx, fr_ldap_config_t);
+	fr_ldap_config_t const	*config = uctx;			/* Usually embedded in a module instance */
 	fr_ldap_connection_t	*c;
 	fr_ldap_state_t		state;
 
 	c = fr_ldap_connection_alloc(conn);
+	c->conn = conn;
+
+	/*
+	 *	Tracks operations sent by the trunk
+	 */
+	MEM(c->queries = rbtree_talloc_alloc(c, fr_ldap_query_cmp, fr_ldap_query_t, NULL, RBTREE_FLAG_NONE));
 
 	/*
 	 *	Configure/allocate the libldap handle
@@ -456,11 +462,13 @@ static fr_connection_state_t _ldap_connection_init(void **h, fr_connection_t *co
  *
  * @param[in] ctx		to allocate any memory in, and to bind the lifetime of the connection to.
  * @param[in] el		to insert I/O and timer callbacks into.
+ * @param[in] conn_conf		Connection and reconnection timeouts.  If NULL, they're taken from config.
  * @param[in] config		to use to bind the connection to an LDAP server.
  * @param[in] log_prefix	to prepend to connection state messages.
  */
 fr_connection_t	*fr_ldap_connection_state_alloc(TALLOC_CTX *ctx, fr_event_list_t *el,
-					        fr_ldap_config_t const *config, char *log_prefix)
+					        fr_connection_conf_t const *conn_conf,
+					        fr_ldap_config_t const *config, char const *log_prefix)
 {
 	fr_connection_t *conn;
 
@@ -469,7 +477,7 @@ fr_connection_t	*fr_ldap_connection_state_alloc(TALLOC_CTX *ctx, fr_event_list_t
 				   	.init = _ldap_connection_init,
 				   	.close = _ldap_connection_close
 				   },
-				   &(fr_connection_conf_t){
+				   conn_conf ? conn_conf : &(fr_connection_conf_t){
 				   	.connection_timeout = config->net_timeout,
 				   	.reconnection_delay = config->reconnection_delay
 				   },
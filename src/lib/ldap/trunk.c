@@ -0,0 +1,560 @@
+/*
+ *   This program is is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or (at
+ *   your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ */
+
+/**
+ * $Id$
+ * @file lib/ldap/trunk.c
+ * @brief Run searches and binds over connections managed by a trunk
+ *
+ * Connections are opened with the async connection state machine in
+ * connection.c, and are bound as the admin user before the trunk starts
+ * using them.
+ *
+ * Searches are pipelined, i.e. many may be outstanding on a connection
+ * at once, with results matched to queries by msgid.  Binds change the
+ * identity of the connection, so trunks used for binds must be configured
+ * with `max_req_per_conn = 1`.
+ *
+ * @copyright 2020 The FreeRADIUS Server Project.
+ */
+RCSID("$Id$")
+
+USES_APPLE_DEPRECATED_API
+
+#define LOG_PREFIX "%s - [%" PRIu64 "] "
+#define LOG_PREFIX_ARGS conn->log_prefix, conn->id
+
+#include <freeradius-devel/ldap/base.h>
+#include <freeradius-devel/unlang/base.h>
+#include <freeradius-devel/util/debug.h>
+#include <freeradius-devel/util/syserror.h>
+
+/** Compare two queries by msgid
+ *
+ */
+int fr_ldap_query_cmp(void const *one, void const *two)
+{
+	fr_ldap_query_t const *a = one, *b = two;
+
+	return (a->msgid > b->msgid) - (a->msgid < b->msgid);
+}
+
+/** Remove a query from the connection's tracking tree
+ *
+ */
+static inline void ldap_trunk_query_untrack(fr_ldap_connection_t *c, fr_ldap_query_t *query)
+{
+	if (!query->msgid) return;
+
+	(void) rbtree_deletebydata(c->queries, query);
+	query->msgid = 0;
+}
+
+/** The connection's fd errored, or was closed by the server
+ *
+ */
+static void _ldap_trunk_io_error(UNUSED fr_event_list_t *el, UNUSED int fd, UNUSED int flags, int fd_errno, void *uctx)
+{
+	fr_trunk_connection_t	*tconn = talloc_get_type_abort(uctx, fr_trunk_connection_t);
+	fr_connection_t		*conn = tconn->conn;
+
+	ERROR("Connection failed: %s", fr_syserror(fd_errno));
+
+	fr_connection_signal_reconnect(conn, FR_CONNECTION_FAILED);
+}
+
+static void _ldap_trunk_io_read(UNUSED fr_event_list_t *el, UNUSED int fd, UNUSED int flags, void *uctx)
+{
+	fr_trunk_connection_signal_readable(talloc_get_type_abort(uctx, fr_trunk_connection_t));
+}
+
+static void _ldap_trunk_io_write(UNUSED fr_event_list_t *el, UNUSED int fd, UNUSED int flags, void *uctx)
+{
+	fr_trunk_connection_signal_writable(talloc_get_type_abort(uctx, fr_trunk_connection_t));
+}
+
+static fr_connection_t *_ldap_trunk_connection_alloc(fr_trunk_connection_t *tconn, fr_event_list_t *el,
+						     fr_connection_conf_t const *conf,
+						     char const *log_prefix, void *uctx)
+{
+	fr_ldap_config_t const	*config = uctx;
+
+	return fr_ldap_connection_state_alloc(tconn, el, conf, config, log_prefix);
+}
+
+/** Install I/O handlers for the events the trunk is interested in
+ *
+ * We always read from the connection, even when there are no outstanding
+ * operations, so that we notice the server closing the connection, and
+ * process any unsolicited notifications.
+ */
+static void _ldap_trunk_connection_notify(fr_trunk_connection_t *tconn, fr_connection_t *conn,
+					  fr_event_list_t *el,
+					  fr_trunk_connection_event_t notify_on, UNUSED void *uctx)
+{
+	fr_ldap_connection_t	*c = talloc_get_type_abort(conn->h, fr_ldap_connection_t);
+	fr_event_fd_cb_t	write_fn = NULL;
+	int			fd = -1;
+
+	if ((ldap_get_option(c->handle, LDAP_OPT_DESC, &fd) != LDAP_OPT_SUCCESS) || (fd < 0)) {
+		ERROR("Failed retrieving file descriptor from libldap");
+		fr_trunk_connection_signal_reconnect(tconn, FR_CONNECTION_FAILED);
+		return;
+	}
+
+	switch (notify_on) {
+	case FR_TRUNK_CONN_EVENT_NONE:
+	case FR_TRUNK_CONN_EVENT_READ:
+		break;
+
+	case FR_TRUNK_CONN_EVENT_WRITE:
+	case FR_TRUNK_CONN_EVENT_BOTH:
+		write_fn = _ldap_trunk_io_write;
+		break;
+	}
+
+	if (fr_event_fd_insert(c, el, fd,
+			       _ldap_trunk_io_read,
+			       write_fn,
+			       _ldap_trunk_io_error,
+			       tconn) < 0) {
+		PERROR("Failed inserting FD event");
+		fr_trunk_connection_signal_reconnect(tconn, FR_CONNECTION_FAILED);
+	}
+}
+
+/** Send pending searches and binds
+ *
+ */
+static void _ldap_trunk_request_mux(UNUSED fr_event_list_t *el, fr_trunk_connection_t *tconn,
+				    fr_connection_t *conn, UNUSED void *uctx)
+{
+	fr_ldap_connection_t	*c = talloc_get_type_abort(conn->h, fr_ldap_connection_t);
+	fr_trunk_request_t	*treq;
+
+	for (;;) {
+		fr_ldap_query_t		*query;
+		REQUEST			*request;
+		LDAPControl		*our_serverctrls[LDAP_MAX_CONTROLS];
+		LDAPControl		*our_clientctrls[LDAP_MAX_CONTROLS];
+		struct berval		cred;
+		char			**search_attrs;
+		int			ret;
+
+		if (unlikely(fr_trunk_connection_pop_request(&treq, tconn) < 0)) return;
+
+		/*
+		 *	No more requests to send
+		 */
+		if (!treq) break;
+
+		query = talloc_get_type_abort(treq->preq, fr_ldap_query_t);
+		request = query->request;
+
+		fr_ldap_control_merge(our_serverctrls, our_clientctrls,
+				      NUM_ELEMENTS(our_serverctrls),
+				      NUM_ELEMENTS(our_clientctrls),
+				      c, query->serverctrls, NULL);
+
+		switch (query->type) {
+		case FR_LDAP_QUERY_SEARCH:
+			if (query->filter) {
+				RDEBUG2("Performing search in \"%s\" with filter \"%s\", scope \"%s\"",
+					query->dn, query->filter,
+					fr_table_str_by_value(fr_ldap_scope, query->scope, "<INVALID>"));
+			} else {
+				RDEBUG2("Performing unfiltered search in \"%s\", scope \"%s\"", query->dn,
+					fr_table_str_by_value(fr_ldap_scope, query->scope, "<INVALID>"));
+			}
+
+			memcpy(&search_attrs, &query->attrs, sizeof(query->attrs));
+			ret = ldap_search_ext(c->handle, query->dn, query->scope, query->filter, search_attrs,
+					      0, our_serverctrls, our_clientctrls, NULL, 0, &query->msgid);
+			break;
+
+		case FR_LDAP_QUERY_BIND:
+			RDEBUG2("Binding as \"%s\"", *query->dn ? query->dn : "(anonymous)");
+
+			if (query->password) {
+				memcpy(&cred.bv_val, &query->password, sizeof(cred.bv_val));
+				cred.bv_len = talloc_array_length(query->password) - 1;
+			} else {
+				cred.bv_val = NULL;
+				cred.bv_len = 0;
+			}
+
+			ret = ldap_sasl_bind(c->handle, query->dn, LDAP_SASL_SIMPLE, &cred,
+					     our_serverctrls, our_clientctrls, &query->msgid);
+			if (ret == LDAP_SUCCESS) c->rebound = true;
+			break;
+
+		default:
+			fr_assert(0);
+			ret = LDAP_PARAM_ERROR;
+			break;
+		}
+
+		switch (ret) {
+		case LDAP_SUCCESS:
+			break;
+
+		/*
+		 *	Leave the request where it is, the trunk
+		 *	will move it to another connection.
+		 */
+		case LDAP_SERVER_DOWN:
+		case LDAP_CONNECT_ERROR:
+			query->msgid = 0;
+			ERROR("Failed sending operation: %s", ldap_err2string(ret));
+			fr_trunk_connection_signal_reconnect(tconn, FR_CONNECTION_FAILED);
+			return;
+
+		default:
+			query->msgid = 0;
+			REDEBUG("Failed sending operation: %s", ldap_err2string(ret));
+			query->ret = LDAP_PROC_ERROR;
+			fr_trunk_request_signal_fail(treq);
+			continue;
+		}
+
+		if (!fr_cond_assert(rbtree_insert(c->queries, query))) {
+			query->msgid = 0;
+			query->ret = LDAP_PROC_ERROR;
+			fr_trunk_request_signal_fail(treq);
+			continue;
+		}
+
+		fr_trunk_request_signal_sent(treq);
+	}
+}
+
+/** Read any results which are available, and match them to queries
+ *
+ */
+static void _ldap_trunk_request_demux(UNUSED fr_trunk_connection_t *tconn, fr_connection_t *conn, UNUSED void *uctx)
+{
+	fr_ldap_connection_t	*c = talloc_get_type_abort(conn->h, fr_ldap_connection_t);
+
+	for (;;) {
+		fr_ldap_query_t		*query;
+		REQUEST			*request;
+		LDAPMessage		*result = NULL, *msg;
+		fr_ldap_rcode_t		status = LDAP_PROC_SUCCESS;
+		int			ret;
+
+		/*
+		 *	Zero timeout means libldap only reads what's
+		 *	available, it doesn't block waiting for more.
+		 */
+		ret = ldap_result(c->handle, LDAP_RES_ANY, LDAP_MSG_ALL, &fr_time_delta_to_timeval(0), &result);
+		switch (ret) {
+		case 0:		/* No more complete results */
+			return;
+
+		case -1:
+			(void) fr_ldap_error_check(NULL, c, NULL, NULL);
+			PERROR("Failed reading results");
+			fr_connection_signal_reconnect(conn, FR_CONNECTION_FAILED);
+			return;
+
+		default:
+			break;
+		}
+
+		query = rbtree_finddata(c->queries, &(fr_ldap_query_t){ .msgid = ldap_msgid(result) });
+		if (!query) {
+			DEBUG3("Discarding result for unknown msgid %i", ldap_msgid(result));
+			ldap_msgfree(result);
+			continue;
+		}
+		request = query->request;
+
+		for (msg = ldap_first_message(c->handle, result);
+		     msg;
+		     msg = ldap_next_message(c->handle, msg)) {
+			status = fr_ldap_error_check(NULL, c, msg, query->dn);
+			if (status != LDAP_PROC_SUCCESS) break;
+		}
+
+		switch (query->type) {
+		case FR_LDAP_QUERY_SEARCH:
+			switch (status) {
+			case LDAP_PROC_SUCCESS:
+				if (ldap_count_entries(c->handle, result) == 0) {
+					RDEBUG2("Search returned no results");
+					status = LDAP_PROC_NO_RESULT;
+					break;
+				}
+				/*
+				 *	libldap records parse errors in the
+				 *	handle, so results must be parsed
+				 *	here, with the handle of the
+				 *	connection that received them.
+				 */
+				if (query->parser) query->parser(c->handle, result, request, query->parser_uctx);
+				query->result = result;
+				result = NULL;
+				break;
+
+			case LDAP_PROC_BAD_DN:
+				RDEBUG2("DN %s does not exist", query->dn);
+				break;
+
+			default:
+				RPEDEBUG("Failed performing search");
+				break;
+			}
+			break;
+
+		case FR_LDAP_QUERY_BIND:
+			if (status != LDAP_PROC_SUCCESS) {
+				RPEDEBUG("Bind as \"%s\" failed", *query->dn ? query->dn : "(anonymous)");
+			}
+			break;
+		}
+		if (result) ldap_msgfree(result);
+
+		query->ret = status;
+		ldap_trunk_query_untrack(c, query);
+		fr_trunk_request_signal_complete(query->treq);
+	}
+}
+
+/** Stop tracking a query, abandoning it if it was cancelled
+ *
+ * Binds can't be abandoned (RFC 4511 section 4.11), and the connection can't
+ * be used for anything else until the server has finished processing the
+ * bind.  So instead the connection is closed and re-opened.
+ */
+static void _ldap_trunk_request_cancel(fr_connection_t *conn, void *preq,
+				       fr_trunk_cancel_reason_t reason, UNUSED void *uctx)
+{
+	fr_ldap_query_t		*query = talloc_get_type_abort(preq, fr_ldap_query_t);
+	fr_ldap_connection_t	*c;
+	int			msgid = query->msgid;
+
+	if (!conn->h) return;
+	c = talloc_get_type_abort(conn->h, fr_ldap_connection_t);
+
+	ldap_trunk_query_untrack(c, query);
+
+	if ((reason != FR_TRUNK_CANCEL_REASON_SIGNAL) || !msgid) return;
+
+	switch (query->type) {
+	/*
+	 *	The trunk pauses connection signals while
+	 *	cancelling, so the reconnect happens once
+	 *	the request has been removed.
+	 */
+	case FR_LDAP_QUERY_BIND:
+		fr_connection_signal_reconnect(conn, FR_CONNECTION_FAILED);
+		break;
+
+	/*
+	 *	Tell the server not to bother, and libldap
+	 *	to discard the result if it arrives anyway.
+	 */
+	case FR_LDAP_QUERY_SEARCH:
+		(void) ldap_abandon_ext(c->handle, msgid, NULL, NULL);
+		break;
+	}
+}
+
+static void _ldap_trunk_request_conn_release(fr_connection_t *conn, void *preq, UNUSED void *uctx)
+{
+	fr_ldap_query_t		*query = talloc_get_type_abort(preq, fr_ldap_query_t);
+
+	if (!conn->h) return;
+
+	ldap_trunk_query_untrack(talloc_get_type_abort(conn->h, fr_ldap_connection_t), query);
+}
+
+static void _ldap_trunk_request_complete(REQUEST *request, void *preq, UNUSED void *rctx, UNUSED void *uctx)
+{
+	fr_ldap_query_t		*query = talloc_get_type_abort(preq, fr_ldap_query_t);
+
+	query->treq = NULL;
+
+	unlang_interpret_resumable(request);
+}
+
+static void _ldap_trunk_request_fail(REQUEST *request, void *preq, UNUSED void *rctx,
+				     UNUSED fr_trunk_request_state_t state, UNUSED void *uctx)
+{
+	fr_ldap_query_t		*query = talloc_get_type_abort(preq, fr_ldap_query_t);
+
+	query->treq = NULL;
+
+	unlang_interpret_resumable(request);
+}
+
+/** Allocate a trunk of connections to an LDAP server
+ *
+ * @param[in] ctx		to allocate the trunk in.
+ * @param[in] el		to insert I/O and timer events into.
+ * @param[in] config		LDAP connection configuration.  Must outlive the trunk.
+ * @param[in] conf		Trunk configuration.  If the trunk will be used for binds
+ *				`max_req_per_conn` must be 1.
+ * @param[in] log_prefix	to prepend to connection state messages.
+ * @return
+ *	- A new trunk on success.
+ *	- NULL on failure.
+ */
+fr_trunk_t *fr_ldap_trunk_alloc(TALLOC_CTX *ctx, fr_event_list_t *el, fr_ldap_config_t const *config,
+				fr_trunk_conf_t const *conf, char const *log_prefix)
+{
+	static fr_trunk_io_funcs_t	io_funcs = {
+						.connection_alloc = _ldap_trunk_connection_alloc,
+						.connection_notify = _ldap_trunk_connection_notify,
+						.request_mux = _ldap_trunk_request_mux,
+						.request_demux = _ldap_trunk_request_demux,
+						.request_cancel = _ldap_trunk_request_cancel,
+						.request_conn_release = _ldap_trunk_request_conn_release,
+						.request_complete = _ldap_trunk_request_complete,
+						.request_fail = _ldap_trunk_request_fail
+					};
+
+	return fr_trunk_alloc(ctx, el, &io_funcs, conf, log_prefix, config, false);
+}
+
+/** Cancel the query if it's freed while outstanding
+ *
+ */
+static int _ldap_query_free(fr_ldap_query_t *query)
+{
+	fr_ldap_trunk_query_cancel(query);
+
+	if (query->result) ldap_msgfree(query->result);
+
+	return 0;
+}
+
+static fr_ldap_query_t *ldap_trunk_query_alloc(TALLOC_CTX *ctx, REQUEST *request, fr_ldap_query_type_t type,
+					       char const *dn, LDAPControl **serverctrls)
+{
+	fr_ldap_query_t	*query;
+	size_t		i;
+
+	MEM(query = talloc_zero(ctx, fr_ldap_query_t));
+	talloc_set_destructor(query, _ldap_query_free);
+
+	query->type = type;
+	query->request = request;
+	query->ret = LDAP_PROC_BAD_CONN;	/* If the trunk fails the query, there was no usable connection */
+	query->dn = talloc_strdup(query, dn ? dn : "");
+
+	if (serverctrls) for (i = 0; serverctrls[i] && (i < LDAP_MAX_CONTROLS); i++) {
+		query->serverctrls[i] = serverctrls[i];
+	}
+
+	return query;
+}
+
+/** Allocate a search to run over a trunk
+ *
+ * @param[in] ctx		to allocate the query in.
+ * @param[in] request		the search is being run for.
+ * @param[in] base_dn		to search under.
+ * @param[in] scope		of the search.
+ * @param[in] filter		to apply to objects found.  May be NULL.
+ * @param[in] attrs		to retrieve.  May be NULL.  Must remain valid until the query completes.
+ * @param[in] serverctrls	Extra controls to send.  May be NULL.  Must remain valid until the
+ *				query completes.
+ * @return a new query.
+ */
+fr_ldap_query_t *fr_ldap_trunk_search_alloc(TALLOC_CTX *ctx, REQUEST *request,
+					    char const *base_dn, int scope, char const *filter,
+					    char const * const *attrs, LDAPControl **serverctrls)
+{
+	fr_ldap_query_t	*query;
+
+	query = ldap_trunk_query_alloc(ctx, request, FR_LDAP_QUERY_SEARCH, base_dn, serverctrls);
+	query->scope = scope;
+	if (filter) query->filter = talloc_strdup(query, filter);
+	query->attrs = attrs;
+
+	return query;
+}
+
+/** Allocate a simple bind to run over a trunk
+ *
+ * @param[in] ctx		to allocate the query in.
+ * @param[in] request		the bind is being performed for.
+ * @param[in] bind_dn		to bind as.  May be NULL to bind anonymously.
+ * @param[in] password		to bind with.  May be NULL.
+ * @param[in] serverctrls	Extra controls to send.  May be NULL.  Must remain valid until the
+ *				query completes.
+ * @return a new query.
+ */
+fr_ldap_query_t *fr_ldap_trunk_bind_alloc(TALLOC_CTX *ctx, REQUEST *request,
+					  char const *bind_dn, char const *password, LDAPControl **serverctrls)
+{
+	fr_ldap_query_t	*query;
+
+	query = ldap_trunk_query_alloc(ctx, request, FR_LDAP_QUERY_BIND, bind_dn, serverctrls);
+	if (password) query->password = talloc_strdup(query, password);
+
+	return query;
+}
+
+/** Enqueue a query, the request is marked resumable when it completes
+ *
+ * When the request resumes query->ret contains the result of the operation,
+ * and for successful searches, query->result contains the objects found.
+ *
+ * @param[in] trunk	to enqueue the query on.
+ * @param[in] query	to enqueue.
+ * @return
+ *	- 0 on success.
+ *	- -1 on failure.
+ */
+int fr_ldap_trunk_query_enqueue(fr_trunk_t *trunk, fr_ldap_query_t *query)
+{
+	REQUEST			*request = query->request;
+	fr_trunk_request_t	*treq;
+
+	treq = fr_trunk_request_alloc(trunk, request);
+	if (!treq) {
+		REDEBUG("Failed allocating trunk request");
+		return -1;
+	}
+
+	switch (fr_trunk_request_enqueue(&treq, trunk, request, query, NULL)) {
+	case FR_TRUNK_ENQUEUE_OK:
+	case FR_TRUNK_ENQUEUE_IN_BACKLOG:
+		break;
+
+	default:
+		REDEBUG("Failed enqueueing LDAP operation");
+		fr_trunk_request_free(&treq);
+		return -1;
+	}
+	query->treq = treq;
+
+	return 0;
+}
+
+/** Cancel a query which has not yet completed
+ *
+ * @param[in] query	to cancel.
+ */
+void fr_ldap_trunk_query_cancel(fr_ldap_query_t *query)
+{
+	if (!query->treq) return;
+
+	fr_trunk_request_signal_cancel(query->treq);
+	query->treq = NULL;
+}
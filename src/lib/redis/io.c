@@ -54,15 +54,52 @@ static void _redis_disconnected(redisAsyncContext const *ac, UNUSED int status)
 	fr_connection_signal_reconnect(conn, FR_CONNECTION_FAILED);
 }
 
+/** Called by hiredis with the result of the AUTH or SELECT commands
+ *
+ * The commands are sent before any others on the connection, and
+ * Redis processes commands in order, so there's no need to wait for
+ * these replies before signalling the connection is open.
+ */
+static void _redis_setup_reply(redisAsyncContext *ac, void *vreply, void *privdata)
+{
+	fr_connection_t		*conn = talloc_get_type_abort(ac->data, fr_connection_t);
+	redisReply		*reply = vreply;
+	char const		*cmd = privdata;
+
+	if (!reply) return;	/* Connection is being freed */
+
+	if (reply->type == REDIS_REPLY_ERROR) {
+		ERROR("%s failed: %s", cmd, reply->str);
+		fr_connection_signal_reconnect(conn, FR_CONNECTION_FAILED);
+	}
+
+#ifdef REDIS_NO_AUTO_FREE_REPLIES
+	fr_redis_reply_free(&reply);
+#endif
+}
+
 /** Called by hiredis to indicate the connection is live
  *
  */
 static void _redis_connected(redisAsyncContext const *ac, UNUSED int status)
 {
 	fr_connection_t		*conn = talloc_get_type_abort(ac->data, fr_connection_t);
+	fr_redis_handle_t	*h = conn->h;
+	redisAsyncContext	*our_ac;
 
 	DEBUG4("Signalled by hiredis, connection is open");
 
+	memcpy(&our_ac, &ac, sizeof(our_ac));	/* const issues */
+
+	if (h->conf->password) {
+		DEBUG3("Executing: AUTH");
+		redisAsyncCommand(our_ac, _redis_setup_reply, "AUTH", "AUTH %s", h->conf->password);
+	}
+	if (h->conf->database) {
+		DEBUG3("Executing: SELECT %u", h->conf->database);
+		redisAsyncCommand(our_ac, _redis_setup_reply, "SELECT", "SELECT %u", h->conf->database);
+	}
+
 	fr_connection_signal_connected(conn);
 }
 
@@ -320,6 +357,7 @@ static fr_connection_state_t _redis_io_connection_init(void **h_out, fr_connecti
 		return FR_CONNECTION_STATE_FAILED;
 	}
 	talloc_set_destructor(h, _redis_handle_free);
+	h->conf = conf;
 
 	h->ac = redisAsyncConnect(host, port);
 	if (!h->ac) {
@@ -327,6 +365,14 @@ static fr_connection_state_t _redis_io_connection_init(void **h_out, fr_connecti
 		return FR_CONNECTION_STATE_FAILED;
 	}
 
+#ifdef REDIS_NO_AUTO_FREE_REPLIES
+	/*
+	 *	Replies are retained until all the commands
+	 *	in a command set have been processed.
+	 */
+	h->ac->c.flags |= REDIS_NO_AUTO_FREE_REPLIES;
+#endif
+
 	if (h->ac->err) {
 		ERROR("Failed allocating handle for %s:%u: %s", host, port, h->ac->errstr);
 	error:
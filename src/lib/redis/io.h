@@ -73,6 +73,8 @@ typedef struct {
 
 	redisAsyncContext	*ac;			//!< Async handle for hiredis.
 
+	fr_redis_io_conf_t const *conf;			//!< The configuration the handle was created with.
+
 	fr_dlist_head_t		ignore;			//!< Contains SQNs for responses that should be ignored.
 
 	fr_redis_sqn_t		req_sqn;		//!< Current redis request number.
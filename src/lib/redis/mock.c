@@ -0,0 +1,716 @@
+/*
+ *   This program is is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or (at
+ *   your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ */
+
+/**
+ * $Id$
+ * @file lib/redis/mock.c
+ * @brief A minimal RESP server for testing and benchmarking the redis pipeline code
+ *
+ * Speaks just enough of the Redis protocol to exercise the pipelining code,
+ * and the modules built on it, without a running redis-server.
+ *
+ * - PING, ECHO, SET, GET, DEL and INCR operate on an in memory keyspace.
+ * - AUTH, SELECT, READONLY and READWRITE always succeed.
+ * - WAIT reports that the requested number of replicas acknowledged the write.
+ * - SCRIPT LOAD records the SHA1 digest of the script.
+ * - EVALSHA returns -NOSCRIPT for unknown scripts, and a canned successful
+ *   lease reply (rcode, address, range, expiry) for known scripts.
+ * - MULTI, EXEC and DISCARD queue commands as Redis does.
+ *
+ * Everything runs in the event list passed to #fr_redis_mock_alloc, so the
+ * mock can share an event loop with the client code under test.
+ *
+ * @copyright 2020 The FreeRADIUS server project
+ */
+RCSID("$Id$")
+
+#include <freeradius-devel/util/debug.h>
+#include <freeradius-devel/util/hash.h>
+#include <freeradius-devel/util/misc.h>
+#include <freeradius-devel/util/sha1.h>
+#include <freeradius-devel/util/socket.h>
+#include <freeradius-devel/util/syserror.h>
+
+#include "mock.h"
+
+#define MOCK_MAX_ARGS	64		//!< Maximum number of arguments in a command.
+#define MOCK_READ_SIZE	65536		//!< How much we read at a time.
+
+struct fr_redis_mock_s {
+	fr_event_list_t		*el;		//!< Event list the server and clients run in.
+	int			fd;		//!< Listening socket.
+	uint16_t		port;		//!< Port we're listening on.
+
+	fr_hash_table_t		*keys;		//!< In memory keyspace.
+	fr_hash_table_t		*scripts;	//!< Digests of scripts loaded with SCRIPT LOAD.
+
+	uint32_t		lease;		//!< Counter used to generate lease addresses.
+
+	fr_redis_mock_stats_t	stats;
+};
+
+/** A key/value pair, or a script digest
+ *
+ */
+typedef struct {
+	uint8_t			*key;
+	size_t			key_len;
+	uint8_t			*value;
+	size_t			value_len;
+} mock_entry_t;
+
+/** A growable buffer
+ *
+ */
+typedef struct {
+	uint8_t			*data;
+	size_t			used;
+} mock_buff_t;
+
+/** A client connection
+ *
+ */
+typedef struct {
+	fr_redis_mock_t		*mock;
+	int			fd;
+
+	mock_buff_t		in;		//!< Data read from the client, not yet processed.
+	mock_buff_t		out;		//!< Replies not yet written to the client.
+	size_t			out_sent;	//!< How much of out has been written.
+
+	mock_buff_t		txn;		//!< Replies for commands queued after MULTI.
+	unsigned int		txn_count;	//!< Number of queued commands.
+	bool			in_multi;	//!< Between MULTI and EXEC/DISCARD.
+
+	bool			write_set;	//!< We're listening for writes.
+} mock_client_t;
+
+typedef void (*mock_cmd_func_t)(fr_redis_mock_t *mock, mock_buff_t *out,
+				int argc, uint8_t const *argv[], size_t const argvlen[]);
+
+typedef struct {
+	char const		*name;
+	int			min_argc;	//!< Including the command name.
+	mock_cmd_func_t		func;
+} mock_cmd_t;
+
+static void mock_client_io_read(fr_event_list_t *el, int fd, int flags, void *uctx);
+
+static uint32_t mock_entry_hash(void const *data)
+{
+	mock_entry_t const *entry = data;
+
+	return fr_hash(entry->key, entry->key_len);
+}
+
+static int mock_entry_cmp(void const *one, void const *two)
+{
+	mock_entry_t const *a = one, *b = two;
+
+	if (a->key_len != b->key_len) return (a->key_len > b->key_len) - (a->key_len < b->key_len);
+
+	return memcmp(a->key, b->key, a->key_len);
+}
+
+static void mock_entry_free(void *data)
+{
+	talloc_free(data);
+}
+
+/** Append data to a buffer, growing it as needed
+ *
+ */
+static void mock_buff_append(TALLOC_CTX *ctx, mock_buff_t *buff, void const *data, size_t len)
+{
+	size_t size = talloc_array_length(buff->data);
+
+	if ((buff->used + len) > size) {
+		size = (size * 2) > (buff->used + len) ? (size * 2) : (buff->used + len);
+		MEM(buff->data = talloc_realloc(ctx, buff->data, uint8_t, size));
+	}
+
+	memcpy(buff->data + buff->used, data, len);
+	buff->used += len;
+}
+
+static void mock_reply_header(mock_buff_t *out, char type, int64_t num)
+{
+	char	tmp[32];
+	int	len;
+
+	len = snprintf(tmp, sizeof(tmp), "%c%" PRId64 "\r\n", type, num);
+	mock_buff_append(NULL, out, tmp, (size_t)len);
+}
+
+static void mock_reply_status(mock_buff_t *out, char const *status)
+{
+	mock_buff_append(NULL, out, "+", 1);
+	mock_buff_append(NULL, out, status, strlen(status));
+	mock_buff_append(NULL, out, "\r\n", 2);
+}
+
+static void mock_reply_error(mock_buff_t *out, char const *error)
+{
+	mock_buff_append(NULL, out, "-", 1);
+	mock_buff_append(NULL, out, error, strlen(error));
+	mock_buff_append(NULL, out, "\r\n", 2);
+}
+
+static void mock_reply_integer(mock_buff_t *out, int64_t num)
+{
+	mock_reply_header(out, ':', num);
+}
+
+static void mock_reply_bulk(mock_buff_t *out, void const *data, size_t len)
+{
+	mock_reply_header(out, '$', (int64_t)len);
+	mock_buff_append(NULL, out, data, len);
+	mock_buff_append(NULL, out, "\r\n", 2);
+}
+
+static void mock_reply_nil(mock_buff_t *out)
+{
+	mock_reply_header(out, '$', -1);
+}
+
+static int64_t mock_arg_integer(uint8_t const *arg, size_t len)
+{
+	char	tmp[32];
+
+	if (len >= sizeof(tmp)) return 0;
+	memcpy(tmp, arg, len);
+	tmp[len] = '\0';
+
+	return strtoll(tmp, NULL, 10);
+}
+
+static void mock_cmd_ok(UNUSED fr_redis_mock_t *mock, mock_buff_t *out,
+			UNUSED int argc, UNUSED uint8_t const *argv[], UNUSED size_t const argvlen[])
+{
+	mock_reply_status(out, "OK");
+}
+
+static void mock_cmd_ping(UNUSED fr_redis_mock_t *mock, mock_buff_t *out,
+			  int argc, uint8_t const *argv[], size_t const argvlen[])
+{
+	if (argc > 1) {
+		mock_reply_bulk(out, argv[1], argvlen[1]);
+		return;
+	}
+	mock_reply_status(out, "PONG");
+}
+
+static void mock_cmd_echo(UNUSED fr_redis_mock_t *mock, mock_buff_t *out,
+			  UNUSED int argc, uint8_t const *argv[], size_t const argvlen[])
+{
+	mock_reply_bulk(out, argv[1], argvlen[1]);
+}
+
+static void mock_cmd_set(fr_redis_mock_t *mock, mock_buff_t *out,
+			 UNUSED int argc, uint8_t const *argv[], size_t const argvlen[])
+{
+	mock_entry_t	*entry;
+
+	MEM(entry = talloc_zero(mock->keys, mock_entry_t));
+	MEM(entry->key = talloc_memdup(entry, argv[1], argvlen[1]));
+	entry->key_len = argvlen[1];
+	MEM(entry->value = talloc_memdup(entry, argv[2], argvlen[2]));
+	entry->value_len = argvlen[2];
+
+	fr_hash_table_replace(mock->keys, entry);
+
+	mock_reply_status(out, "OK");
+}
+
+static void mock_cmd_get(fr_redis_mock_t *mock, mock_buff_t *out,
+			 UNUSED int argc, uint8_t const *argv[], size_t const argvlen[])
+{
+	mock_entry_t	find, *entry;
+
+	memcpy(&find.key, &argv[1], sizeof(find.key));
+	find.key_len = argvlen[1];
+
+	entry = fr_hash_table_finddata(mock->keys, &find);
+	if (!entry) {
+		mock_reply_nil(out);
+		return;
+	}
+	mock_reply_bulk(out, entry->value, entry->value_len);
+}
+
+static void mock_cmd_del(fr_redis_mock_t *mock, mock_buff_t *out,
+			 int argc, uint8_t const *argv[], size_t const argvlen[])
+{
+	mock_entry_t	find;
+	int		i, deleted = 0;
+
+	for (i = 1; i < argc; i++) {
+		memcpy(&find.key, &argv[i], sizeof(find.key));
+		find.key_len = argvlen[i];
+
+		if (fr_hash_table_delete(mock->keys, &find)) deleted++;
+	}
+
+	mock_reply_integer(out, deleted);
+}
+
+static void mock_cmd_incr(fr_redis_mock_t *mock, mock_buff_t *out,
+			  UNUSED int argc, uint8_t const *argv[], size_t const argvlen[])
+{
+	mock_entry_t	find, *entry;
+	int64_t		num = 0;
+	char		tmp[32];
+	int		len;
+
+	memcpy(&find.key, &argv[1], sizeof(find.key));
+	find.key_len = argvlen[1];
+
+	entry = fr_hash_table_finddata(mock->keys, &find);
+	if (entry) num = mock_arg_integer(entry->value, entry->value_len);
+	num++;
+
+	len = snprintf(tmp, sizeof(tmp), "%" PRId64, num);
+
+	MEM(entry = talloc_zero(mock->keys, mock_entry_t));
+	MEM(entry->key = talloc_memdup(entry, argv[1], argvlen[1]));
+	entry->key_len = argvlen[1];
+	MEM(entry->value = talloc_memdup(entry, tmp, (size_t)len));
+	entry->value_len = (size_t)len;
+	fr_hash_table_replace(mock->keys, entry);
+
+	mock_reply_integer(out, num);
+}
+
+static void mock_cmd_wait(UNUSED fr_redis_mock_t *mock, mock_buff_t *out,
+			  UNUSED int argc, uint8_t const *argv[], size_t const argvlen[])
+{
+	mock_reply_integer(out, mock_arg_integer(argv[1], argvlen[1]));
+}
+
+static void mock_cmd_script(fr_redis_mock_t *mock, mock_buff_t *out,
+			    int argc, uint8_t const *argv[], size_t const argvlen[])
+{
+	fr_sha1_ctx	sha1_ctx;
+	uint8_t		digest[SHA1_DIGEST_LENGTH];
+	char		hex[(SHA1_DIGEST_LENGTH * 2) + 1];
+	mock_entry_t	*entry;
+
+	if ((argvlen[1] != 4) || (strncasecmp((char const *)argv[1], "load", 4) != 0) || (argc < 3)) {
+		mock_reply_error(out, "ERR Unknown SCRIPT subcommand or wrong number of arguments");
+		return;
+	}
+
+	fr_sha1_init(&sha1_ctx);
+	fr_sha1_update(&sha1_ctx, argv[2], argvlen[2]);
+	fr_sha1_final(digest, &sha1_ctx);
+	fr_bin2hex(hex, digest, sizeof(digest));
+
+	MEM(entry = talloc_zero(mock->scripts, mock_entry_t));
+	MEM(entry->key = talloc_memdup(entry, hex, sizeof(hex) - 1));
+	entry->key_len = sizeof(hex) - 1;
+	fr_hash_table_replace(mock->scripts, entry);
+
+	mock_reply_bulk(out, hex, sizeof(hex) - 1);
+}
+
+static void mock_cmd_evalsha(fr_redis_mock_t *mock, mock_buff_t *out,
+			     int argc, uint8_t const *argv[], size_t const argvlen[])
+{
+	mock_entry_t	find;
+	char		ip[16];
+	int		len;
+	uint32_t	lease;
+
+	memcpy(&find.key, &argv[1], sizeof(find.key));
+	find.key_len = argvlen[1];
+
+	if (!fr_hash_table_finddata(mock->scripts, &find)) {
+		mock_reply_error(out, "NOSCRIPT No matching script. Please use EVAL.");
+		return;
+	}
+
+	lease = mock->lease++;
+	len = snprintf(ip, sizeof(ip), "10.%u.%u.%u",
+		       (lease >> 16) & 0xff, (lease >> 8) & 0xff, lease & 0xff);
+
+	mock_reply_header(out, '*', 4);
+	mock_reply_integer(out, 0);
+	mock_reply_bulk(out, ip, (size_t)len);
+	mock_reply_bulk(out, "mock", 4);
+	mock_reply_integer(out, (argc > 5) ? mock_arg_integer(argv[5], argvlen[5]) : 0);
+}
+
+static mock_cmd_t const mock_cmds[] = {
+	{ "AUTH",	2, mock_cmd_ok },
+	{ "DEL",	2, mock_cmd_del },
+	{ "ECHO",	2, mock_cmd_echo },
+	{ "EVALSHA",	3, mock_cmd_evalsha },
+	{ "GET",	2, mock_cmd_get },
+	{ "INCR",	2, mock_cmd_incr },
+	{ "PING",	1, mock_cmd_ping },
+	{ "READONLY",	1, mock_cmd_ok },
+	{ "READWRITE",	1, mock_cmd_ok },
+	{ "SCRIPT",	2, mock_cmd_script },
+	{ "SELECT",	2, mock_cmd_ok },
+	{ "SET",	3, mock_cmd_set },
+	{ "WAIT",	3, mock_cmd_wait },
+	{ NULL }
+};
+
+#define CMD_IS(_str) ((argvlen[0] == (sizeof(_str) - 1)) && \
+		      (strncasecmp((char const *)argv[0], _str, sizeof(_str) - 1) == 0))
+
+/** Execute a single command, writing the reply to the client's output buffer
+ *
+ */
+static void mock_command(mock_client_t *client, int argc, uint8_t const *argv[], size_t const argvlen[])
+{
+	fr_redis_mock_t		*mock = client->mock;
+	mock_cmd_t const	*cmd;
+
+	mock->stats.commands++;
+
+	if (CMD_IS("MULTI")) {
+		if (client->in_multi) {
+			mock_reply_error(&client->out, "ERR MULTI calls can not be nested");
+			return;
+		}
+		client->in_multi = true;
+		mock_reply_status(&client->out, "OK");
+		return;
+	}
+
+	if (CMD_IS("EXEC")) {
+		if (!client->in_multi) {
+			mock_reply_error(&client->out, "ERR EXEC without MULTI");
+			return;
+		}
+		mock_reply_header(&client->out, '*', client->txn_count);
+		mock_buff_append(client, &client->out, client->txn.data, client->txn.used);
+	reset:
+		client->txn.used = 0;
+		client->txn_count = 0;
+		client->in_multi = false;
+		return;
+	}
+
+	if (CMD_IS("DISCARD")) {
+		if (!client->in_multi) {
+			mock_reply_error(&client->out, "ERR DISCARD without MULTI");
+			return;
+		}
+		mock_reply_status(&client->out, "OK");
+		goto reset;
+	}
+
+	for (cmd = mock_cmds; cmd->name; cmd++) {
+		if ((strlen(cmd->name) != argvlen[0]) ||
+		    (strncasecmp(cmd->name, (char const *)argv[0], argvlen[0]) != 0)) continue;
+
+		if (argc < cmd->min_argc) {
+			mock_reply_error(&client->out, "ERR wrong number of arguments");
+			return;
+		}
+
+		if (client->in_multi) {
+			cmd->func(mock, &client->txn, argc, argv, argvlen);
+			client->txn_count++;
+			mock_reply_status(&client->out, "QUEUED");
+			return;
+		}
+
+		cmd->func(mock, &client->out, argc, argv, argvlen);
+		return;
+	}
+
+	mock_reply_error(&client->out, "ERR unknown command");
+}
+
+/** Parse a single command in RESP format
+ *
+ * Only arrays of bulk strings are accepted, which is what all clients send.
+ *
+ * @return
+ *	- >0 the number of bytes consumed.
+ *	- 0 if more data is needed.
+ *	- -1 on protocol error.
+ */
+static ssize_t mock_parse(int *argc, uint8_t const *argv[], size_t argvlen[], uint8_t const *in, size_t inlen)
+{
+	uint8_t const	*p = in, *end = in + inlen, *eol;
+	char		*q;
+	long		num, len, i;
+
+	if (inlen == 0) return 0;
+	if (*p != '*') return -1;
+
+	eol = memchr(p, '\n', end - p);
+	if (!eol) return 0;
+
+	num = strtol((char const *)p + 1, &q, 10);
+	if (((uint8_t const *)q != (eol - 1)) || (num <= 0) || (num > MOCK_MAX_ARGS)) return -1;
+	p = eol + 1;
+
+	for (i = 0; i < num; i++) {
+		if (p >= end) return 0;
+		if (*p != '$') return -1;
+
+		eol = memchr(p, '\n', end - p);
+		if (!eol) return 0;
+
+		len = strtol((char const *)p + 1, &q, 10);
+		if (((uint8_t const *)q != (eol - 1)) || (len < 0)) return -1;
+		p = eol + 1;
+
+		if ((end - p) < (len + 2)) return 0;
+		argv[i] = p;
+		argvlen[i] = (size_t)len;
+		p += len + 2;
+	}
+
+	*argc = (int)num;
+
+	return p - in;
+}
+
+static int _mock_client_free(mock_client_t *client)
+{
+	fr_event_fd_delete(client->mock->el, client->fd, FR_EVENT_FILTER_IO);
+	close(client->fd);
+
+	return 0;
+}
+
+static void mock_client_error(UNUSED fr_event_list_t *el, UNUSED int fd, UNUSED int flags,
+			      UNUSED int fd_errno, void *uctx)
+{
+	talloc_free(uctx);
+}
+
+/** Write as much of the output buffer as we can
+ *
+ * @return
+ *	- 0 on success.
+ *	- -1 if the client was freed.
+ */
+static int mock_client_flush(mock_client_t *client)
+{
+	ssize_t		slen;
+	bool		write_set;
+
+	while (client->out_sent < client->out.used) {
+		slen = write(client->fd, client->out.data + client->out_sent, client->out.used - client->out_sent);
+		if (slen < 0) {
+			if ((errno == EAGAIN) || (errno == EWOULDBLOCK)) break;
+			if (errno == EINTR) continue;
+
+			talloc_free(client);
+			return -1;
+		}
+		client->out_sent += slen;
+	}
+
+	if (client->out_sent == client->out.used) {
+		client->out_sent = 0;
+		client->out.used = 0;
+	}
+
+	write_set = (client->out.used > 0);
+	if (write_set == client->write_set) return 0;
+
+	if (fr_event_fd_insert(client, client->mock->el, client->fd,
+			       mock_client_io_read,
+			       write_set ? mock_client_io_read : NULL,
+			       mock_client_error, client) < 0) {
+		talloc_free(client);
+		return -1;
+	}
+	client->write_set = write_set;
+
+	return 0;
+}
+
+/** Read and process commands from the client, and write out any replies
+ *
+ * Also used as the write callback, as processing is a no-op if there's
+ * no new data.
+ */
+static void mock_client_io_read(UNUSED fr_event_list_t *el, UNUSED int fd, UNUSED int flags, void *uctx)
+{
+	mock_client_t	*client = talloc_get_type_abort(uctx, mock_client_t);
+	ssize_t		slen;
+	size_t		size;
+	uint8_t const	*argv[MOCK_MAX_ARGS];
+	size_t		argvlen[MOCK_MAX_ARGS];
+	int		argc;
+	size_t		consumed = 0;
+
+	size = talloc_array_length(client->in.data);
+	if ((size - client->in.used) < MOCK_READ_SIZE) {
+		MEM(client->in.data = talloc_realloc(client, client->in.data, uint8_t, client->in.used + MOCK_READ_SIZE));
+	}
+
+	slen = read(client->fd, client->in.data + client->in.used, MOCK_READ_SIZE);
+	if (slen == 0) {
+	close:
+		talloc_free(client);
+		return;
+	}
+	if (slen < 0) {
+		if ((errno != EAGAIN) && (errno != EWOULDBLOCK) && (errno != EINTR)) goto close;
+		slen = 0;
+	}
+	if (slen > 0) client->mock->stats.reads++;
+	client->in.used += slen;
+
+	/*
+	 *	Process all the complete commands we've
+	 *	received.  Pipelined commands arrive
+	 *	together, and their replies are written
+	 *	out together.
+	 */
+	for (;;) {
+		slen = mock_parse(&argc, argv, argvlen, client->in.data + consumed, client->in.used - consumed);
+		if (slen < 0) {
+			mock_reply_error(&client->out, "ERR Protocol error");
+			(void) mock_client_flush(client);
+			goto close;
+		}
+		if (slen == 0) break;
+
+		mock_command(client, argc, argv, argvlen);
+		consumed += slen;
+	}
+
+	if (consumed) {
+		memmove(client->in.data, client->in.data + consumed, client->in.used - consumed);
+		client->in.used -= consumed;
+	}
+
+	(void) mock_client_flush(client);
+}
+
+/** Accept new client connections
+ *
+ */
+static void mock_accept(UNUSED fr_event_list_t *el, UNUSED int fd, UNUSED int flags, void *uctx)
+{
+	fr_redis_mock_t		*mock = talloc_get_type_abort(uctx, fr_redis_mock_t);
+	mock_client_t		*client;
+	int			client_fd;
+
+	for (;;) {
+		client_fd = accept(mock->fd, NULL, NULL);
+		if (client_fd < 0) {
+			if ((errno != EAGAIN) && (errno != EWOULDBLOCK) && (errno != EINTR)) {
+				ERROR("redis mock - Failed accepting connection: %s", fr_syserror(errno));
+			}
+			return;
+		}
+
+		if (fr_nonblock(client_fd) < 0) {
+			close(client_fd);
+			continue;
+		}
+
+		MEM(client = talloc_zero(mock, mock_client_t));
+		client->mock = mock;
+		client->fd = client_fd;
+
+		if (fr_event_fd_insert(client, mock->el, client_fd,
+				       mock_client_io_read, NULL, mock_client_error, client) < 0) {
+			PERROR("redis mock - Failed inserting client FD");
+			close(client_fd);
+			talloc_free(client);
+			continue;
+		}
+		talloc_set_destructor(client, _mock_client_free);
+
+		mock->stats.connections++;
+	}
+}
+
+static int _mock_free(fr_redis_mock_t *mock)
+{
+	fr_event_fd_delete(mock->el, mock->fd, FR_EVENT_FILTER_IO);
+	close(mock->fd);
+
+	return 0;
+}
+
+/** Allocate a new mock server listening on the specified address and port
+ *
+ * @param[in] ctx	to allocate the server in.  Freeing the server closes
+ *			all client connections.
+ * @param[in] el	to run the server in.
+ * @param[in] ipaddr	to listen on.
+ * @param[in] port	to listen on.  0 to pick an ephemeral port, which
+ *			can be retrieved with #fr_redis_mock_port.
+ * @return
+ *	- A new mock server.
+ *	- NULL on error.
+ */
+fr_redis_mock_t *fr_redis_mock_alloc(TALLOC_CTX *ctx, fr_event_list_t *el,
+				     fr_ipaddr_t const *ipaddr, uint16_t port)
+{
+	fr_redis_mock_t	*mock;
+	int		fd;
+
+	fd = fr_socket_server_tcp(ipaddr, &port, NULL, true);
+	if (fd < 0) return NULL;
+
+	if (fr_socket_bind(fd, ipaddr, &port, NULL) < 0) {
+	error:
+		close(fd);
+		return NULL;
+	}
+
+	if (listen(fd, 128) < 0) {
+		fr_strerror_printf("Failed listening on socket: %s", fr_syserror(errno));
+		goto error;
+	}
+
+	MEM(mock = talloc_zero(ctx, fr_redis_mock_t));
+	mock->el = el;
+	mock->fd = fd;
+	mock->port = port;
+	MEM(mock->keys = fr_hash_table_create(mock, mock_entry_hash, mock_entry_cmp, mock_entry_free));
+	MEM(mock->scripts = fr_hash_table_create(mock, mock_entry_hash, mock_entry_cmp, mock_entry_free));
+
+	if (fr_event_fd_insert(mock, el, fd, mock_accept, NULL, NULL, mock) < 0) {
+		talloc_free(mock);
+		goto error;
+	}
+	talloc_set_destructor(mock, _mock_free);
+
+	return mock;
+}
+
+/** Return the port the mock server is listening on
+ *
+ */
+uint16_t fr_redis_mock_port(fr_redis_mock_t const *mock)
+{
+	return mock->port;
+}
+
+/** Return statistics for the mock server
+ *
+ */
+fr_redis_mock_stats_t const *fr_redis_mock_stats(fr_redis_mock_t const *mock)
+{
+	return &mock->stats;
+}
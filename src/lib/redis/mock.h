@@ -0,0 +1,55 @@
+#pragma once
+
+/*
+ *   This program is is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or (at
+ *   your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ */
+
+/**
+ * $Id$
+ * @file lib/redis/mock.h
+ * @brief A minimal RESP server for testing and benchmarking the redis pipeline code
+ *
+ * @copyright 2020 The FreeRADIUS server project
+ */
+RCSIDH(redis_mock_h, "$Id$")
+
+#include <freeradius-devel/util/event.h>
+#include <freeradius-devel/util/inet.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct fr_redis_mock_s fr_redis_mock_t;
+
+/** Statistics for a mock server
+ *
+ */
+typedef struct {
+	uint64_t	connections;	//!< Number of client connections accepted.
+	uint64_t	reads;		//!< Number of successful reads from clients.
+	uint64_t	commands;	//!< Number of commands processed.
+} fr_redis_mock_stats_t;
+
+fr_redis_mock_t			*fr_redis_mock_alloc(TALLOC_CTX *ctx, fr_event_list_t *el,
+						     fr_ipaddr_t const *ipaddr, uint16_t port);
+
+uint16_t			fr_redis_mock_port(fr_redis_mock_t const *mock);
+
+fr_redis_mock_stats_t const	*fr_redis_mock_stats(fr_redis_mock_t const *mock);
+
+#ifdef __cplusplus
+}
+#endif
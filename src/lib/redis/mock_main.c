@@ -0,0 +1,62 @@
+/*
+ *  cc  -g3 -Wall -DHAVE_DLFCN_H -I../../../src -include freeradius-devel/build.h -L../../../build/lib/local/.libs -ltalloc -lfreeradius-util -o redis_mock mock_main.c mock.c
+ *
+ *  Standalone mock RESP server, for benchmarking rlm_redis and rlm_redis_ippool
+ *  (with async = yes) without a redis-server.
+ *
+ *  Usage: redis_mock [-i <ipaddr>] [-p <port>]
+ */
+#include <freeradius-devel/util/debug.h>
+#include <freeradius-devel/util/inet.h>
+#include "mock.h"
+
+int main(int argc, char *argv[])
+{
+	TALLOC_CTX		*ctx;
+	fr_event_list_t		*el;
+	fr_redis_mock_t		*mock;
+	fr_ipaddr_t		ipaddr;
+	char const		*ipaddr_str = "127.0.0.1";
+	uint16_t		port = 6379;
+	int			c;
+
+	while ((c = getopt(argc, argv, "i:p:")) != -1) switch (c) {
+	case 'i':
+		ipaddr_str = optarg;
+		break;
+
+	case 'p':
+		port = atoi(optarg);
+		break;
+
+	default:
+		fprintf(stderr, "Usage: %s [-i <ipaddr>] [-p <port>]\n", argv[0]);
+		return EXIT_FAILURE;
+	}
+
+	if (fr_inet_pton(&ipaddr, ipaddr_str, -1, AF_UNSPEC, false, true) < 0) {
+		fr_perror("redis_mock");
+		return EXIT_FAILURE;
+	}
+
+	ctx = talloc_init("redis_mock");
+	el = fr_event_list_alloc(ctx, NULL, NULL);
+	if (!el) {
+		fr_perror("redis_mock");
+		return EXIT_FAILURE;
+	}
+
+	mock = fr_redis_mock_alloc(ctx, el, &ipaddr, port);
+	if (!mock) {
+		fr_perror("redis_mock");
+		return EXIT_FAILURE;
+	}
+
+	INFO("Listening on %s port %u", ipaddr_str, fr_redis_mock_port(mock));
+
+	fr_event_loop(el);
+
+	talloc_free(ctx);
+
+	return EXIT_SUCCESS;
+}
@@ -19,6 +19,13 @@
  * @file lib/redis/pipeline.c
  * @brief Functions for pipelining commands.
  *
+ * Command sets from many requests are multiplexed over a small number of
+ * connections per thread.  The trunk is always writable, so each command set
+ * is handed to hiredis as soon as it's enqueued.  hiredis only appends the
+ * commands to the output buffer of the connection and registers interest in
+ * the FD becoming writable, so all commands enqueued during a single pass of
+ * the event loop are written to the server together, as one pipeline.
+ *
  * @copyright 2019 The FreeRADIUS server project
  * @copyright 2019 Network RADIUS SARL (legal@networkradius.com)
  *
@@ -27,6 +34,7 @@
 
 #include <freeradius-devel/server/connection.h>
 #include <freeradius-devel/server/trunk.h>
+#include <freeradius-devel/util/rbtree.h>
 
 #include "pipeline.h"
 #include "io.h"
@@ -39,7 +47,11 @@
 struct fr_redis_cluster_thread_s {
 	fr_event_list_t			*el;
 	fr_trunk_conf_t	const		*tconf;		//!< Configuration for all trunks in the cluster.
-	char				*log_prefix;	//!< Common log prefix to use for all cluster related
+	fr_redis_io_conf_t const	*io_conf;	//!< Template for the I/O configuration of each trunk.
+							///< hostname and port are ignored.
+	rbtree_t			*trunks;	//!< Trunks to individual cluster nodes, keyed by
+							///< address and port.
+	char const			*log_prefix;	//!< Common log prefix to use for all cluster related
 							///< messages.
 	bool				delay_start;	//!< Prevent connections from spawning immediately.
 };
@@ -142,6 +154,10 @@ struct fr_redis_command_set_s {
 };
 
 struct fr_redis_trunk_s {
+	fr_ipaddr_t			ipaddr;		//!< Address of the node.  Only set for trunks
+							///< allocated with #fr_redis_cluster_thread_trunk.
+	uint16_t			port;		//!< Port of the node.
+
 	fr_redis_io_conf_t const	*io_conf;	//!< Redis I/O configuration.  Specifies how to connect
 							///< to the host this trunk is used to communicate with.
 	fr_trunk_t			*trunk;		//!< Trunk containing all the connections to a specific
@@ -180,7 +196,7 @@ static int _redis_command_set_free(fr_redis_command_set_t *cmds)
 	}
 
 	talloc_free_children(cmds);
-	memset(&cmds, 0, sizeof(cmds));
+	memset(cmds, 0, sizeof(*cmds));
 
 	fr_dlist_insert_head(command_set_free_list, cmds);
 
@@ -262,54 +278,52 @@ fr_redis_command_set_t *fr_redis_command_set_alloc(TALLOC_CTX *ctx,
  */
 static int _redis_command_free(fr_redis_command_t *cmd)
 {
-	//if (cmd->result) fr_redis_reply_free(&cmd->result);
+	fr_redis_reply_free(&cmd->result);
 
 	return 0;
 }
 
+/** Return the result of a command
+ *
+ * @param[in] cmd	to return the result for.
+ * @return
+ *	- The reply from the server.  This remains owned by the command.
+ *	- NULL if no reply was received.
+ */
 redisReply *fr_redis_command_get_result(fr_redis_command_t *cmd)
 {
 	return cmd->result;
 }
 
-/** Add a preformatted/expanded command to the command set
+/** Check whether a command starts or ends a transaction block
  *
- * The command must either be entirely static, or parented by the command set.
+ * Because commands from many different requests share the same connection
+ * we need to ensure that transaction blocks aren't left dangling and
+ * that the commands are all in the right order.
  *
- * @note Caller should disallow "SUBSCRIBE" et al, if they're not appropriate.
- * 	 As subscribing to a stream where we're not expecting it would break
- * 	 things, badly.
+ * We try very hard to do this without incurring a performance penalty
+ * for non-transactional commands.
  *
- * @param[in] cmds	Command set to add command to.
- * @param[in] cmd_str	A fully expanded/formatted command to send to redis.
- *			Must be static, or have the same lifetime as the
- *			command set (allocated with the command set as the parent).
- * @param[in] cmd_len	Length of the command.
+ * @param[out] out	Type of the command.
+ * @param[in] cmds	Command set the command is being added to.
+ * @param[in] name	The name of the command, i.e. the first argument.
+ * @param[in] name_len	Length of the command name.
  * @return
- *	- FR_REDIS_PIPELINE_BAD_CMDS if a bad command sequence is enqueued.
- *	- FR_REDIS_PIPELINE_OK if command was enqueued successfully.
+ *	- FR_REDIS_PIPELINE_BAD_CMDS if the command would produce a bad command sequence.
+ *	- FR_REDIS_PIPELINE_OK if the command can be added to the command set.
  */
-fr_redis_pipeline_status_t fr_redis_command_preformatted_add(fr_redis_command_set_t *cmds,
-							     char const *cmd_str, size_t cmd_len)
+static fr_redis_pipeline_status_t redis_command_type(fr_redis_command_type_t *out, fr_redis_command_set_t *cmds,
+						     char const *name, size_t name_len)
 {
-	REQUEST			*request = cmds->request;
-	fr_redis_command_t	*cmd;
-	fr_redis_command_type_t	type = FR_REDIS_COMMAND_NORMAL;
+	REQUEST	*request = cmds->request;
 
-	/*
-	 *	Transaction sanity checks.
-	 *
-	 *	Because commands from many different requests share the same connection
-	 *	we need to ensure that transaction blocks aren't left dangling and
-	 *	that the commands are all in the right order.
-	 *
-	 *	We try very hard to do this without incurring a performance penalty
-	 *      for non-transactional commands.
-	 */
-	switch (tolower(cmd_str[0])) {
+#define CMD_IS(_str) ((name_len == (sizeof(_str) - 1)) && (strncasecmp(name, _str, name_len) == 0))
+
+	*out = FR_REDIS_COMMAND_NORMAL;
+
+	switch (tolower(name[0])) {
 	case 'm':
-		if (tolower(cmd_str[1] != 'u')) break;
-		if (strncasecmp(cmd_str, "multi", sizeof("multi") - 1) != 0) break;
+		if (!CMD_IS("multi")) break;
 		/*
 		 *	There should only ever be a difference of
 		 *	1 between txn starts and txn ends.
@@ -323,13 +337,12 @@ fr_redis_pipeline_status_t fr_redis_command_preformatted_add(fr_redis_command_se
 		 *	that's marked as the start of the transaction
 		 *	block.
 		 */
-		type = cmds->txn_watch ? FR_REDIS_COMMAND_TRANSACTION_START : FR_REDIS_COMMAND_NORMAL;
+		*out = cmds->txn_watch ? FR_REDIS_COMMAND_TRANSACTION_START : FR_REDIS_COMMAND_NORMAL;
 		cmds->txn_start++;	/* Yes MULTI increments start, not WATCH */
 		break;
 
 	case 'e':
-		if (tolower(cmd_str[1] != 'e')) break;
-		if (strncasecmp(cmd_str, "exec", sizeof("exec") - 1) != 0) break;
+		if (!CMD_IS("exec")) break;
 		goto txn_end;
 
 	/*
@@ -338,20 +351,18 @@ fr_redis_pipeline_status_t fr_redis_command_preformatted_add(fr_redis_command_se
 	 *	executing the commands.
 	 */
 	case 'd':
-		if (tolower(cmd_str[1] != 'i')) break;
-		if (strncasecmp(cmd_str, "discard", sizeof("discard") - 1) != 0) break;
+		if (!CMD_IS("discard")) break;
 	txn_end:
 		if (cmds->txn_start <= cmds->txn_end) {
 			ROPTIONAL(ERROR, REDEBUG, "Transaction not started, missing \"MULTI\" command");
 			return FR_REDIS_PIPELINE_BAD_CMDS;
 		}
-		type = FR_REDIS_COMMAND_TRANSACTION_END;
+		*out = FR_REDIS_COMMAND_TRANSACTION_END;
 		cmds->txn_end++;
 		break;
 
 	case 'w':
-		if (tolower(cmd_str[1] != 'a')) break;
-		if (strncasecmp(cmd_str, "watch", sizeof("watch") - 1) != 0) break;
+		if (!CMD_IS("watch")) break;
 		if (cmds->txn_watch) {
 			ROPTIONAL(ERROR, REDEBUG, "Too many consecutive \"WATCH\" commands");
 			return FR_REDIS_PIPELINE_BAD_CMDS;
@@ -366,6 +377,54 @@ fr_redis_pipeline_status_t fr_redis_command_preformatted_add(fr_redis_command_se
 		break;
 	}
 
+	return FR_REDIS_PIPELINE_OK;
+}
+
+/** Add a preformatted/expanded command to the command set
+ *
+ * The command must be in the RESP wire format, as produced by redisFormatCommand
+ * and redisFormatCommandArgv, and must either be entirely static, or parented
+ * by the command set.
+ *
+ * @note Caller should disallow "SUBSCRIBE" et al, if they're not appropriate.
+ * 	 As subscribing to a stream where we're not expecting it would break
+ * 	 things, badly.
+ *
+ * @param[in] cmds	Command set to add command to.
+ * @param[in] cmd_str	A fully expanded/formatted command to send to redis.
+ *			Must be static, or have the same lifetime as the
+ *			command set (allocated with the command set as the parent).
+ * @param[in] cmd_len	Length of the command.
+ * @return
+ *	- FR_REDIS_PIPELINE_BAD_CMDS if a bad command sequence is enqueued.
+ *	- FR_REDIS_PIPELINE_OK if command was enqueued successfully.
+ */
+fr_redis_pipeline_status_t fr_redis_command_preformatted_add(fr_redis_command_set_t *cmds,
+							     char const *cmd_str, size_t cmd_len)
+{
+	REQUEST			*request = cmds->request;
+	fr_redis_command_t	*cmd;
+	fr_redis_command_type_t	type;
+	char const		*p, *end = cmd_str + cmd_len;
+	char			*q;
+	unsigned long		name_len;
+
+	/*
+	 *	The command name is the first bulk string
+	 *	in the array, i.e. *<argc>\r\n$<len>\r\n<name>\r\n
+	 */
+	p = memchr(cmd_str, '\n', cmd_len);
+	if ((cmd_len == 0) || (cmd_str[0] != '*') || !p || ((end - ++p) < 4) || (*p != '$')) {
+	bad_format:
+		ROPTIONAL(ERROR, REDEBUG, "Command is not in RESP format");
+		return FR_REDIS_PIPELINE_BAD_CMDS;
+	}
+
+	name_len = strtoul(p + 1, &q, 10);
+	if ((name_len == 0) || ((end - q) < (ssize_t)(name_len + 4)) || (q[0] != '\r') || (q[1] != '\n')) goto bad_format;
+
+	if (redis_command_type(&type, cmds, q + 2, name_len) != FR_REDIS_PIPELINE_OK) return FR_REDIS_PIPELINE_BAD_CMDS;
+
 	MEM(cmd = talloc_zero(cmds, fr_redis_command_t));
 	talloc_set_destructor(cmd, _redis_command_free);
 	cmd->cmds = cmds;
@@ -377,6 +436,90 @@ fr_redis_pipeline_status_t fr_redis_command_preformatted_add(fr_redis_command_se
 	return FR_REDIS_PIPELINE_OK;
 }
 
+/** Format a command and add it to the command set
+ *
+ * @param[in] cmds	Command set to add command to.
+ * @param[in] fmt	hiredis format string, i.e. "SET %b %s".
+ * @param[in] ap	Arguments for the format string.
+ * @return
+ *	- FR_REDIS_PIPELINE_BAD_CMDS if a bad command sequence is enqueued.
+ *	- FR_REDIS_PIPELINE_OK if command was enqueued successfully.
+ */
+fr_redis_pipeline_status_t fr_redis_command_set_vadd(fr_redis_command_set_t *cmds, char const *fmt, va_list ap)
+{
+	REQUEST				*request = cmds->request;
+	char				*target, *cmd_str;
+	int				len;
+	fr_redis_pipeline_status_t	ret;
+
+	len = redisvFormatCommand(&target, fmt, ap);
+	if (len < 0) {
+		ROPTIONAL(ERROR, REDEBUG, "Failed formatting command");
+		return FR_REDIS_PIPELINE_BAD_CMDS;
+	}
+	MEM(cmd_str = talloc_memdup(cmds, target, (size_t)len));
+	redisFreeCommand(target);
+
+	ret = fr_redis_command_preformatted_add(cmds, cmd_str, (size_t)len);
+	if (ret != FR_REDIS_PIPELINE_OK) talloc_free(cmd_str);
+
+	return ret;
+}
+
+/** Format a command and add it to the command set
+ *
+ * @param[in] cmds	Command set to add command to.
+ * @param[in] fmt	hiredis format string, i.e. "SET %b %s".
+ * @param[in] ...	Arguments for the format string.
+ * @return
+ *	- FR_REDIS_PIPELINE_BAD_CMDS if a bad command sequence is enqueued.
+ *	- FR_REDIS_PIPELINE_OK if command was enqueued successfully.
+ */
+fr_redis_pipeline_status_t fr_redis_command_set_add(fr_redis_command_set_t *cmds, char const *fmt, ...)
+{
+	va_list				ap;
+	fr_redis_pipeline_status_t	ret;
+
+	va_start(ap, fmt);
+	ret = fr_redis_command_set_vadd(cmds, fmt, ap);
+	va_end(ap);
+
+	return ret;
+}
+
+/** Add a command, already split into arguments, to the command set
+ *
+ * @param[in] cmds	Command set to add command to.
+ * @param[in] argc	Number of arguments.
+ * @param[in] argv	Command arguments.  argv[0] is the command name.
+ * @param[in] argvlen	Length of each argument.  If NULL, the arguments must
+ *			be \0 terminated.
+ * @return
+ *	- FR_REDIS_PIPELINE_BAD_CMDS if a bad command sequence is enqueued.
+ *	- FR_REDIS_PIPELINE_OK if command was enqueued successfully.
+ */
+fr_redis_pipeline_status_t fr_redis_command_set_argv_add(fr_redis_command_set_t *cmds,
+							 int argc, char const **argv, size_t const *argvlen)
+{
+	REQUEST				*request = cmds->request;
+	char				*target, *cmd_str;
+	int				len;
+	fr_redis_pipeline_status_t	ret;
+
+	len = redisFormatCommandArgv(&target, argc, argv, argvlen);
+	if (len < 0) {
+		ROPTIONAL(ERROR, REDEBUG, "Failed formatting command");
+		return FR_REDIS_PIPELINE_BAD_CMDS;
+	}
+	MEM(cmd_str = talloc_memdup(cmds, target, (size_t)len));
+	redisFreeCommand(target);
+
+	ret = fr_redis_command_preformatted_add(cmds, cmd_str, (size_t)len);
+	if (ret != FR_REDIS_PIPELINE_OK) talloc_free(cmd_str);
+
+	return ret;
+}
+
 /** Enqueue a command set on a specific trunk
  *
  * The command set may be passed around several trunks before it is complete.
@@ -389,10 +532,18 @@ fr_redis_pipeline_status_t fr_redis_command_preformatted_add(fr_redis_command_se
  *	- FR_REDIS_PIPELINE_DST_UNAVAILABLE if the REDIS host is unreachable.
  *	- FR_REDIS_PIPELINE_FAIL any other general error.
  */
-fr_redis_pipeline_status_t redis_command_set_enqueue(fr_redis_trunk_t *rtrunk, fr_redis_command_set_t *cmds)
+fr_redis_pipeline_status_t fr_redis_command_set_enqueue(fr_redis_trunk_t *rtrunk, fr_redis_command_set_t *cmds)
 {
+	REQUEST				*request = cmds->request;
+	fr_redis_pipeline_status_t	ret;
+
 	if (cmds->txn_start != cmds->txn_end) {
-		ERROR("Refusing to enqueue - Unbalanced transaction start/stop commands");
+		ROPTIONAL(ERROR, REDEBUG, "Refusing to enqueue - Unbalanced transaction start/stop commands");
+		return FR_REDIS_PIPELINE_BAD_CMDS;
+	}
+
+	if (fr_dlist_num_elements(&cmds->pending) == 0) {
+		ROPTIONAL(ERROR, REDEBUG, "Refusing to enqueue - Command set is empty");
 		return FR_REDIS_PIPELINE_BAD_CMDS;
 	}
 
@@ -402,12 +553,69 @@ fr_redis_pipeline_status_t redis_command_set_enqueue(fr_redis_trunk_t *rtrunk, f
 		return FR_REDIS_PIPELINE_OK;
 
 	case FR_TRUNK_ENQUEUE_DST_UNAVAILABLE:
-		return FR_REDIS_PIPELINE_DST_UNAVAILABLE;
+		ret = FR_REDIS_PIPELINE_DST_UNAVAILABLE;
+		break;
 
 	default:
-		return FR_REDIS_PIPELINE_FAIL;
+		ret = FR_REDIS_PIPELINE_FAIL;
+		break;
+	}
+
+	if (cmds->treq) fr_trunk_request_free(&cmds->treq);
+
+	return ret;
+}
+
+/** Cancel a command set that was previously enqueued
+ *
+ * Should be called when the request that enqueued the command set is cancelled.
+ * Responses to any commands already sent will be discarded when they're received.
+ * Neither the complete nor the fail callbacks will be called.
+ *
+ * @param[in] cmds	to cancel.
+ */
+void fr_redis_command_set_cancel(fr_redis_command_set_t *cmds)
+{
+	if (!cmds->treq) return;
+
+	fr_trunk_request_signal_cancel(cmds->treq);
+	cmds->treq = NULL;
+}
+
+#ifndef REDIS_NO_AUTO_FREE_REPLIES
+/** Copy a reply so that it outlives the hiredis callback it was passed to
+ *
+ * Older versions of hiredis always free replies as soon as the reply
+ * callback returns.  The copy is allocated with the same allocator
+ * hiredis uses, so it can be freed with #fr_redis_reply_free.
+ *
+ * @param[in] in	reply to copy.
+ * @return A copy of the reply.
+ */
+static redisReply *redis_reply_copy(redisReply const *in)
+{
+	redisReply	*out;
+	size_t		i;
+
+	MEM(out = malloc(sizeof(*out)));
+	memcpy(out, in, sizeof(*out));
+
+	if (in->str) {
+		MEM(out->str = malloc(in->len + 1));
+		memcpy(out->str, in->str, in->len);
+		out->str[in->len] = '\0';
+	}
+
+	if (in->element) {
+		MEM(out->element = calloc(in->elements, sizeof(out->element[0])));
+		for (i = 0; i < in->elements; i++) {
+			if (in->element[i]) out->element[i] = redis_reply_copy(in->element[i]);
+		}
 	}
+
+	return out;
 }
+#endif
 
 /** Callback for for receiving Redis replies
  *
@@ -431,12 +639,23 @@ static void _redis_pipeline_demux(struct redisAsyncContext *ac, void *vreply, vo
 	fr_connection_t		*conn = talloc_get_type_abort(ac->ev.data, fr_connection_t);
 	fr_redis_handle_t	*h = talloc_get_type_abort(conn->h, fr_redis_handle_t);
 	redisReply		*reply = vreply;
+
+	/*
+	 *	hiredis calls the callbacks for all outstanding
+	 *	commands with a NULL reply when the connection is
+	 *	freed.  By this point the trunk has already told
+	 *	us to requeue or cancel the command sets.
+	 */
+	if (!reply) return;
+
 	/*
 	 *	First check if we should ignore the response
 	 */
 	if (!fr_redis_connection_process_response(h)) {
 		DEBUG4("Ignoring response with SQN %"PRIu64, (h->rsp_sqn - 1));	/* Already incremented */
-		fr_redis_reply_free((redisReply **)&reply);
+#ifdef REDIS_NO_AUTO_FREE_REPLIES
+		fr_redis_reply_free(&reply);
+#endif
 		return;
 	}
 
@@ -447,7 +666,11 @@ static void _redis_pipeline_demux(struct redisAsyncContext *ac, void *vreply, vo
 	 */
 	cmd = talloc_get_type_abort(privdata, fr_redis_command_t);
 	cmds = cmd->cmds;
+#ifdef REDIS_NO_AUTO_FREE_REPLIES
 	cmd->result = reply;
+#else
+	cmd->result = redis_reply_copy(reply);
+#endif
 
 	fr_dlist_remove(&cmds->sent, cmd);
 	fr_dlist_insert_tail(&cmds->completed, cmd);
@@ -473,57 +696,91 @@ static fr_connection_t *_redis_pipeline_connection_alloc(fr_trunk_connection_t *
 /** Enqueue one or more command sets onto a redis handle
  *
  * Because the trunk is in always writable mode, _redis_pipeline_mux
- * will be called any time fr_trunk_request_enqueue is called, so there'll only
- * ever be one command to dequeue.
+ * will be called any time fr_trunk_request_enqueue is called, so there'll usually
+ * only be one command set to dequeue.
+ *
+ * hiredis only writes the commands to its output buffer here.  They're written
+ * to the socket when the FD next becomes writable.
  *
+ * @param[in] el		Event list the connection is bound to.  Unused.
  * @param[in] tconn		Trunk connection holding the commands to enqueue.
  * @param[in] conn		Connection handle containing the fr_redis_handle_t.
- * @param[in] uctx		fr_redis_cluster_t.  Unused.
+ * @param[in] uctx		fr_redis_trunk_t.  Unused.
  */
-static void _redis_pipeline_mux(fr_trunk_connection_t *tconn, fr_connection_t *conn, UNUSED void *uctx)
+static void _redis_pipeline_mux(UNUSED fr_event_list_t *el,
+				fr_trunk_connection_t *tconn, fr_connection_t *conn, UNUSED void *uctx)
 {
 	fr_trunk_request_t	*treq;
 	fr_redis_command_set_t 	*cmds;
 	fr_redis_command_t	*cmd;
 	fr_redis_handle_t	*h = talloc_get_type_abort(conn->h, fr_redis_handle_t);
 	REQUEST			*request;
+	bool			failed;
+
+	for (;;) {
+		if (unlikely(fr_trunk_connection_pop_request(&treq, tconn) < 0)) return;
 
-	treq = fr_trunk_connection_pop_request(&request, (void *)&cmds, NULL, tconn);
-	while ((cmd = fr_dlist_head(&cmds->pending))) {
 		/*
-		 *	If this fails it probably means the connection
-		 *	is disconnecting, but if that's happening then
-		 *	we shouldn't be enqueueing new requests?
+		 *	No more command sets to send
 		 */
-		if (unlikely(redisAsyncCommand(h->ac, _redis_pipeline_demux, cmd, "%s", cmd->str) != REDIS_OK)) {
-			ROPTIONAL(ERROR, REDEBUG, "Unexpected error queueing REDIS command");
-
-			while ((cmd = fr_dlist_head(&cmds->sent))) {
-				fr_redis_connection_ignore_response(h, cmd->sqn);
-				fr_dlist_remove(&cmds->sent, cmd);
-				fr_dlist_insert_tail(&cmds->pending, cmd);
+		if (!treq) break;
+
+		cmds = talloc_get_type_abort(treq->preq, fr_redis_command_set_t);
+		request = treq->request;
+		failed = false;
+
+		while ((cmd = fr_dlist_head(&cmds->pending))) {
+			/*
+			 *	If this fails it probably means the connection
+			 *	is disconnecting, but if that's happening then
+			 *	we shouldn't be enqueueing new requests?
+			 */
+			if (unlikely(redisAsyncFormattedCommand(h->ac, _redis_pipeline_demux, cmd,
+								cmd->str, cmd->len) != REDIS_OK)) {
+				ROPTIONAL(ERROR, REDEBUG, "Unexpected error queueing REDIS command");
+
+				while ((cmd = fr_dlist_head(&cmds->sent))) {
+					fr_redis_connection_ignore_response(h, cmd->sqn);
+					fr_dlist_remove(&cmds->sent, cmd);
+					fr_dlist_insert_tail(&cmds->pending, cmd);
+				}
+				fr_trunk_request_signal_fail(treq);
+				failed = true;
+				break;
 			}
-			fr_trunk_request_signal_fail(treq);
-			return;
+			cmd->sqn = fr_redis_connection_sent_request(h);
+			fr_dlist_remove(&cmds->pending, cmd);
+			fr_dlist_insert_tail(&cmds->sent, cmd);
 		}
-		cmd->sqn = fr_redis_connection_sent_request(h);
-		fr_dlist_remove(&cmds->pending, cmd);
-		fr_dlist_insert_tail(&cmds->sent, cmd);
+		if (failed) continue;
+
+		fr_trunk_request_signal_sent(treq);
 	}
-	fr_trunk_request_signal_sent(treq);
 }
 
 /** Deal with cancellation of sent requests
  *
- * We can't actually signal redis to not process the request, so depending
- * on why the commands were cancelled, we either tell the handle to ignore
- * them, or move them back into the pending list.
+ * We can't actually signal redis to not process the request, so we tell
+ * the handle to ignore the responses, and, if the command set is going to
+ * be sent again, move the commands back into the pending list.
  */
-static void _redis_pipeline_command_set_cancel(fr_connection_t *conn, UNUSED fr_trunk_request_t *treq, void *preq,
+static void _redis_pipeline_command_set_cancel(fr_connection_t *conn, void *preq,
 					       fr_trunk_cancel_reason_t reason, UNUSED void *uctx)
 {
 	fr_redis_command_set_t	*cmds = talloc_get_type_abort(preq, fr_redis_command_set_t);
 	fr_redis_handle_t	*h = conn->h;
+	fr_redis_command_t	*cmd;
+
+	/*
+	 *	Whatever the reason for the cancellation, there'll
+	 *	be responses coming back on this handle for the
+	 *	commands we've already sent.
+	 */
+	for (cmd = fr_dlist_head(&cmds->sent);
+	     cmd;
+	     cmd = fr_dlist_next(&cmds->sent, cmd)) {
+		fr_redis_connection_ignore_response(h, cmd->sqn);
+	}
 
 	/*
 	 *	How we cancel is very different depending
@@ -531,39 +788,49 @@ static void _redis_pipeline_command_set_cancel(fr_connection_t *conn, UNUSED fr_
 	 */
 	switch (reason) {
 	/*
-	 *	Cancel is only called for requests that
-	 *	have been sent, and only when the connection
-	 *	is about to be closed for some reason.
-	 *
-	 *	We don't need to tell the handle to ignore
-	 *	the responses, we just need to get the
-	 *	command set back into the correct state for
-	 *	execution by another handle.
+	 *	The command set is going to be executed by
+	 *	another handle, so get it back into the
+	 *	correct state.  Commands which completed on
+	 *	this handle are executed again, as the results
+	 *	of a partially executed command set can't be
+	 *	relied on.
 	 */
 	case FR_TRUNK_CANCEL_REASON_MOVE:
-		fr_dlist_move(&cmds->pending, &cmds->sent);
+	case FR_TRUNK_CANCEL_REASON_REQUEUE:
+	{
+		fr_dlist_head_t	tmp;
+
+		fr_dlist_talloc_init(&tmp, fr_redis_command_t, entry);
+		while ((cmd = fr_dlist_head(&cmds->completed))) {
+			fr_dlist_remove(&cmds->completed, cmd);
+			fr_redis_reply_free(&cmd->result);
+			fr_dlist_insert_tail(&tmp, cmd);
+		}
+		while ((cmd = fr_dlist_head(&cmds->sent))) {
+			fr_dlist_remove(&cmds->sent, cmd);
+			fr_dlist_insert_tail(&tmp, cmd);
+		}
+		while ((cmd = fr_dlist_head(&cmds->pending))) {
+			fr_dlist_remove(&cmds->pending, cmd);
+			fr_dlist_insert_tail(&tmp, cmd);
+		}
+		while ((cmd = fr_dlist_head(&tmp))) {
+			fr_dlist_remove(&tmp, cmd);
+			fr_dlist_insert_tail(&cmds->pending, cmd);
+		}
+	}
 		return;
 
 	/*
 	 *	If the request was cancelled due to a signal
 	 *	we'll have a response coming back for a
 	 *	request, pctx and rctx that no longer exist.
-	 *	Tell the handle to signal that the response
-	 *	should be ignored when it's received.
 	 *
-	 *      Free will take care of cleaning up the
-	 *	pending commands.
+	 *      The owner of the command set will take care
+	 *	of cleaning up the pending commands.
 	 */
 	case FR_TRUNK_CANCEL_REASON_SIGNAL:
-	{
-		fr_redis_command_t	*cmd;
-
-		for (cmd = fr_dlist_head(&cmds->sent);
-		     cmd;
-		     cmd = fr_dlist_next(&cmds->sent, cmd)) {
-			fr_redis_connection_ignore_response(h, cmd->sqn);
-		}
-	}
+		return;
 
 	case FR_TRUNK_CANCEL_REASON_NONE:
 		fr_assert(0);
@@ -579,6 +846,8 @@ static void _redis_pipeline_command_set_complete(UNUSED REQUEST *request, void *
 {
 	fr_redis_command_set_t	*cmds = talloc_get_type_abort(preq, fr_redis_command_set_t);
 
+	cmds->treq = NULL;	/* Freed by the trunk */
+
 	if (cmds->complete) cmds->complete(cmds->request, &cmds->completed, cmds->rctx);
 }
 
@@ -586,25 +855,20 @@ static void _redis_pipeline_command_set_complete(UNUSED REQUEST *request, void *
  *
  */
 static void _redis_pipeline_command_set_fail(UNUSED REQUEST *request, void *preq,
-					     UNUSED void *rctx, UNUSED void *uctx)
+					     UNUSED void *rctx, UNUSED fr_trunk_request_state_t state, UNUSED void *uctx)
 {
 	fr_redis_command_set_t	*cmds = talloc_get_type_abort(preq, fr_redis_command_set_t);
 
-	if (cmds->fail) cmds->fail(cmds->request, &cmds->completed, cmds->rctx);
-}
-
-/** Free the command set
- *
- */
-static void _redis_pipeline_command_set_free(UNUSED REQUEST *request, void *preq,
-					     UNUSED void *uctx)
-{
-	fr_redis_command_set_t	*cmds = talloc_get_type_abort(preq, fr_redis_command_set_t);
+	cmds->treq = NULL;	/* Freed by the trunk */
 
-	talloc_free(cmds);
+	if (cmds->fail) cmds->fail(cmds->request, &cmds->completed, cmds->rctx);
 }
 
 /** Allocate a new trunk
+ *
+ * Command sets are owned by their creators, so there's no request_free
+ * callback.  The command set is freed when the ctx it was bound to in
+ * #fr_redis_command_set_alloc is freed.
  *
  * @param[in] cluster_thread	to allocate the trunk for.
  * @param[in] io_conf		Describing the connection to a single REDIS host.
@@ -614,19 +878,19 @@ static void _redis_pipeline_command_set_free(UNUSED REQUEST *request, void *preq
  */
 fr_redis_trunk_t *fr_redis_trunk_alloc(fr_redis_cluster_thread_t *cluster_thread, fr_redis_io_conf_t const *io_conf)
 {
-	fr_redis_trunk_t	*rtrunk;
-	fr_trunk_io_funcs_t	io_funcs = {
-					.connection_alloc	= _redis_pipeline_connection_alloc,
-					.request_mux		= _redis_pipeline_mux,
-					/* demux called directly by hiredis */
-					.request_cancel		= _redis_pipeline_command_set_cancel,
-					.request_complete	= _redis_pipeline_command_set_complete,
-					.request_fail		= _redis_pipeline_command_set_fail,
-					.request_free		= _redis_pipeline_command_set_free
-				};
+	fr_redis_trunk_t		*rtrunk;
+	static fr_trunk_io_funcs_t	io_funcs = {
+						.connection_alloc	= _redis_pipeline_connection_alloc,
+						.request_mux		= _redis_pipeline_mux,
+						/* demux called directly by hiredis */
+						.request_cancel		= _redis_pipeline_command_set_cancel,
+						.request_complete	= _redis_pipeline_command_set_complete,
+						.request_fail		= _redis_pipeline_command_set_fail
+					};
 
 	MEM(rtrunk = talloc_zero(cluster_thread, fr_redis_trunk_t));
 	rtrunk->io_conf = io_conf;
+	rtrunk->cluster = cluster_thread;
 	rtrunk->trunk = fr_trunk_alloc(rtrunk, cluster_thread->el,
 				       &io_funcs, cluster_thread->tconf, cluster_thread->log_prefix, rtrunk,
 				       cluster_thread->delay_start);
@@ -638,13 +902,78 @@ fr_redis_trunk_t *fr_redis_trunk_alloc(fr_redis_cluster_thread_t *cluster_thread
 	return rtrunk;
 }
 
+static int _redis_trunk_cmp(void const *one, void const *two)
+{
+	fr_redis_trunk_t const	*a = one, *b = two;
+	int			ret;
+
+	ret = fr_ipaddr_cmp(&a->ipaddr, &b->ipaddr);
+	if (ret != 0) return ret;
+
+	return (a->port > b->port) - (a->port < b->port);
+}
+
+/** Find or allocate the trunk for a specific cluster node
+ *
+ * Trunks are created on first use, so a thread only holds connections
+ * to the nodes it's actually sent commands to.
+ *
+ * @param[in] cluster_thread	to retrieve the trunk from.
+ * @param[in] ipaddr		of the node.
+ * @param[in] port		of the node.
+ * @return
+ *	- The trunk for the node.
+ *	- NULL if a new trunk couldn't be allocated.
+ */
+fr_redis_trunk_t *fr_redis_cluster_thread_trunk(fr_redis_cluster_thread_t *cluster_thread,
+						fr_ipaddr_t const *ipaddr, uint16_t port)
+{
+	fr_redis_trunk_t	find, *rtrunk;
+	fr_redis_io_conf_t	*io_conf;
+	char			buff[FR_IPADDR_STRLEN];
+
+	find.ipaddr = *ipaddr;
+	find.port = port;
+
+	rtrunk = rbtree_finddata(cluster_thread->trunks, &find);
+	if (rtrunk) return rtrunk;
+
+	MEM(io_conf = talloc_zero(cluster_thread, fr_redis_io_conf_t));
+	if (cluster_thread->io_conf) memcpy(io_conf, cluster_thread->io_conf, sizeof(*io_conf));
+	io_conf->hostname = talloc_strdup(io_conf, fr_inet_ntop(buff, sizeof(buff), ipaddr));
+	io_conf->port = port;
+
+	rtrunk = fr_redis_trunk_alloc(cluster_thread, io_conf);
+	if (!rtrunk) {
+		talloc_free(io_conf);
+		return NULL;
+	}
+	talloc_steal(rtrunk, io_conf);
+	rtrunk->ipaddr = *ipaddr;
+	rtrunk->port = port;
+
+	if (!rbtree_insert(cluster_thread->trunks, rtrunk)) {
+		talloc_free(rtrunk);
+		return NULL;
+	}
+
+	return rtrunk;
+}
+
 /** Allocate per-thread, per-cluster instance
  *
  * This structure represents all the connections for a given thread for a given cluster.
  * The structures holds the trunk connections to talk to each cluster member.
  *
+ * @param[in] ctx		to allocate the cluster thread in.
+ * @param[in] el		to run the connections in.
+ * @param[in] tconf		Trunk configuration.  always_writable will be forced on.
+ * @param[in] io_conf		Template for the I/O configuration of trunks allocated
+ *				with #fr_redis_cluster_thread_trunk.  May be NULL.
+ * @return A new cluster thread.
  */
-fr_redis_cluster_thread_t *fr_redis_cluster_thread_alloc(TALLOC_CTX *ctx, fr_event_list_t *el, fr_trunk_conf_t const *tconf)
+fr_redis_cluster_thread_t *fr_redis_cluster_thread_alloc(TALLOC_CTX *ctx, fr_event_list_t *el,
+							 fr_trunk_conf_t const *tconf, fr_redis_io_conf_t const *io_conf)
 {
 	fr_redis_cluster_thread_t *cluster_thread;
 	fr_trunk_conf_t *our_tconf;
@@ -655,8 +984,10 @@ fr_redis_cluster_thread_t *fr_redis_cluster_thread_alloc(TALLOC_CTX *ctx, fr_eve
 
 	cluster_thread->el = el;
 	cluster_thread->tconf = our_tconf;
+	cluster_thread->io_conf = io_conf;
+	if (io_conf) cluster_thread->log_prefix = io_conf->log_prefix;
+	MEM(cluster_thread->trunks = rbtree_talloc_alloc(cluster_thread, _redis_trunk_cmp, fr_redis_trunk_t,
+							 NULL, RBTREE_FLAG_NONE));
 
 	return cluster_thread;
 }
-
-
@@ -66,12 +66,18 @@ typedef void (*fr_redis_command_set_fail_t)(REQUEST *request, fr_dlist_head_t *c
 fr_redis_pipeline_status_t	fr_redis_command_preformatted_add(fr_redis_command_set_t *cmds,
 							     	  char const *cmd_str, size_t cmd_len);
 
-/*
- *	TEMPORARY
- */
-fr_redis_pipeline_status_t redis_command_set_enqueue(fr_redis_trunk_t *rtrunk, fr_redis_command_set_t *cmds);
+fr_redis_pipeline_status_t	fr_redis_command_set_vadd(fr_redis_command_set_t *cmds, char const *fmt, va_list ap);
+
+fr_redis_pipeline_status_t	fr_redis_command_set_add(fr_redis_command_set_t *cmds, char const *fmt, ...);
+
+fr_redis_pipeline_status_t	fr_redis_command_set_argv_add(fr_redis_command_set_t *cmds,
+							      int argc, char const **argv, size_t const *argvlen);
 
-redisReply *fr_redis_command_get_result(fr_redis_command_t *cmd);
+fr_redis_pipeline_status_t	fr_redis_command_set_enqueue(fr_redis_trunk_t *rtrunk, fr_redis_command_set_t *cmds);
+
+void				fr_redis_command_set_cancel(fr_redis_command_set_t *cmds);
+
+redisReply			*fr_redis_command_get_result(fr_redis_command_t *cmd);
 
 fr_redis_command_set_t		*fr_redis_command_set_alloc(TALLOC_CTX *ctx,
 							    REQUEST *request,
@@ -82,8 +88,12 @@ fr_redis_command_set_t		*fr_redis_command_set_alloc(TALLOC_CTX *ctx,
 fr_redis_trunk_t		*fr_redis_trunk_alloc(fr_redis_cluster_thread_t *rtcluster,
 						      fr_redis_io_conf_t const *conf);
 
+fr_redis_trunk_t		*fr_redis_cluster_thread_trunk(fr_redis_cluster_thread_t *cluster_thread,
+							       fr_ipaddr_t const *ipaddr, uint16_t port);
+
 fr_redis_cluster_thread_t	*fr_redis_cluster_thread_alloc(TALLOC_CTX *ctx, fr_event_list_t *el,
-							       fr_trunk_conf_t const *tconf);
+							       fr_trunk_conf_t const *tconf,
+							       fr_redis_io_conf_t const *io_conf);
 
 #ifdef __cplusplus
 }
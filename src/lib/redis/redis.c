@@ -56,7 +56,9 @@ void fr_redis_version_print(void)
 
 /** Check the reply for errors
  *
- * @param conn used to issue the command.
+ * @param conn used to issue the command.  May be NULL for replies received
+ *	over an async connection, in which case a missing reply is treated as a
+ *	connection error.
  * @param reply to process.
  * @return
  *	- REDIS_RCODE_TRY_AGAIN - If the operation should be retries.
@@ -71,6 +73,11 @@ fr_redis_rcode_t fr_redis_command_status(fr_redis_conn_t *conn, redisReply *repl
 {
 	size_t i = 0;
 
+	if (!reply && !conn) {
+		fr_strerror_printf("Connection error: No reply received");
+		return REDIS_RCODE_RECONNECT;
+	}
+
 	if (!reply) switch (conn->handle->err) {
 	case REDIS_OK:
 		break;
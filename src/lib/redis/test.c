@@ -1,90 +1,198 @@
 /*
- *  cc  -g3 -Wall -DHAVE_DLFCN_H -I../../../src -include freeradius-devel/build.h -L../../../build/lib/local/.libs -ltalloc -lhiredis -lfreeradius-unlang -lfreeradius-util -lfreeradius-server -o test_redis test.c redis.c io.c crc16.c
+ *  cc  -g3 -Wall -DHAVE_DLFCN_H -I../../../src -include freeradius-devel/build.h -L../../../build/lib/local/.libs -ltalloc -lhiredis -lfreeradius-unlang -lfreeradius-util -lfreeradius-server -o test_redis test.c redis.c io.c crc16.c pipeline.c mock.c
+ *
+ *  Runs against an in-process mock server (see mock.c) so no redis-server is required.
  */
 #include <freeradius-devel/util/acutest.h>
 #include "base.h"
 #include "io.h"
+#include "mock.h"
 #include "pipeline.h"
 
 #define DEBUG_LVL_SET if (test_verbose_level__ >= 3) fr_debug_lvl = L_DBG_LVL_4 + 1
 
-
 typedef struct {
 	fr_time_t	start;
 	uint64_t	enqueued;
+	uint64_t	received;
+	fr_dlist_head_t	*completed;	//!< Replies, valid until the command set is freed.
+	bool		done;
+	bool		failed;
 } redis_pipeline_stats_t;
 
-static void _command_complete(REQUEST *request, fr_dlist_head_t *completed, void *rctx)
+typedef struct {
+	TALLOC_CTX			*ctx;
+	fr_event_list_t			*el;
+	fr_redis_mock_t			*mock;
+	fr_redis_cluster_thread_t	*cluster_thread;
+	fr_redis_trunk_t		*rtrunk;
+	fr_connection_conf_t		conn_conf;
+	fr_trunk_conf_t			trunk_conf;
+} redis_test_env_t;
+
+static void _command_complete(UNUSED REQUEST *request, fr_dlist_head_t *completed, void *rctx)
 {
-	fr_time_t		io_stop;
-	fr_time_delta_t		io_time;
 	redis_pipeline_stats_t	*stats = rctx;
-	fr_redis_command_t	*cmd = talloc_get_type_abort(fr_dlist_head(completed), fr_redis_command_t);
-	redisReply		*reply = fr_redis_command_get_result(cmd);
-	io_stop = fr_time();
-	io_time = io_stop - stats->start;
+	fr_redis_command_t	*cmd = NULL;
+	fr_time_delta_t		io_time = fr_time() - stats->start;
+
+	while ((cmd = fr_dlist_next(completed, cmd))) {
+		redisReply *reply = fr_redis_command_get_result(cmd);
+
+		if (reply && (reply->type != REDIS_REPLY_ERROR)) stats->received++;
+	}
 
 	INFO("I/O time %pV (%u rps)",
 	     fr_box_time_delta(io_time),
 	     (uint32_t)(stats->enqueued / ((float)io_time / NSEC)));
 
-	fr_assert(fr_dlist_num_elements(completed) == stats->enqueued);
+	stats->completed = completed;
+	stats->done = true;
 }
 
-static void _command_failed(REQUEST *request, fr_dlist_head_t *completed, void *rctx)
+static void _command_failed(UNUSED REQUEST *request, UNUSED fr_dlist_head_t *completed, void *rctx)
 {
-	TEST_CHECK(0);
+	redis_pipeline_stats_t	*stats = rctx;
+
+	stats->failed = true;
+	stats->done = true;
 }
 
-static void test_basic_connection(void)
+static void test_env_init(redis_test_env_t *env)
 {
-	TALLOC_CTX			*ctx;
-	fr_event_list_t			*el;
-	int				events;
+	fr_ipaddr_t	ipaddr;
+
+	memset(env, 0, sizeof(*env));
+	env->trunk_conf.conn_conf = &env->conn_conf;
+
+	env->ctx = talloc_init("test_ctx");
+	env->el = fr_event_list_alloc(env->ctx, NULL, NULL);
+	TEST_CHECK(env->el != NULL);
+
+	fr_inet_pton4(&ipaddr, "127.0.0.1", -1, false, false, true);
+	env->mock = fr_redis_mock_alloc(env->ctx, env->el, &ipaddr, 0);
+	TEST_CHECK(env->mock != NULL);
+
+	env->cluster_thread = fr_redis_cluster_thread_alloc(env->ctx, env->el, &env->trunk_conf, NULL);
+	env->rtrunk = fr_redis_cluster_thread_trunk(env->cluster_thread, &ipaddr, fr_redis_mock_port(env->mock));
+	TEST_CHECK(env->rtrunk != NULL);
+}
+
+static void test_env_run(redis_test_env_t *env, redis_pipeline_stats_t *stats)
+{
+	while (!stats->done) {
+		if (fr_event_corral(env->el, fr_time(), true) < 0) break;
+		fr_event_service(env->el);
+	}
+}
+
+/** Enqueue a large number of PINGs in a single command set
+ *
+ * The mock server should see far fewer reads than commands, showing the
+ * commands were written as a pipeline.
+ */
+static void test_basic_pipeline(void)
+{
+	redis_test_env_t		env;
+	redis_pipeline_stats_t		stats = { 0 };
 	fr_redis_command_set_t		*cmds;
-	fr_redis_cluster_thread_t	*cluster_thread;
-	fr_redis_trunk_t		*rtrunk;
-	fr_connection_conf_t		conn_conf;
-	fr_trunk_conf_t			trunk_conf;
+	fr_redis_mock_stats_t const	*mock_stats;
 	size_t				i;
-	redis_pipeline_stats_t		stats;
 
 	DEBUG_LVL_SET;
 
-	memset(&conn_conf, 0, sizeof(conn_conf));
-	memset(&trunk_conf, 0, sizeof(trunk_conf));
+	test_env_init(&env);
 
-	trunk_conf.conn_conf = &conn_conf;
+	cmds = fr_redis_command_set_alloc(env.ctx, NULL, _command_complete, _command_failed, &stats);
+	for (i = 0; i < 100000; i++) {
+		TEST_CHECK(fr_redis_command_set_add(cmds, "PING") == FR_REDIS_PIPELINE_OK);
+	}
 
-	ctx = talloc_init("test_ctx");
-	el = fr_event_list_alloc(ctx, NULL, NULL);
+	stats.enqueued = 100000;
+	stats.start = fr_time();
 
-	cmds = fr_redis_command_set_alloc(ctx, NULL, _command_complete, _command_failed, &stats);
-	/*
-	 *	Enqueue 10 set commands
-	 */
-	for (i = 0; i < 1000000; i++) {
-		TEST_CHECK(fr_redis_command_preformatted_add(cmds, "PING", sizeof("PING") - 1) == FR_REDIS_PIPELINE_OK);
-	}
+	TEST_CHECK(fr_redis_command_set_enqueue(env.rtrunk, cmds) == FR_REDIS_PIPELINE_OK);
+
+	test_env_run(&env, &stats);
+
+	TEST_CHECK(!stats.failed);
+	TEST_CHECK(stats.received == stats.enqueued);
+	TEST_MSG("Expected %" PRIu64 " replies, got %" PRIu64, stats.enqueued, stats.received);
+
+	mock_stats = fr_redis_mock_stats(env.mock);
+	TEST_CHECK(mock_stats->commands >= stats.enqueued);
+	TEST_CHECK(mock_stats->reads < stats.enqueued);
+	TEST_MSG("Server performed %" PRIu64 " reads for %" PRIu64 " commands",
+		 mock_stats->reads, mock_stats->commands);
+
+	talloc_free(env.ctx);
+}
+
+/** Check that a transaction and argv formatted commands produce the expected results
+ *
+ */
+static void test_transaction(void)
+{
+	redis_test_env_t		env;
+	redis_pipeline_stats_t		stats = { 0 };
+	fr_redis_command_set_t		*cmds;
+	fr_redis_command_t		*cmd;
+	redisReply			*reply = NULL;
+	char const			*argv[] = { "SET", "key with spaces", "value" };
+	size_t				argvlen[] = { 3, 15, 5 };
 
-	cluster_thread = fr_redis_cluster_thread_alloc(ctx, el, &trunk_conf);
-	rtrunk = fr_redis_trunk_alloc(cluster_thread,  &(fr_redis_io_conf_t){ .hostname = "127.0.0.1", .port = 30001 });
+	DEBUG_LVL_SET;
 
-	stats.enqueued = 1000000;
+	test_env_init(&env);
+
+	cmds = fr_redis_command_set_alloc(env.ctx, NULL, _command_complete, _command_failed, &stats);
+	TEST_CHECK(fr_redis_command_set_add(cmds, "MULTI") == FR_REDIS_PIPELINE_OK);
+	TEST_CHECK(fr_redis_command_set_argv_add(cmds, 3, argv, argvlen) == FR_REDIS_PIPELINE_OK);
+	TEST_CHECK(fr_redis_command_set_add(cmds, "INCR %s", "counter") == FR_REDIS_PIPELINE_OK);
+	TEST_CHECK(fr_redis_command_set_add(cmds, "INCR %s", "counter") == FR_REDIS_PIPELINE_OK);
+	TEST_CHECK(fr_redis_command_set_add(cmds, "EXEC") == FR_REDIS_PIPELINE_OK);
+	TEST_CHECK(fr_redis_command_set_add(cmds, "GET %s", "key with spaces") == FR_REDIS_PIPELINE_OK);
+
+	stats.enqueued = 6;
 	stats.start = fr_time();
 
-	TEST_CHECK(redis_command_set_enqueue(rtrunk, cmds) == FR_REDIS_PIPELINE_OK);
+	TEST_CHECK(fr_redis_command_set_enqueue(env.rtrunk, cmds) == FR_REDIS_PIPELINE_OK);
+
+	test_env_run(&env, &stats);
+
+	TEST_CHECK(!stats.failed);
+	TEST_CHECK(stats.received == stats.enqueued);
+	if (!TEST_CHECK(stats.completed != NULL)) goto finish;
+
+	/*
+	 *	Skip to the EXEC reply
+	 */
+	cmd = NULL;
+	while ((cmd = fr_dlist_next(stats.completed, cmd))) {
+		reply = fr_redis_command_get_result(cmd);
+		if (reply->type == REDIS_REPLY_ARRAY) break;
+	}
+	TEST_CHECK(cmd != NULL);
+	if (cmd) {
+		TEST_CHECK(reply->elements == 3);
+		TEST_CHECK(reply->element[2]->type == REDIS_REPLY_INTEGER);
+		TEST_CHECK(reply->element[2]->integer == 2);
+	}
+
+	cmd = fr_dlist_tail(stats.completed);
+	reply = fr_redis_command_get_result(cmd);
+	TEST_CHECK(reply->type == REDIS_REPLY_STRING);
+	TEST_CHECK((reply->len == 5) && (memcmp(reply->str, "value", 5) == 0));
 
-	do {
-		events = fr_event_corral(el, fr_time(), true);
-		fr_event_service(el);
-	} while (events > 0);
+finish:
+	talloc_free(env.ctx);
 }
 
 TEST_LIST = {
 	/*
 	 *	Basic tests
 	 */
-	{ "Basic - Connection", test_basic_connection},
+	{ "Basic - Pipeline",		test_basic_pipeline },
+	{ "Basic - Transaction",	test_transaction },
 	{ NULL }
 };
@@ -1,3 +1,7 @@
 SUBMAKEFILES := \
 	libfreeradius-server.mk \
+	detail_tests.mk \
+	exfile_tests.mk \
+	pool_tests.mk \
+	state_tests.mk \
 	trunk_tests.mk
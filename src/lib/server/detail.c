@@ -0,0 +1,199 @@
+/*
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ */
+
+/**
+ * $Id$
+ *
+ * @file src/lib/server/detail.c
+ * @brief Encode and decode binary detail file records.
+ *
+ * @copyright 2020 The FreeRADIUS server project
+ */
+RCSID("$Id$")
+
+#include <freeradius-devel/server/detail.h>
+#include <freeradius-devel/internal/internal.h>
+#include <freeradius-devel/util/strerror.h>
+
+/** Start a binary detail record
+ *
+ * @param[in] ctx	to allocate the record in.
+ * @param[out] out	the record to initialise.
+ * @param[in] dict	the packet was decoded with.
+ * @param[in] code	of the packet.
+ * @param[in] when	the packet was received.
+ * @return
+ *	- 0 on success.
+ *	- -1 on failure.
+ */
+int fr_detail_binary_init(TALLOC_CTX *ctx, fr_detail_binary_t *out,
+			  fr_dict_t const *dict, unsigned int code, fr_unix_time_t when)
+{
+	uint8_t		hdr[FR_DETAIL_BINARY_HDR_LEN + 1];
+	char const	*name = fr_dict_root(dict)->name;
+	size_t		name_len = strlen(name);
+
+	if (name_len > UINT8_MAX) {
+		fr_strerror_printf("Dictionary name \"%s\" is too long", name);
+		return -1;
+	}
+
+	memcpy(hdr, FR_DETAIL_BINARY_MAGIC, 3);
+	hdr[3] = FR_DETAIL_BINARY_VERSION;
+	memset(hdr + 4, 0, 8);			/* length and done */
+	fr_net_from_uint32(hdr + 12, code);
+	fr_net_from_uint64(hdr + 16, when);
+	hdr[FR_DETAIL_BINARY_HDR_LEN] = name_len;
+
+	if (talloc_buff_init(ctx, &out->tb, 256) < 0) return -1;
+	out->dict = dict;
+
+	if ((talloc_buff_append(&out->tb, hdr, sizeof(hdr)) < 0) ||
+	    (talloc_buff_append(&out->tb, name, name_len) < 0)) {
+		TALLOC_FREE(out->tb.buff);
+		return -1;
+	}
+
+	return 0;
+}
+
+/** Add a pair to a binary detail record
+ *
+ * @param[in] out	the record.
+ * @param[in] vp	to add.  Only this pair is added, not any
+ *			which follow it.
+ * @return
+ *	- 0 on success.
+ *	- -1 if the pair couldn't be encoded.
+ */
+int fr_detail_binary_add(fr_detail_binary_t *out, VALUE_PAIR *vp)
+{
+	uint8_t		buff[1 + 4096];
+	fr_cursor_t	cursor;
+	ssize_t		slen;
+	fr_dict_t const	*dict = fr_dict_by_da(vp->da);
+
+	if (dict == out->dict) {
+		buff[0] = 0;
+	} else if (dict == fr_dict_internal()) {
+		buff[0] = 1;
+	} else {
+		fr_strerror_printf("Attribute %s is from the wrong dictionary", vp->da->name);
+		return -1;
+	}
+
+	fr_cursor_init(&cursor, &vp);
+	slen = fr_internal_encode_pair(buff + 1, sizeof(buff) - 1, &cursor, NULL);
+	if (slen <= 0) {
+		fr_strerror_printf_push("Failed encoding %s", vp->da->name);
+		return -1;
+	}
+
+	return talloc_buff_append(&out->tb, buff, 1 + slen);
+}
+
+/** Finish a binary detail record
+ *
+ * @param[in] out	the record.
+ * @return the length of the record.
+ */
+size_t fr_detail_binary_finish(fr_detail_binary_t *out)
+{
+	fr_net_from_uint32(out->tb.buff + 4, out->tb.used);
+
+	return out->tb.used;
+}
+
+/** Decode a binary detail record
+ *
+ * @param[in] ctx	to allocate pairs in.
+ * @param[in] cursor	to append pairs to.
+ * @param[out] dict	the packet was decoded with.
+ * @param[out] code	of the packet.
+ * @param[out] when	the packet was received.
+ * @param[in] data	the record.
+ * @param[in] data_len	of the data.  Must contain the whole record.
+ * @return
+ *	- >0 the length of the record.
+ *	- <0 on error.  Any pairs which were decoded are left in the cursor.
+ */
+ssize_t fr_detail_binary_decode(TALLOC_CTX *ctx, fr_cursor_t *cursor, fr_dict_t const **dict,
+				unsigned int *code, fr_unix_time_t *when,
+				uint8_t const *data, size_t data_len)
+{
+	ssize_t		len;
+	uint8_t const	*p, *end;
+	char		name[UINT8_MAX + 1];
+	size_t		name_len;
+
+	len = fr_detail_binary_length(data, data_len);
+	if ((len <= 0) || ((size_t) len > data_len)) {
+		fr_strerror_printf("Malformed binary detail record");
+		return -1;
+	}
+
+	end = data + len;
+	name_len = data[FR_DETAIL_BINARY_HDR_LEN];
+	p = data + FR_DETAIL_BINARY_HDR_LEN + 1;
+	if ((size_t)(end - p) < name_len) {
+		fr_strerror_printf("Binary detail record truncated");
+		return -1;
+	}
+
+	memcpy(name, p, name_len);
+	name[name_len] = '\0';
+	p += name_len;
+
+	*dict = fr_dict_by_protocol_name(name);
+	if (!*dict) {
+		fr_strerror_printf("Unknown dictionary \"%s\"", name);
+		return -1;
+	}
+
+	*code = fr_net_to_uint32(data + 12);
+	*when = fr_net_to_uint64(data + 16);
+
+	while (p < end) {
+		fr_dict_t const	*pair_dict;
+		ssize_t		slen;
+
+		switch (p[0]) {
+		case 0:
+			pair_dict = *dict;
+			break;
+
+		case 1:
+			pair_dict = fr_dict_internal();
+			break;
+
+		default:
+			fr_strerror_printf("Invalid dictionary %u at offset %zu of binary detail record",
+					   p[0], (size_t)(p - data));
+			return -1;
+		}
+		p++;
+
+		slen = fr_internal_decode_pair(ctx, cursor, pair_dict, p, end - p, NULL);
+		if (slen <= 0) {
+			fr_strerror_printf_push("Failed decoding pair at offset %zu of binary detail record",
+						(size_t)(p - data));
+			return -1;
+		}
+		p += slen;
+	}
+
+	return len;
+}
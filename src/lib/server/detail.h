@@ -0,0 +1,140 @@
+#pragma once
+/*
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ */
+
+/**
+ * $Id$
+ *
+ * @file lib/server/detail.h
+ * @brief Binary detail file records.
+ *
+ * @copyright 2020 The FreeRADIUS server project
+ */
+RCSIDH(detail_h, "$Id$")
+
+#include <freeradius-devel/util/cursor.h>
+#include <freeradius-devel/util/dict.h>
+#include <freeradius-devel/util/net.h>
+#include <freeradius-devel/util/pair.h>
+#include <freeradius-devel/util/talloc.h>
+#include <freeradius-devel/util/time.h>
+
+#include <talloc.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/** @name Binary detail records
+ *
+ * A binary record can appear anywhere a text entry can, so one
+ * detail file can contain both.  All integers are in network
+ * byte order, and the pairs are encoded with the internal protocol,
+ * so the records can be read on a different architecture.
+ *
+ @verbatim
+   magic (3) | version (1) | length (4) | done (4) | code (4) | timestamp (8)
+   dictionary name length (1) | dictionary name | pair...
+ @endverbatim
+ *
+ * - The length is of the whole record, including the header.
+ * - done is zero, or "Done" once the record has been processed.  It's
+ *   at the same place in each record, so the reader can mark it
+ *   without parsing the record.
+ * - The timestamp is the Unix time in nanoseconds at which the
+ *   packet was received.
+ * - Each pair is prefixed by one byte, which is zero if the pair is
+ *   from the dictionary named in the header, or one if it's from the
+ *   internal dictionary.
+ *
+ * Text entries start with a printable header, so the first byte of
+ * the magic is enough to tell the two apart.
+ * @{
+ */
+#define FR_DETAIL_BINARY_MAGIC		"\xfd" "FD"
+#define FR_DETAIL_BINARY_VERSION	1
+#define FR_DETAIL_BINARY_HDR_LEN	24			//!< Up to, and not including the dictionary name.
+#define FR_DETAIL_BINARY_DONE_OFFSET	8			//!< Of the "done" field.
+#define FR_DETAIL_BINARY_MAX		(1 << 24)		//!< Larger lengths mean the record is corrupt.
+/** @} */
+
+/** A binary detail record being built
+ *
+ */
+typedef struct {
+	fr_talloc_buff_t	tb;			//!< Holds the record.
+	fr_dict_t const		*dict;			//!< Pairs from this dictionary don't need the internal one.
+} fr_detail_binary_t;
+
+/** Whether the data starts with a binary record
+ *
+ * Only the first byte is checked, the rest of the header is
+ * checked by #fr_detail_binary_length.
+ *
+ * @param[in] data	to check.
+ * @param[in] data_len	of the data.
+ */
+static inline bool fr_detail_binary_is_record(uint8_t const *data, size_t data_len)
+{
+	return (data_len > 0) && (data[0] == (uint8_t) FR_DETAIL_BINARY_MAGIC[0]);
+}
+
+/** Return the length of the binary record at the start of data
+ *
+ * @param[in] data	the record.
+ * @param[in] data_len	of the data, which may be less than the record.
+ * @return
+ *	- >0 the length of the record.
+ *	- 0 if more data is needed to determine the length.
+ *	- <0 if the record is malformed.
+ */
+static inline ssize_t fr_detail_binary_length(uint8_t const *data, size_t data_len)
+{
+	uint32_t len;
+
+	if (data_len < FR_DETAIL_BINARY_HDR_LEN) return 0;
+
+	if ((memcmp(data, FR_DETAIL_BINARY_MAGIC, 3) != 0) ||
+	    (data[3] != FR_DETAIL_BINARY_VERSION)) return -1;
+
+	len = fr_net_to_uint32(data + 4);
+	if ((len < (FR_DETAIL_BINARY_HDR_LEN + 1)) || (len > FR_DETAIL_BINARY_MAX)) return -1;
+
+	return len;
+}
+
+/** Whether a binary record has been marked as done
+ *
+ */
+static inline bool fr_detail_binary_is_done(uint8_t const *data)
+{
+	return memcmp(data + FR_DETAIL_BINARY_DONE_OFFSET, "Done", 4) == 0;
+}
+
+int	fr_detail_binary_init(TALLOC_CTX *ctx, fr_detail_binary_t *out,
+			      fr_dict_t const *dict, unsigned int code, fr_unix_time_t when);
+
+int	fr_detail_binary_add(fr_detail_binary_t *out, VALUE_PAIR *vp);
+
+size_t	fr_detail_binary_finish(fr_detail_binary_t *out);
+
+ssize_t	fr_detail_binary_decode(TALLOC_CTX *ctx, fr_cursor_t *cursor, fr_dict_t const **dict,
+				unsigned int *code, fr_unix_time_t *when,
+				uint8_t const *data, size_t data_len);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,284 @@
+#include <freeradius-devel/util/acutest.h>
+
+#include "detail.c"
+
+#ifndef TEST_DICT_DIR
+#  define TEST_DICT_DIR "share/dictionary"
+#endif
+
+static TALLOC_CTX	*test_ctx;
+static fr_dict_t	*test_dict_internal;
+static fr_dict_t	*test_dict_radius;
+
+/** Load the dictionaries the records are encoded with
+ *
+ * Uses $FR_DICTIONARY_DIR if set, otherwise the dictionaries in the
+ * source tree, so the tests must be run from the top directory.
+ */
+static void test_init(void)
+{
+	char const *dict_dir;
+
+	if (test_ctx) return;
+
+	dict_dir = getenv("FR_DICTIONARY_DIR");
+	if (!dict_dir) dict_dir = TEST_DICT_DIR;
+
+	test_ctx = talloc_autofree_context();
+
+	if (!fr_dict_global_ctx_init(test_ctx, dict_dir) ||
+	    (fr_dict_internal_afrom_file(&test_dict_internal, FR_DICTIONARY_INTERNAL_DIR) < 0) ||
+	    (fr_dict_protocol_afrom_file(&test_dict_radius, "radius", NULL) < 0)) {
+		fr_perror("detail_tests");
+		fr_exit_now(EXIT_FAILURE);
+	}
+}
+
+/** Build a list with pairs from both the RADIUS and internal dictionaries
+ *
+ */
+static VALUE_PAIR *test_pairs(TALLOC_CTX *ctx)
+{
+	VALUE_PAIR	*head = NULL, *vp;
+
+	TEST_CHECK(fr_pair_list_afrom_str(ctx, test_dict_radius,
+					  "User-Name = \"bob\", Acct-Status-Type = Start, "
+					  "Framed-IP-Address = 192.0.2.1, Acct-Session-Time = 3600",
+					  &head) != T_INVALID);
+
+	MEM(vp = fr_pair_afrom_da(ctx, fr_dict_attr_by_name(test_dict_internal, "Tmp-String-0")));
+	fr_pair_value_strdup(vp, "internal");
+	fr_pair_add(&head, vp);
+
+	return head;
+}
+
+/** Encode a list as a record
+ *
+ */
+static size_t test_encode(TALLOC_CTX *ctx, fr_detail_binary_t *record, VALUE_PAIR *head)
+{
+	fr_cursor_t	cursor;
+	VALUE_PAIR	*vp;
+
+	TEST_CHECK(fr_detail_binary_init(ctx, record, test_dict_radius, 4, fr_unix_time_from_sec(1577836800)) == 0);
+
+	for (vp = fr_cursor_init(&cursor, &head);
+	     vp;
+	     vp = fr_cursor_next(&cursor)) {
+		TEST_CHECK(fr_detail_binary_add(record, vp) == 0);
+	}
+
+	return fr_detail_binary_finish(record);
+}
+
+static void test_round_trip(void)
+{
+	TALLOC_CTX		*ctx;
+	fr_detail_binary_t	record;
+	VALUE_PAIR		*in, *out = NULL;
+	fr_cursor_t		cursor;
+	fr_dict_t const		*dict;
+	unsigned int		code;
+	fr_unix_time_t		when;
+	size_t			len;
+
+	test_init();
+	ctx = talloc_new(NULL);
+
+	in = test_pairs(ctx);
+	len = test_encode(ctx, &record, in);
+
+	TEST_CASE("Header");
+	TEST_CHECK(fr_detail_binary_is_record(record.tb.buff, len));
+	TEST_CHECK(fr_detail_binary_length(record.tb.buff, len) == (ssize_t) len);
+	TEST_CHECK(!fr_detail_binary_is_done(record.tb.buff));
+
+	TEST_CASE("Decode");
+	fr_cursor_init(&cursor, &out);
+	TEST_CHECK(fr_detail_binary_decode(ctx, &cursor, &dict, &code, &when, record.tb.buff, len) == (ssize_t) len);
+	TEST_CHECK(dict == test_dict_radius);
+	TEST_CHECK(code == 4);
+	TEST_CHECK(when == fr_unix_time_from_sec(1577836800));
+	TEST_CHECK(fr_pair_list_cmp(in, out) == 0);
+
+	TEST_CASE("Done marker");
+	memcpy(record.tb.buff + FR_DETAIL_BINARY_DONE_OFFSET, "Done", 4);
+	TEST_CHECK(fr_detail_binary_is_done(record.tb.buff));
+
+	talloc_free(ctx);
+}
+
+static void test_wrong_dict(void)
+{
+	TALLOC_CTX		*ctx;
+	fr_detail_binary_t	record;
+	VALUE_PAIR		*vp;
+	fr_dict_t		*dhcp;
+
+	test_init();
+	ctx = talloc_new(NULL);
+
+	TEST_CHECK(fr_dict_protocol_afrom_file(&dhcp, "dhcpv4", NULL) == 0);
+	MEM(vp = fr_pair_afrom_da(ctx, fr_dict_attr_by_name(dhcp, "DHCP-Hostname")));
+	fr_pair_value_strdup(vp, "host");
+
+	TEST_CHECK(fr_detail_binary_init(ctx, &record, test_dict_radius, 4, 0) == 0);
+	TEST_CHECK(fr_detail_binary_add(&record, vp) < 0);
+
+	fr_dict_free(&dhcp);
+	talloc_free(ctx);
+}
+
+static void test_length(void)
+{
+	uint8_t		hdr[FR_DETAIL_BINARY_HDR_LEN] = { 0 };
+
+	memcpy(hdr, FR_DETAIL_BINARY_MAGIC, 3);
+	hdr[3] = FR_DETAIL_BINARY_VERSION;
+
+	TEST_CASE("Text entries aren't records");
+	TEST_CHECK(!fr_detail_binary_is_record((uint8_t const *) "Thu Jan", 7));
+	TEST_CHECK(!fr_detail_binary_is_record(hdr, 0));
+
+	TEST_CASE("Short headers need more data");
+	TEST_CHECK(fr_detail_binary_length(hdr, sizeof(hdr) - 1) == 0);
+
+	TEST_CASE("Lengths shorter than the header are malformed");
+	fr_net_from_uint32(hdr + 4, FR_DETAIL_BINARY_HDR_LEN);
+	TEST_CHECK(fr_detail_binary_length(hdr, sizeof(hdr)) < 0);
+
+	TEST_CASE("Lengths over the maximum are malformed");
+	fr_net_from_uint32(hdr + 4, FR_DETAIL_BINARY_MAX + 1);
+	TEST_CHECK(fr_detail_binary_length(hdr, sizeof(hdr)) < 0);
+
+	TEST_CASE("Valid length");
+	fr_net_from_uint32(hdr + 4, FR_DETAIL_BINARY_MAX);
+	TEST_CHECK(fr_detail_binary_length(hdr, sizeof(hdr)) == FR_DETAIL_BINARY_MAX);
+
+	TEST_CASE("Bad version");
+	hdr[3] = FR_DETAIL_BINARY_VERSION + 1;
+	TEST_CHECK(fr_detail_binary_length(hdr, sizeof(hdr)) < 0);
+
+	TEST_CASE("Bad magic");
+	hdr[3] = FR_DETAIL_BINARY_VERSION;
+	hdr[1] = 'X';
+	TEST_CHECK(fr_detail_binary_length(hdr, sizeof(hdr)) < 0);
+}
+
+/** Every truncation of a record must be rejected without reading past the end
+ *
+ * Each prefix is copied into a buffer of exactly that size, so
+ * over-reads are caught by the address sanitiser or valgrind.
+ */
+static void test_truncated(void)
+{
+	TALLOC_CTX		*ctx;
+	fr_detail_binary_t	record;
+	VALUE_PAIR		*head = NULL, *vp;
+	fr_cursor_t		cursor;
+	fr_dict_t const		*dict;
+	unsigned int		code;
+	fr_unix_time_t		when;
+	size_t			len, i;
+
+	test_init();
+	ctx = talloc_new(NULL);
+
+	len = test_encode(ctx, &record, test_pairs(ctx));
+
+	TEST_CASE("Data shorter than the record");
+	for (i = 0; i < len; i++) {
+		uint8_t *copy;
+
+		MEM(copy = talloc_memdup(ctx, record.tb.buff, i));
+		fr_cursor_init(&cursor, &head);
+		TEST_CHECK(fr_detail_binary_decode(ctx, &cursor, &dict, &code, &when, copy, i) < 0);
+		TEST_MSG("Decoded record truncated to %zu of %zu bytes", i, len);
+		fr_pair_list_free(&head);
+		talloc_free(copy);
+	}
+
+	/*
+	 *	The length field is rewritten so it agrees with the
+	 *	data, and the only pair is cut short.  Cutting between
+	 *	pairs would leave a valid record.
+	 */
+	TEST_CASE("Record length shorter than its pair");
+	MEM(vp = fr_pair_afrom_da(ctx, fr_dict_attr_by_name(test_dict_radius, "User-Name")));
+	fr_pair_value_strdup(vp, "bob");
+	len = test_encode(ctx, &record, vp);
+
+	for (i = FR_DETAIL_BINARY_HDR_LEN + 1 + strlen("radius") + 1; i < len; i++) {
+		uint8_t *copy;
+
+		MEM(copy = talloc_memdup(ctx, record.tb.buff, i));
+		fr_net_from_uint32(copy + 4, i);
+		fr_cursor_init(&cursor, &head);
+		TEST_CHECK(fr_detail_binary_decode(ctx, &cursor, &dict, &code, &when, copy, i) < 0);
+		TEST_MSG("Decoded record with length %zu of %zu bytes", i, len);
+		fr_pair_list_free(&head);
+		talloc_free(copy);
+	}
+
+	talloc_free(ctx);
+}
+
+static void test_malformed(void)
+{
+	TALLOC_CTX		*ctx;
+	fr_detail_binary_t	record;
+	VALUE_PAIR		*head = NULL;
+	fr_cursor_t		cursor;
+	fr_dict_t const		*dict;
+	unsigned int		code;
+	fr_unix_time_t		when;
+	size_t			len, name_len = strlen("radius");
+	uint8_t			*copy;
+
+	test_init();
+	ctx = talloc_new(NULL);
+
+	len = test_encode(ctx, &record, test_pairs(ctx));
+
+	TEST_CASE("Dictionary name longer than the record");
+	MEM(copy = talloc_memdup(ctx, record.tb.buff, len));
+	fr_net_from_uint32(copy + 4, FR_DETAIL_BINARY_HDR_LEN + 1 + 2);
+	fr_cursor_init(&cursor, &head);
+	TEST_CHECK(fr_detail_binary_decode(ctx, &cursor, &dict, &code, &when, copy, len) < 0);
+	talloc_free(copy);
+
+	TEST_CASE("Unknown dictionary");
+	MEM(copy = talloc_memdup(ctx, record.tb.buff, len));
+	copy[FR_DETAIL_BINARY_HDR_LEN + 1] = 'x';
+	fr_cursor_init(&cursor, &head);
+	TEST_CHECK(fr_detail_binary_decode(ctx, &cursor, &dict, &code, &when, copy, len) < 0);
+	talloc_free(copy);
+
+	TEST_CASE("Invalid pair dictionary flag");
+	MEM(copy = talloc_memdup(ctx, record.tb.buff, len));
+	copy[FR_DETAIL_BINARY_HDR_LEN + 1 + name_len] = 2;
+	fr_cursor_init(&cursor, &head);
+	TEST_CHECK(fr_detail_binary_decode(ctx, &cursor, &dict, &code, &when, copy, len) < 0);
+	TEST_CHECK(head == NULL);
+	talloc_free(copy);
+
+	fr_pair_list_free(&head);
+	talloc_free(ctx);
+}
+
+TEST_LIST = {
+	/*
+	 *	Basic tests
+	 */
+	{ "Basic - Round trip",				test_round_trip },
+	{ "Basic - Wrong dictionary",			test_wrong_dict },
+
+	/*
+	 *	Bounds checks
+	 */
+	{ "Bounds - Length",				test_length },
+	{ "Bounds - Truncated",				test_truncated },
+	{ "Bounds - Malformed",				test_malformed },
+	{ NULL }
+};
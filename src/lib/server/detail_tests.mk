@@ -0,0 +1,8 @@
+TARGET		:= detail_tests
+
+SOURCES		:= detail_tests.c
+
+TGT_LDLIBS	:= $(LIBS)
+TGT_LDFLAGS	:= $(LDFLAGS)
+
+TGT_PREREQS	:= libfreeradius-util.a libfreeradius-internal.a
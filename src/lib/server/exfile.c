@@ -26,11 +26,13 @@
 #include <freeradius-devel/server/base.h>
 #include <freeradius-devel/util/debug.h>
 #include <freeradius-devel/server/exfile.h>
+#include <freeradius-devel/unlang/base.h>
 
 #include <freeradius-devel/util/misc.h>
 
 #include <sys/stat.h>
 #include <fcntl.h>
+#include <pthread.h>
 
 typedef struct {
 	int			fd;			//!< File descriptor associated with an entry.
@@ -41,6 +43,45 @@ typedef struct {
 	char			*filename;		//!< Filename.
 } exfile_entry_t;
 
+typedef struct exfile_buffer_s exfile_buffer_t;
+
+/** A durable writer waiting for its data to be flushed
+ *
+ * Allocated in the writer's request.  The flush thread writes a byte to
+ * the pipe when it's done, so the request can yield instead of blocking
+ * the worker thread.
+ */
+struct exfile_wait_s {
+	exfile_wait_t		*next;			//!< Next waiter for the same file.
+	exfile_t		*ef;			//!< The data was written to.
+	exfile_buffer_t		*buf;			//!< The data was added to.  NULL if not linked.
+	char const		*filename;		//!< For error messages.
+	int			fd[2];			//!< Pipe written to when the data has been flushed.
+	bool			done;			//!< Set by the flush thread.
+	int			ret;			//!< Result of the flush.
+};
+
+/** Data waiting to be written to a file
+ *
+ */
+struct exfile_buffer_s {
+	exfile_buffer_t		*next;			//!< Next file with buffered data.
+	char			*filename;		//!< Filename.
+	uint32_t		hash;			//!< Hash for cheap comparison.
+	mode_t			permissions;		//!< To create the file with.
+	time_t			last_used;		//!< Last time data was added.
+
+	uint8_t			*data;			//!< Data waiting to be written.
+	size_t			len;			//!< Length of the data.
+	size_t			size;			//!< Of the data buffer.
+
+	uint8_t			*spare;			//!< Buffer swapped in when the data is flushed.
+	size_t			spare_size;		//!< Of the spare buffer.
+
+	exfile_wait_t		*waiting;		//!< Writers waiting for the data to be flushed.
+	exfile_wait_t		*flushing;		//!< Writers waiting for the flush in progress.
+};
+
 
 struct exfile_s {
 	uint32_t		max_entries;		//!< How many file descriptors we keep track of.
@@ -52,6 +93,20 @@ struct exfile_s {
 	CONF_SECTION		*conf;			//!< Conf section to search for triggers.
 	char const		*trigger_prefix;	//!< Trigger path in the global trigger section.
 	VALUE_PAIR		*trigger_args;		//!< Arguments to pass to trigger.
+	bool			chgrp;			//!< Whether to set the group of opened files.
+	gid_t			gid;			//!< Group to set.
+
+	struct {
+		exfile_buffer_conf_t	conf;		//!< How and when to flush.
+		pthread_mutex_t		mutex;		//!< Protects the list of buffers.
+		pthread_cond_t		flush;		//!< Signalled to wake the flush thread.
+		pthread_cond_t		done;		//!< Signalled when a buffer has been flushed.
+		pthread_t		thread;		//!< Writes the buffers to disk.
+		bool			running;	//!< Whether the flush thread has been started.
+		bool			stop;		//!< Tells the flush thread to exit.
+		bool			full;		//!< A buffer has reached the flush size.
+		exfile_buffer_t		*head;		//!< Files with buffered data.
+	} buffer;
 };
 
 #define MAX_TRY_LOCK 4			//!< How many times we attempt to acquire a lock
@@ -116,10 +171,20 @@ static void exfile_cleanup_entry(exfile_t *ef, REQUEST *request, exfile_entry_t
 }
 
 
+static void exfile_buffer_stop(exfile_t *ef);
+
 static int _exfile_free(exfile_t *ef)
 {
 	uint32_t i;
 
+	/*
+	 *	Write out any buffered data before we
+	 *	close the files.
+	 */
+	if (ef->buffer.conf.enabled) exfile_buffer_stop(ef);
+
+	if (!ef->locking) return 0;
+
 	pthread_mutex_lock(&ef->mutex);
 
 	for (i = 0; i < ef->max_entries; i++) {
@@ -157,6 +222,8 @@ exfile_t *exfile_init(TALLOC_CTX *ctx, uint32_t max_entries, uint32_t max_idle,
 	ef->max_idle = max_idle;
 	ef->locking = locking;
 
+	talloc_set_destructor(ef, _exfile_free);
+
 	/*
 	 *	If we're not locking the files, just return the
 	 *	handle.  Each call to exfile_open() will just open a
@@ -166,17 +233,17 @@ exfile_t *exfile_init(TALLOC_CTX *ctx, uint32_t max_entries, uint32_t max_idle,
 
 	ef->entries = talloc_zero_array(ef, exfile_entry_t, max_entries);
 	if (!ef->entries) {
+		ef->locking = false;
 		talloc_free(ef);
 		return NULL;
 	}
 
 	if (pthread_mutex_init(&ef->mutex, NULL) != 0) {
+		ef->locking = false;
 		talloc_free(ef);
 		return NULL;
 	}
 
-	talloc_set_destructor(ef, _exfile_free);
-
 	return ef;
 }
 
@@ -205,6 +272,34 @@ void exfile_enable_triggers(exfile_t *ef, CONF_SECTION *conf, char const *trigge
 	(void) fr_pair_list_copy(ef, &ef->trigger_args, trigger_args);
 }
 
+/** Set the group of files when they're opened
+ *
+ * The group is checked when a file is opened, not on every write,
+ * so new files (including ones created by the flush thread) get the
+ * right group without a chown() per record.
+ *
+ * @param[in] ef	to set the group for.
+ * @param[in] gid	to set on opened files.
+ */
+void exfile_set_group(exfile_t *ef, gid_t gid)
+{
+	ef->chgrp = true;
+	ef->gid = gid;
+}
+
+/*
+ *	Set the group of a file we've just opened, if it's
+ *	not already correct.
+ */
+static void exfile_chgrp(exfile_t *ef, REQUEST *request, int fd, struct stat const *st, char const *filename)
+{
+	if (!ef->chgrp || (st->st_gid == ef->gid)) return;
+
+	if (fchown(fd, -1, ef->gid) < 0) {
+		ROPTIONAL(RWARN, WARN, "Unable to change system group of %s: %s", filename, fr_syserror(errno));
+	}
+}
+
 
 /*
  *	Try to open the file. It it doesn't exist, try to
@@ -290,6 +385,8 @@ int exfile_open(exfile_t *ef, REQUEST *request, char const *filename, mode_t per
 		found = exfile_open_mkdir(ef, filename, permissions);
 		if (found < 0) return -1;
 
+		if (ef->chgrp && (fstat(found, &st) == 0)) exfile_chgrp(ef, request, found, &st, filename);
+
 		(void) lseek(found, 0, SEEK_END);
 		return found;
 	}
@@ -464,6 +561,12 @@ try_lock:
 	ef->entries[i].st_dev = st.st_dev;
 	ef->entries[i].st_ino = st.st_ino;
 
+	/*
+	 *	We already have the file's details, so this
+	 *	costs nothing unless the group is wrong.
+	 */
+	exfile_chgrp(ef, request, ef->entries[i].fd, &st, filename);
+
 	/*
 	 *	Sometimes the file permissions are changed externally.
 	 *	just be sure to update the permission if necessary.
@@ -552,3 +655,612 @@ int exfile_close(exfile_t *ef, REQUEST *request, int fd)
 	fr_strerror_printf("Attempt to unlock file which is not tracked");
 	return -1;
 }
+
+/** Global configuration for buffered writes
+ *
+ */
+CONF_PARSER const exfile_buffer_config[] = {
+	{ FR_CONF_OFFSET("enable", FR_TYPE_BOOL, exfile_buffer_conf_t, enabled), .dflt = "no" },
+	{ FR_CONF_OFFSET("size", FR_TYPE_SIZE, exfile_buffer_conf_t, size), .dflt = "65536" },
+	{ FR_CONF_OFFSET("interval", FR_TYPE_TIME_DELTA, exfile_buffer_conf_t, interval), .dflt = "0.1" },
+	{ FR_CONF_OFFSET("fsync", FR_TYPE_BOOL, exfile_buffer_conf_t, fsync), .dflt = "no" },
+	{ FR_CONF_OFFSET("durable", FR_TYPE_BOOL, exfile_buffer_conf_t, durable), .dflt = "no" },
+	CONF_PARSER_TERMINATOR
+};
+
+/** Write a complete buffer to an open file
+ *
+ */
+static int exfile_write_all(int fd, uint8_t const *data, size_t len)
+{
+	while (len > 0) {
+		ssize_t slen;
+
+		slen = write(fd, data, len);
+		if (slen < 0) {
+			if (errno == EINTR) continue;
+			return -1;
+		}
+
+		data += slen;
+		len -= slen;
+	}
+
+	return 0;
+}
+
+/** Write one file's buffered data out to disk
+ *
+ * Called by the flush thread, without the buffer mutex held.
+ */
+static int exfile_buffer_write(exfile_t *ef, exfile_buffer_t *buf, uint8_t const *data, size_t len)
+{
+	int fd, ret = 0;
+
+	fd = exfile_open(ef, NULL, buf->filename, buf->permissions);
+	if (fd < 0) {
+		PERROR("Failed opening %s", buf->filename);
+		return -1;
+	}
+
+	if (exfile_write_all(fd, data, len) < 0) {
+		ERROR("Failed writing to %s: %s", buf->filename, fr_syserror(errno));
+		ret = -1;
+	} else if (ef->buffer.conf.fsync && (fsync(fd) < 0)) {
+		ERROR("Failed syncing %s: %s", buf->filename, fr_syserror(errno));
+		ret = -1;
+	}
+
+	exfile_close(ef, NULL, fd);
+
+	return ret;
+}
+
+/** Tell a durable writer its data has been flushed
+ *
+ * Called with the buffer mutex held, so the waiter can't be freed.
+ */
+static void exfile_wait_wake(exfile_wait_t *wait, int ret)
+{
+	ssize_t slen;
+
+	wait->ret = ret;
+	wait->done = true;
+
+	do {
+		slen = write(wait->fd[1], "", 1);
+	} while ((slen < 0) && (errno == EINTR));
+}
+
+/** Flush every buffer which has data
+ *
+ * Called with the buffer mutex held.  The mutex is released while each
+ * file is being written, so writers can keep adding data to the spare
+ * buffer.
+ */
+static void exfile_buffer_flush(exfile_t *ef)
+{
+	exfile_buffer_t	*buf, **last;
+	time_t		now = time(NULL);
+
+	ef->buffer.full = false;
+
+	/*
+	 *	Buffers are only ever added at the head, and
+	 *	only we remove them, so the list is stable
+	 *	while the mutex is released.
+	 */
+	for (buf = ef->buffer.head; buf; buf = buf->next) {
+		exfile_wait_t	*w, *next;
+		uint8_t		*data;
+		size_t		len, size;
+		int		ret;
+
+		if (!buf->len) continue;
+
+		data = buf->data;
+		len = buf->len;
+		size = buf->size;
+
+		buf->data = buf->spare;
+		buf->size = buf->spare_size;
+		buf->len = 0;
+		buf->spare = NULL;
+		buf->spare_size = 0;
+
+		/*
+		 *	Kept in the buffer, so waiters which are
+		 *	cancelled during the write can unlink
+		 *	themselves.
+		 */
+		buf->flushing = buf->waiting;
+		buf->waiting = NULL;
+
+		pthread_mutex_unlock(&ef->buffer.mutex);
+		ret = exfile_buffer_write(ef, buf, data, len);
+		pthread_mutex_lock(&ef->buffer.mutex);
+
+		buf->spare = data;
+		buf->spare_size = size;
+
+		for (w = buf->flushing; w; w = next) {
+			next = w->next;
+			w->next = NULL;
+			exfile_wait_wake(w, ret);
+		}
+		buf->flushing = NULL;
+
+		/*
+		 *	Wakes writers waiting for space.
+		 */
+		pthread_cond_broadcast(&ef->buffer.done);
+	}
+
+	/*
+	 *	Forget about files which haven't been
+	 *	written to recently.
+	 */
+	last = &ef->buffer.head;
+	while ((buf = *last)) {
+		if (buf->len || buf->waiting || ((buf->last_used + ef->max_idle) >= now)) {
+			last = &buf->next;
+			continue;
+		}
+
+		*last = buf->next;
+		free(buf->data);
+		free(buf->spare);
+		talloc_free(buf);
+	}
+}
+
+/** Main loop for the flush thread
+ *
+ */
+static void *exfile_buffer_thread(void *arg)
+{
+	exfile_t	*ef = arg;
+
+	pthread_mutex_lock(&ef->buffer.mutex);
+	while (!ef->buffer.stop) {
+		if (!ef->buffer.full) {
+			struct timespec	ts;
+			fr_time_delta_t	when;
+
+			clock_gettime(CLOCK_REALTIME, &ts);
+			when = fr_time_delta_from_timespec(&ts) + ef->buffer.conf.interval;
+			ts.tv_sec = when / NSEC;
+			ts.tv_nsec = when % NSEC;
+
+			pthread_cond_timedwait(&ef->buffer.flush, &ef->buffer.mutex, &ts);
+		}
+
+		exfile_buffer_flush(ef);
+	}
+
+	/*
+	 *	Write out anything added while we were
+	 *	being told to stop.
+	 */
+	exfile_buffer_flush(ef);
+	pthread_mutex_unlock(&ef->buffer.mutex);
+
+	return NULL;
+}
+
+/** Stop the flush thread, writing out all buffered data
+ *
+ */
+static void exfile_buffer_stop(exfile_t *ef)
+{
+	exfile_buffer_t	*buf, *next;
+
+	pthread_mutex_lock(&ef->buffer.mutex);
+	if (ef->buffer.running) {
+		ef->buffer.stop = true;
+		pthread_cond_signal(&ef->buffer.flush);
+		pthread_mutex_unlock(&ef->buffer.mutex);
+
+		pthread_join(ef->buffer.thread, NULL);
+
+		pthread_mutex_lock(&ef->buffer.mutex);
+		ef->buffer.running = false;
+	}
+
+	for (buf = ef->buffer.head; buf; buf = next) {
+		next = buf->next;
+		free(buf->data);
+		free(buf->spare);
+		talloc_free(buf);
+	}
+	ef->buffer.head = NULL;
+	pthread_mutex_unlock(&ef->buffer.mutex);
+
+	pthread_cond_destroy(&ef->buffer.done);
+	pthread_cond_destroy(&ef->buffer.flush);
+	pthread_mutex_destroy(&ef->buffer.mutex);
+}
+
+/** Buffer writes made with exfile_writev()
+ *
+ * Data written to each file is appended to an in-memory buffer shared
+ * by all threads, and a background thread writes each buffer out with
+ * a single call, once it reaches conf->size, or conf->interval has
+ * passed.  This turns the open, lock, write, unlock, close sequence
+ * for every record into one sequence per flush.
+ *
+ * If conf->durable is set, exfile_writev() gives the caller an
+ * #exfile_wait_t, and the request should yield with exfile_wait_yield()
+ * until the data has been written (and synced, if conf->fsync is set),
+ * so the data is on disk before the request is acknowledged.  Otherwise
+ * buffered data will be lost if the server crashes.
+ *
+ * @param[in] ef	to enable buffering for.  Must not have been used yet.
+ * @param[in] conf	How and when to flush.
+ * @return
+ *	- 0 on success.
+ *	- -1 on failure.
+ */
+int exfile_buffer_enable(exfile_t *ef, exfile_buffer_conf_t const *conf)
+{
+	if (!conf->enabled) return 0;
+
+	if (!conf->size) {
+		fr_strerror_printf("Buffer size must be greater than zero");
+		return -1;
+	}
+
+	if (conf->interval <= 0) {
+		fr_strerror_printf("Flush interval must be greater than zero");
+		return -1;
+	}
+
+	if (pthread_mutex_init(&ef->buffer.mutex, NULL) != 0) {
+		fr_strerror_printf("Failed initialising mutex");
+		return -1;
+	}
+	pthread_cond_init(&ef->buffer.flush, NULL);
+	pthread_cond_init(&ef->buffer.done, NULL);
+
+	ef->buffer.conf = *conf;
+
+	return 0;
+}
+
+/** Unlink a waiter from a list
+ *
+ */
+static bool exfile_wait_unlink(exfile_wait_t **head, exfile_wait_t *wait)
+{
+	exfile_wait_t **last;
+
+	for (last = head; *last; last = &(*last)->next) {
+		if (*last != wait) continue;
+
+		*last = wait->next;
+		return true;
+	}
+
+	return false;
+}
+
+/** Stop waiting, if the request is freed before its data is flushed
+ *
+ */
+static int _exfile_wait_free(exfile_wait_t *wait)
+{
+	if (wait->buf) {
+		pthread_mutex_lock(&wait->ef->buffer.mutex);
+		if (!wait->done && !exfile_wait_unlink(&wait->buf->waiting, wait)) {
+			(void) exfile_wait_unlink(&wait->buf->flushing, wait);
+		}
+		pthread_mutex_unlock(&wait->ef->buffer.mutex);
+	}
+
+	if (wait->fd[0] >= 0) close(wait->fd[0]);
+	if (wait->fd[1] >= 0) close(wait->fd[1]);
+
+	return 0;
+}
+
+/** Allocate a waiter for a durable write
+ *
+ */
+static exfile_wait_t *exfile_wait_alloc(exfile_t *ef, REQUEST *request, char const *filename)
+{
+	exfile_wait_t *wait;
+
+	wait = talloc_zero(request, exfile_wait_t);
+	if (!wait) {
+		fr_strerror_printf("Out of memory");
+		return NULL;
+	}
+	wait->ef = ef;
+	wait->fd[0] = wait->fd[1] = -1;
+	talloc_set_destructor(wait, _exfile_wait_free);
+
+	wait->filename = talloc_typed_strdup(wait, filename);
+	if (!wait->filename) {
+		fr_strerror_printf("Out of memory");
+	error:
+		talloc_free(wait);
+		return NULL;
+	}
+
+	if (pipe(wait->fd) < 0) {
+		fr_strerror_printf("Failed creating pipe: %s", fr_syserror(errno));
+		goto error;
+	}
+
+	if ((fr_nonblock(wait->fd[0]) < 0) || (fr_nonblock(wait->fd[1]) < 0)) {
+		fr_strerror_printf("Failed setting pipe to non-blocking: %s", fr_syserror(errno));
+		goto error;
+	}
+
+	return wait;
+}
+
+/** Add data to a file's buffer
+ *
+ * The flush thread is started on first use, so that it's created after
+ * the server has forked into the background.
+ */
+static int exfile_buffer_add(exfile_t *ef, REQUEST *request, char const *filename, mode_t permissions,
+			     struct iovec const *vector, int iovcnt, exfile_wait_t **wait_p)
+{
+	exfile_buffer_t	*buf;
+	exfile_wait_t	*wait = NULL;
+	uint32_t	hash;
+	size_t		len = 0;
+	int		i, ret;
+
+	for (i = 0; i < iovcnt; i++) len += vector[i].iov_len;
+
+	hash = fr_hash_string(filename);
+
+	if (ef->buffer.conf.durable && wait_p) {
+		wait = exfile_wait_alloc(ef, request, filename);
+		if (!wait) return -1;
+	}
+
+	pthread_mutex_lock(&ef->buffer.mutex);
+
+	if (!ef->buffer.running) {
+		ef->buffer.stop = false;
+
+		ret = pthread_create(&ef->buffer.thread, NULL, exfile_buffer_thread, ef);
+		if (ret != 0) {
+			pthread_mutex_unlock(&ef->buffer.mutex);
+			fr_strerror_printf("Failed creating flush thread: %s", fr_syserror(ret));
+			talloc_free(wait);
+			return -1;
+		}
+		ef->buffer.running = true;
+	}
+
+	for (buf = ef->buffer.head; buf; buf = buf->next) {
+		if ((buf->hash == hash) && (strcmp(buf->filename, filename) == 0)) break;
+	}
+
+	if (!buf) {
+		/*
+		 *	Not parented, as other threads
+		 *	allocate from ef without the mutex.
+		 */
+		buf = talloc_zero(NULL, exfile_buffer_t);
+		if (!buf) {
+		oom:
+			pthread_mutex_unlock(&ef->buffer.mutex);
+			fr_strerror_printf("Out of memory");
+			talloc_free(wait);
+			return -1;
+		}
+		buf->filename = talloc_typed_strdup(buf, filename);
+		if (!buf->filename) {
+			talloc_free(buf);
+			goto oom;
+		}
+		buf->hash = hash;
+		buf->permissions = permissions;
+
+		buf->next = ef->buffer.head;
+		ef->buffer.head = buf;
+	}
+
+	/*
+	 *	Don't let the buffer grow without bound if
+	 *	the disk can't keep up.  Wait for the flush
+	 *	thread to swap it out.
+	 *
+	 *	Durable writers don't wait here, as they're
+	 *	already limited by the number of requests
+	 *	waiting for a flush.
+	 */
+	while (!wait && (buf->len >= (ef->buffer.conf.size * 4)) && ef->buffer.running) {
+		ef->buffer.full = true;
+		pthread_cond_signal(&ef->buffer.flush);
+		pthread_cond_wait(&ef->buffer.done, &ef->buffer.mutex);
+	}
+
+	if ((buf->len + len) > buf->size) {
+		size_t	size = buf->size ? buf->size : ef->buffer.conf.size;
+		uint8_t	*data;
+
+		while (size < (buf->len + len)) size *= 2;
+
+		data = realloc(buf->data, size);
+		if (!data) goto oom;
+
+		buf->data = data;
+		buf->size = size;
+	}
+
+	for (i = 0; i < iovcnt; i++) {
+		memcpy(buf->data + buf->len, vector[i].iov_base, vector[i].iov_len);
+		buf->len += vector[i].iov_len;
+	}
+	buf->last_used = time(NULL);
+
+	if (buf->len >= ef->buffer.conf.size) {
+		ef->buffer.full = true;
+		pthread_cond_signal(&ef->buffer.flush);
+	}
+
+	if (!wait) {
+		pthread_mutex_unlock(&ef->buffer.mutex);
+		return 0;
+	}
+
+	/*
+	 *	Wake the flush thread.  Writers arriving while a
+	 *	flush is in progress all wait for the next one,
+	 *	so they share one write (and fsync).
+	 */
+	ROPTIONAL(RDEBUG3, DEBUG3, "Waiting for %s to be flushed", filename);
+
+	wait->buf = buf;
+	wait->next = buf->waiting;
+	buf->waiting = wait;
+
+	ef->buffer.full = true;
+	pthread_cond_signal(&ef->buffer.flush);
+	pthread_mutex_unlock(&ef->buffer.mutex);
+
+	*wait_p = wait;
+
+	return 1;
+}
+
+/** Write data to a file
+ *
+ * If buffering is enabled, the data is added to the file's buffer, and
+ * written by the flush thread.  Otherwise the file is opened, written
+ * to, and returned to the pool.
+ *
+ * @param ef The logfile context returned from exfile_init().
+ * @param request The current request.
+ * @param filename the file to write to.
+ * @param permissions to use if the file needs to be created.
+ * @param vector of data to write.
+ * @param iovcnt Number of elements in vector.
+ * @param wait Where to write the #exfile_wait_t for a durable write.  May be
+ *	NULL if the caller can't wait, in which case the data is only buffered.
+ * @return
+ *	- 1 if the write is durable, and the caller should yield with
+ *	  exfile_wait_yield() until the data has been flushed.
+ *	- 0 on success.
+ *	- -1 on failure.
+ */
+int exfile_writev(exfile_t *ef, REQUEST *request, char const *filename, mode_t permissions,
+		  struct iovec const *vector, int iovcnt, exfile_wait_t **wait)
+{
+	int	fd, i, ret = 0;
+	ssize_t	slen;
+
+	if (!ef || !filename) return -1;
+
+	if (ef->buffer.conf.enabled) return exfile_buffer_add(ef, request, filename, permissions, vector, iovcnt, wait);
+	fd = exfile_open(ef, request, filename, permissions);
+	if (fd < 0) return -1;
+
+	do {
+		slen = writev(fd, vector, iovcnt);
+	} while ((slen < 0) && (errno == EINTR));
+
+	/*
+	 *	Finish off a short write one element at a time.
+	 */
+	for (i = 0; (slen >= 0) && (i < iovcnt); i++) {
+		if ((size_t)slen >= vector[i].iov_len) {
+			slen -= vector[i].iov_len;
+			continue;
+		}
+
+		if (exfile_write_all(fd, (uint8_t const *)vector[i].iov_base + slen, vector[i].iov_len - slen) < 0) {
+			slen = -1;
+			break;
+		}
+		slen = 0;
+	}
+
+	if (slen < 0) {
+		fr_strerror_printf("Failed writing to %s: %s", filename, fr_syserror(errno));
+		ret = -1;
+	}
+
+	exfile_close(ef, request, fd);
+
+	return ret;
+}
+
+/** Mark the request as resumable once its data has been flushed
+ *
+ */
+static void exfile_wait_done(UNUSED void *instance, UNUSED void *thread, REQUEST *request, void *rctx, int fd)
+{
+	(void) unlang_module_fd_delete(request, rctx, fd);
+	unlang_interpret_resumable(request);
+}
+
+/** Stop waiting for the flush if the request is cancelled
+ *
+ */
+static void exfile_wait_signal(UNUSED void *instance, UNUSED void *thread, REQUEST *request, void *rctx,
+			       fr_state_signal_t action)
+{
+	exfile_wait_t *wait = talloc_get_type_abort(rctx, exfile_wait_t);
+
+	if (action != FR_SIGNAL_CANCEL) return;
+
+	RDEBUG2("Request cancelled - No longer waiting for %s to be flushed", wait->filename);
+
+	(void) unlang_module_fd_delete(request, wait, wait->fd[0]);
+	talloc_free(wait);
+}
+
+/** Yield until the data from a durable write has been flushed
+ *
+ * The worker thread continues processing other requests while the
+ * flush thread writes the data out.
+ *
+ * @param[in] request	The current request.
+ * @param[in] wait	returned by exfile_writev().
+ * @param[in] resume	Called once the data has been flushed, with wait as
+ *			its rctx.  Should call exfile_wait_result().
+ * @return
+ *	- RLM_MODULE_YIELD on success.
+ *	- RLM_MODULE_FAIL on failure.
+ */
+rlm_rcode_t exfile_wait_yield(REQUEST *request, exfile_wait_t *wait, fr_unlang_module_resume_t resume)
+{
+	if (unlang_module_fd_add(request, exfile_wait_done, NULL, exfile_wait_done, wait, wait->fd[0]) < 0) {
+		RPERROR("Failed waiting for %s to be flushed", wait->filename);
+		talloc_free(wait);
+		return RLM_MODULE_FAIL;
+	}
+
+	return unlang_module_yield(request, resume, exfile_wait_signal, wait);
+}
+
+/** Get the result of a durable write, and free the waiter
+ *
+ * @param[in] wait	returned by exfile_writev().
+ * @return
+ *	- 0 if the data was written.
+ *	- -1 if writing the data failed, or the data hasn't been flushed yet.
+ */
+int exfile_wait_result(exfile_wait_t *wait)
+{
+	exfile_t	*ef = wait->ef;
+	int		ret;
+
+	pthread_mutex_lock(&ef->buffer.mutex);
+	ret = wait->done ? wait->ret : -1;
+	pthread_mutex_unlock(&ef->buffer.mutex);
+
+	if (ret < 0) fr_strerror_printf("Failed flushing %s", wait->filename);
+
+	talloc_free(wait);
+
+	return ret;
+}
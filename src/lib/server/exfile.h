@@ -25,8 +25,12 @@
  */
 RCSIDH(exfile_h, "$Id$")
 
+#include <freeradius-devel/server/cf_parse.h>
+#include <freeradius-devel/server/rcode.h>
 #include <freeradius-devel/server/request.h>
 
+#include <sys/uio.h>
+
 #ifdef __cplusplus
 extern "C" {
 #endif
@@ -35,16 +39,50 @@ extern "C" {
  */
 typedef struct exfile_s exfile_t;
 
+/*
+ *	A request waiting for a durable write to be flushed.
+ */
+typedef struct exfile_wait_s exfile_wait_t;
+
+/** Configuration for buffered writes
+ *
+ */
+typedef struct {
+	bool			enabled;		//!< Buffer writes, and flush them from a background thread.
+	size_t			size;			//!< Flush a file once this much data is buffered for it.
+	fr_time_delta_t		interval;		//!< Maximum time data is buffered before being flushed.
+	bool			fsync;			//!< Call fsync() after each flush.
+	bool			durable;		//!< Requests yield until their data has been flushed.
+} exfile_buffer_conf_t;
+
+extern CONF_PARSER const exfile_buffer_config[];
+
 exfile_t	*exfile_init(TALLOC_CTX *ctx, uint32_t entries, uint32_t idle, bool locking);
 
+int		exfile_buffer_enable(exfile_t *ef, exfile_buffer_conf_t const *conf);
+
 void		exfile_enable_triggers(exfile_t *ef, CONF_SECTION *cs, char const *trigger_prefix,
 				       VALUE_PAIR *trigger_args);
 
+void		exfile_set_group(exfile_t *ef, gid_t gid);
+
 int		exfile_open(exfile_t *lf, REQUEST *request, char const *filename,
 			    mode_t permissions);
 
 int		exfile_close(exfile_t *lf, REQUEST *request, int fd);
 
+int		exfile_writev(exfile_t *ef, REQUEST *request, char const *filename, mode_t permissions,
+			      struct iovec const *vector, int iovcnt, exfile_wait_t **wait);
+
+/*
+ *	The resume function is an fr_unlang_module_resume_t.  The unlang
+ *	headers can't be included here, as they include this one.
+ */
+rlm_rcode_t	exfile_wait_yield(REQUEST *request, exfile_wait_t *wait,
+				  rlm_rcode_t (*resume)(void *instance, void *thread, REQUEST *request, void *rctx));
+
+int		exfile_wait_result(exfile_wait_t *wait);
+
 #ifdef __cplusplus
 }
 #endif
@@ -0,0 +1,304 @@
+#include <freeradius-devel/util/acutest.h>
+#include <poll.h>
+
+#include "exfile.c"
+
+#define TEST_RECORD		"0123456789abcdef\n"
+#define TEST_RECORD_LEN		(sizeof(TEST_RECORD) - 1)
+
+/** Create a directory for a test file, and return the path of the file
+ *
+ * Each test gets its own directory, as acutest runs each test in its own process.
+ */
+static char *test_path(char const *name)
+{
+	char	dir[] = "/tmp/exfile_tests.XXXXXX";
+	char	*path;
+
+	TEST_CHECK(mkdtemp(dir) != NULL);
+	MEM(path = talloc_asprintf(NULL, "%s/%s", dir, name));
+
+	return path;
+}
+
+/** Remove a test file, and its directory
+ *
+ */
+static void test_path_free(char *path)
+{
+	char *p;
+
+	unlink(path);
+	p = strrchr(path, '/');
+	if (p) {
+		*p = '\0';
+		rmdir(path);
+	}
+	talloc_free(path);
+}
+
+/** Allocate a handle with buffering enabled
+ *
+ */
+static exfile_t *test_exfile_alloc(TALLOC_CTX *ctx, size_t size, fr_time_delta_t interval, bool durable)
+{
+	exfile_buffer_conf_t	conf = {
+					.enabled = true,
+					.size = size,
+					.interval = interval,
+					.durable = durable
+				};
+	exfile_t		*ef;
+
+	ef = exfile_init(ctx, 16, 30, true);
+	TEST_CHECK(ef != NULL);
+	if (ef) TEST_CHECK(exfile_buffer_enable(ef, &conf) == 0);
+
+	return ef;
+}
+
+static int test_write(exfile_t *ef, char const *path, exfile_wait_t **wait)
+{
+	struct iovec vector = { .iov_base = TEST_RECORD, .iov_len = TEST_RECORD_LEN };
+
+	return exfile_writev(ef, NULL, path, 0600, &vector, 1, wait);
+}
+
+static off_t test_size(char const *path)
+{
+	struct stat st;
+
+	if (stat(path, &st) < 0) return -1;
+
+	return st.st_size;
+}
+
+/** Wait up to five seconds for the flush thread to write a file
+ *
+ */
+static bool test_wait_size(char const *path, off_t size)
+{
+	int i;
+
+	for (i = 0; i < 500; i++) {
+		if (test_size(path) == size) return true;
+		usleep(10000);
+	}
+
+	return false;
+}
+
+/** Check a file contains num records
+ *
+ */
+static void test_file_check(char const *path, unsigned int num)
+{
+	char		buffer[TEST_RECORD_LEN];
+	int		fd;
+	unsigned int	i;
+
+	TEST_CHECK(test_size(path) == (off_t)(num * TEST_RECORD_LEN));
+	TEST_MSG("Expected %zu bytes, got %zd", num * TEST_RECORD_LEN, (ssize_t)test_size(path));
+
+	fd = open(path, O_RDONLY);
+	if (!TEST_CHECK(fd >= 0)) return;
+
+	for (i = 0; i < num; i++) {
+		if (!TEST_CHECK(read(fd, buffer, sizeof(buffer)) == (ssize_t)sizeof(buffer)) ||
+		    !TEST_CHECK(memcmp(buffer, TEST_RECORD, sizeof(buffer)) == 0)) {
+			TEST_MSG("Record %u is missing or corrupt", i);
+			break;
+		}
+	}
+
+	close(fd);
+}
+
+/** Check whether a durable writer has been woken, waiting up to five seconds
+ *
+ */
+static bool test_woken(exfile_wait_t *wait)
+{
+	struct pollfd pfd = { .fd = wait->fd[0], .events = POLLIN };
+
+	return (poll(&pfd, 1, 5000) == 1);
+}
+
+static void test_flush_size(void)
+{
+	TALLOC_CTX	*ctx = talloc_init("test");
+	exfile_t	*ef;
+	char		*path = test_path("size");
+	unsigned int	i, num = 4;
+
+	ef = test_exfile_alloc(ctx, num * TEST_RECORD_LEN, fr_time_delta_from_sec(3600), false);
+
+	TEST_CASE("Nothing is written until the buffer is full");
+	for (i = 0; i < num - 1; i++) TEST_CHECK(test_write(ef, path, NULL) == 0);
+	usleep(100000);
+	TEST_CHECK(test_size(path) <= 0);
+
+	TEST_CASE("Filling the buffer flushes it");
+	TEST_CHECK(test_write(ef, path, NULL) == 0);
+	TEST_CHECK(test_wait_size(path, num * TEST_RECORD_LEN));
+	test_file_check(path, num);
+
+	TEST_CASE("Writes continue after a flush");
+	for (i = 0; i < num; i++) TEST_CHECK(test_write(ef, path, NULL) == 0);
+	TEST_CHECK(test_wait_size(path, 2 * num * TEST_RECORD_LEN));
+	test_file_check(path, 2 * num);
+
+	talloc_free(ctx);
+	test_path_free(path);
+}
+
+static void test_flush_interval(void)
+{
+	TALLOC_CTX	*ctx = talloc_init("test");
+	exfile_t	*ef;
+	char		*path = test_path("interval");
+
+	ef = test_exfile_alloc(ctx, 65536, fr_time_delta_from_msec(50), false);
+
+	TEST_CASE("Data is written after the interval, without the buffer filling");
+	TEST_CHECK(test_write(ef, path, NULL) == 0);
+	TEST_CHECK(test_write(ef, path, NULL) == 0);
+	TEST_CHECK(test_wait_size(path, 2 * TEST_RECORD_LEN));
+	test_file_check(path, 2);
+
+	talloc_free(ctx);
+	test_path_free(path);
+}
+
+static void test_durable(void)
+{
+	TALLOC_CTX	*ctx = talloc_init("test");
+	exfile_t	*ef;
+	exfile_wait_t	*a = NULL, *b = NULL;
+	char		*path = test_path("durable");
+
+	ef = test_exfile_alloc(ctx, 65536, fr_time_delta_from_sec(3600), true);
+
+	TEST_CASE("Durable writes return a waiter, without blocking");
+	TEST_CHECK(test_write(ef, path, &a) == 1);
+	TEST_CHECK(test_write(ef, path, &b) == 1);
+	if (!TEST_CHECK(a && b)) goto finish;
+
+	TEST_CASE("Waiters are woken once their data has been flushed");
+	TEST_CHECK(test_woken(a));
+	TEST_CHECK(test_woken(b));
+	test_file_check(path, 2);
+
+	TEST_CASE("The result of the flush is returned");
+	TEST_CHECK(exfile_wait_result(a) == 0);
+	TEST_CHECK(exfile_wait_result(b) == 0);
+
+	TEST_CASE("Callers which can't wait only buffer the data");
+	TEST_CHECK(test_write(ef, path, NULL) == 0);
+
+finish:
+	talloc_free(ctx);
+	test_path_free(path);
+}
+
+static void test_durable_cancel(void)
+{
+	TALLOC_CTX	*ctx = talloc_init("test");
+	exfile_t	*ef;
+	exfile_wait_t	*wait = NULL;
+	char		*path = test_path("cancel");
+	int		i;
+
+	ef = test_exfile_alloc(ctx, 65536, fr_time_delta_from_sec(3600), true);
+
+	/*
+	 *	The waiter may be freed before, during or after
+	 *	the flush, so run this a few times.
+	 */
+	TEST_CASE("Waiters can be freed before their data is flushed");
+	for (i = 0; i < 20; i++) {
+		TEST_CHECK(test_write(ef, path, &wait) == 1);
+		talloc_free(wait);
+	}
+
+	TEST_CASE("The data is still written");
+	TEST_CHECK(test_wait_size(path, 20 * TEST_RECORD_LEN));
+
+	talloc_free(ctx);
+	test_path_free(path);
+}
+
+static void test_stop(void)
+{
+	TALLOC_CTX	*ctx = talloc_init("test");
+	exfile_t	*ef;
+	char		*path = test_path("stop");
+	unsigned int	i;
+
+	ef = test_exfile_alloc(ctx, 65536, fr_time_delta_from_sec(3600), false);
+
+	for (i = 0; i < 10; i++) TEST_CHECK(test_write(ef, path, NULL) == 0);
+	TEST_CHECK(test_size(path) <= 0);
+
+	TEST_CASE("Freeing the handle writes out all buffered data");
+	talloc_free(ctx);
+	test_file_check(path, 10);
+
+	test_path_free(path);
+}
+
+static void test_group(void)
+{
+	TALLOC_CTX	*ctx = talloc_init("test");
+	exfile_t	*ef;
+	char		*path = test_path("group");
+	gid_t		groups[64];
+	int		i, num;
+	struct stat	st;
+
+	/*
+	 *	We can only change the group to one we're a member
+	 *	of, and it has to be different from the default.
+	 */
+	num = getgroups(NUM_ELEMENTS(groups), groups);
+	for (i = 0; i < num; i++) if (groups[i] != getegid()) break;
+	if (i >= num) {
+		TEST_MSG("No supplementary groups, skipping");
+		goto finish;
+	}
+
+	ef = test_exfile_alloc(ctx, 65536, fr_time_delta_from_sec(3600), false);
+	exfile_set_group(ef, groups[i]);
+
+	TEST_CASE("Files created by the flush thread get the group");
+	TEST_CHECK(test_write(ef, path, NULL) == 0);
+	TALLOC_FREE(ctx);
+
+	TEST_CHECK(stat(path, &st) == 0);
+	TEST_CHECK(st.st_gid == groups[i]);
+
+finish:
+	talloc_free(ctx);
+	test_path_free(path);
+}
+
+TEST_LIST = {
+	/*
+	 *	When buffers are flushed
+	 */
+	{ "Flush - Size",				test_flush_size },
+	{ "Flush - Interval",				test_flush_interval },
+	{ "Flush - Stop",				test_stop },
+
+	/*
+	 *	Writers waiting for their data to be flushed
+	 */
+	{ "Durable - Wake",				test_durable },
+	{ "Durable - Cancel",				test_durable_cancel },
+
+	/*
+	 *	Files created by the flush thread
+	 */
+	{ "Group",					test_group },
+	{ NULL }
+};
@@ -13,6 +13,7 @@ SOURCES	:= \
 	connection.c \
 	crypt.c \
 	dependency.c \
+	detail.c \
 	dl_module.c \
 	exec.c \
 	exfile.c \
@@ -33,6 +34,7 @@ SOURCES	:= \
 	request.c \
 	snmp.c \
 	state.c \
+	state_backend.c \
 	stats.c \
 	tmpl.c \
 	trigger.c \
@@ -51,7 +53,7 @@ ifneq ($(OPENSSL_LIBS),)
 TGT_PREREQS	:= libfreeradius-tls.a
 endif
 
-TGT_PREREQS	+= libfreeradius-util.a
+TGT_PREREQS	+= libfreeradius-util.a libfreeradius-internal.a
 
 ifneq ($(MAKECMDGOALS),scan)
 SRC_CFLAGS	+= -DBUILT_WITH_CPPFLAGS=\"$(CPPFLAGS)\" -DBUILT_WITH_CFLAGS=\"$(CFLAGS)\" -DBUILT_WITH_LDFLAGS=\"$(LDFLAGS)\" -DBUILT_WITH_LIBS=\"$(LIBS)\"
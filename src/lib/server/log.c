@@ -226,6 +226,32 @@ static int log_always(fr_log_t const *log, fr_log_type_t type,
 	return r;
 }
 
+/** Adjust the type of a request message which isn't going to a debug log
+ *
+ * Unless we're at a high debug level, warnings and errors are
+ * prefixed so they stand out from the surrounding debug output.
+ *
+ * @param[in,out] type	of the message.
+ * @return text to add before the message.
+ */
+static char const *log_request_type(fr_log_type_t *type)
+{
+	if (DEBUG_ENABLED3) return "";
+
+	switch (*type) {
+	case L_DBG_WARN:
+		*type = L_DBG_WARN_REQ;
+		return "WARNING: ";
+
+	case L_DBG_ERR:
+		*type = L_DBG_ERR_REQ;
+		return "ERROR: ";
+
+	default:
+		return "";
+	}
+}
+
 /** Whether a request specific debug message should be logged
  *
  * @param lvl of debugging this message should be logged at.
@@ -267,6 +293,8 @@ void vlog_request(fr_log_type_t type, fr_log_lvl_t lvl, REQUEST *request,
 		  char const *fmt, va_list ap, void *uctx)
 {
 	char const	*filename;
+	char const	*path = NULL;
+	char		*exp = NULL;
 	FILE		*fp = NULL;
 
 	char		*p;
@@ -281,6 +309,7 @@ void vlog_request(fr_log_type_t type, fr_log_lvl_t lvl, REQUEST *request,
 
 	fr_log_t	*log_dst = uctx;
 	TALLOC_CTX	*pool;
+	int		ret;
 
 	/*
 	 *	No output means no output.
@@ -311,15 +340,14 @@ void vlog_request(fr_log_type_t type, fr_log_lvl_t lvl, REQUEST *request,
 		/*
 		 *	If we're debugging to a file, then use that.
 		 *
-		 *	@todo: have fr_vlog() take a fr_log_t*, so
-		 *	that we can cache the opened descriptor, and
-		 *	we don't need to re-open it on every log
-		 *	message.
+		 *	The file is opened and closed for every
+		 *	message, so this is done by the log writer
+		 *	thread when asynchronous logging is enabled.
 		 */
 		switch (log_dst->dst) {
 		case L_DST_FILES:
-			fp = fopen(log_dst->file, "a");
-			if (!fp) goto finish;
+			if (!log_dst->file) goto finish;
+			path = log_dst->file;
 			break;
 
 #if defined(HAVE_FOPENCOOKIE) || defined (HAVE_FUNOPEN)
@@ -352,7 +380,6 @@ void vlog_request(fr_log_type_t type, fr_log_lvl_t lvl, REQUEST *request,
 	}
 
 	if (filename) {
-		char		*exp;
 		log_dst_t	*dst;
 
 		dst = request->log.dst;
@@ -389,8 +416,7 @@ void vlog_request(fr_log_type_t type, fr_log_lvl_t lvl, REQUEST *request,
 			*p = FR_DIR_SEP;
 		}
 
-		fp = fopen(exp, "a");
-		talloc_free(exp);
+		path = exp;
 	}
 
 print_fmt:
@@ -437,15 +463,35 @@ print_fmt:
 	 *  I don't buy that explanation, but doing a va_copy here does prevent SEGVs seen when
 	 *  running unit tests which generate errors under CI.
 	 */
+	/*
+	 *	Let the log writer do the formatting.  Only the
+	 *	prefix is expanded here, the arguments are copied.
+	 */
+	if (!fp && !path && fr_log_deferred(log_dst)) {
+		fr_log_type_t	deferred_type = type;
+		char const	*prefix;
+
+		prefix = talloc_typed_asprintf(pool, "%s%.*s%s%s",
+					       fmt_prefix, unlang_indent, spaces, fmt_module,
+					       log_request_type(&deferred_type));
+		if (prefix) {
+			va_copy(aq, ap);
+			ret = fr_vlog_deferred(log_dst, deferred_type, file, line, prefix, fmt, aq);
+			va_end(aq);
+			if (ret >= 0) goto finish;
+		}
+	}
+
 	va_copy(aq, ap);
 	fmt_exp = fr_vasprintf(pool, fmt, aq);
 	va_end(aq);
 
 	/*
-	 *	Logging to a file descriptor
+	 *	Logging to a file
 	 */
-	if (fp) {
+	if (fp || path) {
 		char time_buff[64];	/* The current timestamp */
+		char *buffer;
 
 		time_t timeval;
 		timeval = time(NULL);
@@ -471,42 +517,41 @@ print_fmt:
 		p = strrchr(time_buff, '\n');
 		if (p) p[0] = '\0';
 
-		fprintf(fp,
-			"%s"		/* location */
-			"%s"		/* prefix */
-			"%s : "		/* time */
-			"%s"		/* facility */
-			"%.*s"		/* indent */
-			"%s"		/* module */
-			"%s"		/* message */
-			"\n",
-			fmt_location,
-			fmt_prefix,
-			time_buff,
-			fr_table_str_by_value(fr_log_levels, type, ""),
-			unlang_indent, spaces,
-			fmt_module,
-			fmt_exp);
-		fclose(fp);
-		goto finish;
+		buffer = talloc_typed_asprintf(pool,
+					       "%s"	/* location */
+					       "%s"	/* prefix */
+					       "%s : "	/* time */
+					       "%s"	/* facility */
+					       "%.*s"	/* indent */
+					       "%s"	/* module */
+					       "%s"	/* message */
+					       "\n",
+					       fmt_location,
+					       fmt_prefix,
+					       time_buff,
+					       fr_table_str_by_value(fr_log_levels, type, ""),
+					       unlang_indent, spaces,
+					       fmt_module,
+					       fmt_exp);
+
+		if (fp) {
+			fputs(buffer, fp);
+			fclose(fp);
+			goto finish;
+		}
+
+		/*
+		 *	If we can't write to the request's log
+		 *	file, fall back to the main log.
+		 */
+		if ((fr_log_file_append(path, buffer, talloc_array_length(buffer) - 1) == 0) ||
+		    ((type & L_DBG) != 0)) goto finish;
 	}
 
 	/*
 	 *	Logging everywhere else
 	 */
-	if (!DEBUG_ENABLED3) switch (type) {
-	case L_DBG_WARN:
-		extra = "WARNING: ";
-		type = L_DBG_WARN_REQ;
-		break;
-
-	case L_DBG_ERR:
-		extra = "ERROR: ";
-		type = L_DBG_ERR_REQ;
-		break;
-	default:
-		break;
-	};
+	extra = log_request_type(&type);
 
 	log_always(log_dst, type, file, line,
 		   "%s"			/* prefix */
@@ -521,6 +566,7 @@ print_fmt:
 		   fmt_exp);
 
 finish:
+	talloc_free(exp);
 	talloc_free_children(pool);
 }
 
@@ -859,6 +905,8 @@ void log_fatal(fr_log_t const *log, char const *file, int line, char const *fmt,
 	fr_vlog(log, L_ERR, file, line, fmt, ap);
 	va_end(ap);
 
+	fr_log_async_stop();	/* Don't lose queued messages */
+
 	fr_exit_now(EXIT_FAILURE);
 }
 
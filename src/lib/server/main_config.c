@@ -78,7 +78,10 @@ static int hostname_lookups_parse(TALLOC_CTX *ctx, void *out, void *parent, CONF
 
 static int num_networks_parse(TALLOC_CTX *ctx, void *out, void *parent, CONF_ITEM *ci, CONF_PARSER const *rule);
 static int num_workers_parse(TALLOC_CTX *ctx, void *out, void *parent, CONF_ITEM *ci, CONF_PARSER const *rule);
+static int num_offload_parse(TALLOC_CTX *ctx, void *out, void *parent, CONF_ITEM *ci, CONF_PARSER const *rule);
+static int max_offload_queue_parse(TALLOC_CTX *ctx, void *out, void *parent, CONF_ITEM *ci, CONF_PARSER const *rule);
 static int lib_dir_parse(TALLOC_CTX *ctx, void *out, void *parent, CONF_ITEM *ci, CONF_PARSER const *rule);
+static int log_async_ring_size_parse(TALLOC_CTX *ctx, void *out, void *parent, CONF_ITEM *ci, CONF_PARSER const *rule);
 
 static int talloc_memory_limit_parse(TALLOC_CTX *ctx, void *out, void *parent, CONF_ITEM *ci, CONF_PARSER const *rule);
 static int talloc_pool_size_parse(TALLOC_CTX *ctx, void *out, void *parent, CONF_ITEM *ci, CONF_PARSER const *rule);
@@ -137,11 +140,26 @@ static const CONF_PARSER lib_dir_on_read_config[] = {
  *	items, we can parse the rest of the configuration items.
  *
  **********************************************************************/
+static const CONF_PARSER log_async_config[] = {
+	{ FR_CONF_OFFSET("enable", FR_TYPE_BOOL, fr_log_async_conf_t, enabled), .dflt = "no" },
+	{ FR_CONF_OFFSET("ring_size", FR_TYPE_SIZE, fr_log_async_conf_t, ring_size), .dflt = "65536",
+	  .func = log_async_ring_size_parse },
+	{ FR_CONF_OFFSET("overflow", FR_TYPE_UINT32, fr_log_async_conf_t, overflow), .dflt = "drop",
+	  .func = cf_table_parse_uint32,
+	  .uctx = &(cf_table_parse_ctx_t){ .table = fr_log_async_overflow_table, .len = &fr_log_async_overflow_table_len } },
+	{ FR_CONF_OFFSET("format", FR_TYPE_UINT32, fr_log_async_conf_t, format), .dflt = "text",
+	  .func = cf_table_parse_uint32,
+	  .uctx = &(cf_table_parse_ctx_t){ .table = fr_log_async_format_table, .len = &fr_log_async_format_table_len } },
+	CONF_PARSER_TERMINATOR
+};
+
 static const CONF_PARSER log_config[] = {
 	{ FR_CONF_OFFSET("colourise", FR_TYPE_BOOL, main_config_t, do_colourise) },
 	{ FR_CONF_OFFSET("line_number", FR_TYPE_BOOL, main_config_t, log_line_number) },
 	{ FR_CONF_OFFSET("timestamp", FR_TYPE_BOOL, main_config_t, log_timestamp) },
 	{ FR_CONF_OFFSET("use_utc", FR_TYPE_BOOL, main_config_t, log_dates_utc) },
+	{ FR_CONF_OFFSET("async", FR_TYPE_SUBSECTION, main_config_t, log_async),
+	  .subcs = (void const *) log_async_config },
 	CONF_PARSER_TERMINATOR
 };
 
@@ -163,6 +181,10 @@ static const CONF_PARSER thread_config[] = {
 	  .func = num_networks_parse },
 	{ FR_CONF_OFFSET("num_workers", FR_TYPE_UINT32, main_config_t, max_workers), .dflt = STRINGIFY(4),
 	  .func = num_workers_parse },
+	{ FR_CONF_OFFSET("num_offload", FR_TYPE_UINT32, main_config_t, num_offload), .dflt = STRINGIFY(0),
+	  .func = num_offload_parse },
+	{ FR_CONF_OFFSET("max_offload_queue", FR_TYPE_UINT32, main_config_t, max_offload_queue), .dflt = STRINGIFY(1024),
+	  .func = max_offload_queue_parse },
 
 	{ FR_CONF_OFFSET("stats_interval | FR_TYPE_HIDDEN", FR_TYPE_TIME_DELTA, main_config_t, stats_interval), },
 
@@ -460,6 +482,59 @@ static int num_workers_parse(TALLOC_CTX *ctx, void *out, void *parent,
 	return 0;
 }
 
+static int num_offload_parse(TALLOC_CTX *ctx, void *out, void *parent,
+			     CONF_ITEM *ci, CONF_PARSER const *rule)
+{
+	int		ret;
+	uint32_t	value;
+
+	if ((ret = cf_pair_parse_value(ctx, out, parent, ci, rule)) < 0) return ret;
+
+	memcpy(&value, out, sizeof(value));
+
+	FR_INTEGER_BOUND_CHECK("thread.num_offload", value, <=, 256);
+
+	memcpy(out, &value, sizeof(value));
+
+	return 0;
+}
+
+static int max_offload_queue_parse(TALLOC_CTX *ctx, void *out, void *parent,
+				   CONF_ITEM *ci, CONF_PARSER const *rule)
+{
+	int		ret;
+	uint32_t	value;
+
+	if ((ret = cf_pair_parse_value(ctx, out, parent, ci, rule)) < 0) return ret;
+
+	memcpy(&value, out, sizeof(value));
+
+	FR_INTEGER_BOUND_CHECK("thread.max_offload_queue", value, >=, 1);
+	FR_INTEGER_BOUND_CHECK("thread.max_offload_queue", value, <=, 65536);
+
+	memcpy(out, &value, sizeof(value));
+
+	return 0;
+}
+
+static int log_async_ring_size_parse(TALLOC_CTX *ctx, void *out, void *parent,
+				     CONF_ITEM *ci, CONF_PARSER const *rule)
+{
+	int	ret;
+	size_t	value;
+
+	if ((ret = cf_pair_parse_value(ctx, out, parent, ci, rule)) < 0) return ret;
+
+	memcpy(&value, out, sizeof(value));
+
+	FR_SIZE_BOUND_CHECK("log.async.ring_size", value, >=, (size_t)(4 * 1024));
+	FR_SIZE_BOUND_CHECK("log.async.ring_size", value, <=, (size_t)(64 * 1024 * 1024));
+
+	memcpy(out, &value, sizeof(value));
+
+	return 0;
+}
+
 
 static size_t config_escape_func(UNUSED REQUEST *request, char *out, size_t outlen, char const *in, UNUSED void *arg)
 {
@@ -1260,24 +1335,24 @@ int main_config_free(main_config_t **config)
 
 void hup_logfile(main_config_t *config)
 {
-	int fd, old_fd;
+	int fd;
 
 	if (default_log.dst != L_DST_FILES) return;
 
 	fd = open(config->log_file, O_WRONLY | O_APPEND | O_CREAT, 0640);
-	if (fd >= 0) {
-		/*
-		 *	Atomic swap. We'd like to keep the old
-		 *	FD around so that callers don't
-		 *	suddenly find the FD closed, and the
-		 *	writes go nowhere.  But that's hard to
-		 *	do.  So... we have the case where a
-		 *	log message *might* be lost on HUP.
-		 */
-		old_fd = default_log.fd;
-		default_log.fd = fd;
-		close(old_fd);
+	if (fd < 0) return;
+
+	/*
+	 *	Messages queued for the async log writer hold
+	 *	the raw FD number, so it has to stay valid.
+	 *	dup2() atomically points the existing number at
+	 *	the new file, and anything still queued is
+	 *	written there.
+	 */
+	if (dup2(fd, default_log.fd) < 0) {
+		ERROR("HUP - Failed re-opening log file %s: %s", config->log_file, fr_syserror(errno));
 	}
+	close(fd);
 }
 
 void main_config_hup(main_config_t *config)
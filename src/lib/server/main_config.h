@@ -42,6 +42,7 @@ extern main_config_t const *main_config;		//!< Global configuration singleton.
 #include <freeradius-devel/server/tmpl.h>
 
 #include <freeradius-devel/util/dict.h>
+#include <freeradius-devel/util/log.h>
 
 
 /** Main server configuration
@@ -90,6 +91,8 @@ struct main_config_s {
 
 	int32_t		syslog_facility;
 
+	fr_log_async_conf_t	log_async;		//!< Whether messages are written by a dedicated thread.
+
 	char const	*dict_dir;			//!< Where to load dictionaries from.
 
 	size_t		talloc_pool_size;		//!< Size of pool to allocate to hold each #REQUEST.
@@ -138,6 +141,11 @@ struct main_config_s {
 	uint32_t	max_workers;			//!< for the scheduler
 	fr_time_delta_t	stats_interval;			//!< for the scheduler
 
+	uint32_t	num_offload;			//!< Number of threads for running blocking
+							//!< module calls from "parallel offload".
+	uint32_t	max_offload_queue;		//!< Maximum number of calls waiting for
+							//!< an offload thread.
+
 };
 
 void			main_config_name_set_default(main_config_t *config, char const *name, bool overwrite_config);
@@ -1097,6 +1097,30 @@ module_instance_t *module_by_data(void const *data)
 	return talloc_get_type_abort(mi, module_instance_t);
 }
 
+/** Change the type flags of a module instance
+ *
+ * Used by modules which only yield (or only block) in some configurations,
+ * so that "parallel offload" can decide per instance whether calls may be
+ * run on an offload thread.
+ *
+ * @param[in] data	Instance data of the module.
+ * @param[in] type	New RLM_TYPE_* flags for the instance.
+ * @return
+ *	- 0 on success.
+ *	- -1 if no module instance owns data.
+ */
+int module_instance_type_set(void const *data, int type)
+{
+	module_instance_t *mi;
+
+	mi = module_by_data(data);
+	if (!mi) return -1;
+
+	mi->type = type;
+
+	return 0;
+}
+
 
 /** Retrieve module/thread specific instance data for a module
  *
@@ -1573,6 +1597,7 @@ module_instance_t *module_bootstrap(module_instance_t const *parent, CONF_SECTIO
 		return NULL;
 	}
 	mi->number = instance_num++;
+	mi->type = mi->module->type;
 
 	/*
 	 *	Remember the module for later.
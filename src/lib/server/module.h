@@ -63,6 +63,9 @@ extern const char *section_type_value[MOD_COUNT];
 						//!< Server will protect calls
 						//!< with mutex.
 #define RLM_TYPE_RESUMABLE     	(1 << 2) 	//!< does yield / resume
+#define RLM_TYPE_BLOCKING	(1 << 3)	//!< Methods block the calling thread
+						//!< waiting on I/O.  Calls may be run
+						//!< on an offload thread by "parallel offload".
 
 /** Module section callback
  *
@@ -191,6 +194,12 @@ struct module_instance_s {
 
 	module_t const			*module;	//!< Public module structure.  Cached for convenience.
 
+	int				type;		//!< Type flags for this instance.  Copied from
+							///< the module, and may be changed by the module's
+							///< bootstrap or instantiate method, e.g. to mark
+							///< an instance as #RLM_TYPE_RESUMABLE when it's
+							///< configured to use async I/O.
+
 	pthread_mutex_t			*mutex;		//!< To prevent multiple threads entering a thread unsafe
 							///< module.
 
@@ -285,6 +294,8 @@ module_instance_t	*module_by_data(void const *data);
 module_thread_instance_t *module_thread(module_instance_t *mi);
 
 module_thread_instance_t *module_thread_by_data(void const *data);
+
+int		module_instance_type_set(void const *data, int type);
 /** @} */
 
 /** @name Module and module thread initialisation and instantiation
@@ -32,12 +32,19 @@ RCSID("$Id$")
 #include <freeradius-devel/server/modpriv.h>
 #include <freeradius-devel/util/debug.h>
 
+#include <freeradius-devel/util/dlist.h>
 #include <freeradius-devel/util/heap.h>
 #include <freeradius-devel/util/misc.h>
 
+#ifdef HAVE_STDATOMIC_H
+#  include <stdatomic.h>
+#else
+#  include <freeradius-devel/util/stdatomic.h>
+#endif
 #include <time.h>
 
 typedef struct fr_pool_connection_s fr_pool_connection_t;
+typedef struct fr_pool_thread_cache_s fr_pool_thread_cache_t;
 
 static int connection_check(fr_pool_t *pool, REQUEST *request);
 
@@ -68,11 +75,42 @@ struct fr_pool_connection_s {
 
 	bool		needs_reconnecting;	//!< Reconnect this connection before use.
 
+	fr_pool_thread_cache_t	*cache;		//!< Thread cache which owns this connection, if any.
+
 #ifdef PTHREAD_DEBUG
 	pthread_t	pthread_id;		//!< When 'in_use == true'.
 #endif
 };
 
+/** Connections owned by a single thread
+ *
+ * Connections in a thread cache stay "in_use" as far as the rest of the
+ * pool is concerned, and are counted in state.active.  Idle ones are
+ * still counted as spares when deciding whether to open connections.  They're never in
+ * the heap, so the thread which owns them can reserve and release them
+ * without taking the pool mutex.
+ *
+ * The cache mutex is only contended when another thread borrows an idle
+ * connection, or the pool reclaims or closes one.  If both mutexes are
+ * needed, the pool mutex must be locked first.
+ */
+struct fr_pool_thread_cache_s {
+	fr_pool_t		*pool;		//!< Pool the connections belong to.
+
+	pthread_mutex_t		mutex;		//!< Protects the arrays below.
+
+	fr_pool_connection_t	**idle;		//!< Connections which can be reserved.  The most
+						//!< recently released is last.
+	uint32_t		num_idle;	//!< Entries in the idle array.
+
+	fr_pool_connection_t	**held;		//!< Connections reserved by the owning thread.
+	uint32_t		num_held;	//!< Entries in the held array.
+
+	uint32_t		num_owned;	//!< num_idle + num_held.
+
+	fr_dlist_t		entry;		//!< Entry in the pool's list of caches.
+};
+
 /** A connection pool
  *
  * Defines the configuration of the connection pool, all the counters and
@@ -110,6 +148,11 @@ struct fr_pool_s {
 	bool		spread;			//!< If true we spread requests over the connections,
 						//!< using the connection released longest ago, first.
 
+	uint32_t	thread_cache;		//!< Maximum number of connections each thread may keep
+						//!< for itself.  0 disables the thread caches.
+	uint32_t	id;			//!< Unique ID used to find this pool's thread cache.
+	fr_dlist_head_t	caches;			//!< All thread caches.  Protected by the pool mutex.
+
 	fr_heap_t	*heap;			//!< For the next connection heap
 
 	fr_pool_connection_t	*head;		//!< Start of the connection list.
@@ -163,9 +206,15 @@ static const CONF_PARSER pool_config[] = {
 	{ FR_CONF_OFFSET("held_trigger_max", FR_TYPE_TIME_DELTA, fr_pool_t, held_trigger_max), .dflt = "0.5" },
 	{ FR_CONF_OFFSET("retry_delay", FR_TYPE_TIME_DELTA, fr_pool_t, retry_delay), .dflt = "1" },
 	{ FR_CONF_OFFSET("spread", FR_TYPE_BOOL, fr_pool_t, spread), .dflt = "no" },
+	{ FR_CONF_OFFSET("thread_cache", FR_TYPE_UINT32, fr_pool_t, thread_cache), .dflt = "0" },
 	CONF_PARSER_TERMINATOR
 };
 
+static atomic_uint_fast32_t pool_counter = ATOMIC_VAR_INIT(0);
+
+static _Thread_local TALLOC_CTX *pool_thread_ctx;			//!< Parent of pool_thread_caches.
+static _Thread_local fr_pool_thread_cache_t **pool_thread_caches;	//!< Indexed by pool ID.
+
 /** Order connections by reserved most recently
  */
 static int8_t last_reserved_cmp(void const *one, void const *two)
@@ -521,6 +570,61 @@ static fr_pool_connection_t *connection_spawn(fr_pool_t *pool, REQUEST *request,
 	return this;
 }
 
+/** Remove a connection from the thread cache which owns it
+ *
+ * @note Must be called with the cache mutex held.
+ *
+ * @param[in] cache	to modify.
+ * @param[in] this	Connection to remove.
+ */
+static void connection_cache_remove(fr_pool_thread_cache_t *cache, fr_pool_connection_t *this)
+{
+	uint32_t i;
+
+	fr_assert(this->cache == cache);
+
+	for (i = 0; i < cache->num_idle; i++) {
+		if (cache->idle[i] != this) continue;
+
+		/*
+		 *	Keep the idle array in release order.
+		 */
+		memmove(&cache->idle[i], &cache->idle[i + 1], sizeof(cache->idle[0]) * (cache->num_idle - (i + 1)));
+		cache->num_idle--;
+		goto done;
+	}
+
+	for (i = 0; i < cache->num_held; i++) {
+		if (cache->held[i] != this) continue;
+
+		cache->held[i] = cache->held[--cache->num_held];
+		goto done;
+	}
+
+	fr_assert_fail("Connection (%" PRIu64 ") not found in its thread cache", this->number);
+	return;
+
+done:
+	fr_assert(cache->num_owned > 0);
+	cache->num_owned--;
+	this->cache = NULL;
+}
+
+/** Remove a connection from the thread cache which owns it, locking the cache
+ *
+ * @note Must be called with the pool mutex held.
+ *
+ * @param[in] this	Connection to remove.
+ */
+static void connection_cache_detach(fr_pool_connection_t *this)
+{
+	fr_pool_thread_cache_t *cache = this->cache;
+
+	pthread_mutex_lock(&cache->mutex);
+	connection_cache_remove(cache, this);
+	pthread_mutex_unlock(&cache->mutex);
+}
+
 /** Close an existing connection.
  *
  * Removes the connection from the list, calls the delete callback to close
@@ -535,6 +639,11 @@ static fr_pool_connection_t *connection_spawn(fr_pool_t *pool, REQUEST *request,
  */
 static void connection_close_internal(fr_pool_t *pool, REQUEST *request, fr_pool_connection_t *this)
 {
+	/*
+	 *	Connections in a thread cache are always "in_use".
+	 */
+	if (this->cache) connection_cache_detach(this);
+
 	/*
 	 *	If it's in use, release it.
 	 */
@@ -626,6 +735,370 @@ static int connection_manage(fr_pool_t *pool, REQUEST *request, fr_pool_connecti
 	return 1;
 }
 
+/** Check whether a connection can stay in, or be added to, a thread cache
+ *
+ * Applies the same limits as #connection_manage, but doesn't close the
+ * connection.
+ *
+ * @param[in] pool	the connection belongs to.
+ * @param[in] this	Connection to check.
+ * @param[in] now	Current time.
+ * @return
+ *	- true if the connection is still usable.
+ *	- false if it should be returned to the pool.
+ */
+static bool connection_cacheable(fr_pool_t *pool, fr_pool_connection_t *this, fr_time_t now)
+{
+	if (this->needs_reconnecting) return false;
+
+	if ((pool->max_uses > 0) && (this->num_uses >= pool->max_uses)) return false;
+
+	if ((pool->lifetime > 0) && ((this->created + pool->lifetime) < now)) return false;
+
+	if ((pool->idle_timeout > 0) && ((this->last_released + pool->idle_timeout) < now)) return false;
+
+	return true;
+}
+
+/** Return a connection from a thread cache to the pool
+ *
+ * The connection is inserted into the heap, then closed if it's
+ * no longer usable.
+ *
+ * @note Must be called with the pool mutex held, after the connection
+ *	has been removed from its thread cache.
+ *
+ * @param[in] pool	to return the connection to.
+ * @param[in] request	The current request.
+ * @param[in] this	Connection to return.
+ * @param[in] now	Current time.
+ */
+static void connection_cache_return(fr_pool_t *pool, REQUEST *request, fr_pool_connection_t *this, fr_time_t now)
+{
+	fr_assert(this->in_use);
+	fr_assert(!this->cache);
+
+	this->in_use = false;
+
+	fr_assert(pool->state.active != 0);
+	pool->state.active--;
+
+	fr_heap_insert(pool->heap, this);
+	connection_manage(pool, request, this, now);
+}
+
+static void _pool_thread_ctx_free(void *arg)
+{
+	talloc_free(arg);
+}
+
+static int _pool_thread_cache_free(fr_pool_thread_cache_t *cache)
+{
+	pthread_mutex_destroy(&cache->mutex);
+
+	return 0;
+}
+
+/** Return the calling thread's cache for a pool, allocating it if needed
+ *
+ * The caches are parented by the pool, so they're freed with it.  The
+ * thread local array only maps pool IDs to caches, and as IDs are never
+ * reused, entries for pools which have been freed are never looked at again.
+ *
+ * @note Must be called with the pool mutex free.
+ *
+ * @param[in] pool	to return the cache for.
+ * @return
+ *	- The thread cache.
+ *	- NULL on error.
+ */
+static fr_pool_thread_cache_t *pool_thread_cache(fr_pool_t *pool)
+{
+	fr_pool_thread_cache_t	*cache;
+	size_t			len = talloc_array_length(pool_thread_caches);
+
+	if ((pool->id < len) && pool_thread_caches[pool->id]) return pool_thread_caches[pool->id];
+
+	if (!pool_thread_ctx) {
+		TALLOC_CTX *ctx;
+
+		ctx = talloc_init("pool_thread_ctx");
+		if (!ctx) return NULL;
+
+		fr_thread_local_set_destructor(pool_thread_ctx, _pool_thread_ctx_free, ctx);
+	}
+
+	if (pool->id >= len) {
+		fr_pool_thread_cache_t **array;
+
+		array = talloc_realloc(pool_thread_ctx, pool_thread_caches, fr_pool_thread_cache_t *, pool->id + 1);
+		if (!array) return NULL;
+
+		memset(array + len, 0, sizeof(array[0]) * ((pool->id + 1) - len));
+		pool_thread_caches = array;
+	}
+
+	/*
+	 *	Other threads may be allocating memory beneath
+	 *	the pool at the same time.
+	 */
+	pthread_mutex_lock(&pool->mutex);
+	cache = talloc_zero(pool, fr_pool_thread_cache_t);
+	if (!cache) {
+	error:
+		pthread_mutex_unlock(&pool->mutex);
+		return NULL;
+	}
+
+	cache->pool = pool;
+	cache->idle = talloc_array(cache, fr_pool_connection_t *, pool->thread_cache);
+	cache->held = talloc_array(cache, fr_pool_connection_t *, pool->thread_cache);
+	if (!cache->idle || !cache->held) {
+		talloc_free(cache);
+		goto error;
+	}
+
+	pthread_mutex_init(&cache->mutex, NULL);
+	talloc_set_destructor(cache, _pool_thread_cache_free);
+	fr_dlist_insert_tail(&pool->caches, cache);
+	pthread_mutex_unlock(&pool->mutex);
+
+	pool_thread_caches[pool->id] = cache;
+
+	return cache;
+}
+
+/** Reserve a connection from the calling thread's cache
+ *
+ * Connections which have exceeded their limits are returned to the pool
+ * (and closed) as they're found.
+ *
+ * @note Must be called with the pool mutex free.
+ *
+ * @param[in] cache	to reserve the connection from.
+ * @param[in] request	The current request.
+ * @return
+ *	- A connection.
+ *	- NULL if the cache had no usable connections.
+ */
+static fr_pool_connection_t *connection_cache_get(fr_pool_thread_cache_t *cache, REQUEST *request)
+{
+	fr_pool_t		*pool = cache->pool;
+	fr_pool_connection_t	*this;
+	fr_time_t		now = fr_time();
+
+	pthread_mutex_lock(&cache->mutex);
+	while (cache->num_idle > 0) {
+		/*
+		 *	Most recently released first, so the
+		 *	least used connections can idle out.
+		 */
+		this = cache->idle[cache->num_idle - 1];
+		if (connection_cacheable(pool, this, now)) {
+			cache->num_idle--;
+			cache->held[cache->num_held++] = this;
+			pthread_mutex_unlock(&cache->mutex);
+
+			this->num_uses++;
+			this->last_reserved = now;
+#ifdef PTHREAD_DEBUG
+			this->pthread_id = pthread_self();
+#endif
+			ROPTIONAL(RDEBUG2, DEBUG2, "Reserved connection (%" PRIu64 ")", this->number);
+
+			return this;
+		}
+
+		/*
+		 *	The pool mutex must never be locked whilst
+		 *	holding the cache mutex.
+		 */
+		connection_cache_remove(cache, this);
+		pthread_mutex_unlock(&cache->mutex);
+
+		pthread_mutex_lock(&pool->mutex);
+		connection_cache_return(pool, request, this, now);
+		pthread_mutex_unlock(&pool->mutex);
+
+		pthread_mutex_lock(&cache->mutex);
+	}
+	pthread_mutex_unlock(&cache->mutex);
+
+	return NULL;
+}
+
+/** Release a connection reserved from the calling thread's cache
+ *
+ * @note Must be called with the pool mutex free.
+ *
+ * @param[in] cache	to release the connection to.
+ * @param[in] request	The current request.
+ * @param[in] conn	handle to release.
+ * @return
+ *	- true if the connection was released.
+ *	- false if the connection wasn't reserved from this cache.
+ */
+static bool connection_cache_release(fr_pool_thread_cache_t *cache, REQUEST *request, void *conn)
+{
+	fr_pool_t	*pool = cache->pool;
+	uint32_t	i;
+
+	pthread_mutex_lock(&cache->mutex);
+	for (i = 0; i < cache->num_held; i++) {
+		fr_pool_connection_t *this = cache->held[i];
+
+		if (this->connection != conn) continue;
+
+		cache->held[i] = cache->held[--cache->num_held];
+		cache->idle[cache->num_idle++] = this;
+		this->last_released = fr_time();
+		pthread_mutex_unlock(&cache->mutex);
+
+		ROPTIONAL(RDEBUG2, DEBUG2, "Released connection (%" PRIu64 ")", this->number);
+
+		return true;
+	}
+	pthread_mutex_unlock(&cache->mutex);
+
+	return false;
+}
+
+/** Add a connection being released to the calling thread's cache
+ *
+ * @note Must be called with the pool mutex held.
+ *
+ * @param[in] cache	to add the connection to.
+ * @param[in] this	Connection being released.  Must be "in_use".
+ * @param[in] now	Current time.
+ * @return
+ *	- true if the connection was added.  It stays "in_use", and counted
+ *	  in state.active.
+ *	- false if the cache was full, or the connection shouldn't be reused.
+ */
+static bool connection_cache_adopt(fr_pool_thread_cache_t *cache, fr_pool_connection_t *this, fr_time_t now)
+{
+	fr_pool_t	*pool = cache->pool;
+	bool		adopted = false;
+
+	fr_assert(this->in_use);
+	fr_assert(!this->cache);
+
+	this->last_released = now;
+	if (!connection_cacheable(pool, this, now)) return false;
+
+	pthread_mutex_lock(&cache->mutex);
+	if (cache->num_owned < pool->thread_cache) {
+		this->cache = cache;
+		cache->idle[cache->num_idle++] = this;
+		cache->num_owned++;
+		adopted = true;
+	}
+	pthread_mutex_unlock(&cache->mutex);
+
+	return adopted;
+}
+
+/** Take an idle connection from another thread's cache
+ *
+ * Used when the pool is at "max" and the heap is empty.  Caches which
+ * are busy are skipped rather than waited on.
+ *
+ * @note Must be called with the pool mutex held.
+ *
+ * @param[in] pool	to borrow a connection from.
+ * @param[in] request	The current request.
+ * @param[in] now	Current time.
+ * @return
+ *	- A connection, which is "in_use", and counted in state.active.
+ *	- NULL if no idle connections were found.
+ */
+static fr_pool_connection_t *connection_cache_borrow(fr_pool_t *pool, REQUEST *request, fr_time_t now)
+{
+	fr_pool_thread_cache_t	*cache = NULL;
+	fr_pool_connection_t	*this;
+
+	while ((cache = fr_dlist_next(&pool->caches, cache))) {
+		if (pthread_mutex_trylock(&cache->mutex) != 0) continue;
+
+		while (cache->num_idle > 0) {
+			/*
+			 *	Released longest ago, so the owning
+			 *	thread is least likely to miss it.
+			 */
+			this = cache->idle[0];
+			connection_cache_remove(cache, this);
+
+			if (connection_cacheable(pool, this, now)) {
+				pthread_mutex_unlock(&cache->mutex);
+
+				ROPTIONAL(RDEBUG3, DEBUG3, "Borrowed connection (%" PRIu64 ") from another thread",
+					  this->number);
+				return this;
+			}
+
+			connection_cache_return(pool, request, this, now);
+		}
+		pthread_mutex_unlock(&cache->mutex);
+	}
+
+	return NULL;
+}
+
+/** Return any idle connections which have exceeded their limits from the thread caches
+ *
+ * @note Must be called with the pool mutex held.
+ *
+ * @param[in] pool	to manage.
+ * @param[in] request	The current request.
+ * @param[in] now	Current time.
+ */
+static void connection_cache_reclaim(fr_pool_t *pool, REQUEST *request, fr_time_t now)
+{
+	fr_pool_thread_cache_t	*cache = NULL;
+
+	while ((cache = fr_dlist_next(&pool->caches, cache))) {
+		uint32_t i = 0;
+
+		if (pthread_mutex_trylock(&cache->mutex) != 0) continue;
+
+		while (i < cache->num_idle) {
+			fr_pool_connection_t *this = cache->idle[i];
+
+			if (connection_cacheable(pool, this, now)) {
+				i++;
+				continue;
+			}
+
+			connection_cache_remove(cache, this);
+			connection_cache_return(pool, request, this, now);
+		}
+		pthread_mutex_unlock(&cache->mutex);
+	}
+}
+
+/** Count the connections which are idle in thread caches
+ *
+ * These are counted in state.active, but are available for use, so
+ * they're spares as far as deciding whether to open more connections.
+ *
+ * @note Must be called with the pool mutex held.
+ *
+ * @param[in] pool	to count the cached connections of.
+ * @return The number of idle connections in all thread caches.
+ */
+static uint32_t connection_cache_idle(fr_pool_t *pool)
+{
+	fr_pool_thread_cache_t	*cache = NULL;
+	uint32_t		idle = 0;
+
+	while ((cache = fr_dlist_next(&pool->caches, cache))) {
+		pthread_mutex_lock(&cache->mutex);
+		idle += cache->num_idle;
+		pthread_mutex_unlock(&cache->mutex);
+	}
+
+	return idle;
+}
 
 /** Check whether any connections need to be removed from the pool
  *
@@ -643,7 +1116,7 @@ static int connection_manage(fr_pool_t *pool, REQUEST *request, fr_pool_connecti
  */
 static int connection_check(fr_pool_t *pool, REQUEST *request)
 {
-	uint32_t	spawn, idle, extra;
+	uint32_t	spawn, idle, extra, cached = 0;
 	fr_time_t		now = fr_time();
 	fr_pool_connection_t	*this, *next;
 
@@ -652,12 +1125,17 @@ static int connection_check(fr_pool_t *pool, REQUEST *request)
 		return 1;
 	}
 
+	if (pool->thread_cache) {
+		connection_cache_reclaim(pool, request, now);
+		cached = connection_cache_idle(pool);
+	}
+
 	/*
 	 *	Some idle connections are OK, if they're within the
 	 *	configured "spare" range.  Any extra connections
 	 *	outside of that range can be closed.
 	 */
-	idle = pool->state.num - pool->state.active;
+	idle = pool->state.num - pool->state.active + cached;
 	if (idle <= pool->spare) {
 		extra = 0;
 	} else {
@@ -747,6 +1225,13 @@ static int connection_check(fr_pool_t *pool, REQUEST *request)
 		pthread_mutex_lock(&pool->mutex);
 	}
 
+	/*
+	 *	Only connections in the heap can be closed here.
+	 *	Cached ones are handed back to the heap once they
+	 *	expire.
+	 */
+	if (extra > (idle - cached)) extra = idle - cached;
+
 	/*
 	 *	We haven't spawned connections in a while, and there
 	 *	are too many spare ones.  Close the one which has been
@@ -806,6 +1291,7 @@ static void *connection_get_internal(fr_pool_t *pool, REQUEST *request, bool spa
 {
 	fr_time_t now;
 	fr_pool_connection_t *this;
+	uint32_t cached = 0;
 
 	if (!pool) return NULL;
 
@@ -832,6 +1318,15 @@ static void *connection_get_internal(fr_pool_t *pool, REQUEST *request, bool spa
 		goto do_return;
 	}
 
+	/*
+	 *	Connections idle in other threads' caches are
+	 *	better than none.
+	 */
+	if (pool->thread_cache && (pool->state.num == pool->max)) {
+		this = connection_cache_borrow(pool, request, now);
+		if (this) goto do_borrowed;
+	}
+
 	if (pool->state.num == pool->max) {
 		bool complain = false;
 
@@ -856,12 +1351,24 @@ static void *connection_get_internal(fr_pool_t *pool, REQUEST *request, bool spa
 		return NULL;
 	}
 
+	if (pool->thread_cache) cached = connection_cache_idle(pool);
+
 	pthread_mutex_unlock(&pool->mutex);
 
 	if (!spawn) return NULL;
 
-	ROPTIONAL(RDEBUG2, DEBUG2, "%i of %u connections in use.  You  may need to increase \"spare\"",
-	       pool->state.active, pool->state.num);
+	/*
+	 *	Connections idle in other threads' caches aren't
+	 *	in use, but only they can reserve them below max.
+	 */
+	if (cached) {
+		ROPTIONAL(RDEBUG2, DEBUG2, "%u of %u connections in use, %u idle in other threads.  "
+			  "You may need to decrease \"thread_cache\"",
+			  pool->state.active - cached, pool->state.num, cached);
+	} else {
+		ROPTIONAL(RDEBUG2, DEBUG2, "%i of %u connections in use.  You  may need to increase \"spare\"",
+			  pool->state.active, pool->state.num);
+	}
 
 	/*
 	 *	Returns unlocked on failure, or locked on success
@@ -871,9 +1378,11 @@ static void *connection_get_internal(fr_pool_t *pool, REQUEST *request, bool spa
 
 do_return:
 	pool->state.active++;
+	this->in_use = true;
+
+do_borrowed:
 	this->num_uses++;
 	this->last_reserved = fr_time();
-	this->in_use = true;
 
 #ifdef PTHREAD_DEBUG
 	this->pthread_id = pthread_self();
@@ -1017,6 +1526,8 @@ fr_pool_t *fr_pool_init(TALLOC_CTX *ctx,
 	}
 
 	pool->log_prefix = log_prefix ? talloc_typed_strdup(pool, log_prefix) : "core";
+	pool->id = atomic_fetch_add_explicit(&pool_counter, 1, memory_order_relaxed);
+	fr_dlist_init(&pool->caches, fr_pool_thread_cache_t, entry);
 	pthread_mutex_init(&pool->mutex, NULL);
 	pthread_cond_init(&pool->done_spawn, NULL);
 	pthread_cond_init(&pool->done_reconnecting, NULL);
@@ -1054,6 +1565,7 @@ fr_pool_t *fr_pool_init(TALLOC_CTX *ctx,
 	FR_INTEGER_BOUND_CHECK("max", pool->max, <=, 1024);
 	FR_INTEGER_BOUND_CHECK("start", pool->start, <=, pool->max);
 	FR_INTEGER_BOUND_CHECK("spare", pool->spare, <=, (pool->max - pool->min));
+	FR_INTEGER_BOUND_CHECK("thread_cache", pool->thread_cache, <=, pool->max);
 
 	if (pool->lifetime > 0) {
 		FR_TIME_DELTA_COND_CHECK("idle_timeout", pool->idle_timeout,
@@ -1361,6 +1873,17 @@ void fr_pool_free(fr_pool_t *pool)
  */
 void *fr_pool_connection_get(fr_pool_t *pool, REQUEST *request)
 {
+	if (pool && pool->thread_cache) {
+		fr_pool_thread_cache_t	*cache;
+		fr_pool_connection_t	*this;
+
+		cache = pool_thread_cache(pool);
+		if (cache) {
+			this = connection_cache_get(cache, request);
+			if (this) return this->connection;
+		}
+	}
+
 	return connection_get_internal(pool, request, true);
 }
 
@@ -1377,13 +1900,27 @@ void *fr_pool_connection_get(fr_pool_t *pool, REQUEST *request)
 void fr_pool_connection_release(fr_pool_t *pool, REQUEST *request, void *conn)
 {
 	fr_pool_connection_t	*this;
+	fr_pool_thread_cache_t	*cache = NULL;
 	fr_time_delta_t		held;
 	bool			trigger_min = false, trigger_max = false;
 
+	/*
+	 *	Connections reserved from this thread's cache
+	 *	can be released without locking the pool.
+	 */
+	if (pool && pool->thread_cache) {
+		cache = pool_thread_cache(pool);
+		if (cache && connection_cache_release(cache, request, conn)) return;
+	}
+
 	this = connection_find(pool, conn);
 	if (!this) return;
 
-	this->in_use = false;
+	/*
+	 *	Reserved from a cache, but released by a different
+	 *	thread.
+	 */
+	if (this->cache) connection_cache_detach(this);
 
 	/*
 	 *	Record when the connection was last released
@@ -1419,19 +1956,29 @@ void fr_pool_connection_release(fr_pool_t *pool, REQUEST *request, void *conn)
 	fr_stats_bins(&pool->state.held_stats, this->last_reserved, this->last_released);
 
 	/*
-	 *	Insert the connection in the heap.
-	 *
-	 *	This will either be based on when we *started* using it
-	 *	(allowing fast links to be re-used, and slow links to be
-	 *	gradually expired), or when we released it (allowing
-	 *	the maximum amount of time between connection use).
+	 *	Keep the connection for this thread if there's
+	 *	room in its cache.
 	 */
-	fr_heap_insert(pool->heap, this);
+	if (cache && connection_cache_adopt(cache, this, fr_time())) {
+		ROPTIONAL(RDEBUG2, DEBUG2, "Released connection (%" PRIu64 ") to thread cache", this->number);
+	} else {
+		this->in_use = false;
 
-	fr_assert(pool->state.active != 0);
-	pool->state.active--;
+		/*
+		 *	Insert the connection in the heap.
+		 *
+		 *	This will either be based on when we *started* using it
+		 *	(allowing fast links to be re-used, and slow links to be
+		 *	gradually expired), or when we released it (allowing
+		 *	the maximum amount of time between connection use).
+		 */
+		fr_heap_insert(pool->heap, this);
 
-	ROPTIONAL(RDEBUG2, DEBUG2, "Released connection (%" PRIu64 ")", this->number);
+		fr_assert(pool->state.active != 0);
+		pool->state.active--;
+
+		ROPTIONAL(RDEBUG2, DEBUG2, "Released connection (%" PRIu64 ")", this->number);
+	}
 
 	/*
 	 *	We mirror the "spawn on get" functionality by having
@@ -0,0 +1,333 @@
+#include <freeradius-devel/util/acutest.h>
+#include <pthread.h>
+
+#include "pool.c"
+
+#define DEBUG_LVL_SET if (test_verbose_level__ >= 3) fr_debug_lvl = L_DBG_LVL_4 + 1
+
+static atomic_uint_fast32_t test_conn_count = ATOMIC_VAR_INIT(0);
+
+/** Connections are just a number
+ *
+ */
+static void *test_conn_create(TALLOC_CTX *ctx, UNUSED void *opaque, UNUSED fr_time_delta_t timeout)
+{
+	uint32_t *conn;
+
+	MEM(conn = talloc_zero(ctx, uint32_t));
+	*conn = atomic_fetch_add_explicit(&test_conn_count, 1, memory_order_relaxed);
+
+	return conn;
+}
+
+/** Allocate a pool with a synthetic config section
+ *
+ */
+static fr_pool_t *test_pool_alloc(TALLOC_CTX *ctx, char const *max, char const *thread_cache)
+{
+	static int	opaque;
+	CONF_SECTION	*cs;
+	CONF_PAIR	*cp;
+	fr_pool_t	*pool;
+
+	MEM(cs = cf_section_alloc(ctx, NULL, "pool", NULL));
+
+#define TEST_PAIR_ADD(_attr, _value) \
+	do { \
+		MEM(cp = cf_pair_alloc(cs, _attr, _value, T_OP_EQ, T_BARE_WORD, T_BARE_WORD)); \
+		cf_pair_add(cs, cp); \
+	} while (0)
+
+	TEST_PAIR_ADD("start", "0");
+	TEST_PAIR_ADD("min", "0");
+	TEST_PAIR_ADD("spare", "0");
+	TEST_PAIR_ADD("max", max);
+	TEST_PAIR_ADD("thread_cache", thread_cache);
+
+	pool = fr_pool_init(ctx, cs, &opaque, test_conn_create, NULL, "test");
+	TEST_CHECK(pool != NULL);
+	if (pool) TEST_CHECK(fr_pool_start(pool) == 0);
+
+	return pool;
+}
+
+static void test_get_release(void)
+{
+	TALLOC_CTX	*ctx;
+	fr_pool_t	*pool;
+	void		*a, *b, *c;
+
+	DEBUG_LVL_SET;
+
+	ctx = talloc_init("test");
+	pool = test_pool_alloc(ctx, "2", "0");
+
+	TEST_CASE("Connections are opened on demand, up to max");
+	a = fr_pool_connection_get(pool, NULL);
+	b = fr_pool_connection_get(pool, NULL);
+	TEST_CHECK(a != NULL);
+	TEST_CHECK(b != NULL);
+	TEST_CHECK(a != b);
+	c = fr_pool_connection_get(pool, NULL);
+	TEST_CHECK(c == NULL);
+	TEST_CHECK(fr_pool_state(pool)->num == 2);
+	TEST_CHECK(fr_pool_state(pool)->active == 2);
+
+	TEST_CASE("Released connections are reused");
+	fr_pool_connection_release(pool, NULL, a);
+	TEST_CHECK(fr_pool_state(pool)->active == 1);
+	c = fr_pool_connection_get(pool, NULL);
+	TEST_CHECK(c == a);
+
+	fr_pool_connection_release(pool, NULL, b);
+	fr_pool_connection_release(pool, NULL, c);
+	TEST_CHECK(fr_pool_state(pool)->active == 0);
+
+	fr_pool_free(pool);
+	talloc_free(ctx);
+}
+
+static void test_thread_cache(void)
+{
+	TALLOC_CTX		*ctx;
+	fr_pool_t		*pool;
+	fr_pool_thread_cache_t	*cache;
+	void			*a, *b;
+
+	DEBUG_LVL_SET;
+
+	ctx = talloc_init("test");
+	pool = test_pool_alloc(ctx, "4", "1");
+
+	TEST_CASE("Released connections are kept by the thread");
+	a = fr_pool_connection_get(pool, NULL);
+	TEST_CHECK(a != NULL);
+	fr_pool_connection_release(pool, NULL, a);
+
+	cache = pool_thread_cache(pool);
+	TEST_CHECK(cache != NULL);
+	TEST_CHECK(cache->num_idle == 1);
+	TEST_CHECK(cache->num_owned == 1);
+	TEST_CHECK(fr_heap_num_elements(pool->heap) == 0);
+	TEST_CHECK(fr_pool_state(pool)->active == 1);
+
+	TEST_CASE("Cached connections are reserved first");
+	b = fr_pool_connection_get(pool, NULL);
+	TEST_CHECK(b == a);
+	TEST_CHECK(cache->num_idle == 0);
+	TEST_CHECK(cache->num_held == 1);
+
+	TEST_CASE("Cache size is limited");
+	a = fr_pool_connection_get(pool, NULL);
+	TEST_CHECK(a != NULL);
+	TEST_CHECK(a != b);
+	fr_pool_connection_release(pool, NULL, a);
+	fr_pool_connection_release(pool, NULL, b);
+	TEST_CHECK(cache->num_owned == 1);
+	TEST_CHECK(fr_heap_num_elements(pool->heap) == 1);
+	TEST_CHECK(fr_pool_state(pool)->active == 1);
+
+	TEST_CASE("Closing a cached connection removes it from the cache");
+	a = fr_pool_connection_get(pool, NULL);
+	TEST_CHECK(a == b);
+	TEST_CHECK(fr_pool_connection_close(pool, NULL, a) == 1);
+	TEST_CHECK(cache->num_owned == 0);
+	TEST_CHECK(fr_pool_state(pool)->num == 1);
+	TEST_CHECK(fr_pool_state(pool)->active == 0);
+
+	fr_pool_free(pool);
+	talloc_free(ctx);
+}
+
+static void test_thread_cache_spare(void)
+{
+	TALLOC_CTX		*ctx;
+	fr_pool_t		*pool;
+	void			*a, *b;
+
+	DEBUG_LVL_SET;
+
+	ctx = talloc_init("test");
+	pool = test_pool_alloc(ctx, "4", "2");
+	pool->spare = 2;
+
+	a = fr_pool_connection_get(pool, NULL);
+	b = fr_pool_connection_get(pool, NULL);
+	TEST_CHECK(a && b);
+	fr_pool_connection_release(pool, NULL, a);
+	fr_pool_connection_release(pool, NULL, b);
+
+	TEST_CASE("Idle cached connections are counted");
+	pthread_mutex_lock(&pool->mutex);
+	TEST_CHECK(connection_cache_idle(pool) == 2);
+	pthread_mutex_unlock(&pool->mutex);
+	TEST_CHECK(fr_pool_state(pool)->active == 2);
+
+	TEST_CASE("And are spares, so no more connections are opened");
+	pthread_mutex_lock(&pool->mutex);
+	pool->state.last_checked = fr_time();
+	connection_check(pool, NULL);
+	TEST_CHECK(fr_pool_state(pool)->num == 2);
+	TEST_MSG("Expected 2 connections, got %u", fr_pool_state(pool)->num);
+
+	TEST_CASE("But they're not closed as extra spares");
+	pool->spare = 0;
+	pthread_mutex_lock(&pool->mutex);
+	pool->state.last_checked = fr_time();
+	connection_check(pool, NULL);
+	TEST_CHECK(fr_pool_state(pool)->num == 2);
+
+	fr_pool_free(pool);
+	talloc_free(ctx);
+}
+
+typedef struct {
+	fr_pool_t		*pool;
+	size_t			cycles;
+	size_t			failed;
+	void			*conn;			//!< Last connection reserved.
+} test_thread_ctx_t;
+
+/** Reserve and release a single connection
+ *
+ */
+static void *test_borrow_thread(void *arg)
+{
+	test_thread_ctx_t	*tctx = arg;
+
+	tctx->conn = fr_pool_connection_get(tctx->pool, NULL);
+	if (tctx->conn) fr_pool_connection_release(tctx->pool, NULL, tctx->conn);
+
+	return NULL;
+}
+
+static void test_thread_cache_borrow(void)
+{
+	TALLOC_CTX		*ctx;
+	fr_pool_t		*pool;
+	void			*a;
+	pthread_t		tid;
+	test_thread_ctx_t	tctx;
+
+	DEBUG_LVL_SET;
+
+	ctx = talloc_init("test");
+	pool = test_pool_alloc(ctx, "1", "1");
+
+	a = fr_pool_connection_get(pool, NULL);
+	TEST_CHECK(a != NULL);
+	fr_pool_connection_release(pool, NULL, a);
+	TEST_CHECK(pool_thread_cache(pool)->num_idle == 1);
+
+	TEST_CASE("Other threads can borrow idle connections at max");
+	tctx = (test_thread_ctx_t){ .pool = pool };
+	TEST_CHECK(pthread_create(&tid, NULL, test_borrow_thread, &tctx) == 0);
+	pthread_join(tid, NULL);
+
+	TEST_CHECK(tctx.conn == a);
+	TEST_CHECK(pool_thread_cache(pool)->num_owned == 0);
+	TEST_CHECK(fr_pool_state(pool)->num == 1);
+	TEST_CHECK(fr_pool_state(pool)->active == 1);		/* Now in the other thread's cache */
+
+	TEST_CASE("And we can borrow it back");
+	a = fr_pool_connection_get(pool, NULL);
+	TEST_CHECK(a == tctx.conn);
+	fr_pool_connection_release(pool, NULL, a);
+	TEST_CHECK(pool_thread_cache(pool)->num_idle == 1);
+
+	fr_pool_free(pool);
+	talloc_free(ctx);
+}
+
+/** Reserve and release connections as fast as possible
+ *
+ */
+static void *test_contention_thread(void *arg)
+{
+	test_thread_ctx_t	*tctx = arg;
+	size_t			i;
+
+	for (i = 0; i < tctx->cycles; i++) {
+		void *conn;
+
+		conn = fr_pool_connection_get(tctx->pool, NULL);
+		if (!conn) {
+			tctx->failed++;
+			continue;
+		}
+		fr_pool_connection_release(tctx->pool, NULL, conn);
+	}
+
+	return NULL;
+}
+
+static void test_contention(char const *thread_cache)
+{
+	TALLOC_CTX		*ctx;
+	fr_pool_t		*pool;
+	size_t			i, threads = 8, cycles = 100000;
+	pthread_t		tid[8];
+	test_thread_ctx_t	tctx[8];
+	fr_time_t		start, stop;
+	fr_time_delta_t		elapsed;
+
+	DEBUG_LVL_SET;
+
+	ctx = talloc_init("test");
+	pool = test_pool_alloc(ctx, "8", thread_cache);
+
+	start = fr_time();
+	for (i = 0; i < threads; i++) {
+		tctx[i] = (test_thread_ctx_t){ .pool = pool, .cycles = cycles };
+		TEST_CHECK(pthread_create(&tid[i], NULL, test_contention_thread, &tctx[i]) == 0);
+	}
+	for (i = 0; i < threads; i++) {
+		pthread_join(tid[i], NULL);
+		TEST_CHECK(tctx[i].failed == 0);
+		TEST_MSG("Thread %zu had %zu failures", i, tctx[i].failed);
+	}
+	stop = fr_time();
+	elapsed = stop - start;
+
+	TEST_CHECK(fr_pool_state(pool)->num <= 8);
+
+	if (test_verbose_level__ >= 1) {
+		INFO("thread_cache = %s, %zu threads: %pV (%u ops/s)",
+		     thread_cache, threads, fr_box_time_delta(elapsed),
+		     (uint32_t)((threads * cycles) / ((float)elapsed / NSEC)));
+	}
+
+	fr_pool_free(pool);
+	talloc_free(ctx);
+}
+
+static void test_contention_shared(void)
+{
+	test_contention("0");
+}
+
+static void test_contention_thread_cache(void)
+{
+	test_contention("1");
+}
+
+TEST_LIST = {
+	/*
+	 *	Basic tests
+	 */
+	{ "Basic - Get, release",				test_get_release },
+
+	/*
+	 *	Thread caches
+	 */
+	{ "Thread cache - Get, release, close",			test_thread_cache },
+	{ "Thread cache - Borrow",				test_thread_cache_borrow },
+	{ "Thread cache - Spares",				test_thread_cache_spare },
+
+	/*
+	 *	Performance tests
+	 */
+	{ "Speed Test - Contention, shared pool",		test_contention_shared },
+	{ "Speed Test - Contention, thread cache",		test_contention_thread_cache },
+	{ NULL }
+};
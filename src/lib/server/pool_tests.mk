@@ -0,0 +1,12 @@
+TARGET		:= pool_tests
+
+SOURCES		:= pool_tests.c
+
+TGT_LDLIBS	:= $(LIBS)
+TGT_LDFLAGS	:= $(LDFLAGS)
+
+ifneq ($(OPENSSL_LIBS),)
+TGT_PREREQS	:= libfreeradius-tls.a
+endif
+
+TGT_PREREQS	+= libfreeradius-util.a libfreeradius-server.a libfreeradius-unlang.a
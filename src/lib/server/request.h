@@ -34,6 +34,7 @@ extern "C" {
 
 typedef struct fr_async_s fr_async_t;
 typedef struct fr_request_s REQUEST;
+typedef struct tmpl_cache_s tmpl_cache_t;
 
 typedef struct rad_listen rad_listen_t;
 typedef struct rad_client RADCLIENT;
@@ -128,6 +129,8 @@ struct fr_request_s {
 
 	void			*stack;		//!< unlang interpreter stack.
 
+	tmpl_cache_t		*tmpl_cache;	//!< Results of recent attribute reference lookups.
+
 	REQUEST			*parent;
 
 	fr_event_timer_t const	*ev;		//!< Event in event loop tied to this request.
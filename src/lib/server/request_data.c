@@ -450,6 +450,24 @@ int request_data_by_persistance_count(REQUEST *request, bool persist)
 	return count;
 }
 
+/** Return the identifiers and opaque data of a request data entry
+ *
+ * Used when serialising persistable request data held in a list
+ * produced by #request_data_by_persistance.
+ *
+ * @param[out] unique_ptr	The unique_ptr the data was added with.
+ * @param[out] unique_int	The unique_int the data was added with.
+ * @param[in] rd		to return information for.
+ * @return The opaque data.
+ */
+void *request_data_entry_info(void const **unique_ptr, int *unique_int, request_data_t const *rd)
+{
+	*unique_ptr = rd->unique_ptr;
+	*unique_int = rd->unique_int;
+
+	return rd->opaque;
+}
+
 /** Add request data back to a request
  *
  * @note May add multiple entries (if they're linked).
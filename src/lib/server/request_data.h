@@ -57,6 +57,8 @@ int		request_data_by_persistance_reparent(TALLOC_CTX *ctx, fr_dlist_head_t *out,
 
 int		request_data_by_persistance_count(REQUEST *request, bool persist);
 
+void		*request_data_entry_info(void const **unique_ptr, int *unique_int, request_data_t const *rd);
+
 void		request_data_restore(REQUEST *request, fr_dlist_head_t *in);
 
 void		request_data_persistable_free(REQUEST *request);
@@ -50,11 +50,31 @@ RCSID("$Id$")
 #include <freeradius-devel/server/state.h>
 #include <freeradius-devel/util/debug.h>
 
+#include <freeradius-devel/internal/internal.h>
 #include <freeradius-devel/util/dlist.h>
 #include <freeradius-devel/util/md5.h>
 #include <freeradius-devel/util/misc.h>
+#include <freeradius-devel/util/net.h>
 #include <freeradius-devel/util/rand.h>
 
+#include "state_priv.h"
+
+#ifdef HAVE_STDATOMIC_H
+#  include <stdatomic.h>
+#else
+#  include <freeradius-devel/util/stdatomic.h>
+#endif
+
+/** Default number of independently locked shards in a state tree
+ *
+ * Must be a power of two.
+ */
+#ifndef STATE_SHARDS
+#  define STATE_SHARDS	16
+#endif
+
+typedef struct fr_state_shard_s fr_state_shard_t;
+
 /** Holds a state value, and associated VALUE_PAIRs and data
  *
  */
@@ -103,6 +123,8 @@ typedef struct {
 
 	int			tries;
 
+	fr_state_shard_t	*shard;				//!< Shard this entry was inserted into.
+
 	TALLOC_CTX		*ctx;				//!< ctx to parent any data that needs to be
 								//!< tied to the lifetime of the request progression.
 	VALUE_PAIR		*vps;				//!< session-state VALUE_PAIRs, parented by ctx.
@@ -112,24 +134,70 @@ typedef struct {
 	REQUEST			*thawed;			//!< The request that thawed this entry.
 } fr_state_entry_t;
 
+/** An independently locked slice of the state tree
+ *
+ * Entries are assigned to a shard by hashing their (server hash xor'd)
+ * state value.  Lookups, insertions, expiry and removals only ever need
+ * to lock the shard the entry lives in, so workers handling different
+ * authentication sessions rarely contend with each other.
+ */
+struct fr_state_shard_s {
+	pthread_mutex_t		mutex;				//!< Synchronisation mutex for this shard.
+	rbtree_t		*tree;				//!< rbtree used to lookup state value.
+	fr_dlist_head_t		to_expire;			//!< Linked list of entries to free,
+								//!< ordered by cleanup time.
+	uint64_t		timed_out;			//!< Number of states in this shard that were
+								//!< cleaned up due to timeout.
+
+	uint8_t			pad[128];			//!< Keeps the next shard off this shard's cache lines.
+								//!< The shards are allocated by talloc, which only
+								//!< aligns to 16 bytes, so alignas() can't be used.
+};
+
 struct fr_state_tree_s {
-	uint64_t		id;				//!< Next ID to assign.
-	uint64_t		timed_out;			//!< Number of states that were cleaned up due to
-								//!< timeout.
+	atomic_uint_fast64_t	id;				//!< Next ID to assign.
+	atomic_uint_fast32_t	tracked;			//!< Number of entries inserted, or about to be
+								//!< inserted, across all shards.
 	uint32_t		max_sessions;			//!< Maximum number of sessions we track.
-	rbtree_t		*tree;				//!< rbtree used to lookup state value.
-	fr_dlist_head_t		to_expire;			//!< Linked list of entries to free.
 
 	uint32_t		timeout;			//!< How long to wait before cleaning up state entires.
 
-	bool			thread_safe;			//!< Whether we lock the tree whilst modifying it.
-	pthread_mutex_t		mutex;				//!< Synchronisation mutex.
+	bool			thread_safe;			//!< Whether we lock the shards whilst modifying them.
 
 	uint8_t			server_id;			//!< ID to use for load balancing.
 
 	fr_dict_attr_t const	*da;				//!< State attribute used.
+
+	uint32_t		num_shards;			//!< Number of shards, always a power of two.
+	fr_state_shard_t	*shard;				//!< Array of shards.
+
+	fr_state_backend_inst_t	*backend;			//!< Where serialised entries are stored so
+								//!< that other servers can continue sessions.
+								//!< NULL if entries only live in this tree.
 };
 
+/** Version of the serialised state entry format
+ *
+ */
+#define STATE_SERIALIZE_VERSION		1
+
+/** Record types in a serialised state entry
+ *
+ */
+typedef enum {
+	STATE_RECORD_PAIR = 1,					//!< A session-state pair, encoded with the
+								///< internal protocol encoder.
+	STATE_RECORD_DATA = 2					//!< Persistable request data.
+} state_record_t;
+
+/** Request data which has been deserialised, but not yet added to a request
+ *
+ */
+typedef struct {
+	fr_state_data_serializer_t const	*ser;		//!< Serialiser used to recreate the data.
+	void					*opaque;	//!< The recreated data.
+} state_thawed_data_t;
+
 #define PTHREAD_MUTEX_LOCK if (state->thread_safe) pthread_mutex_lock
 #define PTHREAD_MUTEX_UNLOCK if (state->thread_safe) pthread_mutex_unlock
 
@@ -145,53 +213,76 @@ static int state_entry_cmp(void const *one, void const *two)
 	return memcmp(a->state, b->state, sizeof(a->state));
 }
 
+/** Return the shard responsible for a given (server hash xor'd) state value
+ *
+ */
+static inline fr_state_shard_t *state_shard(fr_state_tree_t *state, fr_state_entry_t const *entry)
+{
+	return &state->shard[fr_hash(entry->state, sizeof(entry->state)) & (state->num_shards - 1)];
+}
+
 /** Free the state tree
  *
  */
 static int _state_tree_free(fr_state_tree_t *state)
 {
-	fr_state_entry_t *entry;
-
-	if (state->thread_safe) pthread_mutex_destroy(&state->mutex);
+	fr_state_entry_t	*entry;
+	uint32_t		i;
 
 	DEBUG4("Freeing state tree %p", state);
 
-	while ((entry = fr_dlist_head(&state->to_expire))) {
-		DEBUG4("Freeing state entry %p (%"PRIu64")", entry, entry->id);
-		state_entry_unlink(state, entry);
-		talloc_free(entry);
-	}
+	for (i = 0; i < state->num_shards; i++) {
+		fr_state_shard_t *shard = &state->shard[i];
 
-	/*
-	 *	Free the rbtree
-	 */
-	talloc_free(state->tree);
+		while ((entry = fr_dlist_head(&shard->to_expire))) {
+			DEBUG4("Freeing state entry %p (%"PRIu64")", entry, entry->id);
+			state_entry_unlink(state, entry);
+			talloc_free(entry);
+		}
+
+		/*
+		 *	Free the rbtree
+		 */
+		talloc_free(shard->tree);
+
+		if (state->thread_safe) pthread_mutex_destroy(&shard->mutex);
+	}
 
 	return 0;
 }
 
-/** Initialise a new state tree
+/** Allocate a state tree with a specific number of shards
  *
  * @param[in] ctx		to link the lifecycle of the state tree to.
  * @param[in] da		Attribute used to store and retrieve state from.
- * @param[in] thread_safe		Whether we should mutex protect the state tree.
+ * @param[in] thread_safe	Whether we should mutex protect the shards.
  * @param[in] max_sessions	we track state for.
  * @param[in] timeout		How long to wait before cleaning up entries.
  * @param[in] server_id		ID byte to use in load-balancing operations.
+ * @param[in] num_shards	Number of shards.  Must be a power of two.
  * @return
  *	- A new state tree.
  *	- NULL on failure.
  */
-fr_state_tree_t *fr_state_tree_init(TALLOC_CTX *ctx, fr_dict_attr_t const *da, bool thread_safe,
-				    uint32_t max_sessions, uint32_t timeout, uint8_t server_id)
+static fr_state_tree_t *state_tree_alloc(TALLOC_CTX *ctx, fr_dict_attr_t const *da, bool thread_safe,
+					 uint32_t max_sessions, uint32_t timeout, uint8_t server_id,
+					 uint32_t num_shards)
 {
 	fr_state_tree_t *state;
+	uint32_t	i;
+
+	if (!fr_cond_assert(num_shards && ((num_shards & (num_shards - 1)) == 0))) return NULL;
 
 	state = talloc_zero(NULL, fr_state_tree_t);
 	if (!state) return 0;
 
 	state->max_sessions = max_sessions;
 	state->timeout = timeout;
+	state->da = da;		/* Remember which attribute we use to load/store state */
+	state->server_id = server_id;
+	state->thread_safe = thread_safe;
+	atomic_init(&state->id, 0);
+	atomic_init(&state->tracked, 0);
 
 	/*
 	 *	Create a break in the contexts.
@@ -202,46 +293,119 @@ fr_state_tree_t *fr_state_tree_init(TALLOC_CTX *ctx, fr_dict_attr_t const *da, b
 	 */
 	talloc_link_ctx(ctx, state);
 
-	if (thread_safe && (pthread_mutex_init(&state->mutex, NULL) != 0)) {
+	state->shard = talloc_zero_array(state, fr_state_shard_t, num_shards);
+	if (!state->shard) {
 		talloc_free(state);
 		return NULL;
 	}
+	talloc_set_destructor(state, _state_tree_free);
+
+	for (i = 0; i < num_shards; i++) {
+		fr_state_shard_t *shard = &state->shard[i];
+
+		if (thread_safe && (pthread_mutex_init(&shard->mutex, NULL) != 0)) {
+			talloc_free(state);
+			return NULL;
+		}
+
+		fr_dlist_talloc_init(&shard->to_expire, fr_state_entry_t, list);
+
+		/*
+		 *	We need to do controlled freeing of the
+		 *	rbtree, so that all the state entries
+		 *	are freed before it's destroyed.  Hence
+		 *	it being parented from the NULL ctx.
+		 */
+		shard->tree = rbtree_talloc_alloc(NULL, state_entry_cmp, fr_state_entry_t, NULL, 0);
+		if (!shard->tree) {
+			if (thread_safe) pthread_mutex_destroy(&shard->mutex);
+			talloc_free(state);
+			return NULL;
+		}
+		state->num_shards++;	/* Only count fully initialised shards */
+	}
 
-	fr_dlist_talloc_init(&state->to_expire, fr_state_entry_t, list);
+	return state;
+}
 
+/** Initialise a new state tree
+ *
+ * The tree is split into #STATE_SHARDS independently locked shards,
+ * so that concurrent workers only contend when they're operating on
+ * state values which hash to the same shard.
+ *
+ * @param[in] ctx		to link the lifecycle of the state tree to.
+ * @param[in] da		Attribute used to store and retrieve state from.
+ * @param[in] thread_safe		Whether we should mutex protect the state tree.
+ * @param[in] max_sessions	we track state for.
+ * @param[in] timeout		How long to wait before cleaning up entries.
+ * @param[in] server_id		ID byte to use in load-balancing operations.
+ * @return
+ *	- A new state tree.
+ *	- NULL on failure.
+ */
+fr_state_tree_t *fr_state_tree_init(TALLOC_CTX *ctx, fr_dict_attr_t const *da, bool thread_safe,
+				    uint32_t max_sessions, uint32_t timeout, uint8_t server_id)
+{
 	/*
-	 *	We need to do controlled freeing of the
-	 *	rbtree, so that all the state entries
-	 *	are freed before it's destroyed.  Hence
-	 *	it being parented from the NULL ctx.
+	 *	Sharding only helps if there are multiple
+	 *	threads accessing the tree.
 	 */
-	state->tree = rbtree_talloc_alloc(NULL, state_entry_cmp, fr_state_entry_t, NULL, 0);
-	if (!state->tree) {
-		talloc_free(state);
-		return NULL;
+	return state_tree_alloc(ctx, da, thread_safe, max_sessions, timeout, server_id,
+				thread_safe ? STATE_SHARDS : 1);
+}
+
+/** Store serialised state entries in a backend
+ *
+ * Entries are still kept in the local tree, the backend is only consulted
+ * if a State value isn't found locally, i.e. if the previous round of
+ * the session was handled by a different server.
+ *
+ * @param[in] state	tree to set the backend for.
+ * @param[in] name	of a registered backend, or "memory" to use a private
+ *			in-process backend.
+ * @return
+ *	- 0 on success.
+ *	- -1 if no such backend exists.
+ */
+int fr_state_tree_backend_set(fr_state_tree_t *state, char const *name)
+{
+	fr_state_backend_inst_t *backend;
+
+	backend = fr_state_backend_find(name);
+	if (!backend && (strcmp(name, "memory") == 0)) backend = fr_state_backend_memory_alloc(state, NULL);
+	if (!backend) {
+		fr_strerror_printf("No state backend \"%s\" registered", name);
+		return -1;
 	}
-	talloc_set_destructor(state, _state_tree_free);
 
-	state->da = da;		/* Remember which attribute we use to load/store state */
-	state->server_id = server_id;
-	state->thread_safe = thread_safe;
+	state->backend = backend;
 
-	return state;
+	return 0;
 }
 
 /** Unlink an entry and remove if from the tree
  *
+ * @note Called with the mutex of the entry's shard held.
  */
 static void state_entry_unlink(fr_state_tree_t *state, fr_state_entry_t *entry)
 {
+	fr_state_shard_t *shard;
+
 	/*
 	 *	Check the memory is still valid
 	 */
 	(void) talloc_get_type_abort(entry, fr_state_entry_t);
 
-	fr_dlist_remove(&state->to_expire, entry);
+	shard = entry->shard;
+	if (!fr_cond_assert(shard)) return;
+
+	fr_dlist_remove(&shard->to_expire, entry);
+
+	rbtree_deletebydata(shard->tree, entry);
+	entry->shard = NULL;
 
-	rbtree_deletebydata(state->tree, entry);
+	atomic_fetch_sub_explicit(&state->tracked, 1, memory_order_relaxed);
 
 	DEBUG4("State ID %" PRIu64 " unlinked", entry->id);
 }
@@ -284,103 +448,149 @@ static int _state_entry_free(fr_state_entry_t *entry)
 	return 0;
 }
 
-/** Create a new state entry
+/** Move expired entries from a shard onto a list of entries to free
+ *
+ * @note Called with the shard mutex held.
  *
- * @note Called with the mutex held.
+ * @param[in] state	tree the shard belongs to.
+ * @param[in] shard	to expire entries in.
+ * @param[in] now	Current time.
+ * @param[out] to_free	List to add the expired entries to.
+ * @return The number of entries expired.
  */
-static fr_state_entry_t *state_entry_create(fr_state_tree_t *state, REQUEST *request,
-					    RADIUS_PACKET *packet, fr_state_entry_t *old)
+static uint64_t state_shard_expire(fr_state_tree_t *state, fr_state_shard_t *shard,
+				   time_t now, fr_dlist_head_t *to_free)
 {
-	size_t			i;
-	uint32_t		x;
-	time_t			now = time(NULL);
-	VALUE_PAIR		*vp;
-	fr_state_entry_t	*entry, *next;
-
-	uint8_t			old_state[sizeof(old->state)];
-	int			old_tries = 0;
+	fr_state_entry_t	*entry;
 	uint64_t		timed_out = 0;
-	bool			too_many = false;
-	fr_dlist_head_t		to_free;
-
-	fr_dlist_init(&to_free, fr_state_entry_t, list);
 
 	/*
-	 *	Clean up old entries.
+	 *	The list is ordered by cleanup time, so stop at
+	 *	the first entry which hasn't expired.
 	 */
-	for (entry = fr_dlist_head(&state->to_expire);
-	     entry != NULL;
-	     entry = next) {
+	while ((entry = fr_dlist_head(&shard->to_expire)) && (entry->cleanup < now)) {
 		(void)talloc_get_type_abort(entry, fr_state_entry_t);	/* Allow examination */
-		next = fr_dlist_next(&state->to_expire, entry);		/* Advance *before* potential unlinking */
 
-		if (entry == old) continue;
+		state_entry_unlink(state, entry);
+		fr_dlist_insert_tail(to_free, entry);
+		timed_out++;
+	}
 
-		/*
-		 *	Too old, we can delete it.
-		 */
-		if (entry->cleanup < now) {
-			state_entry_unlink(state, entry);
-			fr_dlist_insert_tail(&to_free, entry);
-			timed_out++;
-			continue;
-		}
+	shard->timed_out += timed_out;
 
-		break;
-	}
+	return timed_out;
+}
 
-	state->timed_out += timed_out;
+/** Free a list of unlinked entries
+ *
+ * We do this outside of the shard mutex as freeing may involve
+ * significantly more work than just freeing the data.
+ *
+ * If there's request data that was persisted it will now
+ * be freed also, and it may have complex destructors associated
+ * with it.
+ */
+static inline void state_entry_list_free(fr_dlist_head_t *to_free)
+{
+	fr_state_entry_t *entry;
 
-	if (!old && (rbtree_num_elements(state->tree) >= (uint32_t) state->max_sessions)) too_many = true;
+	while ((entry = fr_dlist_head(to_free)) != NULL) {
+		fr_dlist_remove(to_free, entry);
+		talloc_free(entry);
+	}
+}
 
-	/*
-	 *	Record the information from the old state, we may base the
-	 *	new state off the old one.
-	 *
-	 *	Once we release the mutex, the state of old becomes indeterminate
-	 *	so we have to grab the values now.
-	 */
-	if (old) {
-		old_tries = old->tries;
+/** Expire old entries in every shard
+ *
+ * Only called when we're at the session limit, so that entries in
+ * shards which haven't seen an insertion recently don't cause new
+ * sessions to be rejected.
+ *
+ * @return The number of entries expired.
+ */
+static uint64_t state_tree_expire(fr_state_tree_t *state, time_t now)
+{
+	uint32_t	i;
+	uint64_t	timed_out = 0;
+	fr_dlist_head_t	to_free;
 
-		memcpy(old_state, old->state, sizeof(old_state));
+	fr_dlist_init(&to_free, fr_state_entry_t, list);
 
-		/*
-		 *	The old one isn't used any more, so we can free it.
-		 */
-		if (fr_dlist_empty(&old->data)) {
-			state_entry_unlink(state, old);
-			fr_dlist_insert_tail(&to_free, old);
-		}
+	for (i = 0; i < state->num_shards; i++) {
+		fr_state_shard_t *shard = &state->shard[i];
+
+		PTHREAD_MUTEX_LOCK(&shard->mutex);
+		timed_out += state_shard_expire(state, shard, now, &to_free);
+		PTHREAD_MUTEX_UNLOCK(&shard->mutex);
 	}
-	PTHREAD_MUTEX_UNLOCK(&state->mutex);
 
-	if (timed_out > 0) RWDEBUG("Cleaning up %"PRIu64" timed out state entries", timed_out);
+	state_entry_list_free(&to_free);
 
-	/*
-	 *	Now free the unlinked entries.
-	 *
-	 *	We do it here as freeing may involve significantly more
-	 *	work than just freeing the data.
-	 *
-	 *	If there's request data that was persisted it will now
-	 *	be freed also, and it may have complex destructors associated
-	 *	with it.
-	 */
-	while ((entry = fr_dlist_head(&to_free)) != NULL) {
-		fr_dlist_remove(&to_free, entry);
-		talloc_free(entry);
+	return timed_out;
+}
+
+/** Reserve a slot in the state tree for a new entry
+ *
+ * Continuing sessions are always allowed a slot, new sessions
+ * are limited to max_sessions.
+ *
+ * @return
+ *	- 0 on success.
+ *	- -1 if we're at the maximum number of sessions.
+ */
+static int state_tree_reserve(fr_state_tree_t *state, REQUEST *request, time_t now, bool continuing)
+{
+	uint64_t timed_out;
+
+	if (continuing) {
+		atomic_fetch_add_explicit(&state->tracked, 1, memory_order_relaxed);
+		return 0;
 	}
 
+	if (atomic_fetch_add_explicit(&state->tracked, 1, memory_order_relaxed) < state->max_sessions) return 0;
+	atomic_fetch_sub_explicit(&state->tracked, 1, memory_order_relaxed);
+
 	/*
-	 *	Have to do this post-cleanup, else we end up returning with
-	 *	a list full of entries to free with none of them being
-	 *	freed which is bad...
+	 *	Shards only expire their own entries on insertion,
+	 *	so sweep all of them before giving up.
 	 */
-	if (too_many) {
+	timed_out = state_tree_expire(state, now);
+	if (timed_out > 0) RWDEBUG("Cleaning up %"PRIu64" timed out state entries", timed_out);
+
+	if (atomic_fetch_add_explicit(&state->tracked, 1, memory_order_relaxed) < state->max_sessions) return 0;
+	atomic_fetch_sub_explicit(&state->tracked, 1, memory_order_relaxed);
+
+	return -1;
+}
+
+/** Create a new state entry
+ *
+ * The entry is not inserted into the tree, that's done by #state_entry_insert
+ * once the caller has populated it.
+ *
+ * @note Called with no mutexes held.
+ *
+ * @param[in] state		tree to create the entry for.
+ * @param[in] request		the entry is being created for.
+ * @param[in] packet		to add the State attribute to.
+ * @param[in] old_state		Value of the previous state entry in this sequence, may be NULL.
+ * @param[in] old_tries		Number of rounds in the previous state entry.
+ * @return
+ *	- A new state entry, with a slot reserved in the tree.
+ *	- NULL on failure.
+ */
+static fr_state_entry_t *state_entry_create(fr_state_tree_t *state, REQUEST *request, RADIUS_PACKET *packet,
+					    uint8_t const *old_state, int old_tries)
+{
+	size_t			i;
+	uint32_t		x;
+	time_t			now = time(NULL);
+	VALUE_PAIR		*vp;
+	fr_state_entry_t	*entry;
+
+	if (state_tree_reserve(state, request, now, (old_state != NULL)) < 0) {
 		RERROR("Failed inserting state entry - At maximum ongoing session limit (%u)",
 		       state->max_sessions);
-		PTHREAD_MUTEX_LOCK(&state->mutex);	/* Caller expects this to be locked */
 		return NULL;
 	}
 
@@ -390,13 +600,13 @@ static fr_state_entry_t *state_entry_create(fr_state_tree_t *state, REQUEST *req
 	 */
 	entry = talloc_zero(NULL, fr_state_entry_t);
 	if (!entry) {
-		PTHREAD_MUTEX_LOCK(&state->mutex);	/* Caller expects this to be locked */
+		atomic_fetch_sub_explicit(&state->tracked, 1, memory_order_relaxed);
 		return NULL;
 	}
 
 	request_data_list_init(&entry->data);
 	talloc_set_destructor(entry, _state_entry_free);
-	entry->id = state->id++;
+	entry->id = atomic_fetch_add_explicit(&state->id, 1, memory_order_relaxed);
 
 	/*
 	 *	Limit the lifetime of this entry based on how long the
@@ -445,7 +655,7 @@ static fr_state_entry_t *state_entry_create(fr_state_tree_t *state, REQUEST *req
 		 *	16 octets of randomness should be enough to
 		 *	have a globally unique state.
 		 */
-		if (old) {
+		if (old_state) {
 			memcpy(entry->state, old_state, sizeof(entry->state));
 			entry->tries = old_tries + 1;
 		/*
@@ -483,8 +693,6 @@ static fr_state_entry_t *state_entry_create(fr_state_tree_t *state, REQUEST *req
 	DEBUG4("State ID %" PRIu64 " created, value 0x%pH, expires %" PRIu64 "s",
 	       entry->id, fr_box_octets(entry->state, sizeof(entry->state)), (uint64_t)entry->cleanup - now);
 
-	PTHREAD_MUTEX_LOCK(&state->mutex);
-
 	/*
 	 *	XOR the server hash with four bytes of random data.
 	 *	We XOR is again before resolving, to ensure state lookups
@@ -493,82 +701,444 @@ static fr_state_entry_t *state_entry_create(fr_state_tree_t *state, REQUEST *req
 	 */
 	*((uint32_t *)(&entry->state_comp.server_hash)) ^= fr_hash_string(cf_section_name2(request->server_cs));
 
-	if (!rbtree_insert(state->tree, entry)) {
-		RERROR("Failed inserting state entry - Insertion into state tree failed");
-		fr_pair_delete_by_da(&packet->vps, state->da);
-		talloc_free(entry);
-		return NULL;
+	return entry;
+}
+
+/** Insert a populated entry into the shard its state value hashes to
+ *
+ * Expired entries in the same shard are unlinked and added to to_free.
+ *
+ * @note Called with no mutexes held.
+ *
+ * @param[in] state		tree to insert the entry into.
+ * @param[in] entry		to insert.  Must have had a slot reserved
+ *				by #state_entry_create.
+ * @param[out] to_free		List of expired entries the caller should free.
+ * @return
+ *	- 0 on success.
+ *	- -1 if an entry with the same state value already exists.
+ */
+static int state_entry_insert(fr_state_tree_t *state, fr_state_entry_t *entry, fr_dlist_head_t *to_free)
+{
+	fr_state_shard_t	*shard = state_shard(state, entry);
+	uint64_t		timed_out;
+
+	PTHREAD_MUTEX_LOCK(&shard->mutex);
+	timed_out = state_shard_expire(state, shard, time(NULL), to_free);
+
+	if (!rbtree_insert(shard->tree, entry)) {
+		PTHREAD_MUTEX_UNLOCK(&shard->mutex);
+		atomic_fetch_sub_explicit(&state->tracked, 1, memory_order_relaxed);
+		return -1;
 	}
+	entry->shard = shard;
 
 	/*
 	 *	Link it to the end of the list, which is implicitely
 	 *	ordered by cleanup time.
 	 */
-	fr_dlist_insert_tail(&state->to_expire, entry);
+	fr_dlist_insert_tail(&shard->to_expire, entry);
+	PTHREAD_MUTEX_UNLOCK(&shard->mutex);
 
-	return entry;
+	if (timed_out > 0) DEBUG2("Cleaning up %"PRIu64" timed out state entries", timed_out);
+
+	return 0;
 }
 
-/** Find the entry, based on the State attribute
+/** Build a lookup key for the State attribute, and return the shard the matching entry would be in
  *
+ * @param[in] state		tree to search in.
+ * @param[out] key		to populate with the normalised state value.
+ * @param[in] request		the State attribute was received in.
+ * @param[in] vb		Value of the State attribute.
+ * @return The shard to search.
  */
-static fr_state_entry_t *state_entry_find(fr_state_tree_t *state, REQUEST *request, fr_value_box_t const *vb)
+static fr_state_shard_t *state_entry_key(fr_state_tree_t *state, fr_state_entry_t *key,
+					 REQUEST *request, fr_value_box_t const *vb)
 {
-	fr_state_entry_t *entry, my_entry;
-
 	/*
 	 *	Assume our own State first.
 	 */
-	if (vb->vb_length == sizeof(my_entry.state)) {
-		memcpy(my_entry.state, vb->vb_octets, sizeof(my_entry.state));
+	if (vb->vb_length == sizeof(key->state)) {
+		memcpy(key->state, vb->vb_octets, sizeof(key->state));
 
 		/*
 		 *	Too big?  Get the MD5 hash, in order
 		 *	to depend on the entire contents of State.
 		 */
-	} else if (vb->vb_length > sizeof(my_entry.state)) {
-		fr_md5_calc(my_entry.state, vb->vb_octets, vb->vb_length);
+	} else if (vb->vb_length > sizeof(key->state)) {
+		fr_md5_calc(key->state, vb->vb_octets, vb->vb_length);
 
 		/*
 		 *	Too small?  Use the whole thing, and
-		 *	set the rest of my_entry.state to zero.
+		 *	set the rest of key.state to zero.
 		 */
 	} else {
-		memcpy(my_entry.state, vb->vb_octets, vb->vb_length);
-		memset(&my_entry.state[vb->vb_length], 0, sizeof(my_entry.state) - vb->vb_length);
+		memcpy(key->state, vb->vb_octets, vb->vb_length);
+		memset(&key->state[vb->vb_length], 0, sizeof(key->state) - vb->vb_length);
 	}
 
 	/*
 	 *	Make it unique for different virtual servers handling the same request
 	 */
-	my_entry.state_comp.server_hash ^= fr_hash_string(cf_section_name2(request->server_cs));
+	key->state_comp.server_hash ^= fr_hash_string(cf_section_name2(request->server_cs));
 
-	entry = rbtree_finddata(state->tree, &my_entry);
+	return state_shard(state, key);
+}
+
+/** Find the entry, based on the State attribute
+ *
+ * @note Called with the shard mutex held.
+ */
+static fr_state_entry_t *state_entry_find(fr_state_shard_t *shard, fr_state_entry_t const *key)
+{
+	fr_state_entry_t *entry;
+
+	entry = rbtree_finddata(shard->tree, key);
 
 	if (entry) (void) talloc_get_type_abort(entry, fr_state_entry_t);
 
 	return entry;
 }
 
+/** Append a record to a serialisation buffer
+ *
+ * Records are:
+ @verbatim
+   type (1) | name length (1) | name | data length (4) | data
+ @endverbatim
+ */
+static int state_record_append(fr_talloc_buff_t *tb, state_record_t type,
+			       char const *name, uint8_t const *data, size_t data_len)
+{
+	if ((talloc_buff_append_uint8(tb, type) < 0) ||
+	    (talloc_buff_append_len8(tb, name, strlen(name)) < 0) ||
+	    (talloc_buff_append_len32(tb, data, data_len) < 0)) return -1;
+
+	return 0;
+}
+
+/** Serialise session-state pairs and persistable request data
+ *
+ * The format is:
+ @verbatim
+   version (1) | seq_start (8) | record...
+ @endverbatim
+ *
+ * Pairs are encoded with the internal protocol encoder, and are
+ * tagged with the name of their dictionary.  Request data is encoded
+ * by the serialiser registered for it, and is tagged with the
+ * serialiser's name.
+ *
+ * @param[out] out		Where to write the serialised entry.
+ * @param[in] ctx		to allocate the serialised entry in.
+ * @param[in] request		The entry is being serialised for.
+ * @param[in] vps		session-state pairs.
+ * @param[in] data		Persistable request data.
+ * @param[in] seq_start		Number of the first request in the sequence.
+ * @return
+ *	- >0 the length of the serialised entry.
+ *	- 0 if the entry can't be serialised, because it contains
+ *	  request data which has no serialiser.
+ */
+static ssize_t state_entry_serialize(uint8_t **out, TALLOC_CTX *ctx, REQUEST *request,
+				     VALUE_PAIR *vps, fr_dlist_head_t *data, uint64_t seq_start)
+{
+	fr_talloc_buff_t	tb;
+	uint8_t		pair_buff[4096];
+	fr_cursor_t	cursor;
+	VALUE_PAIR	*vp;
+	request_data_t	*rd = NULL;
+
+	if (talloc_buff_init(ctx, &tb, 256) < 0) return 0;
+
+	if ((talloc_buff_append_uint8(&tb, STATE_SERIALIZE_VERSION) < 0) ||
+	    (talloc_buff_append_uint64(&tb, seq_start) < 0)) goto error;
+
+	fr_cursor_init(&cursor, &vps);
+	while ((vp = fr_cursor_current(&cursor))) {
+		ssize_t slen;
+
+		/*
+		 *	The encoder advances the cursor
+		 */
+		slen = fr_internal_encode_pair(pair_buff, sizeof(pair_buff), &cursor, NULL);
+		if (slen <= 0) {
+			RPWDEBUG("Failed serialising &session-state:%s", vp->da->name);
+			goto not_portable;
+		}
+
+		if (state_record_append(&tb, STATE_RECORD_PAIR,
+					fr_dict_root(fr_dict_by_da(vp->da))->name, pair_buff, slen) < 0) goto error;
+	}
+
+	while ((rd = fr_dlist_next(data, rd))) {
+		fr_state_data_serializer_t const	*ser;
+		void const				*unique_ptr;
+		int					unique_int;
+		void					*opaque;
+		uint8_t					*blob;
+		ssize_t					slen;
+
+		opaque = request_data_entry_info(&unique_ptr, &unique_int, rd);
+
+		ser = fr_state_data_serializer_by_id(unique_ptr, unique_int);
+		if (!ser) {
+			RDEBUG3("No serialiser for request data %p:%i", unique_ptr, unique_int);
+			goto not_portable;
+		}
+
+		slen = ser->freeze(&blob, tb.buff, opaque);
+		if (slen <= 0) {
+			if (slen < 0) RPWDEBUG("Failed serialising %s request data", ser->name);
+			goto not_portable;
+		}
+
+		if (state_record_append(&tb, STATE_RECORD_DATA, ser->name, blob, slen) < 0) {
+			talloc_free(blob);
+			goto error;
+		}
+		talloc_free(blob);
+	}
+
+	*out = tb.buff;
+
+	return tb.used;
+
+error:
+	RPWDEBUG("Failed serialising session-state");
+
+not_portable:
+	talloc_free(tb.buff);
+
+	return 0;
+}
+
+/** Restore session-state pairs and persistable request data to a request
+ *
+ * The request's state is only modified if the whole entry
+ * could be deserialised.
+ *
+ * @param[in] request	to restore state to.
+ * @param[in] in	Serialised entry.
+ * @param[in] inlen	Length of the serialised entry.
+ * @return
+ *	- 0 on success.
+ *	- -1 on failure.
+ */
+static int state_entry_deserialize(REQUEST *request, uint8_t const *in, size_t inlen)
+{
+	uint8_t const		*p = in, *end = in + inlen;
+	TALLOC_CTX		*state_ctx;
+	VALUE_PAIR		*vps = NULL;
+	fr_cursor_t		cursor;
+	uint64_t		seq_start;
+	state_thawed_data_t	*data;
+	size_t			data_count = 0, i;
+
+	if ((inlen < (1 + sizeof(uint64_t))) || (p[0] != STATE_SERIALIZE_VERSION)) {
+		fr_strerror_printf("Invalid serialised state header");
+		return -1;
+	}
+	seq_start = fr_net_to_uint64(p + 1);
+	p += 1 + sizeof(uint64_t);
+
+	MEM(state_ctx = talloc_init_const("session-state"));
+	MEM(data = talloc_zero_array(state_ctx, state_thawed_data_t, 0));
+	fr_cursor_init(&cursor, &vps);
+
+	while (p < end) {
+		uint8_t		type;
+		size_t		name_len;
+		char const	*name;
+		uint32_t	len;
+
+		if ((end - p) < 2) {
+		truncated:
+			fr_strerror_printf("Serialised state truncated");
+			goto error;
+		}
+		type = p[0];
+		name_len = p[1];
+		p += 2;
+
+		if ((size_t)(end - p) < (name_len + sizeof(uint32_t))) goto truncated;
+		name = (char const *)p;
+		p += name_len;
+
+		len = fr_net_to_uint32(p);
+		p += sizeof(uint32_t);
+		if ((size_t)(end - p) < len) goto truncated;
+
+		switch (type) {
+		case STATE_RECORD_PAIR:
+		{
+			fr_dict_t const	*dict;
+			char		buff[UINT8_MAX + 1];
+			ssize_t		slen;
+
+			memcpy(buff, name, name_len);
+			buff[name_len] = '\0';
+
+			dict = fr_dict_by_protocol_name(buff);
+			if (!dict) {
+				fr_strerror_printf("Unknown dictionary \"%s\"", buff);
+				goto error;
+			}
+
+			slen = fr_internal_decode_pair(state_ctx, &cursor, dict, p, len, NULL);
+			if (slen != (ssize_t)len) {
+				fr_strerror_printf_push("Failed decoding session-state pair");
+				goto error;
+			}
+		}
+			break;
+
+		case STATE_RECORD_DATA:
+		{
+			fr_state_data_serializer_t const *ser;
+
+			ser = fr_state_data_serializer_by_name(name, name_len);
+			if (!ser) {
+				fr_strerror_printf("No serialiser \"%.*s\" registered", (int)name_len, name);
+				goto error;
+			}
+
+			MEM(data = talloc_realloc(state_ctx, data, state_thawed_data_t, data_count + 1));
+			data[data_count].ser = ser;
+			data[data_count].opaque = ser->thaw(state_ctx, p, len);
+			if (!data[data_count].opaque) {
+				fr_strerror_printf_push("Failed deserialising %s request data", ser->name);
+				goto error;
+			}
+			data_count++;
+		}
+			break;
+
+		default:
+			fr_strerror_printf("Unknown record type %u", type);
+			goto error;
+		}
+
+		p += len;
+	}
+
+	/*
+	 *	Everything deserialised, now it's safe to
+	 *	swap the request's state for the new state.
+	 */
+	if (request->state_ctx) talloc_free(request->state_ctx);
+	request->state_ctx = state_ctx;
+	request->state = vps;
+	request->seq_start = seq_start;
+
+	for (i = 0; i < data_count; i++) {
+		_request_data_add(request, data[i].ser->unique_ptr, data[i].ser->unique_int, data[i].ser->type,
+				  data[i].opaque, true, true, true, __FILE__, __LINE__);
+	}
+	talloc_free(data);
+
+	return 0;
+
+error:
+	talloc_free(state_ctx);
+
+	return -1;
+}
+
+/** Serialise a state entry and store it in the tree's backend
+ *
+ * Failures aren't fatal, the entry is still available in the local tree.
+ */
+static void state_backend_freeze(fr_state_tree_t *state, REQUEST *request, fr_state_entry_t *entry)
+{
+	fr_state_backend_inst_t	*backend = state->backend;
+	uint8_t			*blob;
+	ssize_t			slen;
+
+	slen = state_entry_serialize(&blob, NULL, request, entry->vps, &entry->data, entry->seq_start);
+	if (slen == 0) {
+		RDEBUG2("State can't be serialised, it will only be available on this server");
+		return;
+	}
+
+	if (backend->backend->store(backend->uctx, request, entry->state, sizeof(entry->state),
+				    blob, slen, state->timeout) < 0) {
+		RPWDEBUG("Failed storing state in %s backend", backend->backend->name);
+	} else {
+		RDEBUG3("Stored %zd bytes of serialised state in %s backend", slen, backend->backend->name);
+	}
+	talloc_free(blob);
+}
+
+/** Retrieve a serialised state entry from the tree's backend and restore it to the request
+ *
+ */
+static void state_backend_thaw(fr_state_tree_t *state, REQUEST *request, fr_state_entry_t const *key)
+{
+	fr_state_backend_inst_t	*backend = state->backend;
+	uint8_t			*blob = NULL;
+	ssize_t			slen;
+
+	slen = backend->backend->fetch(&blob, NULL, backend->uctx, request, key->state, sizeof(key->state));
+	if (slen < 0) {
+		RPWDEBUG("Failed retrieving state from %s backend", backend->backend->name);
+		return;
+	}
+	if (slen == 0) {
+		RDEBUG3("No state found in %s backend", backend->backend->name);
+		return;
+	}
+
+	if (state_entry_deserialize(request, blob, slen) < 0) {
+		RPWDEBUG("Failed deserialising state from %s backend", backend->backend->name);
+	} else {
+		RDEBUG2("Restored state from %s backend", backend->backend->name);
+	}
+	talloc_free(blob);
+}
+
+/** Remove a serialised state entry from the tree's backend
+ *
+ */
+static inline void state_backend_remove(fr_state_tree_t *state, REQUEST *request, fr_state_entry_t const *key)
+{
+	fr_state_backend_inst_t	*backend = state->backend;
+
+	if (backend->backend->remove(backend->uctx, request, key->state, sizeof(key->state)) < 0) {
+		RPWDEBUG("Failed removing state from %s backend", backend->backend->name);
+	}
+}
+
 /** Called when sending an Access-Accept/Access-Reject to discard state information
  *
  */
 void fr_state_discard(fr_state_tree_t *state, REQUEST *request)
 {
-	fr_state_entry_t	*entry;
+	fr_state_entry_t	*entry, key;
+	fr_state_shard_t	*shard;
 	VALUE_PAIR		*vp;
 
 	vp = fr_pair_find_by_da(request->packet->vps, state->da, TAG_ANY);
 	if (!vp) return;
 
-	PTHREAD_MUTEX_LOCK(&state->mutex);
-	entry = state_entry_find(state, request, &vp->data);
-	if (!entry) {
-		PTHREAD_MUTEX_UNLOCK(&state->mutex);
+	shard = state_entry_key(state, &key, request, &vp->data);
+
+	PTHREAD_MUTEX_LOCK(&shard->mutex);
+	entry = state_entry_find(shard, &key);
+	if (entry) state_entry_unlink(state, entry);
+	PTHREAD_MUTEX_UNLOCK(&shard->mutex);
+
+	/*
+	 *	The state may have been restored from the
+	 *	backend, in which case there's no local entry
+	 *	but the request still holds the state.
+	 */
+	if (state->backend) {
+		state_backend_remove(state, request, &key);
+	} else if (!entry) {
 		return;
 	}
-	state_entry_unlink(state, entry);
-	PTHREAD_MUTEX_UNLOCK(&state->mutex);
 
 	/*
 	 *	If fr_state_to_request was never called, this ensures
@@ -605,7 +1175,8 @@ void fr_state_discard(fr_state_tree_t *state, REQUEST *request)
  */
 void fr_state_to_request(fr_state_tree_t *state, REQUEST *request)
 {
-	fr_state_entry_t	*entry;
+	fr_state_entry_t	*entry, key;
+	fr_state_shard_t	*shard;
 	TALLOC_CTX		*old_ctx = NULL;
 	VALUE_PAIR		*vp;
 
@@ -621,13 +1192,14 @@ void fr_state_to_request(fr_state_tree_t *state, REQUEST *request)
 		return;
 	}
 
-	PTHREAD_MUTEX_LOCK(&state->mutex);
-	entry = state_entry_find(state, request, &vp->data);
+	shard = state_entry_key(state, &key, request, &vp->data);
+
+	PTHREAD_MUTEX_LOCK(&shard->mutex);
+	entry = state_entry_find(shard, &key);
 	if (entry) {
-		(void)talloc_get_type_abort(entry, fr_state_entry_t);
 		if (entry->thawed) {
 			REDEBUG("State entry has already been thawed by a request %"PRIu64, entry->thawed->number);
-			PTHREAD_MUTEX_UNLOCK(&state->mutex);
+			PTHREAD_MUTEX_UNLOCK(&shard->mutex);
 			return;
 		}
 		if (request->state_ctx) old_ctx = request->state_ctx;	/* Store for later freeing */
@@ -643,7 +1215,13 @@ void fr_state_to_request(fr_state_tree_t *state, REQUEST *request)
 		entry->vps = NULL;
 		entry->thawed = request;
 	}
-	PTHREAD_MUTEX_UNLOCK(&state->mutex);
+	PTHREAD_MUTEX_UNLOCK(&shard->mutex);
+
+	/*
+	 *	The previous round may have been handled by
+	 *	another server.
+	 */
+	if (!entry && state->backend) state_backend_thaw(state, request, &key);
 
 	if (request->state) {
 		RDEBUG2("Restored &session-state");
@@ -671,10 +1249,14 @@ void fr_state_to_request(fr_state_tree_t *state, REQUEST *request)
  */
 int fr_request_to_state(fr_state_tree_t *state, REQUEST *request)
 {
-	fr_state_entry_t	*entry, *old = NULL;
-	fr_dlist_head_t		data;
+	fr_state_entry_t	*entry, *old = NULL, key;
+	fr_state_shard_t	*shard;
+	fr_dlist_head_t		data, to_free;
 	VALUE_PAIR		*vp;
 
+	uint8_t			old_state[sizeof(key.state)];
+	int			old_tries = 0;
+
 	request_data_list_init(&data);
 	request_data_by_persistance(&data, request, true);
 
@@ -685,14 +1267,48 @@ int fr_request_to_state(fr_state_tree_t *state, REQUEST *request)
 		log_request_pair_list(L_DBG_LVL_2, request, request->state, "&session-state:");
 	}
 
+	fr_dlist_init(&to_free, fr_state_entry_t, list);
+
 	vp = fr_pair_find_by_da(request->packet->vps, state->da, TAG_ANY);
+	if (vp) {
+		shard = state_entry_key(state, &key, request, &vp->data);
+
+		PTHREAD_MUTEX_LOCK(&shard->mutex);
+		old = state_entry_find(shard, &key);
+
+		/*
+		 *	Record the information from the old state, we may base the
+		 *	new state off the old one.
+		 *
+		 *	Once we release the mutex, the state of old becomes indeterminate
+		 *	so we have to grab the values now.
+		 */
+		if (old) {
+			old_tries = old->tries;
+
+			memcpy(old_state, old->state, sizeof(old_state));
+
+			/*
+			 *	The old one isn't used any more, so we can free it.
+			 */
+			if (fr_dlist_empty(&old->data)) {
+				state_entry_unlink(state, old);
+				fr_dlist_insert_tail(&to_free, old);
+			}
+		}
+		PTHREAD_MUTEX_UNLOCK(&shard->mutex);
 
-	PTHREAD_MUTEX_LOCK(&state->mutex);
-	if (vp) old = state_entry_find(state, request, &vp->data);
+		/*
+		 *	The previous round is finished with,
+		 *	wherever it was handled.
+		 */
+		if (state->backend) state_backend_remove(state, request, &key);
+	}
 
-	entry = state_entry_create(state, request, request->reply, old);
+	entry = state_entry_create(state, request, request->reply, old ? old_state : NULL, old_tries);
 	if (!entry) {
-		PTHREAD_MUTEX_UNLOCK(&state->mutex);
+	error:
+		state_entry_list_free(&to_free);
 		RERROR("Creating state entry failed");
 		request_data_restore(request, &data);	/* Put it back again */
 		return -1;
@@ -701,15 +1317,36 @@ int fr_request_to_state(fr_state_tree_t *state, REQUEST *request)
 	fr_assert(entry->ctx == NULL);
 	fr_assert(request->state_ctx);
 
+	/*
+	 *	Populate the entry before it's visible to
+	 *	any other threads.
+	 */
 	entry->seq_start = request->seq_start;
 	entry->ctx = request->state_ctx;
 	entry->vps = request->state;
 	fr_dlist_move(&entry->data, &data);
 
+	if (state->backend) state_backend_freeze(state, request, entry);
+
+	if (state_entry_insert(state, entry, &to_free) < 0) {
+		RERROR("Failed inserting state entry - Insertion into state tree failed");
+		fr_pair_delete_by_da(&request->reply->vps, state->da);
+		if (state->backend) state_backend_remove(state, request, entry);
+
+		/*
+		 *	Give the state back to the request
+		 */
+		fr_dlist_move(&data, &entry->data);
+		entry->ctx = NULL;
+		entry->vps = NULL;
+		talloc_free(entry);
+		goto error;
+	}
+
 	request->state_ctx = NULL;
 	request->state = NULL;
 
-	PTHREAD_MUTEX_UNLOCK(&state->mutex);
+	state_entry_list_free(&to_free);
 
 	RDEBUG3("RADIUS State - saved");
 	REQUEST_VERIFY(request);
@@ -849,7 +1486,7 @@ void fr_state_detach(REQUEST *request, bool will_free)
  */
 uint64_t fr_state_entries_created(fr_state_tree_t *state)
 {
-	return state->id;
+	return atomic_load_explicit(&state->id, memory_order_relaxed);
 }
 
 /** Return number of entries that timed out
@@ -857,7 +1494,18 @@ uint64_t fr_state_entries_created(fr_state_tree_t *state)
  */
 uint64_t fr_state_entries_timeout(fr_state_tree_t *state)
 {
-	return state->timed_out;
+	uint64_t	timed_out = 0;
+	uint32_t	i;
+
+	for (i = 0; i < state->num_shards; i++) {
+		fr_state_shard_t *shard = &state->shard[i];
+
+		PTHREAD_MUTEX_LOCK(&shard->mutex);
+		timed_out += shard->timed_out;
+		PTHREAD_MUTEX_UNLOCK(&shard->mutex);
+	}
+
+	return timed_out;
 }
 
 /** Return number of entries we're currently tracking
@@ -865,5 +1513,5 @@ uint64_t fr_state_entries_timeout(fr_state_tree_t *state)
  */
 uint32_t fr_state_entries_tracked(fr_state_tree_t *state)
 {
-	return (uint32_t)rbtree_num_elements(state->tree);
+	return (uint32_t)atomic_load_explicit(&state->tracked, memory_order_relaxed);
 }
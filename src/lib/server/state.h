@@ -35,9 +35,109 @@ extern "C" {
 
 typedef struct fr_state_tree_s fr_state_tree_t;
 
+typedef struct fr_state_backend_inst_s fr_state_backend_inst_t;
+
+/** Store a serialised state entry
+ *
+ * @param[in] uctx		Backend specific data.
+ * @param[in] request		The state entry is being stored for.
+ * @param[in] key		State value (xor'd with the virtual server hash).
+ * @param[in] key_len		Length of the key.
+ * @param[in] value		Serialised state entry.
+ * @param[in] value_len		Length of the serialised state entry.
+ * @param[in] ttl		How long the entry should be retained for.
+ * @return
+ *	- 0 on success.
+ *	- -1 on failure.
+ */
+typedef int (*fr_state_backend_store_t)(void *uctx, REQUEST *request,
+					uint8_t const *key, size_t key_len,
+					uint8_t const *value, size_t value_len, uint32_t ttl);
+
+/** Retrieve a serialised state entry
+ *
+ * @param[out] out		Where to write the serialised state entry.
+ * @param[in] ctx		to allocate the serialised state entry in.
+ * @param[in] uctx		Backend specific data.
+ * @param[in] request		The state entry is being retrieved for.
+ * @param[in] key		State value (xor'd with the virtual server hash).
+ * @param[in] key_len		Length of the key.
+ * @return
+ *	- >0 the length of the serialised state entry.
+ *	- 0 if no entry was found.
+ *	- -1 on failure.
+ */
+typedef ssize_t (*fr_state_backend_fetch_t)(uint8_t **out, TALLOC_CTX *ctx, void *uctx, REQUEST *request,
+					    uint8_t const *key, size_t key_len);
+
+/** Remove a serialised state entry
+ *
+ * @param[in] uctx		Backend specific data.
+ * @param[in] request		The state entry is being removed for.
+ * @param[in] key		State value (xor'd with the virtual server hash).
+ * @param[in] key_len		Length of the key.
+ * @return
+ *	- 0 on success (including if the entry didn't exist).
+ *	- -1 on failure.
+ */
+typedef int (*fr_state_backend_remove_t)(void *uctx, REQUEST *request, uint8_t const *key, size_t key_len);
+
+/** Interface for storing state entries outside of the server process
+ *
+ * Allows multi-round authentication sessions to continue on a
+ * different server instance to the one that started them.
+ */
+typedef struct {
+	char const			*name;		//!< Type of backend e.g. "memory", "redis".
+
+	fr_state_backend_store_t	store;		//!< Store a serialised entry.
+	fr_state_backend_fetch_t	fetch;		//!< Retrieve a serialised entry.
+	fr_state_backend_remove_t	remove;		//!< Remove a serialised entry.
+} fr_state_backend_t;
+
+/** Serialise persistable request data so that it can be stored in a state backend
+ *
+ * @param[out] out		Where to write the serialised data.
+ * @param[in] ctx		to allocate the serialised data in.
+ * @param[in] opaque		Request data to serialise.
+ * @return
+ *	- >0 the length of the serialised data.
+ *	- 0 if this particular instance of the data can't be serialised.
+ *	- -1 on failure.
+ */
+typedef ssize_t (*fr_state_data_freeze_t)(uint8_t **out, TALLOC_CTX *ctx, void const *opaque);
+
+/** Recreate persistable request data from its serialised form
+ *
+ * @param[in] ctx		to allocate the request data in.
+ * @param[in] in		Serialised data.
+ * @param[in] inlen		Length of the serialised data.
+ * @return
+ *	- The recreated request data.
+ *	- NULL on failure.
+ */
+typedef void *(*fr_state_data_thaw_t)(TALLOC_CTX *ctx, uint8_t const *in, size_t inlen);
+
 fr_state_tree_t *fr_state_tree_init(TALLOC_CTX *ctx, fr_dict_attr_t const *da, bool thread_safe,
 				    uint32_t max_sessions, uint32_t timeout, uint8_t server_id);
 
+int	fr_state_tree_backend_set(fr_state_tree_t *state, char const *name);
+
+/** @name State backend registration
+ *
+ * @{
+ */
+fr_state_backend_inst_t *fr_state_backend_register(TALLOC_CTX *ctx, char const *name,
+						   fr_state_backend_t const *backend, void *uctx);
+
+fr_state_backend_inst_t *fr_state_backend_find(char const *name);
+
+int	fr_state_data_serializer_register(char const *name, void const *unique_ptr, int unique_int,
+					  char const *type, fr_state_data_freeze_t freeze, fr_state_data_thaw_t thaw);
+
+void	fr_state_data_serializer_unregister(char const *name);
+/** @} */
+
 void	fr_state_discard(fr_state_tree_t *state, REQUEST *request);
 
 void	fr_state_to_request(fr_state_tree_t *state, REQUEST *request);
@@ -0,0 +1,409 @@
+/*
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ */
+
+/**
+ * $Id$
+ *
+ * @brief Registries for state backends and request data serialisers
+ * @file src/lib/server/state_backend.c
+ *
+ * State backends store serialised state entries outside of the state
+ * tree, so that multi-round authentication sessions can be continued
+ * by a different server instance to the one which started them.
+ *
+ * Backends are registered by name, usually by modules during bootstrap,
+ * and are then referenced by name from the configuration of the state
+ * tree.  A simple in-process backend ("memory") is provided here, mainly
+ * as a stand-in for external stores during testing.
+ *
+ * Persistable request data (such as EAP sessions) is opaque to the state
+ * code, so whatever adds it must also register a serialiser for it.  If
+ * any request data in a state entry has no serialiser, the entry is only
+ * kept in the local state tree.
+ *
+ * @copyright 2020 The FreeRADIUS server project
+ */
+RCSID("$Id$")
+
+#include <freeradius-devel/server/base.h>
+#include <freeradius-devel/util/debug.h>
+#include <freeradius-devel/util/rbtree.h>
+
+#include "state_priv.h"
+
+static fr_dlist_head_t	backend_list;
+static bool		backend_list_init;
+
+static fr_dlist_head_t	serializer_list;
+static bool		serializer_list_init;
+
+/** Remove a backend from the registry when it's freed
+ *
+ */
+static int _state_backend_inst_free(fr_state_backend_inst_t *inst)
+{
+	if (inst->name) fr_dlist_remove(&backend_list, inst);
+
+	return 0;
+}
+
+/** Register a state backend
+ *
+ * @note Should only be called during bootstrap, the registry is not thread safe.
+ *
+ * @param[in] ctx		The backend is unregistered when this ctx is freed.
+ * @param[in] name		to register the backend with.  Usually the name
+ *				of the module instance providing it.
+ * @param[in] backend		Backend's exported interface.
+ * @param[in] uctx		Passed to the backend's callbacks.
+ * @return
+ *	- The registered backend.
+ *	- NULL if a backend with the same name already exists.
+ */
+fr_state_backend_inst_t *fr_state_backend_register(TALLOC_CTX *ctx, char const *name,
+						   fr_state_backend_t const *backend, void *uctx)
+{
+	fr_state_backend_inst_t *inst;
+
+	if (!backend_list_init) {
+		fr_dlist_talloc_init(&backend_list, fr_state_backend_inst_t, entry);
+		backend_list_init = true;
+	}
+
+	if (fr_state_backend_find(name)) {
+		fr_strerror_printf("State backend \"%s\" already registered", name);
+		return NULL;
+	}
+
+	MEM(inst = talloc_zero(ctx, fr_state_backend_inst_t));
+	inst->name = talloc_typed_strdup(inst, name);
+	inst->backend = backend;
+	inst->uctx = uctx;
+	talloc_set_destructor(inst, _state_backend_inst_free);
+
+	fr_dlist_insert_tail(&backend_list, inst);
+
+	return inst;
+}
+
+/** Find a registered state backend by name
+ *
+ * @param[in] name	of the backend.
+ * @return
+ *	- The backend.
+ *	- NULL if no backend with that name was registered.
+ */
+fr_state_backend_inst_t *fr_state_backend_find(char const *name)
+{
+	fr_state_backend_inst_t *inst = NULL;
+
+	if (!backend_list_init) return NULL;
+
+	while ((inst = fr_dlist_next(&backend_list, inst))) {
+		if (strcmp(inst->name, name) == 0) return inst;
+	}
+
+	return NULL;
+}
+
+/** Register a serialiser for persistable request data
+ *
+ * @note Should only be called during module load or bootstrap, the registry is not thread safe.
+ *
+ * @param[in] name		Identifies the serialiser in serialised state entries.  Must be
+ *				the same on all servers sharing a state backend.
+ * @param[in] unique_ptr	The request data is added with.
+ * @param[in] unique_int	The request data is added with.
+ * @param[in] type		talloc type of the request data.
+ * @param[in] freeze		Serialise the request data.
+ * @param[in] thaw		Recreate the request data.
+ * @return
+ *	- 0 on success.
+ *	- -1 if a serialiser for this request data already exists.
+ */
+int fr_state_data_serializer_register(char const *name, void const *unique_ptr, int unique_int,
+				      char const *type, fr_state_data_freeze_t freeze, fr_state_data_thaw_t thaw)
+{
+	fr_state_data_serializer_t *ser;
+
+	if (!serializer_list_init) {
+		fr_dlist_talloc_init(&serializer_list, fr_state_data_serializer_t, entry);
+		serializer_list_init = true;
+	}
+
+	if (fr_state_data_serializer_by_id(unique_ptr, unique_int) ||
+	    fr_state_data_serializer_by_name(name, strlen(name))) {
+		fr_strerror_printf("Serialiser \"%s\" already registered", name);
+		return -1;
+	}
+
+	MEM(ser = talloc_zero(NULL, fr_state_data_serializer_t));
+	ser->name = talloc_typed_strdup(ser, name);
+	ser->unique_ptr = unique_ptr;
+	ser->unique_int = unique_int;
+	ser->type = type;
+	ser->freeze = freeze;
+	ser->thaw = thaw;
+
+	fr_dlist_insert_tail(&serializer_list, ser);
+
+	return 0;
+}
+
+/** Unregister a serialiser for persistable request data
+ *
+ * @param[in] name	of the serialiser to remove.
+ */
+void fr_state_data_serializer_unregister(char const *name)
+{
+	fr_state_data_serializer_t *ser;
+
+	ser = UNCONST(fr_state_data_serializer_t *, fr_state_data_serializer_by_name(name, strlen(name)));
+	if (!ser) return;
+
+	fr_dlist_remove(&serializer_list, ser);
+	talloc_free(ser);
+}
+
+/** Find the serialiser for request data
+ *
+ */
+fr_state_data_serializer_t const *fr_state_data_serializer_by_id(void const *unique_ptr, int unique_int)
+{
+	fr_state_data_serializer_t *ser = NULL;
+
+	if (!serializer_list_init) return NULL;
+
+	while ((ser = fr_dlist_next(&serializer_list, ser))) {
+		if ((ser->unique_ptr == unique_ptr) && (ser->unique_int == unique_int)) return ser;
+	}
+
+	return NULL;
+}
+
+/** Find the serialiser for request data by the name recorded in a serialised state entry
+ *
+ */
+fr_state_data_serializer_t const *fr_state_data_serializer_by_name(char const *name, size_t name_len)
+{
+	fr_state_data_serializer_t *ser = NULL;
+
+	if (!serializer_list_init) return NULL;
+
+	while ((ser = fr_dlist_next(&serializer_list, ser))) {
+		if ((strlen(ser->name) == name_len) && (memcmp(ser->name, name, name_len) == 0)) return ser;
+	}
+
+	return NULL;
+}
+
+/** An entry in the memory backend
+ *
+ */
+typedef struct {
+	uint8_t			*key;		//!< State value.
+	uint8_t			*value;		//!< Serialised state entry.
+	time_t			expires;	//!< When the entry should be removed.
+	fr_dlist_t		entry;		//!< Entry in the expiry list.
+} state_memory_entry_t;
+
+/** In-process state backend
+ *
+ */
+typedef struct {
+	pthread_mutex_t		mutex;		//!< Protects the tree and expiry list.
+	rbtree_t		*tree;		//!< Entries by key.
+	fr_dlist_head_t		expiry;		//!< Entries in insertion order.
+} state_memory_t;
+
+static int state_memory_entry_cmp(void const *one, void const *two)
+{
+	state_memory_entry_t const	*a = one, *b = two;
+	size_t				a_len = talloc_array_length(a->key), b_len = talloc_array_length(b->key);
+	int				ret;
+
+	ret = (a_len > b_len) - (a_len < b_len);
+	if (ret != 0) return ret;
+
+	return memcmp(a->key, b->key, a_len);
+}
+
+/** Remove expired entries
+ *
+ * @note Called with the mutex held.
+ */
+static void state_memory_expire(state_memory_t *mem, time_t now)
+{
+	state_memory_entry_t *entry;
+
+	/*
+	 *	Entries are almost always stored with the
+	 *	same TTL, so insertion order is expiry order.
+	 */
+	while ((entry = fr_dlist_head(&mem->expiry)) && (entry->expires < now)) {
+		fr_dlist_remove(&mem->expiry, entry);
+		rbtree_deletebydata(mem->tree, entry);
+		talloc_free(entry);
+	}
+}
+
+static int state_memory_store(void *uctx, UNUSED REQUEST *request,
+			      uint8_t const *key, size_t key_len,
+			      uint8_t const *value, size_t value_len, uint32_t ttl)
+{
+	state_memory_t		*mem = talloc_get_type_abort(uctx, state_memory_t);
+	state_memory_entry_t	*entry, *old;
+	time_t			now = time(NULL);
+
+	/*
+	 *	Allocate outside of the mutex
+	 */
+	MEM(entry = talloc_zero(NULL, state_memory_entry_t));
+	MEM(entry->key = talloc_memdup(entry, key, key_len));
+	MEM(entry->value = talloc_memdup(entry, value, value_len));
+	entry->expires = now + ttl;
+
+	pthread_mutex_lock(&mem->mutex);
+	state_memory_expire(mem, now);
+
+	old = rbtree_finddata(mem->tree, entry);
+	if (old) {
+		fr_dlist_remove(&mem->expiry, old);
+		rbtree_deletebydata(mem->tree, old);
+	}
+
+	if (!rbtree_insert(mem->tree, entry)) {
+		pthread_mutex_unlock(&mem->mutex);
+		talloc_free(old);
+		talloc_free(entry);
+		return -1;
+	}
+	fr_dlist_insert_tail(&mem->expiry, entry);
+	pthread_mutex_unlock(&mem->mutex);
+
+	talloc_free(old);
+
+	return 0;
+}
+
+static ssize_t state_memory_fetch(uint8_t **out, TALLOC_CTX *ctx, void *uctx, UNUSED REQUEST *request,
+				  uint8_t const *key, size_t key_len)
+{
+	state_memory_t		*mem = talloc_get_type_abort(uctx, state_memory_t);
+	state_memory_entry_t	*entry, find;
+	ssize_t			slen = 0;
+
+	/*
+	 *	The comparator uses the talloc array length
+	 */
+	MEM(find.key = talloc_memdup(NULL, key, key_len));
+
+	pthread_mutex_lock(&mem->mutex);
+	entry = rbtree_finddata(mem->tree, &find);
+	if (entry && (entry->expires >= time(NULL))) {
+		slen = talloc_array_length(entry->value);
+		MEM(*out = talloc_memdup(ctx, entry->value, slen));
+	}
+	pthread_mutex_unlock(&mem->mutex);
+
+	talloc_free(find.key);
+
+	return slen;
+}
+
+static int state_memory_remove(void *uctx, UNUSED REQUEST *request, uint8_t const *key, size_t key_len)
+{
+	state_memory_t		*mem = talloc_get_type_abort(uctx, state_memory_t);
+	state_memory_entry_t	*entry, find;
+
+	MEM(find.key = talloc_memdup(NULL, key, key_len));
+
+	pthread_mutex_lock(&mem->mutex);
+	entry = rbtree_finddata(mem->tree, &find);
+	if (entry) {
+		fr_dlist_remove(&mem->expiry, entry);
+		rbtree_deletebydata(mem->tree, entry);
+	}
+	pthread_mutex_unlock(&mem->mutex);
+
+	talloc_free(find.key);
+	talloc_free(entry);
+
+	return 0;
+}
+
+static fr_state_backend_t const state_backend_memory = {
+	.name		= "memory",
+	.store		= state_memory_store,
+	.fetch		= state_memory_fetch,
+	.remove		= state_memory_remove
+};
+
+static int _state_memory_free(state_memory_t *mem)
+{
+	state_memory_entry_t *entry;
+
+	while ((entry = fr_dlist_head(&mem->expiry))) {
+		fr_dlist_remove(&mem->expiry, entry);
+		rbtree_deletebydata(mem->tree, entry);
+		talloc_free(entry);
+	}
+	talloc_free(mem->tree);
+	pthread_mutex_destroy(&mem->mutex);
+
+	return 0;
+}
+
+/** Allocate an in-process state backend
+ *
+ * @param[in] ctx	to allocate the backend in.
+ * @param[in] name	to register the backend with.  If NULL the backend
+ *			is not registered, and can only be used by whoever
+ *			allocated it.
+ * @return
+ *	- A new memory backend.
+ *	- NULL on error.
+ */
+fr_state_backend_inst_t *fr_state_backend_memory_alloc(TALLOC_CTX *ctx, char const *name)
+{
+	fr_state_backend_inst_t	*inst;
+	state_memory_t		*mem;
+
+	MEM(mem = talloc_zero(ctx, state_memory_t));
+	if (pthread_mutex_init(&mem->mutex, NULL) != 0) {
+		fr_strerror_printf("Failed initialising mutex");
+		talloc_free(mem);
+		return NULL;
+	}
+	fr_dlist_talloc_init(&mem->expiry, state_memory_entry_t, entry);
+	MEM(mem->tree = rbtree_talloc_alloc(NULL, state_memory_entry_cmp, state_memory_entry_t, NULL, 0));
+	talloc_set_destructor(mem, _state_memory_free);
+
+	if (name) {
+		inst = fr_state_backend_register(mem, name, &state_backend_memory, mem);
+		if (!inst) {
+			talloc_free(mem);
+			return NULL;
+		}
+		return inst;
+	}
+
+	MEM(inst = talloc_zero(mem, fr_state_backend_inst_t));
+	inst->backend = &state_backend_memory;
+	inst->uctx = mem;
+
+	return inst;
+}
@@ -0,0 +1,59 @@
+#pragma once
+/*
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ */
+
+/**
+ * $Id$
+ *
+ * @file src/lib/server/state_priv.h
+ * @brief Private state backend structures and functions.
+ *
+ * @copyright 2020 The FreeRADIUS server project
+ */
+RCSIDH(state_priv_h, "$Id$")
+
+#include <freeradius-devel/server/state.h>
+#include <freeradius-devel/util/dlist.h>
+
+/** A registered state backend
+ *
+ */
+struct fr_state_backend_inst_s {
+	fr_dlist_t			entry;		//!< Entry in the list of registered backends.
+	char const			*name;		//!< Name the backend was registered with.
+							//!< NULL if not registered.
+	fr_state_backend_t const	*backend;	//!< Backend's exported interface.
+	void				*uctx;		//!< Backend specific data.
+};
+
+/** A registered serialiser for persistable request data
+ *
+ */
+typedef struct {
+	fr_dlist_t			entry;		//!< Entry in the list of registered serialisers.
+	char const			*name;		//!< Identifies the serialiser in serialised entries.
+	void const			*unique_ptr;	//!< unique_ptr of the request data.
+	int				unique_int;	//!< unique_int of the request data.
+	char const			*type;		//!< talloc type of the request data.
+	fr_state_data_freeze_t		freeze;		//!< Serialise the request data.
+	fr_state_data_thaw_t		thaw;		//!< Recreate the request data.
+} fr_state_data_serializer_t;
+
+fr_state_data_serializer_t const	*fr_state_data_serializer_by_id(void const *unique_ptr, int unique_int);
+
+fr_state_data_serializer_t const	*fr_state_data_serializer_by_name(char const *name, size_t name_len);
+
+fr_state_backend_inst_t			*fr_state_backend_memory_alloc(TALLOC_CTX *ctx, char const *name);
@@ -0,0 +1,376 @@
+#include <freeradius-devel/util/acutest.h>
+#include <pthread.h>
+
+#include "state.c"
+
+#define DEBUG_LVL_SET if (test_verbose_level__ >= 3) fr_debug_lvl = L_DBG_LVL_4 + 1
+
+/** Allocate an entry with a random state value, without going through a REQUEST
+ *
+ */
+static fr_state_entry_t *test_entry_alloc(fr_state_tree_t *state, fr_fast_rand_t *rand_ctx, time_t cleanup)
+{
+	fr_state_entry_t	*entry;
+	size_t			i;
+	uint32_t		x;
+
+	if (state_tree_reserve(state, NULL, 0, false) < 0) return NULL;
+
+	MEM(entry = talloc_zero(NULL, fr_state_entry_t));
+	request_data_list_init(&entry->data);
+	talloc_set_destructor(entry, _state_entry_free);
+	entry->id = atomic_fetch_add_explicit(&state->id, 1, memory_order_relaxed);
+	entry->cleanup = cleanup;
+
+	for (i = 0; i < sizeof(entry->state) / sizeof(x); i++) {
+		x = fr_fast_rand(rand_ctx);
+		memcpy(entry->state + (i * 4), &x, sizeof(x));
+	}
+
+	return entry;
+}
+
+/** Find an entry by value, and unlink it if found
+ *
+ */
+static fr_state_entry_t *test_entry_find_unlink(fr_state_tree_t *state, uint8_t const *value)
+{
+	fr_state_entry_t	key, *entry;
+	fr_state_shard_t	*shard;
+
+	memcpy(key.state, value, sizeof(key.state));
+	shard = state_shard(state, &key);
+
+	PTHREAD_MUTEX_LOCK(&shard->mutex);
+	entry = state_entry_find(shard, &key);
+	if (entry) state_entry_unlink(state, entry);
+	PTHREAD_MUTEX_UNLOCK(&shard->mutex);
+
+	return entry;
+}
+
+static void test_insert_find_unlink(void)
+{
+	fr_state_tree_t		*state;
+	fr_state_entry_t	**entries;
+	fr_dlist_head_t		to_free;
+	fr_fast_rand_t		rand_ctx = { .a = 1, .b = 2 };
+	size_t			i, count = 1000;
+	uint32_t		used = 0;
+
+	DEBUG_LVL_SET;
+
+	fr_dlist_init(&to_free, fr_state_entry_t, list);
+
+	state = state_tree_alloc(NULL, NULL, true, count, 60, 0, STATE_SHARDS);
+	TEST_CHECK(state != NULL);
+
+	MEM(entries = talloc_array(NULL, fr_state_entry_t *, count));
+
+	TEST_CASE("Insert entries");
+	for (i = 0; i < count; i++) {
+		entries[i] = test_entry_alloc(state, &rand_ctx, time(NULL) + 60);
+		TEST_CHECK(entries[i] != NULL);
+		TEST_CHECK(state_entry_insert(state, entries[i], &to_free) == 0);
+	}
+	TEST_CHECK(fr_dlist_empty(&to_free));
+	TEST_CHECK(fr_state_entries_tracked(state) == count);
+	TEST_CHECK(fr_state_entries_created(state) == count);
+
+	TEST_CASE("Entries are spread over the shards");
+	for (i = 0; i < STATE_SHARDS; i++) if (rbtree_num_elements(state->shard[i].tree) > 0) used++;
+	TEST_CHECK(used == STATE_SHARDS);
+	TEST_MSG("Expected %u shards used, got %u", STATE_SHARDS, used);
+
+	TEST_CASE("Find and unlink entries");
+	for (i = 0; i < count; i++) {
+		fr_state_entry_t *found;
+
+		found = test_entry_find_unlink(state, entries[i]->state);
+		TEST_CHECK(found == entries[i]);
+		talloc_free(found);
+	}
+	TEST_CHECK(fr_state_entries_tracked(state) == 0);
+
+	talloc_free(entries);
+	talloc_free(state);
+}
+
+static void test_max_sessions(void)
+{
+	fr_state_tree_t		*state;
+	fr_state_entry_t	*entries[10], *entry;
+	fr_dlist_head_t		to_free;
+	fr_fast_rand_t		rand_ctx = { .a = 3, .b = 4 };
+	size_t			i;
+
+	DEBUG_LVL_SET;
+
+	fr_dlist_init(&to_free, fr_state_entry_t, list);
+
+	state = state_tree_alloc(NULL, NULL, true, NUM_ELEMENTS(entries), 60, 0, STATE_SHARDS);
+	TEST_CHECK(state != NULL);
+
+	TEST_CASE("Fill the tree");
+	for (i = 0; i < NUM_ELEMENTS(entries); i++) {
+		entries[i] = test_entry_alloc(state, &rand_ctx, time(NULL) + 60);
+		TEST_CHECK(entries[i] != NULL);
+		TEST_CHECK(state_entry_insert(state, entries[i], &to_free) == 0);
+	}
+
+	TEST_CASE("New sessions are rejected at the limit");
+	TEST_CHECK(test_entry_alloc(state, &rand_ctx, time(NULL) + 60) == NULL);
+	TEST_CHECK(fr_state_entries_tracked(state) == NUM_ELEMENTS(entries));
+
+	TEST_CASE("Continuing sessions are not limited");
+	TEST_CHECK(state_tree_reserve(state, NULL, 0, true) == 0);
+	atomic_fetch_sub_explicit(&state->tracked, 1, memory_order_relaxed);
+
+	TEST_CASE("Removing an entry frees a slot");
+	talloc_free(test_entry_find_unlink(state, entries[0]->state));
+	entry = test_entry_alloc(state, &rand_ctx, time(NULL) + 60);
+	TEST_CHECK(entry != NULL);
+	TEST_CHECK(state_entry_insert(state, entry, &to_free) == 0);
+	TEST_CHECK(fr_state_entries_tracked(state) == NUM_ELEMENTS(entries));
+
+	talloc_free(state);
+}
+
+static void test_expiry(void)
+{
+	fr_state_tree_t		*state;
+	fr_state_entry_t	*entry;
+	fr_dlist_head_t		to_free;
+	fr_fast_rand_t		rand_ctx = { .a = 5, .b = 6 };
+	size_t			i, count = 100;
+
+	DEBUG_LVL_SET;
+
+	fr_dlist_init(&to_free, fr_state_entry_t, list);
+
+	state = state_tree_alloc(NULL, NULL, true, count * 2, 60, 0, STATE_SHARDS);
+	TEST_CHECK(state != NULL);
+
+	TEST_CASE("Insert expired entries");
+	for (i = 0; i < count; i++) {
+		entry = test_entry_alloc(state, &rand_ctx, time(NULL) - 10);
+		TEST_CHECK(state_entry_insert(state, entry, &to_free) == 0);
+	}
+
+	/*
+	 *	Each insertion only expires entries in its own shard
+	 */
+	TEST_CASE("Insertion expires entries in the same shard");
+	TEST_CHECK(fr_state_entries_timeout(state) == count - fr_state_entries_tracked(state));
+	state_entry_list_free(&to_free);
+
+	TEST_CASE("Tree-wide expiry removes the rest");
+	state_tree_expire(state, time(NULL));
+	TEST_CHECK(fr_state_entries_tracked(state) == 0);
+	TEST_CHECK(fr_state_entries_timeout(state) == count);
+
+	talloc_free(state);
+}
+
+static void test_backend_memory(void)
+{
+	fr_state_backend_inst_t	*backend;
+	uint8_t			key[16] = { 0x01 }, value[] = "serialised state";
+	uint8_t			*out = NULL;
+	ssize_t			slen;
+
+	DEBUG_LVL_SET;
+
+	backend = fr_state_backend_memory_alloc(NULL, "test_memory");
+	TEST_CHECK(backend != NULL);
+	TEST_CHECK(fr_state_backend_find("test_memory") == backend);
+
+	TEST_CASE("Store and fetch");
+	TEST_CHECK(backend->backend->store(backend->uctx, NULL, key, sizeof(key), value, sizeof(value), 60) == 0);
+	slen = backend->backend->fetch(&out, NULL, backend->uctx, NULL, key, sizeof(key));
+	TEST_CHECK(slen == sizeof(value));
+	TEST_CHECK(out && (memcmp(out, value, sizeof(value)) == 0));
+	talloc_free(out);
+
+	TEST_CASE("Remove");
+	TEST_CHECK(backend->backend->remove(backend->uctx, NULL, key, sizeof(key)) == 0);
+	TEST_CHECK(backend->backend->fetch(&out, NULL, backend->uctx, NULL, key, sizeof(key)) == 0);
+
+	TEST_CASE("Unregistered when freed");
+	talloc_free(talloc_parent(backend));
+	TEST_CHECK(fr_state_backend_find("test_memory") == NULL);
+}
+
+static int test_data_marker;
+
+static ssize_t test_data_freeze(uint8_t **out, TALLOC_CTX *ctx, void const *opaque)
+{
+	MEM(*out = talloc_memdup(ctx, opaque, sizeof(uint32_t)));
+	return sizeof(uint32_t);
+}
+
+static void *test_data_thaw(TALLOC_CTX *ctx, uint8_t const *in, size_t inlen)
+{
+	uint32_t *data;
+
+	if (inlen != sizeof(uint32_t)) return NULL;
+
+	MEM(data = talloc(ctx, uint32_t));
+	memcpy(data, in, inlen);
+
+	return data;
+}
+
+static void test_serialize_data(void)
+{
+	REQUEST		*request, *thawed;
+	fr_dlist_head_t	data;
+	uint32_t	*value, *restored;
+	uint8_t		*blob;
+	ssize_t		slen;
+
+	DEBUG_LVL_SET;
+
+	TEST_CHECK(fr_state_data_serializer_register("test_data", &test_data_marker, 0, "uint32_t",
+						     test_data_freeze, test_data_thaw) == 0);
+
+	request = request_alloc(NULL);
+	MEM(value = talloc(request->state_ctx, uint32_t));
+	*value = 0xdeadbeef;
+	request_data_talloc_add(request, &test_data_marker, 0, uint32_t, value, true, true, true);
+
+	request_data_list_init(&data);
+	request_data_by_persistance(&data, request, true);
+
+	TEST_CASE("Serialise request data with a registered serialiser");
+	slen = state_entry_serialize(&blob, NULL, request, NULL, &data, 42);
+	TEST_CHECK(slen > 0);
+
+	TEST_CASE("Deserialise into another request");
+	thawed = request_alloc(NULL);
+	TEST_CHECK(state_entry_deserialize(thawed, blob, slen) == 0);
+	TEST_CHECK(thawed->seq_start == 42);
+	restored = request_data_get(thawed, &test_data_marker, 0);
+	TEST_CHECK(restored && (*restored == 0xdeadbeef));
+	talloc_free(restored);
+
+	TEST_CASE("Truncated entries are rejected");
+	TEST_CHECK(state_entry_deserialize(thawed, blob, slen - 1) < 0);
+	talloc_free(blob);
+
+	TEST_CASE("Request data without a serialiser isn't portable");
+	fr_state_data_serializer_unregister("test_data");
+	TEST_CHECK(state_entry_serialize(&blob, NULL, request, NULL, &data, 42) == 0);
+
+	request_data_restore(request, &data);
+	talloc_free(request);
+	talloc_free(thawed);
+}
+
+typedef struct {
+	fr_state_tree_t		*state;
+	size_t			cycles;
+	uint32_t		seed;
+	size_t			failed;
+} test_thread_ctx_t;
+
+/** Insert, find and remove entries as fast as possible
+ *
+ */
+static void *test_contention_thread(void *arg)
+{
+	test_thread_ctx_t	*tctx = arg;
+	fr_fast_rand_t		rand_ctx = { .a = tctx->seed, .b = ~tctx->seed };
+	fr_dlist_head_t		to_free;
+	size_t			i;
+
+	fr_dlist_init(&to_free, fr_state_entry_t, list);
+
+	for (i = 0; i < tctx->cycles; i++) {
+		fr_state_entry_t	*entry, *found;
+
+		entry = test_entry_alloc(tctx->state, &rand_ctx, time(NULL) + 60);
+		if (!entry || (state_entry_insert(tctx->state, entry, &to_free) < 0)) {
+			talloc_free(entry);
+			tctx->failed++;
+			continue;
+		}
+
+		found = test_entry_find_unlink(tctx->state, entry->state);
+		if (found != entry) tctx->failed++;
+		talloc_free(entry);
+	}
+
+	return NULL;
+}
+
+static void test_contention(uint32_t num_shards)
+{
+	fr_state_tree_t		*state;
+	size_t			i, threads = 8, cycles = 100000;
+	pthread_t		tid[8];
+	test_thread_ctx_t	tctx[8];
+	fr_time_t		start, stop;
+	fr_time_delta_t		elapsed;
+
+	DEBUG_LVL_SET;
+
+	state = state_tree_alloc(NULL, NULL, true, threads * cycles, 60, 0, num_shards);
+	TEST_CHECK(state != NULL);
+
+	start = fr_time();
+	for (i = 0; i < threads; i++) {
+		tctx[i] = (test_thread_ctx_t){ .state = state, .cycles = cycles, .seed = i + 1 };
+		TEST_CHECK(pthread_create(&tid[i], NULL, test_contention_thread, &tctx[i]) == 0);
+	}
+	for (i = 0; i < threads; i++) {
+		pthread_join(tid[i], NULL);
+		TEST_CHECK(tctx[i].failed == 0);
+		TEST_MSG("Thread %zu had %zu failures", i, tctx[i].failed);
+	}
+	stop = fr_time();
+	elapsed = stop - start;
+
+	TEST_CHECK(fr_state_entries_tracked(state) == 0);
+	TEST_CHECK(fr_state_entries_created(state) == threads * cycles);
+
+	if (test_verbose_level__ >= 1) {
+		INFO("%u shard(s), %zu threads: %pV (%u ops/s)",
+		     num_shards, threads, fr_box_time_delta(elapsed),
+		     (uint32_t)((threads * cycles) / ((float)elapsed / NSEC)));
+	}
+
+	talloc_free(state);
+}
+
+static void test_contention_single_shard(void)
+{
+	test_contention(1);
+}
+
+static void test_contention_sharded(void)
+{
+	test_contention(STATE_SHARDS);
+}
+
+TEST_LIST = {
+	/*
+	 *	Basic tests
+	 */
+	{ "Basic - Insert, find, unlink",		test_insert_find_unlink },
+	{ "Basic - Session limit",			test_max_sessions },
+	{ "Basic - Expiry",				test_expiry },
+
+	/*
+	 *	External state
+	 */
+	{ "Backend - Memory",				test_backend_memory },
+	{ "Backend - Serialise request data",		test_serialize_data },
+
+	/*
+	 *	Performance tests
+	 */
+	{ "Speed Test - Contention, single shard",	test_contention_single_shard },
+	{ "Speed Test - Contention, sharded",		test_contention_sharded },
+	{ NULL }
+};
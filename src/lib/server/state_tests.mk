@@ -0,0 +1,12 @@
+TARGET		:= state_tests
+
+SOURCES		:= state_tests.c
+
+TGT_LDLIBS	:= $(LIBS)
+TGT_LDFLAGS	:= $(LDFLAGS)
+
+ifneq ($(OPENSSL_LIBS),)
+TGT_PREREQS	:= libfreeradius-tls.a
+endif
+
+TGT_PREREQS	+= libfreeradius-util.a libfreeradius-server.a libfreeradius-unlang.a libfreeradius-internal.a
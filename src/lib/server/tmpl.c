@@ -2962,11 +2962,72 @@ static void *_tmpl_cursor_next(void **prev, void *curr, void *ctx)
 	return NULL;
 }
 
+/** Number of entries in the per-request attribute reference cache
+ *
+ * Must be a power of two.
+ */
+#define TMPL_CACHE_SIZE		16
+
+/** A previously resolved attribute reference
+ *
+ * The result of walking a list depends only on the list, and the
+ * da, tag and index of the reference, so those are what we validate
+ * against.  The #vp_tmpl_t pointer is only used to pick the slot.
+ */
+typedef struct {
+	vp_tmpl_t const		*vpt;		//!< Reference which populated the entry.
+	tmpl_type_t		type;		//!< Of the reference.
+	fr_dict_attr_t const	*da;		//!< Attribute being searched for.
+	int16_t			num;		//!< Instance being searched for.
+	int8_t			tag;		//!< Tag being searched for.
+
+	VALUE_PAIR		**vps;		//!< List which was searched.
+	VALUE_PAIR		*head;		//!< First pair in the list when it was searched.
+	uint64_t		generation;	//!< Value of #fr_cursor_generation when the list was searched.
+
+	fr_cursor_t		cursor;		//!< Cursor positioned at the first matching pair.
+} tmpl_cache_entry_t;
+
+struct tmpl_cache_s {
+	tmpl_cache_entry_t	entry[TMPL_CACHE_SIZE];
+};
+
+/** Find the cache slot for an attribute reference
+ *
+ */
+static inline tmpl_cache_entry_t *tmpl_cache_slot(REQUEST *request, vp_tmpl_t const *vpt)
+{
+	if (unlikely(!request->tmpl_cache)) {
+		request->tmpl_cache = talloc_zero(request, tmpl_cache_t);
+		if (!request->tmpl_cache) return NULL;
+	}
+
+	return &request->tmpl_cache->entry[((uintptr_t)vpt >> 4) & (TMPL_CACHE_SIZE - 1)];
+}
+
+/** Whether a cache entry is still valid for an attribute reference
+ *
+ * Any list modification on this thread, or the list head changing
+ * underneath us, invalidates the entry.
+ */
+static inline bool tmpl_cache_valid(tmpl_cache_entry_t const *entry, vp_tmpl_t const *vpt, VALUE_PAIR **vps)
+{
+	if ((entry->vpt != vpt) || (entry->generation != fr_cursor_generation)) return false;
+	if ((entry->vps != vps) || (entry->head != *vps)) return false;
+	if ((entry->type != vpt->type) || (entry->num != tmpl_num(vpt)) || (entry->tag != tmpl_tag(vpt))) return false;
+
+	return !tmpl_is_attr(vpt) || (entry->da == tmpl_da(vpt));
+}
+
 /** Initialise a #fr_cursor_t to the #VALUE_PAIR specified by a #vp_tmpl_t
  *
  * This makes iterating over the one or more #VALUE_PAIR specified by a #vp_tmpl_t
  * significantly easier.
  *
+ * The position of the first matching #VALUE_PAIR is cached in the request, so
+ * repeated evaluations of the same reference don't walk the list again unless
+ * a list has been modified in the meantime.
+ *
  * @param err May be NULL if no error code is required. Will be set to:
  *	- 0 on success.
  *	- -1 if no matching #VALUE_PAIR could be found.
@@ -2983,7 +3044,8 @@ static void *_tmpl_cursor_next(void **prev, void *curr, void *ctx)
  */
 VALUE_PAIR *tmpl_cursor_init(int *err, fr_cursor_t *cursor, REQUEST *request, vp_tmpl_t const *vpt)
 {
-	VALUE_PAIR	**vps, *vp = NULL;
+	VALUE_PAIR		**vps, *vp = NULL;
+	tmpl_cache_entry_t	*entry;
 
 	TMPL_VERIFY(vpt);
 
@@ -2991,6 +3053,8 @@ VALUE_PAIR *tmpl_cursor_init(int *err, fr_cursor_t *cursor, REQUEST *request, vp
 
 	if (err) *err = 0;
 
+	entry = tmpl_cache_slot(request, vpt);	/* Cache belongs to the original request */
+
 	if (radius_request(&request, tmpl_request(vpt)) < 0) {
 		if (err) {
 			*err = -3;
@@ -3009,7 +3073,25 @@ VALUE_PAIR *tmpl_cursor_init(int *err, fr_cursor_t *cursor, REQUEST *request, vp
 		return NULL;
 	}
 
-	vp = fr_cursor_talloc_iter_init(cursor, vps, _tmpl_cursor_next, vpt, VALUE_PAIR);
+	if (entry && tmpl_cache_valid(entry, vpt, vps)) {
+		fr_cursor_copy(cursor, &entry->cursor);
+		vp = fr_cursor_current(cursor);
+	} else {
+		vp = fr_cursor_talloc_iter_init(cursor, vps, _tmpl_cursor_next, vpt, VALUE_PAIR);
+		if (entry) {
+			*entry = (tmpl_cache_entry_t){
+				.vpt = vpt,
+				.type = vpt->type,
+				.da = tmpl_is_attr(vpt) ? tmpl_da(vpt) : NULL,
+				.num = tmpl_num(vpt),
+				.tag = tmpl_tag(vpt),
+				.vps = vps,
+				.head = *vps,
+				.generation = fr_cursor_generation
+			};
+			fr_cursor_copy(&entry->cursor, cursor);
+		}
+	}
 	if (!vp) {
 		if (err) {
 			*err = -1;
@@ -139,6 +139,10 @@ struct fr_trunk_connection_s {
 	 * @{
  	 */
 	fr_trunk_connection_event_t events;		//!< The current events we expect to be notified on.
+
+	uint32_t		max_req_per_conn;	//!< Overrides the trunk's max_req_per_conn if non-zero.
+
+	fr_time_t		batch_start;		//!< When the oldest pending request was enqueued.
 	/** @} */
 
 	/** @name Request lists
@@ -168,6 +172,8 @@ struct fr_trunk_connection_s {
 	 * @{
  	 */
   	fr_event_timer_t const	*lifetime_ev;		//!< Maximum time this connection can be open.
+
+	fr_event_timer_t const	*batch_ev;		//!< When to write the pending requests.
   	/** @} */
 };
 
@@ -268,6 +274,8 @@ struct fr_trunk_s {
 							///< (open/close) connections.
 
 	uint64_t		last_req_per_conn;	//!< The last request to connection ratio we calculated.
+
+	uint32_t		mux_sent;		//!< Requests sent by the current call to request_mux.
 	/** @} */
 };
 
@@ -275,6 +283,8 @@ static CONF_PARSER const fr_trunk_config_request[] = {
 	{ FR_CONF_OFFSET("per_connection_max", FR_TYPE_UINT32, fr_trunk_conf_t, max_req_per_conn), .dflt = "2000" },
 	{ FR_CONF_OFFSET("per_connection_target", FR_TYPE_UINT32, fr_trunk_conf_t, target_req_per_conn), .dflt = "1000" },
 	{ FR_CONF_OFFSET("free_delay", FR_TYPE_TIME_DELTA, fr_trunk_conf_t, req_cleanup_delay), .dflt = "10.0" },
+	{ FR_CONF_OFFSET("batch_max", FR_TYPE_UINT32, fr_trunk_conf_t, batch_max), .dflt = "0" },
+	{ FR_CONF_OFFSET("batch_delay", FR_TYPE_TIME_DELTA, fr_trunk_conf_t, batch_delay), .dflt = "0" },
 
 	CONF_PARSER_TERMINATOR
 };
@@ -720,6 +730,20 @@ static void trunk_manage(fr_trunk_t *trunk, fr_time_t now);
 static void _trunk_timer(fr_event_list_t *el, fr_time_t now, void *uctx);
 static void trunk_backlog_drain(fr_trunk_t *trunk);
 
+/** Return the maximum number of requests a connection can service
+ *
+ * @param[in] tconn	to return the limit for.
+ * @return
+ *	- 0 if there's no limit.
+ *	- The per-connection override if one was set, else max_req_per_conn.
+ */
+static inline uint32_t trunk_connection_max_req(fr_trunk_connection_t const *tconn)
+{
+	if (tconn->max_req_per_conn) return tconn->max_req_per_conn;
+
+	return tconn->pub.trunk->conf.max_req_per_conn;
+}
+
 /** Compare two protocol requests
  *
  * Allows protocol requests to be prioritised with a function
@@ -967,6 +991,11 @@ static void trunk_request_enter_pending(fr_trunk_request_t *treq, fr_trunk_conne
 
 	REQUEST_STATE_TRANSITION(FR_TRUNK_REQUEST_STATE_PENDING);
 	DEBUG3("[%" PRIu64 "] Trunk connection assigned request %"PRIu64, tconn->pub.conn->id, treq->id);
+
+	/*
+	 *	Start a new batch.
+	 */
+	if (fr_heap_num_elements(tconn->pending) == 0) tconn->batch_start = fr_time();
 	fr_heap_insert(tconn->pending, treq);
 
 	/*
@@ -1055,6 +1084,7 @@ static void trunk_request_enter_sent(fr_trunk_request_t *treq)
 	 *	Update the connection's sent stats
 	 */
 	tconn->sent_count++;
+	if (IN_REQUEST_MUX(trunk)) trunk->mux_sent++;
 
 	/*
 	 *	Enforces max_uses
@@ -2422,9 +2452,11 @@ fr_trunk_enqueue_t fr_trunk_request_enqueue_on_conn(fr_trunk_request_t **treq_ou
 	 *	Limits check
 	 */
 	if (!ignore_limits) {
-		if (trunk->conf.max_req_per_conn &&
+		uint32_t max = trunk_connection_max_req(tconn);
+
+		if (max &&
 		    (fr_trunk_request_count_by_connection(tconn, FR_TRUNK_REQUEST_STATE_ALL) >=
-		     trunk->conf.max_req_per_conn)) return FR_TRUNK_ENQUEUE_NO_CAPACITY;
+		     max)) return FR_TRUNK_ENQUEUE_NO_CAPACITY;
 
 		if (tconn->pub.state != FR_TRUNK_CONN_ACTIVE) return FR_TRUNK_ENQUEUE_NO_CAPACITY;
 	}
@@ -2564,7 +2596,7 @@ uint32_t fr_trunk_request_count_by_connection(fr_trunk_connection_t const *tconn
  */
 static inline void trunk_connection_auto_full(fr_trunk_connection_t *tconn)
 {
-	fr_trunk_t	*trunk = tconn->pub.trunk;
+	uint32_t	max = trunk_connection_max_req(tconn);
 	uint32_t	count;
 
 	if (tconn->pub.state != FR_TRUNK_CONN_ACTIVE) return;
@@ -2572,9 +2604,9 @@ static inline void trunk_connection_auto_full(fr_trunk_connection_t *tconn)
 	/*
 	 *	Enforces max_req_per_conn
 	 */
-	if (trunk->conf.max_req_per_conn > 0) {
+	if (max > 0) {
 		count = fr_trunk_request_count_by_connection(tconn, FR_TRUNK_REQUEST_STATE_ALL);
-		if (count >= trunk->conf.max_req_per_conn) trunk_connection_enter_full(tconn);
+		if (count >= max) trunk_connection_enter_full(tconn);
 	}
 }
 
@@ -2587,14 +2619,14 @@ static inline void trunk_connection_auto_full(fr_trunk_connection_t *tconn)
  */
 static inline bool trunk_connection_is_full(fr_trunk_connection_t *tconn)
 {
-	fr_trunk_t	*trunk = tconn->pub.trunk;
+	uint32_t	max = trunk_connection_max_req(tconn);
 	uint32_t	count;
 
 	/*
 	 *	Enforces max_req_per_conn
 	 */
 	count = fr_trunk_request_count_by_connection(tconn, FR_TRUNK_REQUEST_STATE_ALL);
-	if ((trunk->conf.max_req_per_conn == 0) || (count < trunk->conf.max_req_per_conn)) return false;
+	if ((max == 0) || (count < max)) return false;
 
 	return true;
 }
@@ -2623,6 +2655,69 @@ static inline void trunk_connection_readable(fr_trunk_connection_t *tconn)
 	DO_REQUEST_DEMUX(tconn);
 }
 
+/** Write the pending requests once the batch delay has passed
+ *
+ * @param[in] el	Event list the timer was inserted into.
+ * @param[in] now	Current time.
+ * @param[in] uctx	The tconn.
+ */
+static void _trunk_connection_batch_expire(UNUSED fr_event_list_t *el, UNUSED fr_time_t now, void *uctx)
+{
+	fr_trunk_connection_t	*tconn = talloc_get_type_abort(uctx, fr_trunk_connection_t);
+	fr_trunk_t		*trunk = tconn->pub.trunk;
+
+	if (trunk->conf.always_writable) {
+		trunk_connection_writable(tconn);
+		return;
+	}
+
+	/*
+	 *	Register for write events, request_mux
+	 *	will be called when the connection is
+	 *	writable.
+	 */
+	trunk_connection_event_update(tconn);
+}
+
+/** Check whether pending requests should be held, waiting for more to arrive
+ *
+ * Requests are held until batch_max are pending, or until the oldest
+ * one has waited batch_delay.  A timer is inserted to write them
+ * out when the delay expires.
+ *
+ * @param[in] tconn	to check.
+ * @return
+ *	- true if the pending requests should not be written yet.
+ *	- false if they should be written now.
+ */
+static bool trunk_connection_batch_hold(fr_trunk_connection_t *tconn)
+{
+	fr_trunk_t	*trunk = tconn->pub.trunk;
+	fr_time_t	when;
+
+	if (!trunk->conf.batch_delay || tconn->partial) goto release;
+
+	if (trunk->conf.batch_max &&
+	    ((uint32_t)fr_heap_num_elements(tconn->pending) >= trunk->conf.batch_max)) goto release;
+
+	when = tconn->batch_start + trunk->conf.batch_delay;
+	if (fr_time() >= when) goto release;
+
+	if (!tconn->batch_ev &&
+	    (fr_event_timer_at(tconn, trunk->el, &tconn->batch_ev, when,
+			       _trunk_connection_batch_expire, tconn) < 0)) {
+		PERROR("Failed inserting batch timer, writing requests immediately");
+		goto release;
+	}
+
+	return true;
+
+release:
+	if (tconn->batch_ev) fr_event_timer_delete(&tconn->batch_ev);
+
+	return false;
+}
+
 /** A connection is writable.  Call the request_mux function to write pending requests
  *
  */
@@ -2643,7 +2738,27 @@ static inline void trunk_connection_writable(fr_trunk_connection_t *tconn)
 	if (!fr_trunk_request_count_by_connection(tconn,
 						  FR_TRUNK_REQUEST_STATE_PENDING |
 						  FR_TRUNK_REQUEST_STATE_PARTIAL)) return;
+
+	if (trunk_connection_batch_hold(tconn)) return;
+
+	trunk->mux_sent = 0;
 	DO_REQUEST_MUX(tconn);
+
+	/*
+	 *	Record the batch size.  tconn may have
+	 *	been freed by the muxer, but the trunk
+	 *	is still valid.
+	 */
+	if (trunk->mux_sent > 0) {
+		uint32_t	sent = trunk->mux_sent;
+		unsigned int	bucket = 0;
+
+		trunk->pub.batch_count++;
+		trunk->pub.batch_requests += sent;
+
+		while ((sent >>= 1) && (bucket < (FR_TRUNK_BATCH_BUCKETS - 1))) bucket++;
+		trunk->pub.batch_size[bucket]++;
+	}
 }
 
 /** Update the registrations for I/O events we're interested in
@@ -2672,13 +2787,19 @@ static void trunk_connection_event_update(fr_trunk_connection_t *tconn)
 		 *	If the connection is always writable,
 		 *	then we don't care about write events.
 		 */
+		/*
+		 *	Pending requests which are being held
+		 *	for a batch don't need write events
+		 *	until the batch timer fires.
+		 */
 		if (!trunk->conf.always_writable &&
-		    fr_trunk_request_count_by_connection(tconn,
-							 FR_TRUNK_REQUEST_STATE_PARTIAL |
-						       	 FR_TRUNK_REQUEST_STATE_PENDING |
-							 (trunk->funcs.request_cancel_mux ?
-							 FR_TRUNK_REQUEST_STATE_CANCEL |
-							 FR_TRUNK_REQUEST_STATE_CANCEL_PARTIAL : 0)) > 0) {
+		    ((fr_trunk_request_count_by_connection(tconn,
+							   FR_TRUNK_REQUEST_STATE_PARTIAL |
+							   (trunk->funcs.request_cancel_mux ?
+							   FR_TRUNK_REQUEST_STATE_CANCEL |
+							   FR_TRUNK_REQUEST_STATE_CANCEL_PARTIAL : 0)) > 0) ||
+		     ((fr_trunk_request_count_by_connection(tconn, FR_TRUNK_REQUEST_STATE_PENDING) > 0) &&
+		      !trunk_connection_batch_hold(tconn)))) {
 			events |= FR_TRUNK_CONN_EVENT_WRITE;
 		}
 
@@ -3218,6 +3339,11 @@ static void _trunk_connection_on_closed(UNUSED fr_connection_t *conn,
 	 */
 	if (trunk->conf.lifetime > 0) fr_event_timer_delete(&tconn->lifetime_ev);
 
+	/*
+	 *	Remove the batch timer
+	 */
+	if (tconn->batch_ev) fr_event_timer_delete(&tconn->batch_ev);
+
 	/*
 	 *	Remove the I/O events
 	 */
@@ -3646,6 +3772,34 @@ void fr_trunk_connection_signal_active(fr_trunk_connection_t *tconn)
 	}
 }
 
+/** Change the maximum number of requests a connection can service
+ *
+ * Allows the API client to raise or lower the limit for connections
+ * which have negotiated different capabilities with the server, e.g.
+ * a larger identifier space.  The connection is marked as full, or
+ * no longer full, as necessary.
+ *
+ * @param[in] tconn	to change the limit of.
+ * @param[in] max	The new limit.  0 reverts to the trunk's max_req_per_conn.
+ */
+void fr_trunk_connection_max_req_set(fr_trunk_connection_t *tconn, uint32_t max)
+{
+	tconn->max_req_per_conn = max;
+
+	switch (tconn->pub.state) {
+	case FR_TRUNK_CONN_ACTIVE:
+		trunk_connection_auto_full(tconn);
+		break;
+
+	case FR_TRUNK_CONN_FULL:
+		trunk_connection_auto_unfull(tconn);
+		break;
+
+	default:
+		break;
+	}
+}
+
 /** Signal a trunk connection is no longer viable
  *
  * @param[in] tconn	to signal.
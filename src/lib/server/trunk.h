@@ -207,6 +207,13 @@ typedef struct {
 							///< Used to determine if we need to create new connections
 							///< and whether we can enqueue new requests.
 
+	uint32_t		batch_max;		//!< Write pending requests as soon as this many
+							///< are queued on a connection.  0 means no limit.
+
+	fr_time_delta_t		batch_delay;		//!< How long to hold pending requests, waiting for
+							///< more to write in the same batch.
+							///< 0 disables batching.
+
 	uint64_t		max_uses;		//!< The maximum time a connection can be used.
 
 	fr_time_delta_t		lifetime;		//!< Time between reconnects.
@@ -245,6 +252,11 @@ typedef struct {
 							//!< was a failure, instead of failing them immediately.
 } fr_trunk_conf_t;
 
+/** Number of buckets in the batch size histogram
+ *
+ */
+#define FR_TRUNK_BATCH_BUCKETS	8
+
 /** Public fields for the trunk
  *
  * This saves the overhead of using accessors for commonly used fields in
@@ -286,6 +298,16 @@ struct fr_trunk_pub_s {
 	uint64_t _CONST		req_alloc_new;		//!< How many requests we've allocated.
 
 	uint64_t _CONST		req_alloc_reused;	//!< How many requests were reused.
+
+	uint64_t _CONST		batch_count;		//!< How many calls to request_mux wrote requests.
+
+	uint64_t _CONST		batch_requests;		//!< How many requests were written by those calls.
+
+	uint64_t _CONST		batch_size[FR_TRUNK_BATCH_BUCKETS];	//!< Number of batches by size.
+									///< Bucket n counts batches of
+									///< 2^n to 2^(n+1) - 1 requests,
+									///< the last bucket counts larger
+									///< batches.
 	/** @} */
 
 	bool _CONST		triggers;		//!< do we run the triggers?
@@ -434,6 +456,12 @@ typedef void (*fr_trunk_connection_notify_t)(fr_trunk_connection_t *tconn, fr_co
  * After calling #fr_trunk_request_signal_partial this callback *MUST NOT*
  * call #fr_trunk_connection_pop_request again, and should immediately return.
  *
+ * If batch_delay is set in the trunk configuration, this callback is only called
+ * once batch_max requests are pending, or the oldest pending request has waited
+ * batch_delay.  The callback should write as many of the pending requests as it
+ * can in as few writes as possible. `fr_trunk_request_count_by_connection(tconn,
+ * FR_TRUNK_REQUEST_STATE_PENDING)` gives the size of the batch.
+ *
  * If the request can't be written to the connection because it the connection
  * has become unusable, this callback should call
  * `fr_connection_signal_reconnect(conn)` to notify the connection API that the
@@ -814,6 +842,8 @@ void		fr_trunk_connection_signal_active(fr_trunk_connection_t *tconn) CC_HINT(no
 void		fr_trunk_connection_signal_reconnect(fr_trunk_connection_t *tconn, fr_connection_reason_t reason) CC_HINT(nonnull);
 
 bool		fr_trunk_connection_in_state(fr_trunk_connection_t *tconn, int state);
+
+void		fr_trunk_connection_max_req_set(fr_trunk_connection_t *tconn, uint32_t max) CC_HINT(nonnull);
 /** @} */
 
 /** @name Connection management
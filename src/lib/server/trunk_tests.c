@@ -1828,6 +1828,83 @@ static void test_enqueue_and_io_speed(void)
 	talloc_free(ctx);
 }
 
+static void test_enqueue_batch_requests(fr_trunk_t *trunk, size_t requests)
+{
+	size_t i;
+
+	for (i = 0; i < requests; i++) {
+		fr_trunk_request_t	*treq;
+		test_proto_request_t	*preq;
+
+		treq = fr_trunk_request_alloc(trunk, NULL);
+		preq = talloc_zero(treq, test_proto_request_t);
+		preq->treq = treq;
+		fr_trunk_request_enqueue(&treq, trunk, NULL, preq, NULL);
+	}
+}
+
+static void test_enqueue_batch(void)
+{
+	TALLOC_CTX		*ctx = talloc_init_const("test");
+	fr_trunk_t		*trunk;
+	fr_event_list_t		*el;
+	fr_trunk_conf_t		conf = {
+					.start = 1,
+					.min = 1,
+					.batch_max = 4,
+					.batch_delay = NSEC * 1,
+					.manage_interval = NSEC * 0.5
+				};
+	test_proto_stats_t	stats;
+
+	DEBUG_LVL_SET;
+
+	el = fr_event_list_alloc(ctx, NULL, NULL);
+	fr_event_list_set_time_func(el, test_time);
+
+	test_time_base += NSEC * 0.5;	/* Need to provide a timer starting value above zero */
+
+	memset(&stats, 0, sizeof(stats));
+	trunk = test_setup_trunk(ctx, el, &conf, false, &stats);
+
+	/*
+	 *	Open the connection
+	 */
+	fr_event_corral(el, test_time_base, false);
+	fr_event_service(el);
+
+	TEST_CHECK(fr_trunk_connection_count_by_state(trunk, FR_TRUNK_CONN_ACTIVE) == 1);
+
+	TEST_CASE("Requests below batch_max are held");
+	test_enqueue_batch_requests(trunk, 2);
+
+	while (fr_event_corral(el, test_time_base, false)) fr_event_service(el);
+
+	TEST_CHECK(fr_trunk_request_count_by_state(trunk, FR_TRUNK_CONN_ALL, FR_TRUNK_REQUEST_STATE_PENDING) == 2);
+	TEST_CHECK(trunk->pub.batch_count == 0);
+
+	TEST_CASE("Held requests are written after batch_delay");
+	test_time_base += NSEC * 1.5;
+
+	while (fr_event_corral(el, test_time_base, false)) fr_event_service(el);
+
+	TEST_CHECK(stats.completed == 2);
+	TEST_CHECK(trunk->pub.batch_count == 1);
+	TEST_CHECK(trunk->pub.batch_size[1] == 1);	/* 2-3 requests */
+
+	TEST_CASE("Requests are written as soon as batch_max is reached");
+	test_enqueue_batch_requests(trunk, 4);
+
+	while (fr_event_corral(el, test_time_base, false)) fr_event_service(el);
+
+	TEST_CHECK(stats.completed == 6);
+	TEST_CHECK(trunk->pub.batch_count == 2);
+	TEST_CHECK(trunk->pub.batch_requests == 6);
+	TEST_CHECK(trunk->pub.batch_size[2] == 1);	/* 4-7 requests */
+
+	talloc_free(ctx);
+}
+
 /*
  *	Connection spawning
  */
@@ -1851,6 +1928,7 @@ TEST_LIST = {
 	{ "Enqueue - Cancellation points",		test_enqueue_cancellation_points },
 	{ "Enqueue - Partial state transitions",	test_partial_to_complete_states },
 	{ "Requeue - On reconnect",			test_requeue_on_reconnect },
+	{ "Enqueue - Batching",				test_enqueue_batch },
 
 	/*
 	 *	Rebalance
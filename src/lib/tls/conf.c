@@ -77,6 +77,10 @@ static CONF_PARSER cache_config[] = {
 	{ FR_CONF_OFFSET("require_perfect_forward_secrecy", FR_TYPE_BOOL, fr_tls_conf_t, session_cache_require_pfs), .dflt = "no" },
 #endif
 
+	{ FR_CONF_OFFSET("tickets", FR_TYPE_BOOL, fr_tls_conf_t, session_ticket), .dflt = "no" },
+	{ FR_CONF_OFFSET("ticket_key_file", FR_TYPE_FILE_INPUT, fr_tls_conf_t, session_ticket_key_file) },
+	{ FR_CONF_OFFSET("ticket_key_rotation", FR_TYPE_UINT32, fr_tls_conf_t, session_ticket_key_rotation), .dflt = "0" },
+
 	{ FR_CONF_DEPRECATED("enable", FR_TYPE_BOOL, fr_tls_conf_t, NULL) },
 	{ FR_CONF_DEPRECATED("max_entries", FR_TYPE_UINT32, fr_tls_conf_t, NULL) },
 	{ FR_CONF_DEPRECATED("persist_dir", FR_TYPE_STRING, fr_tls_conf_t, NULL) },
@@ -84,6 +88,12 @@ static CONF_PARSER cache_config[] = {
 	CONF_PARSER_TERMINATOR
 };
 
+static CONF_PARSER offload_config[] = {
+	{ FR_CONF_OFFSET("threads", FR_TYPE_UINT32, fr_tls_offload_conf_t, threads), .dflt = "0" },
+	{ FR_CONF_OFFSET("max_queued", FR_TYPE_UINT32, fr_tls_offload_conf_t, max_queued), .dflt = "1024" },
+	CONF_PARSER_TERMINATOR
+};
+
 static CONF_PARSER verify_config[] = {
 	{ FR_CONF_OFFSET("tmpdir", FR_TYPE_STRING, fr_tls_conf_t, verify_tmp_dir) },
 	{ FR_CONF_OFFSET("client", FR_TYPE_STRING, fr_tls_conf_t, verify_client_cert_cmd) },
@@ -91,6 +101,12 @@ static CONF_PARSER verify_config[] = {
 };
 
 #ifdef HAVE_OPENSSL_OCSP_H
+static CONF_PARSER ocsp_response_cache_config[] = {
+	{ FR_CONF_OFFSET("max_entries", FR_TYPE_UINT32, fr_tls_ocsp_conf_t, cache_max_entries), .dflt = "0" },
+	{ FR_CONF_OFFSET("refresh", FR_TYPE_UINT32, fr_tls_ocsp_conf_t, cache_refresh), .dflt = "60" },
+	CONF_PARSER_TERMINATOR
+};
+
 static CONF_PARSER ocsp_config[] = {
 	{ FR_CONF_OFFSET("enable", FR_TYPE_BOOL, fr_tls_ocsp_conf_t, enable), .dflt = "no" },
 
@@ -102,6 +118,8 @@ static CONF_PARSER ocsp_config[] = {
 	{ FR_CONF_OFFSET("timeout", FR_TYPE_UINT32, fr_tls_ocsp_conf_t, timeout), .dflt = "yes" },
 	{ FR_CONF_OFFSET("softfail", FR_TYPE_BOOL, fr_tls_ocsp_conf_t, softfail), .dflt = "no" },
 
+	{ FR_CONF_POINTER("response_cache", FR_TYPE_SUBSECTION, NULL), .subcs = (void const *) ocsp_response_cache_config },
+
 	CONF_PARSER_TERMINATOR
 };
 #endif
@@ -168,6 +186,8 @@ CONF_PARSER fr_tls_server_config[] = {
 
 	{ FR_CONF_POINTER("verify", FR_TYPE_SUBSECTION, NULL), .subcs = (void const *) verify_config },
 
+	{ FR_CONF_OFFSET("private_key_offload", FR_TYPE_SUBSECTION, fr_tls_conf_t, offload), .subcs = (void const *) offload_config },
+
 #ifdef HAVE_OPENSSL_OCSP_H
 	{ FR_CONF_OFFSET("ocsp", FR_TYPE_SUBSECTION, fr_tls_conf_t, ocsp), .subcs = (void const *) ocsp_config },
 
@@ -435,6 +455,18 @@ fr_tls_conf_t *fr_tls_conf_parse_server(CONF_SECTION *cs)
 	conf->ctx_count = fr_tls_max_threads * 2; /* Reduce contention */
 	if (!conf->ctx_count) conf->ctx_count = 1;
 
+	/*
+	 *	Ticket keys must be shared by all contexts so
+	 *	that any worker can resume any session.
+	 */
+	if (conf->session_ticket && (fr_tls_ticket_keys_alloc(conf) < 0)) goto error;
+
+	/*
+	 *	Likewise all contexts share one private key
+	 *	offload pool.
+	 */
+	if (fr_tls_offload_alloc(conf, cs) < 0) goto error;
+
 	/*
 	 *	Initialize TLS
 	 */
@@ -458,11 +490,13 @@ fr_tls_conf_t *fr_tls_conf_parse_server(CONF_SECTION *cs)
 	if (conf->ocsp.enable) {
 		conf->ocsp.store = conf_ocsp_revocation_store(conf);
 		if (conf->ocsp.store == NULL) goto error;
+		if (fr_tls_ocsp_cache_alloc(conf, &conf->ocsp) < 0) goto error;
 	}
 
 	if (conf->staple.enable) {
 		conf->staple.store = conf_ocsp_revocation_store(conf);
 		if (conf->staple.store == NULL) goto error;
+		if (fr_tls_ocsp_cache_alloc(conf, &conf->staple) < 0) goto error;
 	}
 #endif /*HAVE_OPENSSL_OCSP_H*/
 
@@ -845,6 +845,16 @@ post_ca:
 	 *	Setup session caching
 	 */
 	fr_tls_cache_init(ctx, conf->session_cache_server ? true : false, conf->session_cache_lifetime);
+	if (!client && conf->session_ticket) fr_tls_ticket_init(ctx, conf);
+
+	/*
+	 *	Wrap private keys so operations using them
+	 *	are performed by the offload pool.
+	 */
+	if (!client && (fr_tls_offload_ctx_init(ctx, conf) < 0)) {
+		SSL_CTX_free(ctx);
+		return NULL;
+	}
 
 	return ctx;
 }
@@ -37,6 +37,10 @@ USES_APPLE_DEPRECATED_API	/* OpenSSL API has been deprecated by Apple */
 
 #include <freeradius-devel/unlang/compile.h>
 
+#include <freeradius-devel/util/dlist.h>
+#include <freeradius-devel/util/rbtree.h>
+#include <freeradius-devel/util/syserror.h>
+
 #include <openssl/ocsp.h>
 
 #include "attrs.h"
@@ -57,6 +61,58 @@ typedef enum {
  */
 #define OCSP_MAX_VALIDITY_PERIOD (5 * 60)
 
+/** Minimum interval between attempts to refresh a cached response
+ *
+ */
+#define OCSP_CACHE_REFRESH_RETRY (5)
+
+/** A cached OCSP response
+ *
+ * Entries are shared between all workers, and must only be accessed
+ * with the cache mutex held.
+ */
+typedef struct {
+	fr_dlist_t		lru;			//!< Entry in the LRU list.  Head is most recently used.
+	fr_dlist_t		queued;			//!< Entry in the refresh queue.
+
+	uint8_t			*key;			//!< DER encoded OCSP_CERTID (issuer and serial).
+	size_t			key_len;
+
+	uint8_t			*resp;			//!< DER encoded OCSP_RESPONSE.
+	size_t			resp_len;
+	int			status;			//!< V_OCSP_CERTSTATUS_* for the certificate.
+	time_t			expires;		//!< When the response must no longer be used.
+	time_t			retry;			//!< Don't queue another refresh before this time.
+
+	X509			*cert;			//!< Certificate the response is for.
+	X509			*issuer;		//!< Issuer of the certificate.
+	X509_STORE		*store;			//!< Used to verify refreshed responses.
+	char			*host;			//!< Responder the response was retrieved from.
+	char			*port;
+	char			*path;
+} ocsp_cache_entry_t;
+
+/** Shared cache of OCSP responses
+ *
+ */
+struct fr_tls_ocsp_cache_s {
+	pthread_mutex_t		mutex;
+	pthread_cond_t		cond;
+
+	rbtree_t		*tree;			//!< Entries keyed by OCSP_CERTID.
+	fr_dlist_head_t		lru;			//!< Entries in order of use.
+	fr_dlist_head_t		queue;			//!< Entries waiting to be refreshed.
+
+	fr_tls_ocsp_conf_t const *conf;			//!< OCSP configuration the cache belongs to.
+
+	pthread_t		thread;			//!< Refreshes responses in the background.
+	bool			running;		//!< Whether the refresh thread has been started.
+	bool			stop;			//!< Tell the refresh thread to exit.
+};
+
+static OCSP_RESPONSE *ocsp_fetch(char const *host, char const *port, char const *path,
+				 OCSP_REQUEST *req, uint32_t timeout);
+
 /** Extract components of OCSP responser URL from a certificate
  *
  * @param[in] cert to extract URL from.
@@ -91,6 +147,409 @@ static int ocsp_cert_url_parse(X509 *cert, char **host_out, char **port_out, cha
 	return found_uri ? -1 : 0;
 }
 
+/** Compare two cache entries by their DER encoded OCSP_CERTID
+ *
+ */
+static int ocsp_cache_cmp(void const *one, void const *two)
+{
+	ocsp_cache_entry_t const *a = one, *b = two;
+
+	if (a->key_len != b->key_len) return (a->key_len > b->key_len) - (a->key_len < b->key_len);
+
+	return memcmp(a->key, b->key, a->key_len);
+}
+
+static int _ocsp_cache_entry_free(ocsp_cache_entry_t *entry)
+{
+	OPENSSL_free(entry->resp);
+	X509_free(entry->cert);
+	X509_free(entry->issuer);
+	X509_STORE_free(entry->store);
+
+	return 0;
+}
+
+/** Remove an entry from the cache and free it
+ *
+ * @note Must be called with the cache mutex held.
+ */
+static void ocsp_cache_entry_delete(fr_tls_ocsp_cache_t *cache, ocsp_cache_entry_t *entry)
+{
+	fr_dlist_remove(&cache->lru, entry);
+	fr_dlist_remove(&cache->queue, entry);
+	rbtree_deletebydata(cache->tree, entry);
+}
+
+/** Determine when a response must no longer be used
+ *
+ * If the responder provided nextUpdate we use that, otherwise newer
+ * information is always available, and we only keep the response for
+ * the maximum validity period.
+ */
+static int ocsp_cache_expires(time_t *out, ASN1_GENERALIZEDTIME *this_update, ASN1_GENERALIZEDTIME *next_update)
+{
+	if (next_update) return fr_tls_utils_asn1time_to_epoch(out, next_update);
+
+	if (fr_tls_utils_asn1time_to_epoch(out, this_update) < 0) return -1;
+	*out += OCSP_MAX_VALIDITY_PERIOD;
+
+	return 0;
+}
+
+/** Add or update a response in the cache
+ *
+ * @note Must be called with the cache mutex held.
+ */
+static void ocsp_cache_update(fr_tls_ocsp_cache_t *cache, uint8_t const *key, size_t key_len,
+			      OCSP_RESPONSE *resp, int status, time_t expires,
+			      X509 *cert, X509 *issuer, X509_STORE *store,
+			      char const *host, char const *port, char const *path)
+{
+	ocsp_cache_entry_t	*entry, find;
+	uint8_t			*der = NULL;
+	int			der_len;
+
+	der_len = i2d_OCSP_RESPONSE(resp, &der);
+	if (der_len <= 0) return;
+
+	memcpy(&find.key, &key, sizeof(find.key));
+	find.key_len = key_len;
+
+	entry = rbtree_finddata(cache->tree, &find);
+	if (!entry) {
+		/*
+		 *	Make space by evicting the least recently
+		 *	used entry.
+		 */
+		if (rbtree_num_elements(cache->tree) >= cache->conf->cache_max_entries) {
+			ocsp_cache_entry_t *lru = fr_dlist_tail(&cache->lru);
+
+			if (lru) ocsp_cache_entry_delete(cache, lru);
+		}
+
+		MEM(entry = talloc_zero(cache, ocsp_cache_entry_t));
+		fr_dlist_entry_init(&entry->lru);
+		fr_dlist_entry_init(&entry->queued);
+		MEM(entry->key = talloc_memdup(entry, key, key_len));
+		entry->key_len = key_len;
+		talloc_set_destructor(entry, _ocsp_cache_entry_free);
+
+		if (!rbtree_insert(cache->tree, entry)) {
+			talloc_free(entry);
+			OPENSSL_free(der);
+			return;
+		}
+	} else {
+		OPENSSL_free(entry->resp);
+		X509_free(entry->cert);
+		X509_free(entry->issuer);
+		X509_STORE_free(entry->store);
+		TALLOC_FREE(entry->host);
+		TALLOC_FREE(entry->port);
+		TALLOC_FREE(entry->path);
+		fr_dlist_remove(&cache->lru, entry);
+	}
+
+	entry->resp = der;
+	entry->resp_len = der_len;
+	entry->status = status;
+	entry->expires = expires;
+
+	X509_up_ref(cert);
+	entry->cert = cert;
+	X509_up_ref(issuer);
+	entry->issuer = issuer;
+	X509_STORE_up_ref(store);
+	entry->store = store;
+	MEM(entry->host = talloc_strdup(entry, host));
+	MEM(entry->port = talloc_strdup(entry, port));
+	MEM(entry->path = talloc_strdup(entry, path));
+
+	fr_dlist_insert_head(&cache->lru, entry);
+}
+
+/** Verify a response retrieved by the refresh thread, and add it to the cache
+ *
+ */
+static void ocsp_cache_refresh(fr_tls_ocsp_cache_t *cache, uint8_t const *key, size_t key_len,
+			       X509 *cert, X509 *issuer, X509_STORE *store,
+			       char const *host, char const *port, char const *path)
+{
+	OCSP_CERTID		*certid;
+	OCSP_REQUEST		*req;
+	OCSP_RESPONSE		*resp = NULL;
+	OCSP_BASICRESP		*bresp = NULL;
+	ASN1_GENERALIZEDTIME	*rev, *this_update, *next_update;
+	int			status, reason;
+	time_t			expires;
+
+	MEM(certid = OCSP_cert_to_id(NULL, cert, issuer));
+	MEM(req = OCSP_REQUEST_new());
+	OCSP_request_add0_id(req, certid);
+	if (cache->conf->use_nonce) OCSP_request_add1_nonce(req, NULL, 8);
+
+	resp = ocsp_fetch(host, port, path, req, cache->conf->timeout);
+	if (!resp) {
+		PERROR("Failed refreshing OCSP response from http://%s:%s%s", host, port, path);
+		goto finish;
+	}
+
+	if (OCSP_response_status(resp) != OCSP_RESPONSE_STATUS_SUCCESSFUL) {
+		ERROR("Failed refreshing OCSP response: %s",
+		      OCSP_response_status_str(OCSP_response_status(resp)));
+		goto finish;
+	}
+
+	bresp = OCSP_response_get1_basic(resp);
+	if (!bresp ||
+	    (cache->conf->use_nonce && (OCSP_check_nonce(req, bresp) != 1)) ||
+	    (OCSP_basic_verify(bresp, NULL, store, 0) != 1) ||
+	    !OCSP_resp_find_status(bresp, certid, &status, &reason, &rev, &this_update, &next_update) ||
+	    !OCSP_check_validity(this_update, next_update, OCSP_MAX_VALIDITY_PERIOD, -1) ||
+	    (ocsp_cache_expires(&expires, this_update, next_update) < 0)) {
+		fr_tls_log_error(NULL, "Failed verifying refreshed OCSP response");
+		goto finish;
+	}
+
+	DEBUG2("Refreshed OCSP response from http://%s:%s%s, cert status: %s",
+	       host, port, path, OCSP_cert_status_str(status));
+
+	pthread_mutex_lock(&cache->mutex);
+	ocsp_cache_update(cache, key, key_len, resp, status, expires, cert, issuer, store, host, port, path);
+	pthread_mutex_unlock(&cache->mutex);
+
+finish:
+	OCSP_REQUEST_free(req);
+	OCSP_BASICRESP_free(bresp);
+	OCSP_RESPONSE_free(resp);
+}
+
+/** Refresh responses which are close to expiring
+ *
+ * Runs in its own thread so that workers never wait on the responder
+ * for responses which are already cached.
+ */
+static void *ocsp_cache_refresh_thread(void *arg)
+{
+	fr_tls_ocsp_cache_t	*cache = arg;
+	ocsp_cache_entry_t	*entry;
+
+	pthread_mutex_lock(&cache->mutex);
+	for (;;) {
+		uint8_t		*key;
+		size_t		key_len;
+		X509		*cert, *issuer;
+		X509_STORE	*store;
+		char		*host, *port, *path;
+
+		while (fr_dlist_empty(&cache->queue) && !cache->stop) pthread_cond_wait(&cache->cond, &cache->mutex);
+		if (cache->stop) break;
+
+		/*
+		 *	Take our own copies of everything we need, as
+		 *	the entry may be evicted while we're waiting
+		 *	for the responder.
+		 */
+		entry = fr_dlist_head(&cache->queue);
+		fr_dlist_remove(&cache->queue, entry);
+
+		key_len = entry->key_len;
+		MEM(key = malloc(key_len));
+		memcpy(key, entry->key, key_len);
+		X509_up_ref(cert = entry->cert);
+		X509_up_ref(issuer = entry->issuer);
+		X509_STORE_up_ref(store = entry->store);
+		MEM(host = strdup(entry->host));
+		MEM(port = strdup(entry->port));
+		MEM(path = strdup(entry->path));
+		pthread_mutex_unlock(&cache->mutex);
+
+		ocsp_cache_refresh(cache, key, key_len, cert, issuer, store, host, port, path);
+
+		free(key);
+		X509_free(cert);
+		X509_free(issuer);
+		X509_STORE_free(store);
+		free(host);
+		free(port);
+		free(path);
+
+		pthread_mutex_lock(&cache->mutex);
+	}
+	pthread_mutex_unlock(&cache->mutex);
+
+	return NULL;
+}
+
+/** Retrieve a response from the cache
+ *
+ * If the response is close to expiring, it's queued to be refreshed
+ * in the background.
+ *
+ * @param[in] request	The current request.
+ * @param[in] cache	to search in.
+ * @param[in] certid	of the certificate being checked.
+ * @param[out] resp	The cached response.
+ * @param[out] status	V_OCSP_CERTSTATUS_* value from the response.
+ * @param[out] expires	When the response expires.
+ * @return
+ *	- 1 if a valid response was found.
+ *	- 0 if no valid response was found.
+ */
+static int ocsp_cache_lookup(REQUEST *request, fr_tls_ocsp_cache_t *cache, OCSP_CERTID *certid,
+			     OCSP_RESPONSE **resp, int *status, time_t *expires)
+{
+	ocsp_cache_entry_t	*entry, find = { .key = NULL };
+	uint8_t const		*p;
+	int			key_len;
+	time_t			now;
+
+	key_len = i2d_OCSP_CERTID(certid, &find.key);
+	if (key_len <= 0) return 0;
+	find.key_len = key_len;
+
+	now = fr_time_to_sec(fr_time());
+
+	pthread_mutex_lock(&cache->mutex);
+	entry = rbtree_finddata(cache->tree, &find);
+	OPENSSL_free(find.key);
+
+	if (!entry) {
+		pthread_mutex_unlock(&cache->mutex);
+		RDEBUG2("No cached OCSP response found");
+		return 0;
+	}
+
+	if (entry->expires <= now) {
+		RDEBUG2("Cached OCSP response expired %"PRId64" seconds ago", (int64_t)(now - entry->expires));
+		ocsp_cache_entry_delete(cache, entry);
+		pthread_mutex_unlock(&cache->mutex);
+		return 0;
+	}
+
+	p = entry->resp;
+	*resp = d2i_OCSP_RESPONSE(NULL, &p, entry->resp_len);
+	if (!*resp) {
+		ocsp_cache_entry_delete(cache, entry);
+		pthread_mutex_unlock(&cache->mutex);
+		return 0;
+	}
+	*status = entry->status;
+	*expires = entry->expires;
+
+	fr_dlist_remove(&cache->lru, entry);
+	fr_dlist_insert_head(&cache->lru, entry);
+
+	/*
+	 *	Refresh before the response expires, so that
+	 *	requests never have to wait for the responder.
+	 */
+	if (((entry->expires - now) <= (time_t)cache->conf->cache_refresh) &&
+	    (entry->retry <= now) && !fr_dlist_entry_in_list(&entry->queued)) {
+		RDEBUG2("Cached OCSP response expires in %"PRId64" seconds, queuing refresh",
+			(int64_t)(entry->expires - now));
+
+		if (!cache->running) {
+			int ret;
+
+			ret = pthread_create(&cache->thread, NULL, ocsp_cache_refresh_thread, cache);
+			if (ret != 0) {
+				RERROR("Failed starting OCSP refresh thread: %s", fr_syserror(ret));
+			} else {
+				cache->running = true;
+			}
+		}
+		if (cache->running) {
+			entry->retry = now + OCSP_CACHE_REFRESH_RETRY;
+			fr_dlist_insert_tail(&cache->queue, entry);
+			pthread_cond_signal(&cache->cond);
+		}
+	}
+	pthread_mutex_unlock(&cache->mutex);
+
+	return 1;
+}
+
+/** Add a response retrieved during a request to the cache
+ *
+ */
+static void ocsp_cache_store(fr_tls_ocsp_cache_t *cache, OCSP_CERTID *certid,
+			     OCSP_RESPONSE *resp, int status, time_t expires,
+			     X509 *cert, X509 *issuer, X509_STORE *store,
+			     char const *host, char const *port, char const *path)
+{
+	uint8_t	*key = NULL;
+	int	key_len;
+
+	key_len = i2d_OCSP_CERTID(certid, &key);
+	if (key_len <= 0) return;
+
+	pthread_mutex_lock(&cache->mutex);
+	ocsp_cache_update(cache, key, key_len, resp, status, expires, cert, issuer, store, host, port, path);
+	pthread_mutex_unlock(&cache->mutex);
+
+	OPENSSL_free(key);
+}
+
+static int _ocsp_cache_free(fr_tls_ocsp_cache_t *cache)
+{
+	pthread_mutex_lock(&cache->mutex);
+	cache->stop = true;
+	pthread_cond_signal(&cache->cond);
+	pthread_mutex_unlock(&cache->mutex);
+
+	if (cache->running) pthread_join(cache->thread, NULL);
+
+	/*
+	 *	Entries reference the lists in the cache
+	 *	so must be freed first.
+	 */
+	TALLOC_FREE(cache->tree);
+
+	pthread_cond_destroy(&cache->cond);
+	pthread_mutex_destroy(&cache->mutex);
+
+	return 0;
+}
+
+/** Allocate a shared cache for OCSP responses
+ *
+ * The refresh thread isn't started until a response needs refreshing,
+ * so that it's created after the server has finished daemonizing.
+ *
+ * @param[in] ctx	to allocate the cache in.
+ * @param[in] conf	OCSP configuration.  Does nothing if the cache
+ *			is disabled.
+ * @return
+ *	- 0 on success.
+ *	- -1 on failure.
+ */
+int fr_tls_ocsp_cache_alloc(TALLOC_CTX *ctx, fr_tls_ocsp_conf_t *conf)
+{
+	fr_tls_ocsp_cache_t *cache;
+
+	if (!conf->cache_max_entries) return 0;
+
+	MEM(cache = talloc_zero(ctx, fr_tls_ocsp_cache_t));
+	cache->conf = conf;
+	cache->tree = rbtree_talloc_alloc(cache, ocsp_cache_cmp, ocsp_cache_entry_t,
+					  rbtree_node_talloc_free, RBTREE_FLAG_NONE);
+	if (!cache->tree) {
+		ERROR("Failed allocating OCSP response cache");
+		talloc_free(cache);
+		return -1;
+	}
+	fr_dlist_talloc_init(&cache->lru, ocsp_cache_entry_t, lru);
+	fr_dlist_talloc_init(&cache->queue, ocsp_cache_entry_t, queued);
+	pthread_mutex_init(&cache->mutex, NULL);
+	pthread_cond_init(&cache->cond, NULL);
+	talloc_set_destructor(cache, _ocsp_cache_free);
+
+	conf->mem_cache = cache;
+
+	return 0;
+}
+
 /** Set the OCSP TLS stapling extension for a SSL session, from cached response data
  *
  * @param ssl		The current SSL session.
@@ -326,6 +785,91 @@ int fr_tls_ocsp_staple_cb(SSL *ssl, void *data)
 	return ret;
 }
 
+/** Send an OCSP request to a responder and wait for the response
+ *
+ * @param[in] host	of the responder.
+ * @param[in] port	of the responder.
+ * @param[in] path	to send the request to.
+ * @param[in] req	to send.
+ * @param[in] timeout	How long to wait for the response.  0 waits indefinitely.
+ * @return
+ *	- The response on success.
+ *	- NULL on failure.
+ */
+static OCSP_RESPONSE *ocsp_fetch(char const *host, char const *port, char const *path,
+				 OCSP_REQUEST *req, uint32_t timeout)
+{
+	OCSP_REQ_CTX	*ctx = NULL;
+	OCSP_RESPONSE	*resp = NULL;
+	BIO		*conn;
+	char		host_header[1024];
+	fr_time_t	start;
+	int		rc;
+
+	/* Check host and port length are sane, then create Host: HTTP header */
+	if ((strlen(host) + strlen(port) + 2) > sizeof(host_header)) {
+		fr_strerror_printf("Host and port too long");
+		return NULL;
+	}
+	snprintf(host_header, sizeof(host_header), "%s:%s", host, port);
+
+	/* Setup BIO socket to OCSP responder */
+	conn = BIO_new_connect(host);
+	if (!conn) {
+		fr_strerror_printf("Failed allocating connection");
+		return NULL;
+	}
+	BIO_set_conn_port(conn, port);
+
+	if (timeout) BIO_set_nbio(conn, 1);
+
+	rc = BIO_do_connect(conn);
+	if ((rc <= 0) && ((!timeout) || !BIO_should_retry(conn))) {
+		fr_strerror_printf("Couldn't connect to OCSP responder");
+		goto finish;
+	}
+
+	ctx = OCSP_sendreq_new(conn, path, NULL, -1);
+	if (!ctx) {
+		fr_strerror_printf("Couldn't create OCSP request");
+		goto finish;
+	}
+
+	if (!OCSP_REQ_CTX_add1_header(ctx, "Host", host_header)) {
+		fr_strerror_printf("Couldn't set Host header");
+		goto finish;
+	}
+
+	if (!OCSP_REQ_CTX_set1_req(ctx, req)) {
+		fr_strerror_printf("Couldn't add data to OCSP request");
+		goto finish;
+	}
+
+	start = fr_time();
+	do {
+		rc = OCSP_sendreq_nbio(&resp, ctx);
+		if (timeout && ((fr_time() - start) > fr_time_delta_from_sec(timeout))) break;
+	} while ((rc == -1) && BIO_should_retry(conn));
+
+	if (timeout && (rc == -1) && BIO_should_retry(conn)) {
+		fr_strerror_printf("Response timed out");
+		goto finish;
+	}
+
+	if (rc == 0) fr_strerror_printf("Couldn't get OCSP response");
+
+finish:
+	OCSP_REQ_CTX_free(ctx);
+	BIO_free_all(conn);
+
+	if (rc != 1) {
+		OCSP_RESPONSE_free(resp);
+		return NULL;
+	}
+
+	return resp;
+}
+
 /** Sends a OCSP request to a defined OCSP responder
  *
  */
@@ -340,18 +884,16 @@ int fr_tls_ocsp_check(REQUEST *request, SSL *ssl,
 	char		*host = NULL;
 	char		*port = NULL;
 	char		*path = NULL;
-	char		host_header[1024];
 	int		use_ssl = -1;
 	long		this_fudge = OCSP_MAX_VALIDITY_PERIOD, this_max_age = -1;
-	BIO		*conn = NULL, *ssl_log = NULL;
+	BIO		*ssl_log = NULL;
 	ocsp_status_t   ocsp_status = OCSP_STATUS_FAILED;
 	ocsp_status_t	status;
 	ASN1_GENERALIZEDTIME *rev, *this_update, *next_update;
 	int		reason;
-	OCSP_REQ_CTX	*ctx;
-	int		rc;
+	int		cached_status;
+	time_t		expires;
 
-	fr_time_t	start;
 	VALUE_PAIR	*vp;
 
 	if (conf->cache_server) switch (fr_tls_cache_process(request, conf->cache.load)) {
@@ -432,6 +974,31 @@ int fr_tls_ocsp_check(REQUEST *request, SSL *ssl,
 	 *	Create OCSP Request
 	 */
 	certid = OCSP_cert_to_id(NULL, client_cert, issuer_cert);
+
+	/*
+	 *	Use a response from the shared cache if we have
+	 *	one, so we don't have to wait for the responder.
+	 */
+	if (certid && conf->mem_cache &&
+	    ocsp_cache_lookup(request, conf->mem_cache, certid, &resp, &cached_status, &expires)) {
+		OCSP_CERTID_free(certid);
+
+		RDEBUG2("Using cached OCSP response");
+		MEM(pair_update_request(&vp, attr_tls_ocsp_next_update) >= 0);
+		vp->vp_uint32 = expires - fr_time_to_sec(fr_time());
+		RINDENT();
+		RDEBUG2("&%pP", vp);
+		REXDENT();
+
+		if (cached_status == V_OCSP_CERTSTATUS_GOOD) {
+			RDEBUG2("Cert status: good");
+			ocsp_status = OCSP_STATUS_OK;
+		} else {
+			REDEBUG("Cert status: %s", OCSP_cert_status_str(cached_status));
+		}
+		goto finish;
+	}
+
 	req = OCSP_REQUEST_new();
 	OCSP_request_add0_id(req, certid);
 	if (conf->use_nonce) OCSP_request_add1_nonce(req, NULL, 8);
@@ -477,63 +1044,9 @@ int fr_tls_ocsp_check(REQUEST *request, SSL *ssl,
 
 	RDEBUG2("Using responder URL \"http://%s:%s%s\"", host, port, path);
 
-	/* Check host and port length are sane, then create Host: HTTP header */
-	if ((strlen(host) + strlen(port) + 2) > sizeof(host_header)) {
-		RWDEBUG("Host and port too long");
-		goto skipped;
-	}
-	snprintf(host_header, sizeof(host_header), "%s:%s", host, port);
-
-	/* Setup BIO socket to OCSP responder */
-	conn = BIO_new_connect(host);
-	BIO_set_conn_port(conn, port);
-
-	if (conf->timeout) BIO_set_nbio(conn, 1);
-
-	rc = BIO_do_connect(conn);
-	if ((rc <= 0) && ((!conf->timeout) || !BIO_should_retry(conn))) {
-		REDEBUG("Couldn't connect to OCSP responder");
-		ocsp_status = OCSP_STATUS_SKIPPED;
-		goto finish;
-	}
-
-	ctx = OCSP_sendreq_new(conn, path, NULL, -1);
-	if (!ctx) {
-		REDEBUG("Couldn't create OCSP request");
-		ocsp_status = OCSP_STATUS_SKIPPED;
-		goto finish;
-	}
-
-	if (!OCSP_REQ_CTX_add1_header(ctx, "Host", host_header)) {
-		REDEBUG("Couldn't set Host header");
-		ocsp_status = OCSP_STATUS_SKIPPED;
-		goto finish;
-	}
-
-	if (!OCSP_REQ_CTX_set1_req(ctx, req)) {
-		REDEBUG("Couldn't add data to OCSP request");
-		ocsp_status = OCSP_STATUS_SKIPPED;
-		goto finish;
-	}
-
-	start = fr_time();
-	do {
-		rc = OCSP_sendreq_nbio(&resp, ctx);
-		if (conf->timeout) {
-			if (conf->timeout > (fr_time() - start)) break;
-		}
-	} while ((rc == -1) && BIO_should_retry(conn));
-
-	if (conf->timeout && (rc == -1) && BIO_should_retry(conn)) {
-		REDEBUG("Response timed out");
-		ocsp_status = OCSP_STATUS_SKIPPED;
-		goto finish;
-	}
-
-	OCSP_REQ_CTX_free(ctx);
-
-	if (rc == 0) {
-		REDEBUG("Couldn't get OCSP response");
+	resp = ocsp_fetch(host, port, path, req, conf->timeout);
+	if (!resp) {
+		RPEDEBUG("Couldn't get OCSP response");
 		FR_OPENSSL_DRAIN_ERROR_QUEUE(REDEBUG, "", ssl_log);
 		ocsp_status = OCSP_STATUS_SKIPPED;
 		goto finish;
@@ -636,6 +1149,18 @@ int fr_tls_ocsp_check(REQUEST *request, SSL *ssl,
 		RDEBUG2("Update time not provided.  Not adding &TLS-OCSP-Next-Update");
 	}
 
+	/*
+	 *	Share the response with other requests for the
+	 *	same certificate.  There's no point caching
+	 *	unknown, as the responder may learn about the
+	 *	certificate at any time.
+	 */
+	if (conf->mem_cache && (status != V_OCSP_CERTSTATUS_UNKNOWN) &&
+	    (ocsp_cache_expires(&expires, this_update, next_update) == 0)) {
+		ocsp_cache_store(conf->mem_cache, certid, resp, status, expires,
+				 client_cert, issuer_cert, store, host, port, path);
+	}
+
 	switch (status) {
 	case V_OCSP_CERTSTATUS_GOOD:
 		RDEBUG2("Cert status: good");
@@ -733,7 +1258,6 @@ finish:
 	OPENSSL_free(host);
 	OPENSSL_free(port);
 	OPENSSL_free(path);
-	BIO_free_all(conn);
 	BIO_free(ssl_log);
 
 	return ocsp_status;
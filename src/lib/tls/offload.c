@@ -0,0 +1,790 @@
+/*
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ */
+
+/**
+ * $Id$
+ *
+ * @file tls/offload.c
+ * @brief Perform private key operations in a dedicated thread pool
+ *
+ * An RSA or ECDSA signature takes long enough that performing them inline
+ * during a burst of new handshakes stalls every other request queued on
+ * the worker.
+ *
+ * When offload is enabled the server's private keys are wrapped with an
+ * RSA_METHOD / EC_KEY_METHOD, and contexts are placed into SSL_MODE_ASYNC,
+ * so that OpenSSL runs each handshake step inside an ASYNC_JOB.  When a
+ * private key operation is needed the method queues it for one of the
+ * offload threads and pauses the job.  SSL_read() then returns
+ * SSL_ERROR_WANT_ASYNC, and the request yields until the offload thread
+ * signals completion by writing to a pipe registered with the job's
+ * wait context.  The next call to SSL_read() resumes the job.
+ *
+ * If we're not running inside a job, or the queue is full, the operation
+ * is performed inline exactly as it would be without offload.
+ *
+ * OpenSSL doesn't free a paused job when the SSL session is freed, so
+ * if a request is cancelled while it's waiting, #fr_tls_offload_cancel
+ * must be called to run the job to completion first.
+ *
+ * @copyright 2020 The FreeRADIUS server project
+ */
+RCSID("$Id$")
+USES_APPLE_DEPRECATED_API	/* OpenSSL API has been deprecated by Apple */
+
+#ifdef WITH_TLS
+#define LOG_PREFIX "tls - offload - "
+
+/*
+ *	RSA_METHOD and EC_KEY_METHOD are deprecated in OpenSSL 3.0,
+ *	but they're still the only way of intercepting private key
+ *	operations short of writing a provider.  They must be
+ *	included before base.h which hides deprecated interfaces.
+ */
+#define OPENSSL_SUPPRESS_DEPRECATED
+#include <openssl/async.h>
+#include <openssl/ec.h>
+#include <openssl/rsa.h>
+
+#include <poll.h>
+
+#include <freeradius-devel/server/base.h>
+#include <freeradius-devel/util/debug.h>
+#include <freeradius-devel/util/syserror.h>
+
+#ifdef HAVE_STDATOMIC_H
+#  include <stdatomic.h>
+#else
+#  include <freeradius-devel/util/stdatomic.h>
+#endif
+
+#include "base.h"
+#include "log.h"
+
+typedef enum {
+	TLS_OFFLOAD_RSA_PRIV_ENC = 0,				//!< RSA signature (or raw private encrypt).
+	TLS_OFFLOAD_RSA_PRIV_DEC,				//!< RSA key exchange.
+	TLS_OFFLOAD_ECDSA_SIGN					//!< ECDSA signature.
+} tls_offload_type_t;
+
+typedef struct tls_offload_op_s tls_offload_op_t;
+
+/** A single private key operation
+ *
+ * Input and output are copied into the op, so the offload thread never
+ * touches memory owned by the SSL session.  The op is freed by whichever
+ * of the offload thread, and the job (or wait ctx cleanup if the job is
+ * never resumed), releases it last.
+ */
+struct tls_offload_op_s {
+	tls_offload_op_t	*next;				//!< Next op in the queue.
+
+	tls_offload_type_t	type;
+	union {
+		RSA		*rsa;
+		EC_KEY		*ec;
+	};
+	int			padding;			//!< RSA padding mode.
+	int			md_type;			//!< ECDSA digest type.
+
+	uint8_t			*in;				//!< Copy of the data to sign or decrypt.
+	int			inlen;
+	uint8_t			*out;				//!< Result.
+	unsigned int		outlen;
+	int			ret;				//!< What the default method returned.
+
+	int			fd[2];				//!< Pipe used to wake the job.
+	atomic_bool		done;				//!< The offload thread has finished with the op.
+	atomic_uint		refs;
+
+	fr_time_t		queued;				//!< When the op was submitted.
+	fr_time_t		started;			//!< When an offload thread picked it up.
+};
+
+/** Offload thread pool
+ *
+ */
+struct fr_tls_offload_s {
+	pthread_mutex_t		mutex;
+	pthread_cond_t		cond;
+
+	tls_offload_op_t	*head;				//!< Oldest op.
+	tls_offload_op_t	*tail;				//!< Newest op.
+
+	uint32_t		num_threads;			//!< How many threads to start.
+	uint32_t		max_queued;			//!< Perform operations inline above this.
+	pthread_t		*threads;
+	uint32_t		running;			//!< Threads which have been started.
+	bool			stop;				//!< Tell the threads to exit.
+
+	fr_tls_offload_stats_t	stats;				//!< Protected by mutex.
+};
+
+static pthread_once_t	tls_offload_once = PTHREAD_ONCE_INIT;
+static RSA_METHOD	*tls_offload_rsa_meth;
+static EC_KEY_METHOD	*tls_offload_ec_meth;
+static int		tls_offload_rsa_index = -1;
+static int		tls_offload_ec_index = -1;
+
+/** Unique key for our fd in the job's wait ctx
+ *
+ */
+static char const	tls_offload_wait_key;
+
+static void tls_offload_op_release(tls_offload_op_t *op)
+{
+	if (atomic_fetch_sub_explicit(&op->refs, 1, memory_order_acq_rel) != 1) return;
+
+	close(op->fd[0]);
+	close(op->fd[1]);
+	free(op);
+}
+
+/** Called if the SSL session is freed before the job is resumed
+ *
+ */
+static void _tls_offload_wait_cleanup(UNUSED ASYNC_WAIT_CTX *wctx, UNUSED void const *key,
+				      UNUSED OSSL_ASYNC_FD fd, void *custom)
+{
+	tls_offload_op_release(custom);
+}
+
+/** Perform the private key operation using the default OpenSSL implementation
+ *
+ */
+static void tls_offload_op_exec(tls_offload_op_t *op)
+{
+	switch (op->type) {
+	case TLS_OFFLOAD_RSA_PRIV_ENC:
+		op->ret = RSA_meth_get_priv_enc(RSA_PKCS1_OpenSSL())(op->inlen, op->in, op->out, op->rsa, op->padding);
+		break;
+
+	case TLS_OFFLOAD_RSA_PRIV_DEC:
+		op->ret = RSA_meth_get_priv_dec(RSA_PKCS1_OpenSSL())(op->inlen, op->in, op->out, op->rsa, op->padding);
+		break;
+
+	case TLS_OFFLOAD_ECDSA_SIGN:
+	{
+		int (*sign)(int type, unsigned char const *dgst, int dlen, unsigned char *sig, unsigned int *siglen,
+			    BIGNUM const *kinv, BIGNUM const *r, EC_KEY *eckey);
+
+		EC_KEY_METHOD_get_sign(EC_KEY_OpenSSL(), &sign, NULL, NULL);
+		op->ret = sign(op->md_type, op->in, op->inlen, op->out, &op->outlen, NULL, NULL, op->ec);
+	}
+		break;
+	}
+}
+
+static void *tls_offload_thread(void *arg)
+{
+	fr_tls_offload_t	*pool = arg;
+	tls_offload_op_t	*op;
+	fr_time_t		now;
+
+	pthread_mutex_lock(&pool->mutex);
+	for (;;) {
+		while (!pool->head && !pool->stop) pthread_cond_wait(&pool->cond, &pool->mutex);
+		if (!pool->head) break;
+
+		op = pool->head;
+		pool->head = op->next;
+		if (!pool->head) pool->tail = NULL;
+		pool->stats.queue_depth--;
+		pthread_mutex_unlock(&pool->mutex);
+
+		op->started = fr_time();
+		tls_offload_op_exec(op);
+		now = fr_time();
+
+		pthread_mutex_lock(&pool->mutex);
+		pool->stats.ops++;
+		pool->stats.wait_total += op->started - op->queued;
+		if ((op->started - op->queued) > pool->stats.wait_max) pool->stats.wait_max = op->started - op->queued;
+		pool->stats.op_total += now - op->started;
+		if ((now - op->started) > pool->stats.op_max) pool->stats.op_max = now - op->started;
+		pthread_mutex_unlock(&pool->mutex);
+
+		/*
+		 *	Wake the job before marking the op as done,
+		 *	so the job always finds the wakeup to drain.
+		 */
+		if (write(op->fd[1], "", 1) < 0) {
+			ERROR("Failed signalling completion of private key operation: %s", fr_syserror(errno));
+		}
+		atomic_store_explicit(&op->done, true, memory_order_release);
+		tls_offload_op_release(op);
+
+		pthread_mutex_lock(&pool->mutex);
+	}
+	pthread_mutex_unlock(&pool->mutex);
+
+	return NULL;
+}
+
+/** Start the offload threads
+ *
+ * Called on first use, so that the threads are created after the
+ * server has finished daemonizing.
+ *
+ * @note Must be called with the pool mutex held.
+ */
+static int tls_offload_threads_start(fr_tls_offload_t *pool)
+{
+	int ret;
+
+	while (pool->running < pool->num_threads) {
+		ret = pthread_create(&pool->threads[pool->running], NULL, tls_offload_thread, pool);
+		if (ret != 0) {
+			ERROR("Failed creating private key offload thread: %s", fr_syserror(ret));
+			return -1;
+		}
+		pool->running++;
+	}
+
+	return 0;
+}
+
+/** Queue an operation and pause the current job until it's complete
+ *
+ * Falls back to performing the operation inline if we're not running in
+ * an ASYNC_JOB, or if the queue is full.
+ */
+static void tls_offload_run(fr_tls_offload_t *pool, tls_offload_op_t *op)
+{
+	ASYNC_JOB	*job = ASYNC_get_current_job();
+	ASYNC_WAIT_CTX	*wctx;
+	char		buff[16];
+
+	if (!job || !pool) {
+	run_inline:
+		if (pool) {
+			pthread_mutex_lock(&pool->mutex);
+			pool->stats.inline_ops++;
+			pthread_mutex_unlock(&pool->mutex);
+		}
+		tls_offload_op_exec(op);
+		return;
+	}
+
+	wctx = ASYNC_get_wait_ctx(job);
+	if (pipe(op->fd) < 0) {
+		op->fd[0] = op->fd[1] = -1;
+		goto run_inline;
+	}
+	if ((fr_nonblock(op->fd[0]) < 0) || (fr_nonblock(op->fd[1]) < 0)) {
+	close_inline:
+		close(op->fd[0]);
+		close(op->fd[1]);
+		op->fd[0] = op->fd[1] = -1;
+		goto run_inline;
+	}
+
+	pthread_mutex_lock(&pool->mutex);
+	if ((pool->stats.queue_depth >= pool->max_queued) || (tls_offload_threads_start(pool) < 0)) {
+		pthread_mutex_unlock(&pool->mutex);
+		goto close_inline;
+	}
+
+	/*
+	 *	One reference for the offload thread, and one
+	 *	for the job (or wait ctx cleanup).
+	 */
+	atomic_init(&op->refs, 2);
+	if (!ASYNC_WAIT_CTX_set_wait_fd(wctx, &tls_offload_wait_key, op->fd[0], op, _tls_offload_wait_cleanup)) {
+		pthread_mutex_unlock(&pool->mutex);
+		goto close_inline;
+	}
+
+	op->queued = fr_time();
+	if (pool->tail) {
+		pool->tail->next = op;
+	} else {
+		pool->head = op;
+	}
+	pool->tail = op;
+	pool->stats.queue_depth++;
+	if (pool->stats.queue_depth > pool->stats.queue_depth_max) pool->stats.queue_depth_max = pool->stats.queue_depth;
+	pthread_cond_signal(&pool->cond);
+	pthread_mutex_unlock(&pool->mutex);
+
+	/*
+	 *	We may be resumed early if the application calls
+	 *	SSL_read() before the fd is readable, in which
+	 *	case we just pause again.
+	 */
+	while (!atomic_load_explicit(&op->done, memory_order_acquire)) ASYNC_pause_job();
+
+	while (read(op->fd[0], buff, sizeof(buff)) > 0);
+
+	/*
+	 *	Clearing the fd doesn't call the cleanup function,
+	 *	the caller releases the job's reference instead.
+	 */
+	ASYNC_WAIT_CTX_clear_fd(wctx, &tls_offload_wait_key);
+}
+
+/** Allocate an op, with space for the input and output
+ *
+ */
+static tls_offload_op_t *tls_offload_op_alloc(tls_offload_type_t type, uint8_t const *in, int inlen, size_t outlen)
+{
+	tls_offload_op_t *op;
+
+	op = calloc(1, sizeof(*op) + inlen + outlen);
+	if (!op) return NULL;
+
+	op->type = type;
+	op->in = (uint8_t *)(op + 1);
+	op->inlen = inlen;
+	memcpy(op->in, in, inlen);
+	op->out = op->in + inlen;
+	op->outlen = outlen;
+	op->fd[0] = op->fd[1] = -1;
+
+	return op;
+}
+
+static int tls_offload_rsa(tls_offload_type_t type, int flen, unsigned char const *from, unsigned char *to,
+			   RSA *rsa, int padding)
+{
+	tls_offload_op_t	*op;
+	int			ret;
+
+	op = tls_offload_op_alloc(type, from, flen, RSA_size(rsa));
+	if (!op) return -1;
+	op->rsa = rsa;
+	op->padding = padding;
+
+	tls_offload_run(RSA_get_ex_data(rsa, tls_offload_rsa_index), op);
+
+	ret = op->ret;
+	if (ret > 0) memcpy(to, op->out, ret);
+	if (op->fd[0] < 0) {
+		free(op);
+	} else {
+		tls_offload_op_release(op);
+	}
+
+	return ret;
+}
+
+static int tls_offload_rsa_priv_enc(int flen, unsigned char const *from, unsigned char *to, RSA *rsa, int padding)
+{
+	return tls_offload_rsa(TLS_OFFLOAD_RSA_PRIV_ENC, flen, from, to, rsa, padding);
+}
+
+static int tls_offload_rsa_priv_dec(int flen, unsigned char const *from, unsigned char *to, RSA *rsa, int padding)
+{
+	return tls_offload_rsa(TLS_OFFLOAD_RSA_PRIV_DEC, flen, from, to, rsa, padding);
+}
+
+static int tls_offload_ecdsa_sign(int type, unsigned char const *dgst, int dlen, unsigned char *sig,
+				  unsigned int *siglen, BIGNUM const *kinv, BIGNUM const *r, EC_KEY *eckey)
+{
+	tls_offload_op_t	*op;
+	int			ret;
+
+	/*
+	 *	Precomputed values are only used by callers
+	 *	outside of libssl, just do them inline.
+	 */
+	if (kinv || r) {
+		int (*sign)(int type, unsigned char const *dgst, int dlen, unsigned char *sig, unsigned int *siglen,
+			    BIGNUM const *kinv, BIGNUM const *r, EC_KEY *eckey);
+
+		EC_KEY_METHOD_get_sign(EC_KEY_OpenSSL(), &sign, NULL, NULL);
+		return sign(type, dgst, dlen, sig, siglen, kinv, r, eckey);
+	}
+
+	op = tls_offload_op_alloc(TLS_OFFLOAD_ECDSA_SIGN, dgst, dlen, ECDSA_size(eckey));
+	if (!op) return 0;
+	op->ec = eckey;
+	op->md_type = type;
+
+	tls_offload_run(EC_KEY_get_ex_data(eckey, tls_offload_ec_index), op);
+
+	ret = op->ret;
+	if (ret == 1) {
+		memcpy(sig, op->out, op->outlen);
+		*siglen = op->outlen;
+	}
+	if (op->fd[0] < 0) {
+		free(op);
+	} else {
+		tls_offload_op_release(op);
+	}
+
+	return ret;
+}
+
+static void _tls_offload_global_init(void)
+{
+	int (*sign_setup)(EC_KEY *eckey, BN_CTX *ctx_in, BIGNUM **kinvp, BIGNUM **rp);
+	ECDSA_SIG *(*sign_sig)(unsigned char const *dgst, int dgst_len, BIGNUM const *in_kinv,
+			       BIGNUM const *in_r, EC_KEY *eckey);
+
+	tls_offload_rsa_index = CRYPTO_get_ex_new_index(CRYPTO_EX_INDEX_RSA, 0, NULL, NULL, NULL, NULL);
+	tls_offload_ec_index = CRYPTO_get_ex_new_index(CRYPTO_EX_INDEX_EC_KEY, 0, NULL, NULL, NULL, NULL);
+
+	tls_offload_rsa_meth = RSA_meth_dup(RSA_PKCS1_OpenSSL());
+	if (tls_offload_rsa_meth) {
+		RSA_meth_set1_name(tls_offload_rsa_meth, "FreeRADIUS private key offload");
+		RSA_meth_set_priv_enc(tls_offload_rsa_meth, tls_offload_rsa_priv_enc);
+		RSA_meth_set_priv_dec(tls_offload_rsa_meth, tls_offload_rsa_priv_dec);
+	}
+
+	tls_offload_ec_meth = EC_KEY_METHOD_new(EC_KEY_OpenSSL());
+	if (tls_offload_ec_meth) {
+		EC_KEY_METHOD_get_sign(EC_KEY_OpenSSL(), NULL, &sign_setup, &sign_sig);
+		EC_KEY_METHOD_set_sign(tls_offload_ec_meth, tls_offload_ecdsa_sign, sign_setup, sign_sig);
+	}
+}
+
+static void tls_offload_stats_get(fr_tls_offload_stats_t *stats, fr_tls_offload_t *pool)
+{
+	pthread_mutex_lock(&pool->mutex);
+	*stats = pool->stats;
+	pthread_mutex_unlock(&pool->mutex);
+}
+
+static int cmd_stats_tls_offload(FILE *fp, UNUSED FILE *fp_err, void *ctx, UNUSED fr_cmd_info_t const *info)
+{
+	fr_tls_offload_t	*pool = talloc_get_type_abort(ctx, fr_tls_offload_t);
+	fr_tls_offload_stats_t	stats;
+
+	tls_offload_stats_get(&stats, pool);
+
+	fprintf(fp, "threads\t\t\t%u\n", pool->running);
+	fprintf(fp, "queue_depth\t\t%u\n", stats.queue_depth);
+	fprintf(fp, "queue_depth_max\t\t%u\n", stats.queue_depth_max);
+	fprintf(fp, "ops\t\t\t%" PRIu64 "\n", stats.ops);
+	fprintf(fp, "inline_ops\t\t%" PRIu64 "\n", stats.inline_ops);
+	fprintf(fp, "cancelled\t\t%" PRIu64 "\n", stats.cancelled);
+	fprintf(fp, "wait_avg_usec\t\t%" PRIu64 "\n",
+		stats.ops ? (uint64_t)fr_time_delta_to_usec(stats.wait_total) / stats.ops : 0);
+	fprintf(fp, "wait_max_usec\t\t%" PRIu64 "\n", (uint64_t)fr_time_delta_to_usec(stats.wait_max));
+	fprintf(fp, "op_avg_usec\t\t%" PRIu64 "\n",
+		stats.ops ? (uint64_t)fr_time_delta_to_usec(stats.op_total) / stats.ops : 0);
+	fprintf(fp, "op_max_usec\t\t%" PRIu64 "\n", (uint64_t)fr_time_delta_to_usec(stats.op_max));
+
+	return 0;
+}
+
+static fr_cmd_table_t cmd_table[] = {
+	{
+		.parent = "stats",
+		.name = "tls_offload",
+		.help = "Statistics for TLS private key offload pools.",
+		.read_only = true
+	},
+
+	{
+		.parent = "stats tls_offload",
+		.add_name = true,
+		.name = "self",
+		.func = cmd_stats_tls_offload,
+		.help = "Show queue depth and latency for a private key offload pool.",
+		.read_only = true
+	},
+
+	CMD_TABLE_END
+};
+
+static int _tls_offload_free(fr_tls_offload_t *pool)
+{
+	uint32_t i;
+
+	pthread_mutex_lock(&pool->mutex);
+	pool->stop = true;
+	pthread_cond_broadcast(&pool->cond);
+	pthread_mutex_unlock(&pool->mutex);
+
+	for (i = 0; i < pool->running; i++) pthread_join(pool->threads[i], NULL);
+
+	pthread_cond_destroy(&pool->cond);
+	pthread_mutex_destroy(&pool->mutex);
+
+	return 0;
+}
+
+/** Allocate the offload thread pool for a TLS configuration
+ *
+ * Threads aren't started until the first operation is submitted.
+ *
+ * The pool's statistics are registered with radmin as
+ * "stats tls_offload <name> self", where name is the name of the
+ * TLS configuration section.
+ *
+ * @param[in] conf	to allocate a pool for.  Does nothing if offload
+ *			is disabled.
+ * @param[in] cs	conf was parsed from.
+ * @return
+ *	- 0 on success.
+ *	- -1 on failure.
+ */
+int fr_tls_offload_alloc(fr_tls_conf_t *conf, CONF_SECTION *cs)
+{
+	fr_tls_offload_t	*pool;
+	char const		*name;
+
+	if (!conf->offload.threads) return 0;
+
+	if (!ASYNC_is_capable()) {
+		ERROR("private_key_offload requires OpenSSL async job support, which isn't available "
+		      "on this platform");
+		return -1;
+	}
+
+	/*
+	 *	Anything called from within the handshake runs on
+	 *	the job's (small) stack, which isn't big enough
+	 *	to run a nested interpreter.
+	 */
+	if (conf->session_cache_server) {
+		ERROR("private_key_offload cannot be used with a cache virtual_server.  "
+		      "Use cache { tickets = yes } for resumption");
+		return -1;
+	}
+
+#ifdef HAVE_OPENSSL_OCSP_H
+	if (conf->ocsp.cache_server) {
+		ERROR("private_key_offload cannot be used with an ocsp virtual_server");
+		return -1;
+	}
+#endif
+
+	pthread_once(&tls_offload_once, _tls_offload_global_init);
+	if (!tls_offload_rsa_meth || !tls_offload_ec_meth ||
+	    (tls_offload_rsa_index < 0) || (tls_offload_ec_index < 0)) {
+		fr_tls_log_error(NULL, "Failed initialising private key offload methods");
+		return -1;
+	}
+
+	MEM(pool = talloc_zero(conf, fr_tls_offload_t));
+	pool->num_threads = conf->offload.threads;
+	pool->max_queued = conf->offload.max_queued;
+	MEM(pool->threads = talloc_array(pool, pthread_t, pool->num_threads));
+	pthread_mutex_init(&pool->mutex, NULL);
+	pthread_cond_init(&pool->cond, NULL);
+	talloc_set_destructor(pool, _tls_offload_free);
+
+	conf->offload.pool = pool;
+
+	/*
+	 *	Sections with the same name can't both be
+	 *	registered, which shouldn't stop the server.
+	 */
+	name = cf_section_name2(cs);
+	if (!name) name = cf_section_name1(cs);
+	if (fr_command_register_hook(NULL, name, pool, cmd_table) < 0) {
+		PWARN("Failed registering radmin commands for private key offload");
+	}
+
+	return 0;
+}
+
+/** Route private key operations for all the keys loaded into a ctx via the offload pool
+ *
+ * @param[in] ctx	to wrap keys for.
+ * @param[in] conf	the ctx was allocated from.
+ * @return
+ *	- 0 on success.
+ *	- -1 on failure.
+ */
+int fr_tls_offload_ctx_init(SSL_CTX *ctx, fr_tls_conf_t const *conf)
+{
+	int ret;
+
+	if (!conf->offload.pool) return 0;
+
+	for (ret = SSL_CTX_set_current_cert(ctx, SSL_CERT_SET_FIRST);
+	     ret == 1;
+	     ret = SSL_CTX_set_current_cert(ctx, SSL_CERT_SET_NEXT)) {
+		EVP_PKEY	*pkey = SSL_CTX_get0_privatekey(ctx), *wrapped;
+
+		if (!pkey) continue;
+
+		MEM(wrapped = EVP_PKEY_new());
+		switch (EVP_PKEY_base_id(pkey)) {
+		case EVP_PKEY_RSA:
+		{
+			RSA *rsa = EVP_PKEY_get1_RSA(pkey);
+
+			if (!rsa || !RSA_set_method(rsa, tls_offload_rsa_meth) ||
+			    !RSA_set_ex_data(rsa, tls_offload_rsa_index, conf->offload.pool) ||
+			    !EVP_PKEY_assign_RSA(wrapped, rsa)) {
+				RSA_free(rsa);
+			error:
+				EVP_PKEY_free(wrapped);
+				fr_tls_log_error(NULL, "Failed wrapping private key for offload");
+				return -1;
+			}
+		}
+			break;
+
+		case EVP_PKEY_EC:
+		{
+			EC_KEY *ec = EVP_PKEY_get1_EC_KEY(pkey);
+
+			if (!ec || !EC_KEY_set_method(ec, tls_offload_ec_meth) ||
+			    !EC_KEY_set_ex_data(ec, tls_offload_ec_index, conf->offload.pool) ||
+			    !EVP_PKEY_assign_EC_KEY(wrapped, ec)) {
+				EC_KEY_free(ec);
+				goto error;
+			}
+		}
+			break;
+
+		default:
+			DEBUG2("Not offloading operations for %s private key", OBJ_nid2sn(EVP_PKEY_base_id(pkey)));
+			EVP_PKEY_free(wrapped);
+			continue;
+		}
+
+		if (SSL_CTX_use_PrivateKey(ctx, wrapped) != 1) goto error;
+		EVP_PKEY_free(wrapped);
+	}
+	(void)SSL_CTX_set_current_cert(ctx, SSL_CERT_SET_FIRST);	/* Reset */
+
+	SSL_CTX_set_mode(ctx, SSL_MODE_ASYNC);
+
+	return 0;
+}
+
+/** Return a snapshot of the offload statistics for a configuration
+ *
+ * @param[out] stats	Where to write the statistics.
+ * @param[in] conf	to retrieve statistics for.
+ * @return
+ *	- 0 on success.
+ *	- -1 if offload isn't enabled.
+ */
+int fr_tls_offload_stats(fr_tls_offload_stats_t *stats, fr_tls_conf_t const *conf)
+{
+	if (!conf->offload.pool) return -1;
+
+	tls_offload_stats_get(stats, conf->offload.pool);
+
+	return 0;
+}
+
+/** Return the fd which becomes readable once a paused private key operation completes
+ *
+ * Should be called when #fr_tls_session_handshake indicates that the
+ * handshake is waiting for the offload pool.  The caller should wait
+ * for the fd to become readable, then call #fr_tls_session_handshake
+ * again to continue the handshake.
+ *
+ * @param[in] request		The current request.
+ * @param[in] tls_session	with a paused job.
+ * @return
+ *	- The fd to wait on.
+ *	- -1 on failure.
+ */
+int fr_tls_offload_fd(REQUEST *request, fr_tls_session_t *tls_session)
+{
+	fr_tls_conf_t const	*conf = SSL_CTX_get_app_data(tls_session->ctx);
+	OSSL_ASYNC_FD		fd;
+	size_t			num = 0;
+
+	if ((SSL_get_all_async_fds(tls_session->ssl, NULL, &num) != 1) || (num != 1) ||
+	    (SSL_get_all_async_fds(tls_session->ssl, &fd, &num) != 1)) {
+		REDEBUG("Private key operation is pending, but there's nothing to wait on");
+		return -1;
+	}
+
+	if (RDEBUG_ENABLED2 && conf->offload.pool) {
+		fr_tls_offload_stats_t stats;
+
+		(void) fr_tls_offload_stats(&stats, conf);
+		RDEBUG2("Waiting for private key operation (%u queued, %"PRIu64" performed, %"PRIu64" inline)",
+			stats.queue_depth, stats.ops, stats.inline_ops);
+	}
+
+	return fd;
+}
+
+/** Run a job paused waiting for the offload pool to completion
+ *
+ * Must be called before a session with a pending operation is freed,
+ * as OpenSSL only frees the job's wait ctx, leaking the job and its
+ * stack.  If the operation is still queued it's removed from the
+ * queue and fails, otherwise we wait for the offload thread to finish
+ * performing it.  The job is then resumed, and the handshake continues
+ * until it fails, or needs more data from the peer.
+ *
+ * @note No request may be bound to the session, as callbacks run
+ *	 while the job completes.
+ *
+ * @param[in] tls_session	with a paused job.  Does nothing if no
+ *				job is paused.
+ */
+void fr_tls_offload_cancel(fr_tls_session_t *tls_session)
+{
+	fr_tls_conf_t const	*conf = SSL_CTX_get_app_data(tls_session->ctx);
+	fr_tls_offload_t	*pool;
+	int			ret;
+
+	if (!tls_session->async_pending || !conf || !conf->offload.pool) return;
+	pool = conf->offload.pool;
+
+	/*
+	 *	Continuing the handshake may start another
+	 *	operation, so keep going until the job exits.
+	 */
+	while (tls_session->async_pending) {
+		OSSL_ASYNC_FD		fd;
+		size_t			num = 0;
+		tls_offload_op_t	*op, **op_p, *prev = NULL;
+
+		if ((SSL_get_all_async_fds(tls_session->ssl, NULL, &num) != 1) || (num != 1) ||
+		    (SSL_get_all_async_fds(tls_session->ssl, &fd, &num) != 1)) {
+			ERROR("Failed finding private key operation for cancelled session, job will be leaked");
+			return;
+		}
+
+		pthread_mutex_lock(&pool->mutex);
+		for (op_p = &pool->head; *op_p; prev = *op_p, op_p = &(*op_p)->next) {
+			if ((*op_p)->fd[0] == fd) break;
+		}
+		op = *op_p;
+		if (op) {
+			*op_p = op->next;
+			if (pool->tail == op) pool->tail = prev;
+			pool->stats.queue_depth--;
+			pool->stats.cancelled++;
+		}
+		pthread_mutex_unlock(&pool->mutex);
+
+		if (op) {
+			op->ret = (op->type == TLS_OFFLOAD_ECDSA_SIGN) ? 0 : -1;
+			atomic_store_explicit(&op->done, true, memory_order_release);
+			tls_offload_op_release(op);	/* The offload thread's reference */
+		} else {
+			struct pollfd pfd = { .fd = fd, .events = POLLIN };
+
+			/*
+			 *	An offload thread is performing the
+			 *	operation, which won't take long.
+			 */
+			while ((poll(&pfd, 1, -1) < 0) && (errno == EINTR));
+		}
+
+		ret = SSL_do_handshake(tls_session->ssl);
+		tls_session->async_pending = (SSL_get_error(tls_session->ssl, ret) == SSL_ERROR_WANT_ASYNC);
+	}
+}
+#endif /* WITH_TLS */
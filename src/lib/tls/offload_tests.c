@@ -0,0 +1,452 @@
+#include <freeradius-devel/util/acutest.h>
+
+#include "offload.c"
+
+#if defined(WITH_TLS) && (OPENSSL_VERSION_NUMBER >= 0x30000000L)
+#include <openssl/x509.h>
+
+static EVP_PKEY		*test_ec_pkey;
+static X509		*test_ec_cert;
+static EVP_PKEY		*test_rsa_pkey;
+static X509		*test_rsa_cert;
+
+/** Generate a self-signed certificate for a key
+ *
+ */
+static X509 *test_cert_alloc(EVP_PKEY *pkey)
+{
+	X509		*cert;
+	X509_NAME	*name;
+
+	MEM(cert = X509_new());
+	X509_set_version(cert, 2);
+	ASN1_INTEGER_set(X509_get_serialNumber(cert), 1);
+	X509_gmtime_adj(X509_getm_notBefore(cert), 0);
+	X509_gmtime_adj(X509_getm_notAfter(cert), 3600);
+	X509_set_pubkey(cert, pkey);
+	name = X509_get_subject_name(cert);
+	X509_NAME_add_entry_by_txt(name, "CN", MBSTRING_ASC, (unsigned char const *) "offload test", -1, -1, 0);
+	X509_set_issuer_name(cert, name);
+	if (X509_sign(cert, pkey, EVP_sha256()) <= 0) {
+		fr_tls_log_error(NULL, "Failed signing test certificate");
+		fr_exit_now(EXIT_FAILURE);
+	}
+
+	return cert;
+}
+
+/** Generate the server's keys
+ *
+ * @return
+ *	- true if offload can be tested on this platform.
+ *	- false if OpenSSL doesn't support async jobs.
+ */
+static bool test_init(void)
+{
+	if (!ASYNC_is_capable()) {
+		TEST_MSG("OpenSSL async jobs aren't supported on this platform");
+		return false;
+	}
+
+	if (test_ec_pkey) return true;
+
+	MEM(test_ec_pkey = EVP_EC_gen("P-256"));
+	test_ec_cert = test_cert_alloc(test_ec_pkey);
+	MEM(test_rsa_pkey = EVP_RSA_gen(2048));
+	test_rsa_cert = test_cert_alloc(test_rsa_pkey);
+
+	return true;
+}
+
+/** Allocate a configuration with an offload pool
+ *
+ * @param[in] ctx		to allocate the configuration in.
+ * @param[in] max_queued	Perform operations inline above this.
+ */
+static fr_tls_conf_t *test_conf_alloc(TALLOC_CTX *ctx, uint32_t max_queued)
+{
+	fr_tls_conf_t	*conf;
+	CONF_SECTION	*cs;
+
+	MEM(conf = talloc_zero(ctx, fr_tls_conf_t));
+	MEM(cs = cf_section_alloc(conf, NULL, "tls-config", "offload-test"));
+	conf->offload.threads = 2;
+	conf->offload.max_queued = max_queued;
+
+	TEST_CHECK(fr_tls_offload_alloc(conf, cs) == 0);
+	TEST_CHECK(conf->offload.pool != NULL);
+
+	return conf;
+}
+
+static int _test_ctx_free(SSL_CTX **ctx)
+{
+	SSL_CTX_free(*ctx);
+
+	return 0;
+}
+
+/** Create a TLS 1.3 server context with its key wrapped for offload
+ *
+ */
+static SSL_CTX *test_server_ctx(fr_tls_conf_t *conf, EVP_PKEY *pkey, X509 *cert)
+{
+	SSL_CTX		*ctx, **ctx_p;
+	void		*app_data;
+
+	MEM(ctx = SSL_CTX_new(TLS_server_method()));
+	SSL_CTX_set_min_proto_version(ctx, TLS1_3_VERSION);
+	SSL_CTX_set_session_cache_mode(ctx, SSL_SESS_CACHE_OFF);
+	TEST_CHECK(SSL_CTX_use_certificate(ctx, cert) == 1);
+	TEST_CHECK(SSL_CTX_use_PrivateKey(ctx, pkey) == 1);
+
+	memcpy(&app_data, &conf, sizeof(app_data));
+	SSL_CTX_set_app_data(ctx, app_data);
+	TEST_CHECK(fr_tls_offload_ctx_init(ctx, conf) == 0);
+	TEST_CHECK((SSL_CTX_get_mode(ctx) & SSL_MODE_ASYNC) != 0);
+
+	/*
+	 *	Freed before the pool, which is freed
+	 *	along with the configuration.
+	 */
+	MEM(ctx_p = talloc(conf, SSL_CTX *));
+	*ctx_p = ctx;
+	talloc_set_destructor(ctx_p, _test_ctx_free);
+
+	return ctx;
+}
+
+typedef struct {
+	SSL			*client;
+	SSL			*server;
+	SSL_CTX			*client_ctx;
+	fr_tls_session_t	*tls_session;
+} test_conn_t;
+
+static int _test_conn_free(test_conn_t *conn)
+{
+	SSL_free(conn->client);
+	SSL_free(conn->server);
+	SSL_CTX_free(conn->client_ctx);
+
+	return 0;
+}
+
+/** Connect a client and server over a BIO pair, without starting the handshake
+ *
+ */
+static test_conn_t *test_conn_alloc(TALLOC_CTX *ctx, SSL_CTX *server_ctx)
+{
+	test_conn_t	*conn;
+	BIO		*client_bio, *server_bio;
+
+	MEM(conn = talloc_zero(ctx, test_conn_t));
+	MEM(conn->client_ctx = SSL_CTX_new(TLS_client_method()));
+	SSL_CTX_set_min_proto_version(conn->client_ctx, TLS1_3_VERSION);
+	SSL_CTX_set_verify(conn->client_ctx, SSL_VERIFY_NONE, NULL);
+	MEM(conn->client = SSL_new(conn->client_ctx));
+	MEM(conn->server = SSL_new(server_ctx));
+	talloc_set_destructor(conn, _test_conn_free);
+
+	TEST_CHECK(BIO_new_bio_pair(&client_bio, 0, &server_bio, 0) == 1);
+	SSL_set_bio(conn->client, client_bio, client_bio);
+	SSL_set_bio(conn->server, server_bio, server_bio);
+	SSL_set_connect_state(conn->client);
+	SSL_set_accept_state(conn->server);
+
+	MEM(conn->tls_session = talloc_zero(conn, fr_tls_session_t));
+	conn->tls_session->ctx = server_ctx;
+	conn->tls_session->ssl = conn->server;
+
+	return conn;
+}
+
+/** Advance the server's side of the handshake, as fr_tls_session_handshake does
+ *
+ * @return
+ *	- 1 if the handshake completed.
+ *	- 2 if the handshake paused waiting for the offload pool.
+ *	- 0 if more data is needed from the client.
+ *	- -1 on failure.
+ */
+static int test_server_step(test_conn_t *conn)
+{
+	int ret;
+
+	ret = SSL_do_handshake(conn->server);
+	if (ret == 1) return 1;
+
+	switch (SSL_get_error(conn->server, ret)) {
+	case SSL_ERROR_WANT_ASYNC:
+		conn->tls_session->async_pending = true;
+		return 2;
+
+	case SSL_ERROR_WANT_READ:
+		conn->tls_session->async_pending = false;
+		return 0;
+
+	default:
+		conn->tls_session->async_pending = false;
+		return -1;
+	}
+}
+
+/** Wait for the paused operation to complete
+ *
+ */
+static void test_server_wait(test_conn_t *conn)
+{
+	OSSL_ASYNC_FD	fd;
+	size_t		num = 0;
+	struct pollfd	pfd;
+
+	TEST_CHECK(SSL_get_all_async_fds(conn->server, NULL, &num) == 1);
+	TEST_CHECK(num == 1);
+	TEST_CHECK(SSL_get_all_async_fds(conn->server, &fd, &num) == 1);
+
+	pfd.fd = fd;
+	pfd.events = POLLIN;
+	TEST_CHECK(poll(&pfd, 1, 5000) == 1);
+	TEST_MSG("Timed out waiting for private key operation");
+}
+
+/** Perform a complete handshake, waiting for the offload pool whenever the server pauses
+ *
+ * The job may be resumed between the offload thread waking it and
+ * marking the operation as done, in which case it pauses again, so
+ * the count is only ever a minimum.
+ *
+ * @return how many times the server paused.
+ */
+static int test_handshake(test_conn_t *conn)
+{
+	int	i, client_ret = 0, server_ret = 0, paused = 0;
+
+	for (i = 0; (i < 20) && ((client_ret != 1) || (server_ret != 1)); i++) {
+		if (client_ret != 1) client_ret = SSL_do_handshake(conn->client);
+		if (server_ret == 1) continue;
+
+		server_ret = test_server_step(conn);
+		if (server_ret == 2) {
+			paused++;
+			test_server_wait(conn);
+		}
+	}
+	TEST_CHECK(client_ret == 1);
+	TEST_CHECK(server_ret == 1);
+	TEST_MSG("Handshake failed, client %i, server %i", client_ret, server_ret);
+
+	return paused;
+}
+
+/** Run the handshake until the server pauses
+ *
+ */
+static void test_handshake_until_paused(test_conn_t *conn)
+{
+	int i, ret = 0;
+
+	for (i = 0; (i < 10) && (ret != 2); i++) {
+		(void) SSL_do_handshake(conn->client);
+		ret = test_server_step(conn);
+	}
+	TEST_CHECK(ret == 2);
+	TEST_MSG("Server didn't pause waiting for the offload pool");
+	TEST_CHECK(SSL_waiting_for_async(conn->server) == 1);
+}
+
+static void test_offload(void)
+{
+	TALLOC_CTX		*ctx;
+	fr_tls_conf_t		*conf;
+	test_conn_t		*conn;
+	fr_tls_offload_stats_t	stats;
+
+	if (!test_init()) return;
+	ctx = talloc_new(NULL);
+
+	conf = test_conf_alloc(ctx, 1024);
+
+	TEST_CASE("ECDSA signatures are performed by the pool");
+	conn = test_conn_alloc(ctx, test_server_ctx(conf, test_ec_pkey, test_ec_cert));
+	TEST_CHECK(test_handshake(conn) > 0);
+	talloc_free(conn);
+
+	TEST_CHECK(fr_tls_offload_stats(&stats, conf) == 0);
+	TEST_CHECK(stats.ops == 1);
+	TEST_CHECK(stats.inline_ops == 0);
+	TEST_CHECK(stats.queue_depth == 0);
+	TEST_CHECK(stats.queue_depth_max == 1);
+	TEST_CHECK(stats.op_total > 0);
+	TEST_CHECK(stats.op_max <= stats.op_total);
+
+	TEST_CASE("RSA signatures are performed by the pool");
+	conn = test_conn_alloc(ctx, test_server_ctx(conf, test_rsa_pkey, test_rsa_cert));
+	TEST_CHECK(test_handshake(conn) > 0);
+	talloc_free(conn);
+
+	TEST_CHECK(fr_tls_offload_stats(&stats, conf) == 0);
+	TEST_CHECK(stats.ops == 2);
+	TEST_CHECK(stats.queue_depth == 0);
+
+	talloc_free(ctx);
+}
+
+static void test_inline(void)
+{
+	TALLOC_CTX		*ctx;
+	fr_tls_conf_t		*conf;
+	test_conn_t		*conn;
+	fr_tls_offload_stats_t	stats;
+
+	if (!test_init()) return;
+	ctx = talloc_new(NULL);
+
+	TEST_CASE("Operations are performed inline when the queue is full");
+	conf = test_conf_alloc(ctx, 0);
+	conn = test_conn_alloc(ctx, test_server_ctx(conf, test_ec_pkey, test_ec_cert));
+	TEST_CHECK(test_handshake(conn) == 0);
+	talloc_free(conn);
+
+	TEST_CHECK(fr_tls_offload_stats(&stats, conf) == 0);
+	TEST_CHECK(stats.ops == 0);
+	TEST_CHECK(stats.inline_ops == 1);
+
+	TEST_CASE("Stats aren't available without a pool");
+	conf->offload.pool = NULL;
+	TEST_CHECK(fr_tls_offload_stats(&stats, conf) < 0);
+
+	talloc_free(ctx);
+}
+
+/** A request cancelled while its operation is queued must not leak the job
+ *
+ */
+static void test_cancel_queued(void)
+{
+	TALLOC_CTX		*ctx;
+	fr_tls_conf_t		*conf;
+	fr_tls_offload_t	*pool;
+	test_conn_t		*conn;
+	fr_tls_offload_stats_t	stats;
+
+	if (!test_init()) return;
+	ctx = talloc_new(NULL);
+
+	conf = test_conf_alloc(ctx, 1024);
+	pool = conf->offload.pool;
+	conn = test_conn_alloc(ctx, test_server_ctx(conf, test_ec_pkey, test_ec_cert));
+
+	/*
+	 *	Pretend the threads are running, so the
+	 *	operation stays in the queue.
+	 */
+	pool->running = pool->num_threads;
+	test_handshake_until_paused(conn);
+
+	TEST_CHECK(fr_tls_offload_stats(&stats, conf) == 0);
+	TEST_CHECK(stats.queue_depth == 1);
+
+	TEST_CASE("Cancelling removes the operation from the queue");
+	fr_tls_offload_cancel(conn->tls_session);
+	TEST_CHECK(!conn->tls_session->async_pending);
+	TEST_CHECK(SSL_waiting_for_async(conn->server) == 0);
+	TEST_CHECK(pool->head == NULL);
+	TEST_CHECK(pool->tail == NULL);
+
+	TEST_CHECK(fr_tls_offload_stats(&stats, conf) == 0);
+	TEST_CHECK(stats.queue_depth == 0);
+	TEST_CHECK(stats.cancelled == 1);
+	TEST_CHECK(stats.ops == 0);
+
+	TEST_CASE("The handshake fails after being cancelled");
+	TEST_CHECK(test_server_step(conn) < 0);
+
+	talloc_free(conn);
+	pool->running = 0;
+	talloc_free(ctx);
+}
+
+/** A request cancelled while its operation is being performed must wait for it
+ *
+ */
+static void test_cancel_running(void)
+{
+	TALLOC_CTX		*ctx;
+	fr_tls_conf_t		*conf;
+	test_conn_t		*conn;
+	fr_tls_offload_stats_t	stats;
+
+	if (!test_init()) return;
+	ctx = talloc_new(NULL);
+
+	conf = test_conf_alloc(ctx, 1024);
+	conn = test_conn_alloc(ctx, test_server_ctx(conf, test_rsa_pkey, test_rsa_cert));
+	test_handshake_until_paused(conn);
+
+	TEST_CASE("Cancelling completes the job");
+	fr_tls_offload_cancel(conn->tls_session);
+	TEST_CHECK(!conn->tls_session->async_pending);
+	TEST_CHECK(SSL_waiting_for_async(conn->server) == 0);
+
+	/*
+	 *	Depending on whether a thread had picked
+	 *	up the operation before it was cancelled.
+	 */
+	TEST_CHECK(fr_tls_offload_stats(&stats, conf) == 0);
+	TEST_CHECK((stats.ops + stats.cancelled) == 1);
+	TEST_CHECK(stats.queue_depth == 0);
+
+	TEST_CASE("Cancelling a session without a paused job does nothing");
+	fr_tls_offload_cancel(conn->tls_session);
+	TEST_CHECK(fr_tls_offload_stats(&stats, conf) == 0);
+	TEST_CHECK((stats.ops + stats.cancelled) == 1);
+
+	talloc_free(ctx);
+}
+
+static void test_refused(void)
+{
+	TALLOC_CTX	*ctx;
+	fr_tls_conf_t	*conf;
+	CONF_SECTION	*cs;
+
+	if (!test_init()) return;
+	ctx = talloc_new(NULL);
+
+	MEM(conf = talloc_zero(ctx, fr_tls_conf_t));
+	MEM(cs = cf_section_alloc(conf, NULL, "tls", NULL));
+
+	TEST_CASE("No pool is allocated when offload is disabled");
+	TEST_CHECK(fr_tls_offload_alloc(conf, cs) == 0);
+	TEST_CHECK(conf->offload.pool == NULL);
+
+	TEST_CASE("Offload is refused with a cache virtual server");
+	conf->offload.threads = 1;
+	conf->session_cache_server = "tls-cache";
+	TEST_CHECK(fr_tls_offload_alloc(conf, cs) < 0);
+	TEST_CHECK(conf->offload.pool == NULL);
+
+	talloc_free(ctx);
+}
+
+TEST_LIST = {
+	/*
+	 *	Performing operations
+	 */
+	{ "Offload - Pool",				test_offload },
+	{ "Offload - Inline",				test_inline },
+	{ "Offload - Refused",				test_refused },
+
+	/*
+	 *	Cancelled requests
+	 */
+	{ "Cancel - Queued",				test_cancel_queued },
+	{ "Cancel - Running",				test_cancel_running },
+	{ NULL }
+};
+#else
+TEST_LIST = {
+	{ NULL }
+};
+#endif
@@ -0,0 +1,10 @@
+ifneq ($(OPENSSL_LIBS),)
+TARGET		:= offload_tests
+endif
+
+SOURCES		:= offload_tests.c
+
+TGT_LDLIBS	:= $(LIBS) $(OPENSSL_LIBS)
+TGT_LDFLAGS	:= $(LDFLAGS) $(OPENSSL_FLAGS)
+
+TGT_PREREQS	:= libfreeradius-tls.a libfreeradius-util.a libfreeradius-server.a
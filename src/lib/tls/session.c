@@ -39,6 +39,12 @@
 #include <openssl/x509v3.h>
 #include <ctype.h>
 
+#ifdef HAVE_STDATOMIC_H
+#  include <stdatomic.h>
+#else
+#  include <freeradius-devel/util/stdatomic.h>
+#endif
+
 #include "attrs.h"
 #include "base.h"
 #include "missing.h"
@@ -1317,7 +1323,10 @@ static void fr_tls_session_alert_send(REQUEST *request, fr_tls_session_t *sessio
  * @param session The current TLS session.
  * @return
  *	- -1 on error.
- *	- 0 on success.
+ *	- 1 on success.
+ *	- 2 if a private key operation is pending.  Wait for the fd
+ *	  returned by #fr_tls_offload_fd to become readable, then call
+ *	  this function again.
  */
 int fr_tls_session_handshake(REQUEST *request, fr_tls_session_t *session)
 {
@@ -1387,6 +1396,19 @@ int fr_tls_session_handshake(REQUEST *request, fr_tls_session_t *session)
 		goto finish;
 	}
 
+	/*
+	 *	A private key operation is being performed by
+	 *	the offload pool.  The caller should wait for
+	 *	it to complete, then call us again to resume
+	 *	the handshake where it left off.
+	 */
+	session->async_pending = (SSL_get_error(session->ssl, ret) == SSL_ERROR_WANT_ASYNC);
+	if (session->async_pending) {
+		RDEBUG2("Handshake paused waiting for private key operation");
+		ret = 2;
+		goto finish;
+	}
+
 	/*
 	 *	Returns 0 if we can continue processing the handshake
 	 *	Returns -1 if we encountered a fatal error.
@@ -1490,6 +1512,8 @@ int fr_tls_session_handshake(REQUEST *request, fr_tls_session_t *session)
 			 */
 			MEM(pair_update_request(&vp, attr_eap_session_resumed) >= 0);
 			vp->vp_bool = true;
+
+			fr_tls_ticket_state_restore(request, session);
 		}
 	}
 
@@ -1544,6 +1568,12 @@ finish:
 static int _fr_tls_session_free(fr_tls_session_t *session)
 {
 	if (session->ssl) {
+		/*
+		 *	SSL_free() won't free a job that's
+		 *	waiting for the offload pool.
+		 */
+		fr_tls_offload_cancel(session);
+
 		SSL_set_quiet_shutdown(session->ssl, 1);
 		SSL_shutdown(session->ssl);
 		SSL_free(session->ssl);
@@ -1568,6 +1598,29 @@ static void session_init(fr_tls_session_t *session)
 	session->opaque = NULL;
 }
 
+/** Return the SSL_CTX the calling thread should create sessions from
+ *
+ * Each thread is assigned a slot the first time it creates a session, and
+ * always uses the same context after that.  As there are at least as many
+ * contexts as threads, workers never share a context, so they don't contend
+ * on the locks OpenSSL takes on the SSL_CTX (session cache, reference counts,
+ * ex data).
+ *
+ * @param[in] conf	to select a context from.
+ * @return The context for this thread.
+ */
+static inline SSL_CTX *tls_session_thread_ctx(fr_tls_conf_t const *conf)
+{
+	static atomic_uint_fast32_t	slot_next;
+	static _Thread_local uint32_t	slot;		/* 0 means unassigned */
+
+	if (conf->ctx_count == 1) return conf->ctx[0];
+
+	if (!slot) slot = atomic_fetch_add_explicit(&slot_next, 1, memory_order_relaxed) + 1;
+
+	return conf->ctx[(slot - 1) % conf->ctx_count];
+}
+
 /** Create a new client TLS session
  *
  * Configures a new client TLS session, configuring options, setting callbacks etc...
@@ -1591,7 +1644,7 @@ fr_tls_session_t *fr_tls_session_init_client(TALLOC_CTX *ctx, fr_tls_conf_t *con
 
 	talloc_set_destructor(session, _fr_tls_session_free);
 
-	session->ctx = conf->ctx[(conf->ctx_count == 1) ? 0 : conf->ctx_next++ % conf->ctx_count];	/* mutex not needed */
+	session->ctx = tls_session_thread_ctx(conf);
 	fr_assert(session->ctx);
 
 	session->ssl = SSL_new(session->ctx);
@@ -1665,7 +1718,7 @@ fr_tls_session_t *fr_tls_session_init_server(TALLOC_CTX *ctx, fr_tls_conf_t *con
 
 	RDEBUG2("Initiating new TLS session");
 
-	ssl_ctx = conf->ctx[(conf->ctx_count == 1) ? 0 : conf->ctx_next++ % conf->ctx_count];	/* mutex not needed */
+	ssl_ctx = tls_session_thread_ctx(conf);
 	fr_assert(ssl_ctx);
 
 	new_tls = SSL_new(ssl_ctx);
@@ -1839,7 +1892,7 @@ fr_tls_session_t *fr_tls_session_init_server(TALLOC_CTX *ctx, fr_tls_conf_t *con
 		session->mtu = vp->vp_uint32;
 	}
 
-	if (conf->session_cache_server) session->allow_session_resumption = true; /* otherwise it's false */
+	if (conf->session_cache_server || conf->session_ticket) session->allow_session_resumption = true; /* otherwise it's false */
 
 	fr_tls_session_request_unbind(session->ssl);
 
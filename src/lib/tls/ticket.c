@@ -0,0 +1,632 @@
+/*
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ */
+
+/**
+ * $Id$
+ *
+ * @file tls/ticket.c
+ * @brief Stateless session resumption using RFC 5077 / RFC 8446 session tickets
+ *
+ * Tickets let a supplicant resume without the server performing a full
+ * handshake, and without a round trip through the cache virtual server.
+ *
+ * The keys used to protect tickets are shared by every SSL_CTX created
+ * from the same #fr_tls_conf_t, so a ticket issued by one worker can be
+ * decrypted by any other.  Keys are either generated at startup and
+ * rotated periodically, or loaded from a file so that multiple servers
+ * can resume each other's sessions.
+ *
+ * Tunnelled methods skip inner authentication when a session is resumed,
+ * so a ticket must never be issued before inner authentication has
+ * completed.  We therefore only support tickets with TLS 1.3, where the
+ * NewSessionTicket message can be sent at any point after the handshake.
+ * The method calls #fr_tls_ticket_issue once the inner method succeeds,
+ * and the ticket is marked as authorised.  Tickets without that mark are
+ * ignored when presented.  EAP-TLS has no inner method, so it issues
+ * a ticket once the client certificate has been accepted.
+ *
+ * A resumed session skips the cache virtual server, so the ticket also
+ * carries the session-state list, which is restored to the request once
+ * the session has been resumed.
+ *
+ * @copyright 2020 The FreeRADIUS server project
+ */
+RCSID("$Id$")
+USES_APPLE_DEPRECATED_API	/* OpenSSL API has been deprecated by Apple */
+
+#ifdef WITH_TLS
+#define LOG_PREFIX "tls - ticket - "
+
+#include <freeradius-devel/internal/internal.h>
+#include <freeradius-devel/server/base.h>
+#include <freeradius-devel/util/debug.h>
+#include <freeradius-devel/util/syserror.h>
+
+#include <openssl/rand.h>
+
+#include "attrs.h"
+#include "base.h"
+#include "missing.h"
+
+#if OPENSSL_VERSION_NUMBER >= 0x30000000L
+#include <openssl/core_names.h>
+
+#define TICKET_KEY_NAME_LEN	16
+#define TICKET_KEY_HMAC_LEN	32
+#define TICKET_KEY_AES_LEN	32
+
+/** Size of a key record in ticket_key_file
+ *
+ * This matches the layout used by other TLS servers (name, HMAC key, AES key),
+ * so key files can be shared with, or generated by, existing tooling.
+ */
+#define TICKET_KEY_RECORD_LEN	(TICKET_KEY_NAME_LEN + TICKET_KEY_HMAC_LEN + TICKET_KEY_AES_LEN)
+
+/** Marker stored in the ticket once the session has been authorised
+ *
+ */
+#define TICKET_AUTHORISED	0x01
+
+/** Maximum size of the app data in a ticket
+ *
+ * Tickets are sent in a single handshake message, so session-state
+ * which won't fit is left out.
+ */
+#define TICKET_APPDATA_MAX	8192
+
+typedef struct {
+	uint8_t			name[TICKET_KEY_NAME_LEN];	//!< Identifies the key used to protect a ticket.
+	uint8_t			hmac_key[TICKET_KEY_HMAC_LEN];	//!< Authenticates the ticket.
+	uint8_t			aes_key[TICKET_KEY_AES_LEN];	//!< Encrypts the ticket.
+	time_t			created;			//!< When the key was generated.
+} tls_ticket_key_t;
+
+struct fr_tls_ticket_keys_s {
+	pthread_mutex_t		mutex;				//!< Keys are shared by all workers.
+
+	tls_ticket_key_t	key[FR_TLS_TICKET_KEYS_MAX];	//!< key[0] encrypts new tickets, all
+								///< keys may be used to decrypt them.
+	unsigned int		num;				//!< Number of keys in use.
+
+	uint32_t		rotation;			//!< How often a new key is generated.
+								///< 0 if keys were loaded from a file.
+};
+
+static int _tls_ticket_keys_free(fr_tls_ticket_keys_t *keys)
+{
+	pthread_mutex_destroy(&keys->mutex);
+	OPENSSL_cleanse(keys->key, sizeof(keys->key));
+
+	return 0;
+}
+
+/** Generate a new key and make it the one used for encrypting new tickets
+ *
+ * @param[in] keys	to add the new key to.
+ * @param[in] now	The current time.
+ * @return
+ *	- 0 on success.
+ *	- -1 if we couldn't get enough random data.
+ */
+static int tls_ticket_keys_rotate(fr_tls_ticket_keys_t *keys, time_t now)
+{
+	tls_ticket_key_t *key;
+
+	if (keys->num == FR_TLS_TICKET_KEYS_MAX) keys->num--;
+	memmove(&keys->key[1], &keys->key[0], sizeof(keys->key[0]) * keys->num);
+
+	key = &keys->key[0];
+	if ((RAND_bytes(key->name, sizeof(key->name)) != 1) ||
+	    (RAND_bytes(key->hmac_key, sizeof(key->hmac_key)) != 1) ||
+	    (RAND_bytes(key->aes_key, sizeof(key->aes_key)) != 1)) {
+		memmove(&keys->key[0], &keys->key[1], sizeof(keys->key[0]) * keys->num);
+		return -1;
+	}
+	key->created = now;
+	keys->num++;
+
+	return 0;
+}
+
+/** Load ticket keys from a file
+ *
+ * The file contains one or more 80 byte records.  The first record is
+ * used to encrypt new tickets, the remainder are only used to decrypt
+ * tickets issued before the file was last changed.
+ *
+ * @param[in] keys	to populate.
+ * @param[in] file	to read keys from.
+ * @return
+ *	- 0 on success.
+ *	- -1 on failure.
+ */
+static int tls_ticket_keys_load(fr_tls_ticket_keys_t *keys, char const *file)
+{
+	FILE		*fp;
+	uint8_t		buff[TICKET_KEY_RECORD_LEN * FR_TLS_TICKET_KEYS_MAX + 1];
+	size_t		len;
+	unsigned int	i;
+
+	fp = fopen(file, "r");
+	if (!fp) {
+		ERROR("Failed opening ticket_key_file \"%s\": %s", file, fr_syserror(errno));
+		return -1;
+	}
+	len = fread(buff, 1, sizeof(buff), fp);
+	fclose(fp);
+
+	if ((len == 0) || (len % TICKET_KEY_RECORD_LEN) || (len > (sizeof(buff) - 1))) {
+		ERROR("ticket_key_file \"%s\" must contain between 1 and %u keys of %u bytes",
+		      file, FR_TLS_TICKET_KEYS_MAX, TICKET_KEY_RECORD_LEN);
+		OPENSSL_cleanse(buff, sizeof(buff));
+		return -1;
+	}
+
+	keys->num = len / TICKET_KEY_RECORD_LEN;
+	for (i = 0; i < keys->num; i++) {
+		uint8_t *p = buff + (i * TICKET_KEY_RECORD_LEN);
+
+		memcpy(keys->key[i].name, p, TICKET_KEY_NAME_LEN);
+		p += TICKET_KEY_NAME_LEN;
+		memcpy(keys->key[i].hmac_key, p, TICKET_KEY_HMAC_LEN);
+		p += TICKET_KEY_HMAC_LEN;
+		memcpy(keys->key[i].aes_key, p, TICKET_KEY_AES_LEN);
+	}
+	OPENSSL_cleanse(buff, sizeof(buff));
+
+	return 0;
+}
+
+/** Allocate the keys shared by all SSL_CTX created from a configuration
+ *
+ * @param[in] conf	to allocate keys for.  Keys are parented by the conf.
+ * @return
+ *	- 0 on success.
+ *	- -1 on failure.
+ */
+int fr_tls_ticket_keys_alloc(fr_tls_conf_t *conf)
+{
+	fr_tls_ticket_keys_t *keys;
+
+	MEM(keys = talloc_zero(conf, fr_tls_ticket_keys_t));
+	pthread_mutex_init(&keys->mutex, NULL);
+	talloc_set_destructor(keys, _tls_ticket_keys_free);
+
+	if (conf->session_ticket_key_file) {
+		if (tls_ticket_keys_load(keys, conf->session_ticket_key_file) < 0) {
+		error:
+			talloc_free(keys);
+			return -1;
+		}
+	} else {
+		/*
+		 *	By default rotate often enough that every ticket
+		 *	issued within the session lifetime can still be
+		 *	decrypted.
+		 */
+		keys->rotation = conf->session_ticket_key_rotation;
+		if (!keys->rotation) keys->rotation = conf->session_cache_lifetime / (FR_TLS_TICKET_KEYS_MAX - 1);
+		if (!keys->rotation) keys->rotation = 1;
+
+		if (tls_ticket_keys_rotate(keys, time(NULL)) < 0) {
+			ERROR("Failed generating ticket key");
+			goto error;
+		}
+	}
+
+	conf->ticket_keys = keys;
+
+	return 0;
+}
+
+/** Encrypt or decrypt a ticket using one of our shared keys
+ *
+ * @param[in] ssl	session the ticket is for.
+ * @param[in] key_name	Written to when encrypting, read when decrypting.
+ * @param[in] iv	Written to when encrypting, read when decrypting.
+ * @param[in] ctx	Cipher to initialise.
+ * @param[in] hctx	MAC to initialise.
+ * @param[in] enc	1 if encrypting, 0 if decrypting.
+ * @return
+ *	- 2 if the ticket was decrypted with an old key, and should be renewed.
+ *	- 1 on success.
+ *	- 0 if the key used to encrypt the ticket is unknown.
+ *	- -1 on error.
+ */
+static int tls_ticket_key_cb(SSL *ssl, unsigned char key_name[16], unsigned char iv[EVP_MAX_IV_LENGTH],
+			     EVP_CIPHER_CTX *ctx, EVP_MAC_CTX *hctx, int enc)
+{
+	fr_tls_conf_t const	*conf = SSL_CTX_get_app_data(SSL_get_SSL_CTX(ssl));
+	fr_tls_ticket_keys_t	*keys = conf->ticket_keys;
+	tls_ticket_key_t	key;
+	OSSL_PARAM		params[3];
+	unsigned int		i;
+	int			ret = 1;
+
+	pthread_mutex_lock(&keys->mutex);
+	if (enc) {
+		time_t now = time(NULL);
+
+		if (keys->rotation && ((now - keys->key[0].created) >= (time_t)keys->rotation) &&
+		    (tls_ticket_keys_rotate(keys, now) < 0)) {
+			pthread_mutex_unlock(&keys->mutex);
+			ERROR("Failed rotating ticket key");
+			return -1;
+		}
+		key = keys->key[0];
+	} else {
+		for (i = 0; i < keys->num; i++) {
+			if (memcmp(key_name, keys->key[i].name, TICKET_KEY_NAME_LEN) == 0) break;
+		}
+		if (i == keys->num) {
+			pthread_mutex_unlock(&keys->mutex);
+			return 0;
+		}
+		key = keys->key[i];
+		if (i > 0) ret = 2;
+	}
+	pthread_mutex_unlock(&keys->mutex);
+
+	if (enc) {
+		memcpy(key_name, key.name, TICKET_KEY_NAME_LEN);
+		if ((RAND_bytes(iv, EVP_CIPHER_iv_length(EVP_aes_256_cbc())) != 1) ||
+		    (EVP_EncryptInit_ex(ctx, EVP_aes_256_cbc(), NULL, key.aes_key, iv) != 1)) {
+		error:
+			OPENSSL_cleanse(&key, sizeof(key));
+			return -1;
+		}
+	} else if (EVP_DecryptInit_ex(ctx, EVP_aes_256_cbc(), NULL, key.aes_key, iv) != 1) {
+		goto error;
+	}
+
+	params[0] = OSSL_PARAM_construct_octet_string(OSSL_MAC_PARAM_KEY, key.hmac_key, sizeof(key.hmac_key));
+	params[1] = OSSL_PARAM_construct_utf8_string(OSSL_MAC_PARAM_DIGEST, "sha256", 0);
+	params[2] = OSSL_PARAM_construct_end();
+	if (EVP_MAC_CTX_set_params(hctx, params) != 1) goto error;
+
+	OPENSSL_cleanse(&key, sizeof(key));
+
+	return ret;
+}
+
+/** Add the session-state list to a ticket's app data
+ *
+ * Each pair is preceded by one byte, which is zero if the pair is from
+ * the request's dictionary, or one if it's from the internal dictionary.
+ * Pairs from other dictionaries, or which would make the ticket too
+ * large, are left out.
+ *
+ * @param[in] tb	to append pairs to.
+ * @param[in] request	whose session-state should be serialised.
+ * @return
+ *	- 0 on success.
+ *	- -1 on failure.
+ */
+static int tls_ticket_state_encode(fr_talloc_buff_t *tb, REQUEST *request)
+{
+	fr_cursor_t	cursor;
+	VALUE_PAIR	*vp;
+	uint8_t		buff[1 + 4096];
+
+	for (vp = fr_cursor_init(&cursor, &request->state);
+	     vp;
+	     vp = fr_cursor_next(&cursor)) {
+		fr_cursor_t	pair_cursor;
+		VALUE_PAIR	*head = vp;
+		fr_dict_t const	*dict = fr_dict_by_da(vp->da);
+		ssize_t		slen;
+
+		/*
+		 *	The ticket is the session data.
+		 */
+		if (vp->da == attr_tls_session_data) continue;
+
+		if (dict == request->dict) {
+			buff[0] = 0;
+		} else if (dict == fr_dict_internal()) {
+			buff[0] = 1;
+		} else {
+			RWDEBUG("Not adding &session-state:%s to session ticket, it's from another protocol",
+				vp->da->name);
+			continue;
+		}
+
+		fr_cursor_init(&pair_cursor, &head);
+		slen = fr_internal_encode_pair(buff + 1, sizeof(buff) - 1, &pair_cursor, NULL);
+		if (slen <= 0) {
+			RPWDEBUG("Not adding &session-state:%s to session ticket", vp->da->name);
+			continue;
+		}
+
+		if ((tb->used + 1 + slen) > TICKET_APPDATA_MAX) {
+			RWDEBUG("Not adding &session-state:%s to session ticket, the ticket would be too large",
+				vp->da->name);
+			continue;
+		}
+
+		if (talloc_buff_append(tb, buff, 1 + slen) < 0) return -1;
+	}
+
+	return 0;
+}
+
+/** Decode the session-state list from a ticket's app data
+ *
+ * @param[in] ctx	to allocate pairs in.
+ * @param[out] out	Where to write the pairs.
+ * @param[in] request	the ticket was presented in.
+ * @param[in] data	app data, after the authorised marker.
+ * @param[in] data_len	Length of the app data.
+ * @return
+ *	- 0 on success.
+ *	- -1 if the app data is malformed.
+ */
+static int tls_ticket_state_decode(TALLOC_CTX *ctx, VALUE_PAIR **out, REQUEST *request,
+				   uint8_t const *data, size_t data_len)
+{
+	uint8_t const	*p = data, *end = data + data_len;
+	fr_cursor_t	cursor;
+
+	fr_cursor_init(&cursor, out);
+
+	while (p < end) {
+		fr_dict_t const	*dict;
+		ssize_t		slen;
+
+		switch (p[0]) {
+		case 0:
+			dict = request->dict;
+			break;
+
+		case 1:
+			dict = fr_dict_internal();
+			break;
+
+		default:
+			fr_strerror_printf("Invalid dictionary %u in session ticket", p[0]);
+		error:
+			fr_pair_list_free(out);
+			return -1;
+		}
+		p++;
+
+		slen = fr_internal_decode_pair(ctx, &cursor, dict, p, end - p, NULL);
+		if (slen <= 0) goto error;
+		p += slen;
+	}
+
+	return 0;
+}
+
+/** Record whether the session was authorised when the ticket was created
+ *
+ * If it was, the session-state list is added to the ticket as well.
+ */
+static int tls_ticket_gen_cb(SSL *ssl, UNUSED void *arg)
+{
+	fr_tls_session_t	*tls_session = SSL_get_ex_data(ssl, FR_TLS_EX_INDEX_TLS_SESSION);
+	REQUEST			*request = SSL_get_ex_data(ssl, FR_TLS_EX_INDEX_REQUEST);
+	fr_talloc_buff_t	tb;
+	int			ret;
+
+	if (!tls_session || !tls_session->ticket_authorised || !request) {
+		uint8_t unauthorised = 0;
+
+		return SSL_SESSION_set1_ticket_appdata(SSL_get_session(ssl), &unauthorised, sizeof(unauthorised));
+	}
+
+	if ((talloc_buff_init(NULL, &tb, 256) < 0) ||
+	    (talloc_buff_append_uint8(&tb, TICKET_AUTHORISED) < 0) ||
+	    (tls_ticket_state_encode(&tb, request) < 0)) {
+		RPERROR("Failed adding session-state to session ticket");
+		talloc_free(tb.buff);
+		return 0;
+	}
+
+	ret = SSL_SESSION_set1_ticket_appdata(SSL_get_session(ssl), tb.buff, tb.used);
+	talloc_free(tb.buff);
+
+	return ret;
+}
+
+/** Decide whether a ticket the client presented may be used for resumption
+ *
+ * If it may, the session-state list from the ticket is kept until the
+ * handshake completes, see #fr_tls_ticket_state_restore.
+ */
+static SSL_TICKET_RETURN tls_ticket_dec_cb(SSL *ssl, SSL_SESSION *sess,
+					   UNUSED unsigned char const *keyname, UNUSED size_t keyname_len,
+					   SSL_TICKET_STATUS status, UNUSED void *arg)
+{
+	fr_tls_session_t	*tls_session = SSL_get_ex_data(ssl, FR_TLS_EX_INDEX_TLS_SESSION);
+	REQUEST			*request = SSL_get_ex_data(ssl, FR_TLS_EX_INDEX_REQUEST);
+	uint8_t			*data;
+	size_t			len;
+
+	switch (status) {
+	case SSL_TICKET_SUCCESS:
+	case SSL_TICKET_SUCCESS_RENEW:
+		break;
+
+	default:
+		return SSL_TICKET_RETURN_IGNORE_RENEW;
+	}
+
+	if (!tls_session || !request || !tls_session->allow_session_resumption) return SSL_TICKET_RETURN_IGNORE;
+
+	/*
+	 *	Never resume a session which hadn't completed
+	 *	authentication when the ticket was issued.
+	 */
+	if ((SSL_SESSION_get0_ticket_appdata(sess, (void **)&data, &len) != 1) ||
+	    (len < 1) || (data[0] != TICKET_AUTHORISED)) return SSL_TICKET_RETURN_IGNORE;
+
+	fr_pair_list_free(&tls_session->ticket_state);
+	if (tls_ticket_state_decode(tls_session, &tls_session->ticket_state, request, data + 1, len - 1) < 0) {
+		RPWDEBUG("Ignoring session ticket");
+		return SSL_TICKET_RETURN_IGNORE;
+	}
+
+	return SSL_TICKET_RETURN_USE;
+}
+
+/** Does the client support TLS 1.3
+ *
+ */
+static bool tls_ticket_client_tls13(SSL *ssl)
+{
+	unsigned char const	*p, *end;
+	size_t			len;
+
+	if (SSL_client_hello_get0_ext(ssl, TLSEXT_TYPE_supported_versions, &p, &len) != 1) return false;
+	if ((len < 1) || (p[0] != (len - 1))) return false;
+
+	for (end = p + len, p++; (p + 1) < end; p += 2) {
+		if (((p[0] << 8) | p[1]) == TLS1_3_VERSION) return true;
+	}
+
+	return false;
+}
+
+/** Only allow stateless tickets if we can delay issuing them until the session is authorised
+ *
+ * With TLS 1.2 tickets can only be sent during the handshake, and
+ * methods which don't set allow_session_ticket have no opportunity to
+ * send one after authentication completes.  In those cases we fall back
+ * to whatever resumption the session cache provides.
+ */
+static int tls_ticket_client_hello_cb(SSL *ssl, UNUSED int *al, void *arg)
+{
+	fr_tls_conf_t const	*conf = talloc_get_type_abort_const(arg, fr_tls_conf_t);
+	fr_tls_session_t	*tls_session = SSL_get_ex_data(ssl, FR_TLS_EX_INDEX_TLS_SESSION);
+
+	if (tls_session && tls_session->allow_session_ticket &&
+	    ((conf->tls_max_version == (float) 0.0) || (conf->tls_max_version >= (float) 1.3)) &&
+	    tls_ticket_client_tls13(ssl)) return SSL_CLIENT_HELLO_SUCCESS;
+
+	SSL_set_options(ssl, SSL_OP_NO_TICKET);
+	SSL_set_num_tickets(ssl, conf->session_cache_server ? 1 : 0);
+
+	return SSL_CLIENT_HELLO_SUCCESS;
+}
+
+/** Sets callbacks on a SSL_CTX to enable stateless session resumption
+ *
+ * @param[in] ctx	to modify.
+ * @param[in] conf	the ctx was created from.
+ */
+void fr_tls_ticket_init(SSL_CTX *ctx, fr_tls_conf_t const *conf)
+{
+	void *arg;
+
+	fr_assert(conf->ticket_keys);
+
+	SSL_CTX_clear_options(ctx, SSL_OP_NO_TICKET);
+	SSL_CTX_set_timeout(ctx, conf->session_cache_lifetime);
+
+	/*
+	 *	Tickets are issued explicitly once the session
+	 *	has been authorised.
+	 */
+	SSL_CTX_set_num_tickets(ctx, 0);
+
+	SSL_CTX_set_tlsext_ticket_key_evp_cb(ctx, tls_ticket_key_cb);
+	SSL_CTX_set_session_ticket_cb(ctx, tls_ticket_gen_cb, tls_ticket_dec_cb, NULL);
+
+	memcpy(&arg, &conf, sizeof(arg));
+	SSL_CTX_set_client_hello_cb(ctx, tls_ticket_client_hello_cb, arg);
+}
+
+/** Send the client a ticket it can use to resume this session
+ *
+ * Must only be called once the session has been fully authenticated.
+ * The ticket is sent along with the next record written to the client.
+ *
+ * @param[in] request		The current request.
+ * @param[in] tls_session	to issue a ticket for.
+ * @return
+ *	- 1 if a ticket will be sent.
+ *	- 0 if tickets aren't allowed for this session.
+ *	- -1 on error.
+ */
+int fr_tls_ticket_issue(REQUEST *request, fr_tls_session_t *tls_session)
+{
+	fr_tls_conf_t const	*conf = SSL_CTX_get_app_data(tls_session->ctx);
+	VALUE_PAIR		*vp;
+
+	if (!conf->session_ticket || !tls_session->allow_session_ticket ||
+	    !tls_session->allow_session_resumption || (SSL_version(tls_session->ssl) < TLS1_3_VERSION)) return 0;
+
+	vp = fr_pair_find_by_da(request->control, attr_allow_session_resumption, TAG_ANY);
+	if (vp && (vp->vp_uint32 == 0)) {
+		RDEBUG2("&control:Allow-Session-Resumption == no, not issuing session ticket");
+		return 0;
+	}
+
+	tls_session->ticket_authorised = true;
+	if (SSL_new_session_ticket(tls_session->ssl) != 1) {
+		fr_tls_log_error(request, "Failed issuing session ticket");
+		return -1;
+	}
+	RDEBUG2("Issuing session ticket");
+
+	return 1;
+}
+
+/** Add the session-state list from a ticket to the request
+ *
+ * Called once the handshake has completed, and only if the session was
+ * resumed, so pairs from tickets which OpenSSL ended up rejecting are
+ * never used.
+ *
+ * @param[in] request		The current request.
+ * @param[in] tls_session	which was resumed.
+ */
+void fr_tls_ticket_state_restore(REQUEST *request, fr_tls_session_t *tls_session)
+{
+	VALUE_PAIR *vps = NULL;
+
+	if (!tls_session->ticket_state) return;
+
+	MEM(fr_pair_list_copy(request->state_ctx, &vps, tls_session->ticket_state) >= 0);
+	fr_pair_list_free(&tls_session->ticket_state);
+
+	RDEBUG2("Restoring &session-state from session ticket");
+	log_request_pair_list(L_DBG_LVL_2, request, vps, "&session-state:");
+
+	fr_pair_add(&request->state, vps);
+}
+#else
+int fr_tls_ticket_keys_alloc(UNUSED fr_tls_conf_t *conf)
+{
+	ERROR("Session tickets require OpenSSL >= 3.0.0");
+	return -1;
+}
+
+void fr_tls_ticket_init(UNUSED SSL_CTX *ctx, UNUSED fr_tls_conf_t const *conf)
+{
+}
+
+int fr_tls_ticket_issue(UNUSED REQUEST *request, UNUSED fr_tls_session_t *tls_session)
+{
+	return 0;
+}
+
+void fr_tls_ticket_state_restore(UNUSED REQUEST *request, UNUSED fr_tls_session_t *tls_session)
+{
+}
+#endif
+#endif /* WITH_TLS */
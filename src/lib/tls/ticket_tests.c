@@ -0,0 +1,478 @@
+#include <freeradius-devel/util/acutest.h>
+
+#include "ticket.c"
+
+#if defined(WITH_TLS) && (OPENSSL_VERSION_NUMBER >= 0x30000000L)
+#include <openssl/x509.h>
+
+#ifndef TEST_DICT_DIR
+#  define TEST_DICT_DIR "share/dictionary"
+#endif
+
+static TALLOC_CTX	*test_ctx;
+static fr_dict_t	*test_dict_internal;
+static fr_dict_t	*test_dict_radius;
+static EVP_PKEY		*test_pkey;
+static X509		*test_cert;
+
+/** Load the dictionaries, and generate a self-signed certificate for the server
+ *
+ * Uses $FR_DICTIONARY_DIR if set, otherwise the dictionaries in the
+ * source tree, so the tests must be run from the top directory.
+ */
+static void test_init(void)
+{
+	char const	*dict_dir;
+	X509_NAME	*name;
+
+	if (test_ctx) return;
+
+	dict_dir = getenv("FR_DICTIONARY_DIR");
+	if (!dict_dir) dict_dir = TEST_DICT_DIR;
+
+	test_ctx = talloc_autofree_context();
+
+	if (!fr_dict_global_ctx_init(test_ctx, dict_dir) ||
+	    (fr_dict_internal_afrom_file(&test_dict_internal, FR_DICTIONARY_INTERNAL_DIR) < 0) ||
+	    (fr_dict_protocol_afrom_file(&test_dict_radius, "radius", NULL) < 0) ||
+	    (fr_tls_dict_init() < 0)) {
+		fr_perror("ticket_tests");
+		fr_exit_now(EXIT_FAILURE);
+	}
+
+	MEM(test_pkey = EVP_EC_gen("P-256"));
+	MEM(test_cert = X509_new());
+	X509_set_version(test_cert, 2);
+	ASN1_INTEGER_set(X509_get_serialNumber(test_cert), 1);
+	X509_gmtime_adj(X509_getm_notBefore(test_cert), 0);
+	X509_gmtime_adj(X509_getm_notAfter(test_cert), 3600);
+	X509_set_pubkey(test_cert, test_pkey);
+	name = X509_get_subject_name(test_cert);
+	X509_NAME_add_entry_by_txt(name, "CN", MBSTRING_ASC, (unsigned char const *) "ticket test", -1, -1, 0);
+	X509_set_issuer_name(test_cert, name);
+	if (X509_sign(test_cert, test_pkey, EVP_sha256()) <= 0) {
+		fr_tls_log_error(NULL, "Failed signing test certificate");
+		fr_exit_now(EXIT_FAILURE);
+	}
+}
+
+/** Allocate a configuration with tickets enabled
+ *
+ * @param[in] ctx	to allocate the configuration in.
+ * @param[in] key_file	to load ticket keys from.  NULL to generate them.
+ */
+static fr_tls_conf_t *test_conf_alloc(TALLOC_CTX *ctx, char const *key_file)
+{
+	fr_tls_conf_t	*conf;
+
+	MEM(conf = talloc_zero(ctx, fr_tls_conf_t));
+	conf->session_ticket = true;
+	conf->session_ticket_key_file = key_file;
+	conf->session_cache_lifetime = 3600;
+
+	if (fr_tls_ticket_keys_alloc(conf) < 0) {
+		talloc_free(conf);
+		return NULL;
+	}
+
+	return conf;
+}
+
+static int _test_ctx_free(SSL_CTX **ctx)
+{
+	SSL_CTX_free(*ctx);
+
+	return 0;
+}
+
+/** Create a TLS 1.3 server context, which issues tickets the way the server does
+ *
+ */
+static SSL_CTX *test_server_ctx(fr_tls_conf_t *conf)
+{
+	SSL_CTX		*ctx, **ctx_p;
+	void		*app_data;
+
+	MEM(ctx = SSL_CTX_new(TLS_server_method()));
+	SSL_CTX_set_min_proto_version(ctx, TLS1_3_VERSION);
+	SSL_CTX_set_session_cache_mode(ctx, SSL_SESS_CACHE_OFF);
+	TEST_CHECK(SSL_CTX_use_certificate(ctx, test_cert) == 1);
+	TEST_CHECK(SSL_CTX_use_PrivateKey(ctx, test_pkey) == 1);
+
+	memcpy(&app_data, &conf, sizeof(app_data));
+	SSL_CTX_set_app_data(ctx, app_data);
+	fr_tls_ticket_init(ctx, conf);
+
+	/*
+	 *	Freed along with the configuration.
+	 */
+	MEM(ctx_p = talloc(conf, SSL_CTX *));
+	*ctx_p = ctx;
+	talloc_set_destructor(ctx_p, _test_ctx_free);
+
+	return ctx;
+}
+
+static SSL_SESSION *test_client_session;
+
+/** Keep the last session (and ticket) the client received
+ *
+ */
+static int test_client_new_session(UNUSED SSL *ssl, SSL_SESSION *sess)
+{
+	if (test_client_session) SSL_SESSION_free(test_client_session);
+	test_client_session = sess;
+
+	return 1;
+}
+
+static SSL_CTX *test_client_ctx(void)
+{
+	SSL_CTX *ctx;
+
+	MEM(ctx = SSL_CTX_new(TLS_client_method()));
+	SSL_CTX_set_min_proto_version(ctx, TLS1_3_VERSION);
+	SSL_CTX_set_verify(ctx, SSL_VERIFY_NONE, NULL);
+	SSL_CTX_set_session_cache_mode(ctx, SSL_SESS_CACHE_CLIENT | SSL_SESS_CACHE_NO_INTERNAL_STORE);
+	SSL_CTX_sess_set_new_cb(ctx, test_client_new_session);
+
+	return ctx;
+}
+
+typedef struct {
+	SSL			*client;
+	SSL			*server;
+	fr_tls_session_t	*tls_session;
+	REQUEST			*request;
+} test_conn_t;
+
+static int _test_conn_free(test_conn_t *conn)
+{
+	SSL_free(conn->client);
+	SSL_free(conn->server);
+
+	return 0;
+}
+
+/** Perform a handshake between a client and server over a BIO pair
+ *
+ * @param[in] ctx		to allocate the connection in.
+ * @param[in] server_ctx	to create the server's SSL from.
+ * @param[in] client_ctx	to create the client's SSL from.
+ * @param[in] resume		Session for the client to resume.  May be NULL.
+ * @return the connection, with the handshake completed.
+ */
+static test_conn_t *test_connect(TALLOC_CTX *ctx, SSL_CTX *server_ctx, SSL_CTX *client_ctx, SSL_SESSION *resume)
+{
+	test_conn_t	*conn;
+	BIO		*client_bio, *server_bio;
+	int		i, client_ret = 0, server_ret = 0;
+
+	MEM(conn = talloc_zero(ctx, test_conn_t));
+	MEM(conn->client = SSL_new(client_ctx));
+	MEM(conn->server = SSL_new(server_ctx));
+	talloc_set_destructor(conn, _test_conn_free);
+
+	TEST_CHECK(BIO_new_bio_pair(&client_bio, 0, &server_bio, 0) == 1);
+	SSL_set_bio(conn->client, client_bio, client_bio);
+	SSL_set_bio(conn->server, server_bio, server_bio);
+	SSL_set_connect_state(conn->client);
+	SSL_set_accept_state(conn->server);
+	if (resume) TEST_CHECK(SSL_set_session(conn->client, resume) == 1);
+
+	MEM(conn->request = request_alloc(conn));
+	conn->request->dict = test_dict_radius;
+
+	MEM(conn->tls_session = talloc_zero(conn, fr_tls_session_t));
+	conn->tls_session->ctx = server_ctx;
+	conn->tls_session->ssl = conn->server;
+	conn->tls_session->allow_session_resumption = true;
+	conn->tls_session->allow_session_ticket = true;
+
+	SSL_set_ex_data(conn->server, FR_TLS_EX_INDEX_TLS_SESSION, conn->tls_session);
+	SSL_set_ex_data(conn->server, FR_TLS_EX_INDEX_REQUEST, conn->request);
+
+	for (i = 0; (i < 10) && ((client_ret != 1) || (server_ret != 1)); i++) {
+		if (client_ret != 1) client_ret = SSL_do_handshake(conn->client);
+		if (server_ret != 1) server_ret = SSL_do_handshake(conn->server);
+	}
+	TEST_CHECK(client_ret == 1);
+	TEST_CHECK(server_ret == 1);
+	TEST_MSG("Handshake failed, client %i, server %i", client_ret, server_ret);
+
+	return conn;
+}
+
+/** Send the client a ticket, and make sure it has been received
+ *
+ * @param[in] conn		to send the ticket on.
+ * @param[in] authorised	Whether to issue the ticket as the server does
+ *				after authentication, or issue it beforehand.
+ */
+static void test_ticket_send(test_conn_t *conn, bool authorised)
+{
+	uint8_t		byte = 0;
+
+	if (authorised) {
+		TEST_CHECK(fr_tls_ticket_issue(conn->request, conn->tls_session) == 1);
+	} else {
+		TEST_CHECK(SSL_new_session_ticket(conn->server) == 1);
+	}
+
+	/*
+	 *	The ticket is written ahead of the next
+	 *	application data.
+	 */
+	TEST_CHECK(SSL_write(conn->server, &byte, sizeof(byte)) == 1);
+	TEST_CHECK(SSL_read(conn->client, &byte, sizeof(byte)) == 1);
+}
+
+/** Write key records to a temporary file
+ *
+ */
+static char *test_key_file(TALLOC_CTX *ctx, uint8_t const *data, size_t len)
+{
+	char	*file;
+	int	fd;
+
+	MEM(file = talloc_typed_strdup(ctx, "/tmp/ticket_tests.XXXXXX"));
+	fd = mkstemp(file);
+	TEST_CHECK(fd >= 0);
+	if (len) TEST_CHECK(write(fd, data, len) == (ssize_t) len);
+	close(fd);
+
+	return file;
+}
+
+static void test_issue(void)
+{
+	TALLOC_CTX	*ctx = talloc_new(NULL);
+	fr_tls_conf_t	*conf;
+	SSL_CTX		*server_ctx, *client_ctx;
+	test_conn_t	*conn;
+	VALUE_PAIR	*vp;
+
+	test_init();
+
+	conf = test_conf_alloc(ctx, NULL);
+	TEST_CHECK(conf != NULL);
+	server_ctx = test_server_ctx(conf);
+	client_ctx = test_client_ctx();
+
+	TEST_CASE("No ticket is sent during the handshake");
+	conn = test_connect(ctx, server_ctx, client_ctx, NULL);
+	TEST_CHECK(test_client_session == NULL);
+
+	TEST_CASE("Ticket is issued after authentication");
+	MEM(fr_pair_add_by_da(conn->request->state_ctx, &vp, &conn->request->state, attr_eap_session_resumed) >= 0);
+	vp->vp_bool = false;
+	MEM(fr_pair_add_by_da(conn->request->state_ctx, &vp, &conn->request->state,
+			      fr_dict_attr_by_name(test_dict_radius, "User-Name")) >= 0);
+	fr_pair_value_strdup(vp, "bob");
+	test_ticket_send(conn, true);
+	TEST_CHECK(test_client_session != NULL);
+	TEST_CHECK(SSL_SESSION_has_ticket(test_client_session) == 1);
+	talloc_free(conn);
+
+	TEST_CASE("Ticket resumes the session");
+	conn = test_connect(ctx, server_ctx, client_ctx, test_client_session);
+	TEST_CHECK(SSL_session_reused(conn->server) == 1);
+
+	TEST_CASE("session-state is restored from the ticket");
+	TEST_CHECK(conn->tls_session->ticket_state != NULL);
+	fr_tls_ticket_state_restore(conn->request, conn->tls_session);
+	TEST_CHECK(conn->tls_session->ticket_state == NULL);
+	TEST_CHECK(fr_pair_find_by_da(conn->request->state, attr_eap_session_resumed, TAG_ANY) != NULL);
+	vp = fr_pair_find_by_da(conn->request->state, fr_dict_attr_by_name(test_dict_radius, "User-Name"), TAG_ANY);
+	TEST_CHECK(vp && (strcmp(vp->vp_strvalue, "bob") == 0));
+	talloc_free(conn);
+
+	TEST_CASE("Tickets aren't issued when resumption is disabled");
+	conn = test_connect(ctx, server_ctx, client_ctx, NULL);
+	conn->tls_session->allow_session_resumption = false;
+	TEST_CHECK(fr_tls_ticket_issue(conn->request, conn->tls_session) == 0);
+	TEST_CHECK(!conn->tls_session->ticket_authorised);
+	talloc_free(conn);
+
+	SSL_SESSION_free(test_client_session);
+	test_client_session = NULL;
+	SSL_CTX_free(client_ctx);
+	talloc_free(ctx);
+}
+
+static void test_unauthorised(void)
+{
+	TALLOC_CTX	*ctx = talloc_new(NULL);
+	fr_tls_conf_t	*conf;
+	SSL_CTX		*server_ctx, *client_ctx;
+	test_conn_t	*conn;
+
+	test_init();
+
+	conf = test_conf_alloc(ctx, NULL);
+	TEST_CHECK(conf != NULL);
+	server_ctx = test_server_ctx(conf);
+	client_ctx = test_client_ctx();
+
+	TEST_CASE("Ticket issued before authentication");
+	conn = test_connect(ctx, server_ctx, client_ctx, NULL);
+	test_ticket_send(conn, false);
+	TEST_CHECK(test_client_session != NULL);
+	talloc_free(conn);
+
+	TEST_CASE("Ticket without the authorised marker doesn't resume the session");
+	conn = test_connect(ctx, server_ctx, client_ctx, test_client_session);
+	TEST_CHECK(SSL_session_reused(conn->server) == 0);
+	TEST_CHECK(conn->tls_session->ticket_state == NULL);
+	talloc_free(conn);
+
+	SSL_SESSION_free(test_client_session);
+	test_client_session = NULL;
+	SSL_CTX_free(client_ctx);
+	talloc_free(ctx);
+}
+
+static void test_rotation(void)
+{
+	TALLOC_CTX	*ctx = talloc_new(NULL);
+	fr_tls_conf_t	*conf;
+	SSL_CTX		*server_ctx, *client_ctx;
+	test_conn_t	*conn;
+	uint8_t		name[TICKET_KEY_NAME_LEN];
+	unsigned int	i;
+
+	test_init();
+
+	conf = test_conf_alloc(ctx, NULL);
+	TEST_CHECK(conf != NULL);
+	server_ctx = test_server_ctx(conf);
+	client_ctx = test_client_ctx();
+
+	TEST_CASE("Default rotation keeps tickets valid for the session lifetime");
+	TEST_CHECK(conf->ticket_keys->rotation == (3600 / (FR_TLS_TICKET_KEYS_MAX - 1)));
+	TEST_CHECK(conf->ticket_keys->num == 1);
+
+	conn = test_connect(ctx, server_ctx, client_ctx, NULL);
+	test_ticket_send(conn, true);
+	talloc_free(conn);
+
+	TEST_CASE("New key is used once the rotation interval passes");
+	memcpy(name, conf->ticket_keys->key[0].name, sizeof(name));
+	conf->ticket_keys->key[0].created -= conf->ticket_keys->rotation;
+
+	conn = test_connect(ctx, server_ctx, client_ctx, NULL);
+	test_ticket_send(conn, true);
+	talloc_free(conn);
+	TEST_CHECK(conf->ticket_keys->num == 2);
+	TEST_CHECK(memcmp(conf->ticket_keys->key[1].name, name, sizeof(name)) == 0);
+	TEST_CHECK(memcmp(conf->ticket_keys->key[0].name, name, sizeof(name)) != 0);
+
+	TEST_CASE("Tickets from old keys are accepted until the key is discarded");
+	for (i = 2; i < FR_TLS_TICKET_KEYS_MAX; i++) {
+		TEST_CHECK(tls_ticket_keys_rotate(conf->ticket_keys, time(NULL)) == 0);
+	}
+	TEST_CHECK(conf->ticket_keys->num == FR_TLS_TICKET_KEYS_MAX);
+
+	conn = test_connect(ctx, server_ctx, client_ctx, test_client_session);
+	TEST_CHECK(SSL_session_reused(conn->server) == 1);
+	talloc_free(conn);
+
+	TEST_CASE("Tickets from discarded keys are rejected");
+	for (i = 0; i < FR_TLS_TICKET_KEYS_MAX; i++) {
+		TEST_CHECK(tls_ticket_keys_rotate(conf->ticket_keys, time(NULL)) == 0);
+	}
+	TEST_CHECK(conf->ticket_keys->num == FR_TLS_TICKET_KEYS_MAX);
+
+	conn = test_connect(ctx, server_ctx, client_ctx, test_client_session);
+	TEST_CHECK(SSL_session_reused(conn->server) == 0);
+	talloc_free(conn);
+
+	SSL_SESSION_free(test_client_session);
+	test_client_session = NULL;
+	SSL_CTX_free(client_ctx);
+	talloc_free(ctx);
+}
+
+static void test_key_file_load(void)
+{
+	TALLOC_CTX	*ctx = talloc_new(NULL);
+	uint8_t		keys[TICKET_KEY_RECORD_LEN * (FR_TLS_TICKET_KEYS_MAX + 1)];
+	char		*file;
+	fr_tls_conf_t	*conf, *other;
+	SSL_CTX		*client_ctx;
+	test_conn_t	*conn;
+
+	test_init();
+
+	TEST_CHECK(RAND_bytes(keys, sizeof(keys)) == 1);
+
+	TEST_CASE("Empty files are rejected");
+	file = test_key_file(ctx, keys, 0);
+	TEST_CHECK(test_conf_alloc(ctx, file) == NULL);
+	unlink(file);
+
+	TEST_CASE("Partial records are rejected");
+	file = test_key_file(ctx, keys, TICKET_KEY_RECORD_LEN + 1);
+	TEST_CHECK(test_conf_alloc(ctx, file) == NULL);
+	unlink(file);
+
+	TEST_CASE("Too many records are rejected");
+	file = test_key_file(ctx, keys, sizeof(keys));
+	TEST_CHECK(test_conf_alloc(ctx, file) == NULL);
+	unlink(file);
+
+	TEST_CASE("Missing files are rejected");
+	TEST_CHECK(test_conf_alloc(ctx, "/nonexistent/ticket.key") == NULL);
+
+	TEST_CASE("Keys are loaded in order");
+	file = test_key_file(ctx, keys, TICKET_KEY_RECORD_LEN * 2);
+	conf = test_conf_alloc(ctx, file);
+	TEST_CHECK(conf != NULL);
+	TEST_CHECK(conf->ticket_keys->num == 2);
+	TEST_CHECK(conf->ticket_keys->rotation == 0);
+	TEST_CHECK(memcmp(conf->ticket_keys->key[0].name, keys, TICKET_KEY_NAME_LEN) == 0);
+	TEST_CHECK(memcmp(conf->ticket_keys->key[0].hmac_key, keys + TICKET_KEY_NAME_LEN,
+			  TICKET_KEY_HMAC_LEN) == 0);
+	TEST_CHECK(memcmp(conf->ticket_keys->key[1].aes_key,
+			  keys + TICKET_KEY_RECORD_LEN + TICKET_KEY_NAME_LEN + TICKET_KEY_HMAC_LEN,
+			  TICKET_KEY_AES_LEN) == 0);
+
+	TEST_CASE("Servers sharing a key file resume each other's sessions");
+	other = test_conf_alloc(ctx, file);
+	TEST_CHECK(other != NULL);
+	unlink(file);
+	client_ctx = test_client_ctx();
+
+	conn = test_connect(ctx, test_server_ctx(conf), client_ctx, NULL);
+	test_ticket_send(conn, true);
+	talloc_free(conn);
+
+	conn = test_connect(ctx, test_server_ctx(other), client_ctx, test_client_session);
+	TEST_CHECK(SSL_session_reused(conn->server) == 1);
+	talloc_free(conn);
+
+	SSL_SESSION_free(test_client_session);
+	test_client_session = NULL;
+	SSL_CTX_free(client_ctx);
+	talloc_free(ctx);
+}
+
+TEST_LIST = {
+	/*
+	 *	Issuing and accepting tickets
+	 */
+	{ "Tickets - Issue and resume",			test_issue },
+	{ "Tickets - Unauthorised",			test_unauthorised },
+
+	/*
+	 *	Key management
+	 */
+	{ "Keys - Rotation",				test_rotation },
+	{ "Keys - Key file",				test_key_file_load },
+	{ NULL }
+};
+#else
+TEST_LIST = {
+	{ NULL }
+};
+#endif
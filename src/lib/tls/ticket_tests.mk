@@ -0,0 +1,10 @@
+ifneq ($(OPENSSL_LIBS),)
+TARGET		:= ticket_tests
+endif
+
+SOURCES		:= ticket_tests.c
+
+TGT_LDLIBS	:= $(LIBS) $(OPENSSL_LIBS)
+TGT_LDFLAGS	:= $(LDFLAGS) $(OPENSSL_FLAGS)
+
+TGT_PREREQS	:= libfreeradius-tls.a libfreeradius-util.a libfreeradius-server.a libfreeradius-unlang.a libfreeradius-internal.a
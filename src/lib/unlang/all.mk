@@ -12,6 +12,7 @@ SOURCES	:=	base.c \
 		load_balance.c \
 		map.c \
 		module.c \
+		offload.c \
 		parallel.c \
 		return.c \
 		subrequest.c \
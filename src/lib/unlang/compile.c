@@ -1956,6 +1956,150 @@ static bool compile_action_subsection(unlang_t *c, CONF_SECTION *cs, CONF_SECTIO
 }
 
 
+#ifdef HAVE_REGEX_PCRE2
+/** Return the attribute a condition matches against, if the condition can be part of a regex chain
+ *
+ * Only a single, non-negated, precompiled regex match against a string
+ * attribute qualifies.  Anything else has side effects or semantics
+ * (casts, paircmp, xlat expansion) which we can't reproduce in a
+ * combined match.
+ */
+static vp_tmpl_t const *regex_chain_lhs(fr_cond_t const *cond)
+{
+	vp_map_t const *map;
+
+	if ((cond->type != COND_TYPE_MAP) || cond->negate || cond->next || cond->cast ||
+	    (cond->pass2_fixup != PASS2_FIXUP_NONE)) return NULL;
+
+	map = cond->data.map;
+	if ((map->op != T_OP_REG_EQ) || !tmpl_is_attr(map->lhs) || !tmpl_is_regex(map->rhs)) return NULL;
+	if (tmpl_da(map->lhs)->type != FR_TYPE_STRING) return NULL;
+
+	return map->lhs;
+}
+
+/** Add an if/elsif section to a run of regex matches against the same attribute
+ *
+ * The run is extended if the previous sibling is part of one matching
+ * the same attribute, otherwise a new run is started.  Runs are turned
+ * into combined matchers by compile_regex_chains() once all the
+ * siblings have been compiled.
+ */
+static void compile_regex_chain(unlang_t *parent, unlang_group_t *g)
+{
+	unlang_group_t		*prev = NULL;
+	unlang_regex_chain_t	*chain;
+	vp_tmpl_t const		*lhs;
+	size_t			num;
+
+	lhs = regex_chain_lhs(g->cond);
+	if (!lhs) return;
+
+	if (g->self.type == UNLANG_TYPE_ELSIF) {
+		unlang_t *tail = unlang_generic_to_group(parent)->tail;
+
+		if (tail && ((tail->type == UNLANG_TYPE_IF) || (tail->type == UNLANG_TYPE_ELSIF))) {
+			prev = unlang_generic_to_group(tail);
+		}
+	}
+
+	if (prev && prev->regex_chain &&
+	    (tmpl_da(prev->regex_chain->lhs) == tmpl_da(lhs)) &&
+	    (strcmp(prev->regex_chain->lhs->name, lhs->name) == 0)) {
+		chain = prev->regex_chain;
+
+		num = talloc_array_length(chain->arms);
+		MEM(chain->arms = talloc_realloc(chain, chain->arms, unlang_t *, num + 1));
+		chain->arms[num] = unlang_group_to_generic(g);
+		g->regex_chain = chain;
+		return;
+	}
+
+	MEM(chain = talloc_zero(g, unlang_regex_chain_t));
+	chain->lhs = lhs;
+	MEM(chain->arms = talloc_array(chain, unlang_t *, 1));
+	chain->arms[0] = unlang_group_to_generic(g);
+	g->regex_chain = chain;
+}
+
+/** Remove a regex chain from all of its sections and free it
+ *
+ */
+static void regex_chain_free(unlang_regex_chain_t *chain)
+{
+	size_t i, num = talloc_array_length(chain->arms);
+
+	for (i = 0; i < num; i++) unlang_generic_to_group(chain->arms[i])->regex_chain = NULL;
+
+	talloc_free(chain);
+}
+
+/** Build combined matchers for any regex chains in a group's children
+ *
+ * Chains which are too short, or whose expressions can't be combined,
+ * are discarded, and their sections are evaluated one by one as normal.
+ */
+static void compile_regex_chains(unlang_group_t *g)
+{
+	unlang_t *c;
+
+	for (c = g->children; c; c = c->next) {
+		unlang_group_t		*f;
+		unlang_regex_chain_t	*chain;
+		size_t			i, num;
+
+		if ((c->type != UNLANG_TYPE_IF) && (c->type != UNLANG_TYPE_ELSIF)) continue;
+
+		f = unlang_generic_to_group(c);
+		chain = f->regex_chain;
+		if (!chain || (chain->arms[0] != c)) continue;
+
+		num = talloc_array_length(chain->arms);
+		if (num < 2) {
+			regex_chain_free(chain);
+			continue;
+		}
+
+		MEM(chain->multi = regex_multi_alloc(chain));
+		for (i = 0; i < num; i++) {
+			vp_tmpl_t const *rhs = unlang_generic_to_group(chain->arms[i])->cond->data.map->rhs;
+
+			if (regex_multi_add(chain->multi, rhs->name, rhs->len, &tmpl_regex_flags(rhs)) < 0) {
+				cf_log_debug(unlang_generic_to_group(chain->arms[i])->cs,
+					     "Not combining regular expression: %s", fr_strerror());
+				break;
+			}
+		}
+
+		/*
+		 *	Keep the sections before the one we couldn't
+		 *	add, so long as there are still enough of them.
+		 */
+		if (i < 2) {
+			regex_chain_free(chain);
+			continue;
+		}
+
+		if (i < num) {
+			size_t j;
+
+			for (j = i; j < num; j++) unlang_generic_to_group(chain->arms[j])->regex_chain = NULL;
+			MEM(chain->arms = talloc_realloc(chain, chain->arms, unlang_t *, i));
+			num = i;
+		}
+
+		if (regex_multi_compile(chain->multi) < 0) {
+			cf_log_debug(f->cs, "Failed combining regular expressions: %s", fr_strerror());
+			regex_chain_free(chain);
+			continue;
+		}
+
+		cf_log_debug(f->cs, "Combined %zu regular expression matches on %s into a single match",
+			     num, chain->lhs->name);
+	}
+}
+#endif
+
 static unlang_t *compile_children(unlang_group_t *g, unlang_t *parent, unlang_compile_t *unlang_ctx)
 {
 	CONF_ITEM *ci = NULL;
@@ -2081,6 +2225,10 @@ static unlang_t *compile_children(unlang_group_t *g, unlang_t *parent, unlang_co
 		}
 	}
 
+#ifdef HAVE_REGEX_PCRE2
+	compile_regex_chains(g);
+#endif
+
 	return compile_action_defaults(c, unlang_ctx);
 }
 
@@ -2619,6 +2767,10 @@ static unlang_t *compile_if_subsection(unlang_t *parent, unlang_compile_t *unlan
 	g = unlang_generic_to_group(c);
 	g->cond = cond;
 
+#ifdef HAVE_REGEX_PCRE2
+	compile_regex_chain(parent, g);
+#endif
+
 	return c;
 }
 
@@ -2894,12 +3046,17 @@ static unlang_t *compile_parallel(unlang_t *parent, unlang_compile_t *unlang_ctx
 	unlang_group_t *g;
 	bool clone = true;
 	bool detach = false;
+	bool offload = false;
 
 	/*
 	 *	Parallel sections can create empty children, if the
 	 *	admin demands it.  Otherwise, the principle of least
 	 *	surprise is to copy the whole request, reply, and
 	 *	config items.
+	 *
+	 *	"offload" runs children which are calls to blocking
+	 *	modules on the offload threads, so that they don't
+	 *	block the worker.
 	 */
 	name2 = cf_section_name2(cs);
 	if (name2) {
@@ -2909,6 +3066,9 @@ static unlang_t *compile_parallel(unlang_t *parent, unlang_compile_t *unlang_ctx
 		} else if (strcmp(name2, "detach") == 0) {
 			detach = true;
 
+		} else if (strcmp(name2, "offload") == 0) {
+			offload = true;
+
 		} else {
 			cf_log_err(cs, "Invalid argument '%s'", name2);
 			return NULL;
@@ -2922,6 +3082,7 @@ static unlang_t *compile_parallel(unlang_t *parent, unlang_compile_t *unlang_ctx
 	g = unlang_generic_to_group(c);
 	g->clone = clone;
 	g->detach = detach;
+	g->offload = offload;
 
 	return c;
 }
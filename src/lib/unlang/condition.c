@@ -24,9 +24,54 @@
  */
 RCSID("$Id$")
 
+#include <freeradius-devel/server/regex.h>
+
 #include "unlang_priv.h"
 #include "group_priv.h"
 
+#ifdef HAVE_REGEX_PCRE2
+/** Find the first section in a regex chain whose expression matches
+ *
+ * As with the individual conditions, a section matches if its expression
+ * matches any instance of the attribute.
+ *
+ * @return
+ *	- >= 0 the section to evaluate.
+ *	- -1 if no section matches.
+ *	- -2 if the conditions should be evaluated one by one instead.
+ */
+static int unlang_regex_chain_match(REQUEST *request, unlang_regex_chain_t const *chain)
+{
+	VALUE_PAIR	*vp;
+	fr_cursor_t	cursor;
+	int		ret, arm = -1;
+	bool		found = false;
+
+	for (vp = tmpl_cursor_init(NULL, &cursor, request, chain->lhs);
+	     vp;
+	     vp = fr_cursor_next(&cursor)) {
+		found = true;
+
+		ret = regex_multi_exec(chain->multi, vp->vp_strvalue, vp->vp_length);
+		if (ret < -1) {
+			RPWDEBUG("Combined regex evaluation failed");
+			return -2;
+		}
+
+		if ((ret >= 0) && ((arm < 0) || (ret < arm))) arm = ret;
+		if (arm == 0) break;
+	}
+
+	/*
+	 *	Let the individual conditions produce the
+	 *	appropriate errors for missing attributes.
+	 */
+	if (!found) return -2;
+
+	return arm;
+}
+#endif
+
 static unlang_action_t unlang_if(REQUEST *request, rlm_rcode_t *presult)
 {
 	int			condition;
@@ -38,6 +83,37 @@ static unlang_action_t unlang_if(REQUEST *request, rlm_rcode_t *presult)
 	g = unlang_generic_to_group(instruction);
 	fr_assert(g->cond != NULL);
 
+#ifdef HAVE_REGEX_PCRE2
+	/*
+	 *	We're the first section in a run of regex matches
+	 *	against the same attribute.  Find the section which
+	 *	matches with a single pass over the attribute, and
+	 *	skip the ones which can't.
+	 *
+	 *	The matching section still evaluates its own
+	 *	condition, which populates the capture groups exactly
+	 *	as if the run had been evaluated one by one.
+	 */
+	if (g->regex_chain && (g->regex_chain->arms[0] == instruction) && (frame->next == instruction->next)) {
+		unlang_regex_chain_t const	*chain = g->regex_chain;
+		int				arm;
+
+		arm = unlang_regex_chain_match(request, chain);
+		if (arm > 0) {
+			RDEBUG2("... (skipping to %s)", chain->arms[arm]->debug_name);
+			frame->next = chain->arms[arm];
+			return UNLANG_ACTION_EXECUTE_NEXT;
+		}
+
+		if (arm == -1) {
+			RDEBUG2("... (no match in %s)", chain->lhs->name);
+			regex_sub_to_request(request, NULL, NULL);	/* clear out old entries */
+			frame->next = chain->arms[talloc_array_length(chain->arms) - 1]->next;
+			return UNLANG_ACTION_EXECUTE_NEXT;
+		}
+	}
+#endif
+
 	condition = cond_eval(request, *presult, 0, g->cond);
 	if (condition < 0) {
 		switch (condition) {
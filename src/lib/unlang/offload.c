@@ -0,0 +1,557 @@
+/*
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ */
+
+/**
+ * $Id$
+ *
+ * @file unlang/offload.c
+ * @brief Run blocking module calls from "parallel offload" on a pool of threads.
+ *
+ * Worker threads must never block, but some modules (e.g. rlm_sql and rlm_ldap)
+ * wait for the result of every query.  When a child of a "parallel offload"
+ * section is a call to one of these modules, the child request is handed to
+ * an offload thread, and the worker continues processing other requests.
+ *
+ * Once the call completes, the offload thread pushes the job onto a queue
+ * owned by the worker, and writes to a pipe to wake it up.  The worker then
+ * marks the parent request as resumable.
+ *
+ * Child requests are only ever allocated and freed by the worker.  While a
+ * child is on an offload thread it has no parent, and nothing else references
+ * it, so no locking is needed around the request itself.
+ *
+ * @copyright 2020 The FreeRADIUS server project
+ */
+RCSID("$Id$")
+
+#include <freeradius-devel/io/atomic_queue.h>
+#include <freeradius-devel/server/base.h>
+#include <freeradius-devel/server/module.h>
+#include <freeradius-devel/server/request_data.h>
+#include <freeradius-devel/unlang/offload.h>
+#include <freeradius-devel/util/syserror.h>
+
+#include "unlang_priv.h"
+#include "module_priv.h"
+#include "offload_priv.h"
+
+#include <fcntl.h>
+#include <pthread.h>
+#include <sched.h>
+#include <unistd.h>
+
+/** Per-thread state for a worker which offloads calls
+ *
+ */
+typedef struct {
+	fr_event_list_t		*el;			//!< Event list of the worker.
+	fr_atomic_queue_t	*aq;			//!< Jobs returned by the offload threads.
+	int			pipe[2];		//!< To wake up the worker.
+	uint32_t		outstanding;		//!< Jobs not yet returned to the worker.
+} unlang_offload_thread_t;
+
+/** A child request which is being run on an offload thread
+ *
+ */
+struct unlang_offload_job_s {
+	fr_dlist_t		entry;			//!< Entry in the pool's queue.
+	unlang_offload_thread_t	*owner;			//!< Worker to return the job to.
+	REQUEST			*parent;		//!< Request to resume when the job is done.
+	REQUEST			*child;			//!< Child request making the module call.
+	rlm_rcode_t		rcode;			//!< Result of running the child.
+	atomic_bool		cancelled;		//!< The parent no longer wants the result.
+	bool			yielded;		//!< The module yielded, which isn't allowed
+							///< on an offload thread.
+	bool			done;			//!< The job has been returned to the worker.
+};
+
+/** The offload threads, and the queue of jobs waiting for them
+ *
+ */
+typedef struct {
+	pthread_mutex_t		mutex;			//!< Protects everything below.
+	pthread_cond_t		cond;			//!< Signalled when jobs are queued,
+							//!< threads start, or we're stopping.
+	fr_dlist_head_t		queue;			//!< Jobs waiting for a thread.
+	uint32_t		max_queued;		//!< Maximum length of the queue.
+
+	pthread_t		*threads;		//!< The offload threads.
+	uint32_t		num_threads;		//!< How many threads we started.
+	uint32_t		num_running;		//!< Threads which instantiated successfully.
+	uint32_t		num_failed;		//!< Threads which failed to instantiate.
+	bool			stop;			//!< Tell the threads to exit.
+
+	fr_schedule_thread_instantiate_t	thread_instantiate;	//!< Creates per-thread module instances.
+	fr_schedule_thread_detach_t		thread_detach;		//!< Frees per-thread module instances.
+} unlang_offload_pool_t;
+
+static unlang_offload_pool_t *offload_pool;
+
+static _Thread_local unlang_offload_thread_t *offload_thread;
+
+/** Hand a finished job back to the worker which owns it
+ *
+ */
+static void offload_job_return(unlang_offload_job_t *job)
+{
+	unlang_offload_thread_t *ot = job->owner;
+
+	/*
+	 *	The queue is sized so that it can hold every job
+	 *	the worker has outstanding, so this can only fail
+	 *	transiently.
+	 */
+	while (!fr_atomic_queue_push(ot->aq, job)) sched_yield();
+
+	if ((write(ot->pipe[1], "", 1) < 0) && (errno != EAGAIN) && (errno != EWOULDBLOCK)) {
+		ERROR("Failed signalling worker: %s", fr_syserror(errno));
+	}
+}
+
+/** Run a child request on an offload thread
+ *
+ */
+static void offload_job_run(unlang_offload_job_t *job, fr_event_list_t *el)
+{
+	REQUEST *request = job->child;
+
+	if (atomic_load_explicit(&job->cancelled, memory_order_acquire)) {
+		job->rcode = RLM_MODULE_FAIL;
+		return;
+	}
+
+	/*
+	 *	Anything the module inserts into the event list has
+	 *	to be serviced by this thread, not the worker.
+	 */
+	request->el = el;
+
+	job->rcode = unlang_interpret(request);
+	if (job->rcode == RLM_MODULE_YIELD) {
+		RERROR("Module yielded on an offload thread.  Modules which yield must not be marked as blocking");
+		unlang_interpret_signal(request, FR_SIGNAL_CANCEL);
+		job->rcode = RLM_MODULE_FAIL;
+		job->yielded = true;
+	}
+
+	/*
+	 *	Cached attribute references are validated against
+	 *	this thread's list generation counter, so they mean
+	 *	nothing to the worker.
+	 */
+	TALLOC_FREE(request->tmpl_cache);
+	request->el = NULL;
+}
+
+/** Entry point for offload threads
+ *
+ * @param[in] arg	the #unlang_offload_pool_t.
+ * @return NULL
+ */
+static void *offload_thread_main(void *arg)
+{
+	unlang_offload_pool_t	*pool = arg;
+	unlang_offload_job_t	*job;
+	TALLOC_CTX		*ctx;
+	fr_event_list_t		*el = NULL;
+	bool			ok = false;
+
+	ctx = talloc_init_const("offload");
+	if (!ctx) goto started;
+
+	el = fr_event_list_alloc(ctx, NULL, NULL);
+	if (!el) {
+		PERROR("Offload - Failed creating event list");
+		goto started;
+	}
+
+	if (pool->thread_instantiate && (pool->thread_instantiate(ctx, el, NULL) < 0)) {
+		PERROR("Offload - Failed calling thread instantiate");
+		goto started;
+	}
+	ok = true;
+
+started:
+	pthread_mutex_lock(&pool->mutex);
+	if (ok) {
+		pool->num_running++;
+	} else {
+		pool->num_failed++;
+	}
+	pthread_cond_broadcast(&pool->cond);
+
+	while (ok) {
+		while (!pool->stop && (fr_dlist_num_elements(&pool->queue) == 0)) {
+			pthread_cond_wait(&pool->cond, &pool->mutex);
+		}
+
+		job = fr_dlist_head(&pool->queue);
+		if (!job) break;	/* Stopping, and nothing left to return */
+
+		fr_dlist_remove(&pool->queue, job);
+
+		/*
+		 *	Jobs queued after we were told to stop are
+		 *	returned to their workers without being run.
+		 */
+		if (pool->stop) {
+			job->rcode = RLM_MODULE_FAIL;
+			offload_job_return(job);
+			continue;
+		}
+		pthread_mutex_unlock(&pool->mutex);
+
+		offload_job_run(job, el);
+		offload_job_return(job);
+
+		pthread_mutex_lock(&pool->mutex);
+	}
+	pthread_mutex_unlock(&pool->mutex);
+
+	if (ok && pool->thread_detach) pool->thread_detach(NULL);
+
+	talloc_free(ctx);
+
+	return NULL;
+}
+
+/** Called by the worker when offload threads have returned jobs
+ *
+ */
+static void offload_thread_read(UNUSED fr_event_list_t *el, int fd, UNUSED int flags, void *uctx)
+{
+	unlang_offload_thread_t	*ot = talloc_get_type_abort(uctx, unlang_offload_thread_t);
+	void			*data;
+	char			buffer[256];
+
+	while (read(fd, buffer, sizeof(buffer)) > 0);
+
+	while (fr_atomic_queue_pop(ot->aq, &data)) {
+		unlang_offload_job_t *job = data;
+
+		ot->outstanding--;
+
+		if (atomic_load_explicit(&job->cancelled, memory_order_relaxed)) {
+			talloc_free(job->child);
+			talloc_free(job);
+			continue;
+		}
+
+		job->done = true;
+		unlang_interpret_resumable(job->parent);
+	}
+}
+
+static int _offload_thread_free(unlang_offload_thread_t *ot)
+{
+	if (ot->pipe[0] >= 0) close(ot->pipe[0]);
+	if (ot->pipe[1] >= 0) close(ot->pipe[1]);
+
+	if (offload_thread == ot) offload_thread = NULL;
+
+	return 0;
+}
+
+/** Get the offload state for the current worker, creating it if necessary
+ *
+ * The state is bound to the lifetime of the worker's event list.
+ */
+static unlang_offload_thread_t *offload_thread_get(fr_event_list_t *el)
+{
+	unlang_offload_thread_t *ot;
+
+	if (likely(offload_thread != NULL)) {
+		fr_assert(offload_thread->el == el);
+		return offload_thread;
+	}
+
+	MEM(ot = talloc_zero(el, unlang_offload_thread_t));
+	ot->el = el;
+	ot->pipe[0] = ot->pipe[1] = -1;
+	talloc_set_destructor(ot, _offload_thread_free);
+
+	ot->aq = fr_atomic_queue_create(ot, offload_pool->max_queued + offload_pool->num_threads);
+	if (!ot->aq) {
+		ERROR("Failed creating offload queue");
+	error:
+		talloc_free(ot);
+		return NULL;
+	}
+
+	if (pipe(ot->pipe) < 0) {
+		ERROR("Failed opening offload pipe: %s", fr_syserror(errno));
+		goto error;
+	}
+	(void) fcntl(ot->pipe[0], F_SETFL, O_NONBLOCK | FD_CLOEXEC);
+	(void) fcntl(ot->pipe[1], F_SETFL, O_NONBLOCK | FD_CLOEXEC);
+
+	if (fr_event_fd_insert(ot, el, ot->pipe[0], offload_thread_read, NULL, NULL, ot) < 0) {
+		PERROR("Failed adding offload pipe to event list");
+		goto error;
+	}
+
+	offload_thread = ot;
+
+	return ot;
+}
+
+/** Whether a child instruction can be run on an offload thread
+ *
+ * Only direct calls to module instances marked as #RLM_TYPE_BLOCKING are
+ * eligible.  The flags are checked per instance, as modules which can be
+ * configured to use async I/O mark those instances as #RLM_TYPE_RESUMABLE.
+ * Anything else either doesn't block, or may yield, and so must be run
+ * by the worker.
+ *
+ * @param[in] instruction	the child of the parallel section.
+ * @return
+ *	- true if the child should be offloaded.
+ *	- false if it should be run by the worker.
+ */
+bool unlang_offload_eligible(unlang_t *instruction)
+{
+	unlang_module_t	*sp;
+	int		type;
+
+	if (!offload_pool || (instruction->type != UNLANG_TYPE_MODULE)) return false;
+
+	sp = unlang_generic_to_module(instruction);
+	if (sp->module_instance->force) return false;
+
+	type = sp->module_instance->type;
+
+	return ((type & RLM_TYPE_BLOCKING) != 0) && ((type & RLM_TYPE_RESUMABLE) == 0);
+}
+
+/** Queue a child request to be run on an offload thread
+ *
+ * The child must have been allocated with #unlang_io_subrequest_alloc as
+ * detachable, and have its frames pushed.  On success the child is unlinked
+ * from its parent, and is owned by the job until #unlang_offload_result or
+ * #unlang_offload_cancel is called.
+ *
+ * @param[in] request	the parent, which will be marked resumable when the
+ *			child is done.
+ * @param[in] child	to run.
+ * @return
+ *	- The job on success.
+ *	- NULL if the queue is full, in which case the caller should
+ *	  run the child itself.
+ */
+unlang_offload_job_t *unlang_offload_push(REQUEST *request, REQUEST *child)
+{
+	unlang_offload_pool_t	*pool = offload_pool;
+	unlang_offload_thread_t	*ot;
+	unlang_offload_job_t	*job;
+
+	if (!pool || !request->el) return NULL;
+
+	ot = offload_thread_get(request->el);
+	if (!ot) return NULL;
+
+	if (ot->outstanding >= fr_atomic_queue_size(ot->aq)) return NULL;
+
+	MEM(job = talloc_zero(NULL, unlang_offload_job_t));
+	job->owner = ot;
+	job->parent = request;
+	job->child = child;
+
+	pthread_mutex_lock(&pool->mutex);
+	if (pool->stop || (fr_dlist_num_elements(&pool->queue) >= pool->max_queued)) {
+		pthread_mutex_unlock(&pool->mutex);
+		RDEBUG3("Offload queue is full");
+		talloc_free(job);
+		return NULL;
+	}
+
+	/*
+	 *	The parent must not free the child while an offload
+	 *	thread is running it, and the child must not look at
+	 *	the parent, which the worker may be modifying.
+	 */
+	(void) request_data_get(request, child, 0);
+	child->parent = NULL;
+	child->backlog = NULL;
+	child->el = NULL;
+	TALLOC_FREE(child->tmpl_cache);
+
+	fr_dlist_insert_tail(&pool->queue, job);
+	pthread_cond_signal(&pool->cond);
+	pthread_mutex_unlock(&pool->mutex);
+
+	ot->outstanding++;
+
+	return job;
+}
+
+/** Get the result of an offloaded child, if it has finished
+ *
+ * When the child has finished, the child and the job are freed.  If the
+ * module yielded, a Module-Failure-Message is added to the parent.
+ *
+ * @param[in] job	returned by #unlang_offload_push.
+ * @param[out] presult	the result of the child.
+ * @return
+ *	- true if the child has finished.
+ *	- false if it is still queued or running.
+ */
+bool unlang_offload_result(unlang_offload_job_t *job, rlm_rcode_t *presult)
+{
+	if (!job->done) return false;
+
+	*presult = job->rcode;
+
+	/*
+	 *	The child is about to be freed, so tell the parent
+	 *	why the call failed.
+	 */
+	if (job->yielded) {
+		log_module_failure_msg(job->parent, "Module yielded on an offload thread");
+	}
+
+	talloc_free(job->child);
+	talloc_free(job);
+
+	return true;
+}
+
+/** Tell an offloaded child that its parent no longer wants the result
+ *
+ * If the child hasn't started running it is freed immediately.  Otherwise
+ * it is freed once the offload thread returns it.
+ *
+ * @param[in] job	returned by #unlang_offload_push.
+ */
+void unlang_offload_cancel(unlang_offload_job_t *job)
+{
+	unlang_offload_pool_t *pool = offload_pool;
+
+	if (job->done) {
+	free:
+		talloc_free(job->child);
+		talloc_free(job);
+		return;
+	}
+
+	atomic_store_explicit(&job->cancelled, true, memory_order_release);
+
+	pthread_mutex_lock(&pool->mutex);
+	if (fr_dlist_entry_in_list(&job->entry)) {
+		fr_dlist_remove(&pool->queue, job);
+		pthread_mutex_unlock(&pool->mutex);
+
+		job->owner->outstanding--;
+		goto free;
+	}
+	pthread_mutex_unlock(&pool->mutex);
+}
+
+static int _offload_pool_free(unlang_offload_pool_t *pool)
+{
+	pthread_mutex_destroy(&pool->mutex);
+	pthread_cond_destroy(&pool->cond);
+
+	return 0;
+}
+
+/** Start the offload threads
+ *
+ * Each thread calls thread_instantiate to create its own module instance data,
+ * and an event list for the modules to use.
+ *
+ * @param[in] num_threads		How many threads to start.
+ * @param[in] max_queued		Maximum number of jobs waiting for a thread.
+ * @param[in] thread_instantiate	called by each new thread.
+ * @param[in] thread_detach		called by each thread before it exits.
+ * @return
+ *	- 0 on success.
+ *	- -1 if any thread failed to start.
+ */
+int unlang_offload_start(uint32_t num_threads, uint32_t max_queued,
+			 fr_schedule_thread_instantiate_t thread_instantiate,
+			 fr_schedule_thread_detach_t thread_detach)
+{
+	unlang_offload_pool_t	*pool;
+	uint32_t		i;
+
+	fr_assert(!offload_pool);
+
+	if (!num_threads) return 0;
+
+	MEM(pool = talloc_zero(NULL, unlang_offload_pool_t));
+	pthread_mutex_init(&pool->mutex, NULL);
+	pthread_cond_init(&pool->cond, NULL);
+	talloc_set_destructor(pool, _offload_pool_free);
+
+	fr_dlist_init(&pool->queue, unlang_offload_job_t, entry);
+	pool->max_queued = max_queued;
+	pool->thread_instantiate = thread_instantiate;
+	pool->thread_detach = thread_detach;
+
+	MEM(pool->threads = talloc_zero_array(pool, pthread_t, num_threads));
+
+	for (i = 0; i < num_threads; i++) {
+		if (fr_schedule_pthread_create(&pool->threads[i], offload_thread_main, pool) < 0) {
+			PERROR("Failed creating offload thread");
+			break;
+		}
+		pool->num_threads++;
+	}
+
+	/*
+	 *	Wait for all of the threads to instantiate their
+	 *	modules before we allow anything to be offloaded.
+	 */
+	pthread_mutex_lock(&pool->mutex);
+	while ((pool->num_running + pool->num_failed) < pool->num_threads) {
+		pthread_cond_wait(&pool->cond, &pool->mutex);
+	}
+	pthread_mutex_unlock(&pool->mutex);
+
+	offload_pool = pool;
+
+	if ((pool->num_threads < num_threads) || (pool->num_failed > 0)) {
+		unlang_offload_stop();
+		return -1;
+	}
+
+	DEBUG("Started %u offload threads", pool->num_threads);
+
+	return 0;
+}
+
+/** Stop the offload threads
+ *
+ * Jobs which are still queued are returned to their workers with a result
+ * of "fail".  Must be called before the workers exit.
+ */
+void unlang_offload_stop(void)
+{
+	unlang_offload_pool_t	*pool = offload_pool;
+	uint32_t		i;
+
+	if (!pool) return;
+
+	pthread_mutex_lock(&pool->mutex);
+	pool->stop = true;
+	pthread_cond_broadcast(&pool->cond);
+	pthread_mutex_unlock(&pool->mutex);
+
+	for (i = 0; i < pool->num_threads; i++) pthread_join(pool->threads[i], NULL);
+
+	offload_pool = NULL;
+	talloc_free(pool);
+}
@@ -0,0 +1,40 @@
+#pragma once
+/*
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2, or (at your option)
+ *  any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software Foundation,
+ *  Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+ */
+
+/**
+ * $Id$
+ *
+ * @file unlang/offload.h
+ * @brief Threads for running blocking module calls from "parallel offload".
+ *
+ * @copyright 2020 The FreeRADIUS server project
+ */
+#include <freeradius-devel/io/schedule.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+int	unlang_offload_start(uint32_t num_threads, uint32_t max_queued,
+			     fr_schedule_thread_instantiate_t thread_instantiate,
+			     fr_schedule_thread_detach_t thread_detach);
+
+void	unlang_offload_stop(void);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,44 @@
+#pragma once
+/*
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2, or (at your option)
+ *  any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software Foundation,
+ *  Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+ */
+
+/**
+ * $Id$
+ *
+ * @file unlang/offload_priv.h
+ * @brief Declarations for running child requests on offload threads.
+ *
+ * @copyright 2020 The FreeRADIUS server project
+ */
+#include "unlang_priv.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct unlang_offload_job_s unlang_offload_job_t;
+
+bool			unlang_offload_eligible(unlang_t *instruction);
+
+unlang_offload_job_t	*unlang_offload_push(REQUEST *request, REQUEST *child);
+
+bool			unlang_offload_result(unlang_offload_job_t *job, rlm_rcode_t *presult);
+
+void			unlang_offload_cancel(unlang_offload_job_t *job);
+
+#ifdef __cplusplus
+}
+#endif
@@ -75,6 +75,7 @@ static unlang_action_t unlang_parallel_process(REQUEST *request, rlm_rcode_t *pr
 	rlm_rcode_t		result;
 	unlang_parallel_child_state_t child_state = CHILD_DONE; /* hope that we're done */
 	REQUEST			*child;
+	bool			offload;
 
 	/*
 	 *	If the children should be created detached, we return
@@ -100,8 +101,18 @@ static unlang_action_t unlang_parallel_process(REQUEST *request, rlm_rcode_t *pr
 		case CHILD_INIT:
 			RDEBUG3("parallel child %d is INIT", i);
 			fr_assert(state->children[i].instruction != NULL);
+
+			/*
+			 *	Offloaded children are detachable, so
+			 *	that they're not in the parent's talloc
+			 *	hierarchy while another thread is
+			 *	running them.
+			 */
+			offload = state->offload && unlang_offload_eligible(state->children[i].instruction);
+
+		alloc:
 			child = unlang_io_subrequest_alloc(request,
-							   request->dict, state->detach);
+							   request->dict, state->detach || offload);
 			child->packet->code = request->packet->code;
 
 			if (state->clone) {
@@ -121,13 +132,54 @@ static unlang_action_t unlang_parallel_process(REQUEST *request, rlm_rcode_t *pr
 						       &child->control,
 						       request->control) < 0)) {
 					REDEBUG("failed copying lists to clone");
-					for (i = 0; i < state->num_children; i++) TALLOC_FREE(state->children[i].child);
+					for (i = 0; i < state->num_children; i++) {
+						if (state->children[i].state == CHILD_OFFLOADED) {
+							unlang_offload_cancel(state->children[i].job);
+							state->children[i].state = CHILD_DONE;
+							state->children[i].job = NULL;
+							state->children[i].child = NULL;
+							continue;
+						}
+						TALLOC_FREE(state->children[i].child);
+					}
 
 					*presult = RLM_MODULE_FAIL;
 					return UNLANG_ACTION_CALCULATE_RESULT;
 				}
 			}
 
+			/*
+			 *	The offload thread runs the child to
+			 *	completion, and the worker picks up
+			 *	the result, so there's no need for a
+			 *	frame to signal us.
+			 */
+			if (offload) {
+				unlang_interpret_push(child, NULL, RLM_MODULE_NOOP,
+						      UNLANG_NEXT_STOP, UNLANG_TOP_FRAME);
+				unlang_interpret_push(child,
+						      state->children[i].instruction, RLM_MODULE_FAIL,
+						      UNLANG_NEXT_STOP, UNLANG_SUB_FRAME);
+
+				state->children[i].job = unlang_offload_push(request, child);
+				if (state->children[i].job) {
+					RDEBUG2("parallel - offloaded entry %d/%d", i + 1, state->num_children);
+					state->children[i].child = child;
+					state->children[i].state = CHILD_OFFLOADED;
+					child_state = CHILD_YIELDED;
+					continue;
+				}
+
+				/*
+				 *	No room in the offload queue,
+				 *	run the child here instead.
+				 */
+				RDEBUG3("parallel child %d could not be offloaded", i);
+				unlang_subrequest_free(&child);
+				offload = false;
+				goto alloc;
+			}
+
 			/*
 			 *	Push a top frame, followed by a frame
 			 *	which signals us that the child is
@@ -192,7 +244,8 @@ static unlang_action_t unlang_parallel_process(REQUEST *request, rlm_rcode_t *pr
 				continue;
 			}
 
-			RDEBUG3("parallel child %s returns %s", state->children[i].child->name,
+		calculate_result:
+			RDEBUG3("parallel child %d returns %s", i,
 				fr_table_str_by_value(mod_rcode_table, result, "<invalid>"));
 
 			fr_assert(result < NUM_ELEMENTS(state->children[i].instruction->actions));
@@ -281,6 +334,22 @@ static unlang_action_t unlang_parallel_process(REQUEST *request, rlm_rcode_t *pr
 			child_state = CHILD_YIELDED;
 			continue;
 
+		case CHILD_OFFLOADED:
+			fr_assert(state->children[i].job != NULL);
+
+			if (!unlang_offload_result(state->children[i].job, &result)) {
+				RDEBUG3("parallel child %d is still OFFLOADED", i);
+				child_state = CHILD_YIELDED;
+				continue;
+			}
+
+			/*
+			 *	The child was freed along with the job.
+			 */
+			state->children[i].job = NULL;
+			state->children[i].child = NULL;
+			goto calculate_result;
+
 		case CHILD_EXITED:
 			RDEBUG3("parallel child %d has already EXITED", i);
 			state->children[i].state = CHILD_DONE;
@@ -343,6 +412,19 @@ static unlang_action_t unlang_parallel_process(REQUEST *request, rlm_rcode_t *pr
 			state->children[i].child = NULL;
 			state->children[i].instruction = NULL;
 			break;
+
+			/*
+			 *	We can't stop a call which is running on
+			 *	another thread, so just tell it that we
+			 *	don't care about the result.
+			 */
+		case CHILD_OFFLOADED:
+			unlang_offload_cancel(state->children[i].job);
+			state->children[i].job = NULL;
+			state->children[i].state = CHILD_DONE;
+			state->children[i].child = NULL;
+			state->children[i].instruction = NULL;
+			break;
 		}
 	}
 
@@ -369,6 +451,7 @@ static void unlang_parallel_signal(REQUEST *request, fr_state_signal_t action)
 		case CHILD_INIT:
 		case CHILD_EXITED:
 		case CHILD_DONE:
+		case CHILD_OFFLOADED:		/* Can't be signalled on another thread */
 			break;
 
 		case CHILD_RUNNABLE:
@@ -380,6 +463,26 @@ static void unlang_parallel_signal(REQUEST *request, fr_state_signal_t action)
 	}
 }
 
+/** Cancel any children still running on offload threads
+ *
+ * The parallel section may be freed without being run to completion,
+ * e.g. when the parent request is stopped.
+ */
+static int _parallel_state_free(unlang_parallel_state_t *state)
+{
+	int i;
+
+	for (i = 0; i < state->num_children; i++) {
+		if (state->children[i].state != CHILD_OFFLOADED) continue;
+
+		unlang_offload_cancel(state->children[i].job);
+		state->children[i].job = NULL;
+		state->children[i].state = CHILD_DONE;
+	}
+
+	return 0;
+}
+
 static unlang_action_t unlang_parallel(REQUEST *request, rlm_rcode_t *presult)
 {
 	unlang_stack_t		*stack = request->stack;
@@ -412,7 +515,9 @@ static unlang_action_t unlang_parallel(REQUEST *request, rlm_rcode_t *presult)
 	state->priority = -1;				/* as-yet unset */
 	state->detach = g->detach;
 	state->clone = g->clone;
+	state->offload = g->offload;
 	state->num_children = g->num_children;
+	talloc_set_destructor(state, _parallel_state_free);
 
 	/*
 	 *	Initialize all of the children.
@@ -27,6 +27,7 @@
  * @copyright 2006-2019 The FreeRADIUS server project
  */
 #include "unlang_priv.h"
+#include "offload_priv.h"
 
 #ifdef __cplusplus
 extern "C" {
@@ -39,6 +40,7 @@ typedef enum {
 	CHILD_INIT = 0,					//!< Initial state.
 	CHILD_RUNNABLE,					//!< Child can continue running.
 	CHILD_YIELDED,					//!< Child is yielded waiting on an event.
+	CHILD_OFFLOADED,				//!< Child is running on an offload thread.
 	CHILD_EXITED,					//!< Child has exited
 	CHILD_DONE					//!< The child has completed.
 } unlang_parallel_child_state_t;
@@ -50,6 +52,7 @@ typedef struct {
 	unlang_parallel_child_state_t	state;		//!< State of the child.
 	REQUEST				*child; 	//!< Child request.
 	unlang_t			*instruction;	//!< broken out of g->children
+	unlang_offload_job_t		*job;		//!< When the child is on an offload thread.
 } unlang_parallel_child_t;
 
 typedef struct {
@@ -60,6 +63,7 @@ typedef struct {
 
 	bool			detach;			//!< are we creating the child detached
 	bool			clone;			//!< are the children cloned
+	bool			offload;		//!< are blocking module calls offloaded
 
 	unlang_parallel_child_t children[];		//!< Array of children.
 } unlang_parallel_state_t;
@@ -123,6 +123,19 @@ struct unlang_s {
 	int			actions[RLM_MODULE_NUMCODES];	//!< Priorities for the various return codes.
 };
 
+#ifdef HAVE_REGEX_PCRE2
+/** A run of if/elsif sections which all regex match the same attribute
+ *
+ * Evaluated once by the first section in the run, which then jumps
+ * directly to the section whose expression matches.
+ */
+typedef struct {
+	vp_tmpl_t const		*lhs;		//!< Attribute every section matches against.
+	unlang_t		**arms;		//!< Sections in the run, in evaluation order.
+	fr_regex_multi_t	*multi;		//!< Combined matcher, NULL if the run couldn't be combined.
+} unlang_regex_chain_t;
+#endif
+
 /** Generic representation of a grouping
  *
  * Can represent IF statements, maps, update sections etc...
@@ -158,11 +171,17 @@ typedef struct {
 				};
 			};
 		};
-		fr_cond_t		*cond;		//!< #UNLANG_TYPE_IF, #UNLANG_TYPE_ELSIF.
+		struct {
+			fr_cond_t		*cond;		//!< #UNLANG_TYPE_IF, #UNLANG_TYPE_ELSIF.
+#ifdef HAVE_REGEX_PCRE2
+			unlang_regex_chain_t	*regex_chain;	//!< Run of regex conditions this section belongs to.
+#endif
+		};
 
 		struct {				//!< #UNLANG_TYPE_PARALLEL
 			bool			clone;
 			bool			detach;
+			bool			offload;	//!< Run blocking module calls on offload threads.
 		};
 	};
 } unlang_group_t;
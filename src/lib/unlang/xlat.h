@@ -276,6 +276,8 @@ int		xlat_aeval_compiled_argv(TALLOC_CTX *ctx, char ***argv, REQUEST *request,
 
 int		xlat_flatten_compiled_argv(TALLOC_CTX *ctx, xlat_exp_t const ***argv, xlat_exp_t const *xlat);
 
+int		xlat_func_literals(TALLOC_CTX *ctx, char const ***literal, xlat_exp_t const *xlat);
+
 int		xlat_eval_pair(REQUEST *request, VALUE_PAIR *vp);
 
 bool		xlat_async_required(xlat_exp_t const *xlat);
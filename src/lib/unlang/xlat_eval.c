@@ -1710,6 +1710,37 @@ int xlat_flatten_compiled_argv(TALLOC_CTX *ctx, xlat_exp_t const ***argv, xlat_e
 	return xlat->count;
 }
 
+/** Return the literal text in the arguments of an xlat function
+ *
+ * Each literal node is evaluated to exactly one untainted value box,
+ * in the order the nodes appear.  Async xlat functions can use this
+ * to tell the text of their format from the results of expansions.
+ *
+ * @param[in] ctx	to allocate the array in.
+ * @param[out] literal	Literal text of each node, in order.  Points
+ *			into the nodes, so is only valid for as long as
+ *			the xlat is.
+ * @param[in] xlat	Function node, as passed to the xlat's instantiate function.
+ * @return the number of literal nodes.
+ */
+int xlat_func_literals(TALLOC_CTX *ctx, char const ***literal, xlat_exp_t const *xlat)
+{
+	int i = 0;
+	char const **my_literal;
+	xlat_exp_t const *node;
+
+	for (node = xlat->child; node != NULL; node = node->next) if (node->type == XLAT_LITERAL) i++;
+
+	MEM(my_literal = talloc_zero_array(ctx, char const *, i + 1));
+	*literal = my_literal;
+
+	for (i = 0, node = xlat->child; node != NULL; node = node->next) {
+		if (node->type == XLAT_LITERAL) my_literal[i++] = node->fmt;
+	}
+
+	return i;
+}
+
 
 /** Expands an attribute marked with fr_pair_mark_xlat
  *
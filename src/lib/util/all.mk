@@ -2,5 +2,8 @@ SUBMAKEFILES := \
 	dbuff_tests.mk \
 	heap_tests.mk \
 	libfreeradius-util.mk \
+	log_record_tests.mk \
+	log_tests.mk \
+	md5_tests.mk \
 	sbuff_tests.mk
 
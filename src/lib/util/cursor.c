@@ -33,6 +33,8 @@ RCSID("$Id$")
 
 #define NEXT_PTR(_v) ((void **)(((uint8_t *)(_v)) + cursor->offset))
 
+_Thread_local uint64_t fr_cursor_generation;
+
 /** Internal function to get the next item
  *
  * @param[in,out] prev	attribute to the one we returned.  May be NULL.
@@ -264,6 +266,8 @@ void CC_HINT(hot) fr_cursor_prepend(fr_cursor_t *cursor, void *v)
 {
 	void *old;
 
+	fr_cursor_generation_bump();
+
 #ifndef TALLOC_GET_TYPE_ABORT_NOOP
 	if (cursor->type) _talloc_get_type_abort(v, cursor->type, __location__);
 #endif
@@ -299,6 +303,8 @@ void CC_HINT(hot) fr_cursor_append(fr_cursor_t *cursor, void *v)
 {
 	void *old;
 
+	fr_cursor_generation_bump();
+
 #ifndef TALLOC_GET_TYPE_ABORT_NOOP
 	if (cursor->type) _talloc_get_type_abort(v, cursor->type, __location__);
 #endif
@@ -342,6 +348,8 @@ void fr_cursor_insert(fr_cursor_t *cursor, void *v)
 {
 	void *old;
 
+	fr_cursor_generation_bump();
+
 #ifndef TALLOC_GET_TYPE_ABORT_NOOP
 	if (cursor->type) _talloc_get_type_abort(v, cursor->type, __location__);
 #endif
@@ -373,6 +381,8 @@ void fr_cursor_merge(fr_cursor_t *cursor, fr_cursor_t *to_append)
 {
 	void		*head = NULL, *next, *v;
 
+	fr_cursor_generation_bump();
+
 	/*
 	 *	Build the complete list (in reverse)
 	 */
@@ -595,6 +605,8 @@ void * CC_HINT(hot) fr_cursor_remove(fr_cursor_t *cursor)
 
 	if (!cursor->current) return NULL;			/* don't do anything fancy, it's just a noop */
 
+	fr_cursor_generation_bump();
+
 	v = cursor->current;
 	p = cursor->prev;
 
@@ -651,6 +663,8 @@ void * CC_HINT(hot) fr_cursor_replace(fr_cursor_t *cursor, void *r)
 {
 	void *v, *p;
 
+	fr_cursor_generation_bump();
+
 	/*
 	 *	Correct behaviour here is debatable
 	 */
@@ -723,6 +737,8 @@ void fr_cursor_free_list(fr_cursor_t *cursor)
 
 	if (!*(cursor->head)) return;	/* noop */
 
+	fr_cursor_generation_bump();
+
 	do {
 		v = fr_cursor_remove(cursor);
 		talloc_free(v);
@@ -70,6 +70,22 @@ typedef struct {
 	char const		*type;		//!< If set, used for explicit runtime type safety checks.
 } fr_cursor_t;
 
+/** Incremented whenever a list is modified through a cursor or pair list function
+ *
+ * Lets callers which cache the results of list searches cheaply detect
+ * that those results may be stale.  Lists are only modified by the
+ * thread which owns them, so the counter is thread local.
+ */
+extern _Thread_local uint64_t fr_cursor_generation;
+
+/** Record that a list has been modified
+ *
+ */
+static inline void fr_cursor_generation_bump(void)
+{
+	fr_cursor_generation++;
+}
+
 void fr_cursor_copy(fr_cursor_t *out, fr_cursor_t const *in) CC_HINT(nonnull);
 
 void *fr_cursor_head(fr_cursor_t *cursor);
@@ -150,6 +150,95 @@ void fr_hmac_md5(uint8_t digest[MD5_DIGEST_LENGTH], uint8_t const *in, size_t in
 }
 #endif /* HAVE_OPENSSL_EVP_H */
 
+/** Precompute the inner and outer digest state for a key
+ *
+ * The key only affects the first block of the inner and outer digests,
+ * so when the same key is used repeatedly, the state after hashing those
+ * blocks can be saved and copied, saving two MD5 transforms per HMAC.
+ *
+ * @param[out] hkey	to initialise.  Must be freed with fr_hmac_md5_key_free().
+ * @param[in] key	Pointer to authentication key.
+ * @param[in] key_len	Length of authentication key.
+ * @return
+ *	- 0 on success.
+ *	- -1 if out of memory.
+ */
+int fr_hmac_md5_key_init(fr_hmac_md5_key_t *hkey, uint8_t const *key, size_t key_len)
+{
+	uint8_t		k_ipad[64];
+	uint8_t		k_opad[64];
+	uint8_t		tk[16];
+	int		i;
+
+	/* if key is longer than 64 bytes reset it to key=MD5(key) */
+	if (key_len > 64) {
+		fr_md5_calc(tk, key, key_len);
+
+		key = tk;
+		key_len = 16;
+	}
+
+	memset(k_ipad, 0, sizeof(k_ipad));
+	memset(k_opad, 0, sizeof(k_opad));
+	memcpy(k_ipad, key, key_len);
+	memcpy(k_opad, key, key_len);
+
+	for (i = 0; i < 64; i++) {
+		k_ipad[i] ^= 0x36;
+		k_opad[i] ^= 0x5c;
+	}
+
+	hkey->inner = fr_md5_ctx_alloc(false);
+	hkey->outer = fr_md5_ctx_alloc(false);
+	if (!hkey->inner || !hkey->outer) {
+		fr_hmac_md5_key_free(hkey);
+		return -1;
+	}
+
+	fr_md5_update(hkey->inner, k_ipad, 64);
+	fr_md5_update(hkey->outer, k_opad, 64);
+
+	memset(k_ipad, 0, sizeof(k_ipad));	/* in case it's sensitive */
+	memset(k_opad, 0, sizeof(k_opad));
+
+	return 0;
+}
+
+/** Free the digest state of a precomputed key
+ *
+ * @param[in] hkey	to free.
+ */
+void fr_hmac_md5_key_free(fr_hmac_md5_key_t *hkey)
+{
+	if (hkey->inner) fr_md5_ctx_free(&hkey->inner);
+	if (hkey->outer) fr_md5_ctx_free(&hkey->outer);
+}
+
+/** Calculate HMAC using a precomputed key
+ *
+ * @param digest Caller digest to be filled in.
+ * @param in Pointer to data stream.
+ * @param inlen length of data stream.
+ * @param hkey Precomputed key, from fr_hmac_md5_key_init().
+ */
+void fr_hmac_md5_with_key(uint8_t digest[MD5_DIGEST_LENGTH], uint8_t const *in, size_t inlen,
+			  fr_hmac_md5_key_t const *hkey)
+{
+	fr_md5_ctx_t	*ctx;
+
+	ctx = fr_md5_ctx_alloc(true);
+
+	fr_md5_ctx_copy(ctx, hkey->inner);
+	fr_md5_update(ctx, in, inlen);
+	fr_md5_final(digest, ctx);
+
+	fr_md5_ctx_copy(ctx, hkey->outer);
+	fr_md5_update(ctx, digest, 16);
+	fr_md5_final(digest, ctx);
+
+	fr_md5_ctx_free(&ctx);
+}
+
 /*
 Test Vectors (Trailing '\0' of a character string not included in test):
 
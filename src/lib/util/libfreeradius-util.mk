@@ -30,8 +30,10 @@ SOURCES		:= \
 		   inet.c \
 		   isaac.c \
 		   log.c \
+		   log_record.c \
 		   md4.c \
 		   md5.c \
+		   md5_multi.c \
 		   misc.c \
 		   missing.c \
 		   net.c \
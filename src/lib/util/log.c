@@ -23,18 +23,30 @@
 RCSID("$Id$")
 
 #include <freeradius-devel/util/debug.h>
+#include <freeradius-devel/util/hash.h>
 #include <freeradius-devel/util/log.h>
+#include <freeradius-devel/util/log_record.h>
 #include <freeradius-devel/util/print.h>
 #include <freeradius-devel/util/strerror.h>
 #include <freeradius-devel/util/syserror.h>
 #include <freeradius-devel/util/thread_local.h>
+#include <freeradius-devel/util/time.h>
 #include <freeradius-devel/util/value.h>
 
 #include <fcntl.h>
 #ifdef HAVE_FEATURES_H
 #  include <features.h>
 #endif
+#include <limits.h>
+#include <pthread.h>
+#ifdef HAVE_STDATOMIC_H
+#  include <stdatomic.h>
+#else
+#  include <freeradius-devel/util/stdatomic.h>
+#endif
 #include <stdio.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
 #ifdef HAVE_SYSLOG_H
 #  include <syslog.h>
 #endif
@@ -214,52 +226,1105 @@ static void _fr_vlog_pool_free(void *arg)
 	fr_vlog_pool = NULL;
 }
 
-/** Send a server log message to its destination
+/** Return the thread local memory pool used for formatting messages
+ *
+ */
+static TALLOC_CTX *log_pool(void)
+{
+	TALLOC_CTX *pool;
+
+	/*
+	 *	Allocate a thread local, 4k pool so we don't
+	 *      need to keep allocating memory on the heap.
+	 */
+	pool = fr_vlog_pool;
+	if (!pool) {
+		pool = talloc_pool(NULL, 4096);
+		if (!pool) {
+			fr_perror("Failed allocating memory for vlog_request_pool");
+			return NULL;
+		}
+		fr_thread_local_set_destructor(fr_vlog_pool, _fr_vlog_pool_free, pool);
+	}
+
+	return pool;
+}
+
+static int log_write(fr_log_t const *log, fr_log_type_t type, char const *file, int line,
+		     time_t timeval, char *fmt_msg, TALLOC_CTX *pool);
+
+/** @name Asynchronous log writer
+ *
+ * When enabled, formatted messages are copied into a ring owned by the
+ * thread which generated them, and written out by a dedicated log writer
+ * thread.  A slow disk or syslog socket then only delays the writer, and
+ * not the worker threads processing requests.
+ *
+ * Each ring has exactly one producer (the owning thread) and one consumer
+ * (the log writer), so records are passed between them using only the
+ * atomic head and tail offsets.  The mutex only protects the list of rings,
+ * and the condition variable the writer sleeps on when there's no work.
+ *
+ * Consecutive records for the same destination are written with a single
+ * writev() call.
+ *
+ * With the deferred and binary formats, the arguments of a message are
+ * captured by fr_log_record_args_encode() instead of being formatted, and
+ * the log writer formats them.  With the binary format, messages for log
+ * files aren't formatted at all.  The captured arguments are written to
+ * the file, to be decoded by radlog.
+ * @{
+ */
+#define LOG_ASYNC_ALIGN		(16)
+#define LOG_ASYNC_ALIGN_UP(_x)	(((_x) + (LOG_ASYNC_ALIGN - 1)) & ~((size_t)LOG_ASYNC_ALIGN - 1))
+#define LOG_ASYNC_MIN_SIZE	(4096)
+#define LOG_ASYNC_IOV_MAX	(64)
+#define LOG_ASYNC_IDLE_MS	(100)
+#define LOG_DEFERRED_MAX	(8192)
+
+typedef enum {
+	LOG_RECORD_PAD = 0,			//!< Unused space at the end of the ring.
+	LOG_RECORD_FD,				//!< Write the message to a file descriptor.
+	LOG_RECORD_PATH,			//!< Append the message to a named file.
+	LOG_RECORD_SYSLOG,			//!< Pass the message to syslog().
+	LOG_RECORD_DEFERRED			//!< Format the message, then send it to its destination.
+} log_record_type_t;
+
+/** Header for each message in a ring
+ *
+ * The path (if any) and the message follow the header, and the
+ * whole record is padded to #LOG_ASYNC_ALIGN bytes.
+ */
+typedef struct {
+	uint32_t		size;		//!< Of the record, including this header and padding.
+	uint16_t		type;		//!< One of #log_record_type_t.
+	uint16_t		path_len;	//!< Length of the path, which precedes the message.
+	int32_t			arg;		//!< File descriptor or syslog priority.
+	uint32_t		msg_len;	//!< Length of the message.
+} log_record_t;
+
+/** A message which hasn't been formatted yet
+ *
+ * The prefix and the captured arguments follow the header.
+ */
+typedef struct {
+	fr_log_t const		*log;		//!< Destination.
+	char const		*fmt;		//!< Format string.  Must be a literal.
+	char const		*file;		//!< src file the message was generated in.
+	int32_t			line;		//!< number the message was generated on.
+	uint32_t		type;		//!< #fr_log_type_t of the message.
+	int64_t			when;		//!< Unix time in nanoseconds.
+	uint32_t		prefix_len;	//!< Text to add before the formatted message.
+	uint32_t		args_len;	//!< Length of the captured arguments.
+} log_deferred_t;
+
+/** A format string which has been written to a binary log file
+ *
+ */
+typedef struct {
+	char const		*fmt;		//!< Format string.  NULL if the slot is free.
+	char const		*file;		//!< src file the format string came from.
+	uint32_t		id;		//!< Used by message records to reference the format.
+} log_binary_fmt_t;
+
+typedef struct log_binary_s log_binary_t;
+
+/** A log file being written in binary format
+ *
+ * Only used by the log writer.
+ */
+struct log_binary_s {
+	log_binary_t		*next;		//!< Next binary log file.
+	int			fd;		//!< Of the log file.
+
+	dev_t			dev;		//!< Of the log file, to detect it being replaced.
+	ino_t			ino;		//!< Of the log file, to detect it being replaced.
+	off_t			offset;		//!< Size of the file after our last write.
+
+	uint32_t		num;		//!< Number of format strings written to the file.
+	uint32_t		size;		//!< Of the table.  Always a power of 2.
+	log_binary_fmt_t	*table;		//!< Open addressed hash of format strings.
+};
+
+typedef struct log_ring_s log_ring_t;
+
+struct log_ring_s {
+	log_ring_t		*next;		//!< Next ring in the writer's list.
+
+	uint8_t			*buffer;	//!< Record storage.
+	size_t			size;		//!< Of the buffer.  Always a power of 2.
+
+	atomic_size_t		head;		//!< Only written by the producer.
+	atomic_size_t		tail;		//!< Only written by the log writer.
+
+	atomic_bool		orphaned;	//!< The producer has exited, free once drained.
+
+	atomic_uint_fast64_t	queued;		//!< Messages added by the producer.
+	atomic_uint_fast64_t	dropped;	//!< Messages discarded by the producer.
+};
+
+static struct {
+	pthread_mutex_t		mutex;		//!< Protects the ring list, and the fields below it.
+	pthread_cond_t		cond;		//!< Signalled to wake the log writer.
+	pthread_t		thread;		//!< The log writer.
+
+	log_ring_t		*rings;		//!< One for each thread which has logged a message.
+	bool			alive;		//!< Whether the log writer thread exists.
+	bool			stop;		//!< Tell the log writer to drain all rings and exit.
+	fr_log_async_stats_t	retired;	//!< Counters from rings which have been freed.
+
+	size_t			ring_size;	//!< For new rings.
+	uint32_t		overflow;	//!< One of #fr_log_async_overflow_t.
+	uint32_t		format;		//!< One of #fr_log_async_format_t.
+
+	log_binary_t		*binary;	//!< Binary log files.  Only used by the log writer.
+
+	atomic_bool		running;	//!< Whether producers should queue messages.
+	atomic_bool		idle;		//!< The log writer is about to sleep.
+
+	atomic_uint_fast64_t	written;	//!< Messages written by the log writer.
+	atomic_uint_fast64_t	errors;		//!< Messages the log writer failed to write.
+} log_async = {
+	.mutex = PTHREAD_MUTEX_INITIALIZER,
+	.cond = PTHREAD_COND_INITIALIZER
+};
+
+static _Thread_local log_ring_t *log_async_ring;
+static _Thread_local bool log_async_is_writer;
+
+fr_table_num_sorted_t const fr_log_async_overflow_table[] = {
+	{ "block",	FR_LOG_ASYNC_OVERFLOW_BLOCK	},
+	{ "drop",	FR_LOG_ASYNC_OVERFLOW_DROP	}
+};
+size_t fr_log_async_overflow_table_len = NUM_ELEMENTS(fr_log_async_overflow_table);
+
+fr_table_num_sorted_t const fr_log_async_format_table[] = {
+	{ "binary",	FR_LOG_ASYNC_FORMAT_BINARY	},
+	{ "deferred",	FR_LOG_ASYNC_FORMAT_DEFERRED	},
+	{ "text",	FR_LOG_ASYNC_FORMAT_TEXT	}
+};
+size_t fr_log_async_format_table_len = NUM_ELEMENTS(fr_log_async_format_table);
+
+/** Wake the log writer
+ *
+ */
+static void log_async_wake(void)
+{
+	pthread_mutex_lock(&log_async.mutex);
+	pthread_cond_signal(&log_async.cond);
+	pthread_mutex_unlock(&log_async.mutex);
+}
+
+/** Free a ring, keeping its counters
+ *
+ * @note Must be called with the mutex held.
+ */
+static void log_async_ring_free(log_ring_t *ring)
+{
+	log_ring_t **last;
+
+	for (last = &log_async.rings; *last; last = &(*last)->next) {
+		if (*last != ring) continue;
+
+		*last = ring->next;
+		break;
+	}
+
+	log_async.retired.queued += atomic_load_explicit(&ring->queued, memory_order_relaxed);
+	log_async.retired.dropped += atomic_load_explicit(&ring->dropped, memory_order_relaxed);
+
+	free(ring->buffer);
+	free(ring);
+}
+
+/** Called when a thread which has logged messages exits
+ *
+ * The ring can't be freed until the log writer has drained it.
+ */
+static void _log_async_ring_orphan(void *arg)
+{
+	log_ring_t *ring = arg;
+
+	log_async_ring = NULL;
+
+	pthread_mutex_lock(&log_async.mutex);
+	if (!log_async.alive) {
+		log_async_ring_free(ring);
+	} else {
+		atomic_store_explicit(&ring->orphaned, true, memory_order_release);
+		pthread_cond_signal(&log_async.cond);
+	}
+	pthread_mutex_unlock(&log_async.mutex);
+}
+
+/** Allocate a ring for the current thread, and add it to the writer's list
+ *
+ */
+static log_ring_t *log_async_ring_alloc(void)
+{
+	log_ring_t *ring;
+
+	ring = calloc(1, sizeof(*ring));
+	if (!ring) return NULL;
+
+	ring->size = log_async.ring_size;
+	ring->buffer = malloc(ring->size);
+	if (!ring->buffer) {
+		free(ring);
+		return NULL;
+	}
+	atomic_init(&ring->head, 0);
+	atomic_init(&ring->tail, 0);
+	atomic_init(&ring->orphaned, false);
+	atomic_init(&ring->queued, 0);
+	atomic_init(&ring->dropped, 0);
+
+	pthread_mutex_lock(&log_async.mutex);
+	ring->next = log_async.rings;
+	log_async.rings = ring;
+	pthread_mutex_unlock(&log_async.mutex);
+
+	fr_thread_local_set_destructor(log_async_ring, _log_async_ring_orphan, ring);
+
+	return ring;
+}
+
+/** Copy a message into the current thread's ring
+ *
+ * @param[in] type	of record.
+ * @param[in] arg	file descriptor or syslog priority.
+ * @param[in] path	to append the message to, if type is #LOG_RECORD_PATH.
+ * @param[in] path_len	Length of the path.
+ * @param[in] msg	to write.
+ * @param[in] msg_len	Length of the message.
+ * @return
+ *	- 1 if the message was queued.
+ *	- 0 if the ring was full, and the message was dropped.
+ *	- -1 if the message should be written synchronously by the caller.
+ */
+static int log_async_push(log_record_type_t type, int arg, char const *path, size_t path_len,
+			  char const *msg, size_t msg_len)
+{
+	log_ring_t	*ring = log_async_ring;
+	log_record_t	*rec;
+	size_t		head, tail, pos, need, contig, total;
+
+	if (!atomic_load_explicit(&log_async.running, memory_order_acquire) || log_async_is_writer) return -1;
+
+	if (path_len >= PATH_MAX) return -1;
+
+	if (!ring) {
+		ring = log_async_ring_alloc();
+		if (!ring) return -1;
+	}
+
+	/*
+	 *	Huge messages would monopolise the ring, so
+	 *	they're written directly.
+	 */
+	need = LOG_ASYNC_ALIGN_UP(sizeof(*rec) + path_len + msg_len);
+	if (need > (ring->size / 2)) return -1;
+
+	head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+	pos = head & (ring->size - 1);
+	contig = ring->size - pos;
+
+	/*
+	 *	Records are contiguous, so if there isn't
+	 *	room before the end of the buffer we pad
+	 *	it out and start again at the beginning.
+	 */
+	total = (contig < need) ? (contig + need) : need;
+
+	for (;;) {
+		tail = atomic_load_explicit(&ring->tail, memory_order_acquire);
+		if ((ring->size - (head - tail)) >= total) break;
+
+		if (log_async.overflow == FR_LOG_ASYNC_OVERFLOW_DROP) {
+			atomic_fetch_add_explicit(&ring->dropped, 1, memory_order_relaxed);
+			return 0;
+		}
+
+		log_async_wake();
+		if (!atomic_load_explicit(&log_async.running, memory_order_acquire)) return -1;
+		usleep(100);
+	}
+
+	if (contig < need) {
+		rec = (log_record_t *)(ring->buffer + pos);
+		*rec = (log_record_t){ .size = contig, .type = LOG_RECORD_PAD };
+		head += contig;
+		pos = 0;
+	}
+
+	rec = (log_record_t *)(ring->buffer + pos);
+	*rec = (log_record_t){
+		.size = need,
+		.type = type,
+		.path_len = path_len,
+		.arg = arg,
+		.msg_len = msg_len
+	};
+	if (path_len) memcpy((uint8_t *)(rec + 1), path, path_len);
+	memcpy((uint8_t *)(rec + 1) + path_len, msg, msg_len);
+
+	atomic_store_explicit(&ring->head, head + need, memory_order_seq_cst);
+	atomic_fetch_add_explicit(&ring->queued, 1, memory_order_relaxed);
+
+	/*
+	 *	Pairs with the writer setting idle, then checking
+	 *	the rings.  One of us will see the other's store.
+	 */
+	if (atomic_load_explicit(&log_async.idle, memory_order_seq_cst)) log_async_wake();
+
+	return 1;
+}
+
+/** Write a batch of records which all have the same destination
+ *
+ */
+static void log_async_write(log_record_t const *rec, struct iovec *iov, int iovcnt)
+{
+	int	fd = rec->arg;
+
+	if (rec->type == LOG_RECORD_PATH) {
+		char path[PATH_MAX];
+
+		memcpy(path, rec + 1, rec->path_len);
+		path[rec->path_len] = '\0';
+
+		fd = open(path, O_WRONLY | O_APPEND | O_CREAT, 0666);
+		if (fd < 0) {
+			atomic_fetch_add_explicit(&log_async.errors, iovcnt, memory_order_relaxed);
+			return;
+		}
+	}
+
+	while (iovcnt > 0) {
+		ssize_t	slen;
+
+		slen = writev(fd, iov, iovcnt);
+		if (slen < 0) {
+			if (errno == EINTR) continue;
+			break;
+		}
+
+		/*
+		 *	Skip the messages which were written
+		 *	completely, and retry the remainder.
+		 */
+		while ((iovcnt > 0) && ((size_t)slen >= iov->iov_len)) {
+			slen -= iov->iov_len;
+			iov++;
+			iovcnt--;
+			atomic_fetch_add_explicit(&log_async.written, 1, memory_order_relaxed);
+		}
+		if (iovcnt > 0) {
+			iov->iov_base = (uint8_t *)iov->iov_base + slen;
+			iov->iov_len -= slen;
+		}
+	}
+	if (iovcnt > 0) atomic_fetch_add_explicit(&log_async.errors, iovcnt, memory_order_relaxed);
+
+	if (rec->type == LOG_RECORD_PATH) close(fd);
+}
+
+/** Whether two records can be written with the same call
+ *
+ */
+static inline bool log_async_same_dst(log_record_t const *a, log_record_t const *b)
+{
+	if (a->type != b->type) return false;
+	if ((a->type == LOG_RECORD_SYSLOG) || (a->type == LOG_RECORD_DEFERRED)) return false;
+	if (a->arg != b->arg) return false;
+	if (a->path_len != b->path_len) return false;
+
+	return (memcmp(a + 1, b + 1, a->path_len) == 0);
+}
+
+/** Write an iovec array to a file descriptor, retrying partial writes
+ *
+ */
+static int log_binary_writev(int fd, struct iovec *iov, int iovcnt)
+{
+	while (iovcnt > 0) {
+		ssize_t	slen;
+
+		slen = writev(fd, iov, iovcnt);
+		if (slen < 0) {
+			if (errno == EINTR) continue;
+			return -1;
+		}
+
+		while ((iovcnt > 0) && ((size_t)slen >= iov->iov_len)) {
+			slen -= iov->iov_len;
+			iov++;
+			iovcnt--;
+		}
+		if (iovcnt > 0) {
+			iov->iov_base = (uint8_t *)iov->iov_base + slen;
+			iov->iov_len -= slen;
+		}
+	}
+
+	return 0;
+}
+
+/** Forget all of the format strings written to a binary log file
+ *
+ * Writes a start record, which tells decoders to do the same.
+ */
+static int log_binary_restart(log_binary_t *bin)
+{
+	fr_log_record_start_t	start;
+	struct timespec		ts;
+	struct iovec		iov;
+
+	memset(bin->table, 0, sizeof(bin->table[0]) * bin->size);
+	bin->num = 0;
+
+	clock_gettime(CLOCK_REALTIME, &ts);
+
+	memset(&start, 0, sizeof(start));
+	start.hdr.len = sizeof(start);
+	start.hdr.kind = FR_LOG_RECORD_START;
+	memcpy(start.magic, FR_LOG_RECORD_MAGIC, sizeof(start.magic));
+	start.version = FR_LOG_RECORD_VERSION;
+	start.pid = getpid();
+	start.when = ((int64_t)ts.tv_sec * NSEC) + ts.tv_nsec;
+
+	iov.iov_base = &start;
+	iov.iov_len = sizeof(start);
+
+	return log_binary_writev(bin->fd, &iov, 1);
+}
+
+/** Find or create the state for a binary log file
+ *
+ */
+static log_binary_t *log_binary_find(int fd)
+{
+	log_binary_t *bin;
+
+	for (bin = log_async.binary; bin; bin = bin->next) if (bin->fd == fd) return bin;
+
+	bin = calloc(1, sizeof(*bin));
+	if (!bin) return NULL;
+
+	bin->fd = fd;
+	bin->size = 256;
+	bin->table = calloc(bin->size, sizeof(bin->table[0]));
+	if (!bin->table) {
+		free(bin);
+		return NULL;
+	}
+
+	if (log_binary_restart(bin) < 0) {
+		free(bin->table);
+		free(bin);
+		return NULL;
+	}
+
+	bin->next = log_async.binary;
+	log_async.binary = bin;
+
+	return bin;
+}
+
+/** Free the state of all binary log files
+ *
+ */
+static void log_binary_free(void)
+{
+	log_binary_t *bin, *next;
+
+	for (bin = log_async.binary; bin; bin = next) {
+		next = bin->next;
+		free(bin->table);
+		free(bin);
+	}
+	log_async.binary = NULL;
+}
+
+/** Return the ID of a format string, assigning one if the format is new
+ *
+ * @param[in] bin	log file state.
+ * @param[in] fmt	format string.
+ * @param[in] file	the format string came from.
+ * @param[out] id	of the format string.
+ * @return
+ *	- 1 if the format string is new, and must be written to the file.
+ *	- 0 if the format string has already been written.
+ *	- -1 on error.
+ */
+static int log_binary_format_id(log_binary_t *bin, char const *fmt, char const *file, uint32_t *id)
+{
+	uint32_t	hash, i;
+
+	/*
+	 *	Keep the table at most half full.
+	 */
+	if (((bin->num + 1) * 2) > bin->size) {
+		log_binary_fmt_t	*table, *old = bin->table;
+		uint32_t		size = bin->size * 2, old_size = bin->size, j;
+
+		table = calloc(size, sizeof(table[0]));
+		if (!table) return -1;
+
+		bin->table = table;
+		bin->size = size;
+
+		for (j = 0; j < old_size; j++) {
+			if (!old[j].fmt) continue;
+
+			hash = fr_hash_update(&old[j].file, sizeof(old[j].file), fr_hash(&old[j].fmt, sizeof(old[j].fmt)));
+			for (i = hash & (size - 1); table[i].fmt; i = (i + 1) & (size - 1));
+			table[i] = old[j];
+		}
+		free(old);
+	}
+
+	hash = fr_hash_update(&file, sizeof(file), fr_hash(&fmt, sizeof(fmt)));
+	for (i = hash & (bin->size - 1); bin->table[i].fmt; i = (i + 1) & (bin->size - 1)) {
+		if ((bin->table[i].fmt == fmt) && (bin->table[i].file == file)) {
+			*id = bin->table[i].id;
+			return 0;
+		}
+	}
+
+	bin->table[i].fmt = fmt;
+	bin->table[i].file = file;
+	bin->table[i].id = *id = bin->num++;
+
+	return 1;
+}
+
+/** Write a deferred message to a log file, without formatting it
+ *
+ */
+static int log_binary_write(log_deferred_t const *d)
+{
+	log_binary_t		*bin;
+	fr_log_record_format_t	format;
+	fr_log_record_message_t	msg;
+	struct iovec		iov[6];
+	int			iovcnt = 0;
+	uint32_t		id;
+	struct stat		st;
+
+	bin = log_binary_find(d->log->fd);
+	if (!bin) return -1;
+
+	/*
+	 *	The file was truncated or replaced under us,
+	 *	(logrotate with copytruncate), so the format
+	 *	strings we've written are gone.
+	 */
+	if (fstat(bin->fd, &st) == 0) {
+		if ((bin->num > 0) &&
+		    ((st.st_dev != bin->dev) || (st.st_ino != bin->ino) || (st.st_size < bin->offset))) {
+			if (log_binary_restart(bin) < 0) return -1;
+		}
+		bin->dev = st.st_dev;
+		bin->ino = st.st_ino;
+	}
+
+	switch (log_binary_format_id(bin, d->fmt, d->file, &id)) {
+	case 1:
+		format = (fr_log_record_format_t){
+			.hdr = {
+				.kind = FR_LOG_RECORD_FORMAT
+			},
+			.id = id,
+			.fmt_len = strlen(d->fmt),
+			.file_len = strlen(d->file)
+		};
+		format.hdr.len = sizeof(format) + format.fmt_len + format.file_len;
+
+		iov[iovcnt++] = (struct iovec){ .iov_base = &format, .iov_len = sizeof(format) };
+		iov[iovcnt++] = (struct iovec){ .iov_base = (void *)(uintptr_t)d->fmt, .iov_len = format.fmt_len };
+		iov[iovcnt++] = (struct iovec){ .iov_base = (void *)(uintptr_t)d->file, .iov_len = format.file_len };
+		break;
+
+	case 0:
+		break;
+
+	default:
+		return -1;
+	}
+
+	msg = (fr_log_record_message_t){
+		.hdr = {
+			.len = sizeof(msg) + d->prefix_len + d->args_len,
+			.kind = FR_LOG_RECORD_MESSAGE
+		},
+		.id = id,
+		.type = d->type,
+		.line = d->line,
+		.prefix_len = d->prefix_len,
+		.when = d->when
+	};
+
+	iov[iovcnt++] = (struct iovec){ .iov_base = &msg, .iov_len = sizeof(msg) };
+	iov[iovcnt++] = (struct iovec){ .iov_base = (void *)(uintptr_t)(d + 1),
+					.iov_len = d->prefix_len + d->args_len };
+
+	if (log_binary_writev(bin->fd, iov, iovcnt) < 0) return -1;
+
+	if (fstat(bin->fd, &st) == 0) bin->offset = st.st_size;
+
+	return 0;
+}
+
+/** Format a deferred message, and send it to its destination
+ *
+ */
+static void log_async_deferred(log_deferred_t const *d)
+{
+	char const	*prefix = (char const *)(d + 1);
+	TALLOC_CTX	*pool;
+	char		*msg;
+	int		ret = -1;
+
+	if ((log_async.format == FR_LOG_ASYNC_FORMAT_BINARY) && (d->log->dst == L_DST_FILES)) {
+		ret = log_binary_write(d);
+		goto done;
+	}
+
+	pool = log_pool();
+	if (!pool) goto done;
+
+	msg = fr_log_record_args_print(pool, d->fmt, (uint8_t const *)prefix + d->prefix_len, d->args_len);
+	if (msg && d->prefix_len) msg = talloc_asprintf(pool, "%.*s%s", (int)d->prefix_len, prefix, msg);
+	if (msg) ret = log_write(d->log, d->type, d->file, d->line, (time_t)(d->when / NSEC), msg, pool);
+
+	talloc_free_children(pool);
+
+done:
+	if (ret < 0) {
+		atomic_fetch_add_explicit(&log_async.errors, 1, memory_order_relaxed);
+		return;
+	}
+	atomic_fetch_add_explicit(&log_async.written, 1, memory_order_relaxed);
+}
+
+/** Write out all of the records currently in a ring
+ *
+ * @return
+ *	- true if any records were written.
+ *	- false if the ring was empty.
+ */
+static bool log_async_drain(log_ring_t *ring)
+{
+	struct iovec		iov[LOG_ASYNC_IOV_MAX];
+	int			iovcnt = 0;
+	log_record_t const	*first = NULL;
+	size_t			head, tail;
+
+	tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+	head = atomic_load_explicit(&ring->head, memory_order_acquire);
+	if (tail == head) return false;
+
+	while (tail != head) {
+		log_record_t const *rec = (log_record_t const *)(ring->buffer + (tail & (ring->size - 1)));
+
+		if (rec->type == LOG_RECORD_PAD) {
+			tail += rec->size;
+			continue;
+		}
+
+		/*
+		 *	Different destination, or the batch is
+		 *	full.  Write what we have, and release the
+		 *	space back to the producer.
+		 */
+		if (iovcnt && ((iovcnt == LOG_ASYNC_IOV_MAX) || !log_async_same_dst(first, rec))) {
+			log_async_write(first, iov, iovcnt);
+			iovcnt = 0;
+			atomic_store_explicit(&ring->tail, tail, memory_order_release);
+		}
+
+		if (rec->type == LOG_RECORD_DEFERRED) {
+			log_async_deferred((log_deferred_t const *)(rec + 1));
+			tail += rec->size;
+			continue;
+		}
+
+#ifdef HAVE_SYSLOG_H
+		if (rec->type == LOG_RECORD_SYSLOG) {
+			syslog(rec->arg, "%.*s", (int)rec->msg_len, (char const *)(rec + 1));
+			atomic_fetch_add_explicit(&log_async.written, 1, memory_order_relaxed);
+			tail += rec->size;
+			continue;
+		}
+#endif
+
+		if (!iovcnt) first = rec;
+		iov[iovcnt].iov_base = (uint8_t *)(uintptr_t)(rec + 1) + rec->path_len;
+		iov[iovcnt].iov_len = rec->msg_len;
+		iovcnt++;
+
+		tail += rec->size;
+	}
+
+	if (iovcnt) log_async_write(first, iov, iovcnt);
+	atomic_store_explicit(&ring->tail, tail, memory_order_release);
+
+	return true;
+}
+
+/** Drain every ring, and free the rings of threads which have exited
+ *
+ * @note Only the log writer (or fr_log_async_stop() once the
+ *	writer has exited) may call this function.
+ *
+ * @return
+ *	- true if any records were written.
+ *	- false if all the rings were empty.
+ */
+static bool log_async_drain_all(void)
+{
+	log_ring_t	*ring, *next;
+	bool		busy = false;
+
+	/*
+	 *	New rings are only ever added to the head of the
+	 *	list, and only we remove them, so once we have the
+	 *	head the rest of the list can be walked unlocked.
+	 */
+	pthread_mutex_lock(&log_async.mutex);
+	ring = log_async.rings;
+	pthread_mutex_unlock(&log_async.mutex);
+
+	for (; ring; ring = ring->next) {
+		if (log_async_drain(ring)) busy = true;
+	}
+
+	pthread_mutex_lock(&log_async.mutex);
+	for (ring = log_async.rings; ring; ring = next) {
+		next = ring->next;
+
+		if (!atomic_load_explicit(&ring->orphaned, memory_order_acquire)) continue;
+
+		/*
+		 *	The producer may have logged more before it exited.
+		 */
+		if (atomic_load_explicit(&ring->head, memory_order_acquire) !=
+		    atomic_load_explicit(&ring->tail, memory_order_relaxed)) {
+			busy = true;
+			continue;
+		}
+
+		log_async_ring_free(ring);
+	}
+	pthread_mutex_unlock(&log_async.mutex);
+
+	return busy;
+}
+
+/** Whether any ring has records to write
+ *
+ * @note Must be called with the mutex held.
+ */
+static bool log_async_pending(void)
+{
+	log_ring_t *ring;
+
+	for (ring = log_async.rings; ring; ring = ring->next) {
+		if (atomic_load_explicit(&ring->head, memory_order_seq_cst) !=
+		    atomic_load_explicit(&ring->tail, memory_order_relaxed)) return true;
+	}
+
+	return false;
+}
+
+/** Main loop for the log writer
+ *
+ */
+static void *log_async_thread(UNUSED void *arg)
+{
+	log_async_is_writer = true;
+
+	for (;;) {
+		struct timespec	ts;
+
+		if (log_async_drain_all()) continue;
+
+		pthread_mutex_lock(&log_async.mutex);
+		if (log_async.stop) {
+			pthread_mutex_unlock(&log_async.mutex);
+			break;
+		}
+
+		atomic_store_explicit(&log_async.idle, true, memory_order_seq_cst);
+		if (!log_async_pending()) {
+			clock_gettime(CLOCK_REALTIME, &ts);
+			ts.tv_nsec += LOG_ASYNC_IDLE_MS * 1000000;
+			if (ts.tv_nsec >= 1000000000) {
+				ts.tv_sec++;
+				ts.tv_nsec -= 1000000000;
+			}
+			pthread_cond_timedwait(&log_async.cond, &log_async.mutex, &ts);
+		}
+		atomic_store_explicit(&log_async.idle, false, memory_order_seq_cst);
+		pthread_mutex_unlock(&log_async.mutex);
+	}
+
+	return NULL;
+}
+
+/** Start the log writer thread
+ *
+ * Once started, messages for file, stdout, stderr and syslog
+ * destinations are queued, and written by the log writer.
+ *
+ * @note Must be called after the server has daemonized.
+ *
+ * @param[in] conf	for the log writer.
+ * @return
+ *	- 0 on success.
+ *	- -1 on failure.
+ */
+int fr_log_async_start(fr_log_async_conf_t const *conf)
+{
+	size_t	size = conf->ring_size;
+	int	ret;
+
+	if (atomic_load(&log_async.running)) return 0;
+
+	/*
+	 *	Round up to the nearest power of 2.
+	 */
+	if (size < LOG_ASYNC_MIN_SIZE) size = LOG_ASYNC_MIN_SIZE;
+	size--;
+	size |= size >> 1;
+	size |= size >> 2;
+	size |= size >> 4;
+	size |= size >> 8;
+	size |= size >> 16;
+	size++;
+
+	pthread_mutex_lock(&log_async.mutex);
+	log_async.ring_size = size;
+	log_async.overflow = conf->overflow;
+	log_async.format = conf->format;
+	log_async.stop = false;
+
+	ret = pthread_create(&log_async.thread, NULL, log_async_thread, NULL);
+	if (ret != 0) {
+		pthread_mutex_unlock(&log_async.mutex);
+		fr_strerror_printf("Failed creating log writer thread: %s", fr_syserror(ret));
+		return -1;
+	}
+	log_async.alive = true;
+	pthread_mutex_unlock(&log_async.mutex);
+
+	atomic_store(&log_async.running, true);
+
+	return 0;
+}
+
+/** Stop the log writer, after writing out all queued messages
+ *
+ * Messages logged after this function is called are written
+ * synchronously.
+ */
+void fr_log_async_stop(void)
+{
+	if (!atomic_load(&log_async.running)) return;
+
+	atomic_store(&log_async.running, false);
+
+	pthread_mutex_lock(&log_async.mutex);
+	log_async.stop = true;
+	pthread_cond_signal(&log_async.cond);
+	pthread_mutex_unlock(&log_async.mutex);
+
+	pthread_join(log_async.thread, NULL);
+
+	/*
+	 *	Catch anything queued by threads which saw
+	 *	running == true just before we cleared it.
+	 */
+	while (log_async_drain_all());
+	log_binary_free();
+
+	pthread_mutex_lock(&log_async.mutex);
+	log_async.alive = false;
+	pthread_mutex_unlock(&log_async.mutex);
+}
+
+/** Return the log writer's counters
+ *
+ * @param[out] stats	Where to write the counters.
+ */
+void fr_log_async_stats(fr_log_async_stats_t *stats)
+{
+	log_ring_t *ring;
+
+	pthread_mutex_lock(&log_async.mutex);
+	*stats = log_async.retired;
+	for (ring = log_async.rings; ring; ring = ring->next) {
+		stats->queued += atomic_load_explicit(&ring->queued, memory_order_relaxed);
+		stats->dropped += atomic_load_explicit(&ring->dropped, memory_order_relaxed);
+	}
+	pthread_mutex_unlock(&log_async.mutex);
+
+	stats->written = atomic_load_explicit(&log_async.written, memory_order_relaxed);
+	stats->errors = atomic_load_explicit(&log_async.errors, memory_order_relaxed);
+
+	if (stats->queued > (stats->written + stats->errors)) {
+		stats->pending = stats->queued - (stats->written + stats->errors);
+	}
+}
+
+/** Append a message to a named file
+ *
+ * If the log writer is running, the message is queued, and the file is
+ * opened by the writer.  Otherwise the file is opened, written to, and
+ * closed immediately.
+ *
+ * @param[in] path	of the file.
+ * @param[in] buffer	containing the message.
+ * @param[in] len	of the message.
+ * @return
+ *	- 0 on success.
+ *	- -1 if the message could not be written or queued.
+ */
+int fr_log_file_append(char const *path, char const *buffer, size_t len)
+{
+	int	fd;
+	ssize_t	slen;
+
+	switch (log_async_push(LOG_RECORD_PATH, -1, path, strlen(path), buffer, len)) {
+	case 1:
+		return 0;
+
+	case 0:
+		return -1;
+
+	default:
+		break;
+	}
+
+	fd = open(path, O_WRONLY | O_APPEND | O_CREAT, 0666);
+	if (fd < 0) return -1;
+
+	slen = write(fd, buffer, len);
+	close(fd);
+
+	return (slen < (ssize_t)len) ? -1 : 0;
+}
+
+/** Whether messages for a destination should be formatted by the log writer
+ *
+ * @param[in] log	destination.
+ * @return
+ *	- true if fr_vlog_deferred() will queue the message.
+ *	- false if the caller must format the message itself.
+ */
+bool fr_log_deferred(fr_log_t const *log)
+{
+	if (!atomic_load_explicit(&log_async.running, memory_order_acquire) || log_async_is_writer) return false;
+	if (log_async.format == FR_LOG_ASYNC_FORMAT_TEXT) return false;
+
+	switch (log->dst) {
+	case L_DST_FILES:
+	case L_DST_STDOUT:
+	case L_DST_STDERR:
+	case L_DST_SYSLOG:
+		return true;
+
+	default:
+		return false;
+	}
+}
+
+/** Queue a message to be formatted by the log writer
+ *
+ * The arguments are captured by fr_log_record_args_encode(), which copies
+ * strings and value boxes, so the caller may free them as soon as this
+ * function returns.  The format string and file name are only referenced,
+ * so they must be literals.
  *
  * @param[in] log	destination.
  * @param[in] type	of log message.
  * @param[in] file	src file the log message was generated in.
  * @param[in] line	number the log message was generated on.
+ * @param[in] prefix	Already formatted text to add before the message.  May be NULL.
  * @param[in] fmt	with printf style substitution tokens.
- * @param[in] ap	Substitution arguments.
+ * @param[in] ap	Substitution arguments.  Not consumed.
+ * @return
+ *	- 1 if the message was queued.
+ *	- 0 if the message was dropped.
+ *	- -1 if the caller must format and write the message itself.
  */
-int fr_vlog(fr_log_t const *log, fr_log_type_t type, char const *file, int line, char const *fmt, va_list ap)
+int fr_vlog_deferred(fr_log_t const *log, fr_log_type_t type, char const *file, int line,
+		     char const *prefix, char const *fmt, va_list ap)
+{
+	static _Thread_local uint8_t	buffer[LOG_DEFERRED_MAX];
+	log_deferred_t			d;
+	size_t				prefix_len = prefix ? strlen(prefix) : 0;
+	ssize_t				slen;
+	va_list				aq;
+	struct timespec			ts;
+
+	if (!fr_log_deferred(log)) return -1;
+
+	if ((sizeof(d) + prefix_len) >= sizeof(buffer)) return -1;
+
+	va_copy(aq, ap);
+	slen = fr_log_record_args_encode(buffer + sizeof(d) + prefix_len,
+					 sizeof(buffer) - (sizeof(d) + prefix_len), fmt, aq);
+	va_end(aq);
+	if (slen < 0) return -1;
+
+	clock_gettime(CLOCK_REALTIME, &ts);
+
+	d = (log_deferred_t){
+		.log = log,
+		.fmt = fmt,
+		.file = file,
+		.line = line,
+		.type = type,
+		.when = ((int64_t)ts.tv_sec * NSEC) + ts.tv_nsec,
+		.prefix_len = prefix_len,
+		.args_len = slen
+	};
+	memcpy(buffer, &d, sizeof(d));
+	if (prefix_len) memcpy(buffer + sizeof(d), prefix, prefix_len);
+
+	return log_async_push(LOG_RECORD_DEFERRED, log->fd, NULL, 0,
+			      (char const *)buffer, sizeof(d) + prefix_len + slen);
+}
+/** @} */
+
+/** Add decorations to a formatted message, and write it to its destination
+ *
+ * @param[in] log	destination.
+ * @param[in] type	of log message.
+ * @param[in] file	src file the log message was generated in.
+ * @param[in] line	number the log message was generated on.
+ * @param[in] timeval	when the message was logged.
+ * @param[in] fmt_msg	the formatted message.  Will be modified to remove control chars.
+ * @param[in] pool	for temporary allocations.
+ */
+static int log_write(fr_log_t const *log, fr_log_type_t type, char const *file, int line,
+		     time_t timeval, char *fmt_msg, TALLOC_CTX *pool)
 {
 	int		colourise = log->colourise;
 	char		*buffer;
-	TALLOC_CTX	*pool;
 	int		ret = 0;
 	char const	*fmt_colour = "";
 	char const	*fmt_location = "";
 	char		fmt_time[50];
 	char const	*fmt_facility = "";
 	char const	*fmt_type = "";
-	char		*fmt_msg;
 
 	static char const *spaces = "                                    ";	/* 40 */
 
 	fmt_time[0] = '\0';
 
-	/*
-	 *	If we don't want any messages, then
-	 *	throw them away.
-	 */
-	if (log->dst == L_DST_NULL) return 0;
-
-	/*
-	 *	Allocate a thread local, 4k pool so we don't
-	 *      need to keep allocating memory on the heap.
-	 */
-	pool = fr_vlog_pool;
-	if (!pool) {
-		pool = talloc_pool(NULL, 4096);
-		if (!pool) {
-			fr_perror("Failed allocating memory for vlog_request_pool");
-			return -1;
-		}
-		fr_thread_local_set_destructor(fr_vlog_pool, _fr_vlog_pool_free, pool);
-	}
-
 	/*
 	 *	Set colourisation
 	 */
@@ -308,10 +1373,8 @@ int fr_vlog(fr_log_t const *log, fr_log_type_t type, char const *file, int line,
 
 	case L_TIMESTAMP_ON:
 	{
-		time_t timeval;
 		size_t len;
 
-		timeval = time(NULL);
 #ifdef HAVE_GMTIME_R
 		if (log->dates_utc) {
 			struct tm utc;
@@ -367,7 +1430,7 @@ int fr_vlog(fr_log_t const *log, fr_log_type_t type, char const *file, int line,
 	{
 		char	*p, *end;
 
-		p = fmt_msg = fr_vasprintf(pool, fmt, ap);
+		p = fmt_msg;
 		end = p + talloc_array_length(fmt_msg) - 1;
 
 		/*
@@ -430,6 +1493,24 @@ int fr_vlog(fr_log_t const *log, fr_log_type_t type, char const *file, int line,
 			syslog_priority = LOG_AUTH | LOG_INFO;
 			break;
 		}
+
+		if (atomic_load_explicit(&log_async.running, memory_order_relaxed)) {
+			buffer = talloc_asprintf(pool, "%s%s%s", fmt_time, fmt_time[0] ? ": " : "", fmt_msg);
+
+			switch (log_async_push(LOG_RECORD_SYSLOG, syslog_priority, NULL, 0,
+					       buffer, talloc_array_length(buffer) - 1)) {
+			case 1:
+				goto done;
+
+			case 0:
+				ret = -1;
+				goto done;
+
+			default:
+				break;
+			}
+		}
+
 		syslog(syslog_priority,
 		       "%s"	/* time */
 		       "%s"	/* time sep */
@@ -467,8 +1548,20 @@ int fr_vlog(fr_log_t const *log, fr_log_type_t type, char const *file, int line,
 				 	 colourise ? VTC_RESET : "");
 
 		len = talloc_array_length(buffer) - 1;
-		wrote = write(log->fd, buffer, len);
-		if (wrote < len) ret = -1;
+
+		switch (log_async_push(LOG_RECORD_FD, log->fd, NULL, 0, buffer, len)) {
+		case 1:
+			break;
+
+		case 0:
+			ret = -1;
+			break;
+
+		default:
+			wrote = write(log->fd, buffer, len);
+			if (wrote < len) ret = -1;
+			break;
+		}
 	}
 		break;
 
@@ -477,6 +1570,50 @@ int fr_vlog(fr_log_t const *log, fr_log_type_t type, char const *file, int line,
 		break;
 	}
 
+#ifdef HAVE_SYSLOG_H
+done:
+#endif
+	return ret;
+}
+
+/** Send a server log message to its destination
+ *
+ * @param[in] log	destination.
+ * @param[in] type	of log message.
+ * @param[in] file	src file the log message was generated in.
+ * @param[in] line	number the log message was generated on.
+ * @param[in] fmt	with printf style substitution tokens.
+ * @param[in] ap	Substitution arguments.
+ */
+int fr_vlog(fr_log_t const *log, fr_log_type_t type, char const *file, int line, char const *fmt, va_list ap)
+{
+	TALLOC_CTX	*pool;
+	char		*fmt_msg;
+	int		ret;
+
+	/*
+	 *	If we don't want any messages, then
+	 *	throw them away.
+	 */
+	if (log->dst == L_DST_NULL) return 0;
+
+	/*
+	 *	Let the log writer do the formatting.
+	 */
+	ret = fr_vlog_deferred(log, type, file, line, NULL, fmt, ap);
+	if (ret >= 0) return (ret > 0) ? 0 : -1;
+
+	pool = log_pool();
+	if (!pool) return -1;
+
+	fmt_msg = fr_vasprintf(pool, fmt, ap);
+	if (!fmt_msg) {
+		talloc_free_children(pool);
+		return -1;
+	}
+
+	ret = log_write(log, type, file, line, time(NULL), fmt_msg, pool);
+
 	talloc_free_children(pool);	/* clears all temporary allocations */
 
 	return ret;
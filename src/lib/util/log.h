@@ -115,6 +115,44 @@ typedef struct {
 extern fr_log_t default_log;
 extern bool fr_log_rate_limit;
 
+typedef enum {
+	FR_LOG_ASYNC_OVERFLOW_DROP = 0,		//!< Discard messages when a thread's ring is full.
+	FR_LOG_ASYNC_OVERFLOW_BLOCK		//!< Wait for the log writer to make room.
+} fr_log_async_overflow_t;
+
+extern fr_table_num_sorted_t const fr_log_async_overflow_table[];
+extern size_t fr_log_async_overflow_table_len;
+
+typedef enum {
+	FR_LOG_ASYNC_FORMAT_TEXT = 0,		//!< Messages are formatted by the thread which logged them.
+	FR_LOG_ASYNC_FORMAT_DEFERRED,		//!< Messages are formatted by the log writer.
+	FR_LOG_ASYNC_FORMAT_BINARY		//!< Messages for log files are written unformatted.
+} fr_log_async_format_t;
+
+extern fr_table_num_sorted_t const fr_log_async_format_table[];
+extern size_t fr_log_async_format_table_len;
+
+/** Configuration for the asynchronous log writer
+ *
+ */
+typedef struct {
+	bool			enabled;	//!< Queue messages for the log writer thread.
+	size_t			ring_size;	//!< Size of each thread's ring buffer.
+	uint32_t		overflow;	//!< What to do when a ring is full, one of #fr_log_async_overflow_t.
+	uint32_t		format;		//!< Who formats messages, one of #fr_log_async_format_t.
+} fr_log_async_conf_t;
+
+/** Counters for the asynchronous log writer
+ *
+ */
+typedef struct {
+	uint64_t		queued;		//!< Messages added to a ring.
+	uint64_t		dropped;	//!< Messages discarded because a ring was full.
+	uint64_t		written;	//!< Messages written by the log writer.
+	uint64_t		errors;		//!< Messages the log writer failed to write.
+	uint64_t		pending;	//!< Messages waiting to be written.
+} fr_log_async_stats_t;
+
 
 /** Whether rate limiting is enabled
  *
@@ -128,6 +166,20 @@ static inline bool fr_rate_limit_enabled(void)
 
 int	fr_log_init(fr_log_t *log, bool daemonize);
 
+int	fr_log_async_start(fr_log_async_conf_t const *conf) CC_HINT(nonnull);
+
+void	fr_log_async_stop(void);
+
+void	fr_log_async_stats(fr_log_async_stats_t *stats) CC_HINT(nonnull);
+
+int	fr_log_file_append(char const *path, char const *buffer, size_t len) CC_HINT(nonnull);
+
+bool	fr_log_deferred(fr_log_t const *log) CC_HINT(nonnull);
+
+int	fr_vlog_deferred(fr_log_t const *log, fr_log_type_t type, char const *file, int line,
+			 char const *prefix, char const *fmt, va_list ap)
+	CC_HINT(format (printf, 6, 0)) CC_HINT(nonnull (1,3,6));
+
 int	fr_vlog(fr_log_t const *log, fr_log_type_t lvl, char const *file, int line, char const *fmt, va_list ap)
 	CC_HINT(format (printf, 5, 0)) CC_HINT(nonnull (1,3));
 
@@ -0,0 +1,750 @@
+/*
+ *   This library is free software; you can redistribute it and/or
+ *   modify it under the terms of the GNU Lesser General Public
+ *   License as published by the Free Software Foundation; either
+ *   version 2.1 of the License, or (at your option) any later version.
+ *
+ *   This library is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ *   Lesser General Public License for more details.
+ *
+ *   You should have received a copy of the GNU Lesser General Public
+ *   License along with this library; if not, write to the Free Software
+ *   Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ */
+
+/** Capture the arguments of log messages, so they can be formatted later
+ *
+ * Formatting a message (especially one containing value boxes) is often
+ * more expensive than writing it.  Instead of formatting on the thread
+ * which logged the message, the arguments are copied into a compact binary
+ * form, and the message is formatted by the log writer thread, or by an
+ * offline decoder.
+ *
+ * The format string itself is not copied, so it must remain valid until
+ * the record has been formatted.  This is true of string literals, which
+ * is what the CC_HINT(format) checks on the logging functions enforce.
+ *
+ * @file src/lib/util/log_record.c
+ *
+ * @copyright 2020 The FreeRADIUS server project
+ */
+RCSID("$Id$")
+
+#include <freeradius-devel/util/log_record.h>
+#include <freeradius-devel/util/pair.h>
+#include <freeradius-devel/util/print.h>
+#include <freeradius-devel/util/value.h>
+
+#include <ctype.h>
+#include <stddef.h>
+#include <string.h>
+
+/** Types of captured arguments
+ *
+ * Each argument is a one byte tag, followed by the data for that tag.
+ */
+typedef enum {
+	LOG_ARG_INT = 1,			//!< int64_t, for all integer conversions and '*' fields.
+	LOG_ARG_DOUBLE,				//!< double.
+	LOG_ARG_LDOUBLE,			//!< long double.
+	LOG_ARG_STRING,				//!< uint32_t length, then the string, then a '\0'.
+	LOG_ARG_NULL,				//!< A NULL string or value box.
+	LOG_ARG_PTR,				//!< uint64_t, for '%p'.
+	LOG_ARG_BOX				//!< uint8_t type, uint32_t length, then the value.
+} log_arg_t;
+
+/** A single conversion in a format string
+ *
+ */
+typedef struct {
+	char const	*literal;		//!< Text preceding the conversion.
+	size_t		literal_len;		//!< Length of the text.
+
+	char const	*spec;			//!< Start of the conversion i.e. the '%'.
+	size_t		spec_len;		//!< Length of the conversion.
+
+	bool		width_star;		//!< Width is passed as an argument.
+	bool		prec_star;		//!< Precision is passed as an argument.
+	int		prec;			//!< Precision, or -1 if there isn't one.
+	char		len[2];			//!< Length modifier.
+	char		conv;			//!< Conversion, or one of 'V', 'H', 'M', 'P' for our '%p' extensions.
+} log_spec_t;
+
+/** Find the next conversion in a format string
+ *
+ * This mirrors the parsing done by fr_vasprintf().
+ *
+ * @param[in,out] p_fmt	Where to start looking.  Updated to point after the conversion.
+ * @param[out] spec	Details of the conversion.
+ * @return
+ *	- 1 if a conversion was found.
+ *	- 0 if the end of the format string was reached.  Only the literal fields of spec are set.
+ *	- -1 if the conversion can't be captured.
+ */
+static int log_spec_next(char const **p_fmt, log_spec_t *spec)
+{
+	char const *p = *p_fmt;
+
+	memset(spec, 0, sizeof(*spec));
+	spec->literal = p;
+	spec->prec = -1;
+
+	while (*p) {
+		if (*p != '%') {
+			p++;
+			continue;
+		}
+		if (p[1] == '%') {
+			p += 2;
+			continue;
+		}
+		break;
+	}
+	spec->literal_len = p - spec->literal;
+	*p_fmt = p;
+
+	if (!*p) return 0;
+
+	spec->spec = p++;
+
+	/*
+	 *	Positional arguments can't be captured in order.
+	 */
+	{
+		char const *q;
+
+		for (q = p; isdigit((uint8_t) *q); q++);
+		if ((q != p) && (*q == '$')) return -1;
+	}
+
+	while (*p && strchr("-+ 0#", *p)) p++;
+
+	if (*p == '*') {
+		spec->width_star = true;
+		p++;
+	} else {
+		while (isdigit((uint8_t) *p)) p++;
+	}
+
+	if (*p == '.') {
+		p++;
+		if (*p == '*') {
+			spec->prec_star = true;
+			p++;
+		} else {
+			spec->prec = 0;
+			while (isdigit((uint8_t) *p)) spec->prec = (spec->prec * 10) + (*p++ - '0');
+		}
+	}
+
+	switch (*p) {
+	case 'h':
+	case 'l':
+		spec->len[0] = *p++;
+		if (*p == spec->len[0]) spec->len[1] = *p++;
+		break;
+
+	case 'L':
+	case 'z':
+	case 'j':
+	case 't':
+		spec->len[0] = *p++;
+		break;
+
+	default:
+		break;
+	}
+
+	if (!*p) return -1;
+
+	if ((*p == 'p') && p[1] && strchr("VHMP", p[1])) {
+		spec->conv = p[1];
+		p += 2;
+	} else {
+		spec->conv = *p++;
+	}
+
+	spec->spec_len = p - spec->spec;
+	*p_fmt = p;
+
+	return 1;
+}
+
+#define LOG_ARG_PUT(_tag, _data, _len) \
+do { \
+	if ((size_t)(end - out) < (1 + (_len))) return -1; \
+	*out++ = (_tag); \
+	memcpy(out, (_data), (_len)); \
+	out += (_len); \
+} while (0)
+
+/** Copy a string argument, adding its length and a trailing '\0'
+ *
+ */
+static uint8_t *log_arg_put_string(uint8_t *out, uint8_t const *end, char const *str, size_t len)
+{
+	uint32_t len32 = len;
+
+	if ((size_t)(end - out) < (1 + sizeof(len32) + len + 1)) return NULL;
+
+	*out++ = LOG_ARG_STRING;
+	memcpy(out, &len32, sizeof(len32));
+	out += sizeof(len32);
+	memcpy(out, str, len);
+	out += len;
+	*out++ = '\0';
+
+	return out;
+}
+
+/** Copy a value box argument
+ *
+ * Strings, octets and fixed size values are copied.  Anything
+ * else needs the box's context to print, and so is printed now.
+ */
+static uint8_t *log_arg_put_box(uint8_t *out, uint8_t const *end, char conv, fr_value_box_t const *in)
+{
+	uint8_t const	*data;
+	uint32_t	len;
+	uint8_t		type;
+	char		*subst;
+
+	if (in->enumv) goto print;
+
+	switch (in->type) {
+	case FR_TYPE_STRING:
+	case FR_TYPE_OCTETS:
+		data = in->vb_octets;
+		len = in->vb_length;
+		break;
+
+	case FR_TYPE_ABINARY:
+	case FR_TYPE_VALUE_BOX:
+		goto print;
+
+	default:
+		if ((in->type >= FR_TYPE_MAX) || !fr_value_box_field_sizes[in->type]) goto print;
+
+		data = ((uint8_t const *)in) + fr_value_box_offsets[in->type];
+		len = fr_value_box_field_sizes[in->type];
+		break;
+	}
+
+	if ((size_t)(end - out) < (2 + sizeof(len) + len + 1)) return NULL;
+
+	type = in->type;
+	*out++ = LOG_ARG_BOX;
+	*out++ = type;
+	memcpy(out, &len, sizeof(len));
+	out += sizeof(len);
+	if (len) memcpy(out, data, len);
+	out += len;
+	*out++ = '\0';		/* So strings can be used in place */
+
+	return out;
+
+print:
+	if (conv == 'H') {
+		subst = fr_asprintf(NULL, "%pH", in);
+	} else {
+		subst = fr_asprintf(NULL, "%pV", in);
+	}
+	if (!subst) return NULL;
+
+	out = log_arg_put_string(out, end, subst, talloc_array_length(subst) - 1);
+	talloc_free(subst);
+
+	return out;
+}
+
+/** Capture the arguments for a format string
+ *
+ * Strings, and the values of value boxes are copied, so the captured arguments
+ * remain valid after the caller's memory has been freed.  Arguments which can't
+ * be printed without their context (#VALUE_PAIR, lists of value boxes, and value
+ * boxes with enumerations) are printed immediately.
+ *
+ * @param[out] out	Where to write the arguments.
+ * @param[in] outlen	Length of out.
+ * @param[in] fmt	with printf style substitution tokens.
+ * @param[in] ap	Substitution arguments.
+ * @return
+ *	- The number of bytes written to out.
+ *	- -1 if out was too small, or the format string contains a
+ *	  conversion we can't capture.  The caller should format the
+ *	  message immediately instead.
+ */
+ssize_t fr_log_record_args_encode(uint8_t *out, size_t outlen, char const *fmt, va_list ap)
+{
+	uint8_t		*start = out, *end = out + outlen;
+	char const	*p = fmt;
+	log_spec_t	spec;
+	int		ret;
+
+	while ((ret = log_spec_next(&p, &spec)) > 0) {
+		int64_t		num;
+
+		if (spec.width_star) {
+			num = va_arg(ap, int);
+			LOG_ARG_PUT(LOG_ARG_INT, &num, sizeof(num));
+		}
+		if (spec.prec_star) {
+			num = va_arg(ap, int);
+			LOG_ARG_PUT(LOG_ARG_INT, &num, sizeof(num));
+			spec.prec = num;
+		}
+
+		switch (spec.conv) {
+		case 'd':
+		case 'i':
+			switch (spec.len[0]) {
+			case 'l':
+				num = (spec.len[1] == 'l') ? va_arg(ap, long long) : va_arg(ap, long);
+				break;
+
+			case 'z':
+				num = va_arg(ap, ssize_t);
+				break;
+
+			case 'j':
+				num = va_arg(ap, intmax_t);
+				break;
+
+			case 't':
+				num = va_arg(ap, ptrdiff_t);
+				break;
+
+			default:
+				num = va_arg(ap, int);
+				break;
+			}
+			LOG_ARG_PUT(LOG_ARG_INT, &num, sizeof(num));
+			break;
+
+		case 'u':
+		case 'x':
+		case 'X':
+		case 'o':
+		case 'c':
+		{
+			uint64_t unum;
+
+			switch (spec.len[0]) {
+			case 'l':
+				unum = (spec.len[1] == 'l') ? va_arg(ap, unsigned long long) : va_arg(ap, unsigned long);
+				break;
+
+			case 'z':
+				unum = va_arg(ap, size_t);
+				break;
+
+			case 'j':
+				unum = va_arg(ap, uintmax_t);
+				break;
+
+			case 't':
+				unum = va_arg(ap, ptrdiff_t);
+				break;
+
+			default:
+				unum = va_arg(ap, unsigned int);
+				break;
+			}
+			LOG_ARG_PUT(LOG_ARG_INT, &unum, sizeof(unum));
+		}
+			break;
+
+		case 'f':
+		case 'F':
+		case 'e':
+		case 'E':
+		case 'g':
+		case 'G':
+		case 'a':
+		case 'A':
+			if (spec.len[0] == 'L') {
+				long double ld = va_arg(ap, long double);
+
+				LOG_ARG_PUT(LOG_ARG_LDOUBLE, &ld, sizeof(ld));
+			} else {
+				double d = va_arg(ap, double);
+
+				LOG_ARG_PUT(LOG_ARG_DOUBLE, &d, sizeof(d));
+			}
+			break;
+
+		case 's':
+		{
+			char const *str = va_arg(ap, char const *);
+
+			if (!str) {
+				if (out >= end) return -1;
+				*out++ = LOG_ARG_NULL;
+				break;
+			}
+
+			/*
+			 *	With a precision the string doesn't
+			 *	need to be \0 terminated.
+			 */
+			out = log_arg_put_string(out, end, str, (spec.prec >= 0) ? strnlen(str, spec.prec) : strlen(str));
+			if (!out) return -1;
+		}
+			break;
+
+		case 'p':
+		{
+			uint64_t ptr = (uintptr_t) va_arg(ap, void *);
+
+			LOG_ARG_PUT(LOG_ARG_PTR, &ptr, sizeof(ptr));
+		}
+			break;
+
+		case 'V':
+		case 'H':
+		{
+			fr_value_box_t const *in = va_arg(ap, fr_value_box_t const *);
+
+			if (!in) {
+				if (out >= end) return -1;
+				*out++ = LOG_ARG_NULL;
+				break;
+			}
+
+			out = log_arg_put_box(out, end, spec.conv, in);
+			if (!out) return -1;
+		}
+			break;
+
+		case 'M':
+		case 'P':
+		{
+			void const	*in = va_arg(ap, void const *);
+			char		*subst;
+
+			if (!in) {
+				if (out >= end) return -1;
+				*out++ = LOG_ARG_NULL;
+				break;
+			}
+
+			if (spec.conv == 'M') {
+				subst = fr_value_box_list_asprint(NULL, in, NULL, '"');
+			} else {
+				subst = fr_pair_asprint(NULL, in, '"');
+			}
+			if (!subst) return -1;
+
+			out = log_arg_put_string(out, end, subst, talloc_array_length(subst) - 1);
+			talloc_free(subst);
+			if (!out) return -1;
+		}
+			break;
+
+		case 'n':
+			(void) va_arg(ap, int *);
+			break;
+
+		default:
+			return -1;
+		}
+	}
+	if (ret < 0) return -1;
+
+	return out - start;
+}
+
+/** Read the next argument, checking it's of the expected type
+ *
+ */
+static uint8_t const *log_arg_get(uint8_t const *p, uint8_t const *end, log_arg_t tag, void *data, size_t len)
+{
+	if (!p || (p >= end) || (*p != tag) || ((size_t)(end - (p + 1)) < len)) return NULL;
+
+	memcpy(data, p + 1, len);
+
+	return p + 1 + len;
+}
+
+/** Append literal text to the output, removing the escaping from '%%'
+ *
+ */
+static char *log_literal_append(char *out, char const *literal, size_t len)
+{
+	char const *p = literal, *end = literal + len, *q;
+
+	while (p < end) {
+		q = memchr(p, '%', end - p);
+		if (!q) return talloc_strndup_append_buffer(out, p, end - p);
+
+		out = talloc_strndup_append_buffer(out, p, (q + 1) - p);
+		if (!out) return NULL;
+		p = q + 2;	/* Skip the second '%' */
+	}
+
+	return out;
+}
+
+DIAG_OFF(format-nonliteral)
+/** Format a message using previously captured arguments
+ *
+ * @param[in] ctx	to allocate the message in.
+ * @param[in] fmt	the arguments were captured with.
+ * @param[in] args	as produced by #fr_log_record_args_encode.
+ * @param[in] args_len	Length of args.
+ * @return
+ *	- The formatted message.
+ *	- NULL on error.
+ */
+char *fr_log_record_args_print(TALLOC_CTX *ctx, char const *fmt, uint8_t const *args, size_t args_len)
+{
+	uint8_t const	*p = args, *end = args + args_len;
+	char const	*f = fmt;
+	char		*out;
+	log_spec_t	spec;
+	int		ret;
+
+	out = talloc_strdup(ctx, "");
+
+	while (out && ((ret = log_spec_next(&f, &spec)) > 0)) {
+		char		sub[64];
+		char const	*s;
+		int64_t		width = 0, prec = 0;
+
+		out = log_literal_append(out, spec.literal, spec.literal_len);
+		if (!out) return NULL;
+
+		if (spec.width_star) p = log_arg_get(p, end, LOG_ARG_INT, &width, sizeof(width));
+		if (spec.prec_star) p = log_arg_get(p, end, LOG_ARG_INT, &prec, sizeof(prec));
+
+		/*
+		 *	Replace any '*' with the captured values,
+		 *	so the conversion only takes one argument.
+		 */
+		{
+			char	*q = sub, *q_end = sub + sizeof(sub);
+
+			for (s = spec.spec; s < (spec.spec + spec.spec_len); s++) {
+				if (q_end - q < 24) goto bad;
+
+				if (*s != '*') {
+					*q++ = *s;
+					continue;
+				}
+
+				/*
+				 *	The first '*' is the width, unless there's only a precision.
+				 */
+				if (spec.width_star && (s[-1] != '.')) {
+					q += snprintf(q, q_end - q, "%d", (int) width);
+				} else {
+					q += snprintf(q, q_end - q, "%d", (int) prec);
+				}
+			}
+			*q = '\0';
+		}
+
+		if (!p && (spec.conv != 'n')) goto bad;
+
+		switch (spec.conv) {
+		case 'd':
+		case 'i':
+		{
+			int64_t num;
+
+			p = log_arg_get(p, end, LOG_ARG_INT, &num, sizeof(num));
+			if (!p) goto bad;
+
+			switch (spec.len[0]) {
+			case 'l':
+				if (spec.len[1] == 'l') {
+					out = talloc_asprintf_append_buffer(out, sub, (long long) num);
+				} else {
+					out = talloc_asprintf_append_buffer(out, sub, (long) num);
+				}
+				break;
+
+			case 'z':
+				out = talloc_asprintf_append_buffer(out, sub, (ssize_t) num);
+				break;
+
+			case 'j':
+				out = talloc_asprintf_append_buffer(out, sub, (intmax_t) num);
+				break;
+
+			case 't':
+				out = talloc_asprintf_append_buffer(out, sub, (ptrdiff_t) num);
+				break;
+
+			default:
+				out = talloc_asprintf_append_buffer(out, sub, (int) num);
+				break;
+			}
+		}
+			break;
+
+		case 'u':
+		case 'x':
+		case 'X':
+		case 'o':
+		case 'c':
+		{
+			uint64_t unum;
+
+			p = log_arg_get(p, end, LOG_ARG_INT, &unum, sizeof(unum));
+			if (!p) goto bad;
+
+			switch (spec.len[0]) {
+			case 'l':
+				if (spec.len[1] == 'l') {
+					out = talloc_asprintf_append_buffer(out, sub, (unsigned long long) unum);
+				} else {
+					out = talloc_asprintf_append_buffer(out, sub, (unsigned long) unum);
+				}
+				break;
+
+			case 'z':
+				out = talloc_asprintf_append_buffer(out, sub, (size_t) unum);
+				break;
+
+			case 'j':
+				out = talloc_asprintf_append_buffer(out, sub, (uintmax_t) unum);
+				break;
+
+			case 't':
+				out = talloc_asprintf_append_buffer(out, sub, (ptrdiff_t) unum);
+				break;
+
+			default:
+				out = talloc_asprintf_append_buffer(out, sub, (unsigned int) unum);
+				break;
+			}
+		}
+			break;
+
+		case 'f':
+		case 'F':
+		case 'e':
+		case 'E':
+		case 'g':
+		case 'G':
+		case 'a':
+		case 'A':
+			if (spec.len[0] == 'L') {
+				long double ld;
+
+				p = log_arg_get(p, end, LOG_ARG_LDOUBLE, &ld, sizeof(ld));
+				if (!p) goto bad;
+				out = talloc_asprintf_append_buffer(out, sub, ld);
+			} else {
+				double d;
+
+				p = log_arg_get(p, end, LOG_ARG_DOUBLE, &d, sizeof(d));
+				if (!p) goto bad;
+				out = talloc_asprintf_append_buffer(out, sub, d);
+			}
+			break;
+
+		case 's':
+		case 'V':
+		case 'H':
+		case 'M':
+		case 'P':
+		{
+			uint32_t	len;
+			char		*subst;
+
+			if (p >= end) goto bad;
+
+			if (*p == LOG_ARG_NULL) {
+				p++;
+				out = talloc_strdup_append_buffer(out, "(null)");
+				break;
+			}
+
+			/*
+			 *	Value boxes are rebuilt, pointing
+			 *	into the record, and printed using
+			 *	the normal code.
+			 */
+			if (*p == LOG_ARG_BOX) {
+				fr_value_box_t	box;
+				uint8_t		type;
+
+				if ((end - p) < (ptrdiff_t)(2 + sizeof(len))) goto bad;
+				type = p[1];
+				memcpy(&len, p + 2, sizeof(len));
+				p += 2 + sizeof(len);
+				if ((size_t)(end - p) < ((size_t)len + 1)) goto bad;
+				if (type >= FR_TYPE_MAX) goto bad;
+
+				fr_value_box_init(&box, type, NULL, false);
+				switch (type) {
+				case FR_TYPE_STRING:
+				case FR_TYPE_OCTETS:
+					box.vb_octets = p;
+					box.vb_length = len;
+					break;
+
+				default:
+					if (len != fr_value_box_field_sizes[type]) goto bad;
+					memcpy(((uint8_t *)&box) + fr_value_box_offsets[type], p, len);
+					break;
+				}
+				p += len + 1;
+
+				if (spec.conv == 'H') {
+					subst = fr_asprintf(NULL, "%pH", &box);
+				} else {
+					subst = fr_asprintf(NULL, "%pV", &box);
+				}
+				if (!subst) goto bad;
+
+				out = talloc_strdup_append_buffer(out, subst);
+				talloc_free(subst);
+				break;
+			}
+
+			if ((end - p) < (ptrdiff_t)(1 + sizeof(len)) || (*p != LOG_ARG_STRING)) goto bad;
+			memcpy(&len, p + 1, sizeof(len));
+			p += 1 + sizeof(len);
+			if ((size_t)(end - p) < ((size_t)len + 1)) goto bad;
+
+			if (spec.conv == 's') {
+				out = talloc_asprintf_append_buffer(out, sub, (char const *) p);
+			} else {
+				out = talloc_strndup_append_buffer(out, (char const *) p, len);
+			}
+			p += len + 1;
+		}
+			break;
+
+		case 'p':
+		{
+			uint64_t ptr;
+
+			p = log_arg_get(p, end, LOG_ARG_PTR, &ptr, sizeof(ptr));
+			if (!p) goto bad;
+			out = talloc_asprintf_append_buffer(out, sub, (void *)(uintptr_t) ptr);
+		}
+			break;
+
+		case 'n':
+			break;
+
+		default:
+		bad:
+			/*
+			 *	Print what we can, so the message
+			 *	isn't lost completely.
+			 */
+			return talloc_strdup_append_buffer(out, "<invalid log arguments>");
+		}
+	}
+	if (!out) return NULL;
+
+	return log_literal_append(out, spec.literal, spec.literal_len);
+}
+DIAG_ON(format-nonliteral)
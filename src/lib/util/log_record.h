@@ -0,0 +1,105 @@
+#pragma once
+/*
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ */
+
+/** Binary log records
+ *
+ * @file src/lib/util/log_record.h
+ *
+ * @copyright 2020 The FreeRADIUS server project
+ */
+RCSIDH(log_record_h, "$Id$")
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <freeradius-devel/build.h>
+#include <freeradius-devel/missing.h>
+
+#include <stdarg.h>
+#include <stdint.h>
+#include <talloc.h>
+
+/** @name Binary log file format
+ *
+ * A binary log file is a sequence of records, each starting with
+ * a #fr_log_record_hdr_t.  All integers are in host byte order, and
+ * the arguments of a message are in the layout produced by
+ * #fr_log_record_args_encode, so the file must be decoded by a
+ * build of the same version, on the same architecture.
+ *
+ * - #FR_LOG_RECORD_START is written whenever a server starts writing
+ *   to the file.  Format IDs are only valid until the next start record.
+ * - #FR_LOG_RECORD_FORMAT is written the first time a format string
+ *   is used, and is followed by the format string and the name of
+ *   the source file it came from.
+ * - #FR_LOG_RECORD_MESSAGE references a format string by ID, and is
+ *   followed by the message prefix, and the captured arguments.
+ *
+ * Anything else in the file (such as text written before the log
+ * writer started) should be passed through unchanged by decoders.
+ * @{
+ */
+#define FR_LOG_RECORD_MAGIC	"FRLOGBIN"
+#define FR_LOG_RECORD_VERSION	1
+#define FR_LOG_RECORD_MAX	(1 << 20)		//!< Larger lengths mean the data isn't a record.
+
+typedef enum {
+	FR_LOG_RECORD_START = 1,			//!< A server started writing to the file.
+	FR_LOG_RECORD_FORMAT,				//!< Defines a format string.
+	FR_LOG_RECORD_MESSAGE				//!< A message, and its unformatted arguments.
+} fr_log_record_kind_t;
+
+typedef struct {
+	uint32_t		len;			//!< Of the record, including this header.
+	uint32_t		kind;			//!< One of #fr_log_record_kind_t.
+} fr_log_record_hdr_t;
+
+typedef struct {
+	fr_log_record_hdr_t	hdr;
+	char			magic[8];		//!< #FR_LOG_RECORD_MAGIC, without the '\0'.
+	uint32_t		version;		//!< #FR_LOG_RECORD_VERSION.
+	uint32_t		pid;			//!< Of the server.
+	int64_t			when;			//!< Unix time in nanoseconds.
+} fr_log_record_start_t;
+
+typedef struct {
+	fr_log_record_hdr_t	hdr;
+	uint32_t		id;			//!< Used by messages to reference this format.
+	uint32_t		fmt_len;		//!< Length of the format string.
+	uint32_t		file_len;		//!< Length of the source file name.
+} fr_log_record_format_t;
+
+typedef struct {
+	fr_log_record_hdr_t	hdr;
+	uint32_t		id;			//!< Of the format string.
+	uint32_t		type;			//!< #fr_log_type_t of the message.
+	int32_t			line;			//!< The message was logged from.
+	uint32_t		prefix_len;		//!< Length of the prefix, which precedes the arguments.
+	int64_t			when;			//!< Unix time in nanoseconds.
+} fr_log_record_message_t;
+/** @} */
+
+ssize_t	fr_log_record_args_encode(uint8_t *out, size_t outlen, char const *fmt, va_list ap)
+	CC_HINT(format (printf, 3, 0)) CC_HINT(nonnull (1, 3));
+
+char	*fr_log_record_args_print(TALLOC_CTX *ctx, char const *fmt, uint8_t const *args, size_t args_len)
+	CC_HINT(nonnull (2));
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,308 @@
+#include <freeradius-devel/util/acutest.h>
+
+#include "log_record.c"
+
+static uint8_t		test_args[4096];
+
+/** Capture the arguments for a message, then check they print the same as fr_vasprintf() would
+ *
+ */
+static void test_print(char const *fmt, ...) CC_HINT(format (printf, 1, 2));
+static void test_print(char const *fmt, ...)
+{
+	va_list	ap, aq;
+	ssize_t	slen;
+	char	*expected, *got;
+
+	va_start(ap, fmt);
+	va_copy(aq, ap);
+	slen = fr_log_record_args_encode(test_args, sizeof(test_args), fmt, ap);
+	expected = fr_vasprintf(NULL, fmt, aq);
+	va_end(aq);
+	va_end(ap);
+
+	if (!TEST_CHECK(slen >= 0)) {
+		TEST_MSG("Failed capturing the arguments for \"%s\"", fmt);
+		talloc_free(expected);
+		return;
+	}
+
+	got = fr_log_record_args_print(NULL, fmt, test_args, slen);
+	TEST_CHECK(got && expected && (strcmp(got, expected) == 0));
+	TEST_MSG("Expected \"%s\"", expected);
+	TEST_MSG("Got      \"%s\"", got);
+
+	talloc_free(expected);
+	talloc_free(got);
+}
+
+/** Capture the arguments for a message, returning the number of bytes written to test_args
+ *
+ */
+static ssize_t test_encode(char const *fmt, ...) CC_HINT(format (printf, 1, 2));
+static ssize_t test_encode(char const *fmt, ...)
+{
+	va_list	ap;
+	ssize_t	slen;
+
+	va_start(ap, fmt);
+	slen = fr_log_record_args_encode(test_args, sizeof(test_args), fmt, ap);
+	va_end(ap);
+
+	return slen;
+}
+
+/** Every buffer shorter than the captured arguments must be refused
+ *
+ */
+static void test_encode_short(char const *fmt, ...) CC_HINT(format (printf, 1, 2));
+static void test_encode_short(char const *fmt, ...)
+{
+	va_list	ap, aq;
+	ssize_t	slen, i;
+
+	va_start(ap, fmt);
+
+	va_copy(aq, ap);
+	slen = fr_log_record_args_encode(test_args, sizeof(test_args), fmt, aq);
+	va_end(aq);
+	TEST_CHECK(slen > 0);
+
+	for (i = 0; i < slen; i++) {
+		uint8_t *copy = talloc_array(NULL, uint8_t, i);
+
+		va_copy(aq, ap);
+		TEST_CHECK(fr_log_record_args_encode(copy, i, fmt, aq) < 0);
+		TEST_MSG("Captured \"%s\" into %zd of %zd bytes", fmt, i, slen);
+		va_end(aq);
+
+		talloc_free(copy);
+	}
+
+	va_end(ap);
+}
+
+/** Check printing a copy of the first args_len bytes of test_args fails, without reading past them
+ *
+ */
+static void test_print_bad(char const *fmt, size_t args_len)
+{
+	uint8_t	*copy;
+	char	*got;
+
+	copy = talloc_memdup(NULL, test_args, args_len);
+	got = fr_log_record_args_print(NULL, fmt, copy, args_len);
+
+	TEST_CHECK(got != NULL);
+	TEST_CHECK(got && (strstr(got, "<invalid log arguments>") != NULL));
+	TEST_MSG("Printed \"%s\" with %zu bytes of arguments as \"%s\"", fmt, args_len, got);
+
+	talloc_free(got);
+	talloc_free(copy);
+}
+
+static void test_integers(void)
+{
+	TEST_CASE("Plain integers");
+	test_print("%d %i %u %x %X %o %c", -42, 42, 42U, 0xbeefU, 0xbeefU, 8U, 'z');
+	test_print("%d %u", INT_MIN, UINT_MAX);
+
+	TEST_CASE("Length modifiers");
+	test_print("%hhd %hhu %hd %hu", (signed char) -1, (unsigned char) 255, (short) -300, (unsigned short) 65535);
+	test_print("%ld %lu %lx", LONG_MIN, ULONG_MAX, 0xdeadbeefUL);
+	test_print("%lld %llu", LLONG_MIN, ULLONG_MAX);
+	test_print("%zd %zu %jd %ju %td", (ssize_t) -1, SIZE_MAX, INTMAX_MIN, UINTMAX_MAX, (ptrdiff_t) -7);
+
+	TEST_CASE("Flags and widths");
+	test_print("[%05d] [%-5d] [%+d] [% d] [%#x] [%#o]", 42, 42, 42, 42, 42U, 8U);
+}
+
+static void test_fields(void)
+{
+	TEST_CASE("Width and precision passed as arguments");
+	test_print("[%*d] [%-*d]", 8, 42, 8, 42);
+	test_print("[%.*s]", 3, "truncated");
+	test_print("[%*.*f]", 10, 2, 3.14159);
+	test_print("[%.*d]", 5, 42);
+
+	TEST_CASE("Escaped percent signs");
+	test_print("100%%");
+	test_print("%%d %%s %d%%", 50);
+	test_print("%%%%");
+}
+
+static void test_floats(void)
+{
+	TEST_CASE("Doubles");
+	test_print("%f %F %.3e %E %g %G", 1.5, 2.25, 12345.678, 0.000123, 1e20, 1e-20);
+	test_print("%a %A", 1.0, -0.5);
+
+	TEST_CASE("Long doubles");
+	test_print("%Lf %.10Lg", 1.25L, 3.14159265358979323846L);
+}
+
+static void test_strings(void)
+{
+	char	*str;
+	char	buffer[4] = { 'a', 'b', 'c', 'd' };	/* Not terminated */
+	ssize_t	slen;
+	char	*got;
+
+	TEST_CASE("Strings");
+	test_print("User %s logged in from %s", "bob", "192.0.2.1");
+	test_print("[%10s] [%-10s] [%.2s]", "right", "left", "cut");
+	test_print("[%s]", "");
+
+	TEST_CASE("NULL strings");
+	test_print("[%s]", (char *) NULL);
+
+	TEST_CASE("Strings with a precision needn't be terminated");
+	test_print("[%.4s]", buffer);
+
+	TEST_CASE("Strings are copied");
+	str = talloc_strdup(NULL, "copied");
+	slen = test_encode("[%s]", str);
+	TEST_CHECK(slen > 0);
+	memset(str, 'x', strlen(str));
+	talloc_free(str);
+
+	got = fr_log_record_args_print(NULL, "[%s]", test_args, slen);
+	TEST_CHECK(got && (strcmp(got, "[copied]") == 0));
+	TEST_MSG("Got \"%s\"", got);
+	talloc_free(got);
+
+	TEST_CASE("Pointers");
+	test_print("%p %p", (void *) test_args, (void *) NULL);
+}
+
+static void test_boxes(void)
+{
+	fr_ipaddr_t	ip = { .af = AF_INET, .prefix = 32, .addr.v4.s_addr = htonl(0xc0000201) };
+	uint8_t		octets[] = { 0x00, 0x01, 0xfe, 0xff };
+	char		*str;
+	fr_value_box_t	box;
+	ssize_t		slen;
+	char		*got;
+
+	TEST_CASE("Value boxes");
+	test_print("%pV", fr_box_strvalue("bob"));
+	test_print("%pV", fr_box_octets(octets, sizeof(octets)));
+	test_print("%pV %pV", fr_box_uint32(4294967295U), fr_box_int32(-42));
+	test_print("%pV", fr_box_ipv4addr(ip));
+	test_print("%pV", fr_box_uint64(UINT64_MAX));
+
+	TEST_CASE("Value boxes printed as hex");
+	test_print("%pH %pH", fr_box_strvalue("bob"), fr_box_octets(octets, sizeof(octets)));
+	test_print("%pH", fr_box_uint32(0x01020304));
+
+	TEST_CASE("Value box lists");
+	test_print("%pM", fr_box_strvalue("list"));
+
+	TEST_CASE("NULL value boxes");
+	test_print("[%pV] [%pH] [%pM] [%pP]", (fr_value_box_t *) NULL, (fr_value_box_t *) NULL,
+		   (fr_value_box_t *) NULL, (VALUE_PAIR *) NULL);
+
+	TEST_CASE("Mixed with other conversions");
+	test_print("%s %pV %d %pH %s", "a", fr_box_strvalue("b"), 3, fr_box_octets(octets, 2), "e");
+
+	TEST_CASE("Value boxes are copied");
+	MEM(str = talloc_strdup(NULL, "copied"));
+	fr_value_box_init(&box, FR_TYPE_STRING, NULL, false);
+	box.vb_strvalue = str;
+	box.vb_length = strlen(str);
+
+	slen = test_encode("%pV", &box);
+	TEST_CHECK(slen > 0);
+	memset(str, 'x', box.vb_length);
+	talloc_free(str);
+
+	got = fr_log_record_args_print(NULL, "%pV", test_args, slen);
+	TEST_CHECK(got && (strcmp(got, "\"copied\"") == 0));
+	TEST_MSG("Got \"%s\"", got);
+	talloc_free(got);
+}
+
+static void test_refused(void)
+{
+	TEST_CASE("Positional arguments");
+	TEST_CHECK(test_encode("%1$s", "positional") < 0);
+	TEST_CHECK(test_encode("%2$d %1$s", "reversed", 1) < 0);
+
+	TEST_CASE("Conversions which can't be captured");
+	TEST_CHECK(test_encode("%m") < 0);
+
+	TEST_CASE("Buffers which are too small");
+	test_encode_short("%d", 1);
+	test_encode_short("%*.*f %Lf", 5, 2, 1.5, 2.5L);
+	test_encode_short("%s %s %.2s", "string", (char *) NULL, "precision");
+	test_encode_short("%p", (void *) test_args);
+	test_encode_short("%pV %pH %pV", fr_box_strvalue("bob"), fr_box_uint32(7), (fr_value_box_t *) NULL);
+}
+
+static void test_bad_args(void)
+{
+	uint8_t	octets[] = { 0x01, 0x02 };
+	ssize_t	slen, i;
+	char	*got;
+
+	TEST_CASE("Truncated arguments");
+	slen = test_encode("%d %*s %f %Lf %p %s %pV %pV", -1, 4, "str", 1.0, 2.0L, (void *) test_args, (char *) NULL,
+			   fr_box_octets(octets, sizeof(octets)), fr_box_uint16(80));
+	TEST_CHECK(slen > 0);
+	for (i = 0; i < slen; i++) test_print_bad("%d %*s %f %Lf %p %s %pV %pV", i);
+
+	TEST_CASE("Arguments of the wrong type");
+	slen = test_encode("%d", 1);
+	TEST_CHECK(slen > 0);
+	test_print_bad("%f", slen);
+	test_print_bad("%s", slen);
+	test_print_bad("%p", slen);
+	test_print_bad("%pV", slen);
+
+	TEST_CASE("Value boxes with an invalid type");
+	slen = test_encode("%pV", fr_box_uint32(1));
+	TEST_CHECK(slen > 0);
+	test_args[1] = FR_TYPE_MAX;
+	test_print_bad("%pV", slen);
+
+	TEST_CASE("Value boxes with the wrong length for their type");
+	test_args[1] = FR_TYPE_UINT16;
+	test_print_bad("%pV", slen);
+
+	TEST_CASE("Strings longer than the arguments");
+	slen = test_encode("%s", "string");
+	TEST_CHECK(slen > 0);
+	test_args[1]++;
+	test_print_bad("%s", slen);
+
+	TEST_CASE("Text before a bad argument is kept");
+	slen = test_encode("kept %d", 1);
+	TEST_CHECK(slen > 0);
+	got = fr_log_record_args_print(NULL, "kept %f", test_args, slen);
+	TEST_CHECK(got && (strcmp(got, "kept <invalid log arguments>") == 0));
+	TEST_MSG("Got \"%s\"", got);
+	talloc_free(got);
+
+	TEST_CASE("Formats without conversions need no arguments");
+	got = fr_log_record_args_print(NULL, "no arguments", test_args, 0);
+	TEST_CHECK(got && (strcmp(got, "no arguments") == 0));
+	talloc_free(got);
+}
+
+TEST_LIST = {
+	/*
+	 *	Arguments print the same as fr_vasprintf()
+	 */
+	{ "Print - Integers",				test_integers },
+	{ "Print - Fields",				test_fields },
+	{ "Print - Floats",				test_floats },
+	{ "Print - Strings",				test_strings },
+	{ "Print - Value boxes",			test_boxes },
+
+	/*
+	 *	Bounds checks
+	 */
+	{ "Bounds - Refused",				test_refused },
+	{ "Bounds - Bad arguments",			test_bad_args },
+	{ NULL }
+};
@@ -0,0 +1,8 @@
+TARGET		:= log_record_tests
+
+SOURCES		:= log_record_tests.c
+
+TGT_LDLIBS	:= $(LIBS)
+TGT_LDFLAGS	:= $(LDFLAGS)
+
+TGT_PREREQS	+= libfreeradius-util.a
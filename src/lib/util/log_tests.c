@@ -0,0 +1,603 @@
+#include <freeradius-devel/util/acutest.h>
+
+#include "log.c"
+
+#define TEST_RING_SIZE		(LOG_ASYNC_MIN_SIZE)
+#define TEST_MSG_MAX		(300)
+
+/** Open an anonymous file for records to be written to
+ *
+ */
+static int test_file_open(void)
+{
+	char	path[] = "/tmp/log_tests.XXXXXX";
+	int	fd;
+
+	fd = mkstemp(path);
+	TEST_CHECK(fd >= 0);
+	unlink(path);
+
+	return fd;
+}
+
+/** Generate message n, with a length which varies from message to message
+ *
+ */
+static size_t test_msg(char *buffer, unsigned int n)
+{
+	size_t len = 10 + ((n * 37) % (TEST_MSG_MAX - 10));
+
+	memset(buffer, 'a' + (n % 26), len - 1);
+	snprintf(buffer, len, "%08u", n);
+	buffer[8] = ' ';
+	buffer[len - 1] = '\n';
+
+	return len;
+}
+
+/** Check the file contains messages 0 to num - 1, in order
+ *
+ */
+static void test_file_check(int fd, unsigned int num)
+{
+	char		expected[TEST_MSG_MAX], got[TEST_MSG_MAX];
+	off_t		offset = 0;
+	unsigned int	i;
+
+	for (i = 0; i < num; i++) {
+		size_t len = test_msg(expected, i);
+
+		if (!TEST_CHECK(pread(fd, got, len, offset) == (ssize_t)len) ||
+		    !TEST_CHECK(memcmp(expected, got, len) == 0)) {
+			TEST_MSG("Message %u is missing or corrupt", i);
+			return;
+		}
+		offset += len;
+	}
+
+	TEST_CHECK(pread(fd, got, 1, offset) == 0);
+	TEST_MSG("Unexpected data after message %u", num - 1);
+}
+
+/** Queue message n for fd
+ *
+ */
+static int test_push(int fd, unsigned int n)
+{
+	char	buffer[TEST_MSG_MAX];
+	size_t	len = test_msg(buffer, n);
+
+	return log_async_push(LOG_RECORD_FD, fd, NULL, 0, buffer, len);
+}
+
+/** Reset the counters left by previous tests
+ *
+ */
+static void test_stats_reset(void)
+{
+	log_async.retired = (fr_log_async_stats_t){ 0 };
+	atomic_store(&log_async.written, 0);
+	atomic_store(&log_async.errors, 0);
+}
+
+/** Enable queueing without starting the log writer, so tests can drain rings themselves
+ *
+ */
+static void test_ring_config(size_t size, fr_log_async_overflow_t overflow)
+{
+	test_stats_reset();
+	log_async.ring_size = size;
+	log_async.overflow = overflow;
+	log_async.format = FR_LOG_ASYNC_FORMAT_TEXT;
+	atomic_store(&log_async.running, true);
+}
+
+typedef struct {
+	void		(*func)(void *uctx);
+	void		*uctx;
+} test_thread_t;
+
+static void *_test_thread(void *arg)
+{
+	test_thread_t *t = arg;
+
+	t->func(t->uctx);
+
+	return NULL;
+}
+
+/** Run a producer in its own thread
+ *
+ * Each thread gets a new ring, which is orphaned when the thread exits.
+ */
+static void test_in_thread(void (*func)(void *uctx), void *uctx)
+{
+	pthread_t	thread;
+	test_thread_t	t = { .func = func, .uctx = uctx };
+
+	TEST_CHECK(pthread_create(&thread, NULL, _test_thread, &t) == 0);
+	pthread_join(thread, NULL);
+}
+
+static void _test_wrap(void *uctx)
+{
+	int		fd = *(int *)uctx;
+	log_ring_t	*ring;
+	unsigned int	i;
+	size_t		used = 0, head;
+
+	for (i = 0; i < 500; i++) {
+		char	buffer[TEST_MSG_MAX];
+
+		used += LOG_ASYNC_ALIGN_UP(sizeof(log_record_t) + test_msg(buffer, i));
+
+		if (!TEST_CHECK(test_push(fd, i) == 1)) {
+			TEST_MSG("Failed queueing message %u", i);
+			return;
+		}
+
+		/*
+		 *	Leave a few records in the ring, so the
+		 *	head and tail are rarely aligned.
+		 */
+		if ((i % 3) == 2) TEST_CHECK(log_async_drain(log_async_ring));
+	}
+	ring = log_async_ring;
+	(void) log_async_drain(ring);
+
+	TEST_CASE("The ring wrapped, and padding was inserted");
+	head = atomic_load(&ring->head);
+	TEST_CHECK(head > (4 * ring->size));
+	TEST_CHECK(head > used);
+	TEST_CHECK(head == atomic_load(&ring->tail));
+	TEST_CHECK(atomic_load(&ring->queued) == 500);
+	TEST_CHECK(atomic_load(&ring->dropped) == 0);
+}
+
+static void test_wrap(void)
+{
+	int fd = test_file_open();
+
+	test_ring_config(TEST_RING_SIZE, FR_LOG_ASYNC_OVERFLOW_DROP);
+	test_in_thread(_test_wrap, &fd);
+	atomic_store(&log_async.running, false);
+
+	TEST_CASE("Records are written in order, and intact");
+	test_file_check(fd, 500);
+	TEST_CHECK(atomic_load(&log_async.written) == 500);
+
+	close(fd);
+}
+
+static void _test_full(void *uctx)
+{
+	int			fd = *(int *)uctx;
+	char			buffer[TEST_RING_SIZE];
+	size_t			need = LOG_ASYNC_ALIGN_UP(sizeof(log_record_t) + 100);
+	unsigned int		i, fit = TEST_RING_SIZE / need;
+	fr_log_async_stats_t	stats;
+
+	memset(buffer, 'x', sizeof(buffer));
+
+	TEST_CASE("Messages are queued until the ring is full");
+	for (i = 0; i < fit; i++) {
+		if (!TEST_CHECK(log_async_push(LOG_RECORD_FD, fd, NULL, 0, buffer, 100) == 1)) {
+			TEST_MSG("Failed queueing message %u of %u", i, fit);
+			return;
+		}
+	}
+
+	TEST_CASE("Messages are dropped once the ring is full");
+	for (i = 0; i < 5; i++) TEST_CHECK(log_async_push(LOG_RECORD_FD, fd, NULL, 0, buffer, 100) == 0);
+
+	TEST_CASE("Messages larger than half the ring are left to the caller");
+	TEST_CHECK(log_async_push(LOG_RECORD_FD, fd, NULL, 0, buffer, TEST_RING_SIZE / 2) < 0);
+
+	fr_log_async_stats(&stats);
+	TEST_CHECK(stats.queued == fit);
+	TEST_CHECK(stats.dropped == 5);
+	TEST_CHECK(stats.written == 0);
+	TEST_CHECK(stats.pending == fit);
+
+	TEST_CASE("Draining the ring makes room");
+	TEST_CHECK(log_async_drain(log_async_ring));
+	TEST_CHECK(!log_async_drain(log_async_ring));
+	TEST_CHECK(log_async_push(LOG_RECORD_FD, fd, NULL, 0, buffer, 100) == 1);
+	TEST_CHECK(log_async_drain(log_async_ring));
+
+	fr_log_async_stats(&stats);
+	TEST_CHECK(stats.queued == fit + 1);
+	TEST_CHECK(stats.dropped == 5);
+	TEST_CHECK(stats.written == fit + 1);
+	TEST_CHECK(stats.pending == 0);
+}
+
+static void test_full(void)
+{
+	int			fd = test_file_open();
+	fr_log_async_stats_t	stats;
+	struct stat		st;
+
+	test_ring_config(TEST_RING_SIZE, FR_LOG_ASYNC_OVERFLOW_DROP);
+	test_in_thread(_test_full, &fd);
+	atomic_store(&log_async.running, false);
+
+	TEST_CASE("Counters are kept once the producer exits");
+	fr_log_async_stats(&stats);
+	TEST_CHECK(log_async.rings == NULL);
+	TEST_CHECK(stats.queued == stats.written);
+	TEST_CHECK(stats.dropped == 5);
+
+	TEST_CHECK(fstat(fd, &st) == 0);
+	TEST_CHECK((uint64_t)st.st_size == (stats.written * 100));
+
+	close(fd);
+}
+
+static void _test_producer(void *uctx)
+{
+	int		fd = *(int *)uctx;
+	unsigned int	i;
+
+	for (i = 0; i < 2000; i++) {
+		if (!TEST_CHECK(test_push(fd, i) == 1)) {
+			TEST_MSG("Failed queueing message %u", i);
+			return;
+		}
+	}
+}
+
+/** With overflow = block, producers wait for the writer instead of dropping messages
+ *
+ */
+static void test_block(void)
+{
+	int			fd = test_file_open();
+	fr_log_async_conf_t	conf = { .enabled = true, .ring_size = TEST_RING_SIZE,
+					 .overflow = FR_LOG_ASYNC_OVERFLOW_BLOCK };
+	fr_log_async_stats_t	stats;
+
+	test_stats_reset();
+	TEST_CHECK(fr_log_async_start(&conf) == 0);
+
+	test_in_thread(_test_producer, &fd);
+	fr_log_async_stop();
+
+	TEST_CASE("No messages were dropped");
+	fr_log_async_stats(&stats);
+	TEST_CHECK(stats.queued == 2000);
+	TEST_CHECK(stats.dropped == 0);
+	TEST_CHECK(stats.written == 2000);
+	TEST_CHECK(stats.errors == 0);
+	TEST_CHECK(stats.pending == 0);
+
+	test_file_check(fd, 2000);
+
+	close(fd);
+}
+
+typedef struct {
+	int		fd;
+	char const	*path;
+} test_stop_args_t;
+
+static void _test_stop(void *uctx)
+{
+	test_stop_args_t	*args = uctx;
+	unsigned int		i;
+
+	for (i = 0; i < 100; i++) TEST_CHECK(test_push(args->fd, i) == 1);
+	TEST_CHECK(fr_log_file_append(args->path, "queued\n", 7) == 0);
+}
+
+/** Stopping the writer must write everything which was queued, and free orphaned rings
+ *
+ */
+static void test_stop(void)
+{
+	int			fd = test_file_open();
+	fr_log_async_conf_t	conf = { .enabled = true, .ring_size = 65536,
+					 .overflow = FR_LOG_ASYNC_OVERFLOW_DROP };
+	fr_log_async_stats_t	stats;
+	test_stop_args_t	args;
+	char			path[] = "/tmp/log_tests.XXXXXX";
+	char			buffer[16];
+	int			path_fd;
+
+	path_fd = mkstemp(path);
+	TEST_CHECK(path_fd >= 0);
+
+	test_stats_reset();
+	TEST_CHECK(fr_log_async_start(&conf) == 0);
+
+	args.fd = fd;
+	args.path = path;
+	test_in_thread(_test_stop, &args);
+	fr_log_async_stop();
+
+	TEST_CASE("Queued messages are written by stop");
+	test_file_check(fd, 100);
+	TEST_CHECK(pread(path_fd, buffer, sizeof(buffer), 0) == 7);
+	TEST_CHECK(memcmp(buffer, "queued\n", 7) == 0);
+
+	fr_log_async_stats(&stats);
+	TEST_CHECK(stats.queued == 101);
+	TEST_CHECK(stats.written == 101);
+	TEST_CHECK(stats.pending == 0);
+
+	TEST_CASE("Orphaned rings are freed once drained");
+	TEST_CHECK(log_async.rings == NULL);
+
+	TEST_CASE("Messages are written synchronously once stopped");
+	TEST_CHECK(test_push(fd, 100) < 0);
+	TEST_CHECK(fr_log_file_append(path, "direct\n", 7) == 0);
+	TEST_CHECK(pread(path_fd, buffer, sizeof(buffer), 0) == 14);
+	TEST_CHECK(memcmp(buffer + 7, "direct\n", 7) == 0);
+
+	fr_log_async_stats(&stats);
+	TEST_CHECK(stats.queued == 101);
+
+	TEST_CASE("Stopping twice does nothing");
+	fr_log_async_stop();
+
+	unlink(path);
+	close(path_fd);
+	close(fd);
+}
+
+#define TEST_DEFERRED_MAX	(16)
+
+typedef struct {
+	fr_log_t	log;				//!< Messages are logged to.
+	char		*expected[TEST_DEFERRED_MAX];	//!< Messages, as formatted by the caller.
+	unsigned int	num;				//!< Number of messages logged.
+	unsigned int	sites;				//!< Number of places messages were logged from.
+} test_deferred_t;
+
+/** Log a message, recording how it would have been formatted synchronously
+ *
+ */
+#define TEST_LOG(_t, _fmt, ...) \
+do { \
+	(_t)->expected[(_t)->num++] = fr_asprintf(NULL, _fmt, ## __VA_ARGS__); \
+	TEST_CHECK(fr_log(&(_t)->log, L_INFO, __FILE__, __LINE__, _fmt, ## __VA_ARGS__) == 0); \
+} while (0)
+
+static void _test_deferred(void *uctx)
+{
+	test_deferred_t	*t = uctx;
+	uint8_t		octets[] = { 0xde, 0xad, 0xbe, 0xef };
+	char		*str;
+	unsigned int	i;
+
+	TEST_CHECK(fr_log_deferred(&t->log));
+
+	TEST_LOG(t, "Plain text");
+	TEST_LOG(t, "%d %u %s", -1, 2U, "three");
+
+	MEM(str = talloc_strdup(NULL, "freed"));
+	TEST_LOG(t, "String %s after logging", str);
+	talloc_free(str);
+
+	TEST_LOG(t, "%pV %pH %pV", fr_box_strvalue("bob"), fr_box_octets(octets, sizeof(octets)), fr_box_uint32(42));
+	TEST_LOG(t, "[%.*s] [%5.2f] [%%]", 3, "truncated", 3.14159);
+
+	/*
+	 *	The format string is only written once.
+	 */
+	for (i = 0; i < 3; i++) TEST_LOG(t, "Repeated %u of %u", i + 1, 3U);
+
+	t->sites = 6;
+}
+
+/** Log the test messages from a producer thread, with the log writer running
+ *
+ */
+static void test_deferred_run(test_deferred_t *t, int fd, fr_log_async_format_t format)
+{
+	fr_log_async_conf_t	conf = { .enabled = true, .ring_size = 65536,
+					 .overflow = FR_LOG_ASYNC_OVERFLOW_BLOCK, .format = format };
+	fr_log_async_stats_t	stats;
+
+	memset(t, 0, sizeof(*t));
+	t->log = (fr_log_t){
+		.dst = L_DST_FILES,
+		.fd = fd,
+		.print_level = true,
+		.timestamp = L_TIMESTAMP_OFF
+	};
+
+	test_stats_reset();
+	TEST_CHECK(fr_log_async_start(&conf) == 0);
+	test_in_thread(_test_deferred, t);
+	fr_log_async_stop();
+
+	TEST_CASE("Every message was queued, and written by the log writer");
+	fr_log_async_stats(&stats);
+	TEST_CHECK(stats.queued == t->num);
+	TEST_CHECK(stats.written == t->num);
+	TEST_CHECK(stats.errors == 0);
+}
+
+/** Read everything which was written to a test file
+ *
+ */
+static uint8_t *test_file_read(int fd, size_t *len)
+{
+	struct stat	st;
+	uint8_t		*data;
+
+	if (!TEST_CHECK(fstat(fd, &st) == 0)) return NULL;
+
+	MEM(data = talloc_array(NULL, uint8_t, st.st_size + 1));
+	TEST_CHECK(pread(fd, data, st.st_size, 0) == st.st_size);
+	data[st.st_size] = '\0';
+	*len = st.st_size;
+
+	return data;
+}
+
+/** Messages formatted by the log writer must match those formatted by the caller
+ *
+ */
+static void test_deferred(void)
+{
+	int		fd = test_file_open();
+	test_deferred_t	t;
+	char		*expected;
+	uint8_t		*data;
+	size_t		len;
+	unsigned int	i;
+
+	test_deferred_run(&t, fd, FR_LOG_ASYNC_FORMAT_DEFERRED);
+
+	TEST_CASE("Messages are formatted the same as synchronous messages");
+	MEM(expected = talloc_strdup(NULL, ""));
+	for (i = 0; i < t.num; i++) {
+		expected = talloc_asprintf_append_buffer(expected, "%s%s\n",
+							 fr_table_str_by_value(fr_log_levels, L_INFO, ""),
+							 t.expected[i]);
+	}
+
+	data = test_file_read(fd, &len);
+	TEST_CHECK(data && (len == (talloc_array_length(expected) - 1)) &&
+		   (memcmp(data, expected, len) == 0));
+	TEST_MSG("Expected:\n%s", expected);
+	TEST_MSG("Got:\n%s", data ? (char *)data : "");
+
+	talloc_free(data);
+	talloc_free(expected);
+	for (i = 0; i < t.num; i++) talloc_free(t.expected[i]);
+	close(fd);
+}
+
+/** Messages written in binary format must decode, as radlog does, to the messages formatted by the caller
+ *
+ */
+static void test_binary(void)
+{
+	int				fd = test_file_open();
+	test_deferred_t			t;
+	char				*formats[TEST_DEFERRED_MAX] = { NULL };
+	uint8_t				*data, *p, *end;
+	size_t				len;
+	unsigned int			i, starts = 0, num_formats = 0, num_messages = 0;
+
+	test_deferred_run(&t, fd, FR_LOG_ASYNC_FORMAT_BINARY);
+
+	data = test_file_read(fd, &len);
+	if (!data) goto finish;
+
+	TEST_CASE("The file contains a start record, the formats, and the messages");
+	for (p = data, end = data + len; p < end; ) {
+		fr_log_record_hdr_t	hdr;
+
+		if (!TEST_CHECK((size_t)(end - p) >= sizeof(hdr))) break;
+		memcpy(&hdr, p, sizeof(hdr));
+		if (!TEST_CHECK((hdr.len >= sizeof(hdr)) && (hdr.len <= (size_t)(end - p)))) {
+			TEST_MSG("Record at offset %zu has invalid length %u", (size_t)(p - data), hdr.len);
+			break;
+		}
+
+		switch (hdr.kind) {
+		case FR_LOG_RECORD_START:
+		{
+			fr_log_record_start_t start;
+
+			TEST_CHECK(p == data);
+			TEST_CHECK(hdr.len == sizeof(start));
+			memcpy(&start, p, sizeof(start));
+			TEST_CHECK(memcmp(start.magic, FR_LOG_RECORD_MAGIC, sizeof(start.magic)) == 0);
+			TEST_CHECK(start.version == FR_LOG_RECORD_VERSION);
+			TEST_CHECK(start.pid == (uint32_t)getpid());
+			starts++;
+		}
+			break;
+
+		case FR_LOG_RECORD_FORMAT:
+		{
+			fr_log_record_format_t	format;
+			char const		*str = (char const *)(p + sizeof(format));
+
+			memcpy(&format, p, sizeof(format));
+			if (!TEST_CHECK((format.id == num_formats) && (format.id < TEST_DEFERRED_MAX))) break;
+			TEST_CHECK(hdr.len == (sizeof(format) + format.fmt_len + format.file_len));
+			TEST_CHECK((format.file_len == strlen(__FILE__)) &&
+				   (memcmp(str + format.fmt_len, __FILE__, format.file_len) == 0));
+
+			formats[num_formats++] = talloc_strndup(NULL, str, format.fmt_len);
+		}
+			break;
+
+		case FR_LOG_RECORD_MESSAGE:
+		{
+			fr_log_record_message_t	msg;
+			uint8_t			*args;
+			char			*got;
+
+			memcpy(&msg, p, sizeof(msg));
+			if (!TEST_CHECK((msg.id < num_formats) && (num_messages < t.num))) break;
+			TEST_CHECK(msg.type == L_INFO);
+			TEST_CHECK(msg.line > 0);
+			TEST_CHECK(msg.prefix_len == 0);
+
+			/*
+			 *	Copied so the arguments are aligned, and
+			 *	reads past the end are caught.
+			 */
+			args = talloc_memdup(NULL, p + sizeof(msg), hdr.len - sizeof(msg));
+			got = fr_log_record_args_print(NULL, formats[msg.id], args, hdr.len - sizeof(msg));
+			TEST_CHECK(got && (strcmp(got, t.expected[num_messages]) == 0));
+			TEST_MSG("Expected \"%s\"", t.expected[num_messages]);
+			TEST_MSG("Got      \"%s\"", got);
+
+			talloc_free(got);
+			talloc_free(args);
+			num_messages++;
+		}
+			break;
+
+		default:
+			TEST_CHECK(hdr.kind <= FR_LOG_RECORD_MESSAGE);
+			TEST_MSG("Record at offset %zu has unknown kind %u", (size_t)(p - data), hdr.kind);
+			break;
+		}
+
+		p += hdr.len;
+	}
+
+	TEST_CHECK(p == end);
+	TEST_CHECK(starts == 1);
+	TEST_CHECK(num_formats == t.sites);
+	TEST_CHECK(num_messages == t.num);
+
+	TEST_CASE("The log file state is freed when the writer stops");
+	TEST_CHECK(log_async.binary == NULL);
+
+finish:
+	for (i = 0; i < num_formats; i++) talloc_free(formats[i]);
+	for (i = 0; i < t.num; i++) talloc_free(t.expected[i]);
+	talloc_free(data);
+	close(fd);
+}
+
+TEST_LIST = {
+	/*
+	 *	Single producer / single consumer ring
+	 */
+	{ "Ring - Wrap",				test_wrap },
+	{ "Ring - Full",				test_full },
+
+	/*
+	 *	Log writer thread
+	 */
+	{ "Writer - Block",				test_block },
+	{ "Writer - Stop",				test_stop },
+
+	/*
+	 *	Messages formatted by the log writer
+	 */
+	{ "Deferred - Text",				test_deferred },
+	{ "Deferred - Binary",				test_binary },
+	{ NULL }
+};
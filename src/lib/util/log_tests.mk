@@ -0,0 +1,8 @@
+TARGET		:= log_tests
+
+SOURCES		:= log_tests.c
+
+TGT_LDLIBS	:= $(LIBS)
+TGT_LDFLAGS	:= $(LDFLAGS)
+
+TGT_PREREQS	+= libfreeradius-util.a
@@ -85,8 +85,64 @@ extern		fr_md5_final_t		fr_md5_final;
 void		fr_md5_calc(uint8_t out[static MD5_DIGEST_LENGTH], uint8_t const *in, size_t inlen);
 
 /* hmac.c */
+
+/** HMAC-MD5 digest state after absorbing the key
+ *
+ */
+typedef struct {
+	fr_md5_ctx_t	*inner;		//!< After absorbing key XOR ipad.
+	fr_md5_ctx_t	*outer;		//!< After absorbing key XOR opad.
+} fr_hmac_md5_key_t;
+
 void		fr_hmac_md5(uint8_t digest[static MD5_DIGEST_LENGTH], uint8_t const *in, size_t inlen,
 			    uint8_t const *key, size_t key_len);
+
+int		fr_hmac_md5_key_init(fr_hmac_md5_key_t *hkey, uint8_t const *key, size_t key_len);
+
+void		fr_hmac_md5_key_free(fr_hmac_md5_key_t *hkey);
+
+void		fr_hmac_md5_with_key(uint8_t digest[static MD5_DIGEST_LENGTH], uint8_t const *in, size_t inlen,
+				     fr_hmac_md5_key_t const *hkey);
+
+/* md5_multi.c */
+#define FR_MD5_MULTI_MAX_PARTS		8	//!< Maximum number of fragments per digest operation.
+
+/** A fragment of the data to be hashed
+ *
+ */
+typedef struct {
+	uint8_t const		*data;		//!< Data to hash.
+	size_t			len;		//!< Length of the data.
+} fr_md5_part_t;
+
+/** A single digest operation in a batch
+ *
+ * The parts are hashed in order, as if they were one contiguous buffer.
+ * Unused parts must have a len of zero.
+ */
+typedef struct {
+	fr_md5_part_t		part[FR_MD5_MULTI_MAX_PARTS];	//!< Fragments of the data to hash.
+	uint8_t			*out;		//!< Where to write the digest.  Must be
+						///< at least MD5_DIGEST_LENGTH bytes.
+} fr_md5_multi_job_t;
+
+/** A single HMAC-MD5 operation in a batch
+ *
+ * One part fewer than an MD5 operation is available, as the key block
+ * occupies the first part of the inner digest.
+ */
+typedef struct {
+	uint8_t const		*key;		//!< Authentication key.
+	size_t			key_len;	//!< Length of the authentication key.
+	fr_md5_part_t		part[FR_MD5_MULTI_MAX_PARTS - 1];	//!< Fragments of the data to hash.
+	uint8_t			*out;		//!< Where to write the digest.
+} fr_hmac_md5_multi_job_t;
+
+void		fr_md5_calc_multi(fr_md5_multi_job_t *jobs, size_t num);
+
+void		fr_hmac_md5_multi(fr_hmac_md5_multi_job_t *jobs, size_t num);
+
+char const	*fr_md5_multi_engine(void);
 #ifdef __cplusplus
 }
 #endif
@@ -0,0 +1,543 @@
+/*
+ *   This library is free software; you can redistribute it and/or
+ *   modify it under the terms of the GNU Lesser General Public
+ *   License as published by the Free Software Foundation; either
+ *   version 2.1 of the License, or (at your option) any later version.
+ *
+ *   This library is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ *   Lesser General Public License for more details.
+ *
+ *   You should have received a copy of the GNU Lesser General Public
+ *   License along with this library; if not, write to the Free Software
+ *   Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ */
+
+/** Multi-buffer MD5 and HMAC-MD5
+ *
+ * MD5 is inherently serial within a single message, but independent
+ * messages can be hashed in parallel, one per SIMD lane.  This is useful
+ * where many small messages need to be hashed at once, such as when
+ * verifying a burst of RADIUS packets.
+ *
+ * Each lane consumes one 64 byte block per round.  When a lane's message
+ * is complete its digest is written out, and the next job is loaded into
+ * that lane, so lanes stay busy even when message lengths differ.
+ *
+ * The transform is written using the compiler's generic vector extensions,
+ * and compiled once for the baseline ISA and once each for AVX2 and AVX-512,
+ * with the best available version selected at runtime.  Compilers without
+ * vector extensions fall back to hashing the jobs one at a time.
+ *
+ * @file src/lib/util/md5_multi.c
+ *
+ * @copyright 2020 The FreeRADIUS server project
+ */
+RCSID("$Id$")
+
+#include <freeradius-devel/util/md5.h>
+
+#if defined(__GNUC__)
+#  define HAVE_MD5_MULTI_VECTOR 1
+#  if defined(__x86_64__) || defined(__i386__)
+#    define HAVE_MD5_MULTI_X86 1
+#  endif
+#endif
+
+#define MD5_MULTI_BLOCK_LENGTH	64
+#define MD5_MULTI_LANES		16	//!< Lanes processed per round.  AVX2 does this as two
+					///< halves, the baseline vector code as four quarters.
+#define MD5_MULTI_MIN_JOBS	4	//!< Below this most lanes would be idle, so we don't bother.
+#define HMAC_MD5_MULTI_CHUNK	64	//!< How many HMAC jobs we prepare key blocks for at once.
+
+/** Implementations of the multi-buffer engine
+ *
+ * Ordered so that each engine's CPU requirements are a superset of the previous one's.
+ */
+typedef enum {
+	MD5_MULTI_ENGINE_SERIAL = 0,		//!< One job at a time using fr_md5_update.
+	MD5_MULTI_ENGINE_VECTOR,		//!< Generic vector code for the baseline ISA.
+	MD5_MULTI_ENGINE_AVX2,			//!< Vector code compiled for AVX2.
+	MD5_MULTI_ENGINE_AVX512,		//!< Vector code compiled for AVX-512.
+	MD5_MULTI_ENGINE_MAX
+} md5_multi_engine_t;
+
+static char const *md5_multi_engine_name[MD5_MULTI_ENGINE_MAX] = {
+	[MD5_MULTI_ENGINE_SERIAL]	= "serial",
+	[MD5_MULTI_ENGINE_VECTOR]	= "vector",
+	[MD5_MULTI_ENGINE_AVX2]		= "avx2",
+	[MD5_MULTI_ENGINE_AVX512]	= "avx512"
+};
+
+static int md5_multi_engine_current = -1;
+
+/** Hash jobs one at a time
+ *
+ */
+static void md5_multi_serial(fr_md5_multi_job_t *jobs, size_t num)
+{
+	fr_md5_ctx_t	*ctx;
+	size_t		i, j;
+
+	ctx = fr_md5_ctx_alloc(true);
+	for (i = 0; i < num; i++) {
+		for (j = 0; j < FR_MD5_MULTI_MAX_PARTS; j++) {
+			if (jobs[i].part[j].len == 0) continue;
+
+			fr_md5_update(ctx, jobs[i].part[j].data, jobs[i].part[j].len);
+		}
+		fr_md5_final(jobs[i].out, ctx);
+		fr_md5_ctx_reset(ctx);
+	}
+	fr_md5_ctx_free(&ctx);
+}
+
+#ifdef HAVE_MD5_MULTI_VECTOR
+typedef uint32_t md5_vec_t __attribute__ ((vector_size(MD5_MULTI_LANES * sizeof(uint32_t))));
+
+typedef void (*md5_multi_transform_t)(md5_vec_t state[static 4], uint8_t const *block[static MD5_MULTI_LANES]);
+
+/** Per-lane position within a job
+ *
+ */
+typedef struct {
+	fr_md5_multi_job_t	*job;		//!< Job being hashed, NULL if the lane is idle.
+	unsigned int		part;		//!< Current part of the job.
+	size_t			offset;		//!< Offset into the current part.
+	uint64_t		bits;		//!< Total length of the job's data in bits.
+	bool			padded;		//!< Whether the 0x80 terminator has been written.
+	uint8_t			block[MD5_MULTI_BLOCK_LENGTH];	//!< Where blocks spanning parts, or
+						///< containing padding, are assembled.
+} md5_lane_t;
+
+/* The four core functions - F1 is optimized somewhat */
+#define F1(x, y, z) (z ^ (x & (y ^ z)))
+#define F2(x, y, z) F1(z, x, y)
+#define F3(x, y, z) (x ^ y ^ z)
+#define F4(x, y, z) (y ^ (x | ~z))
+
+/* This is the central step in the MD5 algorithm. */
+#define MD5STEP(f, w, x, y, z, data, s) (w += f(x, y, z) + data, w = w << s | w >> (32 - s),  w += x)
+
+/** The MD5 compression function, applied to every lane at once
+ *
+ * Inlined into each of the engine specific wrappers so that the compiler
+ * generates code for that engine's vector width.
+ *
+ * @param[in,out] state	of each lane.
+ * @param[in] block	the next 64 byte block for each lane.
+ */
+static inline CC_HINT(always_inline) void md5_multi_transform_body(md5_vec_t state[static 4],
+								    uint8_t const *block[static MD5_MULTI_LANES])
+{
+	md5_vec_t	a, b, c, d, in[MD5_MULTI_BLOCK_LENGTH / 4];
+	unsigned int	i, j;
+
+	for (i = 0; i < MD5_MULTI_BLOCK_LENGTH / 4; i++) {
+		for (j = 0; j < MD5_MULTI_LANES; j++) {
+			uint8_t const *p = block[j] + (i * 4);
+
+			in[i][j] = (uint32_t)p[0] | (uint32_t)p[1] << 8 | (uint32_t)p[2] << 16 | (uint32_t)p[3] << 24;
+		}
+	}
+
+	a = state[0];
+	b = state[1];
+	c = state[2];
+	d = state[3];
+
+	MD5STEP(F1, a, b, c, d, in[ 0] + 0xd76aa478,  7);
+	MD5STEP(F1, d, a, b, c, in[ 1] + 0xe8c7b756, 12);
+	MD5STEP(F1, c, d, a, b, in[ 2] + 0x242070db, 17);
+	MD5STEP(F1, b, c, d, a, in[ 3] + 0xc1bdceee, 22);
+	MD5STEP(F1, a, b, c, d, in[ 4] + 0xf57c0faf,  7);
+	MD5STEP(F1, d, a, b, c, in[ 5] + 0x4787c62a, 12);
+	MD5STEP(F1, c, d, a, b, in[ 6] + 0xa8304613, 17);
+	MD5STEP(F1, b, c, d, a, in[ 7] + 0xfd469501, 22);
+	MD5STEP(F1, a, b, c, d, in[ 8] + 0x698098d8,  7);
+	MD5STEP(F1, d, a, b, c, in[ 9] + 0x8b44f7af, 12);
+	MD5STEP(F1, c, d, a, b, in[10] + 0xffff5bb1, 17);
+	MD5STEP(F1, b, c, d, a, in[11] + 0x895cd7be, 22);
+	MD5STEP(F1, a, b, c, d, in[12] + 0x6b901122,  7);
+	MD5STEP(F1, d, a, b, c, in[13] + 0xfd987193, 12);
+	MD5STEP(F1, c, d, a, b, in[14] + 0xa679438e, 17);
+	MD5STEP(F1, b, c, d, a, in[15] + 0x49b40821, 22);
+
+	MD5STEP(F2, a, b, c, d, in[ 1] + 0xf61e2562,  5);
+	MD5STEP(F2, d, a, b, c, in[ 6] + 0xc040b340,  9);
+	MD5STEP(F2, c, d, a, b, in[11] + 0x265e5a51, 14);
+	MD5STEP(F2, b, c, d, a, in[ 0] + 0xe9b6c7aa, 20);
+	MD5STEP(F2, a, b, c, d, in[ 5] + 0xd62f105d,  5);
+	MD5STEP(F2, d, a, b, c, in[10] + 0x02441453,  9);
+	MD5STEP(F2, c, d, a, b, in[15] + 0xd8a1e681, 14);
+	MD5STEP(F2, b, c, d, a, in[ 4] + 0xe7d3fbc8, 20);
+	MD5STEP(F2, a, b, c, d, in[ 9] + 0x21e1cde6,  5);
+	MD5STEP(F2, d, a, b, c, in[14] + 0xc33707d6,  9);
+	MD5STEP(F2, c, d, a, b, in[ 3] + 0xf4d50d87, 14);
+	MD5STEP(F2, b, c, d, a, in[ 8] + 0x455a14ed, 20);
+	MD5STEP(F2, a, b, c, d, in[13] + 0xa9e3e905,  5);
+	MD5STEP(F2, d, a, b, c, in[ 2] + 0xfcefa3f8,  9);
+	MD5STEP(F2, c, d, a, b, in[ 7] + 0x676f02d9, 14);
+	MD5STEP(F2, b, c, d, a, in[12] + 0x8d2a4c8a, 20);
+
+	MD5STEP(F3, a, b, c, d, in[ 5] + 0xfffa3942,  4);
+	MD5STEP(F3, d, a, b, c, in[ 8] + 0x8771f681, 11);
+	MD5STEP(F3, c, d, a, b, in[11] + 0x6d9d6122, 16);
+	MD5STEP(F3, b, c, d, a, in[14] + 0xfde5380c, 23);
+	MD5STEP(F3, a, b, c, d, in[ 1] + 0xa4beea44,  4);
+	MD5STEP(F3, d, a, b, c, in[ 4] + 0x4bdecfa9, 11);
+	MD5STEP(F3, c, d, a, b, in[ 7] + 0xf6bb4b60, 16);
+	MD5STEP(F3, b, c, d, a, in[10] + 0xbebfbc70, 23);
+	MD5STEP(F3, a, b, c, d, in[13] + 0x289b7ec6,  4);
+	MD5STEP(F3, d, a, b, c, in[ 0] + 0xeaa127fa, 11);
+	MD5STEP(F3, c, d, a, b, in[ 3] + 0xd4ef3085, 16);
+	MD5STEP(F3, b, c, d, a, in[ 6] + 0x04881d05, 23);
+	MD5STEP(F3, a, b, c, d, in[ 9] + 0xd9d4d039,  4);
+	MD5STEP(F3, d, a, b, c, in[12] + 0xe6db99e5, 11);
+	MD5STEP(F3, c, d, a, b, in[15] + 0x1fa27cf8, 16);
+	MD5STEP(F3, b, c, d, a, in[ 2] + 0xc4ac5665, 23);
+
+	MD5STEP(F4, a, b, c, d, in[ 0] + 0xf4292244,  6);
+	MD5STEP(F4, d, a, b, c, in[ 7] + 0x432aff97, 10);
+	MD5STEP(F4, c, d, a, b, in[14] + 0xab9423a7, 15);
+	MD5STEP(F4, b, c, d, a, in[ 5] + 0xfc93a039, 21);
+	MD5STEP(F4, a, b, c, d, in[12] + 0x655b59c3,  6);
+	MD5STEP(F4, d, a, b, c, in[ 3] + 0x8f0ccc92, 10);
+	MD5STEP(F4, c, d, a, b, in[10] + 0xffeff47d, 15);
+	MD5STEP(F4, b, c, d, a, in[ 1] + 0x85845dd1, 21);
+	MD5STEP(F4, a, b, c, d, in[ 8] + 0x6fa87e4f,  6);
+	MD5STEP(F4, d, a, b, c, in[15] + 0xfe2ce6e0, 10);
+	MD5STEP(F4, c, d, a, b, in[ 6] + 0xa3014314, 15);
+	MD5STEP(F4, b, c, d, a, in[13] + 0x4e0811a1, 21);
+	MD5STEP(F4, a, b, c, d, in[ 4] + 0xf7537e82,  6);
+	MD5STEP(F4, d, a, b, c, in[11] + 0xbd3af235, 10);
+	MD5STEP(F4, c, d, a, b, in[ 2] + 0x2ad7d2bb, 15);
+	MD5STEP(F4, b, c, d, a, in[ 9] + 0xeb86d391, 21);
+
+	state[0] += a;
+	state[1] += b;
+	state[2] += c;
+	state[3] += d;
+}
+
+static void md5_multi_transform_vector(md5_vec_t state[static 4], uint8_t const *block[static MD5_MULTI_LANES])
+{
+	md5_multi_transform_body(state, block);
+}
+
+#ifdef HAVE_MD5_MULTI_X86
+static CC_HINT(target("avx2")) void md5_multi_transform_avx2(md5_vec_t state[static 4],
+							      uint8_t const *block[static MD5_MULTI_LANES])
+{
+	md5_multi_transform_body(state, block);
+}
+
+static CC_HINT(target("avx512f")) void md5_multi_transform_avx512(md5_vec_t state[static 4],
+								   uint8_t const *block[static MD5_MULTI_LANES])
+{
+	md5_multi_transform_body(state, block);
+}
+#endif
+
+/** Start hashing a job in a lane
+ *
+ */
+static inline void md5_lane_load(md5_lane_t *lane, md5_vec_t state[static 4], unsigned int i,
+				 fr_md5_multi_job_t *job)
+{
+	unsigned int j;
+
+	lane->job = job;
+	lane->part = 0;
+	lane->offset = 0;
+	lane->padded = false;
+	lane->bits = 0;
+	for (j = 0; j < FR_MD5_MULTI_MAX_PARTS; j++) lane->bits += (uint64_t)job->part[j].len << 3;
+
+	state[0][i] = 0x67452301;
+	state[1][i] = 0xefcdab89;
+	state[2][i] = 0x98badcfe;
+	state[3][i] = 0x10325476;
+}
+
+/** Return the next block for a lane
+ *
+ * Blocks that lie entirely within one part are hashed in place, anything
+ * else is assembled in the lane's block buffer.
+ *
+ * @param[in] lane	to return the next block for.
+ * @param[out] last	Whether this is the final block of the job.
+ * @return the block.
+ */
+static inline uint8_t const *md5_lane_block(md5_lane_t *lane, bool *last)
+{
+	fr_md5_multi_job_t const	*job = lane->job;
+	size_t				used = 0;
+	unsigned int			i;
+
+	*last = false;
+
+	while (lane->part < FR_MD5_MULTI_MAX_PARTS) {
+		fr_md5_part_t const	*part = &job->part[lane->part];
+		size_t			avail = part->len - lane->offset;
+		size_t			len;
+
+		if (avail == 0) {
+			lane->part++;
+			lane->offset = 0;
+			continue;
+		}
+
+		if ((used == 0) && (avail >= MD5_MULTI_BLOCK_LENGTH)) {
+			lane->offset += MD5_MULTI_BLOCK_LENGTH;
+			return part->data + lane->offset - MD5_MULTI_BLOCK_LENGTH;
+		}
+
+		len = MD5_MULTI_BLOCK_LENGTH - used;
+		if (avail < len) len = avail;
+
+		memcpy(lane->block + used, part->data + lane->offset, len);
+		lane->offset += len;
+		used += len;
+
+		if (used == MD5_MULTI_BLOCK_LENGTH) return lane->block;
+	}
+
+	/*
+	 *	Out of data, pad to 56 mod 64 and append the
+	 *	length.  If the terminator doesn't leave room
+	 *	for the length, it goes in the next block.
+	 */
+	if (!lane->padded) {
+		lane->block[used++] = 0x80;
+		lane->padded = true;
+	}
+
+	if (used > (MD5_MULTI_BLOCK_LENGTH - 8)) {
+		memset(lane->block + used, 0, MD5_MULTI_BLOCK_LENGTH - used);
+		return lane->block;
+	}
+
+	memset(lane->block + used, 0, (MD5_MULTI_BLOCK_LENGTH - 8) - used);
+	for (i = 0; i < 8; i++) lane->block[(MD5_MULTI_BLOCK_LENGTH - 8) + i] = lane->bits >> (i * 8);
+
+	*last = true;
+
+	return lane->block;
+}
+
+/** Hash jobs in parallel using the specified transform
+ *
+ */
+static void md5_multi_lanes(md5_multi_transform_t transform, fr_md5_multi_job_t *jobs, size_t num)
+{
+	static uint8_t const	idle[MD5_MULTI_BLOCK_LENGTH];
+
+	md5_lane_t		lane[MD5_MULTI_LANES];
+	md5_vec_t		state[4];
+	uint8_t const		*block[MD5_MULTI_LANES];
+	bool			last[MD5_MULTI_LANES];
+	size_t			next = 0, active = 0;
+	unsigned int		i, j;
+
+	for (i = 0; i < MD5_MULTI_LANES; i++) {
+		lane[i].job = NULL;
+		if (next == num) continue;
+
+		md5_lane_load(&lane[i], state, i, &jobs[next++]);
+		active++;
+	}
+
+	while (active > 0) {
+		for (i = 0; i < MD5_MULTI_LANES; i++) {
+			if (!lane[i].job) {
+				block[i] = idle;
+				last[i] = false;
+				continue;
+			}
+			block[i] = md5_lane_block(&lane[i], &last[i]);
+		}
+
+		transform(state, block);
+
+		for (i = 0; i < MD5_MULTI_LANES; i++) {
+			if (!last[i]) continue;
+
+			for (j = 0; j < 4; j++) {
+				uint32_t	word = state[j][i];
+				uint8_t		*out = lane[i].job->out + (j * 4);
+
+				out[0] = word;
+				out[1] = word >> 8;
+				out[2] = word >> 16;
+				out[3] = word >> 24;
+			}
+
+			lane[i].job = NULL;
+			active--;
+
+			if (next == num) continue;
+
+			md5_lane_load(&lane[i], state, i, &jobs[next++]);
+			active++;
+		}
+	}
+
+	memset(lane, 0, sizeof(lane));		/* in case it's sensitive */
+}
+#endif
+
+/** Pick the best engine the CPU we're running on supports
+ *
+ */
+static md5_multi_engine_t md5_multi_engine_select(void)
+{
+#ifdef HAVE_MD5_MULTI_X86
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("avx512f")) return MD5_MULTI_ENGINE_AVX512;
+	if (__builtin_cpu_supports("avx2")) return MD5_MULTI_ENGINE_AVX2;
+#endif
+
+#ifdef HAVE_MD5_MULTI_VECTOR
+	return MD5_MULTI_ENGINE_VECTOR;
+#else
+	return MD5_MULTI_ENGINE_SERIAL;
+#endif
+}
+
+static inline md5_multi_engine_t md5_multi_engine_get(void)
+{
+	if (unlikely(md5_multi_engine_current < 0)) md5_multi_engine_current = md5_multi_engine_select();
+
+	return md5_multi_engine_current;
+}
+
+/** Hash a batch of jobs with a specific engine
+ *
+ */
+static void md5_multi_calc(md5_multi_engine_t engine, fr_md5_multi_job_t *jobs, size_t num)
+{
+	if (num < MD5_MULTI_MIN_JOBS) engine = MD5_MULTI_ENGINE_SERIAL;
+
+	switch (engine) {
+#ifdef HAVE_MD5_MULTI_VECTOR
+	case MD5_MULTI_ENGINE_VECTOR:
+		md5_multi_lanes(md5_multi_transform_vector, jobs, num);
+		return;
+#endif
+
+#ifdef HAVE_MD5_MULTI_X86
+	case MD5_MULTI_ENGINE_AVX2:
+		md5_multi_lanes(md5_multi_transform_avx2, jobs, num);
+		return;
+
+	case MD5_MULTI_ENGINE_AVX512:
+		md5_multi_lanes(md5_multi_transform_avx512, jobs, num);
+		return;
+#endif
+
+	default:
+		md5_multi_serial(jobs, num);
+		return;
+	}
+}
+
+/** HMAC a batch of jobs with a specific engine
+ *
+ * The inner digests of every job are calculated in one batch, and
+ * then the outer digests in another.
+ */
+static void hmac_md5_multi(md5_multi_engine_t engine, fr_hmac_md5_multi_job_t *jobs, size_t num)
+{
+	fr_md5_multi_job_t	md5[HMAC_MD5_MULTI_CHUNK];
+	uint8_t			k_ipad[HMAC_MD5_MULTI_CHUNK][MD5_MULTI_BLOCK_LENGTH];
+	uint8_t			k_opad[HMAC_MD5_MULTI_CHUNK][MD5_MULTI_BLOCK_LENGTH];
+	uint8_t			inner[HMAC_MD5_MULTI_CHUNK][MD5_DIGEST_LENGTH];
+
+	while (num > 0) {
+		size_t	chunk = (num < HMAC_MD5_MULTI_CHUNK) ? num : HMAC_MD5_MULTI_CHUNK;
+		size_t	i, j;
+
+		for (i = 0; i < chunk; i++) {
+			uint8_t const	*key = jobs[i].key;
+			size_t		key_len = jobs[i].key_len;
+			uint8_t		tk[MD5_DIGEST_LENGTH];
+
+			/* if key is longer than 64 bytes reset it to key=MD5(key) */
+			if (key_len > MD5_MULTI_BLOCK_LENGTH) {
+				fr_md5_calc(tk, key, key_len);
+				key = tk;
+				key_len = sizeof(tk);
+			}
+
+			memset(k_ipad[i], 0, sizeof(k_ipad[i]));
+			memcpy(k_ipad[i], key, key_len);
+			memset(k_opad[i], 0, sizeof(k_opad[i]));
+			memcpy(k_opad[i], key, key_len);
+
+			for (j = 0; j < MD5_MULTI_BLOCK_LENGTH; j++) {
+				k_ipad[i][j] ^= 0x36;
+				k_opad[i][j] ^= 0x5c;
+			}
+
+			md5[i] = (fr_md5_multi_job_t){
+				.part = { { .data = k_ipad[i], .len = MD5_MULTI_BLOCK_LENGTH } },
+				.out = inner[i]
+			};
+			memcpy(&md5[i].part[1], jobs[i].part, sizeof(jobs[i].part));
+		}
+		md5_multi_calc(engine, md5, chunk);
+
+		for (i = 0; i < chunk; i++) {
+			md5[i] = (fr_md5_multi_job_t){
+				.part = {
+					{ .data = k_opad[i], .len = MD5_MULTI_BLOCK_LENGTH },
+					{ .data = inner[i], .len = MD5_DIGEST_LENGTH }
+				},
+				.out = jobs[i].out
+			};
+		}
+		md5_multi_calc(engine, md5, chunk);
+
+		jobs += chunk;
+		num -= chunk;
+	}
+
+	memset(k_ipad, 0, sizeof(k_ipad));	/* in case it's sensitive */
+	memset(k_opad, 0, sizeof(k_opad));
+}
+
+/** Calculate the MD5 digests of a batch of independent inputs
+ *
+ * Produces the same output as calling fr_md5_calc() on each job in turn,
+ * but where the CPU supports it, hashes up to 16 jobs in parallel.
+ *
+ * @param[in,out] jobs	to hash.  The digest of each is written to job->out.
+ * @param[in] num	Number of jobs.
+ */
+void fr_md5_calc_multi(fr_md5_multi_job_t *jobs, size_t num)
+{
+	md5_multi_calc(md5_multi_engine_get(), jobs, num);
+}
+
+/** Calculate the HMAC-MD5 digests of a batch of independent inputs
+ *
+ * Produces the same output as calling fr_hmac_md5() on each job in turn.
+ *
+ * @param[in,out] jobs	to hash.  The digest of each is written to job->out.
+ * @param[in] num	Number of jobs.
+ */
+void fr_hmac_md5_multi(fr_hmac_md5_multi_job_t *jobs, size_t num)
+{
+	hmac_md5_multi(md5_multi_engine_get(), jobs, num);
+}
+
+/** Return the name of the multi-buffer engine in use
+ *
+ * @return "serial", "vector", "avx2" or "avx512".
+ */
+char const *fr_md5_multi_engine(void)
+{
+	return md5_multi_engine_name[md5_multi_engine_get()];
+}
@@ -0,0 +1,215 @@
+#include <freeradius-devel/util/acutest.h>
+#include <freeradius-devel/util/rand.h>
+#include <freeradius-devel/util/time.h>
+
+#include "md5_multi.c"
+
+#define MD5_TEST_JOBS	(200)
+#define MD5_TEST_MAXLEN	(300)
+
+static uint8_t md5_test_data[MD5_TEST_JOBS][MD5_TEST_MAXLEN];
+
+/** Split each buffer into a random number of randomly sized parts
+ *
+ */
+static void md5_test_jobs_init(fr_md5_multi_job_t *jobs, uint8_t out[][MD5_DIGEST_LENGTH],
+			       uint8_t expected[][MD5_DIGEST_LENGTH])
+{
+	size_t i, j;
+
+	for (i = 0; i < MD5_TEST_JOBS; i++) {
+		size_t len = fr_rand() % MD5_TEST_MAXLEN;
+		size_t offset = 0;
+
+		for (j = 0; j < len; j++) md5_test_data[i][j] = fr_rand();
+
+		memset(&jobs[i], 0, sizeof(jobs[i]));
+		for (j = 0; (offset < len) && (j < (FR_MD5_MULTI_MAX_PARTS - 1)); j++) {
+			jobs[i].part[j].data = md5_test_data[i] + offset;
+			jobs[i].part[j].len = fr_rand() % ((len - offset) + 1);
+			offset += jobs[i].part[j].len;
+		}
+		jobs[i].part[j].data = md5_test_data[i] + offset;
+		jobs[i].part[j].len = len - offset;
+		jobs[i].out = out[i];
+
+		fr_md5_calc(expected[i], md5_test_data[i], len);
+	}
+}
+
+static void test_md5_multi(void)
+{
+	fr_md5_multi_job_t	jobs[MD5_TEST_JOBS];
+	uint8_t			out[MD5_TEST_JOBS][MD5_DIGEST_LENGTH];
+	uint8_t			expected[MD5_TEST_JOBS][MD5_DIGEST_LENGTH];
+	md5_multi_engine_t	engine, best = md5_multi_engine_select();
+	size_t			i;
+
+	for (engine = MD5_MULTI_ENGINE_SERIAL; engine <= best; engine++) {
+		TEST_CASE(md5_multi_engine_name[engine]);
+
+		md5_test_jobs_init(jobs, out, expected);
+		md5_multi_calc(engine, jobs, MD5_TEST_JOBS);
+
+		for (i = 0; i < MD5_TEST_JOBS; i++) {
+			TEST_CHECK(memcmp(out[i], expected[i], MD5_DIGEST_LENGTH) == 0);
+			TEST_MSG("digest %zu differs", i);
+		}
+	}
+}
+
+static void test_md5_multi_boundaries(void)
+{
+	fr_md5_multi_job_t	jobs[MD5_TEST_JOBS];
+	uint8_t			out[MD5_TEST_JOBS][MD5_DIGEST_LENGTH];
+	uint8_t			expected[MD5_TEST_JOBS][MD5_DIGEST_LENGTH];
+	md5_multi_engine_t	engine, best = md5_multi_engine_select();
+	size_t			i;
+
+	/*
+	 *	Lengths either side of where the padding and
+	 *	length no longer fit in the final block.
+	 */
+	for (engine = MD5_MULTI_ENGINE_SERIAL; engine <= best; engine++) {
+		TEST_CASE(md5_multi_engine_name[engine]);
+
+		for (i = 0; i < 140; i++) {
+			jobs[i] = (fr_md5_multi_job_t){
+				.part = { { .data = md5_test_data[i], .len = i } },
+				.out = out[i]
+			};
+			fr_md5_calc(expected[i], md5_test_data[i], i);
+		}
+		md5_multi_calc(engine, jobs, 140);
+
+		for (i = 0; i < 140; i++) {
+			TEST_CHECK(memcmp(out[i], expected[i], MD5_DIGEST_LENGTH) == 0);
+			TEST_MSG("digest of %zu bytes differs", i);
+		}
+	}
+}
+
+static void test_hmac_md5_multi(void)
+{
+	fr_hmac_md5_multi_job_t	jobs[MD5_TEST_JOBS];
+	uint8_t			out[MD5_TEST_JOBS][MD5_DIGEST_LENGTH];
+	uint8_t			expected[MD5_TEST_JOBS][MD5_DIGEST_LENGTH];
+	md5_multi_engine_t	engine, best = md5_multi_engine_select();
+	size_t			i, j;
+
+	for (engine = MD5_MULTI_ENGINE_SERIAL; engine <= best; engine++) {
+		TEST_CASE(md5_multi_engine_name[engine]);
+
+		for (i = 0; i < MD5_TEST_JOBS; i++) {
+			size_t len = fr_rand() % MD5_TEST_MAXLEN;
+			size_t key_len = fr_rand() % 100;	/* exercise keys longer than a block */
+			uint8_t const *key = md5_test_data[(i + 1) % MD5_TEST_JOBS];
+
+			for (j = 0; j < len; j++) md5_test_data[i][j] = fr_rand();
+
+			jobs[i] = (fr_hmac_md5_multi_job_t){
+				.key = key,
+				.key_len = key_len,
+				.part = {
+					{ .data = md5_test_data[i], .len = len / 2 },
+					{ .data = md5_test_data[i] + (len / 2), .len = len - (len / 2) }
+				},
+				.out = out[i]
+			};
+			fr_hmac_md5(expected[i], md5_test_data[i], len, key, key_len);
+		}
+		hmac_md5_multi(engine, jobs, MD5_TEST_JOBS);
+
+		for (i = 0; i < MD5_TEST_JOBS; i++) {
+			TEST_CHECK(memcmp(out[i], expected[i], MD5_DIGEST_LENGTH) == 0);
+			TEST_MSG("digest %zu differs", i);
+		}
+	}
+}
+
+static void test_hmac_md5_multi_rfc2104(void)
+{
+	fr_hmac_md5_multi_job_t	jobs[1];
+	uint8_t			out[MD5_DIGEST_LENGTH];
+
+	jobs[0] = (fr_hmac_md5_multi_job_t){
+		.key = (uint8_t const *)"Jefe",
+		.key_len = 4,
+		.part = { { .data = (uint8_t const *)"what do ya want for nothing?", .len = 28 } },
+		.out = out
+	};
+	fr_hmac_md5_multi(jobs, 1);
+
+	TEST_CHECK(memcmp(out, "\x75\x0c\x78\x3e\x6a\xb0\xb5\x03\xea\xa8\x6e\x31\x0a\x5d\xb7\x38",
+			  MD5_DIGEST_LENGTH) == 0);
+}
+
+static void test_hmac_md5_with_key(void)
+{
+	fr_hmac_md5_key_t	hkey;
+	uint8_t			out[MD5_DIGEST_LENGTH], expected[MD5_DIGEST_LENGTH];
+	size_t			key_len, i;
+
+	for (key_len = 0; key_len < 100; key_len += 7) {
+		for (i = 0; i < MD5_TEST_MAXLEN; i++) md5_test_data[0][i] = fr_rand();
+
+		TEST_CHECK(fr_hmac_md5_key_init(&hkey, md5_test_data[1], key_len) == 0);
+
+		/*
+		 *	The key state must survive being used repeatedly
+		 */
+		for (i = 0; i < MD5_TEST_MAXLEN; i += 37) {
+			fr_hmac_md5(expected, md5_test_data[0], i, md5_test_data[1], key_len);
+			fr_hmac_md5_with_key(out, md5_test_data[0], i, &hkey);
+
+			TEST_CHECK(memcmp(out, expected, MD5_DIGEST_LENGTH) == 0);
+			TEST_MSG("key length %zu, data length %zu differs", key_len, i);
+		}
+
+		fr_hmac_md5_key_free(&hkey);
+		TEST_CHECK(hkey.inner == NULL);
+		TEST_CHECK(hkey.outer == NULL);
+	}
+}
+
+/** Hash RADIUS sized inputs as fast as possible with each engine
+ *
+ */
+static void test_md5_multi_speed(void)
+{
+	fr_md5_multi_job_t	jobs[MD5_TEST_JOBS];
+	uint8_t			out[MD5_TEST_JOBS][MD5_DIGEST_LENGTH];
+	md5_multi_engine_t	engine, best = md5_multi_engine_select();
+	size_t			i, rounds = 5000;
+
+	for (i = 0; i < MD5_TEST_JOBS; i++) {
+		jobs[i] = (fr_md5_multi_job_t){
+			.part = { { .data = md5_test_data[i], .len = 100 } },
+			.out = out[i]
+		};
+	}
+
+	for (engine = MD5_MULTI_ENGINE_SERIAL; engine <= best; engine++) {
+		fr_time_t	start, stop;
+
+		start = fr_time();
+		for (i = 0; i < rounds; i++) md5_multi_calc(engine, jobs, MD5_TEST_JOBS);
+		stop = fr_time();
+
+		if (test_verbose_level__ >= 1) {
+			printf("%-8s %u hashes/s\n", md5_multi_engine_name[engine],
+			       (uint32_t)((rounds * MD5_TEST_JOBS) / ((float)(stop - start) / NSEC)));
+		}
+	}
+}
+
+TEST_LIST = {
+	{ "md5_multi",				test_md5_multi },
+	{ "md5_multi_boundaries",		test_md5_multi_boundaries },
+	{ "hmac_md5_multi",			test_hmac_md5_multi },
+	{ "hmac_md5_multi_rfc2104",		test_hmac_md5_multi_rfc2104 },
+	{ "hmac_md5_with_key",			test_hmac_md5_with_key },
+
+	{ "Speed Test - MD5, 100 byte inputs",	test_md5_multi_speed },
+	{ NULL }
+};
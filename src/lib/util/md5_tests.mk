@@ -0,0 +1,8 @@
+TARGET		:= md5_tests
+
+SOURCES		:= md5_tests.c
+
+TGT_LDLIBS	:= $(LIBS)
+TGT_LDFLAGS	:= $(LDFLAGS)
+
+TGT_PREREQS	+= libfreeradius-util.a
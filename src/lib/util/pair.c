@@ -47,6 +47,11 @@ RCSID("$Id$")
  */
 static int _fr_pair_free(NDEBUG_UNUSED VALUE_PAIR *vp)
 {
+	/*
+	 *	Any cached pointers to this pair are now invalid.
+	 */
+	fr_cursor_generation_bump();
+
 #ifndef NDEBUG
 	vp->vp_uint32 = FREE_MAGIC;
 #endif
@@ -315,6 +320,7 @@ int fr_pair_to_unknown(VALUE_PAIR *vp)
 
 	fr_dict_unknown_free(&vp->da);	/* Only frees unknown attributes */
 	vp->da = da;
+	fr_cursor_generation_bump();
 
 	return 0;
 }
@@ -563,6 +569,8 @@ void fr_pair_add(VALUE_PAIR **head, VALUE_PAIR *add)
 
 	VP_VERIFY(add);
 
+	fr_cursor_generation_bump();
+
 	if (*head == NULL) {
 		*head = add;
 		return;
@@ -599,6 +607,8 @@ void fr_pair_replace(VALUE_PAIR **head, VALUE_PAIR *replace)
 
 	VP_VERIFY(replace);
 
+	fr_cursor_generation_bump();
+
 	if (*head == NULL) {
 		*head = replace;
 		return;
@@ -1070,6 +1080,8 @@ void fr_pair_list_sort(VALUE_PAIR **vps, fr_cmp_t cmp)
 	 */
 	if (!head || !head->next) return;
 
+	fr_cursor_generation_bump();
+
 	_pair_list_sort_split(head, &a, &b);	/* Split into sublists */
 	fr_pair_list_sort(&a, cmp);		/* Traverse left */
 	fr_pair_list_sort(&b, cmp);		/* Traverse right */
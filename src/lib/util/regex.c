@@ -25,6 +25,7 @@ RCSID("$Id$")
 
 #ifdef HAVE_REGEX
 
+#include <freeradius-devel/util/debug.h>
 #include <freeradius-devel/util/regex.h>
 #include <freeradius-devel/util/strerror.h>
 #include <freeradius-devel/util/talloc.h>
@@ -32,6 +33,8 @@ RCSID("$Id$")
 #include <freeradius-devel/util/table.h>
 #include <freeradius-devel/util/talloc.h>
 
+#include <ctype.h>
+
 #if defined(HAVE_REGEX_PCRE) || (defined(HAVE_REGEX_PCRE2) && defined(PCRE2_CONFIG_JIT))
 #ifndef FR_PCRE_JIT_STACK_MIN
 #  define FR_PCRE_JIT_STACK_MIN	(128 * 1024)
@@ -631,6 +634,301 @@ fr_regmatch_t *regex_match_data_alloc(TALLOC_CTX *ctx, uint32_t count)
 
 	return regmatch;
 }
+
+/** A set of patterns evaluated in a single pass
+ *
+ * The arms are joined into one anchored alternation of the form:
+ *
+ @verbatim
+   \A(?:(*MARK:0)(?s:.*?)(?:<arm0>)|(*MARK:1)(?s:.*?)(?:<arm1>)|...)
+ @endverbatim
+ *
+ * The lazy prefix means every start position is tried for an arm
+ * before the next arm is considered, so the mark left by a successful
+ * match identifies the first arm which would have matched had each
+ * pattern been evaluated on its own, in order.
+ */
+struct fr_regex_multi_s {
+	char			*pattern;	//!< Combined pattern, built by regex_multi_add().
+	uint32_t		count;		//!< Number of arms added.
+	bool			unicode;	//!< Whether the arms were added with the 'u' flag.
+
+	pcre2_code		*compiled;	//!< Compiled combined pattern.
+	bool			jitd;		//!< Whether JIT data is available.
+};
+
+static int _regex_multi_free(fr_regex_multi_t *multi)
+{
+	if (multi->compiled) pcre2_code_free(multi->compiled);
+
+	return 0;
+}
+
+/** Allocate an empty multi-pattern matcher
+ *
+ * @param[in] ctx	to allocate the matcher in.
+ * @return
+ *	- A new matcher.
+ *	- NULL on error.
+ */
+fr_regex_multi_t *regex_multi_alloc(TALLOC_CTX *ctx)
+{
+	fr_regex_multi_t *multi;
+
+	multi = talloc_zero(ctx, fr_regex_multi_t);
+	if (!multi) {
+		fr_strerror_printf("Out of memory");
+		return NULL;
+	}
+	talloc_set_destructor(multi, _regex_multi_free);
+
+	return multi;
+}
+
+/** Check whether a pattern can be embedded in a combined alternation
+ *
+ * Anything which depends on group numbering, or which can change how
+ * the text following the pattern is parsed, is refused.
+ */
+static bool regex_multi_pattern_ok(char const *pattern, size_t len)
+{
+	char const *p = pattern, *end = pattern + len;
+
+	while (p < end) {
+		switch (*p) {
+		case '\\':
+			if ((p + 1) >= end) return false;
+
+			/*
+			 *	Back references, \K, \G and \Q...\E quoting
+			 */
+			if (isdigit((int) p[1])) return false;
+			if (strchr("gkGKQ", p[1])) return false;
+			p += 2;
+			continue;
+
+		case '(':
+			/*
+			 *	Only plain non-capturing groups.  Named
+			 *	groups, lookbehinds, option settings and
+			 *	verbs are all refused.
+			 */
+			if (((p + 1) < end) && (p[1] == '*')) return false;
+			if (((p + 1) < end) && (p[1] == '?') && (((p + 2) >= end) || (p[2] != ':'))) return false;
+			break;
+
+		default:
+			break;
+		}
+		p++;
+	}
+
+	return true;
+}
+
+/** Add a pattern to a multi-pattern matcher
+ *
+ * Arms are numbered in the order they are added.
+ *
+ * @param[in] multi	to add the pattern to.
+ * @param[in] pattern	to add.
+ * @param[in] len	of pattern.
+ * @param[in] flags	the pattern would have been compiled with.  May be NULL.
+ * @return
+ *	- >= 0 the arm number of the pattern.
+ *	- -1 if the pattern can't be combined with the other arms.
+ */
+int regex_multi_add(fr_regex_multi_t *multi, char const *pattern, size_t len, fr_regex_flags_t const *flags)
+{
+	char	opts[4], *p = opts;
+	char	*combined;
+	bool	unicode = flags && flags->unicode;
+
+	if (multi->compiled) {
+		fr_strerror_printf("Matcher has already been compiled");
+		return -1;
+	}
+
+	if (len == 0) {
+		fr_strerror_printf("Empty expression");
+		return -1;
+	}
+
+	if (flags && flags->extended) {
+		fr_strerror_printf("Extended expressions can't be combined");
+		return -1;
+	}
+
+	if ((multi->count > 0) && (unicode != multi->unicode)) {
+		fr_strerror_printf("Unicode and non-unicode expressions can't be combined");
+		return -1;
+	}
+
+	if (!regex_multi_pattern_ok(pattern, len)) {
+		fr_strerror_printf("Expression uses constructs which can't be combined");
+		return -1;
+	}
+
+	if (flags) {
+		if (flags->ignore_case) *p++ = 'i';
+		if (flags->multiline) *p++ = 'm';
+		if (flags->dot_all) *p++ = 's';
+	}
+	*p = '\0';
+
+	combined = talloc_asprintf(multi, "%s%s(*MARK:%u)(?s:.*?)(?%s:%.*s)",
+				   multi->pattern ? multi->pattern : "\\A(?:",
+				   multi->count ? "|" : "",
+				   multi->count, opts, (int)len, pattern);
+	if (!combined) {
+		fr_strerror_printf("Out of memory");
+		return -1;
+	}
+	talloc_free(multi->pattern);
+	multi->pattern = combined;
+	multi->unicode = unicode;
+
+	return multi->count++;
+}
+
+/** Compile the arms of a multi-pattern matcher
+ *
+ * @param[in] multi	to compile.
+ * @return
+ *	- 0 on success.
+ *	- -1 on failure.
+ */
+int regex_multi_compile(fr_regex_multi_t *multi)
+{
+	int		ret;
+	PCRE2_SIZE	offset;
+	uint32_t	cflags = PCRE2_NO_AUTO_CAPTURE;
+	char		*combined;
+
+	if (!fr_pcre2_tls && (fr_pcre2_tls_init() < 0)) return -1;
+
+	if (!multi->count) {
+		fr_strerror_printf("No expressions to compile");
+		return -1;
+	}
+
+	if (multi->unicode) cflags |= PCRE2_UTF;
+
+	combined = talloc_asprintf(multi, "%s)", multi->pattern);
+	if (!combined) {
+		fr_strerror_printf("Out of memory");
+		return -1;
+	}
+
+	multi->compiled = pcre2_compile((PCRE2_SPTR8)combined, talloc_array_length(combined) - 1,
+					cflags, &ret, &offset, fr_pcre2_tls->ccontext);
+	talloc_free(combined);
+	if (!multi->compiled) {
+		PCRE2_UCHAR errbuff[128];
+
+		pcre2_get_error_message(ret, errbuff, sizeof(errbuff));
+		fr_strerror_printf("%s", (char *)errbuff);
+
+		return -1;
+	}
+
+#ifdef PCRE2_CONFIG_JIT
+	if (fr_pcre2_tls->do_jit) {
+		ret = pcre2_jit_compile(multi->compiled, PCRE2_JIT_COMPLETE);
+		if (ret < 0) {
+			PCRE2_UCHAR errbuff[128];
+
+			pcre2_get_error_message(ret, errbuff, sizeof(errbuff));
+			fr_strerror_printf("Pattern JIT failed: %s", (char *)errbuff);
+			pcre2_code_free(multi->compiled);
+			multi->compiled = NULL;
+
+			return -1;
+		}
+		multi->jitd = true;
+	}
+#endif
+
+	return 0;
+}
+
+/** Return the number of arms in a multi-pattern matcher
+ *
+ */
+uint32_t regex_multi_count(fr_regex_multi_t const *multi)
+{
+	return multi->count;
+}
+
+/** Find the first arm which matches a subject
+ *
+ * No capture data is produced.  Callers wanting subcaptures should
+ * re-evaluate the original expression for the arm returned.
+ *
+ * @param[in] multi	The compiled matcher.
+ * @param[in] subject	to match.
+ * @param[in] len	Length of subject.
+ * @return
+ *	- >= 0 the first arm which matched.
+ *	- -1 if no arms matched.
+ *	- -2 on error.
+ */
+int regex_multi_exec(fr_regex_multi_t const *multi, char const *subject, size_t len)
+{
+	int			ret;
+	pcre2_match_data	*match_data;
+	PCRE2_SPTR		mark;
+	unsigned long		arm;
+
+	if (!fr_pcre2_tls && (fr_pcre2_tls_init() < 0)) return -2;
+
+	if (!fr_cond_assert(multi->compiled)) return -2;
+
+	match_data = pcre2_match_data_create_from_pattern(multi->compiled, fr_pcre2_tls->gcontext);
+	if (!match_data) {
+		fr_strerror_printf("Failed allocating temporary match data");
+		return -2;
+	}
+
+#ifdef PCRE2_CONFIG_JIT
+	if (multi->jitd) {
+		ret = pcre2_jit_match(multi->compiled, (PCRE2_SPTR8)subject, len, 0, 0,
+				      match_data, fr_pcre2_tls->mcontext);
+	} else
+#endif
+	{
+		ret = pcre2_match(multi->compiled, (PCRE2_SPTR8)subject, len, 0, 0,
+				  match_data, fr_pcre2_tls->mcontext);
+	}
+	if (ret < 0) {
+		PCRE2_UCHAR	errbuff[128];
+
+		pcre2_match_data_free(match_data);
+
+		if (ret == PCRE2_ERROR_NOMATCH) return -1;
+
+		pcre2_get_error_message(ret, errbuff, sizeof(errbuff));
+		fr_strerror_printf("regex evaluation failed with code (%i): %s", ret, errbuff);
+
+		return -2;
+	}
+
+	mark = pcre2_get_mark(match_data);
+	if (!mark) {
+		pcre2_match_data_free(match_data);
+		fr_strerror_printf("Combined expression matched without setting a mark");
+		return -2;
+	}
+	arm = strtoul((char const *)mark, NULL, 10);
+	pcre2_match_data_free(match_data);
+
+	if (arm >= multi->count) {
+		fr_strerror_printf("Combined expression returned invalid arm %lu", arm);
+		return -2;
+	}
+
+	return (int)arm;
+}
 /*
  *######################################
  *#       FUNCTIONS FOR LIBPCRE        #
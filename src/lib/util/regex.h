@@ -178,6 +178,20 @@ int		regex_substitute(TALLOC_CTX *ctx, char **out, size_t max_out, regex_t *preg
 #endif
 uint32_t	regex_subcapture_count(regex_t const *preg);
 fr_regmatch_t	*regex_match_data_alloc(TALLOC_CTX *ctx, uint32_t count);
+
+#ifdef HAVE_REGEX_PCRE2
+/** Multiple expressions evaluated in a single pass, returning the first which matches
+ *
+ */
+typedef struct fr_regex_multi_s fr_regex_multi_t;
+
+fr_regex_multi_t *regex_multi_alloc(TALLOC_CTX *ctx);
+int		regex_multi_add(fr_regex_multi_t *multi, char const *pattern, size_t len,
+				fr_regex_flags_t const *flags);
+int		regex_multi_compile(fr_regex_multi_t *multi);
+uint32_t	regex_multi_count(fr_regex_multi_t const *multi);
+int		regex_multi_exec(fr_regex_multi_t const *multi, char const *subject, size_t len);
+#endif
 #  ifdef __cplusplus
 }
 #  endif
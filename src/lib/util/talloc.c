@@ -533,6 +533,104 @@ finish:
 	return out;
 }
 
+/** Initialise a buffer which grows as data is appended to it
+ *
+ * Used to serialise structures whose length isn't known in advance.
+ *
+ * @param[in] ctx	to allocate the buffer in.
+ * @param[out] tb	to initialise.
+ * @param[in] hint	Initial size of the buffer.
+ * @return
+ *	- 0 on success.
+ *	- -1 on failure.
+ */
+int talloc_buff_init(TALLOC_CTX *ctx, fr_talloc_buff_t *tb, size_t hint)
+{
+	tb->buff = talloc_array(ctx, uint8_t, hint ? hint : 1);
+	tb->used = 0;
+	if (!tb->buff) {
+		fr_strerror_printf("Out of memory");
+		return -1;
+	}
+
+	return 0;
+}
+
+/** Append data to a buffer, growing it if needed
+ *
+ * @param[in] tb	to append to.
+ * @param[in] in	data to append.
+ * @param[in] inlen	Length of data.
+ * @return
+ *	- 0 on success.
+ *	- -1 on failure.  The buffer is unchanged.
+ */
+int talloc_buff_append(fr_talloc_buff_t *tb, void const *in, size_t inlen)
+{
+	size_t len = talloc_array_length(tb->buff);
+
+	if ((tb->used + inlen) > len) {
+		uint8_t *buff;
+
+		buff = talloc_realloc(talloc_parent(tb->buff), tb->buff, uint8_t, (tb->used + inlen) * 2);
+		if (!buff) {
+			fr_strerror_printf("Out of memory");
+			return -1;
+		}
+		tb->buff = buff;
+	}
+
+	/*
+	 * C99 (7.21.1/2) - Length zero results in noop
+	 */
+	memcpy(tb->buff + tb->used, in, inlen);
+	tb->used += inlen;
+
+	return 0;
+}
+
+/** Append data to a buffer, preceded by a one byte length
+ *
+ * @param[in] tb	to append to.
+ * @param[in] in	data to append.
+ * @param[in] inlen	Length of data.  Must be less than 256.
+ * @return
+ *	- 0 on success.
+ *	- -1 on failure.  The buffer may contain the length.
+ */
+int talloc_buff_append_len8(fr_talloc_buff_t *tb, void const *in, size_t inlen)
+{
+	if (inlen > UINT8_MAX) {
+		fr_strerror_printf("Field too long, expected at most %u bytes, got %zu bytes", UINT8_MAX, inlen);
+		return -1;
+	}
+
+	if (talloc_buff_append_uint8(tb, inlen) < 0) return -1;
+
+	return talloc_buff_append(tb, in, inlen);
+}
+
+/** Append data to a buffer, preceded by a four byte length in network order
+ *
+ * @param[in] tb	to append to.
+ * @param[in] in	data to append.
+ * @param[in] inlen	Length of data.
+ * @return
+ *	- 0 on success.
+ *	- -1 on failure.  The buffer may contain the length.
+ */
+int talloc_buff_append_len32(fr_talloc_buff_t *tb, void const *in, size_t inlen)
+{
+	if (inlen > UINT32_MAX) {
+		fr_strerror_printf("Field too long, expected at most %u bytes, got %zu bytes", UINT32_MAX, inlen);
+		return -1;
+	}
+
+	if (talloc_buff_append_uint32(tb, inlen) < 0) return -1;
+
+	return talloc_buff_append(tb, in, inlen);
+}
+
 /** Compares two talloced uint8_t arrays with memcmp
  *
  * Talloc arrays carry their length as part of the structure, so can be passed to a generic
@@ -159,6 +159,55 @@ void		**talloc_array_null_strip(void **array);
 
 int		talloc_const_free(void const *ptr);
 
+/** A talloced byte array which grows as data is appended to it
+ *
+ */
+typedef struct {
+	uint8_t		*buff;			//!< The data.  May be reallocated by any append.
+	size_t		used;			//!< How much of buff has been written to.
+} fr_talloc_buff_t;
+
+int		talloc_buff_init(TALLOC_CTX *ctx, fr_talloc_buff_t *tb, size_t hint);
+
+int		talloc_buff_append(fr_talloc_buff_t *tb, void const *in, size_t inlen);
+
+int		talloc_buff_append_len8(fr_talloc_buff_t *tb, void const *in, size_t inlen);
+
+int		talloc_buff_append_len32(fr_talloc_buff_t *tb, void const *in, size_t inlen);
+
+/** Append a single byte to a buffer
+ *
+ */
+static inline int talloc_buff_append_uint8(fr_talloc_buff_t *tb, uint8_t num)
+{
+	return talloc_buff_append(tb, &num, sizeof(num));
+}
+
+/** Append a 32bit unsigned integer to a buffer, in network order
+ *
+ */
+static inline int talloc_buff_append_uint32(fr_talloc_buff_t *tb, uint32_t num)
+{
+	uint8_t	out[sizeof(num)];
+
+	out[0] = (num >> 24) & 0xff;
+	out[1] = (num >> 16) & 0xff;
+	out[2] = (num >> 8) & 0xff;
+	out[3] = num & 0xff;
+
+	return talloc_buff_append(tb, out, sizeof(out));
+}
+
+/** Append a 64bit unsigned integer to a buffer, in network order
+ *
+ */
+static inline int talloc_buff_append_uint64(fr_talloc_buff_t *tb, uint64_t num)
+{
+	if (talloc_buff_append_uint32(tb, num >> 32) < 0) return -1;
+
+	return talloc_buff_append_uint32(tb, num & 0xffffffff);
+}
+
 /** Free a list of talloced structures containing a next field
  *
  * @param[in] _head	of list to free.  Will set memory it points to to be NULL.
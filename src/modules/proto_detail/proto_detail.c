@@ -23,6 +23,7 @@
  * @copyright 2016 Alan DeKok (aland@freeradius.org)
  */
 #include <freeradius-devel/server/base.h>
+#include <freeradius-devel/server/detail.h>
 #include <freeradius-devel/radius/radius.h>
 #include <freeradius-devel/io/listen.h>
 #include <freeradius-devel/io/schedule.h>
@@ -230,6 +231,79 @@ static int transport_parse(TALLOC_CTX *ctx, void *out, UNUSED void *parent,
 	return dl_module_instance(ctx, out, transport_cs, parent_inst, name, DL_MODULE_TYPE_SUBMODULE);
 }
 
+/** Set the original src/dst ip/port, or the protocol, from a decoded pair
+ *
+ */
+static int decode_special(REQUEST *request, VALUE_PAIR *vp)
+{
+	if ((vp->da == attr_packet_src_ip_address) ||
+	    (vp->da == attr_packet_src_ipv6_address)) {
+		request->packet->src_ipaddr = vp->vp_ip;
+	} else if ((vp->da == attr_packet_dst_ip_address) ||
+		   (vp->da == attr_packet_dst_ipv6_address)) {
+		request->packet->dst_ipaddr = vp->vp_ip;
+	} else if (vp->da == attr_packet_src_port) {
+		request->packet->src_port = vp->vp_uint16;
+	} else if (vp->da == attr_packet_dst_port) {
+		request->packet->dst_port = vp->vp_uint16;
+	} else if (vp->da == attr_protocol) {
+		request->dict = fr_dict_by_protocol_num(vp->vp_uint32);
+		if (!request->dict) {
+			REDEBUG("Invalid protocol: %pP", vp);
+			return -1;
+		}
+	}
+
+	return 0;
+}
+
+/** Decode a binary detail record
+ *
+ * The pairs are decoded directly, instead of being printed and
+ * re-parsed.
+ */
+static int mod_decode_binary(proto_detail_t const *inst, REQUEST *request, uint8_t *const data, size_t data_len)
+{
+	fr_cursor_t		cursor;
+	VALUE_PAIR		*vp, *head = NULL;
+	fr_dict_t const		*dict;
+	unsigned int		code;
+	fr_unix_time_t		when;
+
+	fr_cursor_init(&cursor, &head);
+	if (fr_detail_binary_decode(request->packet, &cursor, &dict, &code, &when, data, data_len) < 0) {
+		RPEDEBUG("Failed decoding binary detail entry");
+		fr_pair_list_free(&head);
+		return -1;
+	}
+	request->dict = dict;
+
+	for (vp = fr_cursor_head(&cursor);
+	     vp;
+	     vp = fr_cursor_next(&cursor)) {
+		if (decode_special(request, vp) < 0) {
+			fr_pair_list_free(&head);
+			return -1;
+		}
+	}
+
+	/*
+	 *	The original time at which we received the
+	 *	packet.  We need this to properly calculate
+	 *	Acct-Delay-Time.
+	 */
+	vp = fr_pair_afrom_da(request->packet, attr_packet_original_timestamp);
+	if (vp) {
+		vp->vp_date = when;
+		vp->type = VT_DATA;
+		fr_cursor_append(&cursor, vp);
+	}
+
+	fr_pair_add(&request->packet->vps, head);
+
+	return inst->app_io->decode(inst->app_io_instance, request, data, data_len);
+}
+
 /** Decode the packet, and set the request->process function
  *
  */
@@ -259,6 +333,8 @@ static int mod_decode(void const *instance, REQUEST *request, uint8_t *const dat
 
 	end = data + data_len;
 
+	if (fr_detail_binary_is_record(data, data_len)) return mod_decode_binary(inst, request, data, data_len);
+
 	MPRINT("HEADER %s", data);
 
 	if (sscanf((char const *) data, "%*s %*s %*d %*d:%*d:%*d %d", &num) != 1) {
@@ -351,25 +427,7 @@ static int mod_decode(void const *instance, REQUEST *request, uint8_t *const dat
 		/*
 		 *	Set the original src/dst ip/port
 		 */
-		if (vp) {
-			if ((vp->da == attr_packet_src_ip_address) ||
-			    (vp->da == attr_packet_src_ipv6_address)) {
-				request->packet->src_ipaddr = vp->vp_ip;
-			} else if ((vp->da == attr_packet_dst_ip_address) ||
-				   (vp->da == attr_packet_dst_ipv6_address)) {
-				request->packet->dst_ipaddr = vp->vp_ip;
-			} else if (vp->da == attr_packet_src_port) {
-				request->packet->src_port = vp->vp_uint16;
-			} else if (vp->da == attr_packet_dst_port) {
-				request->packet->dst_port = vp->vp_uint16;
-			} else if (vp->da == attr_protocol) {
-				request->dict = fr_dict_by_protocol_num(vp->vp_uint32);
-				if (!request->dict) {
-					REDEBUG("Invalid protocol: %pP", vp);
-					goto error;
-				}
-			}
-		}
+		if (vp && (decode_special(request, vp) < 0)) goto error;
 
 	next:
 		lineno++;
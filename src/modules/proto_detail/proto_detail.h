@@ -95,6 +95,7 @@ struct proto_detail_work_s {
 	bool				track_progress;		//!< do we track progress by writing?
 	bool				retransmit;		//!< are we retransmitting on error?
 	bool				immediate;		//!< start reading the detail files immediately
+	bool				use_mmap;		//!< read the work file via mmap() instead of read()
 
 	int				mode;			//!< O_RDWR or O_RDONLY
 
@@ -137,6 +138,10 @@ struct proto_detail_work_thread_s {
 	off_t				header_offset;		//!< offset of the current header we're reading
 	off_t				read_offset;		//!< where we're reading from in filename_work
 
+	uint8_t				*map;			//!< work file, if it's mapped into memory
+	size_t				map_size;		//!< size of the mapping
+	off_t				map_released;		//!< pages before this offset have been released
+
 	fr_event_timer_t const		*ev;			//!< for detail file timers.
 
 	pthread_mutex_t			worker_mutex;		//!< for the workers
@@ -32,9 +32,11 @@
 #include <freeradius-devel/util/dlist.h>
 #include <freeradius-devel/util/time.h>
 #include <freeradius-devel/util/debug.h>
+#include <freeradius-devel/server/detail.h>
 #include "proto_detail.h"
 
 #include <fcntl.h>
+#include <sys/mman.h>
 #include <sys/stat.h>
 
 #ifndef NDEBUG
@@ -91,6 +93,8 @@ static const CONF_PARSER file_listen_config[] = {
 
 	{ FR_CONF_OFFSET("retransmit", FR_TYPE_BOOL, proto_detail_work_t, retransmit ), .dflt = "yes" },
 
+	{ FR_CONF_OFFSET("mmap", FR_TYPE_BOOL, proto_detail_work_t, use_mmap ), .dflt = "yes" },
+
 	{ FR_CONF_POINTER("limit", FR_TYPE_SUBSECTION, NULL), .subcs = (void const *) limit_config },
 	CONF_PARSER_TERMINATOR
 };
@@ -145,6 +149,43 @@ static fr_event_update_t resume_read[] = {
 	{ 0 }
 };
 
+/*
+ *	Release pages of the mapping in chunks of this size.
+ */
+#define MAP_RELEASE_SIZE	(16 * 1024 * 1024)
+
+/** Copy the next chunk of the work file from the mapping
+ *
+ *  The pages we've already copied are released as we go, so
+ *  that reading a very large file doesn't leave all of it
+ *  resident.
+ */
+static ssize_t work_map_read(proto_detail_work_thread_t *thread, uint8_t *buffer, size_t room)
+{
+	size_t	len;
+	off_t	release;
+
+	if ((size_t) thread->read_offset >= thread->map_size) return 0;
+
+	len = thread->map_size - thread->read_offset;
+	if (len > room) len = room;
+
+	memcpy(buffer, thread->map + thread->read_offset, len);
+	thread->read_offset += len;
+
+#ifdef MADV_DONTNEED
+	release = thread->read_offset & ~((off_t) MAP_RELEASE_SIZE - 1);
+	if (release > thread->map_released) {
+		(void) madvise(thread->map + thread->map_released, release - thread->map_released, MADV_DONTNEED);
+		thread->map_released = release;
+	}
+#else
+	(void) release;
+#endif
+
+	return len;
+}
+
 static ssize_t mod_read(fr_listen_t *li, void **packet_ctx, fr_time_t *recv_time_p, uint8_t *buffer, size_t buffer_len, size_t *leftover, uint32_t *priority, UNUSED bool *is_dup)
 {
 	proto_detail_work_t const	*inst = talloc_get_type_abort_const(li->app_io_instance, proto_detail_work_t);
@@ -156,6 +197,7 @@ static ssize_t mod_read(fr_listen_t *li, void **packet_ctx, fr_time_t *recv_time
 	uint8_t				*partial, *end, *next, *p, *record_end;
 	uint8_t				*stopped_search;
 	off_t				done_offset;
+	bool				binary;
 
 	fr_assert(*leftover < buffer_len);
 	fr_assert(thread->fd >= 0);
@@ -228,7 +270,7 @@ static ssize_t mod_read(fr_listen_t *li, void **packet_ctx, fr_time_t *recv_time
 	/*
 	 *	Seek to the current read offset.
 	 */
-	(void) lseek(thread->fd, thread->read_offset, SEEK_SET);
+	if (!thread->map) (void) lseek(thread->fd, thread->read_offset, SEEK_SET);
 
 	/*
 	 *	There will be "leftover" bytes left over in the buffer
@@ -247,20 +289,24 @@ static ssize_t mod_read(fr_listen_t *li, void **packet_ctx, fr_time_t *recv_time
 
 		room = buffer_len - *leftover;
 
-		data_size = read(thread->fd, partial, room);
-		if (data_size < 0) {
-			ERROR("proto_detail (%s): Failed reading file %s: %s",
-			      thread->name, thread->filename_work, fr_syserror(errno));
-			return -1;
+		if (thread->map) {
+			data_size = work_map_read(thread, partial, room);
+		} else {
+			data_size = read(thread->fd, partial, room);
+			if (data_size < 0) {
+				ERROR("proto_detail (%s): Failed reading file %s: %s",
+				      thread->name, thread->filename_work, fr_syserror(errno));
+				return -1;
+			}
+
+			/*
+			 *	Remember the read offset.
+			 */
+			thread->read_offset = lseek(thread->fd, 0, SEEK_CUR);
 		}
 
 		MPRINT("GOT %zd bytes", data_size);
 
-		/*
-		 *	Remember the read offset, and whether we got EOF.
-		 */
-		thread->read_offset = lseek(thread->fd, 0, SEEK_CUR);
-
 		/*
 		 *	Only set EOF if there's no more data in the buffer to manage.
 		 */
@@ -285,6 +331,41 @@ redo:
 	next = NULL;
 	stopped_search = end;
 
+	/*
+	 *	Binary records contain their length, so there's no
+	 *	need to search for the end of them.
+	 */
+	binary = fr_detail_binary_is_record(buffer, end - buffer);
+	if (binary) {
+		ssize_t slen;
+
+		slen = fr_detail_binary_length(buffer, end - buffer);
+		if (slen < 0) {
+			ERROR("proto_detail (%s): Malformed binary entry found at offset %zu of file %s",
+			      thread->name, (size_t) thread->header_offset, thread->filename_work);
+			return -1;
+		}
+
+		if ((size_t) slen > buffer_len) {
+			ERROR("proto_detail (%s): Too large binary entry (%zd > %zu bytes) found at offset %zu of file %s",
+			      thread->name, slen, buffer_len, (size_t) thread->header_offset, thread->filename_work);
+			return -1;
+		}
+
+		if ((slen == 0) || (slen > (end - buffer))) {
+			if (thread->eof) {
+				ERROR("proto_detail (%s): Truncated binary entry found at offset %zu of file %s",
+				      thread->name, (size_t) thread->header_offset, thread->filename_work);
+				return -1;
+			}
+		} else {
+			next = buffer + slen;
+		}
+
+		stopped_search = buffer;
+		goto search_done;
+	}
+
 	/*
 	 *	Look for "end of record" marker, starting from the
 	 *	beginning of the buffer.
@@ -298,9 +379,16 @@ redo:
 
 	p = buffer + thread->last_search;
 	while (p < end) {
+		/*
+		 *	memchr() is vectorised by libc, and is much
+		 *	faster than checking each byte ourselves.
+		 */
 		if (p[0] != '\n') {
-			p++;
-			continue;
+			p = memchr(p, '\n', end - p);
+			if (!p) {
+				p = end;
+				break;
+			}
 		}
 		if ((p + 1) == end) {
 			/*
@@ -381,6 +469,7 @@ redo:
 		p += 3;
 	}
 
+search_done:
 	thread->last_search = (stopped_search - buffer);
 
 	/*
@@ -462,10 +551,21 @@ redo:
 	p = buffer;
 	done_offset = 0;
 
+	/*
+	 *	Binary records have a fixed place for the "Done"
+	 *	marker, so we don't need to search for it.
+	 */
+	if (binary) {
+		if (fr_detail_binary_is_done(buffer)) goto skip_record;
+
+		done_offset = thread->header_offset + FR_DETAIL_BINARY_DONE_OFFSET;
+		p = record_end;
+	}
+
 	while (p < record_end) {
 		if (*p != '\0') {
-			p++;
-			continue;
+			p = memchr(p, '\0', record_end - p);
+			if (!p) break;
 		}
 
 		p++;
@@ -716,6 +816,33 @@ static int mod_open(fr_listen_t *li)
 		thread->file_size = 1;
 	}
 
+	/*
+	 *	Map the file into memory.  Anything appended to the
+	 *	file after this point is ignored, as it would be when
+	 *	reading it.  If the mapping fails, we just read() it.
+	 */
+	if (inst->use_mmap) {
+		struct stat buf;
+
+		if ((fstat(thread->fd, &buf) == 0) && (buf.st_size > 0)) {
+			void *map;
+
+			map = mmap(NULL, buf.st_size, PROT_READ, MAP_SHARED, thread->fd, 0);
+			if (map == MAP_FAILED) {
+				cf_log_warn(inst->cs, "Failed mapping %s, falling back to read(): %s",
+					    thread->filename_work, fr_syserror(errno));
+			} else {
+				thread->map = map;
+				thread->map_size = buf.st_size;
+				thread->map_released = 0;
+				thread->file_size = buf.st_size;
+#ifdef MADV_SEQUENTIAL
+				(void) madvise(thread->map, thread->map_size, MADV_SEQUENTIAL);
+#endif
+			}
+		}
+	}
+
 	fr_assert(thread->name == NULL);
 	fr_assert(thread->filename_work != NULL);
 	thread->name = talloc_typed_asprintf(thread, "detail_work from filename %s", thread->filename_work);
@@ -746,6 +873,12 @@ static int mod_close_internal(proto_detail_work_thread_t *thread)
 
 	unlink(thread->filename_work);
 
+	if (thread->map) {
+		(void) munmap(thread->map, thread->map_size);
+		thread->map = NULL;
+		thread->map_size = 0;
+	}
+
 	close(thread->fd);
 	thread->fd = -1;
 
@@ -97,11 +97,13 @@ fr_dict_autoload_t proto_radius_dict[] = {
 	{ NULL }
 };
 
+static fr_dict_attr_t const *attr_freeradius_extended_id;
 static fr_dict_attr_t const *attr_packet_type;
 static fr_dict_attr_t const *attr_user_name;
 
 extern fr_dict_attr_autoload_t proto_radius_dict_attr[];
 fr_dict_attr_autoload_t proto_radius_dict_attr[] = {
+	{ .out = &attr_freeradius_extended_id, .name = "FreeRADIUS-Extended-ID", .type = FR_TYPE_UINT16, .dict = &dict_radius},
 	{ .out = &attr_packet_type, .name = "Packet-Type", .type = FR_TYPE_UINT32, .dict = &dict_radius},
 	{ .out = &attr_user_name, .name = "User-Name", .type = FR_TYPE_STRING, .dict = &dict_radius},
 	{ NULL }
@@ -471,6 +473,27 @@ static ssize_t mod_encode(void const *instance, REQUEST *request, uint8_t *buffe
 		if (data_len > 0) return data_len;
 	}
 
+	/*
+	 *	Echo the client's extended ID, so that it can find
+	 *	the request.  Use the last one, any others were added
+	 *	by proxies further upstream.
+	 */
+	if (inst->extended_id) {
+		VALUE_PAIR	*vp, *ext_id = NULL;
+		fr_cursor_t	cursor;
+
+		for (vp = fr_cursor_iter_by_da_init(&cursor, &request->packet->vps, attr_freeradius_extended_id);
+		     vp;
+		     vp = fr_cursor_next(&cursor)) ext_id = vp;
+
+		if (ext_id) {
+			fr_pair_delete_by_da(&request->reply->vps, attr_freeradius_extended_id);
+
+			MEM(vp = fr_pair_copy(request->reply, ext_id));
+			fr_pair_add(&request->reply->vps, vp);
+		}
+	}
+
 #ifdef WITH_UDPFROMTO
 	/*
 	 *	Overwrite the src ip address on the outbound packet
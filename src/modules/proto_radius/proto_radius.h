@@ -40,6 +40,10 @@ typedef struct {
 
 	bool				tunnel_password_zeros;		//!< check for trailing zeroes in Tunnel-Password.
 
+	bool				extended_id;			//!< echo FreeRADIUS-Extended-ID in replies.
+									///< Set by transports which can tell
+									///< packets with the same ID apart.
+
 	bool				code_allowed[FR_CODE_RADIUS_MAX + 1];	//!< Allowed packet codes.
 
 	uint32_t			priorities[FR_RADIUS_MAX_PACKET_CODE];	//!< priorities for individual packets
@@ -54,6 +54,8 @@ typedef struct {
 
 	uint32_t	session_timeout;		//!< Maximum time between the last response and next request.
 	uint32_t	max_session;			//!< Maximum ongoing session allowed.
+	char const	*session_backend;		//!< Where to store serialised session state so that
+							//!< other servers can continue the session.
 
 	uint8_t       	state_server_id;		//!< Sets a specific byte in the state to allow the
 							//!< authenticating server to be identified in packet
@@ -78,6 +80,7 @@ typedef struct {
 static const CONF_PARSER session_config[] = {
 	{ FR_CONF_OFFSET("timeout", FR_TYPE_UINT32, proto_radius_auth_t, session_timeout), .dflt = "15" },
 	{ FR_CONF_OFFSET("max", FR_TYPE_UINT32, proto_radius_auth_t, max_session), .dflt = "4096" },
+	{ FR_CONF_OFFSET("backend", FR_TYPE_STRING, proto_radius_auth_t, session_backend) },
 	{ FR_CONF_OFFSET("state_server_id", FR_TYPE_UINT8, proto_radius_auth_t, state_server_id) },
 
 	CONF_PARSER_TERMINATOR
@@ -734,6 +737,11 @@ static int mod_instantiate(void *instance, UNUSED CONF_SECTION *process_app_cs)
 	inst->state_tree = fr_state_tree_init(inst, attr_state, main_config->spawn_workers, inst->max_session,
 					      inst->session_timeout, inst->state_server_id);
 
+	if (inst->session_backend && (fr_state_tree_backend_set(inst->state_tree, inst->session_backend) < 0)) {
+		PERROR("Failed setting session backend");
+		return -1;
+	}
+
 	return 0;
 }
 
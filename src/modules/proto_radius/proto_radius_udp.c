@@ -422,6 +422,8 @@ static char const *mod_name(fr_listen_t *li)
 static int mod_bootstrap(void *instance, CONF_SECTION *cs)
 {
 	proto_radius_udp_t	*inst = talloc_get_type_abort(instance, proto_radius_udp_t);
+	proto_radius_t		*parent = talloc_get_type_abort(dl_module_parent_data_by_child_data(instance),
+								proto_radius_t);
 	size_t			num;
 	CONF_ITEM		*ci;
 	CONF_SECTION		*server_cs;
@@ -484,6 +486,13 @@ static int mod_bootstrap(void *instance, CONF_SECTION *cs)
 		}
 	}
 
+	/*
+	 *	Unless we dedup using the request authenticator,
+	 *	packets with the same ID from the same source are
+	 *	duplicates.  So we can't support extended IDs.
+	 */
+	parent->extended_id = inst->dedup_authenticator;
+
 	ci = cf_parent(inst->cs); /* listen { ... } */
 	fr_assert(ci != NULL);
 	ci = cf_parent(ci);
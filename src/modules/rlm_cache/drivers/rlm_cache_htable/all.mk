@@ -0,0 +1,3 @@
+SUBMAKEFILES := \
+	rlm_cache_htable.mk \
+	rlm_cache_htable_tests.mk
@@ -0,0 +1,580 @@
+/*
+ *   This program is is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or (at
+ *   your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ */
+
+/**
+ * $Id$
+ * @file rlm_cache_htable.c
+ * @brief Sharded, in memory, hash table based cache.
+ *
+ * Entries are spread over a number of independently locked shards by
+ * hashing their keys.  Each shard is an open addressed (linear probing)
+ * hash table.  When a shard exceeds its share of the memory limit, entries
+ * are evicted using the CLOCK algorithm, with expired entries evicted first.
+ *
+ * @copyright 2020 The FreeRADIUS server project
+ */
+#include <freeradius-devel/server/base.h>
+#include <freeradius-devel/util/debug.h>
+#include <freeradius-devel/util/hash.h>
+#include "../../rlm_cache.h"
+
+#ifdef HAVE_STDATOMIC_H
+#  include <stdatomic.h>
+#else
+#  include <freeradius-devel/util/stdatomic.h>
+#endif
+
+/** Maximum number of shards
+ *
+ * The low bits of an entry's hash select the shard, and the remaining
+ * bits select the slot within the shard.
+ */
+#define HTABLE_MAX_SHARDS	256
+
+/** Number of slots in a new shard
+ *
+ * Must be a power of two.
+ */
+#define HTABLE_INITIAL_SLOTS	64
+
+typedef struct {
+	rlm_cache_entry_t	fields;		//!< Entry data.
+	uint32_t		hash;		//!< Hash of the entry's key.
+	size_t			size;		//!< Memory used by the entry, counted against max_memory.
+	bool			referenced;	//!< Whether the entry has been found since the CLOCK
+						///< hand last passed it.
+} rlm_cache_htable_entry_t;
+
+/** An independently locked slice of the cache
+ *
+ */
+typedef struct {
+	pthread_mutex_t		mutex;		//!< Protects the slots, and entries in them.
+
+	rlm_cache_htable_entry_t **slots;	//!< Open addressed table of entries.
+	uint32_t		mask;		//!< Number of slots - 1.
+	uint32_t		used;		//!< Number of occupied slots.
+	uint32_t		hand;		//!< Position of the CLOCK hand.
+
+	size_t			memory;		//!< Memory used by entries in this shard.
+	size_t			max_memory;	//!< This shard's share of max_memory.
+
+	uint64_t		evicted;	//!< Number of unexpired entries removed to free memory.
+
+	uint8_t			pad[128];	//!< No two shards share a cache line, whatever
+						///< alignment talloc gives the array.
+} rlm_cache_htable_shard_t;
+
+typedef struct {
+	uint32_t		num_shards;	//!< Number of shards.  Rounded up to a power of two.
+	size_t			max_memory;	//!< Maximum memory used by entries, 0 for no limit.
+
+	uint32_t		shard_bits;	//!< log2(num_shards).
+	rlm_cache_htable_shard_t *shard;	//!< Array of shards.
+
+	atomic_uint_fast32_t	count;		//!< Number of entries across all shards.
+} rlm_cache_htable_t;
+
+/** Handle, recording which shard is locked
+ *
+ * rlm_cache acquires a handle before it knows the key, so the shard is
+ * only locked when the handle is first used with a key.
+ */
+typedef struct {
+	rlm_cache_htable_t	*driver;	//!< Driver instance.
+	rlm_cache_htable_shard_t *shard;	//!< Shard currently locked, or NULL.
+} rlm_cache_htable_handle_t;
+
+static const CONF_PARSER driver_config[] = {
+	{ FR_CONF_OFFSET("shards", FR_TYPE_UINT32, rlm_cache_htable_t, num_shards), .dflt = "16" },
+	{ FR_CONF_OFFSET("max_memory", FR_TYPE_SIZE, rlm_cache_htable_t, max_memory), .dflt = "0" },
+	CONF_PARSER_TERMINATOR
+};
+
+/** Return the shard responsible for a hash
+ *
+ */
+static inline rlm_cache_htable_shard_t *htable_shard(rlm_cache_htable_t *driver, uint32_t hash)
+{
+	return &driver->shard[hash & (driver->num_shards - 1)];
+}
+
+/** Return the slot an entry with a given hash should occupy, if there are no collisions
+ *
+ */
+static inline uint32_t htable_slot_ideal(rlm_cache_htable_t *driver, rlm_cache_htable_shard_t *shard, uint32_t hash)
+{
+	return (hash >> driver->shard_bits) & shard->mask;
+}
+
+/** Lock the shard responsible for a hash
+ *
+ * If the handle was previously used with a key from a different shard,
+ * that shard is unlocked first.
+ */
+static rlm_cache_htable_shard_t *htable_lock(rlm_cache_htable_handle_t *handle, uint32_t hash)
+{
+	rlm_cache_htable_shard_t *shard = htable_shard(handle->driver, hash);
+
+	if (handle->shard == shard) return shard;
+
+	if (handle->shard) pthread_mutex_unlock(&handle->shard->mutex);
+	pthread_mutex_lock(&shard->mutex);
+	handle->shard = shard;
+
+	return shard;
+}
+
+/** Find the slot containing an entry
+ *
+ * @note Called with the shard mutex held.
+ *
+ * @return
+ *	- The slot containing the entry.
+ *	- -1 if there's no entry with this key.
+ */
+static int64_t htable_slot_find(rlm_cache_htable_t *driver, rlm_cache_htable_shard_t *shard,
+				uint32_t hash, uint8_t const *key, size_t key_len)
+{
+	uint32_t			i;
+	rlm_cache_htable_entry_t	*c;
+
+	for (i = htable_slot_ideal(driver, shard, hash);
+	     (c = shard->slots[i]);
+	     i = (i + 1) & shard->mask) {
+		if ((c->hash == hash) && (c->fields.key_len == key_len) &&
+		    (memcmp(c->fields.key, key, key_len) == 0)) return i;
+	}
+
+	return -1;
+}
+
+/** Remove the entry in a slot and free it
+ *
+ * Entries later in the same probe sequence are shifted backwards, so
+ * lookups never need to skip over deleted slots.
+ *
+ * @note Called with the shard mutex held.
+ */
+static void htable_slot_free(rlm_cache_htable_t *driver, rlm_cache_htable_shard_t *shard, uint32_t i)
+{
+	rlm_cache_htable_entry_t	*c = shard->slots[i];
+	uint32_t			j, k;
+
+	shard->memory -= c->size;
+	shard->used--;
+	atomic_fetch_sub_explicit(&driver->count, 1, memory_order_relaxed);
+	talloc_free(c);
+
+	for (j = (i + 1) & shard->mask; (c = shard->slots[j]); j = (j + 1) & shard->mask) {
+		k = htable_slot_ideal(driver, shard, c->hash);
+
+		/*
+		 *	Leave the entry where it is if its ideal
+		 *	slot is (cyclically) between the hole
+		 *	and its current position.
+		 */
+		if ((i <= j) ? ((i < k) && (k <= j)) : ((i < k) || (k <= j))) continue;
+
+		shard->slots[i] = c;
+		i = j;
+	}
+	shard->slots[i] = NULL;
+}
+
+/** Double the number of slots in a shard
+ *
+ * @note Called with the shard mutex held.
+ */
+static int htable_grow(rlm_cache_htable_t *driver, rlm_cache_htable_shard_t *shard)
+{
+	rlm_cache_htable_entry_t	**old = shard->slots, *c;
+	uint32_t			old_mask = shard->mask, i, j;
+
+	/*
+	 *	Slots are allocated by multiple threads, so
+	 *	mustn't share a talloc hierarchy.
+	 */
+	shard->slots = talloc_zero_array(NULL, rlm_cache_htable_entry_t *, (old_mask + 1) * 2);
+	if (!shard->slots) {
+		shard->slots = old;
+		return -1;
+	}
+	shard->mask = (old_mask << 1) | 1;
+
+	for (i = 0; i <= old_mask; i++) {
+		c = old[i];
+		if (!c) continue;
+
+		for (j = htable_slot_ideal(driver, shard, c->hash); shard->slots[j]; j = (j + 1) & shard->mask);
+		shard->slots[j] = c;
+	}
+	shard->hand &= old_mask;
+	talloc_free(old);
+
+	return 0;
+}
+
+/** Evict entries until there's enough memory available for a new one
+ *
+ * The CLOCK hand sweeps over the slots.  Expired entries, and entries
+ * which haven't been found since the hand last passed them, are evicted.
+ * Other entries have their reference bit cleared.
+ *
+ * @note Called with the shard mutex held.
+ */
+static void htable_evict(rlm_cache_htable_t *driver, rlm_cache_htable_shard_t *shard,
+			 fr_unix_time_t now, size_t needed)
+{
+	rlm_cache_htable_entry_t *c;
+
+	while (shard->used && ((shard->memory + needed) > shard->max_memory)) {
+		c = shard->slots[shard->hand];
+		if (!c) goto next;
+
+		if (c->fields.expires >= now) {
+			if (c->referenced) {
+				c->referenced = false;
+				goto next;
+			}
+			shard->evicted++;
+		}
+
+		/*
+		 *	Don't advance, another entry may have
+		 *	been shifted into this slot.
+		 */
+		htable_slot_free(driver, shard, shard->hand);
+		continue;
+
+	next:
+		shard->hand = (shard->hand + 1) & shard->mask;
+	}
+}
+
+/** Advance the CLOCK hand a few slots, removing expired entries
+ *
+ * Called on every insert, so expired entries are cleaned up even when
+ * there's no memory limit, or the limit hasn't been reached.
+ *
+ * @note Called with the shard mutex held.
+ */
+static void htable_reap(rlm_cache_htable_t *driver, rlm_cache_htable_shard_t *shard, fr_unix_time_t now)
+{
+	rlm_cache_htable_entry_t	*c;
+	int				i;
+
+	for (i = 0; i < 4; i++) {
+		c = shard->slots[shard->hand];
+		if (c && (c->fields.expires < now)) {
+			htable_slot_free(driver, shard, shard->hand);
+			continue;
+		}
+		shard->hand = (shard->hand + 1) & shard->mask;
+	}
+}
+
+/** Free all entries in the cache
+ *
+ */
+static int mod_detach(void *instance)
+{
+	rlm_cache_htable_t	*driver = talloc_get_type_abort(instance, rlm_cache_htable_t);
+	uint32_t		i, j;
+
+	if (!driver->shard) return 0;
+
+	for (i = 0; i < driver->num_shards; i++) {
+		rlm_cache_htable_shard_t *shard = &driver->shard[i];
+
+		if (!shard->slots) continue;
+
+		for (j = 0; j <= shard->mask; j++) talloc_free(shard->slots[j]);
+		talloc_free(shard->slots);
+
+		pthread_mutex_destroy(&shard->mutex);
+	}
+	TALLOC_FREE(driver->shard);
+
+	return 0;
+}
+
+/** Create a new cache_htable instance
+ *
+ * @param instance	A uint8_t array of inst_size if inst_size > 0, else NULL,
+ *			this should contain the result of parsing the driver's
+ *			CONF_PARSER array that it specified in the interface struct.
+ * @param conf		section holding driver specific #CONF_PAIR (s).
+ * @return
+ *	- 0 on success.
+ *	- -1 on failure.
+ */
+static int mod_instantiate(void *instance, CONF_SECTION *conf)
+{
+	rlm_cache_htable_t	*driver = talloc_get_type_abort(instance, rlm_cache_htable_t);
+	uint32_t		i;
+
+	FR_INTEGER_BOUND_CHECK("shards", driver->num_shards, >=, 1);
+	FR_INTEGER_BOUND_CHECK("shards", driver->num_shards, <=, HTABLE_MAX_SHARDS);
+
+	while (driver->num_shards & (driver->num_shards - 1)) driver->num_shards++;
+	for (driver->shard_bits = 0; (1U << driver->shard_bits) < driver->num_shards; driver->shard_bits++);
+
+	if (driver->max_memory && ((driver->max_memory / driver->num_shards) < 1024)) {
+		cf_log_err(conf, "'max_memory' must be at least 1024 bytes per shard");
+		return -1;
+	}
+
+	driver->shard = talloc_zero_array(driver, rlm_cache_htable_shard_t, driver->num_shards);
+	if (!driver->shard) {
+		ERROR("Failed to create cache");
+		return -1;
+	}
+
+	for (i = 0; i < driver->num_shards; i++) {
+		rlm_cache_htable_shard_t *shard = &driver->shard[i];
+
+		if (pthread_mutex_init(&shard->mutex, NULL) < 0) {
+			ERROR("Failed initializing mutex: %s", fr_syserror(errno));
+			return -1;
+		}
+
+		shard->slots = talloc_zero_array(NULL, rlm_cache_htable_entry_t *, HTABLE_INITIAL_SLOTS);
+		if (!shard->slots) {
+			pthread_mutex_destroy(&shard->mutex);
+			ERROR("Failed to create cache");
+			return -1;
+		}
+		shard->mask = HTABLE_INITIAL_SLOTS - 1;
+		shard->max_memory = driver->max_memory / driver->num_shards;
+	}
+	atomic_init(&driver->count, 0);
+
+	return 0;
+}
+
+/** Custom allocation function for the driver
+ *
+ * Allows allocation of cache entry structures with additional fields.
+ *
+ * @copydetails cache_entry_alloc_t
+ */
+static rlm_cache_entry_t *cache_entry_alloc(UNUSED rlm_cache_config_t const *config, UNUSED void *instance,
+					    REQUEST *request)
+{
+	rlm_cache_htable_entry_t *c;
+
+	c = talloc_zero(NULL, rlm_cache_htable_entry_t);
+	if (!c) {
+		RERROR("Failed allocating cache entry");
+		return NULL;
+	}
+
+	return (rlm_cache_entry_t *)c;
+}
+
+/** Locate a cache entry
+ *
+ * @copydetails cache_entry_find_t
+ */
+static cache_status_t cache_entry_find(rlm_cache_entry_t **out,
+				       UNUSED rlm_cache_config_t const *config, void *instance,
+				       UNUSED REQUEST *request, void *handle, uint8_t const *key, size_t key_len)
+{
+	rlm_cache_htable_t		*driver = talloc_get_type_abort(instance, rlm_cache_htable_t);
+	rlm_cache_htable_shard_t	*shard;
+	rlm_cache_htable_entry_t	*c;
+	uint32_t			hash = fr_hash(key, key_len);
+	int64_t				i;
+
+	shard = htable_lock(handle, hash);
+
+	i = htable_slot_find(driver, shard, hash, key, key_len);
+	if (i < 0) {
+		*out = NULL;
+		return CACHE_MISS;
+	}
+
+	c = shard->slots[i];
+	c->referenced = true;
+	*out = &c->fields;
+
+	return CACHE_OK;
+}
+
+/** Free an entry and remove it from the data store
+ *
+ * @copydetails cache_entry_expire_t
+ */
+static cache_status_t cache_entry_expire(UNUSED rlm_cache_config_t const *config, void *instance,
+					 UNUSED REQUEST *request, void *handle,
+					 uint8_t const *key, size_t key_len)
+{
+	rlm_cache_htable_t		*driver = talloc_get_type_abort(instance, rlm_cache_htable_t);
+	rlm_cache_htable_shard_t	*shard;
+	uint32_t			hash = fr_hash(key, key_len);
+	int64_t				i;
+
+	shard = htable_lock(handle, hash);
+
+	i = htable_slot_find(driver, shard, hash, key, key_len);
+	if (i < 0) return CACHE_MISS;
+
+	htable_slot_free(driver, shard, i);
+
+	return CACHE_OK;
+}
+
+/** Insert a new entry into the data store, replacing any existing entry with the same key
+ *
+ * @copydetails cache_entry_insert_t
+ */
+static cache_status_t cache_entry_insert(UNUSED rlm_cache_config_t const *config, void *instance,
+					 REQUEST *request, void *handle,
+					 rlm_cache_entry_t const *c)
+{
+	rlm_cache_htable_t		*driver = talloc_get_type_abort(instance, rlm_cache_htable_t);
+	rlm_cache_htable_shard_t	*shard;
+	rlm_cache_htable_entry_t	*my_c;
+	fr_unix_time_t			now;
+	int64_t				i;
+	uint32_t			j;
+
+	memcpy(&my_c, &c, sizeof(my_c));
+
+	/*
+	 *	Do the expensive bits outside of the mutex
+	 */
+	my_c->hash = fr_hash(c->key, c->key_len);
+	my_c->size = talloc_total_size(my_c);
+	my_c->referenced = false;
+
+	shard = htable_lock(handle, my_c->hash);
+
+	if (shard->max_memory && (my_c->size > shard->max_memory)) {
+		RWDEBUG("Entry size (%zu bytes) exceeds the memory available to each shard", my_c->size);
+		return CACHE_ERROR;
+	}
+
+	i = htable_slot_find(driver, shard, my_c->hash, c->key, c->key_len);
+	if (i >= 0) {
+		if (shard->slots[i] == my_c) return CACHE_OK;	/* Re-inserting an existing entry */
+		htable_slot_free(driver, shard, i);
+	}
+
+	now = fr_time_to_unix_time(request->packet->timestamp);
+	htable_reap(driver, shard, now);
+	if (shard->max_memory) htable_evict(driver, shard, now, my_c->size);
+
+	/*
+	 *	Keep the load factor below 3/4
+	 */
+	if (((shard->used + 1) * 4) > ((shard->mask + 1) * 3)) {
+		if (htable_grow(driver, shard) < 0) {
+			RERROR("Failed growing cache shard");
+			return CACHE_ERROR;
+		}
+	}
+
+	for (j = htable_slot_ideal(driver, shard, my_c->hash); shard->slots[j]; j = (j + 1) & shard->mask);
+	shard->slots[j] = my_c;
+	shard->used++;
+	shard->memory += my_c->size;
+	atomic_fetch_add_explicit(&driver->count, 1, memory_order_relaxed);
+
+	return CACHE_OK;
+}
+
+/** Update the TTL of an entry
+ *
+ * Entries are only ever expired lazily, so there's nothing to reorder.
+ *
+ * @copydetails cache_entry_set_ttl_t
+ */
+static cache_status_t cache_entry_set_ttl(UNUSED rlm_cache_config_t const *config, UNUSED void *instance,
+					  UNUSED REQUEST *request, UNUSED void *handle,
+					  UNUSED rlm_cache_entry_t *c)
+{
+	return CACHE_OK;
+}
+
+/** Return the number of entries in the cache
+ *
+ * @copydetails cache_entry_count_t
+ */
+static uint32_t cache_entry_count(UNUSED rlm_cache_config_t const *config, void *instance,
+				  UNUSED REQUEST *request, UNUSED void *handle)
+{
+	rlm_cache_htable_t *driver = talloc_get_type_abort(instance, rlm_cache_htable_t);
+
+	return atomic_load_explicit(&driver->count, memory_order_relaxed);
+}
+
+/** Allocate a handle
+ *
+ * The shard is locked when the handle is first used with a key.
+ *
+ * @copydetails cache_acquire_t
+ */
+static int cache_acquire(void **handle, UNUSED rlm_cache_config_t const *config, void *instance,
+			 REQUEST *request)
+{
+	rlm_cache_htable_handle_t *h;
+
+	MEM(h = talloc_zero(request, rlm_cache_htable_handle_t));
+	h->driver = talloc_get_type_abort(instance, rlm_cache_htable_t);
+
+	*handle = h;
+
+	return 0;
+}
+
+/** Release a handle, unlocking the shard it was used with
+ *
+ * @copydetails cache_release_t
+ */
+static void cache_release(UNUSED rlm_cache_config_t const *config, UNUSED void *instance, REQUEST *request,
+			  rlm_cache_handle_t *handle)
+{
+	rlm_cache_htable_handle_t *h = talloc_get_type_abort(handle, rlm_cache_htable_handle_t);
+
+	if (h->shard) {
+		pthread_mutex_unlock(&h->shard->mutex);
+		RDEBUG3("Mutex released");
+	}
+
+	talloc_free(h);
+}
+
+extern rlm_cache_driver_t rlm_cache_htable;
+rlm_cache_driver_t rlm_cache_htable = {
+	.name		= "rlm_cache_htable",
+	.magic		= RLM_MODULE_INIT,
+	.instantiate	= mod_instantiate,
+	.detach		= mod_detach,
+	.inst_size	= sizeof(rlm_cache_htable_t),
+	.config		= driver_config,
+	.alloc		= cache_entry_alloc,
+
+	.find		= cache_entry_find,
+	.insert		= cache_entry_insert,
+	.expire		= cache_entry_expire,
+	.set_ttl	= cache_entry_set_ttl,
+	.count		= cache_entry_count,
+
+	.acquire	= cache_acquire,
+	.release	= cache_release,
+};
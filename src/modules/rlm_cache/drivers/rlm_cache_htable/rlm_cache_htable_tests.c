@@ -0,0 +1,365 @@
+#include <freeradius-devel/util/acutest.h>
+#include <freeradius-devel/util/rand.h>
+#include <pthread.h>
+
+#include "rlm_cache_htable.c"
+
+#define DEBUG_LVL_SET if (test_verbose_level__ >= 3) fr_debug_lvl = L_DBG_LVL_4 + 1
+
+/*
+ *	For comparison
+ */
+extern rlm_cache_driver_t rlm_cache_rbtree;
+
+static rlm_cache_config_t test_config = { .name = "test", .ttl = 60 };
+
+/** Allocate and instantiate a driver with a synthetic config section
+ *
+ * @param[in] ctx		to allocate the instance in.
+ * @param[in] driver		to instantiate.
+ * @param[in] shards		Number of shards, if the driver has them.
+ * @param[in] max_memory	Memory limit, if the driver has one.
+ */
+static void *test_driver_alloc(TALLOC_CTX *ctx, rlm_cache_driver_t const *driver,
+			       char const *shards, char const *max_memory)
+{
+	CONF_SECTION	*cs;
+	CONF_PAIR	*cp;
+	void		*instance;
+
+	MEM(cs = cf_section_alloc(ctx, NULL, "driver", NULL));
+
+#define TEST_PAIR_ADD(_attr, _value) \
+	do { \
+		MEM(cp = cf_pair_alloc(cs, _attr, _value, T_OP_EQ, T_BARE_WORD, T_BARE_WORD)); \
+		cf_pair_add(cs, cp); \
+	} while (0)
+
+	TEST_PAIR_ADD("shards", shards);
+	TEST_PAIR_ADD("max_memory", max_memory);
+
+	MEM(instance = talloc_zero_size(ctx, driver->inst_size));
+	talloc_set_name(instance, "%s_t", driver->name);
+
+	if (driver->config) {
+		TEST_CHECK(cf_section_rules_push(cs, driver->config) == 0);
+		TEST_CHECK(cf_section_parse(instance, instance, cs) == 0);
+	}
+
+	TEST_CHECK(driver->instantiate(instance, cs) == 0);
+
+	return instance;
+}
+
+/** Allocate a request with a packet timestamp, which the drivers use as "now"
+ *
+ */
+static REQUEST *test_request_alloc(TALLOC_CTX *ctx)
+{
+	REQUEST *request;
+
+	request = request_local_alloc(ctx);
+	MEM(request->packet = fr_radius_alloc(request, false));
+	request->packet->timestamp = fr_time();
+
+	return request;
+}
+
+/** Insert an entry with an integer key
+ *
+ */
+static cache_status_t test_insert(rlm_cache_driver_t const *driver, void *instance, REQUEST *request,
+				  void *handle, uint32_t key, fr_time_delta_t ttl)
+{
+	rlm_cache_entry_t	*c;
+	cache_status_t		ret;
+
+	c = driver->alloc(&test_config, instance, request);
+	TEST_CHECK(c != NULL);
+	if (!c) return CACHE_ERROR;
+
+	MEM(c->key = talloc_memdup(c, &key, sizeof(key)));
+	c->key_len = sizeof(key);
+	c->created = fr_time_to_unix_time(request->packet->timestamp);
+	c->expires = c->created + ttl;
+
+	ret = driver->insert(&test_config, instance, request, handle, c);
+	if (ret != CACHE_OK) talloc_free(c);
+
+	return ret;
+}
+
+/** Find an entry with an integer key
+ *
+ */
+static cache_status_t test_find(rlm_cache_entry_t **out, rlm_cache_driver_t const *driver, void *instance,
+				REQUEST *request, void *handle, uint32_t key)
+{
+	return driver->find(out, &test_config, instance, request, handle, (uint8_t const *)&key, sizeof(key));
+}
+
+static void test_insert_find_expire(void)
+{
+	TALLOC_CTX		*ctx;
+	REQUEST			*request;
+	void			*instance, *handle;
+	rlm_cache_entry_t	*c;
+	uint32_t		i, count = 10000;
+
+	DEBUG_LVL_SET;
+
+	ctx = talloc_init("test");
+	request = test_request_alloc(ctx);
+	instance = test_driver_alloc(ctx, &rlm_cache_htable, "16", "0");
+
+	TEST_CASE("Insert entries");
+	for (i = 0; i < count; i++) {
+		rlm_cache_htable.acquire(&handle, &test_config, instance, request);
+		TEST_CHECK(test_insert(&rlm_cache_htable, instance, request, handle, i, fr_time_delta_from_sec(60)) == CACHE_OK);
+		rlm_cache_htable.release(&test_config, instance, request, handle);
+	}
+	TEST_CHECK(rlm_cache_htable.count(&test_config, instance, request, NULL) == count);
+
+	TEST_CASE("Find entries");
+	for (i = 0; i < count; i++) {
+		rlm_cache_htable.acquire(&handle, &test_config, instance, request);
+		TEST_CHECK(test_find(&c, &rlm_cache_htable, instance, request, handle, i) == CACHE_OK);
+		TEST_CHECK(c && (memcmp(c->key, &i, sizeof(i)) == 0));
+		rlm_cache_htable.release(&test_config, instance, request, handle);
+	}
+
+	TEST_CASE("Missing entries aren't found");
+	rlm_cache_htable.acquire(&handle, &test_config, instance, request);
+	TEST_CHECK(test_find(&c, &rlm_cache_htable, instance, request, handle, count) == CACHE_MISS);
+	TEST_CHECK(c == NULL);
+	rlm_cache_htable.release(&test_config, instance, request, handle);
+
+	TEST_CASE("Inserts overwrite existing entries");
+	rlm_cache_htable.acquire(&handle, &test_config, instance, request);
+	TEST_CHECK(test_insert(&rlm_cache_htable, instance, request, handle, 0, fr_time_delta_from_sec(120)) == CACHE_OK);
+	TEST_CHECK(test_find(&c, &rlm_cache_htable, instance, request, handle, 0) == CACHE_OK);
+	TEST_CHECK(c && (c->expires == c->created + fr_time_delta_from_sec(120)));
+	rlm_cache_htable.release(&test_config, instance, request, handle);
+	TEST_CHECK(rlm_cache_htable.count(&test_config, instance, request, NULL) == count);
+
+	TEST_CASE("Expire every other entry");
+	for (i = 0; i < count; i += 2) {
+		rlm_cache_htable.acquire(&handle, &test_config, instance, request);
+		TEST_CHECK(rlm_cache_htable.expire(&test_config, instance, request, handle,
+						   (uint8_t const *)&i, sizeof(i)) == CACHE_OK);
+		rlm_cache_htable.release(&test_config, instance, request, handle);
+	}
+	TEST_CHECK(rlm_cache_htable.count(&test_config, instance, request, NULL) == count / 2);
+
+	TEST_CASE("Remaining entries are still found after removals");
+	for (i = 0; i < count; i++) {
+		rlm_cache_htable.acquire(&handle, &test_config, instance, request);
+		TEST_CHECK(test_find(&c, &rlm_cache_htable, instance, request, handle, i) ==
+			   ((i % 2) ? CACHE_OK : CACHE_MISS));
+		TEST_MSG("Unexpected result for key %u", i);
+		rlm_cache_htable.release(&test_config, instance, request, handle);
+	}
+
+	rlm_cache_htable.detach(instance);
+	talloc_free(ctx);
+}
+
+static void test_reap(void)
+{
+	TALLOC_CTX		*ctx;
+	REQUEST			*request;
+	void			*instance, *handle;
+	uint32_t		i, count = 1000;
+
+	DEBUG_LVL_SET;
+
+	ctx = talloc_init("test");
+	request = test_request_alloc(ctx);
+	instance = test_driver_alloc(ctx, &rlm_cache_htable, "1", "0");
+
+	for (i = 0; i < count; i++) {
+		rlm_cache_htable.acquire(&handle, &test_config, instance, request);
+		TEST_CHECK(test_insert(&rlm_cache_htable, instance, request, handle, i, fr_time_delta_from_sec(1)) == CACHE_OK);
+		rlm_cache_htable.release(&test_config, instance, request, handle);
+	}
+
+	TEST_CASE("Inserts remove expired entries");
+	request->packet->timestamp += fr_time_delta_from_sec(2);
+	for (i = count; i < count * 2; i++) {
+		rlm_cache_htable.acquire(&handle, &test_config, instance, request);
+		TEST_CHECK(test_insert(&rlm_cache_htable, instance, request, handle, i, fr_time_delta_from_sec(60)) == CACHE_OK);
+		rlm_cache_htable.release(&test_config, instance, request, handle);
+	}
+	TEST_CHECK(rlm_cache_htable.count(&test_config, instance, request, NULL) < count * 2);
+	TEST_MSG("Expected expired entries to be removed, have %u entries",
+		 rlm_cache_htable.count(&test_config, instance, request, NULL));
+
+	rlm_cache_htable.detach(instance);
+	talloc_free(ctx);
+}
+
+static void test_evict(void)
+{
+	TALLOC_CTX		*ctx;
+	REQUEST			*request;
+	rlm_cache_htable_t	*driver;
+	void			*instance, *handle;
+	rlm_cache_entry_t	*c;
+	uint32_t		i, count = 10000;
+
+	DEBUG_LVL_SET;
+
+	ctx = talloc_init("test");
+	request = test_request_alloc(ctx);
+	instance = test_driver_alloc(ctx, &rlm_cache_htable, "1", "65536");
+	driver = instance;
+
+	TEST_CASE("Memory used by entries is limited");
+	for (i = 0; i < count; i++) {
+		rlm_cache_htable.acquire(&handle, &test_config, instance, request);
+		TEST_CHECK(test_insert(&rlm_cache_htable, instance, request, handle, i, fr_time_delta_from_sec(60)) == CACHE_OK);
+
+		/*
+		 *	Keep finding the first entry, so it's
+		 *	always referenced when the hand passes.
+		 */
+		TEST_CHECK(test_find(&c, &rlm_cache_htable, instance, request, handle, 0) == CACHE_OK);
+		rlm_cache_htable.release(&test_config, instance, request, handle);
+	}
+	TEST_CHECK(driver->shard[0].memory <= 65536);
+	TEST_CHECK(driver->shard[0].evicted > 0);
+	TEST_CHECK(rlm_cache_htable.count(&test_config, instance, request, NULL) < count);
+
+	TEST_CASE("Referenced entries are kept");
+	rlm_cache_htable.acquire(&handle, &test_config, instance, request);
+	TEST_CHECK(test_find(&c, &rlm_cache_htable, instance, request, handle, 0) == CACHE_OK);
+	rlm_cache_htable.release(&test_config, instance, request, handle);
+
+	rlm_cache_htable.detach(instance);
+	talloc_free(ctx);
+}
+
+typedef struct {
+	rlm_cache_driver_t const	*driver;
+	void				*instance;
+	size_t				cycles;
+	uint32_t			keys;
+	fr_fast_rand_t			rand_ctx;
+	size_t				failed;
+} test_thread_ctx_t;
+
+/** Find random keys, inserting them if they're missing
+ *
+ */
+static void *test_lookup_thread(void *arg)
+{
+	test_thread_ctx_t	*tctx = arg;
+	REQUEST			*request;
+	rlm_cache_entry_t	*c;
+	void			*handle;
+	size_t			i;
+
+	request = test_request_alloc(NULL);
+
+	for (i = 0; i < tctx->cycles; i++) {
+		uint32_t key = fr_fast_rand(&tctx->rand_ctx) % tctx->keys;
+
+		tctx->driver->acquire(&handle, &test_config, tctx->instance, request);
+		switch (test_find(&c, tctx->driver, tctx->instance, request, handle, key)) {
+		case CACHE_OK:
+			break;
+
+		case CACHE_MISS:
+			if (test_insert(tctx->driver, tctx->instance, request, handle, key,
+					fr_time_delta_from_sec(60)) == CACHE_OK) break;
+			FALL_THROUGH;
+
+		default:
+			tctx->failed++;
+			break;
+		}
+		tctx->driver->release(&test_config, tctx->instance, request, handle);
+	}
+
+	talloc_free(request);
+
+	return NULL;
+}
+
+static void test_contention(rlm_cache_driver_t const *driver, size_t threads)
+{
+	TALLOC_CTX		*ctx;
+	REQUEST			*request;
+	void			*instance;
+	size_t			i, cycles = 100000;
+	pthread_t		*tid;
+	test_thread_ctx_t	*tctx;
+	fr_time_t		start, stop;
+	fr_time_delta_t		elapsed;
+
+	DEBUG_LVL_SET;
+
+	ctx = talloc_init("test");
+	request = test_request_alloc(ctx);
+	instance = test_driver_alloc(ctx, driver, "16", "0");
+
+	MEM(tid = talloc_array(ctx, pthread_t, threads));
+	MEM(tctx = talloc_array(ctx, test_thread_ctx_t, threads));
+
+	start = fr_time();
+	for (i = 0; i < threads; i++) {
+		tctx[i] = (test_thread_ctx_t){
+			.driver = driver,
+			.instance = instance,
+			.cycles = cycles,
+			.keys = 4096,
+			.rand_ctx = { .a = i, .b = i + 1 }
+		};
+		TEST_CHECK(pthread_create(&tid[i], NULL, test_lookup_thread, &tctx[i]) == 0);
+	}
+	for (i = 0; i < threads; i++) {
+		pthread_join(tid[i], NULL);
+		TEST_CHECK(tctx[i].failed == 0);
+		TEST_MSG("Thread %zu had %zu failures", i, tctx[i].failed);
+	}
+	stop = fr_time();
+	elapsed = stop - start;
+
+	TEST_CHECK(driver->count(&test_config, instance, request, NULL) <= 4096);
+
+	if (test_verbose_level__ >= 1) {
+		INFO("%s, %zu threads: %pV (%u ops/s)",
+		     driver->name, threads, fr_box_time_delta(elapsed),
+		     (uint32_t)((threads * cycles) / ((float)elapsed / NSEC)));
+	}
+
+	driver->detach(instance);
+	talloc_free(ctx);
+}
+
+static void test_contention_rbtree_1(void)	{ test_contention(&rlm_cache_rbtree, 1); }
+static void test_contention_rbtree_8(void)	{ test_contention(&rlm_cache_rbtree, 8); }
+static void test_contention_rbtree_32(void)	{ test_contention(&rlm_cache_rbtree, 32); }
+static void test_contention_htable_1(void)	{ test_contention(&rlm_cache_htable, 1); }
+static void test_contention_htable_8(void)	{ test_contention(&rlm_cache_htable, 8); }
+static void test_contention_htable_32(void)	{ test_contention(&rlm_cache_htable, 32); }
+
+TEST_LIST = {
+	/*
+	 *	Basic tests
+	 */
+	{ "Basic - Insert, find, expire",			test_insert_find_expire },
+	{ "Basic - Expired entries are removed",		test_reap },
+	{ "Basic - Eviction",					test_evict },
+
+	/*
+	 *	Performance tests
+	 */
+	{ "Speed Test - rbtree, 1 thread",			test_contention_rbtree_1 },
+	{ "Speed Test - rbtree, 8 threads",			test_contention_rbtree_8 },
+	{ "Speed Test - rbtree, 32 threads",			test_contention_rbtree_32 },
+	{ "Speed Test - htable, 1 thread",			test_contention_htable_1 },
+	{ "Speed Test - htable, 8 threads",			test_contention_htable_8 },
+	{ "Speed Test - htable, 32 threads",			test_contention_htable_32 },
+	{ NULL }
+};
@@ -0,0 +1,12 @@
+TARGET		:= rlm_cache_htable_tests
+
+SOURCES		:= rlm_cache_htable_tests.c ../rlm_cache_rbtree/rlm_cache_rbtree.c
+
+TGT_LDLIBS	:= $(LIBS)
+TGT_LDFLAGS	:= $(LDFLAGS)
+
+ifneq ($(OPENSSL_LIBS),)
+TGT_PREREQS	:= libfreeradius-tls.a
+endif
+
+TGT_PREREQS	+= libfreeradius-util.a libfreeradius-server.a libfreeradius-unlang.a
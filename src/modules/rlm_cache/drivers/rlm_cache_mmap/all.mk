@@ -0,0 +1,4 @@
+TARGET		:= rlm_cache_mmap.a
+SOURCES		:= rlm_cache_mmap.c
+TGT_LDLIBS	:= $(LIBS)
+TGT_PREREQS	:= libfreeradius-internal.a libfreeradius-util.a
@@ -0,0 +1,862 @@
+/*
+ *   This program is is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or (at
+ *   your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ */
+
+/**
+ * $Id$
+ * @file rlm_cache_mmap.c
+ * @brief Persistent cache, stored in a memory mapped file.
+ *
+ * The file is a fixed size array of slots, grouped into sets.  An entry's
+ * key hash selects a set, and the entry may occupy any slot in that set.
+ * When a set is full, expired entries are replaced first, then the entry
+ * closest to expiring.
+ *
+ * Entries are serialised with the internal protocol encoder, so the file
+ * survives restarts, and may be shared by multiple processes on the same
+ * host.  Sets are protected by process shared mutexes stored in the file.
+ *
+ * @copyright 2020 The FreeRADIUS server project
+ */
+#include <freeradius-devel/server/base.h>
+#include <freeradius-devel/util/debug.h>
+#include <freeradius-devel/util/hash.h>
+#include <freeradius-devel/util/net.h>
+#include <freeradius-devel/internal/internal.h>
+#include "../../rlm_cache.h"
+
+#ifdef HAVE_STDATOMIC_H
+#  include <stdatomic.h>
+#else
+#  include <freeradius-devel/util/stdatomic.h>
+#endif
+#include <stdalign.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#ifndef F_OFD_SETLK
+#  include <sys/file.h>
+#endif
+
+#define MMAP_MAGIC		0x66726d63	//!< "frmc"
+
+/** Version of the file format
+ *
+ * Must be incremented whenever the layout of the file, or the
+ * serialisation format of entries changes.
+ */
+#define MMAP_VERSION		1
+
+#define MMAP_SET_WAYS		8		//!< Slots in each set.
+#define MMAP_MAX_LOCKS		256		//!< Maximum number of mutexes, each protects a range of sets.
+#define MMAP_RECORD_HDR_LEN	7		//!< request, list, op, tag, dict name length, value length (2).
+
+/** Header at the start of the file
+ *
+ * Used to check the file was created with the same settings.
+ */
+typedef struct {
+	uint32_t		magic;		//!< Always #MMAP_MAGIC.
+	uint32_t		version;	//!< Always #MMAP_VERSION.
+	uint64_t		file_size;	//!< Length of the file.
+	uint32_t		slot_size;	//!< Length of each slot, including its header.
+	uint32_t		num_sets;	//!< Number of sets.  A power of two.
+	uint32_t		num_locks;	//!< Number of mutexes.  A power of two.
+
+	atomic_uint_fast32_t	count;		//!< Number of entries in the file.
+} rlm_cache_mmap_header_t;
+
+typedef struct {
+	alignas(128) pthread_mutex_t	mutex;	//!< Process shared mutex, protecting a range of sets.
+} rlm_cache_mmap_lock_t;
+
+/** A slot in the file, containing a single entry
+ *
+ */
+typedef struct {
+	uint32_t		hash;		//!< Hash of the entry's key.  0 if the slot is empty.
+	uint32_t		key_len;	//!< Length of the key.
+	uint32_t		data_len;	//!< Length of the serialised maps.
+	uint32_t		pad;
+	uint64_t		hits;		//!< How many times the entry has been retrieved.
+	fr_unix_time_t		created;	//!< When the entry was created.
+	fr_unix_time_t		expires;	//!< When the entry expires.
+	uint8_t			data[];		//!< Key, followed by the serialised maps.
+} rlm_cache_mmap_slot_t;
+
+typedef struct {
+	char const		*filename;	//!< Cache file.
+	size_t			size;		//!< Maximum size of the cache file.
+	size_t			slot_size;	//!< Maximum size of an entry.
+
+	int			fd;		//!< Cache file, holding a shared lock.
+	uint8_t			*base;		//!< Start of the mapping.
+	size_t			mapped;		//!< Length of the mapping.
+
+	rlm_cache_mmap_header_t	*header;	//!< Header at the start of the mapping.
+	rlm_cache_mmap_lock_t	*locks;		//!< Array of mutexes.
+	uint8_t			*slots;		//!< Start of the slot array.
+
+	uint32_t		num_sets;	//!< Number of sets.
+	uint32_t		num_locks;	//!< Number of mutexes.
+} rlm_cache_mmap_t;
+
+static const CONF_PARSER driver_config[] = {
+	{ FR_CONF_OFFSET("filename", FR_TYPE_FILE_OUTPUT | FR_TYPE_REQUIRED, rlm_cache_mmap_t, filename) },
+	{ FR_CONF_OFFSET("size", FR_TYPE_SIZE, rlm_cache_mmap_t, size), .dflt = "16M" },
+	{ FR_CONF_OFFSET("slot_size", FR_TYPE_SIZE, rlm_cache_mmap_t, slot_size), .dflt = "1024" },
+	CONF_PARSER_TERMINATOR
+};
+
+/** Hash a key, reserving 0 to mark empty slots
+ *
+ */
+static inline uint32_t mmap_hash(uint8_t const *key, size_t key_len)
+{
+	uint32_t hash = fr_hash(key, key_len);
+
+	return hash ? hash : 1;
+}
+
+/** Return a slot in the set responsible for a hash
+ *
+ */
+static inline rlm_cache_mmap_slot_t *mmap_slot(rlm_cache_mmap_t *driver, uint32_t hash, unsigned int way)
+{
+	size_t set = hash & (driver->num_sets - 1);
+
+	return (rlm_cache_mmap_slot_t *)(driver->slots + (((set * MMAP_SET_WAYS) + way) * driver->slot_size));
+}
+
+/** Lock the set responsible for a hash
+ *
+ * @return
+ *	- The mutex that was locked.
+ *	- NULL on error.
+ */
+static pthread_mutex_t *mmap_lock(rlm_cache_mmap_t *driver, REQUEST *request, uint32_t hash)
+{
+	pthread_mutex_t	*mutex = &driver->locks[hash & (driver->num_locks - 1)].mutex;
+	int		ret;
+
+	ret = pthread_mutex_lock(mutex);
+#ifdef HAVE_PTHREAD_MUTEXATTR_SETROBUST
+	/*
+	 *	Another process died holding the mutex.  Slots
+	 *	are only marked as used once they've been written,
+	 *	so the sets it protects are still consistent.
+	 */
+	if (ret == EOWNERDEAD) {
+		RWDEBUG("Recovering mutex from process which exited while holding it");
+		ret = pthread_mutex_consistent(mutex);
+	}
+#endif
+	if (ret != 0) {
+		RERROR("Failed locking cache: %s", fr_syserror(ret));
+		return NULL;
+	}
+
+	return mutex;
+}
+
+/** Find the slot containing an entry
+ *
+ * @note Called with the set locked.
+ */
+static rlm_cache_mmap_slot_t *mmap_slot_find(rlm_cache_mmap_t *driver, uint32_t hash,
+					     uint8_t const *key, size_t key_len)
+{
+	rlm_cache_mmap_slot_t	*slot;
+	unsigned int		i;
+
+	for (i = 0; i < MMAP_SET_WAYS; i++) {
+		slot = mmap_slot(driver, hash, i);
+		if ((slot->hash == hash) && (slot->key_len == key_len) &&
+		    (memcmp(slot->data, key, key_len) == 0)) return slot;
+	}
+
+	return NULL;
+}
+
+/** Choose the slot a new entry should be written to
+ *
+ * In order of preference, this is the slot containing an entry with
+ * the same key, an empty slot, a slot containing an expired entry,
+ * or the slot containing the entry closest to expiring.
+ *
+ * @note Called with the set locked.
+ */
+static rlm_cache_mmap_slot_t *mmap_slot_victim(rlm_cache_mmap_t *driver, uint32_t hash,
+					       uint8_t const *key, size_t key_len)
+{
+	rlm_cache_mmap_slot_t	*slot, *empty = NULL, *oldest = NULL;
+	unsigned int		i;
+
+	for (i = 0; i < MMAP_SET_WAYS; i++) {
+		slot = mmap_slot(driver, hash, i);
+
+		if (!slot->hash) {
+			if (!empty) empty = slot;
+			continue;
+		}
+
+		if ((slot->hash == hash) && (slot->key_len == key_len) &&
+		    (memcmp(slot->data, key, key_len) == 0)) return slot;
+
+		if (!oldest || (slot->expires < oldest->expires)) oldest = slot;
+	}
+
+	return empty ? empty : oldest;
+}
+
+/** Mark a slot as empty
+ *
+ * @note Called with the set locked.
+ */
+static void mmap_slot_clear(rlm_cache_mmap_t *driver, rlm_cache_mmap_slot_t *slot)
+{
+	slot->hash = 0;
+	atomic_fetch_sub_explicit(&driver->header->count, 1, memory_order_relaxed);
+}
+
+/** Serialise the maps in a cache entry
+ *
+ * Each map is written as a record, containing the request, list, operator
+ * and tag of the LHS, the name of the dictionary the attribute belongs to,
+ * and the attribute encoded with the internal encoder.
+ *
+ * @return
+ *	- The number of bytes written.
+ *	- -1 if the maps don't fit in outlen bytes, or couldn't be encoded.
+ */
+static ssize_t mmap_entry_serialize(uint8_t *out, size_t outlen, REQUEST *request, rlm_cache_entry_t const *c)
+{
+	uint8_t		*p = out, *end = out + outlen;
+	vp_map_t	*map;
+	TALLOC_CTX	*pool;
+
+	MEM(pool = talloc_pool(NULL, 1024));
+
+	for (map = c->maps; map; map = map->next) {
+		fr_dict_attr_t const	*da = tmpl_da(map->lhs);
+		char const		*dict_name = fr_dict_root(fr_dict_by_da(da))->name;
+		size_t			name_len = strlen(dict_name);
+		VALUE_PAIR		*vp;
+		fr_cursor_t		cursor;
+		ssize_t			slen;
+
+		if ((size_t)(end - p) <= (MMAP_RECORD_HDR_LEN + name_len)) {
+		too_large:
+			RWDEBUG("Entry is too large for slot_size (%zu bytes)",
+				outlen + sizeof(rlm_cache_mmap_slot_t) + c->key_len);
+			talloc_free(pool);
+			return -1;
+		}
+
+		MEM(vp = fr_pair_afrom_da(pool, da));
+		if (fr_value_box_copy(vp, &vp->data, tmpl_value(map->rhs)) < 0) {
+			RPERROR("Failed copying value of %s", da->name);
+			talloc_free(pool);
+			return -1;
+		}
+
+		p[0] = tmpl_request(map->lhs);
+		p[1] = tmpl_list(map->lhs);
+		p[2] = map->op;
+		p[3] = (uint8_t)tmpl_tag(map->lhs);
+		p[4] = name_len;
+		memcpy(p + 5, dict_name, name_len);
+		p += 5 + name_len;
+
+		/*
+		 *	The encoder fails if there's not enough
+		 *	room left in the slot.
+		 */
+		fr_cursor_init(&cursor, &vp);
+		slen = fr_internal_encode_pair(p + 2, end - (p + 2), &cursor, NULL);
+		if ((slen <= 0) || (slen > UINT16_MAX)) goto too_large;
+
+		fr_net_from_uint16(p, slen);
+		p += 2 + slen;
+
+		talloc_free_children(pool);
+	}
+	talloc_free(pool);
+
+	return p - out;
+}
+
+/** Convert serialised records back into maps
+ *
+ * @return
+ *	- 0 on success.
+ *	- -1 on failure.
+ */
+static int mmap_entry_deserialize(rlm_cache_entry_t *c, uint8_t const *in, size_t inlen)
+{
+	uint8_t const	*p = in, *end = in + inlen;
+	vp_map_t	**last = &c->maps;
+
+	while (p < end) {
+		fr_dict_t const	*dict;
+		char		name[UINT8_MAX + 1];
+		VALUE_PAIR	*vps = NULL;
+		fr_cursor_t	cursor;
+		vp_map_t	*map;
+		uint16_t	len;
+		ssize_t		slen;
+
+		if ((size_t)(end - p) < MMAP_RECORD_HDR_LEN) {
+		truncated:
+			fr_strerror_printf("Serialised entry truncated");
+			return -1;
+		}
+
+		if ((p[0] >= REQUEST_UNKNOWN) || (p[1] >= PAIR_LIST_UNKNOWN) || (p[2] >= T_TOKEN_LAST)) {
+			fr_strerror_printf("Invalid record header");
+			return -1;
+		}
+
+		if ((size_t)(end - p) < (MMAP_RECORD_HDR_LEN + p[4])) goto truncated;
+		memcpy(name, p + 5, p[4]);
+		name[p[4]] = '\0';
+
+		len = fr_net_to_uint16(p + 5 + p[4]);
+		if ((size_t)(end - p) < (MMAP_RECORD_HDR_LEN + p[4] + len)) goto truncated;
+
+		dict = fr_dict_by_protocol_name(name);
+		if (!dict) {
+			fr_strerror_printf("Unknown dictionary \"%s\"", name);
+			return -1;
+		}
+
+		fr_cursor_init(&cursor, &vps);
+		slen = fr_internal_decode_pair(c, &cursor, dict, p + MMAP_RECORD_HDR_LEN + p[4], len, NULL);
+		if ((slen != (ssize_t)len) || !vps) {
+			fr_strerror_printf_push("Failed decoding attribute");
+			fr_pair_list_free(&vps);
+			return -1;
+		}
+		vps->tag = (int8_t)p[3];
+
+		if (map_afrom_vp(c, &map, vps, &(vp_tmpl_rules_t){ .request_def = p[0], .list_def = p[1] }) < 0) {
+			fr_pair_list_free(&vps);
+			return -1;
+		}
+		fr_pair_list_free(&vps);
+
+		map->op = p[2];
+		*last = map;
+		last = &map->next;
+
+		p += MMAP_RECORD_HDR_LEN + p[4] + len;
+	}
+
+	return 0;
+}
+
+/** Lock, or unlock the cache file
+ *
+ * The lock belongs to the open file description, not the process.
+ * Each instance using the file holds its own lock, and closing a
+ * descriptor for the same file elsewhere in the process doesn't
+ * release it.  Process-owned fcntl locks don't work that way.
+ *
+ * Without OFD locks we use flock(), which has the same semantics,
+ * but may briefly drop the lock when converting it.
+ *
+ * @param[in] fd	of the cache file.
+ * @param[in] type	F_RDLCK, F_WRLCK, or F_UNLCK.
+ * @param[in] wait	for a conflicting lock to be released.
+ * @return
+ *	- 0 on success.
+ *	- -1 on failure, or if the lock is held elsewhere and wait is false.
+ */
+static int mmap_file_lock(int fd, short type, bool wait)
+{
+#ifdef F_OFD_SETLK
+	struct flock fl = {
+		.l_type = type,
+		.l_whence = SEEK_SET,
+		.l_start = 0,
+		.l_len = 0,
+		.l_pid = 0		/* Must be zero for OFD locks */
+	};
+
+	return fcntl(fd, wait ? F_OFD_SETLKW : F_OFD_SETLK, &fl);
+#else
+	int operation;
+
+	switch (type) {
+	case F_WRLCK:
+		operation = LOCK_EX;
+		break;
+
+	case F_RDLCK:
+		operation = LOCK_SH;
+		break;
+
+	default:
+		operation = LOCK_UN;
+		break;
+	}
+
+	if (!wait) operation |= LOCK_NB;
+
+	return flock(fd, operation);
+#endif
+}
+
+/** Initialise the mutexes in the cache file
+ *
+ * @note Must only be called when no other process has the file mapped.
+ */
+static int mmap_locks_init(rlm_cache_mmap_t *driver)
+{
+	pthread_mutexattr_t	attr;
+	uint32_t		i;
+	int			ret;
+
+	pthread_mutexattr_init(&attr);
+	ret = pthread_mutexattr_setpshared(&attr, PTHREAD_PROCESS_SHARED);
+#ifdef HAVE_PTHREAD_MUTEXATTR_SETROBUST
+	if (ret == 0) ret = pthread_mutexattr_setrobust(&attr, PTHREAD_MUTEX_ROBUST);
+#endif
+	if (ret != 0) {
+	error:
+		ERROR("Failed initializing mutex: %s", fr_syserror(ret));
+		pthread_mutexattr_destroy(&attr);
+		return -1;
+	}
+
+	for (i = 0; i < driver->num_locks; i++) {
+		ret = pthread_mutex_init(&driver->locks[i].mutex, &attr);
+		if (ret != 0) goto error;
+	}
+	pthread_mutexattr_destroy(&attr);
+
+	return 0;
+}
+
+/** Unmap and close the cache file
+ *
+ * Entries remain in the file for the next process to use it.
+ */
+static int mod_detach(void *instance)
+{
+	rlm_cache_mmap_t *driver = talloc_get_type_abort(instance, rlm_cache_mmap_t);
+
+	if (!driver->base) return 0;
+
+	munmap(driver->base, driver->mapped);
+	driver->base = NULL;
+	close(driver->fd);		/* Releases our lock */
+
+	return 0;
+}
+
+/** Create a new cache_mmap instance
+ *
+ * If no other process has the cache file open, the file is (re)formatted
+ * if it doesn't match our configuration, and its mutexes are reinitialised,
+ * as they may have been held by a process which no longer exists.
+ *
+ * If another process has the file open, its configuration must match ours.
+ *
+ * @param instance	A uint8_t array of inst_size if inst_size > 0, else NULL,
+ *			this should contain the result of parsing the driver's
+ *			CONF_PARSER array that it specified in the interface struct.
+ * @param conf		section holding driver specific #CONF_PAIR (s).
+ * @return
+ *	- 0 on success.
+ *	- -1 on failure.
+ */
+static int mod_instantiate(void *instance, CONF_SECTION *conf)
+{
+	rlm_cache_mmap_t	*driver = talloc_get_type_abort(instance, rlm_cache_mmap_t);
+	rlm_cache_mmap_header_t	hdr;
+	size_t			slots_offset;
+	struct stat		st;
+	bool			exclusive, valid;
+	uint32_t		i;
+	int			fd;
+	void			*base;
+
+	FR_SIZE_BOUND_CHECK("slot_size", driver->slot_size, >=, (size_t)128);
+	FR_SIZE_BOUND_CHECK("slot_size", driver->slot_size, <=, (size_t)65536);
+	driver->slot_size = ROUND_UP(driver->slot_size, 64);
+
+	/*
+	 *	Work out how many sets fit in the file.
+	 */
+	slots_offset = ROUND_UP(sizeof(rlm_cache_mmap_header_t), 128) + (sizeof(rlm_cache_mmap_lock_t) * MMAP_MAX_LOCKS);
+	if (driver->size < (slots_offset + (driver->slot_size * MMAP_SET_WAYS))) {
+		cf_log_err(conf, "'size' must be at least %zu bytes", slots_offset + (driver->slot_size * MMAP_SET_WAYS));
+		return -1;
+	}
+
+	driver->num_sets = 1;
+	while ((slots_offset + ((size_t)driver->num_sets * 2 * MMAP_SET_WAYS * driver->slot_size)) <= driver->size) {
+		if (driver->num_sets == (UINT32_C(1) << 31)) break;
+		driver->num_sets *= 2;
+	}
+	driver->num_locks = driver->num_sets < MMAP_MAX_LOCKS ? driver->num_sets : MMAP_MAX_LOCKS;
+
+	memset(&hdr, 0, sizeof(hdr));
+	hdr.magic = MMAP_MAGIC;
+	hdr.version = MMAP_VERSION;
+	hdr.file_size = slots_offset + ((size_t)driver->num_sets * MMAP_SET_WAYS * driver->slot_size);
+	hdr.slot_size = driver->slot_size;
+	hdr.num_sets = driver->num_sets;
+	hdr.num_locks = driver->num_locks;
+
+	fd = open(driver->filename, O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+	if (fd < 0) {
+		ERROR("Failed opening \"%s\": %s", driver->filename, fr_syserror(errno));
+		return -1;
+	}
+
+	/*
+	 *	Every process using the file holds a shared lock.
+	 *	If we can get an exclusive lock, no one else is
+	 *	using it.
+	 */
+	exclusive = (mmap_file_lock(fd, F_WRLCK, false) == 0);
+	if (!exclusive && (mmap_file_lock(fd, F_RDLCK, true) < 0)) {
+		ERROR("Failed locking \"%s\": %s", driver->filename, fr_syserror(errno));
+	error:
+		close(fd);
+		return -1;
+	}
+
+	if (fstat(fd, &st) < 0) {
+		ERROR("Failed getting size of \"%s\": %s", driver->filename, fr_syserror(errno));
+		goto error;
+	}
+
+	/*
+	 *	Check the file was created with the same settings.
+	 */
+	{
+		rlm_cache_mmap_header_t	file_hdr;
+
+		valid = ((size_t)st.st_size == hdr.file_size) &&
+			(pread(fd, &file_hdr, sizeof(file_hdr), 0) == sizeof(file_hdr)) &&
+			(file_hdr.magic == hdr.magic) && (file_hdr.version == hdr.version) &&
+			(file_hdr.file_size == hdr.file_size) && (file_hdr.slot_size == hdr.slot_size) &&
+			(file_hdr.num_sets == hdr.num_sets) && (file_hdr.num_locks == hdr.num_locks);
+	}
+
+	if (!valid) {
+		if (!exclusive) {
+			ERROR("\"%s\" is in use by another process, with a different 'size' or 'slot_size'",
+			      driver->filename);
+			goto error;
+		}
+
+		if (st.st_size > 0) WARN("Discarding entries in \"%s\", it was created with different settings",
+					 driver->filename);
+
+		/*
+		 *	Truncating first ensures the whole file is zeroed.
+		 */
+		if ((ftruncate(fd, 0) < 0) || (ftruncate(fd, hdr.file_size) < 0)) {
+			ERROR("Failed resizing \"%s\": %s", driver->filename, fr_syserror(errno));
+			goto error;
+		}
+	}
+
+	base = mmap(NULL, hdr.file_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	if (base == MAP_FAILED) {
+		ERROR("Failed mapping \"%s\": %s", driver->filename, fr_syserror(errno));
+		goto error;
+	}
+
+	driver->base = base;
+	driver->mapped = hdr.file_size;
+	driver->header = base;
+	driver->locks = (rlm_cache_mmap_lock_t *)(driver->base + ROUND_UP(sizeof(rlm_cache_mmap_header_t), 128));
+	driver->slots = driver->base + slots_offset;
+	driver->fd = fd;
+
+	if (exclusive) {
+		uint32_t count = 0;
+
+		if (mmap_locks_init(driver) < 0) {
+		unmap:
+			munmap(driver->base, driver->mapped);
+			driver->base = NULL;
+			goto error;
+		}
+
+		if (!valid) {
+			memcpy(driver->header, &hdr, offsetof(rlm_cache_mmap_header_t, count));
+		/*
+		 *	A process may have exited without updating the
+		 *	count, so recalculate it.
+		 */
+		} else for (i = 0; i < driver->num_sets; i++) {
+			unsigned int j;
+
+			for (j = 0; j < MMAP_SET_WAYS; j++) if (mmap_slot(driver, i, j)->hash) count++;
+		}
+		atomic_init(&driver->header->count, count);
+
+		DEBUG("Cache file \"%s\" contains %u entries", driver->filename, count);
+
+		/*
+		 *	Let other processes in.  Converting an OFD
+		 *	lock is atomic.
+		 */
+		if (mmap_file_lock(fd, F_RDLCK, true) < 0) {
+			ERROR("Failed locking \"%s\": %s", driver->filename, fr_syserror(errno));
+			goto unmap;
+		}
+	}
+
+	return 0;
+}
+
+/** Locate a cache entry, and deserialise it
+ *
+ * @copydetails cache_entry_find_t
+ */
+static cache_status_t cache_entry_find(rlm_cache_entry_t **out,
+				       UNUSED rlm_cache_config_t const *config, void *instance,
+				       REQUEST *request, UNUSED void *handle, uint8_t const *key, size_t key_len)
+{
+	rlm_cache_mmap_t	*driver = talloc_get_type_abort(instance, rlm_cache_mmap_t);
+	rlm_cache_mmap_slot_t	*slot;
+	rlm_cache_entry_t	*c;
+	pthread_mutex_t		*mutex;
+	uint32_t		hash = mmap_hash(key, key_len);
+	uint8_t			*data;
+	size_t			data_len;
+
+	*out = NULL;
+
+	mutex = mmap_lock(driver, request, hash);
+	if (!mutex) return CACHE_ERROR;
+
+	slot = mmap_slot_find(driver, hash, key, key_len);
+	if (!slot) {
+		pthread_mutex_unlock(mutex);
+		return CACHE_MISS;
+	}
+
+	if ((sizeof(rlm_cache_mmap_slot_t) + key_len + slot->data_len) > driver->slot_size) {
+		RWDEBUG("Discarding entry with invalid length");
+		mmap_slot_clear(driver, slot);
+		pthread_mutex_unlock(mutex);
+		return CACHE_MISS;
+	}
+
+	/*
+	 *	Copy the entry out, and deserialise it after
+	 *	releasing the mutex.
+	 */
+	MEM(c = talloc_zero(NULL, rlm_cache_entry_t));
+	c->created = slot->created;
+	c->expires = slot->expires;
+	c->hits = slot->hits++;
+	data_len = slot->data_len;
+	MEM(data = talloc_memdup(c, slot->data + key_len, data_len));
+	pthread_mutex_unlock(mutex);
+
+	c->key = talloc_memdup(c, key, key_len);
+	c->key_len = key_len;
+
+	if (mmap_entry_deserialize(c, data, data_len) < 0) {
+		RPWDEBUG("Discarding invalid entry");
+		talloc_free(c);
+
+		mutex = mmap_lock(driver, request, hash);
+		if (!mutex) return CACHE_ERROR;
+
+		slot = mmap_slot_find(driver, hash, key, key_len);
+		if (slot) mmap_slot_clear(driver, slot);
+		pthread_mutex_unlock(mutex);
+
+		return CACHE_MISS;
+	}
+	talloc_free(data);
+
+	*out = c;
+
+	return CACHE_OK;
+}
+
+/** Free an entry which was deserialised from the file
+ *
+ * @copydetails cache_entry_free_t
+ */
+static void cache_entry_free(rlm_cache_entry_t *c)
+{
+	talloc_free(c);
+}
+
+/** Serialise an entry, and write it to a slot, replacing any existing entry with the same key
+ *
+ * @copydetails cache_entry_insert_t
+ */
+static cache_status_t cache_entry_insert(UNUSED rlm_cache_config_t const *config, void *instance,
+					 REQUEST *request, UNUSED void *handle,
+					 rlm_cache_entry_t const *c)
+{
+	rlm_cache_mmap_t	*driver = talloc_get_type_abort(instance, rlm_cache_mmap_t);
+	rlm_cache_mmap_slot_t	*slot;
+	pthread_mutex_t		*mutex;
+	uint32_t		hash = mmap_hash(c->key, c->key_len);
+	uint8_t			*data;
+	size_t			outlen;
+	ssize_t			slen;
+
+	if ((sizeof(rlm_cache_mmap_slot_t) + c->key_len) >= driver->slot_size) {
+		RWDEBUG("Key is too large for slot_size (%zu bytes)", driver->slot_size);
+		return CACHE_ERROR;
+	}
+	outlen = driver->slot_size - (sizeof(rlm_cache_mmap_slot_t) + c->key_len);
+
+	/*
+	 *	Do the expensive bits outside of the mutex
+	 */
+	MEM(data = talloc_array(request, uint8_t, outlen));
+	slen = mmap_entry_serialize(data, outlen, request, c);
+	if (slen < 0) {
+		talloc_free(data);
+		return CACHE_ERROR;
+	}
+
+	mutex = mmap_lock(driver, request, hash);
+	if (!mutex) {
+		talloc_free(data);
+		return CACHE_ERROR;
+	}
+
+	slot = mmap_slot_victim(driver, hash, c->key, c->key_len);
+	if (!slot->hash) {
+		atomic_fetch_add_explicit(&driver->header->count, 1, memory_order_relaxed);
+	} else if (slot->hash != hash) {
+		RDEBUG3("Evicting entry to make space");
+	}
+
+	/*
+	 *	Mark the slot as empty until it's been completely
+	 *	written, in case we die part way through.
+	 */
+	slot->hash = 0;
+	atomic_thread_fence(memory_order_release);
+
+	slot->key_len = c->key_len;
+	slot->data_len = slen;
+	slot->hits = 0;
+	slot->created = c->created;
+	slot->expires = c->expires;
+	memcpy(slot->data, c->key, c->key_len);
+	memcpy(slot->data + c->key_len, data, slen);
+
+	atomic_thread_fence(memory_order_release);
+	slot->hash = hash;
+
+	pthread_mutex_unlock(mutex);
+	talloc_free(data);
+
+	return CACHE_OK;
+}
+
+/** Remove an entry from the file
+ *
+ * @copydetails cache_entry_expire_t
+ */
+static cache_status_t cache_entry_expire(UNUSED rlm_cache_config_t const *config, void *instance,
+					 REQUEST *request, UNUSED void *handle,
+					 uint8_t const *key, size_t key_len)
+{
+	rlm_cache_mmap_t	*driver = talloc_get_type_abort(instance, rlm_cache_mmap_t);
+	rlm_cache_mmap_slot_t	*slot;
+	pthread_mutex_t		*mutex;
+	uint32_t		hash = mmap_hash(key, key_len);
+
+	mutex = mmap_lock(driver, request, hash);
+	if (!mutex) return CACHE_ERROR;
+
+	slot = mmap_slot_find(driver, hash, key, key_len);
+	if (!slot) {
+		pthread_mutex_unlock(mutex);
+		return CACHE_MISS;
+	}
+	mmap_slot_clear(driver, slot);
+	pthread_mutex_unlock(mutex);
+
+	return CACHE_OK;
+}
+
+/** Update the TTL of an entry
+ *
+ * If another process removed the entry after it was found, it's
+ * written again.
+ *
+ * @copydetails cache_entry_set_ttl_t
+ */
+static cache_status_t cache_entry_set_ttl(rlm_cache_config_t const *config, void *instance,
+					  REQUEST *request, void *handle,
+					  rlm_cache_entry_t *c)
+{
+	rlm_cache_mmap_t	*driver = talloc_get_type_abort(instance, rlm_cache_mmap_t);
+	rlm_cache_mmap_slot_t	*slot;
+	pthread_mutex_t		*mutex;
+	uint32_t		hash = mmap_hash(c->key, c->key_len);
+
+	mutex = mmap_lock(driver, request, hash);
+	if (!mutex) return CACHE_ERROR;
+
+	slot = mmap_slot_find(driver, hash, c->key, c->key_len);
+	if (slot) slot->expires = c->expires;
+	pthread_mutex_unlock(mutex);
+
+	if (!slot) return cache_entry_insert(config, instance, request, handle, c);
+
+	return CACHE_OK;
+}
+
+/** Return the number of entries in the file
+ *
+ * @copydetails cache_entry_count_t
+ */
+static uint32_t cache_entry_count(UNUSED rlm_cache_config_t const *config, void *instance,
+				  UNUSED REQUEST *request, UNUSED void *handle)
+{
+	rlm_cache_mmap_t *driver = talloc_get_type_abort(instance, rlm_cache_mmap_t);
+
+	return atomic_load_explicit(&driver->header->count, memory_order_relaxed);
+}
+
+extern rlm_cache_driver_t rlm_cache_mmap;
+rlm_cache_driver_t rlm_cache_mmap = {
+	.name		= "rlm_cache_mmap",
+	.magic		= RLM_MODULE_INIT,
+	.instantiate	= mod_instantiate,
+	.detach		= mod_detach,
+	.inst_size	= sizeof(rlm_cache_mmap_t),
+	.config		= driver_config,
+
+	.free		= cache_entry_free,
+
+	.find		= cache_entry_find,
+	.insert		= cache_entry_insert,
+	.expire		= cache_entry_expire,
+	.set_ttl	= cache_entry_set_ttl,
+	.count		= cache_entry_count,
+};
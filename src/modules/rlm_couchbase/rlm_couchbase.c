@@ -569,7 +569,7 @@ extern module_t rlm_couchbase;
 module_t rlm_couchbase = {
 	.magic		= RLM_MODULE_INIT,
 	.name		= "couchbase",
-	.type		= RLM_TYPE_THREAD_SAFE,
+	.type		= RLM_TYPE_THREAD_SAFE | RLM_TYPE_BLOCKING,
 	.inst_size	= sizeof(rlm_couchbase_t),
 	.config		= module_config,
 	.bootstrap	= mod_bootstrap,
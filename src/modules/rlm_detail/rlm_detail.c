@@ -29,6 +29,7 @@ RCSID("$Id$")
 #include <freeradius-devel/server/base.h>
 #include <freeradius-devel/server/module.h>
 #include <freeradius-devel/util/debug.h>
+#include <freeradius-devel/server/detail.h>
 #include <freeradius-devel/server/exfile.h>
 
 #include <ctype.h>
@@ -60,12 +61,16 @@ typedef struct {
 
 	bool		log_srcdst;	//!< Add IP src/dst attributes to entries.
 
+	bool		binary;		//!< Write binary records instead of text.
+
 	bool		escape;		//!< do filename escaping, yes / no
 
 	xlat_escape_t	escape_func; //!< escape function
 
 	exfile_t    	*ef;		//!< Log file handler
 
+	exfile_buffer_conf_t buffer;	//!< Buffered write configuration.
+
 	fr_hash_table_t *ht;		//!< Holds suppressed attributes.
 } rlm_detail_t;
 
@@ -77,6 +82,8 @@ static const CONF_PARSER module_config[] = {
 	{ FR_CONF_OFFSET("locking", FR_TYPE_BOOL, rlm_detail_t, locking), .dflt = "no" },
 	{ FR_CONF_OFFSET("escape_filenames", FR_TYPE_BOOL, rlm_detail_t, escape), .dflt = "no" },
 	{ FR_CONF_OFFSET("log_packet_header", FR_TYPE_BOOL, rlm_detail_t, log_srcdst), .dflt = "no" },
+	{ FR_CONF_OFFSET("binary", FR_TYPE_BOOL, rlm_detail_t, binary), .dflt = "no" },
+	{ FR_CONF_OFFSET("buffer", FR_TYPE_SUBSECTION, rlm_detail_t, buffer), .subcs = (void const *) exfile_buffer_config },
 	CONF_PARSER_TERMINATOR
 };
 
@@ -166,6 +173,29 @@ static int mod_instantiate(void *instance, CONF_SECTION *conf)
 		return -1;
 	}
 
+	if (exfile_buffer_enable(inst->ef, &inst->buffer) < 0) {
+		cf_log_perr(conf, "Failed enabling buffered writes");
+		return -1;
+	}
+
+	/*
+	 *	The group is set by exfile when it opens the file,
+	 *	including files created by the flush thread.
+	 */
+	if (inst->group) {
+		gid_t	gid;
+		char	*endptr;
+
+		gid = strtol(inst->group, &endptr, 10);
+		if (*endptr != '\0') {
+			if (rad_getgid(inst, &gid, inst->group) < 0) {
+				cf_log_err(conf, "Unable to find system group \"%s\"", inst->group);
+				return -1;
+			}
+		}
+		exfile_set_group(inst->ef, gid);
+	}
+
 	/*
 	 *	Suppress certain attributes.
 	 */
@@ -377,6 +407,206 @@ static int detail_write(FILE *out, rlm_detail_t const *inst, REQUEST *request, R
 	return 0;
 }
 
+/*
+ *	Resume after a durable write has been flushed.
+ */
+static rlm_rcode_t detail_flushed(UNUSED void *instance, UNUSED void *thread, REQUEST *request, void *rctx)
+{
+	if (exfile_wait_result(rctx) < 0) {
+		RPERROR("Failed writing detail entry");
+		return RLM_MODULE_FAIL;
+	}
+
+	return RLM_MODULE_OK;
+}
+
+/*
+ *	Append data written to the detail entry buffer.
+ */
+static ssize_t _detail_buffer_write(void *cookie, char const *data, size_t len)
+{
+	char	**entry = cookie;
+	char	*n;
+
+	n = talloc_bstr_append(NULL, *entry, data, len);
+	if (!n) return -1;
+	*entry = n;
+
+	return len;
+}
+
+/*
+ *	Format a detail entry in memory, and hand it to
+ *	the exfile buffer.
+ */
+static rlm_rcode_t detail_do_buffered(rlm_detail_t const *inst, REQUEST *request, char const *filename,
+				      RADIUS_PACKET *packet, bool compat)
+{
+	char			*entry;
+	FILE			*outfp;
+	struct iovec		vector;
+	cookie_io_functions_t	io;
+	exfile_wait_t		*wait;
+	int			ret;
+
+	MEM(entry = talloc_zero_array(request, char, 1));
+
+	/*
+	 *	These must be set separately as they have different prototypes.
+	 */
+	io.read = NULL;
+	io.seek = NULL;
+	io.close = NULL;
+	io.write = _detail_buffer_write;
+
+	outfp = fopencookie(&entry, "w", io);
+	if (!outfp) {
+		RERROR("Failed creating detail entry buffer");
+		talloc_free(entry);
+		return RLM_MODULE_FAIL;
+	}
+
+	ret = detail_write(outfp, inst, request, packet, compat);
+	if (fclose(outfp) != 0) ret = -1;
+	if (ret < 0) {
+		talloc_free(entry);
+		return RLM_MODULE_FAIL;
+	}
+
+	vector.iov_base = entry;
+	vector.iov_len = talloc_array_length(entry) - 1;
+
+	ret = exfile_writev(inst->ef, request, filename, inst->perm, &vector, 1, &wait);
+	talloc_free(entry);
+	if (ret < 0) {
+		RPERROR("Failed writing to %s", filename);
+		return RLM_MODULE_FAIL;
+	}
+
+	if (ret > 0) return exfile_wait_yield(request, wait, detail_flushed);
+
+	return RLM_MODULE_OK;
+}
+
+/*
+ *	Add a pair to a binary detail record, skipping any which
+ *	can't be encoded.
+ */
+static void detail_binary_add(REQUEST *request, fr_detail_binary_t *record, VALUE_PAIR *vp)
+{
+	if (fr_detail_binary_add(record, vp) < 0) RPWDEBUG("Skipping attribute");
+}
+
+/** Write a single binary detail record
+ *
+ * Contains the same attributes as the text entry written by
+ * detail_write(), but encoded with the internal protocol.  The
+ * header and "Timestamp" are replaced with fields in the record.
+ *
+ * @param[in] inst Instance of rlm_detail.
+ * @param[in] request The current request.
+ * @param[in] filename to write the record to.
+ * @param[in] packet associated with the request (request, reply...).
+ * @param[in] compat Write out entry in compatibility mode.
+ */
+static rlm_rcode_t detail_do_binary(rlm_detail_t const *inst, REQUEST *request, char const *filename,
+				    RADIUS_PACKET *packet, bool compat)
+{
+	fr_detail_binary_t	record;
+	struct iovec		vector;
+	VALUE_PAIR		*vp, stacked;
+	fr_cursor_t		cursor;
+	exfile_wait_t		*wait;
+	int			ret;
+
+	if (!packet->vps) {
+		RWDEBUG("Skipping empty packet");
+		return RLM_MODULE_OK;
+	}
+
+	if (fr_detail_binary_init(request, &record, request->dict, packet->code,
+				  fr_time_to_unix_time(request->packet->timestamp)) < 0) {
+		RPERROR("Failed creating detail record");
+		return RLM_MODULE_FAIL;
+	}
+
+	/*
+	 *	Stacked pairs are encoded directly, so we don't
+	 *	need to allocate them.
+	 */
+	memset(&stacked, 0, sizeof(stacked));
+	stacked.op = T_OP_EQ;
+	vp = &stacked;
+
+	if (!compat) {
+		stacked.da = attr_packet_type;
+		fr_value_box_shallow(&stacked.data, (uint32_t) packet->code, true);
+		detail_binary_add(request, &record, vp);
+	}
+
+	if (inst->log_srcdst) {
+		switch (packet->src_ipaddr.af) {
+		case AF_INET:
+			stacked.da = attr_packet_src_ipv4_address;
+			fr_value_box_shallow(&stacked.data, &packet->src_ipaddr, true);
+			detail_binary_add(request, &record, vp);
+
+			stacked.da = attr_packet_dst_ipv4_address;
+			fr_value_box_shallow(&stacked.data, &packet->dst_ipaddr, true);
+			detail_binary_add(request, &record, vp);
+			break;
+
+		case AF_INET6:
+			stacked.da = attr_packet_src_ipv6_address;
+			fr_value_box_shallow(&stacked.data, &packet->src_ipaddr, true);
+			detail_binary_add(request, &record, vp);
+
+			stacked.da = attr_packet_dst_ipv6_address;
+			fr_value_box_shallow(&stacked.data, &packet->dst_ipaddr, true);
+			detail_binary_add(request, &record, vp);
+			break;
+
+		default:
+			break;
+		}
+
+		stacked.da = attr_packet_src_port;
+		fr_value_box_shallow(&stacked.data, packet->src_port, true);
+		detail_binary_add(request, &record, vp);
+
+		stacked.da = attr_packet_dst_port;
+		fr_value_box_shallow(&stacked.data, packet->dst_port, true);
+		detail_binary_add(request, &record, vp);
+	}
+
+	for (vp = fr_cursor_init(&cursor, &packet->vps);
+	     vp;
+	     vp = fr_cursor_next(&cursor)) {
+		if (inst->ht && fr_hash_table_finddata(inst->ht, vp->da)) continue;
+
+		/*
+		 *	Don't write passwords in old format...
+		 */
+		if (compat && (vp->da == attr_user_password)) continue;
+
+		detail_binary_add(request, &record, vp);
+	}
+
+	vector.iov_base = record.tb.buff;
+	vector.iov_len = fr_detail_binary_finish(&record);
+
+	ret = exfile_writev(inst->ef, request, filename, inst->perm, &vector, 1, &wait);
+	talloc_free(record.tb.buff);
+	if (ret < 0) {
+		RPERROR("Failed writing to %s", filename);
+		return RLM_MODULE_FAIL;
+	}
+
+	if (ret > 0) return exfile_wait_yield(request, wait, detail_flushed);
+
+	return RLM_MODULE_OK;
+}
+
 /*
  *	Do detail, compatible with old accounting
  */
@@ -388,11 +618,6 @@ static rlm_rcode_t CC_HINT(nonnull) detail_do(void const *instance, REQUEST *req
 
 	FILE		*outfp;
 
-#ifdef HAVE_GRP_H
-	gid_t		gid;
-	char		*endptr;
-#endif
-
 	rlm_detail_t const *inst = instance;
 
 	/*
@@ -406,6 +631,14 @@ static rlm_rcode_t CC_HINT(nonnull) detail_do(void const *instance, REQUEST *req
 
 	RDEBUG2("%s expands to %s", inst->filename, buffer);
 
+	if (inst->binary) return detail_do_binary(inst, request, buffer, packet, compat);
+
+	/*
+	 *	The entry is written out later, together with
+	 *	entries from other requests.
+	 */
+	if (inst->buffer.enabled) return detail_do_buffered(inst, request, buffer, packet, compat);
+
 	outfd = exfile_open(inst->ef, request, buffer, inst->perm);
 	if (outfd < 0) {
 		RPERROR("Couldn't open file %s", buffer);
@@ -413,21 +646,6 @@ static rlm_rcode_t CC_HINT(nonnull) detail_do(void const *instance, REQUEST *req
 		return RLM_MODULE_FAIL;
 	}
 
-	if (inst->group != NULL) {
-		gid = strtol(inst->group, &endptr, 10);
-		if (*endptr != '\0') {
-			if (rad_getgid(request, &gid, inst->group) < 0) {
-				RDEBUG2("Unable to find system group '%s'", inst->group);
-				goto skip_group;
-			}
-		}
-
-		if (chown(buffer, -1, gid) == -1) {
-			RDEBUG2("Unable to change system group of '%s'", buffer);
-		}
-	}
-
-skip_group:
 	outfp = NULL;
 	dupfd = dup(outfd);
 	if (dupfd < 0) {
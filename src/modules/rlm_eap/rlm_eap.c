@@ -35,6 +35,7 @@ RCSID("$Id$")
 #include <freeradius-devel/protocol/freeradius/freeradius.internal.h>
 #include <freeradius-devel/unlang/interpret.h>
 #include <freeradius-devel/unlang/module.h>
+#include <freeradius-devel/util/net.h>
 #include "rlm_eap.h"
 
 extern module_t rlm_eap;
@@ -973,6 +974,127 @@ static rlm_rcode_t mod_post_auth(void *instance, UNUSED void *thread, REQUEST *r
 	return RLM_MODULE_UPDATED;
 }
 
+/** Serialise a frozen eap_session_t so another server can continue the session
+ *
+ * The format is:
+ @verbatim
+   instance name length (1) | instance name | type (1) | rounds (4) |
+   identity length (4) | identity | method data
+ @endverbatim
+ *
+ * Only methods which provide a freeze callback can be serialised.  TLS based
+ * methods and sessions with tunnelled children are never serialised.
+ */
+static ssize_t eap_session_state_freeze(uint8_t **out, TALLOC_CTX *ctx, void const *opaque)
+{
+	eap_session_t const		*eap_session = talloc_get_type_abort_const(opaque, eap_session_t);
+	rlm_eap_t const			*inst = eap_session->inst;
+	rlm_eap_submodule_t const	*submodule;
+	fr_talloc_buff_t		tb;
+	uint8_t				*method = NULL;
+	ssize_t				method_len;
+	size_t				identity_len;
+
+	if (!inst || eap_session->tls || eap_session->child || (eap_session->type >= FR_EAP_METHOD_MAX)) return 0;
+
+	submodule = inst->methods[eap_session->type].submodule;
+	if (!submodule || !submodule->freeze || !submodule->thaw) return 0;
+
+	/*
+	 *	Instance names longer than this can't be encoded,
+	 *	so the session just isn't portable.
+	 */
+	if (strlen(inst->name) > UINT8_MAX) return 0;
+
+	method_len = submodule->freeze(&method, NULL, eap_session);
+	if (method_len <= 0) return method_len;
+
+	identity_len = eap_session->identity ? talloc_array_length(eap_session->identity) - 1 : 0;
+
+	if (talloc_buff_init(ctx, &tb, 64 + identity_len + method_len) < 0) {
+	error:
+		talloc_free(method);
+		return -1;
+	}
+
+	if ((talloc_buff_append_len8(&tb, inst->name, strlen(inst->name)) < 0) ||
+	    (talloc_buff_append_uint8(&tb, eap_session->type) < 0) ||
+	    (talloc_buff_append_uint32(&tb, eap_session->rounds) < 0) ||
+	    (talloc_buff_append_len32(&tb, eap_session->identity, identity_len) < 0) ||
+	    (talloc_buff_append(&tb, method, method_len) < 0)) {
+		talloc_free(tb.buff);
+		goto error;
+	}
+	talloc_free(method);
+
+	*out = tb.buff;
+
+	return tb.used;
+}
+
+/** Recreate a frozen eap_session_t serialised by #eap_session_state_freeze
+ *
+ */
+static void *eap_session_state_thaw(TALLOC_CTX *ctx, uint8_t const *in, size_t inlen)
+{
+	uint8_t const			*p = in, *end = in + inlen;
+	char				name[UINT8_MAX + 1];
+	size_t				name_len;
+	uint32_t			identity_len;
+	module_instance_t		*mi;
+	rlm_eap_t const			*inst;
+	rlm_eap_submodule_t const	*submodule;
+	eap_session_t			*eap_session;
+	eap_type_t			type;
+
+	if (inlen < 1) {
+	truncated:
+		fr_strerror_printf("Serialised EAP session truncated");
+		return NULL;
+	}
+	name_len = *p++;
+	if ((size_t)(end - p) < (name_len + 1 + sizeof(uint32_t) + sizeof(uint32_t))) goto truncated;
+	memcpy(name, p, name_len);
+	name[name_len] = '\0';
+	p += name_len;
+
+	mi = module_by_name(NULL, name);
+	if (!mi || (strcmp(mi->module->name, "eap") != 0)) {
+		fr_strerror_printf("No EAP module \"%s\" to continue session with", name);
+		return NULL;
+	}
+	inst = talloc_get_type_abort_const(mi->dl_inst->data, rlm_eap_t);
+
+	type = *p++;
+	if ((type >= FR_EAP_METHOD_MAX) || !(submodule = inst->methods[type].submodule) || !submodule->thaw) {
+		fr_strerror_printf("EAP module \"%s\" can't continue %s sessions", name, eap_type2name(type));
+		return NULL;
+	}
+
+	eap_session = eap_session_restore_alloc(ctx);
+	eap_session->inst = inst;
+	eap_session->type = type;
+	eap_session->rounds = fr_net_to_uint32(p);
+	p += sizeof(uint32_t);
+
+	identity_len = fr_net_to_uint32(p);
+	p += sizeof(uint32_t);
+	if ((size_t)(end - p) < identity_len) {
+		talloc_free(eap_session);
+		goto truncated;
+	}
+	eap_session->identity = talloc_bstrndup(eap_session, (char const *)p, identity_len);
+	p += identity_len;
+
+	if (submodule->thaw(eap_session, p, end - p) < 0) {
+		fr_strerror_printf_push("Failed restoring %s session data", eap_type2name(type));
+		talloc_free(eap_session);
+		return NULL;
+	}
+
+	return eap_session;
+}
+
 static int mod_instantiate(void *instance, UNUSED CONF_SECTION *cs)
 {
 	rlm_eap_t	*inst = talloc_get_type_abort(instance, rlm_eap_t);
@@ -1066,11 +1188,25 @@ static int mod_load(void)
 		PERROR("Failed initialising EAP base library");
 		return -1;
 	}
+
+	/*
+	 *	Allow EAP sessions to be stored in external
+	 *	state backends.  The session is always added
+	 *	with a NULL unique_ptr, see eap_session_continue.
+	 */
+	if (fr_state_data_serializer_register("eap_session", NULL, REQUEST_DATA_EAP_SESSION, "eap_session_t",
+					      eap_session_state_freeze, eap_session_state_thaw) < 0) {
+		PERROR("Failed registering EAP session serialiser");
+		eap_base_free();
+		return -1;
+	}
+
 	return 0;
 }
 
 static void mod_unload(void)
 {
+	fr_state_data_serializer_unregister("eap_session");
 	eap_base_free();
 }
 
@@ -448,6 +448,8 @@ error:
 }
 
 
+static rlm_rcode_t mod_handshake_resume(void *instance, void *thread, REQUEST *request, void *rctx);
+
 /*
  *	Do authentication, by letting EAP-TLS do most of the work.
  */
@@ -489,6 +491,13 @@ static rlm_rcode_t mod_process(void *instance, UNUSED void *thread, REQUEST *req
 		fr_assert(tls_session->opaque != NULL);
 		break;
 
+	/*
+	 *	Waiting for the private key offload pool,
+	 *	continue the handshake when it's done.
+	 */
+	case EAP_TLS_YIELD:
+		return eap_tls_yield(request, eap_session, mod_handshake_resume);
+
 	/*
 	 *	The TLS code is still working on the TLS
 	 *	exchange, and it's a valid TLS request.
@@ -560,6 +569,14 @@ static rlm_rcode_t mod_process(void *instance, UNUSED void *thread, REQUEST *req
 	return RLM_MODULE_FAIL;
 }
 
+/** Continue the handshake once a private key operation has completed
+ *
+ */
+static rlm_rcode_t mod_handshake_resume(void *instance, void *thread, REQUEST *request, UNUSED void *rctx)
+{
+	return mod_process(instance, thread, request);
+}
+
 /*
  *	Send an initial eap-tls request to the peer, using the libeap functions.
  */
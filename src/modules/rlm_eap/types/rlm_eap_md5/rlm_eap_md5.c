@@ -164,6 +164,35 @@ static rlm_rcode_t mod_session_init(UNUSED void *instance, UNUSED void *thread,
 	return RLM_MODULE_HANDLED;
 }
 
+/*
+ *	The only session data is the challenge we sent.
+ */
+static ssize_t mod_session_freeze(uint8_t **out, TALLOC_CTX *ctx, eap_session_t const *eap_session)
+{
+	size_t len;
+
+	if (!eap_session->opaque) return 0;
+
+	len = talloc_array_length((uint8_t const *)eap_session->opaque);
+	MEM(*out = talloc_memdup(ctx, eap_session->opaque, len));
+
+	return len;
+}
+
+static int mod_session_thaw(eap_session_t *eap_session, uint8_t const *in, size_t inlen)
+{
+	if (inlen != MD5_CHALLENGE_LEN) {
+		fr_strerror_printf("Invalid EAP-MD5 challenge length, expected %d bytes, got %zu bytes",
+				   MD5_CHALLENGE_LEN, inlen);
+		return -1;
+	}
+
+	MEM(eap_session->opaque = talloc_memdup(eap_session, in, inlen));
+	eap_session->process = mod_process;
+
+	return 0;
+}
+
 /*
  *	The module name should be the only globally exported symbol.
  *	That is, everything else should be 'static'.
@@ -175,5 +204,7 @@ rlm_eap_submodule_t rlm_eap_md5 = {
 	.provides	= { FR_EAP_METHOD_MD5 },
 	.magic		= RLM_MODULE_INIT,
 	.session_init	= mod_session_init,	/* Initialise a new EAP session */
-	.entry_point	= mod_process		/* Process next round of EAP method */
+	.entry_point	= mod_process,		/* Process next round of EAP method */
+	.freeze		= mod_session_freeze,	/* Serialise the challenge */
+	.thaw		= mod_session_thaw	/* Restore the challenge */
 };
@@ -86,6 +86,13 @@ static int eap_peap_success(REQUEST *request, eap_session_t *eap_session, fr_tls
 	tlv_packet[9] = 0;
 	tlv_packet[10] = EAP_TLV_SUCCESS;
 
+	/*
+	 *	Phase2 has succeeded (or was skipped because the
+	 *	session was resumed), so the ticket can go out
+	 *	with the success TLV.
+	 */
+	fr_tls_ticket_issue(request, tls_session);
+
 	(tls_session->record_from_buff)(&tls_session->clean_in, tlv_packet, 11);
 
 	/*
@@ -121,6 +121,8 @@ static peap_tunnel_t *peap_alloc(TALLOC_CTX *ctx, rlm_eap_peap_t *inst)
 	return t;
 }
 
+static rlm_rcode_t mod_handshake_resume(void *instance, void *thread, REQUEST *request, void *rctx);
+
 /*
  *	Do authentication, by letting EAP-TLS do most of the work.
  */
@@ -165,6 +167,13 @@ static rlm_rcode_t mod_process(void *instance, UNUSED void *thread, REQUEST *req
 		peap->status = PEAP_STATUS_TUNNEL_ESTABLISHED;
 		break;
 
+	/*
+	 *	Waiting for the private key offload pool,
+	 *	continue the handshake when it's done.
+	 */
+	case EAP_TLS_YIELD:
+		return eap_tls_yield(request, eap_session, mod_handshake_resume);
+
 	/*
 	 *	The TLS code is still working on the TLS
 	 *	exchange, and it's a valid TLS request.
@@ -247,6 +256,14 @@ static rlm_rcode_t mod_process(void *instance, UNUSED void *thread, REQUEST *req
 	return rcode;
 }
 
+/** Continue the handshake once a private key operation has completed
+ *
+ */
+static rlm_rcode_t mod_handshake_resume(void *instance, void *thread, REQUEST *request, UNUSED void *rctx)
+{
+	return mod_process(instance, thread, request);
+}
+
 /*
  *	Send an initial eap-tls request to the peer, using the libeap functions.
  */
@@ -275,6 +292,11 @@ static rlm_rcode_t mod_session_init(void *instance, UNUSED void *thread, REQUEST
 	eap_session->opaque = eap_tls_session = eap_tls_session_init(request, eap_session, inst->tls_conf, client_cert);
 	if (!eap_tls_session) return RLM_MODULE_FAIL;
 
+	/*
+	 *	Tickets are only issued once phase2 has succeeded.
+	 */
+	eap_tls_session->tls_session->allow_session_ticket = true;
+
 	/*
 	 *	As it is a poorly designed protocol, PEAP uses
 	 *	bits in the TLS header to indicate PEAP
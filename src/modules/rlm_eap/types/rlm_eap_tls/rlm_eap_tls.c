@@ -119,6 +119,25 @@ static rlm_rcode_t eap_tls_success_with_prf(REQUEST *request, eap_session_t *eap
 	return RLM_MODULE_OK;
 }
 
+/** The client certificate has been accepted
+ *
+ * Send a session ticket if we can, otherwise send the EAP-Success now.
+ */
+static rlm_rcode_t eap_tls_authorised(REQUEST *request, eap_session_t *eap_session)
+{
+	switch (eap_tls_ticket(request, eap_session)) {
+	case 1:
+		return RLM_MODULE_HANDLED;
+
+	case 0:
+		return eap_tls_success_with_prf(request, eap_session);
+
+	default:
+		eap_tls_fail(request, eap_session);
+		return RLM_MODULE_FAIL;
+	}
+}
+
 static unlang_action_t eap_tls_virtual_server_result(REQUEST *request, rlm_rcode_t *presult,
 						     UNUSED int *priority, void *uctx)
 {
@@ -127,7 +146,7 @@ static unlang_action_t eap_tls_virtual_server_result(REQUEST *request, rlm_rcode
 	switch (*presult) {
 	case RLM_MODULE_OK:
 	case RLM_MODULE_UPDATED:
-		*presult = eap_tls_success_with_prf(request, eap_session);
+		*presult = eap_tls_authorised(request, eap_session);
 		break;
 
 	default:
@@ -189,6 +208,8 @@ static rlm_rcode_t eap_tls_virtual_server(rlm_eap_tls_t *inst, REQUEST *request,
 	return RLM_MODULE_YIELD;
 }
 
+static rlm_rcode_t mod_handshake_resume(void *instance, void *thread, REQUEST *request, void *rctx);
+
 static rlm_rcode_t mod_process(void *instance, UNUSED void *thread, REQUEST *request)
 {
 	eap_tls_status_t	status;
@@ -214,10 +235,23 @@ static rlm_rcode_t mod_process(void *instance, UNUSED void *thread, REQUEST *req
 	 *	it accepts the certificates, too.
 	 */
 	case EAP_TLS_ESTABLISHED:
+		/*
+		 *	The peer has ACKed the session ticket, the
+		 *	certificate was accepted before it was sent.
+		 */
+		if (eap_tls_session->ticket_sent) return eap_tls_success_with_prf(request, eap_session);
+
 		if (inst->virtual_server) return eap_tls_virtual_server(inst, request, eap_session);
-		return eap_tls_success_with_prf(request, eap_session);
+		return eap_tls_authorised(request, eap_session);
 
 
+	/*
+	 *	Waiting for the private key offload pool,
+	 *	continue the handshake when it's done.
+	 */
+	case EAP_TLS_YIELD:
+		return eap_tls_yield(request, eap_session, mod_handshake_resume);
+
 	/*
 	 *	The TLS code is still working on the TLS
 	 *	exchange, and it's a valid TLS request.
@@ -249,6 +283,14 @@ static rlm_rcode_t mod_process(void *instance, UNUSED void *thread, REQUEST *req
 	}
 }
 
+/** Continue the handshake once a private key operation has completed
+ *
+ */
+static rlm_rcode_t mod_handshake_resume(void *instance, void *thread, REQUEST *request, UNUSED void *rctx)
+{
+	return mod_process(instance, thread, request);
+}
+
 /*
  *	Send an initial eap-tls request to the peer, using the libeap functions.
  */
@@ -282,6 +324,12 @@ static rlm_rcode_t mod_session_init(void *instance, UNUSED void *thread, REQUEST
 
 	eap_tls_session->include_length = inst->include_length;
 
+	/*
+	 *	A ticket is sent once the certificate has been
+	 *	accepted, see eap_tls_authorised().
+	 */
+	eap_tls_session->tls_session->allow_session_ticket = true;
+
 	/*
 	 *	TLS session initialization is over.  Now handle TLS
 	 *	related handshaking or application data.
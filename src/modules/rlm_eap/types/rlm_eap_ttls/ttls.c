@@ -523,6 +523,12 @@ static rlm_rcode_t CC_HINT(nonnull) process_reply(NDEBUG_UNUSED eap_session_t *e
 				fr_cursor_prepend(&to_tunnel, fr_pair_copy(tls_session, vp));
 			}
 		}
+
+		/*
+		 *	The ticket goes out with the tunneled reply,
+		 *	which is the last data we send in the tunnel.
+		 */
+		if (t->authenticated) fr_tls_ticket_issue(request, tls_session);
 	}
 		break;
 
@@ -499,7 +499,7 @@ module_t rlm_krb5 = {
 	.magic		= RLM_MODULE_INIT,
 	.name		= "krb5",
 #ifdef KRB5_IS_THREAD_SAFE
-	.type		= RLM_TYPE_THREAD_SAFE,
+	.type		= RLM_TYPE_THREAD_SAFE | RLM_TYPE_BLOCKING,
 #endif
 	.inst_size	= sizeof(rlm_krb5_t),
 	.config		= module_config,
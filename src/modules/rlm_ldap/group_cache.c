@@ -0,0 +1,412 @@
+/*
+ *   This program is is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or (at
+ *   your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ */
+
+/**
+ * $Id$
+ * @file group_cache.c
+ * @brief Cache the results of dynamic group membership checks.
+ *
+ * @copyright 2020 The FreeRADIUS Server Project.
+ */
+RCSID("$Id$")
+
+USES_APPLE_DEPRECATED_API
+
+#include <freeradius-devel/util/debug.h>
+#include <freeradius-devel/util/hash.h>
+#include <ctype.h>
+
+#define LOG_PREFIX "rlm_ldap (%s) - "
+#define LOG_PREFIX_ARGS inst->name
+
+#include "rlm_ldap.h"
+
+/** Number of independently locked shards in a group cache
+ *
+ * Must be a power of two.
+ */
+#ifndef LDAP_GROUP_CACHE_SHARDS
+#  define LDAP_GROUP_CACHE_SHARDS	16
+#endif
+
+/** Result of checking whether a user is a member of a group
+ *
+ */
+typedef struct {
+	uint8_t const		*key;				//!< Normalised user DN and group name or DN,
+								///< separated by a '\0'.
+	size_t			key_len;			//!< Length of the key.
+
+	bool			member;				//!< Whether the user was a member of the group.
+	fr_time_t		expires;			//!< When this entry should no longer be used.
+
+	fr_dlist_t		lru;				//!< Entry in the shard's LRU list.
+} ldap_group_cache_entry_t;
+
+/** An independently locked slice of the group cache
+ *
+ * Entries are assigned to a shard by hashing their key, so workers
+ * checking membership for different users rarely contend with each other.
+ */
+typedef struct {
+	pthread_mutex_t		mutex;				//!< Synchronisation mutex for this shard.
+	rbtree_t		*tree;				//!< Entries, keyed by user DN and group.
+	fr_dlist_head_t		lru;				//!< Entries ordered by last use, most recent first.
+	uint32_t		max_entries;			//!< Maximum number of entries in this shard.
+
+	uint64_t		hits;				//!< Lookups which found a valid entry.
+	uint64_t		misses;				//!< Lookups which didn't.
+	uint64_t		expired;			//!< Entries removed because their TTL passed.
+	uint64_t		evicted;			//!< Entries removed to make space for new ones.
+
+	uint8_t			pad[128];			//!< Separates the counters above from the next
+								///< shard's mutex.  talloc_zero_array() doesn't
+								///< honour alignas(), so the gap is explicit.
+} ldap_group_cache_shard_t;
+
+struct rlm_ldap_group_cache_s {
+	fr_time_delta_t		ttl;				//!< How long positive results are cached for.
+	fr_time_delta_t		negative_ttl;			//!< How long negative results are cached for.
+
+	uint32_t		num_shards;			//!< Number of shards, always a power of two.
+	ldap_group_cache_shard_t *shard;			//!< Array of shards.
+};
+
+/** Compare two group cache entries by key
+ *
+ */
+static int ldap_group_cache_entry_cmp(void const *one, void const *two)
+{
+	ldap_group_cache_entry_t const *a = one, *b = two;
+	int ret;
+
+	ret = (a->key_len > b->key_len) - (a->key_len < b->key_len);
+	if (ret != 0) return ret;
+
+	return memcmp(a->key, b->key, a->key_len);
+}
+
+/** Build the key for a user DN and group
+ *
+ * DNs are compared case insensitively, so are lowercased.  Group names
+ * are compared case sensitively elsewhere in the module, so are left alone.
+ *
+ * @param[out] out	Where to write the key.
+ * @param[in] outlen	Size of out.
+ * @param[in] user_dn	Normalised DN of the user object.
+ * @param[in] check	vp containing the group value (name or DN).
+ * @return
+ *	- The length of the key.
+ *	- 0 if the key wouldn't fit in out.
+ */
+static size_t ldap_group_cache_key(uint8_t *out, size_t outlen, char const *user_dn, VALUE_PAIR const *check)
+{
+	size_t		dn_len = strlen(user_dn), i;
+	uint8_t		*p = out;
+	bool		check_is_dn;
+
+	if ((dn_len + 1 + check->vp_length) > outlen) return 0;
+
+	for (i = 0; i < dn_len; i++) *p++ = tolower((uint8_t)user_dn[i]);
+	*p++ = '\0';
+
+	check_is_dn = fr_ldap_util_is_dn(check->vp_strvalue, check->vp_length);
+	for (i = 0; i < check->vp_length; i++) {
+		*p++ = check_is_dn ? tolower((uint8_t)check->vp_strvalue[i]) : (uint8_t)check->vp_strvalue[i];
+	}
+
+	return p - out;
+}
+
+/** Return the shard responsible for a given key
+ *
+ */
+static inline ldap_group_cache_shard_t *ldap_group_cache_shard(rlm_ldap_group_cache_t *cache,
+							       uint8_t const *key, size_t key_len)
+{
+	return &cache->shard[fr_hash(key, key_len) & (cache->num_shards - 1)];
+}
+
+/** Remove an entry from its shard and free it
+ *
+ * @note Called with the shard mutex held.
+ */
+static void ldap_group_cache_entry_free(ldap_group_cache_shard_t *shard, ldap_group_cache_entry_t *entry)
+{
+	fr_dlist_remove(&shard->lru, entry);
+	rbtree_deletebydata(shard->tree, entry);
+	talloc_free(entry);
+}
+
+/** Free all entries and destroy the shard mutexes
+ *
+ */
+static int _ldap_group_cache_free(rlm_ldap_group_cache_t *cache)
+{
+	ldap_group_cache_entry_t	*entry;
+	uint32_t			i;
+
+	for (i = 0; i < cache->num_shards; i++) {
+		ldap_group_cache_shard_t *shard = &cache->shard[i];
+
+		while ((entry = fr_dlist_head(&shard->lru))) ldap_group_cache_entry_free(shard, entry);
+
+		talloc_free(shard->tree);
+		pthread_mutex_destroy(&shard->mutex);
+	}
+
+	return 0;
+}
+
+/** Allocate a group membership cache
+ *
+ * @param[in] ctx		to link the lifetime of the cache to.
+ * @param[in] max_entries	Maximum number of results to cache.
+ * @param[in] ttl		How long to cache the results of checks which found
+ *				the user was a member of the group.
+ * @param[in] negative_ttl	How long to cache the results of checks which found
+ *				the user was not a member of the group.  0 disables
+ *				negative caching.
+ * @return
+ *	- A new group cache.
+ *	- NULL on failure.
+ */
+rlm_ldap_group_cache_t *rlm_ldap_group_cache_alloc(TALLOC_CTX *ctx, uint32_t max_entries,
+						   fr_time_delta_t ttl, fr_time_delta_t negative_ttl)
+{
+	rlm_ldap_group_cache_t	*cache;
+	uint32_t		i, num_shards = LDAP_GROUP_CACHE_SHARDS;
+
+	/*
+	 *	Small caches don't benefit from sharding, and
+	 *	every shard must be able to hold at least one
+	 *	entry.
+	 */
+	while ((num_shards > 1) && (num_shards > max_entries)) num_shards >>= 1;
+
+	/*
+	 *	Entries are allocated and freed by multiple
+	 *	threads, so the cache must not share a talloc
+	 *	hierarchy with anything else.
+	 */
+	cache = talloc_zero(NULL, rlm_ldap_group_cache_t);
+	if (!cache) return NULL;
+	talloc_link_ctx(ctx, cache);
+
+	cache->ttl = ttl;
+	cache->negative_ttl = negative_ttl;
+
+	cache->shard = talloc_zero_array(cache, ldap_group_cache_shard_t, num_shards);
+	if (!cache->shard) {
+		talloc_free(cache);
+		return NULL;
+	}
+	talloc_set_destructor(cache, _ldap_group_cache_free);
+
+	for (i = 0; i < num_shards; i++) {
+		ldap_group_cache_shard_t *shard = &cache->shard[i];
+
+		if (pthread_mutex_init(&shard->mutex, NULL) != 0) {
+			talloc_free(cache);
+			return NULL;
+		}
+
+		shard->tree = rbtree_talloc_alloc(NULL, ldap_group_cache_entry_cmp, ldap_group_cache_entry_t, NULL, 0);
+		if (!shard->tree) {
+			pthread_mutex_destroy(&shard->mutex);
+			talloc_free(cache);
+			return NULL;
+		}
+		fr_dlist_talloc_init(&shard->lru, ldap_group_cache_entry_t, lru);
+
+		/*
+		 *	Round up, so the total may slightly exceed
+		 *	max_entries, but no shard has a limit of 0.
+		 */
+		shard->max_entries = (max_entries + num_shards - 1) / num_shards;
+		cache->num_shards++;	/* Only count fully initialised shards */
+	}
+
+	return cache;
+}
+
+/** Find a cached group membership result
+ *
+ * @param[in] inst	rlm_ldap configuration.
+ * @param[in] request	Current request.
+ * @param[in] user_dn	Normalised DN of the user object.
+ * @param[in] check	vp containing the group value (name or DN).
+ * @return
+ *	- RLM_MODULE_OK if the user is a member of the group.
+ *	- RLM_MODULE_NOTFOUND if the user is not a member of the group.
+ *	- RLM_MODULE_NOOP if there's no valid cached result.
+ */
+rlm_rcode_t rlm_ldap_group_cache_find(rlm_ldap_t const *inst, REQUEST *request,
+				      char const *user_dn, VALUE_PAIR const *check)
+{
+	rlm_ldap_group_cache_t		*cache = inst->group_cache;
+	ldap_group_cache_shard_t	*shard;
+	ldap_group_cache_entry_t	*entry, find;
+	uint8_t				key[(LDAP_MAX_DN_STR_LEN * 2) + 1];
+	rlm_rcode_t			rcode = RLM_MODULE_NOOP;
+
+	find.key = key;
+	find.key_len = ldap_group_cache_key(key, sizeof(key), user_dn, check);
+	if (!find.key_len) return RLM_MODULE_NOOP;
+
+	shard = ldap_group_cache_shard(cache, find.key, find.key_len);
+
+	pthread_mutex_lock(&shard->mutex);
+	entry = rbtree_finddata(shard->tree, &find);
+	if (!entry) {
+		shard->misses++;
+		goto done;
+	}
+
+	if (entry->expires <= fr_time()) {
+		ldap_group_cache_entry_free(shard, entry);
+		shard->expired++;
+		shard->misses++;
+		goto done;
+	}
+
+	/*
+	 *	Move to the front of the LRU list
+	 */
+	fr_dlist_remove(&shard->lru, entry);
+	fr_dlist_insert_head(&shard->lru, entry);
+	shard->hits++;
+
+	rcode = entry->member ? RLM_MODULE_OK : RLM_MODULE_NOTFOUND;
+
+done:
+	pthread_mutex_unlock(&shard->mutex);
+
+	switch (rcode) {
+	case RLM_MODULE_OK:
+		RDEBUG2("User found in group \"%pV\". Matched cached group check result", &check->data);
+		break;
+
+	case RLM_MODULE_NOTFOUND:
+		RDEBUG2("User not found in group \"%pV\". Matched cached group check result", &check->data);
+		break;
+
+	default:
+		break;
+	}
+
+	return rcode;
+}
+
+/** Cache the result of a dynamic group membership check
+ *
+ * Replaces any existing entry for the same user and group, evicting the
+ * least recently used entry in the shard if it's full.
+ *
+ * @param[in] inst	rlm_ldap configuration.
+ * @param[in] request	Current request.
+ * @param[in] user_dn	Normalised DN of the user object.
+ * @param[in] check	vp containing the group value (name or DN).
+ * @param[in] member	Whether the user is a member of the group.
+ */
+void rlm_ldap_group_cache_insert(rlm_ldap_t const *inst, REQUEST *request,
+				 char const *user_dn, VALUE_PAIR const *check, bool member)
+{
+	rlm_ldap_group_cache_t		*cache = inst->group_cache;
+	ldap_group_cache_shard_t	*shard;
+	ldap_group_cache_entry_t	*entry, *old;
+	fr_time_delta_t			ttl = member ? cache->ttl : cache->negative_ttl;
+	uint8_t				key[(LDAP_MAX_DN_STR_LEN * 2) + 1];
+	size_t				key_len;
+
+	if (!ttl) return;
+
+	key_len = ldap_group_cache_key(key, sizeof(key), user_dn, check);
+	if (!key_len) return;
+
+	/*
+	 *	Allocate outside of the mutex
+	 */
+	entry = talloc_zero(NULL, ldap_group_cache_entry_t);
+	if (!entry) return;
+
+	entry->key = talloc_memdup(entry, key, key_len);
+	if (!entry->key) {
+		talloc_free(entry);
+		return;
+	}
+	entry->key_len = key_len;
+	entry->member = member;
+	entry->expires = fr_time() + ttl;
+
+	shard = ldap_group_cache_shard(cache, entry->key, entry->key_len);
+
+	pthread_mutex_lock(&shard->mutex);
+	old = rbtree_finddata(shard->tree, entry);
+	if (old) {
+		ldap_group_cache_entry_free(shard, old);
+	} else if (fr_dlist_num_elements(&shard->lru) >= shard->max_entries) {
+		ldap_group_cache_entry_free(shard, fr_dlist_tail(&shard->lru));
+		shard->evicted++;
+	}
+
+	if (!rbtree_insert(shard->tree, entry)) {
+		pthread_mutex_unlock(&shard->mutex);
+		talloc_free(entry);
+		return;
+	}
+	fr_dlist_insert_head(&shard->lru, entry);
+	pthread_mutex_unlock(&shard->mutex);
+
+	RDEBUG3("Cached group check result for %pV seconds", fr_box_time_delta(ttl));
+}
+
+/** Write group cache statistics for radmin
+ *
+ */
+int rlm_ldap_group_cache_cmd_stats(FILE *fp, UNUSED FILE *fp_err, void *ctx, UNUSED fr_cmd_info_t const *info)
+{
+	rlm_ldap_t const	*inst = talloc_get_type_abort_const(ctx, rlm_ldap_t);
+	rlm_ldap_group_cache_t	*cache = inst->group_cache;
+	uint64_t		entries = 0, hits = 0, misses = 0, expired = 0, evicted = 0;
+	uint32_t		i;
+
+	if (!cache) {
+		fprintf(fp, "disabled\n");
+		return 0;
+	}
+
+	for (i = 0; i < cache->num_shards; i++) {
+		ldap_group_cache_shard_t *shard = &cache->shard[i];
+
+		pthread_mutex_lock(&shard->mutex);
+		entries += fr_dlist_num_elements(&shard->lru);
+		hits += shard->hits;
+		misses += shard->misses;
+		expired += shard->expired;
+		evicted += shard->evicted;
+		pthread_mutex_unlock(&shard->mutex);
+	}
+
+	fprintf(fp, "entries\t\t\t%" PRIu64 "\n", entries);
+	fprintf(fp, "max_entries\t\t%" PRIu64 "\n", (uint64_t)cache->shard[0].max_entries * cache->num_shards);
+	fprintf(fp, "hits\t\t\t%" PRIu64 "\n", hits);
+	fprintf(fp, "misses\t\t\t%" PRIu64 "\n", misses);
+	fprintf(fp, "expired\t\t\t%" PRIu64 "\n", expired);
+	fprintf(fp, "evicted\t\t\t%" PRIu64 "\n", evicted);
+
+	return 0;
+}
@@ -258,242 +258,86 @@ finish:
 	return rcode;
 }
 
-/** Convert group membership information into attributes
+/** Expand the base DN and filter used to find the group objects a user is a member of
  *
- * @param[in] inst rlm_ldap configuration.
- * @param[in] request Current request.
- * @param[in,out] pconn to use. May change as this function calls functions which auto re-connect.
- * @param[in] entry retrieved by rlm_ldap_find_user or fr_ldap_search.
- * @param[in] attr membership attribute to look for in the entry.
- * @return One of the RLM_MODULE_* values.
+ * @param[out] base_dn		Where to write the expanded base DN.
+ * @param[in] base_dn_buff	Buffer to expand the base DN into, must be #LDAP_MAX_DN_STR_LEN bytes.
+ * @param[in] filter		Buffer to write the filter to, must be #LDAP_MAX_FILTER_STR_LEN + 1 bytes.
+ * @param[in] inst		rlm_ldap configuration.
+ * @param[in] request		Current request.
+ * @return
+ *	- 0 on success.
+ *	- -1 on failure.
  */
-rlm_rcode_t rlm_ldap_cacheable_userobj(rlm_ldap_t const *inst, REQUEST *request, fr_ldap_connection_t **pconn,
-				       LDAPMessage *entry, char const *attr)
+static int rlm_ldap_cacheable_groupobj_expand(char const **base_dn, char *base_dn_buff, char *filter,
+					      rlm_ldap_t const *inst, REQUEST *request)
 {
-	rlm_rcode_t rcode = RLM_MODULE_OK;
-
-	struct berval **values;
-
-	char *group_name[LDAP_MAX_CACHEABLE + 1];
-	char **name_p = group_name;
-
-	char *group_dn[LDAP_MAX_CACHEABLE + 1];
-	char **dn_p;
-
-	char *name;
-
-	VALUE_PAIR *vp, **list, *groups = NULL;
-	TALLOC_CTX *list_ctx, *value_ctx;
-	fr_cursor_t list_cursor, groups_cursor;
-
-	int is_dn, i, count;
-
-	fr_assert(entry);
-	fr_assert(attr);
-
-	/*
-	 *	Parse the membership information we got in the initial user query.
-	 */
-	values = ldap_get_values_len((*pconn)->handle, entry, attr);
-	if (!values) {
-		RDEBUG2("No cacheable group memberships found in user object");
-
-		return RLM_MODULE_OK;
-	}
-	count = ldap_count_values_len(values);
-
-	list = radius_list(request, PAIR_LIST_CONTROL);
-	list_ctx = radius_list_ctx(request, PAIR_LIST_CONTROL);
-	fr_assert(list != NULL);
-	fr_assert(list_ctx != NULL);
-
-	/*
-	 *	Simplifies freeing temporary values
-	 */
-	value_ctx = talloc_new(request);
-
-	/*
-	 *	Temporary list to hold new group VPs, will be merged
-	 *	once all group info has been gathered/resolved
-	 *	successfully.
-	 */
-	fr_cursor_init(&groups_cursor, &groups);
-
-	for (i = 0; (i < LDAP_MAX_CACHEABLE) && (i < count); i++) {
-		is_dn = fr_ldap_util_is_dn(values[i]->bv_val, values[i]->bv_len);
-
-		if (inst->cacheable_group_dn) {
-			/*
-			 *	The easy case, we're caching DNs and we got a DN.
-			 */
-			if (is_dn) {
-				MEM(vp = fr_pair_afrom_da(list_ctx, inst->cache_da));
-				fr_pair_value_bstrndup(vp, values[i]->bv_val, values[i]->bv_len, true);
-				fr_cursor_append(&groups_cursor, vp);
-			/*
-			 *	We were told to cache DNs but we got a name, we now need to resolve
-			 *	this to a DN. Store all the group names in an array so we can do one query.
-			 */
-			} else {
-				*name_p++ = fr_ldap_berval_to_string(value_ctx, values[i]);
-			}
-		}
-
-		if (inst->cacheable_group_name) {
-			/*
-			 *	The easy case, we're caching names and we got a name.
-			 */
-			if (!is_dn) {
-				MEM(vp = fr_pair_afrom_da(list_ctx, inst->cache_da));
-				fr_pair_value_bstrndup(vp, values[i]->bv_val, values[i]->bv_len, true);
-				fr_cursor_append(&groups_cursor, vp);
-			/*
-			 *	We were told to cache names but we got a DN, we now need to resolve
-			 *	this to a name.
-			 *	Only Active Directory supports filtering on DN, so we have to search
-			 *	for each individual group.
-			 */
-			} else {
-				char *dn;
-
-				dn = fr_ldap_berval_to_string(value_ctx, values[i]);
-				rcode = rlm_ldap_group_dn2name(inst, request, pconn, dn, &name);
-				talloc_free(dn);
-
-				if (rcode == RLM_MODULE_NOOP) continue;
-
-				if (rcode != RLM_MODULE_OK) {
-					ldap_value_free_len(values);
-					talloc_free(value_ctx);
-					fr_pair_list_free(&groups);
-
-					return rcode;
-				}
-
-				MEM(vp = fr_pair_afrom_da(list_ctx, inst->cache_da));
-				fr_pair_value_bstrdup_buffer(vp, name, true);
-				fr_cursor_append(&groups_cursor, vp);
-				talloc_free(name);
-			}
-		}
-	}
-	*name_p = NULL;
-
-	rcode = rlm_ldap_group_name2dn(inst, request, pconn, group_name, group_dn, sizeof(group_dn));
-
-	ldap_value_free_len(values);
-	talloc_free(value_ctx);
-
-	if (rcode != RLM_MODULE_OK) return rcode;
-
-	fr_cursor_init(&list_cursor, list);
+	char const *filters[] = { inst->groupobj_filter, inst->groupobj_membership_filter };
 
-	RDEBUG2("Adding cacheable user object memberships");
-	RINDENT();
-	if (RDEBUG_ENABLED) {
-		for (vp = fr_cursor_head(&groups_cursor);
-		     vp;
-		     vp = fr_cursor_next(&groups_cursor)) {
-			RDEBUG2("&control:%s += \"%pV\"", inst->cache_da->name, &vp->data);
-		}
+	if (fr_ldap_xlat_filter(request,
+				 filters, NUM_ELEMENTS(filters),
+				 filter, LDAP_MAX_FILTER_STR_LEN + 1) < 0) {
+		return -1;
 	}
 
-	fr_cursor_head(&groups_cursor);
-	fr_cursor_merge(&list_cursor, &groups_cursor);
-
-	for (dn_p = group_dn; *dn_p; dn_p++) {
-		MEM(vp = fr_pair_afrom_da(list_ctx, inst->cache_da));
-		fr_pair_value_strdup(vp, *dn_p);
-		fr_cursor_append(&list_cursor, vp);
+	if (tmpl_expand(base_dn, base_dn_buff, LDAP_MAX_DN_STR_LEN, request,
+			inst->groupobj_base_dn, fr_ldap_escape_func, NULL) < 0) {
+		REDEBUG("Failed creating base_dn");
 
-		RDEBUG2("&control:%s += \"%pV\"", inst->cache_da->name, &vp->data);
-		ldap_memfree(*dn_p);
+		return -1;
 	}
-	REXDENT();
 
-	return rcode;
+	return 0;
 }
 
-/** Convert group membership information into attributes
+/** Convert the result of a search for group objects into attributes
  *
  * @param[in] inst rlm_ldap configuration.
  * @param[in] request Current request.
- * @param[in,out] pconn to use. May change as this function calls functions which auto re-connect.
+ * @param[in] handle libldap handle to use when parsing the result.
+ * @param[in] status of the search.
+ * @param[in] result of the search.  May be NULL if the search failed.  Not freed.
  * @return One of the RLM_MODULE_* values.
  */
-rlm_rcode_t rlm_ldap_cacheable_groupobj(rlm_ldap_t const *inst, REQUEST *request, fr_ldap_connection_t **pconn)
+rlm_rcode_t rlm_ldap_cacheable_groupobj_result(rlm_ldap_t const *inst, REQUEST *request, LDAP *handle,
+					       fr_ldap_rcode_t status, LDAPMessage *result)
 {
-	rlm_rcode_t rcode = RLM_MODULE_OK;
-	fr_ldap_rcode_t status;
 	int ldap_errno;
 
-	LDAPMessage *result = NULL;
 	LDAPMessage *entry;
 
-	char const *base_dn;
-	char base_dn_buff[LDAP_MAX_DN_STR_LEN];
-
-	char const *filters[] = { inst->groupobj_filter, inst->groupobj_membership_filter };
-	char filter[LDAP_MAX_FILTER_STR_LEN + 1];
-
-	char const *attrs[] = { inst->groupobj_name_attr, NULL };
-
 	VALUE_PAIR *vp;
 	char *dn;
 
-	fr_assert(inst->groupobj_base_dn);
-
-	if (!inst->groupobj_membership_filter) {
-		RDEBUG2("Skipping caching group objects as directive 'group.membership_filter' is not set");
-
-		return RLM_MODULE_OK;
-	}
-
-	if (fr_ldap_xlat_filter(request,
-				 filters, NUM_ELEMENTS(filters),
-				 filter, sizeof(filter)) < 0) {
-		return RLM_MODULE_INVALID;
-	}
-
-	if (tmpl_expand(&base_dn, base_dn_buff, sizeof(base_dn_buff), request,
-			inst->groupobj_base_dn, fr_ldap_escape_func, NULL) < 0) {
-		REDEBUG("Failed creating base_dn");
-
-		return RLM_MODULE_INVALID;
-	}
-
-	status = fr_ldap_search(&result, request, pconn, base_dn,
-				inst->groupobj_scope, filter, attrs, NULL, NULL);
 	switch (status) {
 	case LDAP_PROC_SUCCESS:
 		break;
 
 	case LDAP_PROC_NO_RESULT:
 		RDEBUG2("No cacheable group memberships found in group objects");
-		goto finish;
+		return RLM_MODULE_OK;
 
 	default:
-		rcode = RLM_MODULE_FAIL;
-		goto finish;
+		return RLM_MODULE_FAIL;
 	}
 
-	entry = ldap_first_entry((*pconn)->handle, result);
+	entry = ldap_first_entry(handle, result);
 	if (!entry) {
-		ldap_get_option((*pconn)->handle, LDAP_OPT_RESULT_CODE, &ldap_errno);
+		ldap_get_option(handle, LDAP_OPT_RESULT_CODE, &ldap_errno);
 		REDEBUG("Failed retrieving entry: %s", ldap_err2string(ldap_errno));
 
-		goto finish;
+		return RLM_MODULE_OK;
 	}
 
 	RDEBUG2("Adding cacheable group object memberships");
 	do {
 		if (inst->cacheable_group_dn) {
-			dn = ldap_get_dn((*pconn)->handle, entry);
+			dn = ldap_get_dn(handle, entry);
 			if (!dn) {
-				ldap_get_option((*pconn)->handle, LDAP_OPT_RESULT_CODE, &ldap_errno);
+				ldap_get_option(handle, LDAP_OPT_RESULT_CODE, &ldap_errno);
 				REDEBUG("Retrieving object DN from entry failed: %s", ldap_err2string(ldap_errno));
 
-				goto finish;
+				return RLM_MODULE_OK;
 			}
 			fr_ldap_util_normalise_dn(dn, dn);
 
@@ -509,7 +353,7 @@ rlm_rcode_t rlm_ldap_cacheable_groupobj(rlm_ldap_t const *inst, REQUEST *request
 		if (inst->cacheable_group_name) {
 			struct berval **values;
 
-			values = ldap_get_values_len((*pconn)->handle, entry, inst->groupobj_name_attr);
+			values = ldap_get_values_len(handle, entry, inst->groupobj_name_attr);
 			if (!values) continue;
 
 			MEM(pair_add_control(&vp, inst->cache_da) == 0);
@@ -521,9 +365,100 @@ rlm_rcode_t rlm_ldap_cacheable_groupobj(rlm_ldap_t const *inst, REQUEST *request
 
 			ldap_value_free_len(values);
 		}
-	} while ((entry = ldap_next_entry((*pconn)->handle, entry)));
+	} while ((entry = ldap_next_entry(handle, entry)));
 
-finish:
+	return RLM_MODULE_OK;
+}
+
+/** Allocate a search for the group objects a user is a member of, to run over a trunk
+ *
+ * The result should be passed to #rlm_ldap_cacheable_groupobj_result.
+ *
+ * @param[in] ctx to allocate the query in.
+ * @param[in] inst rlm_ldap configuration.
+ * @param[in] request Current request.
+ * @param[out] rcode The status of the operation, one of the RLM_MODULE_* codes.
+ * @return
+ *	- A new query.
+ *	- NULL, with rcode set to #RLM_MODULE_OK, if group objects aren't searched.
+ *	- NULL, with rcode set to #RLM_MODULE_INVALID, on error.
+ */
+fr_ldap_query_t *rlm_ldap_cacheable_groupobj_search_alloc(TALLOC_CTX *ctx, rlm_ldap_t const *inst,
+							  REQUEST *request, rlm_rcode_t *rcode)
+{
+	fr_ldap_query_t *query;
+
+	char const *base_dn;
+	char base_dn_buff[LDAP_MAX_DN_STR_LEN];
+	char filter[LDAP_MAX_FILTER_STR_LEN + 1];
+
+	char const **attrs;
+
+	fr_assert(inst->groupobj_base_dn);
+
+	*rcode = RLM_MODULE_OK;
+
+	if (!inst->groupobj_membership_filter) {
+		RDEBUG2("Skipping caching group objects as directive 'group.membership_filter' is not set");
+
+		return NULL;
+	}
+
+	if (rlm_ldap_cacheable_groupobj_expand(&base_dn, base_dn_buff, filter, inst, request) < 0) {
+		*rcode = RLM_MODULE_INVALID;
+
+		return NULL;
+	}
+
+	query = fr_ldap_trunk_search_alloc(ctx, request, base_dn, inst->groupobj_scope, filter, NULL, NULL);
+
+	/*
+	 *	The attribute list must remain valid until
+	 *	the search completes.
+	 */
+	MEM(attrs = talloc_array(query, char const *, 2));
+	attrs[0] = inst->groupobj_name_attr;
+	attrs[1] = NULL;
+	query->attrs = attrs;
+
+	return query;
+}
+
+/** Convert group membership information into attributes
+ *
+ * @param[in] inst rlm_ldap configuration.
+ * @param[in] request Current request.
+ * @param[in,out] pconn to use. May change as this function calls functions which auto re-connect.
+ * @return One of the RLM_MODULE_* values.
+ */
+rlm_rcode_t rlm_ldap_cacheable_groupobj(rlm_ldap_t const *inst, REQUEST *request, fr_ldap_connection_t **pconn)
+{
+	rlm_rcode_t rcode;
+	fr_ldap_rcode_t status;
+
+	LDAPMessage *result = NULL;
+
+	char const *base_dn;
+	char base_dn_buff[LDAP_MAX_DN_STR_LEN];
+	char filter[LDAP_MAX_FILTER_STR_LEN + 1];
+
+	char const *attrs[] = { inst->groupobj_name_attr, NULL };
+
+	fr_assert(inst->groupobj_base_dn);
+
+	if (!inst->groupobj_membership_filter) {
+		RDEBUG2("Skipping caching group objects as directive 'group.membership_filter' is not set");
+
+		return RLM_MODULE_OK;
+	}
+
+	if (rlm_ldap_cacheable_groupobj_expand(&base_dn, base_dn_buff, filter, inst, request) < 0) {
+		return RLM_MODULE_INVALID;
+	}
+
+	status = fr_ldap_search(&result, request, pconn, base_dn,
+				inst->groupobj_scope, filter, attrs, NULL, NULL);
+	rcode = rlm_ldap_cacheable_groupobj_result(inst, request, (*pconn)->handle, status, result);
 	if (result) ldap_msgfree(result);
 
 	return rcode;
@@ -36,6 +36,7 @@ USES_APPLE_DEPRECATED_API
 #include "rlm_ldap.h"
 
 #include <freeradius-devel/server/map_proc.h>
+#include <freeradius-devel/unlang/base.h>
 
 static CONF_PARSER sasl_mech_dynamic[] = {
 	{ FR_CONF_OFFSET("mech", FR_TYPE_TMPL | FR_TYPE_NOT_EMPTY, fr_ldap_sasl_t_dynamic_t, mech) },
@@ -104,6 +105,13 @@ static CONF_PARSER user_config[] = {
 /*
  *	Group configuration
  */
+static CONF_PARSER group_cache_config[] = {
+	{ FR_CONF_OFFSET("ttl", FR_TYPE_TIME_DELTA, rlm_ldap_t, group_cache_ttl), .dflt = "0" },
+	{ FR_CONF_OFFSET("negative_ttl", FR_TYPE_TIME_DELTA, rlm_ldap_t, group_cache_negative_ttl), .dflt = "0" },
+	{ FR_CONF_OFFSET("max_entries", FR_TYPE_UINT32, rlm_ldap_t, group_cache_max_entries), .dflt = "16384" },
+	CONF_PARSER_TERMINATOR
+};
+
 static CONF_PARSER group_config[] = {
 	{ FR_CONF_OFFSET("filter", FR_TYPE_STRING, rlm_ldap_t, groupobj_filter) },
 	{ FR_CONF_OFFSET("scope", FR_TYPE_STRING, rlm_ldap_t, groupobj_scope_str), .dflt = "sub" },
@@ -117,6 +125,7 @@ static CONF_PARSER group_config[] = {
 	{ FR_CONF_OFFSET("cache_attribute", FR_TYPE_STRING, rlm_ldap_t, cache_attribute) },
 	{ FR_CONF_OFFSET("group_attribute", FR_TYPE_STRING, rlm_ldap_t, group_attribute) },
 	{ FR_CONF_OFFSET("allow_dangling_group_ref", FR_TYPE_BOOL, rlm_ldap_t, allow_dangling_group_refs), .dflt = "no" },
+	{ FR_CONF_POINTER("membership_cache", FR_TYPE_SUBSECTION, NULL), .subcs = (void const *) group_cache_config },
 	CONF_PARSER_TERMINATOR
 };
 
@@ -223,6 +232,9 @@ static const CONF_PARSER module_config[] = {
 	{ FR_CONF_POINTER("global", FR_TYPE_SUBSECTION, NULL), .subcs = (void const *) global_config },
 
 	{ FR_CONF_OFFSET("tls", FR_TYPE_SUBSECTION, rlm_ldap_t, handle_config), .subcs = (void const *) tls_config },
+
+	{ FR_CONF_OFFSET("async", FR_TYPE_BOOL, rlm_ldap_t, async), .dflt = "no" },
+	{ FR_CONF_OFFSET("trunk", FR_TYPE_SUBSECTION, rlm_ldap_t, trunk_conf), .subcs = (void const *) fr_trunk_config },
 	CONF_PARSER_TERMINATOR
 };
 
@@ -598,9 +610,11 @@ static int rlm_ldap_groupcmp(void *instance, REQUEST *request, UNUSED VALUE_PAIR
 
 	bool			found = false;
 	bool			check_is_dn;
+	bool			cacheable = false;
 
 	fr_ldap_connection_t		*conn = NULL;
-	char const		*user_dn;
+	char const		*user_dn = NULL;
+	VALUE_PAIR		*vp;
 
 	fr_assert(inst->groupobj_base_dn);
 
@@ -651,19 +665,49 @@ static int rlm_ldap_groupcmp(void *instance, REQUEST *request, UNUSED VALUE_PAIR
 		}
 	}
 
-	conn = mod_conn_get(inst, request);
-	if (!conn) return 1;
-
 	/*
 	 *	This is used in the default membership filter.
+	 *
+	 *	If an earlier search has already found the user's DN
+	 *	we don't need a connection to check the group cache.
 	 */
-	user_dn = rlm_ldap_find_user(inst, request, &conn, NULL, false, NULL, &rcode);
-	if (!user_dn) {
-		ldap_mod_conn_release(inst, request, conn);
-		return 1;
+	vp = fr_pair_find_by_da(request->control, attr_ldap_userdn, TAG_ANY);
+	if (vp) {
+		RDEBUG2("Using user DN from request \"%pV\"", &vp->data);
+		user_dn = vp->vp_strvalue;
+	} else {
+		conn = mod_conn_get(inst, request);
+		if (!conn) return 1;
+
+		user_dn = rlm_ldap_find_user(inst, request, &conn, NULL, false, NULL, &rcode);
+		if (!user_dn) {
+			ldap_mod_conn_release(inst, request, conn);
+			return 1;
+		}
 	}
 
-	fr_assert(conn);
+	/*
+	 *	Check if we've recently done the same dynamic
+	 *	check for this user.
+	 */
+	if (inst->group_cache) {
+		switch (rlm_ldap_group_cache_find(inst, request, user_dn, check)) {
+		case RLM_MODULE_NOTFOUND:
+			goto finish;
+
+		case RLM_MODULE_OK:
+			found = true;
+			goto finish;
+
+		default:
+			break;
+		}
+	}
+
+	if (!conn) {
+		conn = mod_conn_get(inst, request);
+		if (!conn) return 1;
+	}
 
 	/*
 	 *	Check groupobj user membership
@@ -675,6 +719,7 @@ static int rlm_ldap_groupcmp(void *instance, REQUEST *request, UNUSED VALUE_PAIR
 
 		case RLM_MODULE_OK:
 			found = true;
+			cacheable = true;
 			FALL_THROUGH;
 
 		default:
@@ -694,6 +739,7 @@ static int rlm_ldap_groupcmp(void *instance, REQUEST *request, UNUSED VALUE_PAIR
 
 		case RLM_MODULE_OK:
 			found = true;
+			cacheable = true;
 			FALL_THROUGH;
 
 		default:
@@ -703,7 +749,14 @@ static int rlm_ldap_groupcmp(void *instance, REQUEST *request, UNUSED VALUE_PAIR
 
 	fr_assert(conn);
 
+	/*
+	 *	All checks completed without finding the user
+	 */
+	cacheable = true;
+
 finish:
+	if (cacheable && inst->group_cache) rlm_ldap_group_cache_insert(inst, request, user_dn, check, found);
+
 	if (conn) ldap_mod_conn_release(inst, request, conn);
 
 	if (!found) {
@@ -715,8 +768,185 @@ finish:
 	return 0;
 }
 
-static rlm_rcode_t mod_authenticate(void *instance, UNUSED void *thread, REQUEST *request) CC_HINT(nonnull);
-static rlm_rcode_t CC_HINT(nonnull) mod_authenticate(void *instance, UNUSED void *thread, REQUEST *request)
+/** Convert the result of binding as a user to a module rcode
+ *
+ */
+static rlm_rcode_t ldap_user_bind_rcode(REQUEST *request, char const *dn, fr_ldap_rcode_t status)
+{
+	switch (status) {
+	case LDAP_PROC_SUCCESS:
+		RDEBUG2("Bind as user \"%s\" was successful", dn);
+		return RLM_MODULE_OK;
+
+	case LDAP_PROC_NOT_PERMITTED:
+		return RLM_MODULE_DISALLOW;
+
+	case LDAP_PROC_REJECT:
+		return RLM_MODULE_REJECT;
+
+	case LDAP_PROC_BAD_DN:
+		return RLM_MODULE_INVALID;
+
+	case LDAP_PROC_NO_RESULT:
+		return RLM_MODULE_NOTFOUND;
+
+	default:
+		return RLM_MODULE_FAIL;
+	}
+}
+
+/** Resume context for users authenticated over the thread's trunks
+ *
+ */
+typedef struct {
+	rlm_ldap_t const	*inst;			//!< Instance of rlm_ldap.
+	rlm_ldap_thread_t	*thread;		//!< Thread the operations are enqueued on.
+	char const		*password;		//!< User-Password to bind with.
+	char const		*dn;			//!< Of the user object.
+	rlm_rcode_t		rcode;			//!< Result of finding the user object.
+	fr_ldap_query_t		*query;			//!< Search or bind in progress.
+} ldap_auth_ctx_t;
+
+/** Find the user's DN in the result of the user object search
+ *
+ * Called from the trunk connection's demux callback.
+ */
+static void mod_authenticate_search_parse(LDAP *handle, LDAPMessage *result, REQUEST *request, void *uctx)
+{
+	ldap_auth_ctx_t		*auth_ctx = talloc_get_type_abort(uctx, ldap_auth_ctx_t);
+
+	auth_ctx->dn = rlm_ldap_user_dn_from_result(auth_ctx->inst, request, handle, result, &auth_ctx->rcode);
+}
+
+/** Cancel the search or bind if the request is stopped while it's in progress
+ *
+ */
+static void mod_authenticate_signal(UNUSED void *instance, UNUSED void *thread, UNUSED REQUEST *request,
+				    void *rctx, fr_state_signal_t action)
+{
+	ldap_auth_ctx_t		*auth_ctx = talloc_get_type_abort(rctx, ldap_auth_ctx_t);
+
+	if (action != FR_SIGNAL_CANCEL) return;
+
+	talloc_free(auth_ctx);				/* Also cancels the query */
+}
+
+/** Process the result of binding as the user
+ *
+ */
+static rlm_rcode_t mod_authenticate_bind_resume(UNUSED void *instance, UNUSED void *thread,
+						REQUEST *request, void *rctx)
+{
+	ldap_auth_ctx_t		*auth_ctx = talloc_get_type_abort(rctx, ldap_auth_ctx_t);
+	rlm_rcode_t		rcode;
+
+	rcode = ldap_user_bind_rcode(request, auth_ctx->dn, auth_ctx->query->ret);
+	talloc_free(auth_ctx);
+
+	return rcode;
+}
+
+/** Bind as the user, over a connection from the bind trunk
+ *
+ */
+static rlm_rcode_t mod_authenticate_bind(REQUEST *request, ldap_auth_ctx_t *auth_ctx)
+{
+	TALLOC_FREE(auth_ctx->query);
+
+	auth_ctx->query = fr_ldap_trunk_bind_alloc(auth_ctx, request, auth_ctx->dn, auth_ctx->password, NULL);
+	if (fr_ldap_trunk_query_enqueue(auth_ctx->thread->bind_trunk, auth_ctx->query) < 0) {
+		talloc_free(auth_ctx);
+		return RLM_MODULE_FAIL;
+	}
+
+	return unlang_module_yield(request, mod_authenticate_bind_resume, mod_authenticate_signal, auth_ctx);
+}
+
+/** Process the result of searching for the user object
+ *
+ * Follows the same logic as rlm_ldap_find_user().
+ */
+static rlm_rcode_t mod_authenticate_search_resume(UNUSED void *instance, UNUSED void *thread,
+						  REQUEST *request, void *rctx)
+{
+	ldap_auth_ctx_t		*auth_ctx = talloc_get_type_abort(rctx, ldap_auth_ctx_t);
+	fr_ldap_query_t		*query = auth_ctx->query;
+	rlm_rcode_t		rcode = auth_ctx->rcode;
+
+	switch (query->ret) {
+	case LDAP_PROC_SUCCESS:
+		break;
+
+	case LDAP_PROC_BAD_DN:
+	case LDAP_PROC_NO_RESULT:
+		rcode = RLM_MODULE_NOTFOUND;
+		goto finish;
+
+	default:
+		rcode = RLM_MODULE_FAIL;
+		goto finish;
+	}
+
+	/*
+	 *	The DN was found by mod_authenticate_search_parse()
+	 *	when the result was received.
+	 */
+	if (!auth_ctx->dn) goto finish;
+
+	return mod_authenticate_bind(request, auth_ctx);
+
+finish:
+	talloc_free(auth_ctx);
+
+	return rcode;
+}
+
+/** Authenticate a user without blocking the worker thread
+ *
+ * Same as the synchronous path in mod_authenticate(), but the user object is
+ * found with a search over the thread's search trunk, and the user bind is
+ * performed over the thread's bind trunk, with the request yielding while
+ * each operation is in progress.
+ */
+static rlm_rcode_t mod_authenticate_async(rlm_ldap_t const *inst, rlm_ldap_thread_t *thread,
+					  REQUEST *request, VALUE_PAIR *password)
+{
+	ldap_auth_ctx_t		*auth_ctx;
+	VALUE_PAIR		*vp;
+	rlm_rcode_t		rcode;
+
+	MEM(auth_ctx = talloc_zero(request, ldap_auth_ctx_t));
+	auth_ctx->inst = inst;
+	auth_ctx->thread = thread;
+	auth_ctx->password = password->vp_strvalue;
+
+	vp = fr_pair_find_by_da(request->control, attr_ldap_userdn, TAG_ANY);
+	if (vp) {
+		RDEBUG2("Using user DN from request \"%pV\"", &vp->data);
+		auth_ctx->dn = vp->vp_strvalue;
+
+		return mod_authenticate_bind(request, auth_ctx);
+	}
+
+	auth_ctx->query = rlm_ldap_user_search_alloc(auth_ctx, inst, request, NULL, &rcode);
+	if (!auth_ctx->query) {
+		talloc_free(auth_ctx);
+		return rcode;
+	}
+	auth_ctx->rcode = RLM_MODULE_FAIL;
+	auth_ctx->query->parser = mod_authenticate_search_parse;
+	auth_ctx->query->parser_uctx = auth_ctx;
+
+	if (fr_ldap_trunk_query_enqueue(thread->trunk, auth_ctx->query) < 0) {
+		talloc_free(auth_ctx);
+		return RLM_MODULE_FAIL;
+	}
+
+	return unlang_module_yield(request, mod_authenticate_search_resume, mod_authenticate_signal, auth_ctx);
+}
+
+static rlm_rcode_t mod_authenticate(void *instance, void *thread, REQUEST *request) CC_HINT(nonnull);
+static rlm_rcode_t CC_HINT(nonnull) mod_authenticate(void *instance, void *thread, REQUEST *request)
 {
 	rlm_rcode_t		rcode;
 	fr_ldap_rcode_t		status;
@@ -771,6 +1001,17 @@ static rlm_rcode_t CC_HINT(nonnull) mod_authenticate(void *instance, UNUSED void
 		RDEBUG2("Login attempt with password");
 	}
 
+	/*
+	 *	SASL binds are multi-step, and still use
+	 *	the connection pool.
+	 */
+	if (inst->async && !inst->user_sasl.mech) {
+		RDEBUG2("Login attempt by \"%pV\"", &username->data);
+
+		return mod_authenticate_async(inst, talloc_get_type_abort(thread, rlm_ldap_thread_t),
+					      request, password);
+	}
+
 	conn = mod_conn_get(inst, request);
 	if (!conn) return RLM_MODULE_FAIL;
 
@@ -824,32 +1065,7 @@ static rlm_rcode_t CC_HINT(nonnull) mod_authenticate(void *instance, UNUSED void
 			      inst->user_sasl.mech ? &sasl : NULL,
 			      0,
 			      NULL, NULL);
-	switch (status) {
-	case LDAP_PROC_SUCCESS:
-		rcode = RLM_MODULE_OK;
-		RDEBUG2("Bind as user \"%s\" was successful", dn);
-		break;
-
-	case LDAP_PROC_NOT_PERMITTED:
-		rcode = RLM_MODULE_DISALLOW;
-		break;
-
-	case LDAP_PROC_REJECT:
-		rcode = RLM_MODULE_REJECT;
-		break;
-
-	case LDAP_PROC_BAD_DN:
-		rcode = RLM_MODULE_INVALID;
-		break;
-
-	case LDAP_PROC_NO_RESULT:
-		rcode = RLM_MODULE_NOTFOUND;
-		break;
-
-	default:
-		rcode = RLM_MODULE_FAIL;
-		break;
-	};
+	rcode = ldap_user_bind_rcode(request, dn, status);
 
 finish:
 	ldap_mod_conn_release(inst, request, conn);
@@ -931,58 +1147,56 @@ free_result:
 	return rcode;
 }
 
-static rlm_rcode_t mod_authorize(void *instance, UNUSED void *thread, REQUEST *request) CC_HINT(nonnull);
-static rlm_rcode_t mod_authorize(void *instance, UNUSED void *thread, REQUEST *request)
+/** Add the attributes needed to check access, memberships and profiles to the user object search
+ *
+ */
+static void ldap_authorize_attrs_add(rlm_ldap_t const *inst, fr_ldap_map_exp_t *expanded)
 {
-	rlm_rcode_t		rcode = RLM_MODULE_OK;
-	int			ldap_errno;
-	int			i;
-	rlm_ldap_t const	*inst = instance;
-	struct berval		**values;
-	fr_ldap_connection_t	*conn;
-	LDAPMessage		*result, *entry;
-	char const 		*dn = NULL;
-	fr_ldap_map_exp_t	expanded; /* faster than allocing every time */
-#ifdef WITH_EDIR
-	fr_ldap_rcode_t		status;
-#endif
-
-	/*
-	 *	Don't be tempted to add a check for User-Name or
-	 *	User-Password here.  LDAP authorization can be used
-	 *	for many things besides searching for users.
-	 */
-
-	if (fr_ldap_map_expand(&expanded, request, inst->user_map) < 0) return RLM_MODULE_FAIL;
-
-	conn = mod_conn_get(inst, request);
-	if (!conn) return RLM_MODULE_FAIL;
-
-	/*
-	 *	Add any additional attributes we need for checking access, memberships, and profiles
-	 */
 	if (inst->userobj_access_attr) {
-		expanded.attrs[expanded.count++] = inst->userobj_access_attr;
+		expanded->attrs[expanded->count++] = inst->userobj_access_attr;
 	}
 
 	if (inst->userobj_membership_attr && (inst->cacheable_group_dn || inst->cacheable_group_name)) {
-		expanded.attrs[expanded.count++] = inst->userobj_membership_attr;
+		expanded->attrs[expanded->count++] = inst->userobj_membership_attr;
 	}
 
 	if (inst->profile_attr) {
-		expanded.attrs[expanded.count++] = inst->profile_attr;
+		expanded->attrs[expanded->count++] = inst->profile_attr;
 	}
 
 	if (inst->valuepair_attr) {
-		expanded.attrs[expanded.count++] = inst->valuepair_attr;
+		expanded->attrs[expanded->count++] = inst->valuepair_attr;
 	}
 
-	expanded.attrs[expanded.count] = NULL;
+	expanded->attrs[expanded->count] = NULL;
+}
 
-	dn = rlm_ldap_find_user(inst, request, &conn, expanded.attrs, true, &result, &rcode);
-	if (!dn) {
-		goto finish;
-	}
+/** Check access, cache group memberships, and apply profiles and attribute maps for a user object
+ *
+ * @param[in] inst		rlm_ldap configuration.
+ * @param[in] request		Current request.
+ * @param[in,out] pconn		to use. May change as this function calls functions which auto re-connect.
+ * @param[in] dn		of the user object.
+ * @param[in] result		of the search for the user object.
+ * @param[in] expanded		attribute map.
+ * @param[in] groupobj		search for the group objects the user is a member of, which has
+ *				already been run.  If NULL, and group objects are cached, the
+ *				search is run using pconn.
+ * @return One of the RLM_MODULE_* values.
+ */
+static rlm_rcode_t ldap_authorize_user(rlm_ldap_t const *inst, REQUEST *request, fr_ldap_connection_t **pconn,
+				       char const *dn, LDAPMessage *result, fr_ldap_map_exp_t const *expanded,
+				       fr_ldap_query_t const *groupobj)
+{
+	rlm_rcode_t		rcode = RLM_MODULE_OK;
+	int			ldap_errno;
+	int			i;
+	struct berval		**values;
+	fr_ldap_connection_t	*conn = *pconn;
+	LDAPMessage		*entry;
+#ifdef WITH_EDIR
+	fr_ldap_rcode_t		status;
+#endif
 
 	entry = ldap_first_entry(conn->handle, result);
 	if (!entry) {
@@ -1013,7 +1227,12 @@ static rlm_rcode_t mod_authorize(void *instance, UNUSED void *thread, REQUEST *r
 			}
 		}
 
-		rcode = rlm_ldap_cacheable_groupobj(inst, request, &conn);
+		if (groupobj) {
+			rcode = rlm_ldap_cacheable_groupobj_result(inst, request, conn->handle,
+								   groupobj->ret, groupobj->result);
+		} else {
+			rcode = rlm_ldap_cacheable_groupobj(inst, request, &conn);
+		}
 		if (rcode != RLM_MODULE_OK) {
 			goto finish;
 		}
@@ -1111,7 +1330,7 @@ skip_edir:
 			goto finish;
 		}
 
-		switch (rlm_ldap_map_profile(inst, request, &conn, profile, &expanded)) {
+		switch (rlm_ldap_map_profile(inst, request, &conn, profile, expanded)) {
 		case RLM_MODULE_INVALID:
 			rcode = RLM_MODULE_INVALID;
 			goto finish;
@@ -1139,7 +1358,7 @@ skip_edir:
 				char *value;
 
 				value = fr_ldap_berval_to_string(request, values[i]);
-				ret = rlm_ldap_map_profile(inst, request, &conn, value, &expanded);
+				ret = rlm_ldap_map_profile(inst, request, &conn, value, expanded);
 				talloc_free(value);
 				if (ret == RLM_MODULE_FAIL) {
 					ldap_value_free_len(values);
@@ -1156,11 +1375,249 @@ skip_edir:
 		RDEBUG2("Processing user attributes");
 		RINDENT();
 		if (fr_ldap_map_do(request, conn, inst->valuepair_attr,
-				   &expanded, entry) > 0) rcode = RLM_MODULE_UPDATED;
+				   expanded, entry) > 0) rcode = RLM_MODULE_UPDATED;
 		REXDENT();
 		rlm_ldap_check_reply(inst, request, conn);
 	}
 
+finish:
+	*pconn = conn;
+
+	return rcode;
+}
+
+/** Resume context for users authorized over the thread's trunk
+ *
+ */
+typedef struct {
+	rlm_ldap_t const	*inst;			//!< Instance of rlm_ldap.
+	rlm_ldap_thread_t	*thread;		//!< Thread the searches are enqueued on.
+	fr_ldap_map_exp_t	expanded;		//!< Attributes to retrieve, and the map to apply.
+	char const		*dn;			//!< Of the user object.
+	rlm_rcode_t		rcode;			//!< Result of finding the user object.
+	fr_ldap_query_t		*user;			//!< Search for the user object.
+	fr_ldap_query_t		*groupobj;		//!< Search for the group objects the user is a member of.
+} ldap_autz_ctx_t;
+
+/** Free any dynamically expanded attribute names
+ *
+ * The searches are children of the resume context, and are cancelled when they're freed.
+ */
+static int _ldap_autz_ctx_free(ldap_autz_ctx_t *autz_ctx)
+{
+	talloc_free(autz_ctx->expanded.ctx);
+
+	return 0;
+}
+
+/** Find the user's DN in the result of the user object search
+ *
+ * Called from the trunk connection's demux callback.
+ */
+static void mod_authorize_search_parse(LDAP *handle, LDAPMessage *result, REQUEST *request, void *uctx)
+{
+	ldap_autz_ctx_t		*autz_ctx = talloc_get_type_abort(uctx, ldap_autz_ctx_t);
+
+	autz_ctx->dn = rlm_ldap_user_dn_from_result(autz_ctx->inst, request, handle, result, &autz_ctx->rcode);
+}
+
+/** Cancel the searches if the request is stopped while they're in progress
+ *
+ */
+static void mod_authorize_signal(UNUSED void *instance, UNUSED void *thread, UNUSED REQUEST *request,
+				 void *rctx, fr_state_signal_t action)
+{
+	ldap_autz_ctx_t		*autz_ctx = talloc_get_type_abort(rctx, ldap_autz_ctx_t);
+
+	if (action != FR_SIGNAL_CANCEL) return;
+
+	talloc_free(autz_ctx);
+}
+
+/** Process the user object, once all the searches which can be run over the trunk have completed
+ *
+ * The remaining work may need more LDAP operations, so it uses a connection
+ * from the pool.  The search results are parsed with that connection's
+ * handle, which only this thread is using.
+ */
+static rlm_rcode_t mod_authorize_groupobj_resume(UNUSED void *instance, UNUSED void *thread,
+						 REQUEST *request, void *rctx)
+{
+	ldap_autz_ctx_t		*autz_ctx = talloc_get_type_abort(rctx, ldap_autz_ctx_t);
+	rlm_ldap_t const	*inst = autz_ctx->inst;
+	fr_ldap_connection_t	*conn;
+	rlm_rcode_t		rcode;
+
+	conn = mod_conn_get(inst, request);
+	if (!conn) {
+		talloc_free(autz_ctx);
+		return RLM_MODULE_FAIL;
+	}
+
+	/*
+	 *	Any further searches must be performed as
+	 *	the admin user, as in rlm_ldap_find_user().
+	 */
+	if (conn->rebound) {
+		if (fr_ldap_bind(request, &conn, conn->config->admin_identity, conn->config->admin_password,
+				 &conn->config->admin_sasl, 0, NULL, NULL) != LDAP_PROC_SUCCESS) {
+			rcode = RLM_MODULE_FAIL;
+			goto finish;
+		}
+		conn->rebound = false;
+	}
+
+	rcode = ldap_authorize_user(inst, request, &conn, autz_ctx->dn, autz_ctx->user->result,
+				    &autz_ctx->expanded, autz_ctx->groupobj);
+
+finish:
+	ldap_mod_conn_release(inst, request, conn);
+	talloc_free(autz_ctx);
+
+	return rcode;
+}
+
+/** Process the result of searching for the user object, and search for group objects
+ *
+ * Follows the same logic as rlm_ldap_find_user().
+ */
+static rlm_rcode_t mod_authorize_search_resume(void *instance, void *thread, REQUEST *request, void *rctx)
+{
+	ldap_autz_ctx_t		*autz_ctx = talloc_get_type_abort(rctx, ldap_autz_ctx_t);
+	rlm_ldap_t const	*inst = autz_ctx->inst;
+	rlm_rcode_t		rcode = autz_ctx->rcode;
+
+	switch (autz_ctx->user->ret) {
+	case LDAP_PROC_SUCCESS:
+		break;
+
+	case LDAP_PROC_BAD_DN:
+	case LDAP_PROC_NO_RESULT:
+		rcode = RLM_MODULE_NOTFOUND;
+		goto finish;
+
+	default:
+		rcode = RLM_MODULE_FAIL;
+		goto finish;
+	}
+
+	/*
+	 *	The DN was found by mod_authorize_search_parse()
+	 *	when the result was received.
+	 */
+	if (!autz_ctx->dn) goto finish;
+
+	if (!inst->cacheable_group_dn && !inst->cacheable_group_name) {
+		return mod_authorize_groupobj_resume(instance, thread, request, autz_ctx);
+	}
+
+	/*
+	 *	The result is only used if the user is allowed
+	 *	access, but the search is sent now so that it's
+	 *	not on the critical path.
+	 */
+	autz_ctx->groupobj = rlm_ldap_cacheable_groupobj_search_alloc(autz_ctx, inst, request, &rcode);
+	if (!autz_ctx->groupobj) {
+		if (rcode != RLM_MODULE_OK) goto finish;
+
+		/*
+		 *	Group objects aren't searched, but
+		 *	user object memberships may still
+		 *	be cached.
+		 */
+		return mod_authorize_groupobj_resume(instance, thread, request, autz_ctx);
+	}
+
+	if (fr_ldap_trunk_query_enqueue(autz_ctx->thread->trunk, autz_ctx->groupobj) < 0) {
+		rcode = RLM_MODULE_FAIL;
+		goto finish;
+	}
+
+	return unlang_module_yield(request, mod_authorize_groupobj_resume, mod_authorize_signal, autz_ctx);
+
+finish:
+	talloc_free(autz_ctx);
+
+	return rcode;
+}
+
+/** Authorize a user, without blocking the worker thread while searching for the user and group objects
+ *
+ * Same as the synchronous path in mod_authorize(), but the user object, and
+ * group objects the user is a member of, are found with searches over the
+ * thread's search trunk, with the request yielding while each is in
+ * progress.  Everything else still uses a connection from the pool.
+ */
+static rlm_rcode_t mod_authorize_async(rlm_ldap_t const *inst, rlm_ldap_thread_t *thread,
+				       REQUEST *request, fr_ldap_map_exp_t const *expanded)
+{
+	ldap_autz_ctx_t		*autz_ctx;
+	rlm_rcode_t		rcode;
+
+	MEM(autz_ctx = talloc_zero(request, ldap_autz_ctx_t));
+	autz_ctx->inst = inst;
+	autz_ctx->thread = thread;
+	autz_ctx->expanded = *expanded;
+	talloc_set_destructor(autz_ctx, _ldap_autz_ctx_free);
+
+	autz_ctx->user = rlm_ldap_user_search_alloc(autz_ctx, inst, request, autz_ctx->expanded.attrs, &rcode);
+	if (!autz_ctx->user) {
+		talloc_free(autz_ctx);
+		return rcode;
+	}
+	autz_ctx->rcode = RLM_MODULE_FAIL;
+	autz_ctx->user->parser = mod_authorize_search_parse;
+	autz_ctx->user->parser_uctx = autz_ctx;
+
+	if (fr_ldap_trunk_query_enqueue(thread->trunk, autz_ctx->user) < 0) {
+		talloc_free(autz_ctx);
+		return RLM_MODULE_FAIL;
+	}
+
+	return unlang_module_yield(request, mod_authorize_search_resume, mod_authorize_signal, autz_ctx);
+}
+
+static rlm_rcode_t mod_authorize(void *instance, void *thread, REQUEST *request) CC_HINT(nonnull);
+static rlm_rcode_t mod_authorize(void *instance, void *thread, REQUEST *request)
+{
+	rlm_rcode_t		rcode = RLM_MODULE_OK;
+	rlm_ldap_t const	*inst = instance;
+	fr_ldap_connection_t	*conn;
+	LDAPMessage		*result = NULL;
+	char const 		*dn = NULL;
+	fr_ldap_map_exp_t	expanded; /* faster than allocing every time */
+
+	/*
+	 *	Don't be tempted to add a check for User-Name or
+	 *	User-Password here.  LDAP authorization can be used
+	 *	for many things besides searching for users.
+	 */
+
+	if (fr_ldap_map_expand(&expanded, request, inst->user_map) < 0) return RLM_MODULE_FAIL;
+
+	/*
+	 *	Add any additional attributes we need for checking access, memberships, and profiles
+	 */
+	ldap_authorize_attrs_add(inst, &expanded);
+
+	if (inst->async) {
+		return mod_authorize_async(inst, talloc_get_type_abort(thread, rlm_ldap_thread_t),
+					   request, &expanded);
+	}
+
+	conn = mod_conn_get(inst, request);
+	if (!conn) {
+		talloc_free(expanded.ctx);
+		return RLM_MODULE_FAIL;
+	}
+
+	dn = rlm_ldap_find_user(inst, request, &conn, expanded.attrs, true, &result, &rcode);
+	if (!dn) {
+		goto finish;
+	}
+
+	rcode = ldap_authorize_user(inst, request, &conn, dn, result, &expanded, NULL);
+
 finish:
 	talloc_free(expanded.ctx);
 	if (result) ldap_msgfree(result);
@@ -1421,6 +1878,18 @@ static rlm_rcode_t CC_HINT(nonnull) mod_post_auth(void *instance, UNUSED void *t
 	return RLM_MODULE_NOOP;
 }
 
+static fr_cmd_table_t cmd_table[] = {
+	{
+		.parent = "show module",
+		.add_name = true,
+		.name = "group_cache",
+		.func = rlm_ldap_group_cache_cmd_stats,
+		.help = "Show statistics for the group membership cache.",
+		.read_only = true,
+	},
+
+	CMD_TABLE_END
+};
 
 /** Detach from the LDAP server and cleanup internal state.
  *
@@ -1438,6 +1907,28 @@ static int mod_detach(void *instance)
 	return 0;
 }
 
+/** Allocate the per-thread trunks used for async authentication
+ *
+ */
+static int mod_thread_instantiate(UNUSED CONF_SECTION const *cs, void *instance, fr_event_list_t *el, void *thread)
+{
+	rlm_ldap_t const	*inst = talloc_get_type_abort_const(instance, rlm_ldap_t);
+	rlm_ldap_thread_t	*t = talloc_get_type_abort(thread, rlm_ldap_thread_t);
+
+	t->inst = inst;
+	t->el = el;
+
+	if (!inst->async) return 0;
+
+	t->trunk = fr_ldap_trunk_alloc(t, el, &inst->handle_config, &inst->trunk_conf, inst->name);
+	if (!t->trunk) return -1;
+
+	t->bind_trunk = fr_ldap_trunk_alloc(t, el, &inst->handle_config, &inst->bind_trunk_conf, inst->name);
+	if (!t->bind_trunk) return -1;
+
+	return 0;
+}
+
 /** Parse an accounting sub section.
  *
  * Allocate a new ldap_acct_section_t and write the config data into it.
@@ -1994,6 +2485,49 @@ static int mod_instantiate(void *instance, CONF_SECTION *conf)
 	 */
 	if (fr_ldap_init() < 0) goto error;
 
+	if (inst->async) {
+		/*
+		 *	A bind changes the identity of the connection
+		 *	so other operations can't be sent until it's
+		 *	complete.
+		 */
+		inst->bind_trunk_conf = inst->trunk_conf;
+		inst->bind_trunk_conf.max_req_per_conn = 1;
+		inst->bind_trunk_conf.target_req_per_conn = 1;
+
+		if (inst->user_sasl.mech) {
+			cf_log_warn(conf, "SASL user binds are not performed asynchronously, "
+				    "and will use the connection pool");
+		}
+
+		/*
+		 *	User and group object searches yield, so
+		 *	calls to this instance must never be run
+		 *	on an offload thread.
+		 */
+		module_instance_type_set(instance, RLM_TYPE_THREAD_SAFE | RLM_TYPE_RESUMABLE);
+	}
+
+	if (inst->group_cache_ttl || inst->group_cache_negative_ttl) {
+		if (!inst->group_cache_max_entries) {
+			cf_log_err(conf, "Configuration item 'group.membership_cache.max_entries' must be greater "
+				   "than 0 if the membership cache is enabled");
+			goto error;
+		}
+
+		inst->group_cache = rlm_ldap_group_cache_alloc(inst, inst->group_cache_max_entries,
+							       inst->group_cache_ttl, inst->group_cache_negative_ttl);
+		if (!inst->group_cache) {
+			cf_log_err(conf, "Failed allocating group membership cache");
+			goto error;
+		}
+
+		if (fr_command_register_hook(NULL, inst->name, inst, cmd_table) < 0) {
+			PERROR("Failed registering radmin commands for group membership cache");
+			goto error;
+		}
+	}
+
 	/*
 	 *	Initialize the socket pool.
 	 */
@@ -2024,16 +2558,19 @@ static void mod_unload(void)
 /* globally exported name */
 extern module_t rlm_ldap;
 module_t rlm_ldap = {
-	.magic		= RLM_MODULE_INIT,
-	.name		= "ldap",
-	.type		= 0,
-	.inst_size	= sizeof(rlm_ldap_t),
-	.config		= module_config,
-	.onload		= mod_load,
-	.unload		= mod_unload,
-	.bootstrap	= mod_bootstrap,
-	.instantiate	= mod_instantiate,
-	.detach		= mod_detach,
+	.magic			= RLM_MODULE_INIT,
+	.name			= "ldap",
+	.type			= RLM_TYPE_THREAD_SAFE | RLM_TYPE_BLOCKING,
+	.inst_size		= sizeof(rlm_ldap_t),
+	.thread_inst_size	= sizeof(rlm_ldap_thread_t),
+	.thread_inst_type	= "rlm_ldap_thread_t",
+	.config			= module_config,
+	.onload			= mod_load,
+	.unload			= mod_unload,
+	.bootstrap		= mod_bootstrap,
+	.instantiate		= mod_instantiate,
+	.thread_instantiate	= mod_thread_instantiate,
+	.detach			= mod_detach,
 	.methods = {
 		[MOD_AUTHENTICATE]	= mod_authenticate,
 		[MOD_AUTHORIZE]		= mod_authorize,
@@ -19,6 +19,8 @@
 
 typedef struct ldap_inst_s rlm_ldap_t;
 
+typedef struct rlm_ldap_group_cache_s rlm_ldap_group_cache_t;
+
 typedef struct {
 	vp_tmpl_t	*mech;				//!< SASL mech(s) to try.
 	vp_tmpl_t	*proxy;				//!< Identity to proxy.
@@ -112,6 +114,15 @@ struct ldap_inst_s {
 	bool		allow_dangling_group_refs;	//!< Don't error if we fail to resolve a group DN referenced
 														///< from a user object.
 
+	fr_time_delta_t	group_cache_ttl;		//!< How long to cache the results of dynamic group checks
+							///< which found the user was a member.
+	fr_time_delta_t	group_cache_negative_ttl;	//!< How long to cache the results of dynamic group checks
+							///< which found the user was not a member.
+	uint32_t	group_cache_max_entries;	//!< Maximum number of group check results to cache.
+
+	rlm_ldap_group_cache_t	*group_cache;		//!< Results of dynamic group checks, shared by all
+							///< workers.  NULL if disabled.
+
 	/*
 	 *	Profiles
 	 */
@@ -142,6 +153,11 @@ struct ldap_inst_s {
 	fr_pool_t	*pool;				//!< Connection pool instance.
 	fr_ldap_config_t handle_config;			//!< Connection configuration instance.
 
+	bool		async;				//!< Authenticate users without blocking the worker thread.
+	fr_trunk_conf_t	trunk_conf;			//!< Configuration for the per-thread search trunk.
+	fr_trunk_conf_t	bind_trunk_conf;		//!< Configuration for the per-thread bind trunk.
+							///< Copied from trunk_conf, with one bind per connection.
+
 	/*
 	 *	Global config
 	 */
@@ -151,6 +167,17 @@ struct ldap_inst_s {
 	uint32_t	ldap_debug;			//!< Debug flag for the SDK.
 };
 
+/** Per-thread instance data, only used when async is enabled
+ *
+ */
+typedef struct {
+	rlm_ldap_t const	*inst;			//!< Instance of rlm_ldap.
+	fr_event_list_t		*el;			//!< This thread's event list.
+	fr_trunk_t		*trunk;			//!< Connections bound as the admin user, used for
+							///< searches.  Searches are pipelined.
+	fr_trunk_t		*bind_trunk;		//!< Connections used to bind as users.
+} rlm_ldap_thread_t;
+
 extern fr_dict_attr_t const *attr_cleartext_password;
 extern fr_dict_attr_t const *attr_crypt_password;
 extern fr_dict_attr_t const *attr_ldap_userdn;
@@ -166,6 +193,12 @@ extern fr_dict_attr_t const *attr_user_name;
 char const *rlm_ldap_find_user(rlm_ldap_t const *inst, REQUEST *request, fr_ldap_connection_t **pconn,
 			       char const *attrs[], bool force, LDAPMessage **result, rlm_rcode_t *rcode);
 
+char const *rlm_ldap_user_dn_from_result(rlm_ldap_t const *inst, REQUEST *request, LDAP *handle,
+					 LDAPMessage *result, rlm_rcode_t *rcode);
+
+fr_ldap_query_t *rlm_ldap_user_search_alloc(TALLOC_CTX *ctx, rlm_ldap_t const *inst, REQUEST *request,
+					    char const * const *attrs, rlm_rcode_t *rcode);
+
 rlm_rcode_t rlm_ldap_check_access(rlm_ldap_t const *inst, REQUEST *request,
 				  fr_ldap_connection_t const *conn, LDAPMessage *entry);
 
@@ -179,6 +212,12 @@ rlm_rcode_t rlm_ldap_cacheable_userobj(rlm_ldap_t const *inst, REQUEST *request,
 
 rlm_rcode_t rlm_ldap_cacheable_groupobj(rlm_ldap_t const *inst, REQUEST *request, fr_ldap_connection_t **pconn);
 
+rlm_rcode_t rlm_ldap_cacheable_groupobj_result(rlm_ldap_t const *inst, REQUEST *request, LDAP *handle,
+					       fr_ldap_rcode_t status, LDAPMessage *result);
+
+fr_ldap_query_t *rlm_ldap_cacheable_groupobj_search_alloc(TALLOC_CTX *ctx, rlm_ldap_t const *inst,
+							  REQUEST *request, rlm_rcode_t *rcode);
+
 rlm_rcode_t rlm_ldap_check_groupobj_dynamic(rlm_ldap_t const *inst, REQUEST *request, fr_ldap_connection_t **pconn,
 					    VALUE_PAIR *check);
 
@@ -187,6 +226,20 @@ rlm_rcode_t rlm_ldap_check_userobj_dynamic(rlm_ldap_t const *inst, REQUEST *requ
 
 rlm_rcode_t rlm_ldap_check_cached(rlm_ldap_t const *inst, REQUEST *request, VALUE_PAIR *check);
 
+/*
+ *	group_cache.c - Cache of dynamic group membership check results.
+ */
+rlm_ldap_group_cache_t *rlm_ldap_group_cache_alloc(TALLOC_CTX *ctx, uint32_t max_entries,
+						   fr_time_delta_t ttl, fr_time_delta_t negative_ttl);
+
+rlm_rcode_t rlm_ldap_group_cache_find(rlm_ldap_t const *inst, REQUEST *request,
+				      char const *user_dn, VALUE_PAIR const *check);
+
+void rlm_ldap_group_cache_insert(rlm_ldap_t const *inst, REQUEST *request,
+				 char const *user_dn, VALUE_PAIR const *check, bool member);
+
+int rlm_ldap_group_cache_cmd_stats(FILE *fp, FILE *fp_err, void *ctx, fr_cmd_info_t const *info);
+
 /*
  *	conn.c - Connection wrappers.
  */
@@ -36,6 +36,145 @@ USES_APPLE_DEPRECATED_API
 
 #include "rlm_ldap.h"
 
+/** Expand the base DN and filter used to find user objects
+ *
+ * @param[out] base_dn		Where to write the expanded base DN.
+ * @param[in] base_dn_buff	Buffer to expand the base DN into, must be #LDAP_MAX_DN_STR_LEN bytes.
+ * @param[out] filter		Where to write the expanded filter.  Will be NULL if there's no filter.
+ * @param[in] filter_buff	Buffer to expand the filter into, must be #LDAP_MAX_FILTER_STR_LEN bytes.
+ * @param[in] inst		rlm_ldap configuration.
+ * @param[in] request		Current request.
+ * @return
+ *	- 0 on success.
+ *	- -1 on failure.
+ */
+static int rlm_ldap_user_search_expand(char const **base_dn, char *base_dn_buff,
+				       char const **filter, char *filter_buff,
+				       rlm_ldap_t const *inst, REQUEST *request)
+{
+	*filter = NULL;
+
+	if (inst->userobj_filter) {
+		if (tmpl_expand(filter, filter_buff, LDAP_MAX_FILTER_STR_LEN, request, inst->userobj_filter,
+				fr_ldap_escape_func, NULL) < 0) {
+			REDEBUG("Unable to create filter");
+			return -1;
+		}
+	}
+
+	if (tmpl_expand(base_dn, base_dn_buff, LDAP_MAX_DN_STR_LEN, request,
+			inst->userobj_base_dn, fr_ldap_escape_func, NULL) < 0) {
+		REDEBUG("Unable to create base_dn");
+		return -1;
+	}
+
+	return 0;
+}
+
+/** Extract the DN of a user object from search results
+ *
+ * Adds the DN to the control list as LDAP-UserDN.
+ *
+ * @param[in] inst rlm_ldap configuration.
+ * @param[in] request Current request.
+ * @param[in] handle libldap handle to use when parsing the result.
+ * @param[in] result of a search for the user object, containing at least one entry.
+ * @param[out] rcode The status of the operation, one of the RLM_MODULE_* codes.
+ * @return The user's DN or NULL on error.
+ */
+char const *rlm_ldap_user_dn_from_result(rlm_ldap_t const *inst, REQUEST *request, LDAP *handle,
+					 LDAPMessage *result, rlm_rcode_t *rcode)
+{
+	VALUE_PAIR	*vp;
+	LDAPMessage	*entry;
+	int		ldap_errno;
+	int		cnt;
+	char		*dn;
+
+	*rcode = RLM_MODULE_FAIL;
+
+	/*
+	 *	Forbid the use of unsorted search results that
+	 *	contain multiple entries, as it's a potential
+	 *	security issue, and likely non deterministic.
+	 */
+	if (!inst->userobj_sort_ctrl) {
+		cnt = ldap_count_entries(handle, result);
+		if (cnt > 1) {
+			REDEBUG("Ambiguous search result, returned %i unsorted entries (should return 1 or 0).  "
+				"Enable sorting, or specify a more restrictive base_dn, filter or scope", cnt);
+			REDEBUG("The following entries were returned:");
+			RINDENT();
+			for (entry = ldap_first_entry(handle, result);
+			     entry;
+			     entry = ldap_next_entry(handle, entry)) {
+				dn = ldap_get_dn(handle, entry);
+				REDEBUG("%s", dn);
+				ldap_memfree(dn);
+			}
+			REXDENT();
+			*rcode = RLM_MODULE_INVALID;
+			return NULL;
+		}
+	}
+
+	entry = ldap_first_entry(handle, result);
+	if (!entry) {
+		ldap_get_option(handle, LDAP_OPT_RESULT_CODE, &ldap_errno);
+		REDEBUG("Failed retrieving entry: %s",
+			ldap_err2string(ldap_errno));
+
+		return NULL;
+	}
+
+	dn = ldap_get_dn(handle, entry);
+	if (!dn) {
+		ldap_get_option(handle, LDAP_OPT_RESULT_CODE, &ldap_errno);
+		REDEBUG("Retrieving object DN from entry failed: %s", ldap_err2string(ldap_errno));
+
+		return NULL;
+	}
+	fr_ldap_util_normalise_dn(dn, dn);
+
+	RDEBUG2("User object found at DN \"%s\"", dn);
+
+	MEM(pair_update_control(&vp, attr_ldap_userdn) >= 0);
+	fr_pair_value_strdup(vp, dn);
+	*rcode = RLM_MODULE_OK;
+
+	ldap_memfree(dn);
+
+	return vp->vp_strvalue;
+}
+
+/** Allocate a search for the current user's object, to run over a trunk
+ *
+ * @param[in] ctx to allocate the query in.
+ * @param[in] inst rlm_ldap configuration.
+ * @param[in] request Current request.
+ * @param[in] attrs Additional attributes to retrieve, may be NULL.
+ * @param[out] rcode The status of the operation, one of the RLM_MODULE_* codes.
+ * @return A new query, or NULL on error.
+ */
+fr_ldap_query_t *rlm_ldap_user_search_alloc(TALLOC_CTX *ctx, rlm_ldap_t const *inst, REQUEST *request,
+					    char const * const *attrs, rlm_rcode_t *rcode)
+{
+	char const	*filter;
+	char	    	filter_buff[LDAP_MAX_FILTER_STR_LEN];
+	char const	*base_dn;
+	char	    	base_dn_buff[LDAP_MAX_DN_STR_LEN];
+	LDAPControl	*serverctrls[] = { inst->userobj_sort_ctrl, NULL };
+
+	if (rlm_ldap_user_search_expand(&base_dn, base_dn_buff, &filter, filter_buff, inst, request) < 0) {
+		*rcode = RLM_MODULE_INVALID;
+		return NULL;
+	}
+
+	*rcode = RLM_MODULE_OK;
+
+	return fr_ldap_trunk_search_alloc(ctx, request, base_dn, inst->userobj_scope, filter, attrs, serverctrls);
+}
+
 /** Retrieve the DN of a user object
  *
  * Retrieves the DN of a user and adds it to the control list as LDAP-UserDN. Will also retrieve any
@@ -61,11 +200,9 @@ char const *rlm_ldap_find_user(rlm_ldap_t const *inst, REQUEST *request, fr_ldap
 
 	fr_ldap_rcode_t	status;
 	VALUE_PAIR	*vp = NULL;
-	LDAPMessage	*tmp_msg = NULL, *entry = NULL;
-	int		ldap_errno;
-	int		cnt;
-	char		*dn = NULL;
-	char const	*filter = NULL;
+	LDAPMessage	*tmp_msg = NULL;
+	char const	*dn;
+	char const	*filter;
 	char	    	filter_buff[LDAP_MAX_FILTER_STR_LEN];
 	char const	*base_dn;
 	char	    	base_dn_buff[LDAP_MAX_DN_STR_LEN];
@@ -115,19 +252,7 @@ char const *rlm_ldap_find_user(rlm_ldap_t const *inst, REQUEST *request, fr_ldap
 		(*pconn)->rebound = false;
 	}
 
-	if (inst->userobj_filter) {
-		if (tmpl_expand(&filter, filter_buff, sizeof(filter_buff), request, inst->userobj_filter,
-				fr_ldap_escape_func, NULL) < 0) {
-			REDEBUG("Unable to create filter");
-			*rcode = RLM_MODULE_INVALID;
-
-			return NULL;
-		}
-	}
-
-	if (tmpl_expand(&base_dn, base_dn_buff, sizeof(base_dn_buff), request,
-			inst->userobj_base_dn, fr_ldap_escape_func, NULL) < 0) {
-		REDEBUG("Unable to create base_dn");
+	if (rlm_ldap_user_search_expand(&base_dn, base_dn_buff, &filter, filter_buff, inst, request) < 0) {
 		*rcode = RLM_MODULE_INVALID;
 
 		return NULL;
@@ -151,64 +276,14 @@ char const *rlm_ldap_find_user(rlm_ldap_t const *inst, REQUEST *request, fr_ldap
 
 	fr_assert(*pconn);
 
-	/*
-	 *	Forbid the use of unsorted search results that
-	 *	contain multiple entries, as it's a potential
-	 *	security issue, and likely non deterministic.
-	 */
-	if (!inst->userobj_sort_ctrl) {
-		cnt = ldap_count_entries((*pconn)->handle, *result);
-		if (cnt > 1) {
-			REDEBUG("Ambiguous search result, returned %i unsorted entries (should return 1 or 0).  "
-				"Enable sorting, or specify a more restrictive base_dn, filter or scope", cnt);
-			REDEBUG("The following entries were returned:");
-			RINDENT();
-			for (entry = ldap_first_entry((*pconn)->handle, *result);
-			     entry;
-			     entry = ldap_next_entry((*pconn)->handle, entry)) {
-				dn = ldap_get_dn((*pconn)->handle, entry);
-				REDEBUG("%s", dn);
-				ldap_memfree(dn);
-			}
-			REXDENT();
-			*rcode = RLM_MODULE_INVALID;
-			goto finish;
-		}
-	}
-
-	entry = ldap_first_entry((*pconn)->handle, *result);
-	if (!entry) {
-		ldap_get_option((*pconn)->handle, LDAP_OPT_RESULT_CODE, &ldap_errno);
-		REDEBUG("Failed retrieving entry: %s",
-			ldap_err2string(ldap_errno));
-
-		goto finish;
-	}
-
-	dn = ldap_get_dn((*pconn)->handle, entry);
-	if (!dn) {
-		ldap_get_option((*pconn)->handle, LDAP_OPT_RESULT_CODE, &ldap_errno);
-		REDEBUG("Retrieving object DN from entry failed: %s", ldap_err2string(ldap_errno));
-
-		goto finish;
-	}
-	fr_ldap_util_normalise_dn(dn, dn);
-
-	RDEBUG2("User object found at DN \"%s\"", dn);
-
-	MEM(pair_update_control(&vp, attr_ldap_userdn) >= 0);
-	fr_pair_value_strdup(vp, dn);
-	*rcode = RLM_MODULE_OK;
-
-	ldap_memfree(dn);
+	dn = rlm_ldap_user_dn_from_result(inst, request, (*pconn)->handle, *result, rcode);
 
-finish:
 	if ((freeit || (*rcode != RLM_MODULE_OK)) && *result) {
 		ldap_msgfree(*result);
 		*result = NULL;
 	}
 
-	return vp ? vp->vp_strvalue : NULL;
+	return dn;
 }
 
 /** Check for presence of access attribute in result
@@ -105,6 +105,7 @@ typedef struct {
 		exfile_t		*ef;			//!< Exclusive file access handle.
 		bool			escape;			//!< Do filename escaping, yes / no.
 		xlat_escape_t		escape_func;		//!< Escape function.
+		exfile_buffer_conf_t	buffer;			//!< Buffered write configuration.
 	} file;
 
 	struct {
@@ -128,6 +129,8 @@ static const CONF_PARSER file_config[] = {
 	{ FR_CONF_OFFSET("permissions", FR_TYPE_UINT32, linelog_instance_t, file.permissions), .dflt = "0600" },
 	{ FR_CONF_OFFSET("group", FR_TYPE_STRING, linelog_instance_t, file.group_str) },
 	{ FR_CONF_OFFSET("escape_filenames", FR_TYPE_BOOL, linelog_instance_t, file.escape), .dflt = "no" },
+	{ FR_CONF_OFFSET("buffer", FR_TYPE_SUBSECTION, linelog_instance_t, file.buffer),
+	  .subcs = (void const *) exfile_buffer_config },
 	CONF_PARSER_TERMINATOR
 };
 
@@ -329,6 +332,11 @@ static int mod_instantiate(void *instance, CONF_SECTION *conf)
 			return -1;
 		}
 
+		if (exfile_buffer_enable(inst->file.ef, &inst->file.buffer) < 0) {
+			cf_log_perr(conf, "Failed enabling buffered writes");
+			return -1;
+		}
+
 		if (inst->file.group_str) {
 			char *endptr;
 
@@ -340,6 +348,7 @@ static int mod_instantiate(void *instance, CONF_SECTION *conf)
 					return -1;
 				}
 			}
+			exfile_set_group(inst->file.ef, inst->file.group);
 		}
 	}
 		break;
@@ -435,6 +444,19 @@ static size_t linelog_escape_func(UNUSED REQUEST *request,
 	return fr_snprint(out, outlen, in, -1, 0);
 }
 
+/** Resume after a durable write has been flushed
+ *
+ */
+static rlm_rcode_t linelog_flushed(UNUSED void *instance, UNUSED void *thread, REQUEST *request, void *rctx)
+{
+	if (exfile_wait_result(rctx) < 0) {
+		RPERROR("Failed writing log message");
+		return RLM_MODULE_FAIL;
+	}
+
+	return RLM_MODULE_OK;
+}
+
 /** Write a linelog message
  *
  * Write a log message to syslog or a flat file.
@@ -445,6 +467,7 @@ static size_t linelog_escape_func(UNUSED REQUEST *request,
  * @return
  *	- #RLM_MODULE_NOOP if no message to log.
  *	- #RLM_MODULE_FAIL if we failed writing the message.
+ *	- #RLM_MODULE_YIELD if we're waiting for a durable write to be flushed.
  *	- #RLM_MODULE_OK on success.
  */
 static rlm_rcode_t mod_do_linelog(void *instance, UNUSED void *thread, REQUEST *request) CC_HINT(nonnull);
@@ -635,8 +658,8 @@ build_vector:
 	switch (inst->log_dst) {
 	case LINELOG_DST_FILE:
 	{
-		int fd = -1;
-		char path[2048];
+		char		path[2048];
+		exfile_wait_t	*wait;
 
 		if (xlat_eval(path, sizeof(path), request, inst->file.name, inst->file.escape_func, NULL) < 0) {
 			return RLM_MODULE_FAIL;
@@ -654,28 +677,24 @@ build_vector:
 			*p = '/';
 		}
 
-		fd = exfile_open(inst->file.ef, request, path, inst->file.permissions);
-		if (fd < 0) {
-			RERROR("Failed to open %s: %s", path, fr_syserror(errno));
-			rcode = RLM_MODULE_FAIL;
-			goto finish;
-		}
-
-		if (inst->file.group_str && (chown(path, -1, inst->file.group) == -1)) {
-			RPWARN("Unable to change system group of \"%s\": %s", path, fr_strerror());
-		}
-
-		if (writev(fd, vector_p, vector_len) < 0) {
-			RERROR("Failed writing to \"%s\": %s", path, fr_syserror(errno));
-			exfile_close(inst->file.ef, request, fd);
+		/*
+		 *	With buffering enabled, the data is written
+		 *	out later, along with data from other requests.
+		 */
+		switch (exfile_writev(inst->file.ef, request, path, inst->file.permissions,
+				      vector_p, vector_len, &wait)) {
+		case 0:
+			break;
 
-			/* Assert on the extra fatal errors */
-			fr_assert((errno != EINVAL) && (errno != EFAULT));
+		case 1:
+			rcode = exfile_wait_yield(request, wait, linelog_flushed);
+			break;
 
-			return RLM_MODULE_FAIL;
+		default:
+			RPERROR("Failed writing to \"%s\"", path);
+			rcode = RLM_MODULE_FAIL;
+			break;
 		}
-
-		exfile_close(inst->file.ef, request, fd);
 	}
 		break;
 
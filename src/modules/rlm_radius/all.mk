@@ -1,2 +1 @@
-SUBMAKEFILES := rlm_radius.mk rlm_radius_udp.mk
-
+SUBMAKEFILES := rlm_radius.mk rlm_radius_udp.mk rlm_radius_udp_tests.mk track_tests.mk
@@ -41,6 +41,8 @@ static CONF_PARSER const status_check_config[] = {
 	{ FR_CONF_OFFSET("type", FR_TYPE_VOID, rlm_radius_t, status_check),
 	  .func = status_check_type_parse },
 
+	{ FR_CONF_OFFSET("extended_id", FR_TYPE_BOOL, rlm_radius_t, extended_id), .dflt = "no" },
+
 	CONF_PARSER_TERMINATOR
 };
 
@@ -54,13 +56,15 @@ static CONF_PARSER const status_check_update_config[] = {
 };
 
 /*
- *	Retransmission intervals for the packets we support.
+ *	Retransmission intervals for the packets we support, and
+ *	whether they're safe to send to two home servers.
  */
 static CONF_PARSER auth_config[] = {
 	{ FR_CONF_OFFSET("initial_rtx_time", FR_TYPE_TIME_DELTA, rlm_radius_t, retry[FR_CODE_ACCESS_REQUEST].irt), .dflt = STRINGIFY(2) },
 	{ FR_CONF_OFFSET("max_rtx_time", FR_TYPE_TIME_DELTA, rlm_radius_t, retry[FR_CODE_ACCESS_REQUEST].mrt), .dflt = STRINGIFY(16) },
 	{ FR_CONF_OFFSET("max_rtx_count", FR_TYPE_UINT32, rlm_radius_t, retry[FR_CODE_ACCESS_REQUEST].mrc), .dflt = STRINGIFY(5) },
 	{ FR_CONF_OFFSET("max_rtx_duration", FR_TYPE_TIME_DELTA, rlm_radius_t, retry[FR_CODE_ACCESS_REQUEST].mrd), .dflt = STRINGIFY(30) },
+	{ FR_CONF_OFFSET("hedge", FR_TYPE_BOOL, rlm_radius_t, hedge[FR_CODE_ACCESS_REQUEST]), .dflt = "yes" },
 	CONF_PARSER_TERMINATOR
 };
 
@@ -69,6 +73,7 @@ static CONF_PARSER acct_config[] = {
 	{ FR_CONF_OFFSET("max_rtx_time", FR_TYPE_TIME_DELTA, rlm_radius_t, retry[FR_CODE_ACCOUNTING_REQUEST].mrt), .dflt = STRINGIFY(5) },
 	{ FR_CONF_OFFSET("max_rtx_count", FR_TYPE_UINT32, rlm_radius_t, retry[FR_CODE_ACCOUNTING_REQUEST].mrc), .dflt = STRINGIFY(1) },
 	{ FR_CONF_OFFSET("max_rtx_duration", FR_TYPE_TIME_DELTA, rlm_radius_t, retry[FR_CODE_ACCOUNTING_REQUEST].mrd), .dflt = STRINGIFY(30) },
+	{ FR_CONF_OFFSET("hedge", FR_TYPE_BOOL, rlm_radius_t, hedge[FR_CODE_ACCOUNTING_REQUEST]), .dflt = "no" },
 	CONF_PARSER_TERMINATOR
 };
 
@@ -85,6 +90,7 @@ static CONF_PARSER coa_config[] = {
 	{ FR_CONF_OFFSET("max_rtx_time", FR_TYPE_TIME_DELTA, rlm_radius_t, retry[FR_CODE_COA_REQUEST].mrt), .dflt = STRINGIFY(16) },
 	{ FR_CONF_OFFSET("max_rtx_count", FR_TYPE_UINT32, rlm_radius_t, retry[FR_CODE_COA_REQUEST].mrc), .dflt = STRINGIFY(5) },
 	{ FR_CONF_OFFSET("max_rtx_duration", FR_TYPE_TIME_DELTA, rlm_radius_t, retry[FR_CODE_COA_REQUEST].mrd), .dflt = STRINGIFY(30) },
+	{ FR_CONF_OFFSET("hedge", FR_TYPE_BOOL, rlm_radius_t, hedge[FR_CODE_COA_REQUEST]), .dflt = "no" },
 	CONF_PARSER_TERMINATOR
 };
 
@@ -93,6 +99,7 @@ static CONF_PARSER disconnect_config[] = {
 	{ FR_CONF_OFFSET("max_rtx_time", FR_TYPE_TIME_DELTA, rlm_radius_t, retry[FR_CODE_DISCONNECT_REQUEST].mrt), .dflt = STRINGIFY(16) },
 	{ FR_CONF_OFFSET("max_rtx_count", FR_TYPE_UINT32, rlm_radius_t, retry[FR_CODE_DISCONNECT_REQUEST].mrc), .dflt = STRINGIFY(5) },
 	{ FR_CONF_OFFSET("max_rtx_duration", FR_TYPE_TIME_DELTA, rlm_radius_t, retry[FR_CODE_DISCONNECT_REQUEST].mrd), .dflt = STRINGIFY(30) },
+	{ FR_CONF_OFFSET("hedge", FR_TYPE_BOOL, rlm_radius_t, hedge[FR_CODE_DISCONNECT_REQUEST]), .dflt = "no" },
 	CONF_PARSER_TERMINATOR
 };
 
@@ -586,7 +593,11 @@ static int mod_bootstrap(void *instance, CONF_SECTION *conf)
 	 *	These limits are specific to RADIUS, and cannot be over-ridden
 	 */
 	FR_INTEGER_BOUND_CHECK("trunk.per_connection_max", inst->trunk_conf.max_req_per_conn, >=, 2);
-	FR_INTEGER_BOUND_CHECK("trunk.per_connection_max", inst->trunk_conf.max_req_per_conn, <=, 255);
+	if (!inst->extended_id) {
+		FR_INTEGER_BOUND_CHECK("trunk.per_connection_max", inst->trunk_conf.max_req_per_conn, <=, 255);
+	} else {
+		FR_INTEGER_BOUND_CHECK("trunk.per_connection_max", inst->trunk_conf.max_req_per_conn, <=, 65535);
+	}
 	FR_INTEGER_BOUND_CHECK("trunk.per_connection_target", inst->trunk_conf.target_req_per_conn, <=, inst->trunk_conf.max_req_per_conn / 2);
 
 	FR_TIME_DELTA_BOUND_CHECK("zombie_period", inst->zombie_period, >=, fr_time_delta_from_sec(1));
@@ -623,6 +634,16 @@ static int mod_bootstrap(void *instance, CONF_SECTION *conf)
 		cf_log_warn(conf, "Ignoring 'status_check = %s' due to 'replicate = true'",
 			    fr_packet_codes[inst->status_check]);
 		inst->status_check = 0;
+		inst->extended_id = false;
+	}
+
+	/*
+	 *	Extended IDs are negotiated by the server echoing
+	 *	FreeRADIUS-Extended-ID in its Status-Server reply.
+	 */
+	if (inst->extended_id && (inst->status_check != FR_CODE_STATUS_SERVER)) {
+		cf_log_err(conf, "Using 'extended_id = yes' requires 'status_check { type = Status-Server }'");
+		return -1;
 	}
 
 
@@ -72,9 +72,12 @@ struct rlm_radius_s {
 	vp_map_t		*status_check_map;	//!< attributes for the status-server checks
 	uint32_t		num_answers_to_alive;		//!< How many status check responses we need to
 							///< mark the connection as alive.
+	bool			extended_id;		//!< Negotiate extended IDs with Status-Server.
 
 	bool			allowed[FR_RADIUS_MAX_PACKET_CODE];
 	fr_retry_config_t      	retry[FR_RADIUS_MAX_PACKET_CODE];
+	bool			hedge[FR_RADIUS_MAX_PACKET_CODE];	//!< Whether the packet is safe to send
+									///< to a second home server.
 
 	fr_trunk_conf_t		trunk_conf;		//!< trunk configuration
 };
@@ -39,6 +39,35 @@ RCSID("$Id$")
 #include "rlm_radius.h"
 #include "track.h"
 
+/** Address of a home server
+ *
+ */
+typedef struct {
+	fr_ipaddr_t		ipaddr;			//!< IP of the home server.
+	uint16_t		port;			//!< Port of the home server.
+} udp_home_conf_t;
+
+/** How to choose between home servers
+ *
+ */
+typedef enum {
+	UDP_SELECT_PEAK_EWMA = 0,			//!< Lowest peak EWMA response time, weighted
+							///< by outstanding requests.
+	UDP_SELECT_LEAST_OUTSTANDING			//!< Fewest outstanding requests.
+} udp_select_t;
+
+static fr_table_num_sorted_t const udp_select_table[] = {
+	{ "least-outstanding",	UDP_SELECT_LEAST_OUTSTANDING	},
+	{ "peak-ewma",		UDP_SELECT_PEAK_EWMA		}
+};
+static size_t udp_select_table_len = NUM_ELEMENTS(udp_select_table);
+
+#define UDP_RTT_BUCKETS		32			//!< log2 microsecond buckets, so up to ~35 minutes.
+#define UDP_RTT_WINDOW		1024			//!< Age the histogram after this many samples.
+#define UDP_RTT_MIN_SAMPLES	32			//!< Don't hedge until we have this many samples.
+#define UDP_RTT_HALF_LIFE	((fr_time_delta_t)5 * NSEC)	//!< Halve the response time and timeout rate
+								///< this often, if there are no new samples.
+
 /** Static configuration for the module.
  *
  */
@@ -64,21 +93,66 @@ typedef struct {
 	bool			replicate;		//!< Copied from parent->replicate
 
 	fr_trunk_conf_t		*trunk_conf;		//!< trunk configuration
+
+	udp_home_conf_t		**home_server;		//!< Additional home servers, as configured.
+	udp_home_conf_t		*homes;			//!< All home servers, starting with ipaddr / port.
+	uint32_t		num_homes;		//!< Number of entries in homes.
+
+	char const		*select_name;		//!< How to choose between home servers.
+	udp_select_t		select;			//!< Parsed version of select_name.
+	uint32_t		hedge_percentile;	//!< Also send to a second home server if there's no
+							///< reply after this percentile of response times.
 } rlm_radius_udp_t;
 
+typedef struct udp_thread_s udp_thread_t;
+
+/** Per-thread state for one home server
+ *
+ */
 typedef struct {
+	udp_thread_t		*thread;		//!< Thread this belongs to.
+	udp_home_conf_t const	*conf;			//!< Address of the home server.
+
+	fr_trunk_t		*trunk;			//!< trunk handler
+
+	fr_time_delta_t		rtt;			//!< Peak EWMA of the response time.
+	double			timeout_rate;		//!< EWMA of the fraction of requests which timed out.
+	fr_time_t		last_sample;		//!< When rtt or timeout_rate were last updated.
+
+	uint32_t		rtt_hist[UDP_RTT_BUCKETS];	//!< Response times, in log2 microsecond buckets.
+	uint32_t		rtt_samples;		//!< Sum of rtt_hist.
+} udp_home_t;
+
+struct udp_thread_s {
 	fr_event_list_t		*el;			//!< Event list.
 
 	rlm_radius_udp_t const	*inst;			//!< our instance
 
-	fr_trunk_t		*trunk;			//!< trunk handler
-} udp_thread_t;
+	udp_home_t		**homes;		//!< One per home server.
+};
 
 typedef struct {
 	fr_trunk_request_t	*treq;
 	rlm_rcode_t		rcode;			//!< from the transport
+
+	REQUEST			*request;		//!< The request being proxied.
+	udp_thread_t		*thread;		//!< Thread the request is being proxied by.
+	udp_home_t		*home;			//!< Home server treq was sent to.
+	bool			require_ma;		//!< Copied to each udp_request_t.
+
+	fr_trunk_request_t	*hedge_treq;		//!< Copy sent to a second home server.
+	fr_event_timer_t const	*hedge_ev;		//!< When to send the copy.
 } udp_result_t;
 
+/** The home server which sent an Access-Challenge
+ *
+ * Saved with the session-state, so that the next packet in the
+ * conversation goes to the same home server.
+ */
+typedef struct {
+	uint32_t		home;			//!< Index into inst->homes.
+} udp_sticky_t;
+
 typedef struct udp_request_s udp_request_t;
 
 typedef struct {
@@ -104,6 +178,7 @@ typedef struct {
 
 	rlm_radius_udp_t const	*inst;			//!< Our module instance.
 	udp_thread_t		*thread;
+	udp_home_t		*home;			//!< Home server this connection is to.
 
 	uint8_t			last_id;		//!< Used when replicating to ensure IDs are distributed
 							///< evenly.
@@ -121,6 +196,9 @@ typedef struct {
 
 	radius_track_t		*tt;			//!< RADIUS ID tracking structure.
 
+	bool			ext_id_pending;		//!< The server agreed to extended IDs, but the
+							///< trunk hasn't been told yet.
+
 	fr_time_t		mrs_time;		//!< Most recent sent time which had a reply.
 	fr_time_t		last_reply;		//!< When we last received a reply.
 	fr_time_t		first_sent;		//!< first time we sent a packet since going idle
@@ -149,6 +227,7 @@ struct udp_request_s {
 	bool			require_ma;		//!< saved from the original packet.
 	bool			can_retransmit;		//!< can we retransmit this packet?
 	bool			status_check;		//!< is this packet a status check?
+	bool			timed_out;		//!< no reply before the retransmission limits.
 
 	VALUE_PAIR		*extra;			//!< VPs for debugging, like Proxy-State.
 
@@ -162,6 +241,16 @@ struct udp_request_s {
 	fr_retry_t		retry;			//!< retransmission timers
 };
 
+static const CONF_PARSER home_server_config[] = {
+	{ FR_CONF_OFFSET("ipaddr", FR_TYPE_COMBO_IP_ADDR, udp_home_conf_t, ipaddr), },
+	{ FR_CONF_OFFSET("ipv4addr", FR_TYPE_IPV4_ADDR, udp_home_conf_t, ipaddr) },
+	{ FR_CONF_OFFSET("ipv6addr", FR_TYPE_IPV6_ADDR, udp_home_conf_t, ipaddr) },
+
+	{ FR_CONF_OFFSET("port", FR_TYPE_UINT16, udp_home_conf_t, port) },
+
+	CONF_PARSER_TERMINATOR
+};
+
 static const CONF_PARSER module_config[] = {
 	{ FR_CONF_OFFSET("ipaddr", FR_TYPE_COMBO_IP_ADDR, rlm_radius_udp_t, dst_ipaddr), },
 	{ FR_CONF_OFFSET("ipv4addr", FR_TYPE_IPV4_ADDR, rlm_radius_udp_t, dst_ipaddr) },
@@ -183,6 +272,13 @@ static const CONF_PARSER module_config[] = {
 	{ FR_CONF_OFFSET("src_ipv4addr", FR_TYPE_IPV4_ADDR, rlm_radius_udp_t, src_ipaddr) },
 	{ FR_CONF_OFFSET("src_ipv6addr", FR_TYPE_IPV6_ADDR, rlm_radius_udp_t, src_ipaddr) },
 
+	{ FR_CONF_OFFSET("home_server", FR_TYPE_SUBSECTION | FR_TYPE_MULTI, rlm_radius_udp_t, home_server),
+	  .subcs_size = sizeof(udp_home_conf_t), .subcs_type = "udp_home_conf_t",
+	  .subcs = home_server_config, .ident2 = CF_IDENT_ANY },
+
+	{ FR_CONF_OFFSET("select", FR_TYPE_STRING, rlm_radius_udp_t, select_name), .dflt = "peak-ewma" },
+	{ FR_CONF_OFFSET("hedge_percentile", FR_TYPE_UINT32, rlm_radius_udp_t, hedge_percentile), .dflt = "0" },
+
 	CONF_PARSER_TERMINATOR
 };
 
@@ -198,12 +294,15 @@ static fr_dict_attr_t const *attr_acct_delay_time;
 static fr_dict_attr_t const *attr_error_cause;
 static fr_dict_attr_t const *attr_event_timestamp;
 static fr_dict_attr_t const *attr_extended_attribute_1;
+static fr_dict_attr_t const *attr_freeradius_extended_id;
 static fr_dict_attr_t const *attr_message_authenticator;
 static fr_dict_attr_t const *attr_nas_identifier;
 static fr_dict_attr_t const *attr_original_packet_code;
 static fr_dict_attr_t const *attr_proxy_state;
 static fr_dict_attr_t const *attr_response_length;
+static fr_dict_attr_t const *attr_state;
 static fr_dict_attr_t const *attr_user_password;
+static fr_dict_attr_t const *attr_vendor_specific;
 static fr_dict_attr_t const *attr_packet_type;
 
 extern fr_dict_attr_autoload_t rlm_radius_udp_dict_attr[];
@@ -212,12 +311,15 @@ fr_dict_attr_autoload_t rlm_radius_udp_dict_attr[] = {
 	{ .out = &attr_error_cause, .name = "Error-Cause", .type = FR_TYPE_UINT32, .dict = &dict_radius },
 	{ .out = &attr_event_timestamp, .name = "Event-Timestamp", .type = FR_TYPE_DATE, .dict = &dict_radius},
 	{ .out = &attr_extended_attribute_1, .name = "Extended-Attribute-1", .type = FR_TYPE_EXTENDED, .dict = &dict_radius},
+	{ .out = &attr_freeradius_extended_id, .name = "FreeRADIUS-Extended-ID", .type = FR_TYPE_UINT16, .dict = &dict_radius},
 	{ .out = &attr_message_authenticator, .name = "Message-Authenticator", .type = FR_TYPE_OCTETS, .dict = &dict_radius},
 	{ .out = &attr_nas_identifier, .name = "NAS-Identifier", .type = FR_TYPE_STRING, .dict = &dict_radius},
 	{ .out = &attr_original_packet_code, .name = "Original-Packet-Code", .type = FR_TYPE_UINT32, .dict = &dict_radius},
 	{ .out = &attr_proxy_state, .name = "Proxy-State", .type = FR_TYPE_OCTETS, .dict = &dict_radius},
 	{ .out = &attr_response_length, .name = "Response-Length", .type = FR_TYPE_UINT32, .dict = &dict_radius },
+	{ .out = &attr_state, .name = "State", .type = FR_TYPE_OCTETS, .dict = &dict_radius},
 	{ .out = &attr_user_password, .name = "User-Password", .type = FR_TYPE_STRING, .dict = &dict_radius},
+	{ .out = &attr_vendor_specific, .name = "Vendor-Specific", .type = FR_TYPE_VSA, .dict = &dict_radius},
 	{ .out = &attr_packet_type, .name = "Packet-Type", .type = FR_TYPE_UINT32, .dict = &dict_radius },
 	{ NULL }
 };
@@ -329,6 +431,257 @@ static void status_check_reset(udp_handle_t *h, udp_request_t *u)
 	udp_request_reset(u);
 }
 
+/** Return how much of the response time and timeout rate is left
+ *
+ * Samples only arrive for home servers we send requests to.  If a
+ * home server times out, it isn't chosen again, so there are no
+ * new samples to bring its response time back down.  Instead, the
+ * response time and timeout rate are halved every UDP_RTT_HALF_LIFE
+ * since the last sample.  Its cost eventually drops below that of
+ * the other home servers, and it's sent a request.
+ *
+ * @param[in] home	to decay the response time of.
+ * @param[in] now	the current time.
+ * @return 0..1, the fraction to multiply rtt and timeout_rate by.
+ */
+static double home_decay(udp_home_t const *home, fr_time_t now)
+{
+	fr_time_delta_t	elapsed;
+	double		decay;
+
+	if (!home->last_sample || (now <= home->last_sample)) return 1.0;
+
+	elapsed = now - home->last_sample;
+	if (elapsed >= (UDP_RTT_HALF_LIFE * 32)) return 0;
+
+	/*
+	 *	Halve for each full half life, then interpolate
+	 *	linearly within the current one.
+	 */
+	decay = 1.0 / ((uint64_t)1 << (elapsed / UDP_RTT_HALF_LIFE));
+
+	return decay * (1.0 - ((double)(elapsed % UDP_RTT_HALF_LIFE) / (2 * UDP_RTT_HALF_LIFE)));
+}
+
+/** Apply any decay since the last sample, before adding a new one
+ *
+ */
+static void home_decay_apply(udp_home_t *home, fr_time_t now)
+{
+	double decay = home_decay(home, now);
+
+	if (decay < 1.0) {
+		home->rtt = (fr_time_delta_t)(home->rtt * decay);
+		home->timeout_rate *= decay;
+	}
+
+	if (now > home->last_sample) home->last_sample = now;
+}
+
+/** Record the response time of a request
+ *
+ * @param[in] home	the request was sent to.
+ * @param[in] rtt	How long the home server took to reply, or
+ *			how long we waited before giving up.
+ * @param[in] now	When the reply was received, or we gave up.
+ */
+static void home_rtt_sample(udp_home_t *home, fr_time_delta_t rtt, fr_time_t now)
+{
+	uint64_t	usec = fr_time_delta_to_usec(rtt);
+	unsigned int	bucket = 0, i;
+
+	home_decay_apply(home, now);
+
+	/*
+	 *	Peak EWMA.  Jump straight to a higher response time,
+	 *	so that we react quickly to a slow home server, and
+	 *	decay slowly back down.
+	 */
+	if (rtt > home->rtt) {
+		home->rtt = rtt;
+	} else {
+		home->rtt -= (home->rtt - rtt) / 8;
+	}
+
+	while ((usec >>= 1) && (bucket < (UDP_RTT_BUCKETS - 1))) bucket++;
+
+	/*
+	 *	Age the histogram, so that the percentiles follow
+	 *	changes in the home server's response times.
+	 */
+	if (home->rtt_samples >= UDP_RTT_WINDOW) {
+		home->rtt_samples = 0;
+		for (i = 0; i < UDP_RTT_BUCKETS; i++) {
+			home->rtt_hist[i] /= 2;
+			home->rtt_samples += home->rtt_hist[i];
+		}
+	}
+
+	home->rtt_hist[bucket]++;
+	home->rtt_samples++;
+}
+
+/** Record whether a request timed out
+ *
+ */
+static inline void home_timeout_sample(udp_home_t *home, bool timed_out, fr_time_t now)
+{
+	home_decay_apply(home, now);
+
+	home->timeout_rate += ((timed_out ? 1.0 : 0.0) - home->timeout_rate) / 16;
+}
+
+/** Return a percentile of the home server's response times
+ *
+ * @param[in] home		to return the response time for.
+ * @param[in] percentile	1..99.
+ * @return
+ *	- 0 if we don't have enough samples.
+ *	- The response time, interpolated within its bucket.
+ */
+static fr_time_delta_t home_rtt_percentile(udp_home_t const *home, uint32_t percentile)
+{
+	uint64_t	target, seen = 0;
+	unsigned int	i;
+
+	if (home->rtt_samples < UDP_RTT_MIN_SAMPLES) return 0;
+
+	target = ((uint64_t)home->rtt_samples * percentile + 99) / 100;
+
+	for (i = 0; i < UDP_RTT_BUCKETS; i++) {
+		uint64_t low = (uint64_t)1 << i;
+
+		if ((seen + home->rtt_hist[i]) < target) {
+			seen += home->rtt_hist[i];
+			continue;
+		}
+
+		return fr_time_delta_from_usec(low + (low * (target - seen)) / home->rtt_hist[i]);
+	}
+
+	return 0;
+}
+
+/** Return the cost of sending a request to a home server
+ *
+ * Lower is better.  Outstanding requests come from the trunk, so
+ * they include requests in the backlog, and requests which are
+ * waiting for a reply.
+ */
+static double home_cost(rlm_radius_udp_t const *inst, udp_home_t const *home, fr_time_t now)
+{
+	double outstanding = home->trunk->req_alloc;
+	double decay;
+
+	switch (inst->select) {
+	case UDP_SELECT_LEAST_OUTSTANDING:
+		return outstanding;
+
+	case UDP_SELECT_PEAK_EWMA:
+	default:
+		break;
+	}
+
+	/*
+	 *	Home servers we haven't heard from yet have a zero
+	 *	response time, so they're tried first.  Timeouts
+	 *	are also included in the response time, so this
+	 *	only adds a small penalty for unreliable servers.
+	 *
+	 *	Both decay if we haven't heard from the home server
+	 *	recently.  Once it's chosen again, the outstanding
+	 *	request raises its cost, so it's only sent a few
+	 *	requests until it replies, or they time out.
+	 */
+	decay = home_decay(home, now);
+
+	return ((fr_time_delta_to_usec(home->rtt) * decay) + 1) * (outstanding + 1) /
+	       (1.0 - (home->timeout_rate * decay * 0.9));
+}
+
+/** Choose the best home server to send a request to
+ *
+ * @param[in] t		Thread to choose a home server from.
+ * @param[in] exclude	Don't choose this home server.  May be NULL.
+ * @return
+ *	- The home server with the lowest cost.
+ *	- NULL if there are no home servers other than exclude.
+ */
+static udp_home_t *home_select(udp_thread_t *t, udp_home_t const *exclude)
+{
+	udp_home_t	*best = NULL;
+	double		best_cost = 0;
+	size_t		i, num = talloc_array_length(t->homes);
+	fr_time_t	now;
+
+	if (num == 1) return (t->homes[0] == exclude) ? NULL : t->homes[0];
+
+	now = fr_time();
+	for (i = 0; i < num; i++) {
+		udp_home_t	*home = t->homes[i];
+		double		cost;
+
+		if (home == exclude) continue;
+
+		cost = home_cost(t->inst, home, now);
+		if (!best || (cost < best_cost)) {
+			best = home;
+			best_cost = cost;
+		}
+	}
+
+	return best;
+}
+
+/** Remember which home server sent an Access-Challenge
+ *
+ * @param[in] request	which received the Access-Challenge.
+ * @param[in] home	which sent it.
+ */
+static void home_sticky_set(REQUEST *request, udp_home_t const *home)
+{
+	rlm_radius_udp_t const	*inst = home->thread->inst;
+	udp_sticky_t		*sticky;
+
+	if ((inst->num_homes == 1) || !request->state_ctx) return;
+
+	MEM(sticky = talloc_zero(request->state_ctx, udp_sticky_t));
+	sticky->home = home->conf - inst->homes;
+
+	if (request_data_talloc_add(request, inst, 0, udp_sticky_t, sticky, true, false, true) < 0) {
+		RWDEBUG("Failed saving home server for the next round of the challenge");
+		talloc_free(sticky);
+	}
+}
+
+/** Find the home server which sent the Access-Challenge this request is answering
+ *
+ * @param[in] t		Thread to find the home server in.
+ * @param[in] request	to find the home server for.
+ * @return
+ *	- The home server the request must be sent to.
+ *	- NULL if the request can go to any home server.
+ */
+static udp_home_t *home_sticky_get(udp_thread_t *t, REQUEST *request)
+{
+	udp_sticky_t	*sticky;
+	udp_home_t	*home;
+
+	if (t->inst->num_homes == 1) return NULL;
+
+	if (request->packet->code != FR_CODE_ACCESS_REQUEST) return NULL;
+
+	sticky = request_data_get(request, t->inst, 0);
+	if (!sticky) return NULL;
+
+	home = NULL;
+	if (fr_pair_find_by_da(request->packet->vps, attr_state, TAG_ANY) &&
+	    (sticky->home < talloc_array_length(t->homes))) home = t->homes[sticky->home];
+	talloc_free(sticky);
+
+	return home;
+}
+
 /*
  *	Status-Server checks.  Manually build the packet, and
  *	all of its associated glue.
@@ -521,6 +874,44 @@ static void conn_status_check_again(fr_event_list_t *el, UNUSED fr_time_t now, v
 	}
 }
 
+/** Find FreeRADIUS-Extended-ID in a reply
+ *
+ * We need the extended ID to find the request, so we walk the raw
+ * packet instead of decoding it.  If there's more than one, we use
+ * the last, as we add ours after any which came from upstream.
+ *
+ * @param[out] ext_id	The extended ID echoed by the server.
+ * @param[in] packet	The reply.
+ * @param[in] packet_len	Length of the reply.
+ * @return
+ *	- 0 if the reply contains an extended ID.
+ *	- -1 if it doesn't.
+ */
+static int extended_id_find(uint16_t *ext_id, uint8_t const *packet, size_t packet_len)
+{
+	uint8_t const	*attr, *end;
+	uint32_t	vendor = fr_dict_vendor_num_by_da(attr_freeradius_extended_id);
+	int		ret = -1;
+
+	end = packet + packet_len;
+
+	for (attr = packet + RADIUS_HEADER_LENGTH;
+	     (attr + 2) <= end;
+	     attr += attr[1]) {
+		if ((attr[1] < 2) || ((attr + attr[1]) > end)) break;
+
+		if (attr[0] != attr_vendor_specific->attr) continue;
+		if (attr[1] != 10) continue;
+		if (fr_net_to_uint32(attr + 2) != vendor) continue;
+		if ((attr[6] != attr_freeradius_extended_id->attr) || (attr[7] != 4)) continue;
+
+		*ext_id = fr_net_to_uint16(attr + 8);
+		ret = 0;
+	}
+
+	return ret;
+}
+
 /** Read the incoming status-check response.  If it's correct mark the connection as connected
  *
  */
@@ -528,7 +919,7 @@ static void conn_readable_status_check(fr_event_list_t *el, UNUSED int fd, UNUSE
 {
 	fr_connection_t		*conn = talloc_get_type_abort(uctx, fr_connection_t);
 	udp_handle_t		*h = talloc_get_type_abort(conn->h, udp_handle_t);
-	fr_trunk_t		*trunk = h->thread->trunk;
+	fr_trunk_t		*trunk = h->home->trunk;
 	rlm_radius_t const 	*inst = h->inst->parent;
 	udp_request_t		*u = h->status_u;
 	ssize_t			slen;
@@ -580,6 +971,21 @@ static void conn_readable_status_check(fr_event_list_t *el, UNUSED int fd, UNUSE
 
 	fr_pair_list_free(&reply);	/* FIXME - Do something with these... */
 
+	/*
+	 *	The server echoed our extended ID, so it supports
+	 *	them.  The trunk is told in request_mux(), as that's
+	 *	where we have the trunk connection.
+	 */
+	if (inst->extended_id && !h->tt->extended) {
+		uint16_t ext_id;
+
+		if ((extended_id_find(&ext_id, h->buffer, (size_t)slen) == 0) && (ext_id == u->id)) {
+			DEBUG("%s - Server supports extended IDs on connection - %s", h->module_name, h->name);
+			radius_track_use_extended(h->tt);
+			h->ext_id_pending = true;
+		}
+	}
+
 	/*
 	 *	Process the error, and count this as a success.
 	 *	This is usually used for dynamic configuration
@@ -716,17 +1122,19 @@ static int _udp_handle_free(udp_handle_t *h)
  *
  * @param[out] h_out	Where to write the new file descriptor.
  * @param[in] conn	to initialise.
- * @param[in] uctx	A #udp_thread_t
+ * @param[in] uctx	A #udp_home_t
  */
 static fr_connection_state_t conn_init(void **h_out, fr_connection_t *conn, void *uctx)
 {
 	int			fd;
 	udp_handle_t		*h;
-	udp_thread_t		*thread = talloc_get_type_abort(uctx, udp_thread_t);
+	udp_home_t		*home = talloc_get_type_abort(uctx, udp_home_t);
+	udp_thread_t		*thread = home->thread;
 	uint16_t		i;
 
 	MEM(h = talloc_zero(conn, udp_handle_t));
 	h->thread = thread;
+	h->home = home;
 	h->inst = thread->inst;
 	h->module_name = h->inst->parent->name;
 	h->src_ipaddr = h->inst->src_ipaddr;
@@ -755,7 +1163,7 @@ static fr_connection_state_t conn_init(void **h_out, fr_connection_t *conn, void
 	/*
 	 *	Open the outgoing socket.
 	 */
-	fd = fr_socket_client_udp(&h->src_ipaddr, &h->src_port, &h->inst->dst_ipaddr, h->inst->dst_port, true);
+	fd = fr_socket_client_udp(&h->src_ipaddr, &h->src_port, &home->conf->ipaddr, home->conf->port, true);
 	if (fd < 0) {
 		PERROR("%s - Failed opening socket", h->module_name);
 	fail:
@@ -768,7 +1176,7 @@ static fr_connection_state_t conn_init(void **h_out, fr_connection_t *conn, void
 	 */
 	h->name = fr_asprintf(h, "proto udp local %pV port %u remote %pV port %u",
 			      fr_box_ipaddr(h->src_ipaddr), h->src_port,
-			      fr_box_ipaddr(h->inst->dst_ipaddr), h->inst->dst_port);
+			      fr_box_ipaddr(home->conf->ipaddr), home->conf->port);
 
 	talloc_set_destructor(h, _udp_handle_free);
 
@@ -933,7 +1341,8 @@ static fr_connection_t *thread_conn_alloc(fr_trunk_connection_t *tconn, fr_event
 					  char const *log_prefix, void *uctx)
 {
 	fr_connection_t		*conn;
-	udp_thread_t		*thread = talloc_get_type_abort(uctx, udp_thread_t);
+	udp_home_t		*home = talloc_get_type_abort(uctx, udp_home_t);
+	udp_thread_t		*thread = home->thread;
 
 	conn = fr_connection_alloc(tconn, el,
 				   &(fr_connection_funcs_t){
@@ -943,12 +1352,20 @@ static fr_connection_t *thread_conn_alloc(fr_trunk_connection_t *tconn, fr_event
 				   },
 				   conf,
 				   log_prefix,
-				   thread);
+				   home);
 	if (!conn) {
 		PERROR("%s - Failed allocating state handler for new connection", thread->inst->parent->name);
 		return NULL;
 	}
 
+	/*
+	 *	Until the server agrees to extended IDs, the
+	 *	connection can only have 255 packets outstanding.
+	 */
+	if (thread->inst->parent->extended_id && (thread->inst->trunk_conf->max_req_per_conn > UINT8_MAX)) {
+		fr_trunk_connection_max_req_set(tconn, UINT8_MAX);
+	}
+
 	return conn;
 }
 
@@ -1249,6 +1666,12 @@ static decode_fail_t decode(TALLOC_CTX *ctx, VALUE_PAIR **reply, uint8_t *respon
 	       fr_packet_codes[code], code, packet_len, h->name);
 	log_request_pair_list(L_DBG_LVL_2, request, *reply, NULL);
 
+	/*
+	 *	The extended ID is only meaningful between us and
+	 *	the server, so don't pass it on.
+	 */
+	fr_pair_delete_by_da(reply, attr_freeradius_extended_id);
+
 	*response_code = code;
 
 	/*
@@ -1270,6 +1693,7 @@ static int encode(rlm_radius_udp_t const *inst, REQUEST *request, udp_request_t
 	uint8_t			*msg = NULL;
 	int			message_authenticator = u->require_ma * (RADIUS_MESSAGE_AUTHENTICATOR_LENGTH + 2);
 	int			proxy_state = 6;
+	int			extended_id = 0;
 
 	fr_assert(inst->parent->allowed[u->code]);
 	fr_assert(!u->packet);
@@ -1339,17 +1763,27 @@ static int encode(rlm_radius_udp_t const *inst, REQUEST *request, udp_request_t
 		proxy_state = 0;
 	}
 
+	/*
+	 *	Packets with an extended ID carry it in the packet,
+	 *	so that the server can echo it.  So do status checks
+	 *	sent when the connection is opened, as that's how we
+	 *	find out if the server supports extended IDs.
+	 */
+	if (u->rr ? radius_track_entry_is_extended(u->rr) : (u->status_check && inst->parent->extended_id)) {
+		extended_id = 10;
+	}
+
 	/*
 	 *	We should have at mininum 64-byte packets, so don't
 	 *	bother doing run-time checks here.
 	 */
-	fr_assert(u->packet_len >= (size_t) (RADIUS_HEADER_LENGTH + proxy_state + message_authenticator));
+	fr_assert(u->packet_len >= (size_t) (RADIUS_HEADER_LENGTH + proxy_state + extended_id + message_authenticator));
 
 	/*
 	 *	Encode it, leaving room for Proxy-State and
 	 *	Message-Authenticator if necessary.
 	 */
-	packet_len = fr_radius_encode(u->packet, u->packet_len - (proxy_state + message_authenticator), NULL,
+	packet_len = fr_radius_encode(u->packet, u->packet_len - (proxy_state + extended_id + message_authenticator), NULL,
 				      inst->secret, talloc_array_length(inst->secret) - 1,
 				      u->code, id, request->packet->vps);
 	if (fr_pair_encode_is_error(packet_len)) {
@@ -1364,7 +1798,7 @@ static int encode(rlm_radius_udp_t const *inst, REQUEST *request, udp_request_t
 		size_t have;
 		size_t need;
 
-		have = u->packet_len - (proxy_state + message_authenticator);
+		have = u->packet_len - (proxy_state + extended_id + message_authenticator);
 		need = have - packet_len;
 
 		if (need > RADIUS_MAX_PACKET_SIZE) {
@@ -1380,7 +1814,7 @@ static int encode(rlm_radius_udp_t const *inst, REQUEST *request, udp_request_t
 	/*
 	 *	The encoded packet should NOT over-run the input buffer.
 	 */
-	fr_assert((size_t) (packet_len + proxy_state + message_authenticator) <= u->packet_len);
+	fr_assert((size_t) (packet_len + proxy_state + extended_id + message_authenticator) <= u->packet_len);
 
 	/*
 	 *	Add Proxy-State to the tail end of the packet.
@@ -1430,6 +1864,29 @@ static int encode(rlm_radius_udp_t const *inst, REQUEST *request, udp_request_t
 		fr_pair_add(&u->extra, vp);
 	}
 
+	/*
+	 *	Add FreeRADIUS-Extended-ID.  Like Proxy-State, it's
+	 *	specific to this packet, so it's not added to
+	 *	request->packet->vps.
+	 */
+	if (extended_id) {
+		uint8_t		*attr = u->packet + packet_len;
+		uint16_t	ext_id = u->rr ? u->rr->ext_id : id;
+		VALUE_PAIR	*vp;
+
+		attr[0] = (uint8_t)attr_vendor_specific->attr;
+		attr[1] = extended_id;
+		fr_net_from_uint32(attr + 2, fr_dict_vendor_num_by_da(attr_freeradius_extended_id));
+		attr[6] = (uint8_t)attr_freeradius_extended_id->attr;
+		attr[7] = 4;
+		fr_net_from_uint16(attr + 8, ext_id);
+		packet_len += extended_id;
+
+		MEM(vp = fr_pair_afrom_da(u->packet, attr_freeradius_extended_id));
+		vp->vp_uint16 = ext_id;
+		fr_pair_add(&u->extra, vp);
+	}
+
 	/*
 	 *	Add Message-Authenticator manually.
 	 *
@@ -1730,6 +2187,17 @@ static void request_timeout(fr_event_list_t *el, fr_time_t now, void *uctx)
 		break;
 	}
 
+	/*
+	 *	A timeout counts as a response at least as slow
+	 *	as the time we waited, so that home servers
+	 *	which drop packets aren't preferred.
+	 */
+	if (!u->status_check) {
+		home_rtt_sample(h->home, now - u->retry.start, now);
+		home_timeout_sample(h->home, true, now);
+		u->timed_out = true;
+	}
+
 	r->rcode = RLM_MODULE_FAIL;
 	fr_trunk_request_signal_complete(treq);
 
@@ -1756,6 +2224,16 @@ static void request_mux(fr_event_list_t *el,
 	 */
 	if (check_for_zombie(el, tconn, 0)) return;
 
+	/*
+	 *	The server agreed to extended IDs when the
+	 *	connection was opened, so lift the limit set in
+	 *	thread_conn_alloc().
+	 */
+	if (h->ext_id_pending) {
+		h->ext_id_pending = false;
+		fr_trunk_connection_max_req_set(tconn, 0);
+	}
+
 	/*
 	 *	Encode multiple packets in preparation
 	 *      for transmission with sendmmsg.
@@ -2323,6 +2801,7 @@ static void request_demux(fr_trunk_connection_t *tconn, fr_connection_t *conn, U
 		radius_track_entry_t	*rr;
 		decode_fail_t		reason;
 		uint8_t			code = 0;
+		uint16_t		ext_id;
 		VALUE_PAIR		*reply = NULL;
 
 		fr_time_t		now;
@@ -2353,8 +2832,16 @@ static void request_demux(fr_trunk_connection_t *tconn, fr_connection_t *conn, U
 		/*
 		 *	Note that we don't care about packet codes.  All
 		 *	packet codes share the same ID space.
+		 *
+		 *	Replies to packets sent with an extended ID echo
+		 *	it.  Packets sent before the server agreed to
+		 *	extended IDs use the static IDs.
 		 */
-		rr = radius_track_entry_find(h->tt, h->buffer[1], NULL);
+		if (h->tt->extended && (extended_id_find(&ext_id, h->buffer, (size_t)slen) == 0)) {
+			rr = radius_track_entry_find_extended(h->tt, h->buffer[1], ext_id);
+		} else {
+			rr = radius_track_entry_find(h->tt, h->buffer[1], NULL);
+		}
 		if (!rr) {
 			WARN("%s - Ignoring reply with ID %i that arrived too late",
 			     h->module_name, h->buffer[1]);
@@ -2393,12 +2880,28 @@ static void request_demux(fr_trunk_connection_t *tconn, fr_connection_t *conn, U
 		 *	this module for internal signalling.
 		 */
 		if (u == h->status_u) {
+			/*
+			 *	Status-Server replies are often the only
+			 *	samples we get from a home server which
+			 *	had stopped responding.
+			 */
+			if (u->retry.count == 1) home_rtt_sample(h->home, now - u->retry.start, now);
+			home_timeout_sample(h->home, false, now);
+
 			fr_pair_list_free(&reply);	/* Probably want to pass this to status_check_reply? */
 			status_check_reply(treq, now);
 			fr_trunk_request_signal_complete(treq);
 			continue;
 		}
 
+		/*
+		 *	Replies to retransmissions can't be matched
+		 *	to a particular transmission, so they don't
+		 *	tell us anything about the response time.
+		 */
+		if (u->retry.count == 1) home_rtt_sample(h->home, now - u->retry.start, now);
+		home_timeout_sample(h->home, false, now);
+
 		/*
 		 *	Handle any state changes, etc. needed by receiving a
 		 *	Protocol-Error reply packet.
@@ -2433,6 +2936,13 @@ static void request_demux(fr_trunk_connection_t *tconn, fr_connection_t *conn, U
 				vp->vp_uint32 = FR_CODE_ACCESS_CHALLENGE;
 				fr_pair_add(&request->reply->vps, vp);
 			}
+
+			/*
+			 *	The State is only valid at this home
+			 *	server, so the next packet has to go
+			 *	here too.
+			 */
+			home_sticky_set(request, h->home);
 		}
 
 		/*
@@ -2530,6 +3040,45 @@ static void request_conn_release_replicate(UNUSED fr_connection_t *conn, void *p
 	if (u->packet) udp_request_reset(u);
 }
 
+/** Forget about a treq which has finished
+ *
+ * If the request was also sent to another home server, either keep
+ * waiting for that copy, or cancel it.
+ *
+ * @param[in] r		the result shared by both copies.
+ * @param[in] u		the copy which has finished.
+ * @param[in] failed	whether the copy failed, or got a reply.
+ * @return
+ *	- true if the other copy is still outstanding, and the request
+ *	  should not be resumed yet.
+ *	- false if the request should be resumed.
+ */
+static bool udp_result_release(udp_result_t *r, udp_request_t *u, bool failed)
+{
+	fr_trunk_request_t	**done, **other;
+
+	if (r->treq && (r->treq->preq == u)) {
+		done = &r->treq;
+		other = &r->hedge_treq;
+	} else {
+		done = &r->hedge_treq;
+		other = &r->treq;
+	}
+
+	*done = NULL;
+
+	if (*other) {
+		if (failed) return true;
+
+		fr_trunk_request_signal_cancel(*other);
+		*other = NULL;
+	}
+
+	if (r->hedge_ev) (void) fr_event_timer_delete(&r->hedge_ev);
+
+	return false;
+}
+
 /** Write out a canned failure
  *
  */
@@ -2545,8 +3094,9 @@ static void request_fail(REQUEST *request, void *preq, void *rctx,
 
 	if (u->status_check) return;
 
+	if (udp_result_release(r, u, true)) return;
+
 	r->rcode = RLM_MODULE_FAIL;
-	r->treq = NULL;
 
 	unlang_interpret_resumable(request);
 }
@@ -2563,7 +3113,7 @@ static void request_complete(REQUEST *request, void *preq, void *rctx, UNUSED vo
 
 	if (u->status_check) return;
 
-	r->treq = NULL;
+	if (udp_result_release(r, u, u->timed_out)) return;
 
 	unlang_interpret_resumable(request);
 }
@@ -2614,7 +3164,7 @@ static void mod_signal(UNUSED void *instance, void *thread, UNUSED REQUEST *requ
 	 *	unlang_request_is_scheduled will return false
 	 *	(don't use it).
 	 */
-	if (!r->treq) {
+	if (!r->treq && !r->hedge_treq) {
 		talloc_free(rctx);
 		return;
 	}
@@ -2625,7 +3175,8 @@ static void mod_signal(UNUSED void *instance, void *thread, UNUSED REQUEST *requ
 	 *	trunk so it can clean up the treq.
 	 */
 	case FR_SIGNAL_CANCEL:
-		fr_trunk_request_signal_cancel(r->treq);
+		if (r->treq) fr_trunk_request_signal_cancel(r->treq);
+		if (r->hedge_treq) fr_trunk_request_signal_cancel(r->hedge_treq);
 		talloc_free(rctx);	/* Should be freed soon anyway, but better to be explicit */
 		return;
 
@@ -2642,8 +3193,10 @@ static void mod_signal(UNUSED void *instance, void *thread, UNUSED REQUEST *requ
 		 *	and we have no idea what state
 		 *	the request is in.
 		 */
-		if (check_for_zombie(t->el, r->treq->tconn, 0)) return;
-		fr_trunk_request_requeue(r->treq);
+		if (r->treq && !check_for_zombie(t->el, r->treq->tconn, 0)) fr_trunk_request_requeue(r->treq);
+		if (r->hedge_treq && !check_for_zombie(t->el, r->hedge_treq->tconn, 0)) {
+			fr_trunk_request_requeue(r->hedge_treq);
+		}
 		return;
 
 	default:
@@ -2662,13 +3215,80 @@ static int _udp_request_free(udp_request_t *u)
 	return 0;
 }
 
+/** Allocate a treq for a home server, and enqueue it
+ *
+ * @param[out] treq_out	Where to write the enqueued treq.
+ * @param[in] inst	of the module.
+ * @param[in] home	to send the request to.
+ * @param[in] r		result to write the response into.
+ * @param[in] request	to send.
+ * @return
+ *	- 0 on success.
+ *	- -1 on failure.
+ */
+static int udp_request_enqueue(fr_trunk_request_t **treq_out, rlm_radius_udp_t const *inst,
+			       udp_home_t *home, udp_result_t *r, REQUEST *request)
+{
+	fr_trunk_request_t	*treq;
+	udp_request_t		*u;
+
+	treq = fr_trunk_request_alloc(home->trunk, request);
+	if (!treq) return -1;
+
+	MEM(u = talloc_zero(treq, udp_request_t));
+
+	u->rr = NULL;
+	u->code = request->packet->code;
+	u->synchronous = inst->parent->synchronous;
+	u->priority = request->async->priority;	  /* cached for speed */
+	u->recv_time = request->async->recv_time; /* cached for speed */
+	u->require_ma = r->require_ma;
+
+	if (fr_trunk_request_enqueue(&treq, home->trunk, request, u, r) < 0) {
+		fr_assert(!u->rr && !u->packet);	/* Should not have been fed to the muxer */
+		fr_trunk_request_free(&treq);		/* Return to the free list */
+		return -1;
+	}
+
+	talloc_set_destructor(u, _udp_request_free);
+	*treq_out = treq;
+
+	return 0;
+}
+
+/** Send a copy of a slow request to another home server
+ *
+ * Whichever copy gets a reply first is used, and the other one
+ * is cancelled.
+ */
+static void hedge_send(UNUSED fr_event_list_t *el, UNUSED fr_time_t now, void *uctx)
+{
+	udp_result_t	*r = talloc_get_type_abort(uctx, udp_result_t);
+	REQUEST		*request = r->request;
+	udp_home_t	*home;
+
+	if (!r->treq) return;
+
+	home = home_select(r->thread, r->home);
+	if (!home) return;
+
+	RDEBUG("No reply from %pV port %u, also sending request to %pV port %u",
+	       fr_box_ipaddr(r->home->conf->ipaddr), r->home->conf->port,
+	       fr_box_ipaddr(home->conf->ipaddr), home->conf->port);
+
+	if (udp_request_enqueue(&r->hedge_treq, r->thread->inst, home, r, request) < 0) {
+		RWDEBUG("Failed sending request to %pV port %u",
+			fr_box_ipaddr(home->conf->ipaddr), home->conf->port);
+	}
+}
+
 static rlm_rcode_t mod_enqueue(void **rctx_out, void *instance, void *thread, REQUEST *request)
 {
 	rlm_radius_udp_t		*inst = talloc_get_type_abort(instance, rlm_radius_udp_t);
 	udp_thread_t			*t = talloc_get_type_abort(thread, udp_thread_t);
 	udp_result_t			*r;
-	udp_request_t			*u;
-	fr_trunk_request_t		*treq;
+	udp_home_t			*home;
+	fr_time_delta_t			delay;
 
 	fr_assert(request->packet->code > 0);
 	fr_assert(request->packet->code < FR_RADIUS_MAX_PACKET_CODE);
@@ -2678,19 +3298,10 @@ static rlm_rcode_t mod_enqueue(void **rctx_out, void *instance, void *thread, RE
 		return RLM_MODULE_NOOP;
 	}
 
-	treq = fr_trunk_request_alloc(t->trunk, request);
-	if (!treq) return RLM_MODULE_FAIL;
-
 	MEM(r = talloc_zero(request, udp_result_t));
-	MEM(u = talloc_zero(treq, udp_request_t));
-
-	u->rr = NULL;
-	u->code = request->packet->code;
-	u->synchronous = inst->parent->synchronous;
-	u->priority = request->async->priority;	  /* cached for speed */
-	u->recv_time = request->async->recv_time; /* cached for speed */
-
 	r->rcode = RLM_MODULE_FAIL;
+	r->request = request;
+	r->thread = t;
 
 	/*
 	 *	Make sure that we print out the actual encoded value
@@ -2703,19 +3314,62 @@ static rlm_rcode_t mod_enqueue(void **rctx_out, void *instance, void *thread, RE
 	 *	@todo - don't edit the input packet!
 	 */
 	if (fr_pair_find_by_da(request->packet->vps, attr_message_authenticator, TAG_ANY)) {
-		u->require_ma = true;
+		r->require_ma = true;
 		pair_delete_request(attr_message_authenticator);
 	}
 
-	if (fr_trunk_request_enqueue(&treq, t->trunk, request, u, r) < 0) {
-		fr_assert(!u->rr && !u->packet);	/* Should not have been fed to the muxer */
-		fr_trunk_request_free(&treq);		/* Return to the free list */
-		talloc_free(r);
-		return RLM_MODULE_FAIL;
+	/*
+	 *	A reply to an Access-Challenge has to go to the home
+	 *	server which sent the challenge.  No other home
+	 *	server will recognise the State, so we don't send
+	 *	the request anywhere else.
+	 */
+	home = home_sticky_get(t, request);
+	if (home) {
+		RDEBUG2("Sending request to %pV port %u, which sent the Access-Challenge",
+			fr_box_ipaddr(home->conf->ipaddr), home->conf->port);
+
+		if (udp_request_enqueue(&r->treq, inst, home, r, request) < 0) {
+			talloc_free(r);
+			return RLM_MODULE_FAIL;
+		}
+		r->home = home;
+
+		*rctx_out = r;
+
+		return RLM_MODULE_YIELD;
 	}
 
-	r->treq = treq;	/* Remember for signalling purposes */
-	talloc_set_destructor(u, _udp_request_free);
+	/*
+	 *	Send the request to the best home server, and if
+	 *	that fails, to the next best.
+	 */
+	home = home_select(t, NULL);
+	if (udp_request_enqueue(&r->treq, inst, home, r, request) < 0) {
+		home = home_select(t, home);
+		if (!home || (udp_request_enqueue(&r->treq, inst, home, r, request) < 0)) {
+			talloc_free(r);
+			return RLM_MODULE_FAIL;
+		}
+	}
+	r->home = home;
+
+	/*
+	 *	If the home server is slower than usual to reply,
+	 *	send a copy of the request to another one.  Only
+	 *	packets which are safe to send twice are copied,
+	 *	and never ones which are part of a conversation
+	 *	with a particular home server.
+	 */
+	if (inst->hedge_percentile && (inst->num_homes > 1) && inst->parent->hedge[request->packet->code] &&
+	    !fr_pair_find_by_da(request->packet->vps, attr_state, TAG_ANY)) {
+		delay = home_rtt_percentile(home, inst->hedge_percentile);
+		if (delay > 0) {
+			if (fr_event_timer_in(r, t->el, &r->hedge_ev, delay, hedge_send, r) < 0) {
+				RPWDEBUG("Failed inserting hedge timer");
+			}
+		}
+	}
 
 	*rctx_out = r;
 
@@ -2729,6 +3383,7 @@ static int mod_thread_instantiate(UNUSED CONF_SECTION const *cs, void *instance,
 {
 	rlm_radius_udp_t		*inst = talloc_get_type_abort(instance, rlm_radius_udp_t);
 	udp_thread_t			*thread = talloc_get_type_abort(tctx, udp_thread_t);
+	uint32_t			i;
 
 	static fr_trunk_io_funcs_t	io_funcs = {
 						.connection_alloc = thread_conn_alloc,
@@ -2761,9 +3416,24 @@ static int mod_thread_instantiate(UNUSED CONF_SECTION const *cs, void *instance,
 
 	thread->el = el;
 	thread->inst = inst;
-	thread->trunk = fr_trunk_alloc(thread, el, inst->replicate ? &io_funcs_replicate : &io_funcs,
-				       inst->trunk_conf, inst->parent->name, thread, false);
-	if (!thread->trunk) return -1;
+
+	/*
+	 *	One trunk per home server, so that each has its
+	 *	own connections, and its own statistics.
+	 */
+	MEM(thread->homes = talloc_zero_array(thread, udp_home_t *, inst->num_homes));
+	for (i = 0; i < inst->num_homes; i++) {
+		udp_home_t *home;
+
+		MEM(home = talloc_zero(thread->homes, udp_home_t));
+		home->thread = thread;
+		home->conf = &inst->homes[i];
+		home->trunk = fr_trunk_alloc(home, el, inst->replicate ? &io_funcs_replicate : &io_funcs,
+					     inst->trunk_conf, inst->parent->name, home, false);
+		if (!home->trunk) return -1;
+
+		thread->homes[i] = home;
+	}
 
 	return 0;
 }
@@ -2783,6 +3453,7 @@ static int mod_instantiate(void *instance, CONF_SECTION *conf)
 	rlm_radius_t		*parent = talloc_get_type_abort(dl_module_parent_data_by_child_data(instance),
 								rlm_radius_t);
 	rlm_radius_udp_t	*inst = talloc_get_type_abort(instance, rlm_radius_udp_t);
+	size_t			i, num_home_server;
 
 	if (!parent) {
 		ERROR("IO module cannot be instantiated directly");
@@ -2832,6 +3503,55 @@ static int mod_instantiate(void *instance, CONF_SECTION *conf)
 		return -1;
 	}
 
+	/*
+	 *	The primary home server is always first, followed
+	 *	by any others.  They all share the same secret,
+	 *	and connection settings.
+	 */
+	num_home_server = talloc_array_length(inst->home_server);
+	inst->num_homes = num_home_server + 1;
+	MEM(inst->homes = talloc_zero_array(inst, udp_home_conf_t, inst->num_homes));
+
+	inst->homes[0].ipaddr = inst->dst_ipaddr;
+	inst->homes[0].port = inst->dst_port;
+
+	for (i = 0; i < num_home_server; i++) {
+		udp_home_conf_t *home = inst->home_server[i];
+
+		if (home->ipaddr.af == AF_UNSPEC) {
+			cf_log_err(conf, "A value must be given for 'ipaddr' in each 'home_server'");
+			return -1;
+		}
+
+		if (home->ipaddr.af != inst->src_ipaddr.af) {
+			cf_log_err(conf, "The 'ipaddr' of each 'home_server' must be of the same "
+				   "address family as 'src_ipaddr'");
+			return -1;
+		}
+
+		if (!home->port) home->port = inst->dst_port;
+
+		inst->homes[i + 1] = *home;
+	}
+
+	inst->select = fr_table_value_by_str(udp_select_table, inst->select_name, -1);
+	if (inst->select == (udp_select_t) -1) {
+		cf_log_err(conf, "Invalid value \"%s\" for 'select'.  Expected \"least-outstanding\" "
+			   "or \"peak-ewma\"", inst->select_name);
+		return -1;
+	}
+
+	if (inst->hedge_percentile &&
+	    ((inst->hedge_percentile < 50) || (inst->hedge_percentile > 99))) {
+		cf_log_err(conf, "'hedge_percentile' must be 0, or between 50 and 99");
+		return -1;
+	}
+
+	/*
+	 *	There are no replies to wait for.
+	 */
+	if (inst->replicate) inst->hedge_percentile = 0;
+
 	/*
 	 *	Clamp max_packet_size first before checking recv_buff and send_buff
 	 */
@@ -0,0 +1,286 @@
+#include <freeradius-devel/util/acutest.h>
+
+#include "rlm_radius_udp.c"
+
+/** Allocate a thread with a number of home servers, but no trunks or connections
+ *
+ * Only the fields used to choose between home servers are filled in.
+ */
+static udp_thread_t *test_thread_alloc(TALLOC_CTX *ctx, udp_select_t select, uint32_t num)
+{
+	rlm_radius_udp_t	*inst;
+	udp_thread_t		*t;
+	uint32_t		i;
+
+	MEM(inst = talloc_zero(ctx, rlm_radius_udp_t));
+	inst->select = select;
+	inst->num_homes = num;
+	MEM(inst->homes = talloc_zero_array(inst, udp_home_conf_t, num));
+
+	MEM(t = talloc_zero(ctx, udp_thread_t));
+	t->inst = inst;
+	MEM(t->homes = talloc_zero_array(t, udp_home_t *, num));
+
+	for (i = 0; i < num; i++) {
+		udp_home_t *home;
+
+		MEM(home = talloc_zero(t->homes, udp_home_t));
+		home->thread = t;
+		home->conf = &inst->homes[i];
+		inst->homes[i].port = 1812 + i;
+		MEM(home->trunk = (fr_trunk_t *) talloc_zero(home, struct fr_trunk_pub_s));
+
+		t->homes[i] = home;
+	}
+
+	return t;
+}
+
+/** Set the number of outstanding requests the trunk reports
+ *
+ */
+static void test_outstanding_set(udp_home_t *home, uint64_t outstanding)
+{
+	memcpy(home->trunk, &(struct fr_trunk_pub_s){ .req_alloc = outstanding }, sizeof(struct fr_trunk_pub_s));
+}
+
+static void test_home_select_single(void)
+{
+	TALLOC_CTX	*ctx = talloc_init("test_home_select_single");
+	udp_thread_t	*t = test_thread_alloc(ctx, UDP_SELECT_PEAK_EWMA, 1);
+
+	TEST_CHECK(home_select(t, NULL) == t->homes[0]);
+	TEST_CHECK(home_select(t, t->homes[0]) == NULL);
+
+	talloc_free(ctx);
+}
+
+static void test_home_select_least_outstanding(void)
+{
+	TALLOC_CTX	*ctx = talloc_init("test_home_select_least_outstanding");
+	udp_thread_t	*t = test_thread_alloc(ctx, UDP_SELECT_LEAST_OUTSTANDING, 3);
+
+	test_outstanding_set(t->homes[0], 5);
+	test_outstanding_set(t->homes[1], 2);
+	test_outstanding_set(t->homes[2], 7);
+
+	/*
+	 *	Response times are ignored.
+	 */
+	t->homes[1]->rtt = fr_time_delta_from_sec(1);
+
+	TEST_CHECK(home_select(t, NULL) == t->homes[1]);
+	TEST_CHECK(home_select(t, t->homes[1]) == t->homes[0]);
+
+	test_outstanding_set(t->homes[2], 1);
+	TEST_CHECK(home_select(t, NULL) == t->homes[2]);
+
+	talloc_free(ctx);
+}
+
+static void test_home_select_peak_ewma(void)
+{
+	TALLOC_CTX	*ctx = talloc_init("test_home_select_peak_ewma");
+	udp_thread_t	*t = test_thread_alloc(ctx, UDP_SELECT_PEAK_EWMA, 3);
+
+	/*
+	 *	A fast home server with more outstanding requests
+	 *	beats a slow one with fewer.
+	 */
+	t->homes[0]->rtt = fr_time_delta_from_msec(10);
+	test_outstanding_set(t->homes[0], 1);
+	t->homes[1]->rtt = fr_time_delta_from_msec(1);
+	test_outstanding_set(t->homes[1], 3);
+	t->homes[2]->rtt = fr_time_delta_from_msec(30);
+	test_outstanding_set(t->homes[2], 0);
+
+	TEST_CHECK(home_select(t, NULL) == t->homes[1]);
+	TEST_CHECK(home_select(t, t->homes[1]) == t->homes[0]);
+
+	/*
+	 *	Until it has too many.
+	 */
+	test_outstanding_set(t->homes[1], 30);
+	TEST_CHECK(home_select(t, NULL) == t->homes[0]);
+
+	/*
+	 *	Home servers we haven't heard from are tried first.
+	 */
+	t->homes[2]->rtt = 0;
+	TEST_CHECK(home_select(t, NULL) == t->homes[2]);
+
+	talloc_free(ctx);
+}
+
+static void test_home_select_timeouts(void)
+{
+	TALLOC_CTX	*ctx = talloc_init("test_home_select_timeouts");
+	udp_thread_t	*t = test_thread_alloc(ctx, UDP_SELECT_PEAK_EWMA, 2);
+	fr_time_t	now = fr_time();
+	int		i;
+
+	t->homes[0]->rtt = t->homes[1]->rtt = fr_time_delta_from_msec(5);
+
+	/*
+	 *	Otherwise identical home servers, one of which
+	 *	has recently timed out.
+	 */
+	for (i = 0; i < 8; i++) {
+		home_timeout_sample(t->homes[0], true, now);
+		home_timeout_sample(t->homes[1], false, now);
+	}
+	TEST_CHECK(t->homes[0]->timeout_rate > 0);
+	TEST_CHECK(home_select(t, NULL) == t->homes[1]);
+
+	/*
+	 *	And recovered.
+	 */
+	for (i = 0; i < 256; i++) home_timeout_sample(t->homes[0], false, now);
+	home_timeout_sample(t->homes[1], true, now);
+	TEST_CHECK(home_select(t, NULL) == t->homes[0]);
+
+	talloc_free(ctx);
+}
+
+/** Check a percentile falls within the log2 bucket of the expected response time
+ *
+ */
+static void test_percentile_check(udp_home_t const *home, uint32_t percentile, fr_time_delta_t expected)
+{
+	fr_time_delta_t	rtt = home_rtt_percentile(home, percentile);
+	uint64_t	low = 1;
+
+	while ((low << 1) <= (uint64_t) fr_time_delta_to_usec(expected)) low <<= 1;
+
+	TEST_CHECK((fr_time_delta_to_usec(rtt) >= low) && (fr_time_delta_to_usec(rtt) <= (low << 1)));
+	TEST_MSG("p%u - expected %"PRIu64"..%"PRIu64"us, got %"PRIu64"us",
+		 percentile, low, low << 1, (uint64_t) fr_time_delta_to_usec(rtt));
+}
+
+static void test_home_rtt_percentile(void)
+{
+	TALLOC_CTX	*ctx = talloc_init("test_home_rtt_percentile");
+	udp_thread_t	*t = test_thread_alloc(ctx, UDP_SELECT_PEAK_EWMA, 1);
+	udp_home_t	*home = t->homes[0];
+	fr_time_t	now = fr_time();
+	int		i;
+
+	/*
+	 *	Not enough samples to hedge.
+	 */
+	for (i = 0; i < (UDP_RTT_MIN_SAMPLES - 1); i++) home_rtt_sample(home, fr_time_delta_from_usec(1000), now);
+	TEST_CHECK(home_rtt_percentile(home, 50) == 0);
+
+	home_rtt_sample(home, fr_time_delta_from_usec(1000), now);
+	test_percentile_check(home, 50, fr_time_delta_from_usec(1000));
+	test_percentile_check(home, 99, fr_time_delta_from_usec(1000));
+
+	/*
+	 *	One in ten is slow.
+	 */
+	for (i = UDP_RTT_MIN_SAMPLES; i < 900; i++) home_rtt_sample(home, fr_time_delta_from_usec(1000), now);
+	for (i = 0; i < 100; i++) home_rtt_sample(home, fr_time_delta_from_msec(100), now);
+
+	test_percentile_check(home, 50, fr_time_delta_from_usec(1000));
+	test_percentile_check(home, 85, fr_time_delta_from_usec(1000));
+	test_percentile_check(home, 95, fr_time_delta_from_msec(100));
+
+	talloc_free(ctx);
+}
+
+static void test_home_rtt_aging(void)
+{
+	TALLOC_CTX	*ctx = talloc_init("test_home_rtt_aging");
+	udp_thread_t	*t = test_thread_alloc(ctx, UDP_SELECT_PEAK_EWMA, 1);
+	udp_home_t	*home = t->homes[0];
+	fr_time_t	now = fr_time();
+	int		i;
+
+	for (i = 0; i < (UDP_RTT_WINDOW * 4); i++) home_rtt_sample(home, fr_time_delta_from_msec(100), now);
+	TEST_CHECK(home->rtt_samples <= UDP_RTT_WINDOW);
+	test_percentile_check(home, 50, fr_time_delta_from_msec(100));
+
+	/*
+	 *	The home server gets faster.  The old samples
+	 *	are aged out of the histogram.
+	 */
+	for (i = 0; i < (UDP_RTT_WINDOW * 4); i++) home_rtt_sample(home, fr_time_delta_from_usec(1000), now);
+	TEST_CHECK(home->rtt_samples <= UDP_RTT_WINDOW);
+	test_percentile_check(home, 95, fr_time_delta_from_usec(1000));
+
+	/*
+	 *	The peak EWMA decays towards the new response time.
+	 */
+	TEST_CHECK(home->rtt < fr_time_delta_from_msec(2));
+
+	/*
+	 *	But jumps straight to a higher one.
+	 */
+	home_rtt_sample(home, fr_time_delta_from_msec(50), now);
+	TEST_CHECK(home->rtt == fr_time_delta_from_msec(50));
+
+	talloc_free(ctx);
+}
+
+static void test_home_select_decay(void)
+{
+	TALLOC_CTX	*ctx = talloc_init("test_home_select_decay");
+	udp_thread_t	*t = test_thread_alloc(ctx, UDP_SELECT_PEAK_EWMA, 2);
+	udp_home_t	*home = t->homes[0];
+	fr_time_t	now = fr_time();
+	int		i;
+
+	/*
+	 *	A home server which timed out, and one which
+	 *	replied recently.
+	 */
+	home_rtt_sample(home, fr_time_delta_from_sec(30), now);
+	for (i = 0; i < 8; i++) home_timeout_sample(home, true, now);
+	home_rtt_sample(t->homes[1], fr_time_delta_from_msec(5), now);
+	home_timeout_sample(t->homes[1], false, now);
+	TEST_CHECK(home_select(t, NULL) == t->homes[1]);
+
+	/*
+	 *	Nothing is decayed without time passing.
+	 */
+	TEST_CHECK(home_decay(home, now) == 1.0);
+	TEST_CHECK(home_decay(home, now - NSEC) == 1.0);
+
+	TEST_CASE("The response time halves every half life");
+	TEST_CHECK(home_decay(home, now + UDP_RTT_HALF_LIFE) == 0.5);
+	TEST_CHECK(home_decay(home, now + (UDP_RTT_HALF_LIFE * 3)) == 0.125);
+	TEST_CHECK(home_decay(home, now + (UDP_RTT_HALF_LIFE / 2)) == 0.75);
+	TEST_CHECK(home_decay(home, now + (UDP_RTT_HALF_LIFE * 64)) == 0);
+
+	TEST_CASE("A home server which timed out is eventually tried again");
+	home->last_sample = now - (UDP_RTT_HALF_LIFE * 20);
+	TEST_CHECK(home_select(t, NULL) == home);
+
+	TEST_CASE("Decay is applied before new samples");
+	home_rtt_sample(home, fr_time_delta_from_msec(1), now);
+	TEST_CHECK(home->rtt < fr_time_delta_from_msec(2));
+	TEST_MSG("Expected < 2ms, got %"PRId64"ns", home->rtt);
+	TEST_CHECK(home->timeout_rate < 0.01);
+	TEST_CHECK(home->last_sample == now);
+
+	talloc_free(ctx);
+}
+
+TEST_LIST = {
+	/*
+	 *	Home server selection
+	 */
+	{ "home_select - Single home server",		test_home_select_single },
+	{ "home_select - Least outstanding",		test_home_select_least_outstanding },
+	{ "home_select - Peak EWMA",			test_home_select_peak_ewma },
+	{ "home_select - Timeouts",			test_home_select_timeouts },
+	{ "home_select - Decay",			test_home_select_decay },
+
+	/*
+	 *	Response time percentiles
+	 */
+	{ "home_rtt_percentile - Percentiles",		test_home_rtt_percentile },
+	{ "home_rtt_percentile - Aging",		test_home_rtt_aging },
+
+	{ NULL }
+};
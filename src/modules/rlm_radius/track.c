@@ -63,6 +63,41 @@ radius_track_t *radius_track_alloc(TALLOC_CTX *ctx)
 }
 
 
+/** Allocate another page of extended IDs
+ *
+ * Each page uses every header ID once, and the entries are added
+ * to the tail of the free list, so IDs are still allocated in least
+ * recently used order.
+ *
+ * @param[in] tt	The radius_track_t tracking table.
+ * @return
+ *	- 0 on success.
+ *	- -1 if all of the extended IDs have been allocated.
+ */
+static int track_ext_page_alloc(radius_track_t *tt)
+{
+	radius_track_entry_t	*page;
+	unsigned int		hi, i;
+
+	if (tt->num_ext > UINT8_MAX) return -1;
+
+	hi = tt->num_ext++;
+	MEM(page = talloc_zero_array(tt, radius_track_entry_t, UINT8_MAX + 1));
+	tt->ext[hi] = page;
+
+	for (i = 0; i <= UINT8_MAX; i++) {
+		page[i].id = i;
+		page[i].ext_id = (hi << 8) | i;
+#ifndef NDEBUG
+		page[i].file = __FILE__;
+		page[i].line = __LINE__;
+#endif
+		fr_dlist_insert_tail(&tt->free_list, &page[i]);
+	}
+
+	return 0;
+}
+
 /** Compare two radius_track_entry_t
  *
  */
@@ -130,7 +165,7 @@ retry:
 		 *	don't use it".  Ensure that we only return IDs
 		 *	which are in the static array.
 		 */
-		if (!tt->use_authenticator && (te != &tt->id[te->id])) {
+		if (!tt->use_authenticator && !tt->extended && (te != &tt->id[te->id])) {
 			talloc_free(te);
 			goto retry;
 		}
@@ -138,6 +173,18 @@ retry:
 		goto done;
 	}
 
+	/*
+	 *	The server supports extended IDs, so we can add
+	 *	another 256 entries.
+	 */
+	if (tt->extended) {
+		if (track_ext_page_alloc(tt) < 0) {
+			fr_strerror_printf("No free entries");
+			return -1;
+		}
+		goto retry;
+	}
+
 	/*
 	 *	There are no free entries, and we can't use the
 	 *	Request Authenticator.  Oh well...
@@ -243,9 +290,23 @@ int radius_track_entry_release(
 		 */
 		if (tt->subtree[te->id]) (void) rbtree_deletebydata(tt->subtree[te->id], te);
 
+		/*
+		 *	Static IDs aren't re-used once the server
+		 *	has agreed to extended IDs.
+		 */
+		if (tt->extended) {
+			*te_to_free = NULL;
+			return 0;
+		}
+
 		goto done;
 	}
 
+	/*
+	 *	Extended entries are freed with the table.
+	 */
+	if (radius_track_entry_is_extended(te)) goto done;
+
 	/*
 	 *	At this point, it MUST be talloc'd.
 	 */
@@ -308,7 +369,7 @@ int radius_track_entry_update(radius_track_entry_t *te, uint8_t const *vector)
 	 *	@todo - gracefully handle fallback if the server screws up.
 	 */
 	if (!tt->use_authenticator) {
-		fr_assert(te == &tt->id[te->id]);
+		fr_assert((te == &tt->id[te->id]) || radius_track_entry_is_extended(te));
 		return 0;
 	}
 
@@ -410,6 +471,61 @@ void radius_track_use_authenticator(radius_track_t *tt, bool flag)
 	tt->use_authenticator = flag;
 }
 
+/** Find a tracking entry from an extended ID
+ *
+ * @param tt		The radius_track_t tracking table
+ * @param packet_id    	The ID from the RADIUS header
+ * @param ext_id	The extended ID echoed by the server
+ * @return
+ *	- NULL on "not found"
+ *	- radius_track_entry_t on success
+ */
+radius_track_entry_t *radius_track_entry_find_extended(radius_track_t *tt, uint8_t packet_id, uint16_t ext_id)
+{
+	radius_track_entry_t *page, *te;
+
+	(void) talloc_get_type_abort(tt, radius_track_t);
+
+	page = tt->ext[ext_id >> 8];
+	if (!page) return NULL;
+
+	te = &page[ext_id & 0xff];
+
+	/*
+	 *	Not in use, or the server mangled the ID.
+	 */
+	if (!te->request || (te->id != packet_id)) return NULL;
+
+	return te;
+}
+
+/** Switch to extended IDs
+ *
+ * Called once the server has agreed to echo the extended ID.  New
+ * entries are allocated from pages of extended IDs, which are found
+ * with #radius_track_entry_find_extended.  Static entries which are
+ * in use can still be found with #radius_track_entry_find.
+ *
+ * @param tt		The radius_track_t tracking table
+ */
+void radius_track_use_extended(radius_track_t *tt)
+{
+	radius_track_entry_t *te;
+
+	(void) talloc_get_type_abort(tt, radius_track_t);
+
+	if (tt->extended) return;
+
+	fr_assert(!tt->use_authenticator);
+
+	tt->extended = true;
+
+	/*
+	 *	Stop handing out static IDs.
+	 */
+	while ((te = fr_dlist_head(&tt->free_list))) fr_dlist_remove(&tt->free_list, te);
+}
+
 #ifndef NDEBUG
 /** Print out the state of every tracking entry
  *
@@ -443,5 +559,27 @@ void radius_track_state_log(fr_log_t const *log, fr_log_type_t log_type, char co
 
 		if (extra) extra(log, log_type, file, line, entry);
 	}
+
+	/*
+	 *	There may be tens of thousands of extended
+	 *	entries, so only print the ones which are in use.
+	 */
+	for (i = 0; i < tt->num_ext; i++) {
+		size_t j;
+
+		for (j = 0; j <= UINT8_MAX; j++) {
+			radius_track_entry_t	*entry;
+
+			entry = &tt->ext[i][j];
+			if (!entry->request) continue;
+
+			fr_log(log, log_type, file, line,
+			       "[ext %u] %"PRIu64 " - Allocated at %s:%u to request %p (%s), uctx %p",
+			       entry->ext_id, entry->operation,
+			       entry->file, entry->line, entry->request, entry->request->name, entry->uctx);
+
+			if (extra) extra(log, log_type, file, line, entry);
+		}
+	}
 }
 #endif
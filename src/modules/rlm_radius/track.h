@@ -46,6 +46,7 @@ struct radius_track_entry_s {
 
 	uint8_t		code;			//!< packet code (sigh)
 	uint8_t		id;			//!< our ID
+	uint16_t	ext_id;			//!< our extended ID, if allocated from an extended page.
 
 	union {
 		fr_dlist_t	entry;					//!< For free list.
@@ -71,6 +72,12 @@ struct radius_track_s {
 
 	rbtree_t	*subtree[UINT8_MAX + 1];	//!< for Original-Request-Authenticator
 
+	bool		extended;		//!< whether the server supports extended IDs.
+	radius_track_entry_t	*ext[UINT8_MAX + 1];	//!< Pages of extended IDs, indexed by the high
+							///< 8 bits of the extended ID.  Allocated as
+							///< needed, so memory grows with peak load.
+	unsigned int	num_ext;		//!< number of extended pages allocated.
+
 #ifndef NDEBUG
 	uint64_t	operation;		//!< Incremented each alloc and de-alloc
 #endif
@@ -118,4 +125,19 @@ int			radius_track_entry_update(radius_track_entry_t *te,
 radius_track_entry_t	*radius_track_entry_find(radius_track_t *tt, uint8_t packet_id,
 						 uint8_t const *vector) CC_HINT(nonnull(1));
 
+radius_track_entry_t	*radius_track_entry_find_extended(radius_track_t *tt, uint8_t packet_id,
+							  uint16_t ext_id) CC_HINT(nonnull);
+
 void			radius_track_use_authenticator(radius_track_t *te, bool flag) CC_HINT(nonnull);
+
+void			radius_track_use_extended(radius_track_t *tt) CC_HINT(nonnull);
+
+/** Whether an entry was allocated from an extended page
+ *
+ */
+static inline bool radius_track_entry_is_extended(radius_track_entry_t const *te)
+{
+	radius_track_entry_t const *page = te->tt->ext[te->ext_id >> 8];
+
+	return page && (te == &page[te->ext_id & 0xff]);
+}
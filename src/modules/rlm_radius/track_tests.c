@@ -0,0 +1,174 @@
+#include <freeradius-devel/util/acutest.h>
+
+#include "track.c"
+
+#define TEST_MAX_EXTENDED	((UINT8_MAX + 1) * (UINT8_MAX + 1))
+
+/** Reserve an entry, checking that the reservation succeeded
+ *
+ */
+static radius_track_entry_t *test_reserve(radius_track_t *tt, REQUEST *request)
+{
+	radius_track_entry_t *te = NULL;
+
+	TEST_CHECK(radius_track_entry_reserve(&te, NULL, tt, request, FR_CODE_ACCESS_REQUEST, NULL) == 0);
+	TEST_CHECK(te != NULL);
+
+	return te;
+}
+
+/** Without extended IDs, only the 256 static entries are used
+ *
+ */
+static void test_static(void)
+{
+	TALLOC_CTX		*ctx = talloc_init("test_static");
+	REQUEST			*request = request_local_alloc(ctx);
+	radius_track_t		*tt;
+	radius_track_entry_t	*te[UINT8_MAX + 1], *extra = NULL;
+	size_t			i;
+
+	tt = radius_track_alloc(ctx);
+
+	for (i = 0; i < NUM_ELEMENTS(te); i++) {
+		te[i] = test_reserve(tt, request);
+		TEST_CHECK(te[i] == &tt->id[te[i]->id]);
+		TEST_CHECK(!radius_track_entry_is_extended(te[i]));
+	}
+	TEST_CHECK(tt->num_requests == NUM_ELEMENTS(te));
+
+	TEST_CHECK(radius_track_entry_reserve(&extra, NULL, tt, request, FR_CODE_ACCESS_REQUEST, NULL) < 0);
+	TEST_CHECK(extra == NULL);
+
+	for (i = 0; i < NUM_ELEMENTS(te); i++) {
+		uint8_t id = te[i]->id;
+
+		TEST_CHECK(radius_track_entry_find(tt, id, NULL) == te[i]);
+		TEST_CHECK(radius_track_entry_release(&te[i]) == 0);
+		TEST_CHECK(radius_track_entry_find(tt, id, NULL) == NULL);
+	}
+	TEST_CHECK(tt->num_requests == 0);
+	TEST_CHECK(tt->num_ext == 0);
+
+	talloc_free(ctx);
+}
+
+/** Pages of extended IDs are allocated as needed, and entries are found by their extended ID
+ *
+ */
+static void test_extended(void)
+{
+	TALLOC_CTX		*ctx = talloc_init("test_extended");
+	REQUEST			*request = request_local_alloc(ctx);
+	radius_track_t		*tt;
+	radius_track_entry_t	*old, *te[1000];
+	size_t			i, j;
+
+	tt = radius_track_alloc(ctx);
+
+	/*
+	 *	Outstanding before the server agreed to
+	 *	extended IDs.
+	 */
+	old = test_reserve(tt, request);
+
+	radius_track_use_extended(tt);
+	TEST_CHECK(fr_dlist_num_elements(&tt->free_list) == 0);
+
+	for (i = 0; i < NUM_ELEMENTS(te); i++) {
+		te[i] = test_reserve(tt, request);
+		TEST_CHECK(radius_track_entry_is_extended(te[i]));
+		TEST_CHECK(te[i]->id == (te[i]->ext_id & 0xff));
+	}
+	TEST_CHECK(tt->num_ext == (NUM_ELEMENTS(te) + UINT8_MAX) / (UINT8_MAX + 1));
+
+	for (i = 0; i < NUM_ELEMENTS(te); i++) {
+		TEST_CHECK(radius_track_entry_find_extended(tt, te[i]->id, te[i]->ext_id) == te[i]);
+		TEST_MSG("ext_id %u", te[i]->ext_id);
+
+		/*
+		 *	Server mangled the header ID.
+		 */
+		TEST_CHECK(radius_track_entry_find_extended(tt, te[i]->id + 1, te[i]->ext_id) == NULL);
+
+		for (j = 0; j < i; j++) if (!TEST_CHECK(te[i]->ext_id != te[j]->ext_id)) break;
+	}
+
+	/*
+	 *	The old entry can still be found, but isn't reused
+	 *	once it's released.
+	 */
+	TEST_CHECK(!radius_track_entry_is_extended(old));
+	TEST_CHECK(radius_track_entry_find(tt, old->id, NULL) == old);
+	TEST_CHECK(radius_track_entry_release(&old) == 0);
+	TEST_CHECK(fr_dlist_num_elements(&tt->free_list) == (tt->num_ext * (UINT8_MAX + 1)) - NUM_ELEMENTS(te));
+
+	for (i = 0; i < NUM_ELEMENTS(te); i++) {
+		uint8_t		id = te[i]->id;
+		uint16_t	ext_id = te[i]->ext_id;
+
+		TEST_CHECK(radius_track_entry_release(&te[i]) == 0);
+		TEST_CHECK(radius_track_entry_find_extended(tt, id, ext_id) == NULL);
+	}
+	TEST_CHECK(tt->num_requests == 0);
+
+	/*
+	 *	Released entries are reused, rather than allocating
+	 *	more pages.
+	 */
+	i = tt->num_ext;
+	te[0] = test_reserve(tt, request);
+	TEST_CHECK(radius_track_entry_is_extended(te[0]));
+	TEST_CHECK(tt->num_ext == i);
+	TEST_CHECK(radius_track_entry_release(&te[0]) == 0);
+
+	/*
+	 *	Pages which haven't been allocated.
+	 */
+	TEST_CHECK(radius_track_entry_find_extended(tt, 0, UINT16_MAX) == NULL);
+
+	talloc_free(ctx);
+}
+
+/** Every extended ID can be used, and no more
+ *
+ */
+static void test_extended_exhaust(void)
+{
+	TALLOC_CTX		*ctx = talloc_init("test_extended_exhaust");
+	REQUEST			*request = request_local_alloc(ctx);
+	radius_track_t		*tt;
+	radius_track_entry_t	**te, *extra = NULL;
+	size_t			i, reserved;
+
+	tt = radius_track_alloc(ctx);
+	radius_track_use_extended(tt);
+
+	MEM(te = talloc_zero_array(ctx, radius_track_entry_t *, TEST_MAX_EXTENDED));
+
+	for (reserved = 0; reserved < TEST_MAX_EXTENDED; reserved++) {
+		if (radius_track_entry_reserve(&te[reserved], NULL, tt, request,
+					       FR_CODE_ACCESS_REQUEST, NULL) < 0) break;
+	}
+	TEST_CHECK(reserved == TEST_MAX_EXTENDED);
+	TEST_MSG("Reserved %zu entries", reserved);
+	TEST_CHECK(tt->num_ext == UINT8_MAX + 1);
+
+	TEST_CHECK(radius_track_entry_reserve(&extra, NULL, tt, request, FR_CODE_ACCESS_REQUEST, NULL) < 0);
+
+	for (i = 0; i < reserved; i++) {
+		TEST_CHECK(radius_track_entry_find_extended(tt, te[i]->id, te[i]->ext_id) == te[i]);
+		TEST_CHECK(radius_track_entry_release(&te[i]) == 0);
+	}
+	TEST_CHECK(tt->num_requests == 0);
+
+	talloc_free(ctx);
+}
+
+TEST_LIST = {
+	{ "static",			test_static },
+	{ "extended",			test_extended },
+	{ "extended_exhaust",		test_extended_exhaust },
+
+	{ NULL }
+};
@@ -31,15 +31,14 @@ RCSID("$Id$")
 #include <freeradius-devel/server/base.h>
 #include <freeradius-devel/server/module.h>
 #include <freeradius-devel/server/modpriv.h>
+#include <freeradius-devel/unlang/base.h>
 #include <freeradius-devel/util/debug.h>
 
 #include <freeradius-devel/redis/base.h>
 #include <freeradius-devel/redis/cluster.h>
+#include <freeradius-devel/redis/pipeline.h>
 
-static CONF_PARSER module_config[] = {
-	REDIS_COMMON_CONFIG,
-	CONF_PARSER_TERMINATOR
-};
+#include <ctype.h>
 
 /** rlm_redis module instance
  *
@@ -51,8 +50,55 @@ typedef struct {
 	char const		*name;		//!< Instance name.
 
 	fr_redis_cluster_t	*cluster;	//!< Redis cluster.
+
+	bool			async;		//!< Run %{redis:...} over the per-thread pipeline
+						///< instead of the blocking connection pool.
+	fr_trunk_conf_t		trunk_conf;	//!< Configuration for the per-thread trunks.
+	fr_redis_io_conf_t	io_conf;	//!< Template for the I/O configuration of each trunk.
 } rlm_redis_t;
 
+/** rlm_redis thread instance, only used when async is enabled
+ *
+ */
+typedef struct {
+	fr_redis_cluster_thread_t *cluster_thread;	//!< Trunks for the cluster's nodes.
+} rlm_redis_thread_t;
+
+/** Wrapper around the module thread struct for the async xlat
+ *
+ */
+typedef struct {
+	rlm_redis_t const	*inst;		//!< Instance of rlm_redis.
+	rlm_redis_thread_t	*t;		//!< rlm_redis thread instance.
+} redis_xlat_thread_inst_t;
+
+/** Instance data for the async xlat
+ *
+ */
+typedef struct {
+	rlm_redis_t const	*inst;		//!< Instance of rlm_redis.
+	char const		**literal;	//!< Literal text of the command, in the order it appears.
+	int			num_literal;	//!< Number of literal strings.
+} redis_xlat_inst_t;
+
+/** Command in progress
+ *
+ */
+typedef struct {
+	fr_redis_command_set_t	*cmds;		//!< READONLY (optional), the command, READWRITE (optional).
+	fr_dlist_head_t		*completed;	//!< Commands and their replies.
+	bool			read_only;	//!< Command was wrapped in READONLY/READWRITE.
+	bool			failed;		//!< The commands could not be executed.
+} redis_xlat_rctx_t;
+
+static CONF_PARSER module_config[] = {
+	REDIS_COMMON_CONFIG,
+
+	{ FR_CONF_OFFSET("async", FR_TYPE_BOOL, rlm_redis_t, async), .dflt = "no" },
+	{ FR_CONF_OFFSET("trunk", FR_TYPE_SUBSECTION, rlm_redis_t, trunk_conf), .subcs = (void const *) fr_trunk_config },
+	CONF_PARSER_TERMINATOR
+};
+
 /** Change the state of a connection to READONLY execute a command and switch to READWRITE
  *
  * @param[out] status_out Where to write the status from the command.
@@ -148,6 +194,19 @@ static int redis_xlat_instantiate(void *xlat_inst, UNUSED xlat_exp_t const *exp,
 	return 0;
 }
 
+/** Record the literal text of the command, so it can be told apart from expansions
+ *
+ */
+static int redis_xlat_async_instantiate(void *xlat_inst, xlat_exp_t const *exp, void *uctx)
+{
+	redis_xlat_inst_t	*xi = talloc_get_type_abort(xlat_inst, redis_xlat_inst_t);
+
+	xi->inst = talloc_get_type_abort(uctx, rlm_redis_t);
+	xi->num_literal = xlat_func_literals(xi, &xi->literal, exp);
+
+	return 0;
+}
+
 /** Force a redis cluster remap
  *
 @verbatim
@@ -490,6 +549,530 @@ finish:
 	return ret;
 }
 
+/** Split the input of the async xlat into arguments
+ *
+ * Only the literal text of the command is split.  Arguments are
+ * delimited by unquoted whitespace in the literal text, and quotes
+ * in the literal text may enclose whitespace.  The value of an
+ * expansion is always added to the current argument as it is, so
+ * whitespace and quotes in attribute values can't add arguments.
+ *
+ * A leading '-' in the literal text marks the command as read only.
+ * A leading '@' marks the first argument as the address of the node
+ * to send the command to.
+ *
+ * Literal text is recognised by its position and content, and is
+ * never tainted.  An untainted expansion with the same text as the
+ * next literal may be taken for it, but can then only produce
+ * arguments which are in the command anyway.
+ *
+ * @param[out] argv		Where to write pointers to the arguments.
+ * @param[out] argvlen		Where to write the length of each argument.
+ * @param[out] read_only	Whether the command is read only.
+ * @param[out] by_node		Whether argv[0] is the address of a node.
+ * @param[in] max_argc		Maximum number of arguments.
+ * @param[in] xi		Instance data of the xlat.
+ * @param[in] in		Input boxes.  Cast to strings in place.  Arguments
+ *				are allocated in the context of the first box.
+ * @return
+ *	- The number of arguments.
+ *	- -1 on error.
+ */
+static int redis_xlat_args(char const **argv, size_t *argvlen, bool *read_only, bool *by_node,
+			   int max_argc, redis_xlat_inst_t const *xi, fr_value_box_t *in)
+{
+	fr_value_box_t	*vb;
+	char		*q, *arg = NULL;
+	char		quote = '\0';
+	size_t		total = 0;
+	int		argc = 0, lit = 0;
+
+	*read_only = false;
+	*by_node = false;
+
+	for (vb = in; vb; vb = vb->next) {
+		if ((vb->type != FR_TYPE_STRING) && (fr_value_box_cast_in_place(vb, vb, FR_TYPE_STRING, NULL) < 0)) {
+			return -1;
+		}
+		total += vb->vb_length;
+	}
+
+	/*
+	 *	Arguments are never longer than the input.
+	 */
+	MEM(q = talloc_array(in, char, total + 1));
+
+#define ARG_START \
+	do { \
+		if (!arg) { \
+			if (argc >= max_argc) { \
+				fr_strerror_printf("Too many parameters; increase MAX_REDIS_ARGS and recompile"); \
+				return -1; \
+			} \
+			arg = q; \
+		} \
+	} while (0)
+
+#define ARG_END \
+	do { \
+		if (arg) { \
+			argv[argc] = arg; \
+			argvlen[argc++] = q - arg; \
+			arg = NULL; \
+		} \
+	} while (0)
+
+	for (vb = in; vb; vb = vb->next) {
+		char const *p, *end;
+
+		/*
+		 *	Expansions are added to the current argument as is.
+		 */
+		if (vb->tainted || (lit >= xi->num_literal) ||
+		    (vb->vb_length != (talloc_array_length(xi->literal[lit]) - 1)) ||
+		    (memcmp(vb->vb_strvalue, xi->literal[lit], vb->vb_length) != 0)) {
+			ARG_START;
+			memcpy(q, vb->vb_strvalue, vb->vb_length);
+			q += vb->vb_length;
+			continue;
+		}
+
+		p = vb->vb_strvalue;
+		end = p + vb->vb_length;
+
+		if ((lit++ == 0) && (vb == in)) {
+			if ((p < end) && (*p == '-')) {
+				*read_only = true;
+				p++;
+			}
+			if ((p < end) && (*p == '@')) {
+				*by_node = true;
+				p++;
+			}
+		}
+
+		while (p < end) {
+			if (quote) {
+				if (*p == quote) {
+					quote = '\0';
+				} else {
+					*q++ = *p;
+				}
+				p++;
+				continue;
+			}
+
+			if (isspace((uint8_t) *p)) {
+				ARG_END;
+				p++;
+				continue;
+			}
+
+			ARG_START;
+			if ((*p == '"') || (*p == '\'')) {
+				quote = *p++;
+				continue;
+			}
+			*q++ = *p++;
+		}
+	}
+
+	if (quote) {
+		fr_strerror_printf("Unterminated quoted string");
+		return -1;
+	}
+	ARG_END;
+
+#undef ARG_START
+#undef ARG_END
+
+	return argc;
+}
+
+static void redis_xlat_complete(REQUEST *request, fr_dlist_head_t *completed, void *rctx)
+{
+	redis_xlat_rctx_t	*our_rctx = talloc_get_type_abort(rctx, redis_xlat_rctx_t);
+
+	our_rctx->completed = completed;
+	unlang_interpret_resumable(request);
+}
+
+static void redis_xlat_fail(REQUEST *request, fr_dlist_head_t *completed, void *rctx)
+{
+	redis_xlat_rctx_t	*our_rctx = talloc_get_type_abort(rctx, redis_xlat_rctx_t);
+
+	our_rctx->completed = completed;
+	our_rctx->failed = true;
+	unlang_interpret_resumable(request);
+}
+
+/** Cancel the command if the request is stopped while it's in progress
+ *
+ */
+static void redis_xlat_signal(UNUSED REQUEST *request, UNUSED void *xlat_inst, UNUSED void *xlat_thread_inst,
+			      void *rctx, fr_state_signal_t action)
+{
+	redis_xlat_rctx_t	*our_rctx = talloc_get_type_abort(rctx, redis_xlat_rctx_t);
+
+	if (action != FR_SIGNAL_CANCEL) return;
+
+	fr_redis_command_set_cancel(our_rctx->cmds);
+	talloc_free(our_rctx);
+}
+
+/** Convert the reply to the command to a value box
+ *
+ */
+static xlat_action_t redis_xlat_resume(TALLOC_CTX *ctx, fr_cursor_t *out,
+				       REQUEST *request, UNUSED void const *xlat_inst, UNUSED void *xlat_thread_inst,
+				       UNUSED fr_value_box_t **in, void *rctx)
+{
+	redis_xlat_rctx_t	*our_rctx = talloc_get_type_abort(rctx, redis_xlat_rctx_t);
+	fr_redis_command_t	*cmd;
+	redisReply		*reply;
+	fr_value_box_t		*vb;
+	xlat_action_t		ret = XLAT_ACTION_FAIL;
+
+	if (our_rctx->failed) {
+		REDEBUG("Failed executing command");
+		goto finish;
+	}
+
+	/*
+	 *	Skip over the reply to READONLY
+	 */
+	cmd = fr_dlist_head(our_rctx->completed);
+	if (our_rctx->read_only) {
+		if (fr_redis_command_status(NULL, fr_redis_command_get_result(cmd)) != REDIS_RCODE_SUCCESS) {
+			RPEDEBUG("Setting READONLY failed");
+			goto finish;
+		}
+		cmd = fr_dlist_next(our_rctx->completed, cmd);
+	}
+	if (!fr_cond_assert(cmd)) goto finish;
+
+	reply = fr_redis_command_get_result(cmd);
+	switch (fr_redis_command_status(NULL, reply)) {
+	case REDIS_RCODE_SUCCESS:
+		break;
+
+	case REDIS_RCODE_MOVE:
+	case REDIS_RCODE_ASK:
+		REDEBUG("Key served by a different node: %s", reply->str);
+		goto finish;
+
+	default:
+		RPEDEBUG("Command failed");
+		goto finish;
+	}
+
+	switch (reply->type) {
+	case REDIS_REPLY_INTEGER:
+	case REDIS_REPLY_STATUS:
+	case REDIS_REPLY_STRING:
+		MEM(vb = fr_value_box_alloc_null(ctx));
+		if (fr_redis_reply_to_value_box(vb, vb, reply, FR_TYPE_STRING, NULL) < 0) {
+			RPEDEBUG("Failed converting reply");
+			talloc_free(vb);
+			goto finish;
+		}
+		fr_cursor_append(out, vb);
+		ret = XLAT_ACTION_DONE;
+		break;
+
+	default:
+		REDEBUG("Server returned non-value type \"%s\"",
+			fr_table_str_by_value(redis_reply_types, reply->type, "<UNKNOWN>"));
+		break;
+	}
+
+finish:
+	talloc_free(our_rctx);
+
+	return ret;
+}
+
+/** Xlat to make calls to redis over the per-thread pipeline
+ *
+@verbatim
+%{redis:[-][@<host>[:port]] <redis command>}
+@endverbatim
+ *
+ * Commands from all the requests this thread is processing are written
+ * to each node together, so the round trip is shared between them.
+ *
+ * The command is split into arguments before expansion, see
+ * redis_xlat_args().
+ *
+ * @ingroup xlat_functions
+ */
+static xlat_action_t redis_xlat_async(UNUSED TALLOC_CTX *ctx, UNUSED fr_cursor_t *out,
+				      REQUEST *request, void const *xlat_inst, void *xlat_thread_inst,
+				      fr_value_box_t **in)
+{
+	redis_xlat_inst_t const			*xi = talloc_get_type_abort_const(xlat_inst, redis_xlat_inst_t);
+	rlm_redis_t const			*inst = xi->inst;
+	redis_xlat_thread_inst_t		*xt = talloc_get_type_abort(xlat_thread_inst, redis_xlat_thread_inst_t);
+	redis_xlat_rctx_t			*our_rctx;
+	fr_redis_trunk_t			*rtrunk = NULL;
+	bool					read_only, by_node;
+
+	int					argc;
+	char const				*argv[MAX_REDIS_ARGS];
+	size_t					argvlen[MAX_REDIS_ARGS];
+
+	if (!in) {
+		REDEBUG("Missing command");
+		return XLAT_ACTION_FAIL;
+	}
+
+	argc = redis_xlat_args(argv, argvlen, &read_only, &by_node, MAX_REDIS_ARGS, xi, *in);
+	if (argc < 0) {
+		RPEDEBUG("Invalid command");
+		return XLAT_ACTION_FAIL;
+	}
+
+	/*
+	 *	Hack to allow querying against a specific node for testing
+	 */
+	if (by_node) {
+		fr_socket_addr_t	node_addr;
+
+		RDEBUG3("Overriding node selection");
+
+		if (argc < 2) {
+			REDEBUG("Found node specifier but no command, format is [-][@<host>[:port]] <redis command>");
+			return XLAT_ACTION_FAIL;
+		}
+
+		if (fr_inet_pton_port(&node_addr.ipaddr, &node_addr.port, argv[0], argvlen[0],
+				      AF_UNSPEC, true, true) < 0) {
+			RPEDEBUG("Failed parsing node address");
+			return XLAT_ACTION_FAIL;
+		}
+
+		rtrunk = fr_redis_cluster_thread_trunk(xt->t->cluster_thread, &node_addr.ipaddr, node_addr.port);
+		if (!rtrunk) {
+			REDEBUG("Failed allocating trunk for cluster node");
+			return XLAT_ACTION_FAIL;
+		}
+
+		argc--;
+		memmove(argv, argv + 1, sizeof(argv[0]) * argc);
+		memmove(argvlen, argvlen + 1, sizeof(argvlen[0]) * argc);
+	}
+
+	if (argc == 0) {
+		REDEBUG("Missing command");
+		return XLAT_ACTION_FAIL;
+	}
+
+	/*
+	 *	Same key heuristic as the blocking xlat, the
+	 *	second argument is usually the key.
+	 */
+	if (!rtrunk) {
+		fr_redis_cluster_key_slot_t const	*key_slot;
+		fr_redis_cluster_node_t const		*node = NULL;
+		fr_ipaddr_t				node_ipaddr;
+		uint16_t				node_port;
+
+		key_slot = fr_redis_cluster_slot_by_key(inst->cluster, request,
+							(uint8_t const *)(argc > 1 ? argv[1] : NULL),
+							argc > 1 ? argvlen[1] : 0);
+		if (read_only) node = fr_redis_cluster_slave(inst->cluster, key_slot, 0);
+		if (!node) node = fr_redis_cluster_master(inst->cluster, key_slot);
+		if (!node || (fr_redis_cluster_ipaddr(&node_ipaddr, node) < 0) ||
+		    (fr_redis_cluster_port(&node_port, node) < 0)) {
+			REDEBUG("No cluster node available for this key slot");
+			return XLAT_ACTION_FAIL;
+		}
+
+		rtrunk = fr_redis_cluster_thread_trunk(xt->t->cluster_thread, &node_ipaddr, node_port);
+		if (!rtrunk) {
+			REDEBUG("Failed allocating trunk for cluster node");
+			return XLAT_ACTION_FAIL;
+		}
+	}
+
+	if (RDEBUG_ENABLED2) {
+		RDEBUG2("Executing command: %.*s", (int)argvlen[0], argv[0]);
+		if (argc > 1) {
+			RDEBUG2("With arguments");
+			RINDENT();
+			for (int i = 1; i < argc; i++) RDEBUG2("[%i] %.*s", i, (int)argvlen[i], argv[i]);
+			REXDENT();
+		}
+	}
+
+	MEM(our_rctx = talloc_zero(request, redis_xlat_rctx_t));
+	our_rctx->read_only = read_only;
+	our_rctx->cmds = fr_redis_command_set_alloc(our_rctx, request, redis_xlat_complete, redis_xlat_fail, our_rctx);
+
+	if ((read_only && (fr_redis_command_set_add(our_rctx->cmds, "READONLY") != FR_REDIS_PIPELINE_OK)) ||
+	    (fr_redis_command_set_argv_add(our_rctx->cmds, argc, argv, argvlen) != FR_REDIS_PIPELINE_OK) ||
+	    (read_only && (fr_redis_command_set_add(our_rctx->cmds, "READWRITE") != FR_REDIS_PIPELINE_OK)) ||
+	    (fr_redis_command_set_enqueue(rtrunk, our_rctx->cmds) != FR_REDIS_PIPELINE_OK)) {
+		REDEBUG("Failed enqueueing command");
+		talloc_free(our_rctx);
+		return XLAT_ACTION_FAIL;
+	}
+
+	return unlang_xlat_yield(request, redis_xlat_resume, redis_xlat_signal, our_rctx);
+}
+
+/** Resolve the module's thread instance for the async xlat
+ *
+ */
+static int redis_xlat_thread_instantiate(UNUSED void *xlat_inst, void *xlat_thread_inst,
+					 UNUSED xlat_exp_t const *exp, void *uctx)
+{
+	rlm_redis_t			*inst = talloc_get_type_abort(uctx, rlm_redis_t);
+	redis_xlat_thread_inst_t	*xt = xlat_thread_inst;
+
+	xt->inst = inst;
+	xt->t = talloc_get_type_abort(module_thread_by_data(inst)->data, rlm_redis_thread_t);
+
+	return 0;
+}
+
+/** Prefix for keys used to store serialised session-state
+ *
+ */
+#define REDIS_STATE_KEY_PREFIX	"state:"
+
+/** Run a single command against the node responsible for a session-state key
+ *
+ * @param[in] inst	of rlm_redis.
+ * @param[in] request	The command is being run for.
+ * @param[in] key	State value.
+ * @param[in] key_len	Length of the state value.
+ * @param[in] argc	Number of arguments.
+ * @param[in] argv	Command arguments.  argv[1] is filled in with the prefixed key.
+ * @param[in] argvlen	Length of each argument.  argvlen[1] is filled in with the
+ *			length of the prefixed key.
+ * @return
+ *	- The reply on success.
+ *	- NULL on failure.
+ */
+static redisReply *redis_state_command(rlm_redis_t const *inst, REQUEST *request,
+				       uint8_t const *key, size_t key_len,
+				       int argc, char const **argv, size_t *argvlen)
+{
+	fr_redis_conn_t			*conn;
+	fr_redis_cluster_state_t	state;
+	fr_redis_rcode_t		status;
+	redisReply			*reply = NULL;
+	int				s_ret;
+	uint8_t				key_buff[sizeof(REDIS_STATE_KEY_PREFIX) - 1 + 64];
+	size_t				prefix_len = sizeof(REDIS_STATE_KEY_PREFIX) - 1;
+
+	if (key_len > (sizeof(key_buff) - prefix_len)) {
+		REDEBUG("State key too long");
+		return NULL;
+	}
+	memcpy(key_buff, REDIS_STATE_KEY_PREFIX, prefix_len);
+	memcpy(key_buff + prefix_len, key, key_len);
+
+	argv[1] = (char const *)key_buff;
+	argvlen[1] = prefix_len + key_len;
+
+	for (s_ret = fr_redis_cluster_state_init(&state, &conn, inst->cluster, request,
+						 key_buff, argvlen[1], false);
+	     s_ret == REDIS_RCODE_TRY_AGAIN;	/* Continue */
+	     s_ret = fr_redis_cluster_state_next(&state, &conn, inst->cluster, request, status, &reply)) {
+		reply = redisCommandArgv(conn->handle, argc, argv, argvlen);
+		status = fr_redis_command_status(conn, reply);
+	}
+	if (s_ret != REDIS_RCODE_SUCCESS) {
+		fr_redis_reply_free(&reply);
+		return NULL;
+	}
+
+	return reply;
+}
+
+/** Store serialised session-state with a TTL
+ *
+ */
+static int redis_state_store(void *uctx, REQUEST *request, uint8_t const *key, size_t key_len,
+			     uint8_t const *value, size_t value_len, uint32_t ttl)
+{
+	rlm_redis_t const	*inst = uctx;
+	char			ttl_buff[sizeof("4294967295")];
+	char const		*argv[5] = { "SET", NULL, (char const *)value, "EX", ttl_buff };
+	size_t			argvlen[5] = { 3, 0, value_len, 2, 0 };
+	redisReply		*reply;
+
+	argvlen[4] = snprintf(ttl_buff, sizeof(ttl_buff), "%u", ttl);
+
+	reply = redis_state_command(inst, request, key, key_len, NUM_ELEMENTS(argv), argv, argvlen);
+	if (!reply) return -1;
+	fr_redis_reply_free(&reply);
+
+	return 0;
+}
+
+/** Retrieve serialised session-state
+ *
+ */
+static ssize_t redis_state_fetch(uint8_t **out, TALLOC_CTX *ctx, void *uctx, REQUEST *request,
+				 uint8_t const *key, size_t key_len)
+{
+	rlm_redis_t const	*inst = uctx;
+	char const		*argv[2] = { "GET", NULL };
+	size_t			argvlen[2] = { 3, 0 };
+	redisReply		*reply;
+	ssize_t			slen;
+
+	reply = redis_state_command(inst, request, key, key_len, NUM_ELEMENTS(argv), argv, argvlen);
+	if (!reply) return -1;
+
+	switch (reply->type) {
+	case REDIS_REPLY_NIL:
+		slen = 0;
+		break;
+
+	case REDIS_REPLY_STRING:
+		MEM(*out = talloc_memdup(ctx, reply->str, reply->len));
+		slen = reply->len;
+		break;
+
+	default:
+		REDEBUG("Unexpected reply type \"%s\" retrieving state",
+			fr_table_str_by_value(redis_reply_types, reply->type, "<UNKNOWN>"));
+		slen = -1;
+		break;
+	}
+	fr_redis_reply_free(&reply);
+
+	return slen;
+}
+
+/** Remove serialised session-state
+ *
+ */
+static int redis_state_remove(void *uctx, REQUEST *request, uint8_t const *key, size_t key_len)
+{
+	rlm_redis_t const	*inst = uctx;
+	char const		*argv[2] = { "DEL", NULL };
+	size_t			argvlen[2] = { 3, 0 };
+	redisReply		*reply;
+
+	reply = redis_state_command(inst, request, key, key_len, NUM_ELEMENTS(argv), argv, argvlen);
+	if (!reply) return -1;
+	fr_redis_reply_free(&reply);
+
+	return 0;
+}
+
+static fr_state_backend_t const redis_state_backend = {
+	.name		= "redis",
+	.store		= redis_state_store,
+	.fetch		= redis_state_fetch,
+	.remove		= redis_state_remove
+};
+
 static int mod_bootstrap(void *instance, CONF_SECTION *conf)
 {
 	rlm_redis_t	*inst = instance;
@@ -499,7 +1082,13 @@ static int mod_bootstrap(void *instance, CONF_SECTION *conf)
 	inst->name = cf_section_name2(conf);
 	if (!inst->name) inst->name = cf_section_name1(conf);
 
-	xlat_register(inst, inst->name, redis_xlat, NULL, NULL, 0, XLAT_DEFAULT_BUF_LEN, false);
+	if (!inst->async) {
+		xlat_register(inst, inst->name, redis_xlat, NULL, NULL, 0, XLAT_DEFAULT_BUF_LEN, false);
+	} else {
+		xlat = xlat_async_register(inst, inst->name, redis_xlat_async);
+		xlat_async_instantiate_set(xlat, redis_xlat_async_instantiate, redis_xlat_inst_t, NULL, inst);
+		xlat_async_thread_instantiate_set(xlat, redis_xlat_thread_instantiate, redis_xlat_thread_inst_t, NULL, inst);
+	}
 
 	/*
 	 *	%{redis_node:<key>[ idx]}
@@ -514,6 +1103,15 @@ static int mod_bootstrap(void *instance, CONF_SECTION *conf)
 	xlat_async_instantiate_set(xlat, redis_xlat_instantiate, rlm_redis_t *, NULL, inst);
 	talloc_free(name);
 
+	/*
+	 *	Allow virtual servers to store session-state
+	 *	in this instance with "session { backend = <name> }".
+	 */
+	if (!fr_state_backend_register(inst, inst->name, &redis_state_backend, inst)) {
+		cf_log_perr(conf, "Failed registering state backend");
+		return -1;
+	}
+
 	return 0;
 }
 
@@ -524,6 +1122,37 @@ static int mod_instantiate(void *instance, CONF_SECTION *conf)
 	inst->cluster = fr_redis_cluster_alloc(inst, conf, &inst->conf, true, NULL, NULL, NULL);
 	if (!inst->cluster) return -1;
 
+	/*
+	 *	Template for the connections to each of
+	 *	the cluster's nodes.
+	 */
+	inst->io_conf.database = inst->conf.database;
+	inst->io_conf.password = inst->conf.password;
+	inst->io_conf.log_prefix = talloc_typed_asprintf(inst, "rlm_redis (%s)", inst->name);
+
+	/*
+	 *	Commands are sent over the per-thread trunks and
+	 *	the request yields, so calls to this instance must
+	 *	never be run on an offload thread.
+	 */
+	if (inst->async) module_instance_type_set(instance, RLM_TYPE_THREAD_SAFE | RLM_TYPE_RESUMABLE);
+
+	return 0;
+}
+
+/** Allocate the per-thread trunks used when async is enabled
+ *
+ */
+static int mod_thread_instantiate(UNUSED CONF_SECTION const *conf, void *instance, fr_event_list_t *el, void *thread)
+{
+	rlm_redis_t const	*inst = instance;
+	rlm_redis_thread_t	*t = talloc_get_type_abort(thread, rlm_redis_thread_t);
+
+	if (!inst->async) return 0;
+
+	t->cluster_thread = fr_redis_cluster_thread_alloc(t, el, &inst->trunk_conf, &inst->io_conf);
+	if (!t->cluster_thread) return -1;
+
 	return 0;
 }
 
@@ -538,10 +1167,13 @@ extern module_t rlm_redis;
 module_t rlm_redis = {
 	.magic		= RLM_MODULE_INIT,
 	.name		= "redis",
-	.type		= RLM_TYPE_THREAD_SAFE,
+	.type		= RLM_TYPE_THREAD_SAFE | RLM_TYPE_BLOCKING,
 	.inst_size	= sizeof(rlm_redis_t),
 	.config		= module_config,
 	.onload		= mod_load,
 	.bootstrap	= mod_bootstrap,
 	.instantiate	= mod_instantiate,
+	.thread_inst_size	= sizeof(rlm_redis_thread_t),
+	.thread_inst_type	= "rlm_redis_thread_t",
+	.thread_instantiate	= mod_thread_instantiate,
 };
@@ -44,10 +44,12 @@ RCSID("$Id$")
 #include <freeradius-devel/server/base.h>
 #include <freeradius-devel/server/module.h>
 #include <freeradius-devel/server/modpriv.h>
+#include <freeradius-devel/unlang/base.h>
 #include <freeradius-devel/util/debug.h>
 
 #include <freeradius-devel/redis/base.h>
 #include <freeradius-devel/redis/cluster.h>
+#include <freeradius-devel/redis/pipeline.h>
 #include "redis_ippool.h"
 
 #ifdef WITH_DHCP
@@ -98,10 +100,50 @@ typedef struct {
 						//!< allocated_address_attr if updates are successful.
 
 	fr_redis_cluster_t	*cluster;	//!< Redis cluster.
+
+	bool			async;		//!< Send commands over the per-thread pipeline
+						///< instead of the blocking connection pool.
+	fr_trunk_conf_t		trunk_conf;	//!< Configuration for the per-thread trunks.
+	fr_redis_io_conf_t	io_conf;	//!< Template for the I/O configuration of each trunk.
 } rlm_redis_ippool_t;
 
+/** rlm_redis_ippool thread instance, only used when async is enabled
+ *
+ */
+typedef struct {
+	fr_redis_cluster_thread_t *cluster_thread;	//!< Trunks for the cluster's nodes.
+} rlm_redis_ippool_thread_t;
+
+/** A lease operation
+ *
+ * Holds everything needed to process the result of the operation,
+ * whether it's executed with the blocking connection pool, or yields
+ * while it's executed over the pipeline.
+ */
+typedef struct {
+	rlm_redis_ippool_t const *inst;
+	ippool_action_t		action;
+
+	char const		*digest;	//!< Of the script to call.
+	char const		*script;	//!< To load if the node doesn't have it cached.
+	char			*cmd;		//!< EVALSHA command in RESP format.
+	size_t			cmd_len;	//!< Length of the EVALSHA command.
+
+	char			ip_str[INET6_ADDRSTRLEN + 4];	//!< Address being updated or released.
+	uint32_t		expires;	//!< Lease time of an update.
+
+	fr_redis_trunk_t	*rtrunk;	//!< Trunk for the node responsible for the pool.
+	fr_redis_command_set_t	*cmds;		//!< Commands in progress.
+	fr_dlist_head_t		*completed;	//!< Commands and their replies.
+	bool			loading;	//!< SCRIPT LOAD was sent along with the EVALSHA.
+	bool			failed;		//!< The commands could not be executed.
+} ippool_op_t;
+
 static CONF_PARSER redis_config[] = {
 	REDIS_COMMON_CONFIG,
+
+	{ FR_CONF_OFFSET("async", FR_TYPE_BOOL, rlm_redis_ippool_t, async), .dflt = "no" },
+	{ FR_CONF_OFFSET("trunk", FR_TYPE_SUBSECTION, rlm_redis_ippool_t, trunk_conf), .subcs = (void const *) fr_trunk_config },
 	CONF_PARSER_TERMINATOR
 };
 
@@ -445,6 +487,66 @@ static void ippool_action_print(REQUEST *request, ippool_action_t action,
 	talloc_free(gateway_str);
 }
 
+/** Check the reply to an EXEC wrapping SCRIPT LOAD and EVALSHA
+ *
+ * @param request The current request.
+ * @param reply to EXEC.
+ * @param digest we expect SCRIPT LOAD to return.
+ * @return
+ *	- 0 if the script was loaded and called.
+ *	- -1 on error.
+ */
+static int ippool_exec_check(REQUEST *request, redisReply *reply, char const *digest)
+{
+	if (reply->type != REDIS_REPLY_ARRAY) {
+		REDEBUG("Bad response to EXEC, expected array got %s",
+			fr_table_str_by_value(redis_reply_types, reply->type, "<UNKNOWN>"));
+		return -1;
+	}
+	if (reply->elements != 2) {
+		REDEBUG("Bad response to EXEC, expected 2 result elements, got %zu", reply->elements);
+		return -1;
+	}
+	if (reply->element[0]->type != REDIS_REPLY_STRING) {
+		REDEBUG("Bad response to SCRIPT LOAD, expected string got %s",
+			fr_table_str_by_value(redis_reply_types, reply->element[0]->type, "<UNKNOWN>"));
+		return -1;
+	}
+	if (strcmp(reply->element[0]->str, digest) != 0) {
+		RWDEBUG("Incorrect SHA1 from SCRIPT LOAD, expected %s, got %s", digest, reply->element[0]->str);
+		return -1;
+	}
+	return 0;
+}
+
+/** Format a command in RESP format so it can be sent synchronously or over the pipeline
+ *
+ * @param[in] ctx	to allocate the command in.
+ * @param[out] len	Length of the formatted command.
+ * @param[in] fmt	hiredis format string.
+ * @param[in] ...	Arguments for the format string.
+ * @return
+ *	- The formatted command.
+ *	- NULL on error.
+ */
+static char *ippool_command_format(TALLOC_CTX *ctx, size_t *len, char const *fmt, ...)
+{
+	va_list	ap;
+	char	*formatted, *out;
+	int	ret;
+
+	va_start(ap, fmt);
+	ret = redisvFormatCommand(&formatted, fmt, ap);
+	va_end(ap);
+	if (ret < 0) return NULL;
+
+	MEM(out = talloc_memdup(ctx, formatted, (size_t)ret));
+	redisFreeCommand(formatted);
+	*len = (size_t)ret;
+
+	return out;
+}
+
 /** Execute a script against Redis cluster
  *
  * Handles uploading the script to the server if required.
@@ -461,15 +563,15 @@ static void ippool_action_print(REQUEST *request, ippool_action_t action,
  * @param[in] wait_timeout	How long to wait for slaves.
  * @param[in] digest		of script.
  * @param[in] script		to upload.
- * @param[in] cmd		EVALSHA command to execute.
- * @param[in] ...		Arguments for the eval command.
+ * @param[in] cmd		EVALSHA command to execute, in RESP format.
+ * @param[in] cmd_len		Length of the EVALSHA command.
  * @return status of the command.
  */
 static fr_redis_rcode_t ippool_script(redisReply **out, REQUEST *request, fr_redis_cluster_t *cluster,
 				      uint8_t const *key, size_t key_len,
 				      uint32_t wait_num, fr_time_delta_t wait_timeout,
 				      char const digest[], char const *script,
-				      char const *cmd, ...)
+				      char const *cmd, size_t cmd_len)
 {
 	fr_redis_conn_t			*conn;
 	redisReply			*replies[5];	/* Must be equal to the maximum number of pipelined commands */
@@ -479,25 +581,17 @@ static fr_redis_rcode_t ippool_script(redisReply **out, REQUEST *request, fr_red
 	fr_redis_rcode_t		s_ret, status;
 	unsigned int			pipelined = 0;
 
-	va_list				ap;
-
 	*out = NULL;
 
 #ifndef NDEBUG
 	memset(replies, 0, sizeof(replies));
 #endif
 
-	va_start(ap, cmd);
-
 	for (s_ret = fr_redis_cluster_state_init(&state, &conn, cluster, request, key, key_len, false);
 	     s_ret == REDIS_RCODE_TRY_AGAIN;	/* Continue */
 	     s_ret = fr_redis_cluster_state_next(&state, &conn, cluster, request, status, &replies[0])) {
-	     	va_list	copy;
-
 	     	RDEBUG3("Calling script 0x%s", digest);
-	     	va_copy(copy, ap);	/* copy or segv */
-		redisvAppendCommand(conn->handle, cmd, copy);
-		va_end(copy);
+		redisAppendFormattedCommand(conn->handle, cmd, cmd_len);
 		pipelined = 1;
 		if (wait_num) {
 			redisAppendCommand(conn->handle, "WAIT %i %i", wait_num, fr_time_delta_to_msec(wait_timeout));
@@ -521,13 +615,11 @@ static fr_redis_rcode_t ippool_script(redisReply **out, REQUEST *request, fr_red
 	     	RDEBUG3("Loading script 0x%s", digest);
 		redisAppendCommand(conn->handle, "MULTI");
 		redisAppendCommand(conn->handle, "SCRIPT LOAD %s", script);
-	     	va_copy(copy, ap);	/* copy or segv */
-		redisvAppendCommand(conn->handle, cmd, copy);
-		va_end(copy);
+		redisAppendFormattedCommand(conn->handle, cmd, cmd_len);
 		redisAppendCommand(conn->handle, "EXEC");
 		pipelined = 4;
 		if (wait_num) {
-			redisAppendCommand(conn->handle, "WAIT %i %i", wait_num, wait_timeout);
+			redisAppendCommand(conn->handle, "WAIT %i %i", wait_num, fr_time_delta_to_msec(wait_timeout));
 			pipelined++;
 		}
 
@@ -539,29 +631,12 @@ static fr_redis_rcode_t ippool_script(redisReply **out, REQUEST *request, fr_red
 				fr_redis_reply_print(L_DBG_LVL_3, replies[i], request, i);
 			}
 
-			if (replies[3]->type != REDIS_REPLY_ARRAY) {
-				REDEBUG("Bad response to EXEC, expected array got %s",
-					fr_table_str_by_value(redis_reply_types, replies[3]->type, "<UNKNOWN>"));
+			if (ippool_exec_check(request, replies[3], digest) < 0) {
 			error:
 				fr_redis_pipeline_free(replies, reply_cnt);
 				status = REDIS_RCODE_ERROR;
 				goto finish;
 			}
-			if (replies[3]->elements != 2) {
-				REDEBUG("Bad response to EXEC, expected 2 result elements, got %zu",
-					replies[3]->elements);
-				goto error;
-			}
-			if (replies[3]->element[0]->type != REDIS_REPLY_STRING) {
-				REDEBUG("Bad response to SCRIPT LOAD, expected string got %s",
-					fr_table_str_by_value(redis_reply_types, replies[3]->element[0]->type, "<UNKNOWN>"));
-				goto error;
-			}
-			if (strcmp(replies[3]->element[0]->str, digest) != 0) {
-				RWDEBUG("Incorrect SHA1 from SCRIPT LOAD, expected %s, got %s",
-					digest, replies[3]->element[0]->str);
-				goto error;
-			}
 		}
 	}
 	if (s_ret != REDIS_RCODE_SUCCESS) goto error;
@@ -570,7 +645,7 @@ static fr_redis_rcode_t ippool_script(redisReply **out, REQUEST *request, fr_red
 	case 2:	/* EVALSHA with wait */
 		if (ippool_wait_check(request, wait_num, replies[1]) < 0) goto error;
 		fr_redis_reply_free(&replies[1]);	/* Free the wait response */
-		break;
+		FALL_THROUGH;
 
 	case 1:	/* EVALSHA */
 		*out = replies[0];
@@ -595,50 +670,17 @@ static fr_redis_rcode_t ippool_script(redisReply **out, REQUEST *request, fr_red
 	}
 
 finish:
-	va_end(ap);
 	return s_ret;
 }
 
-/** Allocate a new IP address from a pool
+/** Process the reply to an allocation
  *
+ * Adds the allocated address, range and expiry to the request.
  */
-static ippool_rcode_t redis_ippool_allocate(rlm_redis_ippool_t const *inst, REQUEST *request,
-					    uint8_t const *key_prefix, size_t key_prefix_len,
-					    uint8_t const *device_id, size_t device_id_len,
-					    uint8_t const *gateway_id, size_t gateway_id_len,
-					    uint32_t expires)
+static ippool_rcode_t redis_ippool_allocate(rlm_redis_ippool_t const *inst, REQUEST *request, redisReply *reply)
 {
-	struct			timeval now;
-	redisReply		*reply = NULL;
-
-	fr_redis_rcode_t	status;
 	ippool_rcode_t		ret = IPPOOL_RCODE_SUCCESS;
 
-	fr_assert(key_prefix);
-	fr_assert(device_id);
-
-	now = fr_time_to_timeval(fr_time());
-
-	/*
-	 *	hiredis doesn't deal well with NULL string pointers
-	 */
-	if (!gateway_id) gateway_id = (uint8_t const *)"";
-
-	status = ippool_script(&reply, request, inst->cluster,
-			       key_prefix, key_prefix_len,
-			       inst->wait_num, inst->wait_timeout,
-			       lua_alloc_digest, lua_alloc_cmd,
-	 		       "EVALSHA %s 1 %b %u %u %b %b",
-	 		       lua_alloc_digest,
-			       key_prefix, key_prefix_len,
-			       (unsigned int)now.tv_sec, expires,
-			       device_id, device_id_len,
-			       gateway_id, gateway_id_len);
-	if (status != REDIS_RCODE_SUCCESS) {
-		ret = IPPOOL_RCODE_FAIL;
-		goto finish;
-	}
-
 	fr_assert(reply);
 	if (reply->type != REDIS_REPLY_ARRAY) {
 		REDEBUG("Expected result to be array got \"%s\"",
@@ -786,24 +828,16 @@ static ippool_rcode_t redis_ippool_allocate(rlm_redis_ippool_t const *inst, REQU
 		}
 	}
 finish:
-	fr_redis_reply_free(&reply);
 	return ret;
 }
 
-/** Update an existing IP address in a pool
+/** Process the reply to a lease update
  *
+ * Adds the range and expiry to the request.
  */
 static ippool_rcode_t redis_ippool_update(rlm_redis_ippool_t const *inst, REQUEST *request,
-					  uint8_t const *key_prefix, size_t key_prefix_len,
-					  fr_ipaddr_t *ip,
-					  uint8_t const *device_id, size_t device_id_len,
-					  uint8_t const *gateway_id, size_t gateway_id_len,
-					  uint32_t expires)
+					  redisReply *reply, uint32_t expires)
 {
-	struct			timeval now;
-	redisReply		*reply = NULL;
-
-	fr_redis_rcode_t	status;
 	ippool_rcode_t		ret = IPPOOL_RCODE_SUCCESS;
 
 	vp_tmpl_t		range_rhs;
@@ -811,47 +845,7 @@ static ippool_rcode_t redis_ippool_update(rlm_redis_ippool_t const *inst, REQUES
 
 	tmpl_init(&range_rhs, TMPL_TYPE_DATA, "", 0, T_DOUBLE_QUOTED_STRING);
 
-	now = fr_time_to_timeval(fr_time());
-
-	/*
-	 *	hiredis doesn't deal well with NULL string pointers
-	 */
-	if (!device_id) device_id = (uint8_t const *)"";
-	if (!gateway_id) gateway_id = (uint8_t const *)"";
-
-	if ((ip->af == AF_INET) && inst->ipv4_integer) {
-		status = ippool_script(&reply, request, inst->cluster,
-				       key_prefix, key_prefix_len,
-				       inst->wait_num, inst->wait_timeout,
-				       lua_update_digest, lua_update_cmd,
-				       "EVALSHA %s 1 %b %u %u %u %b %b",
-				       lua_update_digest,
-				       key_prefix, key_prefix_len,
-				       (unsigned int)now.tv_sec, expires,
-				       htonl(ip->addr.v4.s_addr),
-				       device_id, device_id_len,
-				       gateway_id, gateway_id_len);
-	} else {
-		char ip_buff[FR_IPADDR_PREFIX_STRLEN];
-
-		IPPOOL_SPRINT_IP(ip_buff, ip, ip->prefix);
-		status = ippool_script(&reply, request, inst->cluster,
-				       key_prefix, key_prefix_len,
-				       inst->wait_num, inst->wait_timeout,
-				       lua_update_digest, lua_update_cmd,
-				       "EVALSHA %s 1 %b %u %u %s %b %b",
-				       lua_update_digest,
-				       key_prefix, key_prefix_len,
-				       (unsigned int)now.tv_sec, expires,
-				       ip_buff,
-				       device_id, device_id_len,
-				       gateway_id, gateway_id_len);
-	}
-	if (status != REDIS_RCODE_SUCCESS) {
-		ret = IPPOOL_RCODE_FAIL;
-		goto finish;
-	}
-
+	fr_assert(reply);
 	if (reply->type != REDIS_REPLY_ARRAY) {
 		REDEBUG("Expected result to be array got \"%s\"",
 			fr_table_str_by_value(redis_reply_types, reply->type, "<UNKNOWN>"));
@@ -927,63 +921,17 @@ static ippool_rcode_t redis_ippool_update(rlm_redis_ippool_t const *inst, REQUES
 	}
 
 finish:
-	fr_redis_reply_free(&reply);
-
 	return ret;
 }
 
-/** Release an existing IP address in a pool
+/** Process the reply to a lease release
  *
  */
-static ippool_rcode_t redis_ippool_release(rlm_redis_ippool_t const *inst, REQUEST *request,
-					   uint8_t const *key_prefix, size_t key_prefix_len,
-					   fr_ipaddr_t *ip,
-					   uint8_t const *device_id, size_t device_id_len)
+static ippool_rcode_t redis_ippool_release(REQUEST *request, redisReply *reply)
 {
-	struct			timeval now;
-	redisReply		*reply = NULL;
-
-	fr_redis_rcode_t	status;
 	ippool_rcode_t		ret = IPPOOL_RCODE_SUCCESS;
 
-	now = fr_time_to_timeval(fr_time());
-
-	/*
-	 *	hiredis doesn't deal well with NULL string pointers
-	 */
-	if (!device_id) device_id = (uint8_t const *)"";
-
-	if ((ip->af == AF_INET) && inst->ipv4_integer) {
-		status = ippool_script(&reply, request, inst->cluster,
-				       key_prefix, key_prefix_len,
-				       inst->wait_num, inst->wait_timeout,
-				       lua_release_digest, lua_release_cmd,
-				       "EVALSHA %s 1 %b %u %u %b",
-				       lua_release_digest,
-				       key_prefix, key_prefix_len,
-				       (unsigned int)now.tv_sec,
-				       htonl(ip->addr.v4.s_addr),
-				       device_id, device_id_len);
-	} else {
-		char ip_buff[FR_IPADDR_PREFIX_STRLEN];
-
-		IPPOOL_SPRINT_IP(ip_buff, ip, ip->prefix);
-		status = ippool_script(&reply, request, inst->cluster,
-				       key_prefix, key_prefix_len,
-				       inst->wait_num, inst->wait_timeout,
-				       lua_release_digest, lua_release_cmd,
-				       "EVALSHA %s 1 %b %u %s %b",
-				       lua_release_digest,
-				       key_prefix, key_prefix_len,
-				       (unsigned int)now.tv_sec,
-				       ip_buff,
-				       device_id, device_id_len);
-	}
-	if (status != REDIS_RCODE_SUCCESS) {
-		ret = IPPOOL_RCODE_FAIL;
-		goto finish;
-	}
-
+	fr_assert(reply);
 	if (reply->type != REDIS_REPLY_ARRAY) {
 		REDEBUG("Expected result to be array got \"%s\"",
 			fr_table_str_by_value(redis_reply_types, reply->type, "<UNKNOWN>"));
@@ -1010,8 +958,6 @@ static ippool_rcode_t redis_ippool_release(rlm_redis_ippool_t const *inst, REQUE
 	if (ret < 0) goto finish;
 
 finish:
-	fr_redis_reply_free(&reply);
-
 	return ret;
 }
 
@@ -1054,7 +1000,308 @@ static inline ssize_t ippool_pool_name(uint8_t const **out, uint8_t buff[], size
 	return slen;
 }
 
-static rlm_rcode_t mod_action(rlm_redis_ippool_t const *inst, REQUEST *request, ippool_action_t action)
+/** Process the result of a lease operation
+ *
+ * @param[in] op	that was executed.
+ * @param[in] request	The current request.
+ * @param[in] reply	to the EVALSHA command.
+ * @return the rcode returned by the script, or IPPOOL_RCODE_FAIL on error.
+ */
+static ippool_rcode_t ippool_op_reply(ippool_op_t *op, REQUEST *request, redisReply *reply)
+{
+	switch (op->action) {
+	case POOL_ACTION_ALLOCATE:
+		return redis_ippool_allocate(op->inst, request, reply);
+
+	case POOL_ACTION_UPDATE:
+		return redis_ippool_update(op->inst, request, reply, op->expires);
+
+	case POOL_ACTION_RELEASE:
+		return redis_ippool_release(request, reply);
+
+	default:
+		fr_assert(0);
+		return IPPOOL_RCODE_FAIL;
+	}
+}
+
+/** Convert the result of a lease operation to a module rcode
+ *
+ * @param[in] op	that was executed.
+ * @param[in] request	The current request.
+ * @param[in] ret	as returned by #ippool_op_reply.
+ * @return the module rcode.
+ */
+static rlm_rcode_t ippool_op_rcode(ippool_op_t *op, REQUEST *request, ippool_rcode_t ret)
+{
+	rlm_redis_ippool_t const	*inst = op->inst;
+	char const			*ip_str = op->ip_str;
+
+	switch (op->action) {
+	case POOL_ACTION_ALLOCATE:
+		switch (ret) {
+		case IPPOOL_RCODE_SUCCESS:
+			RDEBUG2("IP address lease allocated");
+			return RLM_MODULE_UPDATED;
+
+		case IPPOOL_RCODE_POOL_EMPTY:
+			RWDEBUG("Pool contains no free addresses");
+			return RLM_MODULE_NOTFOUND;
+
+		default:
+			return RLM_MODULE_FAIL;
+		}
+
+	case POOL_ACTION_UPDATE:
+		switch (ret) {
+		case IPPOOL_RCODE_SUCCESS:
+			RDEBUG2("Requested IP address' \"%s\" lease updated", ip_str);
+
+			/*
+			 *	Copy over the input IP address to the reply attribute
+			 */
+			if (inst->copy_on_update) {
+				vp_tmpl_t ip_rhs = {
+					.name = "",
+					.type = TMPL_TYPE_DATA,
+					.quote = T_BARE_WORD,
+				};
+				vp_map_t ip_map = {
+					.lhs = inst->allocated_address_attr,
+					.op = T_OP_SET,
+					.rhs = &ip_rhs
+				};
+
+				fr_value_box_strdup_shallow(&ip_rhs.data.literal, NULL, ip_str, false);
+
+				if (map_to_request(request, &ip_map, map_to_vp, NULL) < 0) return RLM_MODULE_FAIL;
+			}
+			return RLM_MODULE_UPDATED;
+
+		/*
+		 *	It's useful to be able to identify the 'not found' case
+		 *	as we can relay to a server where the IP address might
+		 *	be found.  This extremely useful for migrations.
+		 */
+		case IPPOOL_RCODE_NOT_FOUND:
+			REDEBUG("Requested IP address \"%s\" is not a member of the specified pool", ip_str);
+			return RLM_MODULE_NOTFOUND;
+
+		case IPPOOL_RCODE_EXPIRED:
+			REDEBUG("Requested IP address' \"%s\" lease already expired at time of renewal", ip_str);
+			return RLM_MODULE_INVALID;
+
+		case IPPOOL_RCODE_DEVICE_MISMATCH:
+			REDEBUG("Requested IP address' \"%s\" lease allocated to another device", ip_str);
+			return RLM_MODULE_INVALID;
+
+		default:
+			return RLM_MODULE_FAIL;
+		}
+
+	case POOL_ACTION_RELEASE:
+		switch (ret) {
+		case IPPOOL_RCODE_SUCCESS:
+			RDEBUG2("IP address \"%s\" released", ip_str);
+			return RLM_MODULE_UPDATED;
+
+		/*
+		 *	It's useful to be able to identify the 'not found' case
+		 *	as we can relay to a server where the IP address might
+		 *	be found.  This extremely useful for migrations.
+		 */
+		case IPPOOL_RCODE_NOT_FOUND:
+			REDEBUG("Requested IP address \"%s\" is not a member of the specified pool", ip_str);
+			return RLM_MODULE_NOTFOUND;
+
+		case IPPOOL_RCODE_DEVICE_MISMATCH:
+			REDEBUG("Requested IP address' \"%s\" lease allocated to another device", ip_str);
+			return RLM_MODULE_INVALID;
+
+		default:
+			return RLM_MODULE_FAIL;
+		}
+
+	default:
+		fr_assert(0);
+		return RLM_MODULE_FAIL;
+	}
+}
+
+/** Execute a lease operation, blocking until it completes
+ *
+ */
+static rlm_rcode_t ippool_op_sync(ippool_op_t *op, REQUEST *request, uint8_t const *key_prefix, size_t key_prefix_len)
+{
+	rlm_redis_ippool_t const	*inst = op->inst;
+	redisReply			*reply = NULL;
+	ippool_rcode_t			ret;
+
+	if (ippool_script(&reply, request, inst->cluster,
+			  key_prefix, key_prefix_len,
+			  inst->wait_num, inst->wait_timeout,
+			  op->digest, op->script, op->cmd, op->cmd_len) != REDIS_RCODE_SUCCESS) {
+		ret = IPPOOL_RCODE_FAIL;
+	} else {
+		ret = ippool_op_reply(op, request, reply);
+	}
+	fr_redis_reply_free(&reply);
+
+	return ippool_op_rcode(op, request, ret);
+}
+
+/** All commands in the set received replies, mark the request as runnable
+ *
+ */
+static void ippool_async_complete(REQUEST *request, fr_dlist_head_t *completed, void *rctx)
+{
+	ippool_op_t	*op = talloc_get_type_abort(rctx, ippool_op_t);
+
+	op->completed = completed;
+	unlang_interpret_resumable(request);
+}
+
+/** The command set could not be executed, mark the request as runnable
+ *
+ */
+static void ippool_async_fail(REQUEST *request, fr_dlist_head_t *completed, void *rctx)
+{
+	ippool_op_t	*op = talloc_get_type_abort(rctx, ippool_op_t);
+
+	op->completed = completed;
+	op->failed = true;
+	unlang_interpret_resumable(request);
+}
+
+/** Cancel the operation if the request is stopped while it's in progress
+ *
+ */
+static void ippool_async_signal(UNUSED void *instance, UNUSED void *thread, UNUSED REQUEST *request,
+				void *rctx, fr_state_signal_t action)
+{
+	ippool_op_t	*op = talloc_get_type_abort(rctx, ippool_op_t);
+
+	if (action != FR_SIGNAL_CANCEL) return;
+
+	fr_redis_command_set_cancel(op->cmds);
+	talloc_free(op);
+}
+
+static rlm_rcode_t ippool_async_resume(void *instance, void *thread, REQUEST *request, void *rctx);
+
+/** Enqueue the EVALSHA (and optionally the script) on the pool's trunk, and yield
+ *
+ * Commands from all the requests being processed by this thread are written
+ * to the node together, so the round trip is shared.
+ *
+ * @param[in] op	to execute.
+ * @param[in] request	The current request.
+ * @param[in] load	Wrap the EVALSHA in a transaction with SCRIPT LOAD.
+ */
+static rlm_rcode_t ippool_async_send(ippool_op_t *op, REQUEST *request, bool load)
+{
+	rlm_redis_ippool_t const	*inst = op->inst;
+
+	/*
+	 *	Any previous command set remains parented
+	 *	by the op, and is freed with it.
+	 */
+	op->cmds = fr_redis_command_set_alloc(op, request, ippool_async_complete, ippool_async_fail, op);
+	op->completed = NULL;
+	op->failed = false;
+	op->loading = load;
+
+	RDEBUG3("%s script 0x%s", load ? "Loading" : "Calling", op->digest);
+
+	if (load) {
+		if ((fr_redis_command_set_add(op->cmds, "MULTI") != FR_REDIS_PIPELINE_OK) ||
+		    (fr_redis_command_set_add(op->cmds, "SCRIPT LOAD %s", op->script) != FR_REDIS_PIPELINE_OK)) {
+		error:
+			talloc_free(op);
+			return RLM_MODULE_FAIL;
+		}
+	}
+	if (fr_redis_command_preformatted_add(op->cmds, op->cmd, op->cmd_len) != FR_REDIS_PIPELINE_OK) goto error;
+	if (load && (fr_redis_command_set_add(op->cmds, "EXEC") != FR_REDIS_PIPELINE_OK)) goto error;
+	if (inst->wait_num && (fr_redis_command_set_add(op->cmds, "WAIT %i %i", inst->wait_num,
+							  (int)fr_time_delta_to_msec(inst->wait_timeout)) != FR_REDIS_PIPELINE_OK)) {
+		goto error;
+	}
+
+	if (fr_redis_command_set_enqueue(op->rtrunk, op->cmds) != FR_REDIS_PIPELINE_OK) {
+		REDEBUG("Failed enqueueing commands");
+		goto error;
+	}
+
+	return unlang_module_yield(request, ippool_async_resume, ippool_async_signal, op);
+}
+
+/** Process the replies to a lease operation executed over the pipeline
+ *
+ * Mirrors the logic in #ippool_script, but cluster redirects are not followed.
+ */
+static rlm_rcode_t ippool_async_resume(UNUSED void *instance, UNUSED void *thread, REQUEST *request, void *rctx)
+{
+	ippool_op_t			*op = talloc_get_type_abort(rctx, ippool_op_t);
+	rlm_redis_ippool_t const	*inst = op->inst;
+	fr_redis_command_t		*cmd = NULL;
+	redisReply			*replies[5], *reply;
+	size_t				reply_cnt = 0, i;
+	ippool_rcode_t			ret = IPPOOL_RCODE_FAIL;
+	rlm_rcode_t			rcode;
+
+	if (op->failed) {
+		REDEBUG("Failed executing script 0x%s", op->digest);
+		goto finish;
+	}
+
+	while ((cmd = fr_dlist_next(op->completed, cmd)) && (reply_cnt < NUM_ELEMENTS(replies))) {
+		replies[reply_cnt++] = fr_redis_command_get_result(cmd);
+	}
+
+	for (i = 0; i < reply_cnt; i++) {
+		if (RDEBUG_ENABLED3) fr_redis_reply_print(L_DBG_LVL_3, replies[i], request, i);
+
+		switch (fr_redis_command_status(NULL, replies[i])) {
+		case REDIS_RCODE_SUCCESS:
+			continue;
+
+		/*
+		 *	The node doesn't have the script cached,
+		 *	send it up along with the EVALSHA.
+		 */
+		case REDIS_RCODE_NO_SCRIPT:
+			if (!op->loading && (i == 0)) return ippool_async_send(op, request, true);
+			FALL_THROUGH;
+
+		default:
+			RPEDEBUG("Failed executing script 0x%s", op->digest);
+			goto finish;
+		}
+	}
+
+	if (op->loading) {
+		if ((reply_cnt < 4) || (ippool_exec_check(request, replies[3], op->digest) < 0)) goto finish;
+		reply = replies[3]->element[1];
+	} else {
+		if (reply_cnt < 1) goto finish;
+		reply = replies[0];
+	}
+
+	if (inst->wait_num && ((reply_cnt < (op->loading ? 5 : 2)) ||
+			       (ippool_wait_check(request, inst->wait_num, replies[reply_cnt - 1]) < 0))) goto finish;
+
+	ret = ippool_op_reply(op, request, reply);
+
+finish:
+	rcode = ippool_op_rcode(op, request, ret);
+	talloc_free(op);
+
+	return rcode;
+}
+
+static rlm_rcode_t mod_action(rlm_redis_ippool_t const *inst, rlm_redis_ippool_thread_t *thread,
+			      REQUEST *request, ippool_action_t action)
 {
 	uint8_t		key_prefix_buff[IPPOOL_MAX_KEY_PREFIX_SIZE], device_id_buff[256], gateway_id_buff[256];
 	uint8_t const	*key_prefix, *device_id = NULL, *gateway_id = NULL;
@@ -1065,6 +1312,9 @@ static rlm_rcode_t mod_action(rlm_redis_ippool_t const *inst, REQUEST *request,
 	char const	*expires_str;
 	unsigned long	expires = 0;
 	char		*q;
+	struct timeval	now;
+	ippool_op_t	*op;
+	rlm_rcode_t	rcode;
 
 	slen = ippool_pool_name(&key_prefix, (uint8_t *)&key_prefix_buff, sizeof(key_prefix_len), inst, request);
 	if (slen < 0) return RLM_MODULE_FAIL;
@@ -1094,36 +1344,47 @@ static rlm_rcode_t mod_action(rlm_redis_ippool_t const *inst, REQUEST *request,
 		gateway_id_len = (size_t)slen;
 	}
 
+	now = fr_time_to_timeval(fr_time());
+
+	MEM(op = talloc_zero(request, ippool_op_t));
+	op->inst = inst;
+	op->action = action;
+
 	switch (action) {
 	case POOL_ACTION_ALLOCATE:
 		if (tmpl_expand(&expires_str, expires_buff, sizeof(expires_buff),
 				request, inst->offer_time, NULL, NULL) < 0) {
 			REDEBUG("Failed expanding offer_time (%s)", inst->offer_time->name);
-			return RLM_MODULE_FAIL;
+			rcode = RLM_MODULE_FAIL;
+			goto finish;
 		}
 
 		expires = strtoul(expires_str, &q, 10);
 		if (q != (expires_str + strlen(expires_str))) {
 			REDEBUG("Invalid offer_time.  Must be an integer value");
-			return RLM_MODULE_FAIL;
+			rcode = RLM_MODULE_FAIL;
+			goto finish;
 		}
 
 		ippool_action_print(request, action, L_DBG_LVL_2, key_prefix, key_prefix_len, NULL,
 				    device_id, device_id_len, gateway_id, gateway_id_len, expires);
-		switch (redis_ippool_allocate(inst, request, key_prefix, key_prefix_len,
-					      device_id, device_id_len,
-					      gateway_id, gateway_id_len, (uint32_t)expires)) {
-		case IPPOOL_RCODE_SUCCESS:
-			RDEBUG2("IP address lease allocated");
-			return RLM_MODULE_UPDATED;
 
-		case IPPOOL_RCODE_POOL_EMPTY:
-			RWDEBUG("Pool contains no free addresses");
-			return RLM_MODULE_NOTFOUND;
-
-		default:
-			return RLM_MODULE_FAIL;
-		}
+		/*
+		 *	hiredis doesn't deal well with NULL string pointers
+		 */
+		fr_assert(device_id);
+		if (!gateway_id) gateway_id = (uint8_t const *)"";
+
+		op->digest = lua_alloc_digest;
+		op->script = lua_alloc_cmd;
+		op->cmd = ippool_command_format(op, &op->cmd_len,
+						"EVALSHA %s 1 %b %u %u %b %b",
+						lua_alloc_digest,
+						key_prefix, key_prefix_len,
+						(unsigned int)now.tv_sec, (uint32_t)expires,
+						device_id, device_id_len,
+						gateway_id, gateway_id_len);
+		break;
 
 	case POOL_ACTION_UPDATE:
 	{
@@ -1133,75 +1394,67 @@ static rlm_rcode_t mod_action(rlm_redis_ippool_t const *inst, REQUEST *request,
 		if (tmpl_expand(&expires_str, expires_buff, sizeof(expires_buff),
 				request, inst->lease_time, NULL, NULL) < 0) {
 			REDEBUG("Failed expanding lease_time (%s)", inst->lease_time->name);
-			return RLM_MODULE_FAIL;
+			rcode = RLM_MODULE_FAIL;
+			goto finish;
 		}
 
 		expires = strtoul(expires_str, &q, 10);
 		if (q != (expires_str + strlen(expires_str))) {
 			REDEBUG("Invalid expires.  Must be an integer value");
-			return RLM_MODULE_FAIL;
+			rcode = RLM_MODULE_FAIL;
+			goto finish;
 		}
 
 		if (tmpl_expand(&ip_str, ip_buff, sizeof(ip_buff), request, inst->requested_address, NULL, NULL) < 0) {
 			REDEBUG("Failed expanding requested_address (%s)", inst->requested_address->name);
-			return RLM_MODULE_FAIL;
+			rcode = RLM_MODULE_FAIL;
+			goto finish;
 		}
 
 		if (fr_inet_pton(&ip, ip_str, -1, AF_UNSPEC, false, true) < 0) {
 			RPEDEBUG("Failed parsing address");
-			return RLM_MODULE_FAIL;
+			rcode = RLM_MODULE_FAIL;
+			goto finish;
 		}
 
 		ippool_action_print(request, action, L_DBG_LVL_2, key_prefix, key_prefix_len,
 				    ip_str, device_id, device_id_len, gateway_id, gateway_id_len, expires);
-		switch (redis_ippool_update(inst, request, key_prefix, key_prefix_len,
-					    &ip, device_id, device_id_len,
-					    gateway_id, gateway_id_len, (uint32_t)expires)) {
-		case IPPOOL_RCODE_SUCCESS:
-			RDEBUG2("Requested IP address' \"%s\" lease updated", ip_str);
 
-			/*
-			 *	Copy over the input IP address to the reply attribute
-			 */
-			if (inst->copy_on_update) {
-				vp_tmpl_t ip_rhs = {
-					.name = "",
-					.type = TMPL_TYPE_DATA,
-					.quote = T_BARE_WORD,
-				};
-				vp_map_t ip_map = {
-					.lhs = inst->allocated_address_attr,
-					.op = T_OP_SET,
-					.rhs = &ip_rhs
-				};
-
-				fr_value_box_strdup_shallow(&ip_rhs.data.literal, NULL, ip_str, false);
-
-				if (map_to_request(request, &ip_map, map_to_vp, NULL) < 0) return RLM_MODULE_FAIL;
-			}
-			return RLM_MODULE_UPDATED;
+		strlcpy(op->ip_str, ip_str, sizeof(op->ip_str));
+		op->expires = (uint32_t)expires;
 
 		/*
-		 *	It's useful to be able to identify the 'not found' case
-		 *	as we can relay to a server where the IP address might
-		 *	be found.  This extremely useful for migrations.
+		 *	hiredis doesn't deal well with NULL string pointers
 		 */
-		case IPPOOL_RCODE_NOT_FOUND:
-			REDEBUG("Requested IP address \"%s\" is not a member of the specified pool", ip_str);
-			return RLM_MODULE_NOTFOUND;
-
-		case IPPOOL_RCODE_EXPIRED:
-			REDEBUG("Requested IP address' \"%s\" lease already expired at time of renewal", ip_str);
-			return RLM_MODULE_INVALID;
-
-		case IPPOOL_RCODE_DEVICE_MISMATCH:
-			REDEBUG("Requested IP address' \"%s\" lease allocated to another device", ip_str);
-			return RLM_MODULE_INVALID;
-
-		default:
-			return RLM_MODULE_FAIL;
+		if (!device_id) device_id = (uint8_t const *)"";
+		if (!gateway_id) gateway_id = (uint8_t const *)"";
+
+		op->digest = lua_update_digest;
+		op->script = lua_update_cmd;
+		if ((ip.af == AF_INET) && inst->ipv4_integer) {
+			op->cmd = ippool_command_format(op, &op->cmd_len,
+							"EVALSHA %s 1 %b %u %u %u %b %b",
+							lua_update_digest,
+							key_prefix, key_prefix_len,
+							(unsigned int)now.tv_sec, (uint32_t)expires,
+							htonl(ip.addr.v4.s_addr),
+							device_id, device_id_len,
+							gateway_id, gateway_id_len);
+		} else {
+			char ip_prefix_buff[FR_IPADDR_PREFIX_STRLEN];
+
+			IPPOOL_SPRINT_IP(ip_prefix_buff, &ip, ip.prefix);
+			op->cmd = ippool_command_format(op, &op->cmd_len,
+							"EVALSHA %s 1 %b %u %u %s %b %b",
+							lua_update_digest,
+							key_prefix, key_prefix_len,
+							(unsigned int)now.tv_sec, (uint32_t)expires,
+							ip_prefix_buff,
+							device_id, device_id_len,
+							gateway_id, gateway_id_len);
 		}
 	}
+		break;
 
 	case POOL_ACTION_RELEASE:
 	{
@@ -1210,52 +1463,108 @@ static rlm_rcode_t mod_action(rlm_redis_ippool_t const *inst, REQUEST *request,
 
 		if (tmpl_expand(&ip_str, ip_buff, sizeof(ip_buff), request, inst->requested_address, NULL, NULL) < 0) {
 			REDEBUG("Failed expanding requested_address (%s)", inst->requested_address->name);
-			return RLM_MODULE_FAIL;
+			rcode = RLM_MODULE_FAIL;
+			goto finish;
 		}
 
 		if (fr_inet_pton(&ip, ip_str, -1, AF_UNSPEC, false, true) < 0) {
 			RPEDEBUG("Failed parsing address");
-			return RLM_MODULE_FAIL;
+			rcode = RLM_MODULE_FAIL;
+			goto finish;
 		}
 
 		ippool_action_print(request, action, L_DBG_LVL_2, key_prefix, key_prefix_len,
 				    ip_str, device_id, device_id_len, gateway_id, gateway_id_len, 0);
-		switch (redis_ippool_release(inst, request, key_prefix, key_prefix_len,
-					     &ip, device_id, device_id_len)) {
-		case IPPOOL_RCODE_SUCCESS:
-			RDEBUG2("IP address \"%s\" released", ip_str);
-			return RLM_MODULE_UPDATED;
+
+		strlcpy(op->ip_str, ip_str, sizeof(op->ip_str));
 
 		/*
-		 *	It's useful to be able to identify the 'not found' case
-		 *	as we can relay to a server where the IP address might
-		 *	be found.  This extremely useful for migrations.
+		 *	hiredis doesn't deal well with NULL string pointers
 		 */
-		case IPPOOL_RCODE_NOT_FOUND:
-			REDEBUG("Requested IP address \"%s\" is not a member of the specified pool", ip_str);
-			return RLM_MODULE_NOTFOUND;
-
-		case IPPOOL_RCODE_DEVICE_MISMATCH:
-			REDEBUG("Requested IP address' \"%s\" lease allocated to another device", ip_str);
-			return RLM_MODULE_INVALID;
-
-		default:
-			return RLM_MODULE_FAIL;
+		if (!device_id) device_id = (uint8_t const *)"";
+
+		op->digest = lua_release_digest;
+		op->script = lua_release_cmd;
+		if ((ip.af == AF_INET) && inst->ipv4_integer) {
+			op->cmd = ippool_command_format(op, &op->cmd_len,
+							"EVALSHA %s 1 %b %u %u %b",
+							lua_release_digest,
+							key_prefix, key_prefix_len,
+							(unsigned int)now.tv_sec,
+							htonl(ip.addr.v4.s_addr),
+							device_id, device_id_len);
+		} else {
+			char ip_prefix_buff[FR_IPADDR_PREFIX_STRLEN];
+
+			IPPOOL_SPRINT_IP(ip_prefix_buff, &ip, ip.prefix);
+			op->cmd = ippool_command_format(op, &op->cmd_len,
+							"EVALSHA %s 1 %b %u %s %b",
+							lua_release_digest,
+							key_prefix, key_prefix_len,
+							(unsigned int)now.tv_sec,
+							ip_prefix_buff,
+							device_id, device_id_len);
 		}
 	}
+		break;
 
 	case POOL_ACTION_BULK_RELEASE:
 		RDEBUG2("Bulk release not yet implemented");
-		return RLM_MODULE_NOOP;
+		rcode = RLM_MODULE_NOOP;
+		goto finish;
 
 	default:
 		fr_assert(0);
-		return RLM_MODULE_FAIL;
+		rcode = RLM_MODULE_FAIL;
+		goto finish;
+	}
+
+	if (!op->cmd) {
+		REDEBUG("Failed formatting EVALSHA command");
+		rcode = RLM_MODULE_FAIL;
+		goto finish;
+	}
+
+	if (inst->async) {
+		fr_redis_cluster_key_slot_t const	*key_slot;
+		fr_redis_cluster_node_t const		*node;
+		fr_ipaddr_t				node_ipaddr;
+		uint16_t				node_port;
+
+		/*
+		 *	The pool's keys all share a hash tag, so
+		 *	any operation on the pool is sent to the
+		 *	master responsible for the pool name.
+		 */
+		key_slot = fr_redis_cluster_slot_by_key(inst->cluster, request, key_prefix, key_prefix_len);
+		node = fr_redis_cluster_master(inst->cluster, key_slot);
+		if (!node || (fr_redis_cluster_ipaddr(&node_ipaddr, node) < 0) ||
+		    (fr_redis_cluster_port(&node_port, node) < 0)) {
+			REDEBUG("No cluster node available for pool");
+			rcode = RLM_MODULE_FAIL;
+			goto finish;
+		}
+
+		op->rtrunk = fr_redis_cluster_thread_trunk(thread->cluster_thread, &node_ipaddr, node_port);
+		if (!op->rtrunk) {
+			REDEBUG("Failed allocating trunk for cluster node");
+			rcode = RLM_MODULE_FAIL;
+			goto finish;
+		}
+
+		return ippool_async_send(op, request, false);
 	}
+
+	rcode = ippool_op_sync(op, request, key_prefix, key_prefix_len);
+
+finish:
+	talloc_free(op);
+
+	return rcode;
 }
 
-static rlm_rcode_t mod_accounting(void *instance, UNUSED void *thread, REQUEST *request) CC_HINT(nonnull);
-static rlm_rcode_t mod_accounting(void *instance, UNUSED void *thread, REQUEST *request)
+static rlm_rcode_t mod_accounting(void *instance, void *thread, REQUEST *request) CC_HINT(nonnull);
+static rlm_rcode_t mod_accounting(void *instance, void *thread, REQUEST *request)
 {
 	rlm_redis_ippool_t const	*inst = instance;
 	VALUE_PAIR			*vp;
@@ -1264,7 +1573,7 @@ static rlm_rcode_t mod_accounting(void *instance, UNUSED void *thread, REQUEST *
 	 *	Pool-Action override
 	 */
 	vp = fr_pair_find_by_da(request->control, attr_pool_action, TAG_ANY);
-	if (vp) return mod_action(inst, request, vp->vp_uint32);
+	if (vp) return mod_action(inst, thread, request, vp->vp_uint32);
 
 	/*
 	 *	Otherwise, guess the action by Acct-Status-Type
@@ -1278,22 +1587,22 @@ static rlm_rcode_t mod_accounting(void *instance, UNUSED void *thread, REQUEST *
 	switch (vp->vp_uint32) {
 	case FR_STATUS_START:
 	case FR_STATUS_ALIVE:
-		return mod_action(inst, request, POOL_ACTION_UPDATE);
+		return mod_action(inst, thread, request, POOL_ACTION_UPDATE);
 
 	case FR_STATUS_STOP:
-		return mod_action(inst, request, POOL_ACTION_RELEASE);
+		return mod_action(inst, thread, request, POOL_ACTION_RELEASE);
 
 	case FR_STATUS_ACCOUNTING_OFF:
 	case FR_STATUS_ACCOUNTING_ON:
-		return mod_action(inst, request, POOL_ACTION_BULK_RELEASE);
+		return mod_action(inst, thread, request, POOL_ACTION_BULK_RELEASE);
 
 	default:
 		return RLM_MODULE_NOOP;
 	}
 }
 
-static rlm_rcode_t mod_authorize(void *instance, UNUSED void *thread, REQUEST *request) CC_HINT(nonnull);
-static rlm_rcode_t mod_authorize(void *instance, UNUSED void *thread, REQUEST *request)
+static rlm_rcode_t mod_authorize(void *instance, void *thread, REQUEST *request) CC_HINT(nonnull);
+static rlm_rcode_t mod_authorize(void *instance, void *thread, REQUEST *request)
 {
 	rlm_redis_ippool_t const	*inst = instance;
 	VALUE_PAIR			*vp;
@@ -1303,11 +1612,11 @@ static rlm_rcode_t mod_authorize(void *instance, UNUSED void *thread, REQUEST *r
 	 *	when called in Post-Auth.
 	 */
 	vp = fr_pair_find_by_da(request->control, attr_pool_action, TAG_ANY);
-	return mod_action(inst, request, vp ? vp->vp_uint32 : POOL_ACTION_ALLOCATE);
+	return mod_action(inst, thread, request, vp ? vp->vp_uint32 : POOL_ACTION_ALLOCATE);
 }
 
-static rlm_rcode_t mod_post_auth(void *instance, UNUSED void *thread, REQUEST *request) CC_HINT(nonnull);
-static rlm_rcode_t mod_post_auth(void *instance, UNUSED void *thread, REQUEST *request)
+static rlm_rcode_t mod_post_auth(void *instance, void *thread, REQUEST *request) CC_HINT(nonnull);
+static rlm_rcode_t mod_post_auth(void *instance, void *thread, REQUEST *request)
 {
 	rlm_redis_ippool_t const	*inst = instance;
 	VALUE_PAIR			*vp;
@@ -1336,7 +1645,7 @@ static rlm_rcode_t mod_post_auth(void *instance, UNUSED void *thread, REQUEST *r
 	}
 
 run:
-	return mod_action(inst, request, action);
+	return mod_action(inst, thread, request, action);
 }
 
 static int mod_instantiate(void *instance, CONF_SECTION *conf)
@@ -1386,6 +1695,39 @@ static int mod_instantiate(void *instance, CONF_SECTION *conf)
 	 */
 	if (!inst->offer_time) inst->offer_time = inst->lease_time;
 
+	/*
+	 *	Template for the connections to each of
+	 *	the cluster's nodes.
+	 */
+	inst->io_conf.database = inst->conf.database;
+	inst->io_conf.password = inst->conf.password;
+	inst->name = cf_section_name2(conf);
+	if (!inst->name) inst->name = cf_section_name1(conf);
+	inst->io_conf.log_prefix = talloc_typed_asprintf(inst, "rlm_redis_ippool (%s)", inst->name);
+
+	/*
+	 *	Lease operations are sent over the per-thread trunks
+	 *	and the request yields, so calls to this instance must
+	 *	never be run on an offload thread.
+	 */
+	if (inst->async) module_instance_type_set(instance, RLM_TYPE_THREAD_SAFE | RLM_TYPE_RESUMABLE);
+
+	return 0;
+}
+
+/** Allocate the per-thread trunks used when async is enabled
+ *
+ */
+static int mod_thread_instantiate(UNUSED CONF_SECTION const *conf, void *instance, fr_event_list_t *el, void *thread)
+{
+	rlm_redis_ippool_t const	*inst = instance;
+	rlm_redis_ippool_thread_t	*t = talloc_get_type_abort(thread, rlm_redis_ippool_thread_t);
+
+	if (!inst->async) return 0;
+
+	t->cluster_thread = fr_redis_cluster_thread_alloc(t, el, &inst->trunk_conf, &inst->io_conf);
+	if (!t->cluster_thread) return -1;
+
 	return 0;
 }
 
@@ -1400,11 +1742,14 @@ extern module_t rlm_redis_ippool;
 module_t rlm_redis_ippool = {
 	.magic		= RLM_MODULE_INIT,
 	.name		= "redis",
-	.type		= RLM_TYPE_THREAD_SAFE,
+	.type		= RLM_TYPE_THREAD_SAFE | RLM_TYPE_BLOCKING,
 	.inst_size	= sizeof(rlm_redis_ippool_t),
 	.config		= module_config,
 	.onload		= mod_load,
 	.instantiate	= mod_instantiate,
+	.thread_inst_size	= sizeof(rlm_redis_ippool_thread_t),
+	.thread_inst_type	= "rlm_redis_ippool_thread_t",
+	.thread_instantiate	= mod_thread_instantiate,
 	.methods = {
 		[MOD_ACCOUNTING]	= mod_accounting,
 		[MOD_AUTHORIZE]		= mod_authorize,
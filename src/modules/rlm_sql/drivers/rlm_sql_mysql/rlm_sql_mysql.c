@@ -69,6 +69,21 @@ DIAG_ON(strict-prototypes)
 #define HAVE_TLS_VERIFY_OPTIONS 0
 #endif
 
+/*
+ *	Non-blocking connect and query.  MariaDB provides _start/_cont
+ *	variants of the blocking functions, MySQL >= 8.0.16 provides
+ *	_nonblocking variants.
+ */
+#if defined(MYSQL_WAIT_READ)
+#  define HAVE_MYSQL_ASYNC		1
+#  define MYSQL_SOCKET(_conn)		mysql_get_socket(&(_conn)->db)
+#elif !defined(MARIADB_BASE_VERSION) && (MYSQL_VERSION_ID >= 80016)
+#  define HAVE_MYSQL_ASYNC		1
+#  define MYSQL_SOCKET(_conn)		((_conn)->db.net.fd)
+#else
+#  define HAVE_MYSQL_ASYNC		0
+#endif
+
 #include "rlm_sql.h"
 
 typedef enum {
@@ -88,6 +103,13 @@ typedef struct {
 	MYSQL		db;
 	MYSQL		*sock;
 	MYSQL_RES	*result;
+
+#if HAVE_MYSQL_ASYNC
+	unsigned long	flags;			//!< Flags passed to each non-blocking connect call.
+	char const	*query;			//!< Query passed to each non-blocking query call.
+	int		status;			//!< What MariaDB is waiting for.
+	int		ret;			//!< Result of the last MariaDB _start or _cont call.
+#endif
 } rlm_sql_mysql_conn_t;
 
 typedef struct {
@@ -217,18 +239,15 @@ static int mod_load(void)
 	return 0;
 }
 
-static sql_rcode_t sql_socket_init(rlm_sql_handle_t *handle, rlm_sql_config_t *config, fr_time_delta_t timeout)
+/** Initialise the MySQL handle and set connection options
+ *
+ * @return the client flags to connect with.
+ */
+static unsigned long sql_options_set(rlm_sql_mysql_conn_t *conn, rlm_sql_config_t *config, unsigned int connect_timeout)
 {
-	rlm_sql_mysql_conn_t *conn;
 	rlm_sql_mysql_t *inst = config->driver;
-	unsigned int connect_timeout = (unsigned int)fr_time_delta_to_sec(timeout);
 	unsigned long sql_flags;
 
-	MEM(conn = handle->conn = talloc_zero(handle, rlm_sql_mysql_conn_t));
-	talloc_set_destructor(conn, _sql_socket_destructor);
-
-	DEBUG("Starting connect to MySQL server");
-
 	mysql_init(&(conn->db));
 
 	/*
@@ -323,14 +342,14 @@ static sql_rcode_t sql_socket_init(rlm_sql_handle_t *handle, rlm_sql_config_t *c
 #ifdef CLIENT_MULTI_STATEMENTS
 	sql_flags |= CLIENT_MULTI_STATEMENTS;
 #endif
-	conn->sock = mysql_real_connect(&(conn->db),
-					config->sql_server,
-					config->sql_login,
-					config->sql_password,
-					config->sql_db,
-					config->sql_port,
-					NULL,
-					sql_flags);
+	return sql_flags;
+}
+
+/** Log the result of connecting to the server
+ *
+ */
+static sql_rcode_t sql_connect_result(rlm_sql_mysql_conn_t *conn, rlm_sql_config_t *config)
+{
 	if (!conn->sock) {
 		ERROR("Couldn't connect to MySQL server %s@%s:%s", config->sql_login,
 		      config->sql_server, config->sql_db);
@@ -347,6 +366,31 @@ static sql_rcode_t sql_socket_init(rlm_sql_handle_t *handle, rlm_sql_config_t *c
 	return RLM_SQL_OK;
 }
 
+static sql_rcode_t sql_socket_init(rlm_sql_handle_t *handle, rlm_sql_config_t *config, fr_time_delta_t timeout)
+{
+	rlm_sql_mysql_conn_t *conn;
+	unsigned int connect_timeout = (unsigned int)fr_time_delta_to_sec(timeout);
+	unsigned long sql_flags;
+
+	MEM(conn = handle->conn = talloc_zero(handle, rlm_sql_mysql_conn_t));
+	talloc_set_destructor(conn, _sql_socket_destructor);
+
+	DEBUG("Starting connect to MySQL server");
+
+	sql_flags = sql_options_set(conn, config, connect_timeout);
+
+	conn->sock = mysql_real_connect(&(conn->db),
+					config->sql_server,
+					config->sql_login,
+					config->sql_password,
+					config->sql_db,
+					config->sql_port,
+					NULL,
+					sql_flags);
+
+	return sql_connect_result(conn, config);
+}
+
 /** Analyse the last error that occurred on the socket, and determine an action
  *
  * @param server Socket from which to extract the server error. May be NULL.
@@ -417,18 +461,14 @@ static sql_rcode_t sql_check_error(MYSQL *server, int client_errno)
 	return RLM_SQL_OK;
 }
 
-static sql_rcode_t sql_query(rlm_sql_handle_t *handle, UNUSED rlm_sql_config_t *config, char const *query)
+/** Check the result of a query once the server has responded
+ *
+ */
+static sql_rcode_t sql_query_result(rlm_sql_mysql_conn_t *conn)
 {
-	rlm_sql_mysql_conn_t *conn = handle->conn;
 	sql_rcode_t rcode;
 	char const *info;
 
-	if (!conn->sock) {
-		ERROR("Socket not connected");
-		return RLM_SQL_RECONNECT;
-	}
-
-	mysql_query(conn->sock, query);
 	rcode = sql_check_error(conn->sock, 0);
 	if (rcode != RLM_SQL_OK) {
 		return rcode;
@@ -441,6 +481,185 @@ static sql_rcode_t sql_query(rlm_sql_handle_t *handle, UNUSED rlm_sql_config_t *
 	return RLM_SQL_OK;
 }
 
+static sql_rcode_t sql_query(rlm_sql_handle_t *handle, UNUSED rlm_sql_config_t *config, char const *query)
+{
+	rlm_sql_mysql_conn_t *conn = handle->conn;
+
+	if (!conn->sock) {
+		ERROR("Socket not connected");
+		return RLM_SQL_RECONNECT;
+	}
+
+	mysql_query(conn->sock, query);
+
+	return sql_query_result(conn);
+}
+
+#if HAVE_MYSQL_ASYNC
+#  ifdef MYSQL_WAIT_READ
+/** Record what MariaDB is waiting for
+ *
+ */
+static sql_rcode_t sql_async_wait(sql_io_wait_t *wait_out, rlm_sql_mysql_conn_t *conn, int status)
+{
+	conn->status = status;
+
+	*wait_out = SQL_IO_WAIT_NONE;
+	if (status & MYSQL_WAIT_READ) *wait_out |= SQL_IO_WAIT_READ;
+	if (status & MYSQL_WAIT_WRITE) *wait_out |= SQL_IO_WAIT_WRITE;
+
+	return RLM_SQL_AGAIN;
+}
+#  endif
+
+/** Start a non-blocking connection to the server
+ *
+ */
+static sql_rcode_t sql_socket_init_async(int *fd_out, sql_io_wait_t *wait_out,
+					 rlm_sql_handle_t *handle, rlm_sql_config_t *config)
+{
+	rlm_sql_mysql_conn_t *conn;
+
+	MEM(conn = handle->conn = talloc_zero(handle, rlm_sql_mysql_conn_t));
+	talloc_set_destructor(conn, _sql_socket_destructor);
+
+	DEBUG("Starting non-blocking connect to MySQL server");
+
+	conn->flags = sql_options_set(conn, config, 0);
+
+#  ifdef MYSQL_WAIT_READ
+	mysql_options(&(conn->db), MYSQL_OPT_NONBLOCK, 0);
+
+	conn->status = mysql_real_connect_start(&conn->sock, &(conn->db),
+						config->sql_server,
+						config->sql_login,
+						config->sql_password,
+						config->sql_db,
+						config->sql_port,
+						NULL,
+						conn->flags);
+	*fd_out = MYSQL_SOCKET(conn);
+	if (conn->status) return sql_async_wait(wait_out, conn, conn->status);
+#  else
+	switch (mysql_real_connect_nonblocking(&(conn->db),
+					       config->sql_server,
+					       config->sql_login,
+					       config->sql_password,
+					       config->sql_db,
+					       config->sql_port,
+					       NULL,
+					       conn->flags)) {
+	case NET_ASYNC_NOT_READY:
+		*fd_out = MYSQL_SOCKET(conn);
+		*wait_out = SQL_IO_WAIT_READ;
+		return RLM_SQL_AGAIN;
+
+	case NET_ASYNC_ERROR:
+		conn->sock = NULL;
+		break;
+
+	default:
+		conn->sock = &(conn->db);
+		break;
+	}
+	*fd_out = MYSQL_SOCKET(conn);
+#  endif
+
+	*wait_out = SQL_IO_WAIT_NONE;
+
+	return sql_connect_result(conn, config);
+}
+
+static sql_rcode_t sql_socket_continue(int *fd_out, sql_io_wait_t *wait_out,
+				       rlm_sql_handle_t *handle, rlm_sql_config_t *config)
+{
+	rlm_sql_mysql_conn_t *conn = handle->conn;
+
+#  ifdef MYSQL_WAIT_READ
+	conn->status = mysql_real_connect_cont(&conn->sock, &(conn->db), conn->status);
+	*fd_out = MYSQL_SOCKET(conn);
+	if (conn->status) return sql_async_wait(wait_out, conn, conn->status);
+#  else
+	switch (mysql_real_connect_nonblocking(&(conn->db),
+					       config->sql_server,
+					       config->sql_login,
+					       config->sql_password,
+					       config->sql_db,
+					       config->sql_port,
+					       NULL,
+					       conn->flags)) {
+	case NET_ASYNC_NOT_READY:
+		*fd_out = MYSQL_SOCKET(conn);
+		*wait_out = SQL_IO_WAIT_READ;
+		return RLM_SQL_AGAIN;
+
+	case NET_ASYNC_ERROR:
+		conn->sock = NULL;
+		break;
+
+	default:
+		conn->sock = &(conn->db);
+		break;
+	}
+	*fd_out = MYSQL_SOCKET(conn);
+#  endif
+
+	*wait_out = SQL_IO_WAIT_NONE;
+
+	return sql_connect_result(conn, config);
+}
+
+static sql_rcode_t sql_query_continue(sql_io_wait_t *wait_out, rlm_sql_handle_t *handle,
+				      UNUSED rlm_sql_config_t *config)
+{
+	rlm_sql_mysql_conn_t *conn = handle->conn;
+
+#  ifdef MYSQL_WAIT_READ
+	conn->status = mysql_real_query_cont(&conn->ret, conn->sock, conn->status);
+	if (conn->status) return sql_async_wait(wait_out, conn, conn->status);
+#  else
+	switch (mysql_real_query_nonblocking(conn->sock, conn->query, strlen(conn->query))) {
+	case NET_ASYNC_NOT_READY:
+		*wait_out = SQL_IO_WAIT_READ;
+		return RLM_SQL_AGAIN;
+
+	default:
+		break;
+	}
+#  endif
+
+	*wait_out = SQL_IO_WAIT_NONE;
+	conn->query = NULL;
+
+	return sql_query_result(conn);
+}
+
+static sql_rcode_t sql_query_send(sql_io_wait_t *wait_out, rlm_sql_handle_t *handle,
+				  UNUSED rlm_sql_config_t *config, char const *query)
+{
+	rlm_sql_mysql_conn_t *conn = handle->conn;
+
+	if (!conn->sock) {
+		ERROR("Socket not connected");
+		return RLM_SQL_RECONNECT;
+	}
+
+	conn->query = query;
+
+#  ifdef MYSQL_WAIT_READ
+	conn->status = mysql_real_query_start(&conn->ret, conn->sock, query, strlen(query));
+	if (conn->status) return sql_async_wait(wait_out, conn, conn->status);
+
+	*wait_out = SQL_IO_WAIT_NONE;
+	conn->query = NULL;
+
+	return sql_query_result(conn);
+#  else
+	return sql_query_continue(wait_out, handle, config);
+#  endif
+}
+#endif
+
 static sql_rcode_t sql_store_result(rlm_sql_handle_t *handle, UNUSED rlm_sql_config_t *config)
 {
 	rlm_sql_mysql_conn_t *conn = handle->conn;
@@ -864,5 +1083,11 @@ rlm_sql_driver_t rlm_sql_mysql = {
 	.sql_error			= sql_error,
 	.sql_finish_query		= sql_finish_query,
 	.sql_finish_select_query	= sql_finish_query,
-	.sql_escape_func		= sql_escape_func
+	.sql_escape_func		= sql_escape_func,
+#if HAVE_MYSQL_ASYNC
+	.sql_socket_init_async		= sql_socket_init_async,
+	.sql_socket_continue		= sql_socket_continue,
+	.sql_query_send			= sql_query_send,
+	.sql_query_continue		= sql_query_continue
+#endif
 };
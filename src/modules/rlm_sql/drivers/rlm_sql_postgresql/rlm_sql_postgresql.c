@@ -254,6 +254,86 @@ static int CC_HINT(nonnull) sql_socket_init(rlm_sql_handle_t *handle, rlm_sql_co
 	return 0;
 }
 
+/** Retrieve and classify the result of a query, once libpq has read all of it
+ *
+ */
+static sql_rcode_t sql_query_result(rlm_sql_postgres_t *inst, rlm_sql_postgres_conn_t *conn)
+{
+	PGresult		*tmp_result;
+	int			numfields = 0;
+	ExecStatusType		status;
+
+	/*
+	 *  Returns a PGresult pointer or possibly a null pointer.
+	 *  A non-null pointer will generally be returned except in
+	 *  out-of-memory conditions or serious errors such as inability
+	 *  to send the command to the server. If a null pointer is
+	 *  returned, it should be treated like a PGRES_FATAL_ERROR
+	 *  result.
+	 */
+	conn->result = PQgetResult(conn->db);
+
+	/* Discard results for appended queries */
+	while ((tmp_result = PQgetResult(conn->db)) != NULL)
+		PQclear(tmp_result);
+
+	/*
+	 *  As this error COULD be a connection error OR an out-of-memory
+	 *  condition return value WILL be wrong SOME of the time
+	 *  regardless! Pick your poison...
+	 */
+	if (!conn->result) {
+		ERROR("Failed getting query result: %s", PQerrorMessage(conn->db));
+		return RLM_SQL_RECONNECT;
+	}
+
+	status = PQresultStatus(conn->result);
+	switch (status){
+	/*
+	 *  Successful completion of a command returning no data.
+	 */
+	case PGRES_COMMAND_OK:
+		/*
+		 *  Affected_rows function only returns the number of affected rows of a command
+		 *  returning no data...
+		 */
+		conn->affected_rows = affected_rows(conn->result);
+		DEBUG2("query affected rows = %i", conn->affected_rows);
+		break;
+	/*
+	 *  Successful completion of a command returning data (such as a SELECT or SHOW).
+	 */
+#ifdef HAVE_PGRES_SINGLE_TUPLE
+	case PGRES_SINGLE_TUPLE:
+#endif
+	case PGRES_TUPLES_OK:
+		conn->cur_row = 0;
+		conn->affected_rows = PQntuples(conn->result);
+		numfields = PQnfields(conn->result); /*Check row storing functions..*/
+		DEBUG2("query returned rows = %i, fields = %i", conn->affected_rows, numfields);
+		break;
+
+#ifdef HAVE_PGRES_COPY_BOTH
+	case PGRES_COPY_BOTH:
+#endif
+	case PGRES_COPY_OUT:
+	case PGRES_COPY_IN:
+		DEBUG2("Data transfer started");
+		break;
+
+	/*
+	 *  Weird.. this shouldn't happen.
+	 */
+	case PGRES_EMPTY_QUERY:
+	case PGRES_BAD_RESPONSE:	/* The server's response was not understood */
+	case PGRES_NONFATAL_ERROR:
+	case PGRES_FATAL_ERROR:
+		break;
+	}
+
+	return sql_classify_error(inst, status, conn->result);
+}
+
 static CC_HINT(nonnull) sql_rcode_t sql_query(rlm_sql_handle_t *handle, rlm_sql_config_t *config,
 					      char const *query)
 {
@@ -262,9 +342,6 @@ static CC_HINT(nonnull) sql_rcode_t sql_query(rlm_sql_handle_t *handle, rlm_sql_
 	fr_time_delta_t		timeout = fr_time_delta_from_sec(config->query_timeout);
 	fr_time_t		start;
 	int			sockfd;
-	PGresult		*tmp_result;
-	int			numfields = 0;
-	ExecStatusType		status;
 
 	if (!conn->db) {
 		ERROR("Socket not connected");
@@ -317,75 +394,150 @@ static CC_HINT(nonnull) sql_rcode_t sql_query(rlm_sql_handle_t *handle, rlm_sql_
 		}
 	}
 
-	/*
-	 *  Returns a PGresult pointer or possibly a null pointer.
-	 *  A non-null pointer will generally be returned except in
-	 *  out-of-memory conditions or serious errors such as inability
-	 *  to send the command to the server. If a null pointer is
-	 *  returned, it should be treated like a PGRES_FATAL_ERROR
-	 *  result.
-	 */
-	conn->result = PQgetResult(conn->db);
+	return sql_query_result(inst, conn);
+}
 
-	/* Discard results for appended queries */
-	while ((tmp_result = PQgetResult(conn->db)) != NULL)
-		PQclear(tmp_result);
+/** Start a non-blocking connection to the server
+ *
+ */
+static sql_rcode_t CC_HINT(nonnull) sql_socket_init_async(int *fd_out, sql_io_wait_t *wait_out,
+							  rlm_sql_handle_t *handle, rlm_sql_config_t *config)
+{
+	rlm_sql_postgres_t *inst = config->driver;
+	rlm_sql_postgres_conn_t *conn;
 
-	/*
-	 *  As this error COULD be a connection error OR an out-of-memory
-	 *  condition return value WILL be wrong SOME of the time
-	 *  regardless! Pick your poison...
-	 */
-	if (!conn->result) {
-		ERROR("Failed getting query result: %s", PQerrorMessage(conn->db));
-		return RLM_SQL_RECONNECT;
+	MEM(conn = handle->conn = talloc_zero(handle, rlm_sql_postgres_conn_t));
+	talloc_set_destructor(conn, _sql_socket_destructor);
+
+	DEBUG2("Connecting using parameters: %s", inst->db_string);
+	conn->db = PQconnectStart(inst->db_string);
+	if (!conn->db) {
+		ERROR("Connection failed: Out of memory");
+		return RLM_SQL_ERROR;
+	}
+	if (PQstatus(conn->db) == CONNECTION_BAD) {
+		ERROR("Connection failed: %s", PQerrorMessage(conn->db));
+		PQfinish(conn->db);
+		conn->db = NULL;
+		return RLM_SQL_ERROR;
 	}
 
-	status = PQresultStatus(conn->result);
-	switch (status){
 	/*
-	 *  Successful completion of a command returning no data.
+	 *  libpq says to behave as if PQconnectPoll
+	 *  had returned PGRES_POLLING_WRITING.
 	 */
-	case PGRES_COMMAND_OK:
-		/*
-		 *  Affected_rows function only returns the number of affected rows of a command
-		 *  returning no data...
-		 */
-		conn->affected_rows = affected_rows(conn->result);
-		DEBUG2("query affected rows = %i", conn->affected_rows);
+	*fd_out = PQsocket(conn->db);
+	*wait_out = SQL_IO_WAIT_WRITE;
+
+	return RLM_SQL_AGAIN;
+}
+
+/** Advance the connection state machine
+ *
+ */
+static sql_rcode_t CC_HINT(nonnull) sql_socket_continue(int *fd_out, sql_io_wait_t *wait_out,
+							rlm_sql_handle_t *handle, UNUSED rlm_sql_config_t *config)
+{
+	rlm_sql_postgres_conn_t *conn = handle->conn;
+
+	switch (PQconnectPoll(conn->db)) {
+	case PGRES_POLLING_READING:
+		*wait_out = SQL_IO_WAIT_READ;
 		break;
+
+	case PGRES_POLLING_WRITING:
+		*wait_out = SQL_IO_WAIT_WRITE;
+		break;
+
+	case PGRES_POLLING_OK:
+		if (PQsetnonblocking(conn->db, 1) < 0) {
+			ERROR("Failed setting connection to non-blocking: %s", PQerrorMessage(conn->db));
+			return RLM_SQL_ERROR;
+		}
+
+		DEBUG2("Connected to database '%s' on '%s' server version %i, protocol version %i, backend PID %i ",
+		       PQdb(conn->db), PQhost(conn->db), PQserverVersion(conn->db), PQprotocolVersion(conn->db),
+		       PQbackendPID(conn->db));
+
+		*wait_out = SQL_IO_WAIT_NONE;
+		return RLM_SQL_OK;
+
+	default:
+		ERROR("Connection failed: %s", PQerrorMessage(conn->db));
+		return RLM_SQL_ERROR;
+	}
+
 	/*
-	 *  Successful completion of a command returning data (such as a SELECT or SHOW).
+	 *  The socket may change between calls.
 	 */
-#ifdef HAVE_PGRES_SINGLE_TUPLE
-	case PGRES_SINGLE_TUPLE:
-#endif
-	case PGRES_TUPLES_OK:
-		conn->cur_row = 0;
-		conn->affected_rows = PQntuples(conn->result);
-		numfields = PQnfields(conn->result); /*Check row storing functions..*/
-		DEBUG2("query returned rows = %i, fields = %i", conn->affected_rows, numfields);
-		break;
+	*fd_out = PQsocket(conn->db);
 
-#ifdef HAVE_PGRES_COPY_BOTH
-	case PGRES_COPY_BOTH:
-#endif
-	case PGRES_COPY_OUT:
-	case PGRES_COPY_IN:
-		DEBUG2("Data transfer started");
-		break;
+	return RLM_SQL_AGAIN;
+}
+
+/** Flush any buffered query data, and figure out what we're waiting for next
+ *
+ */
+static sql_rcode_t sql_query_flush(sql_io_wait_t *wait_out, rlm_sql_postgres_conn_t *conn)
+{
+	switch (PQflush(conn->db)) {
+	case 0:
+		*wait_out = SQL_IO_WAIT_READ;
+		return RLM_SQL_AGAIN;
 
 	/*
-	 *  Weird.. this shouldn't happen.
+	 *  Data remains to be sent.  libpq says to wait
+	 *  for either, as the server may block sending
+	 *  until we read what it's already sent.
 	 */
-	case PGRES_EMPTY_QUERY:
-	case PGRES_BAD_RESPONSE:	/* The server's response was not understood */
-	case PGRES_NONFATAL_ERROR:
-	case PGRES_FATAL_ERROR:
-		break;
+	case 1:
+		*wait_out = SQL_IO_WAIT_READ | SQL_IO_WAIT_WRITE;
+		return RLM_SQL_AGAIN;
+
+	default:
+		ERROR("Failed sending query: %s", PQerrorMessage(conn->db));
+		return RLM_SQL_RECONNECT;
 	}
+}
+
+static sql_rcode_t CC_HINT(nonnull) sql_query_send(sql_io_wait_t *wait_out, rlm_sql_handle_t *handle,
+						   UNUSED rlm_sql_config_t *config, char const *query)
+{
+	rlm_sql_postgres_conn_t	*conn = handle->conn;
+
+	if (!conn->db) {
+		ERROR("Socket not connected");
+		return RLM_SQL_RECONNECT;
+	}
+
+	if (!PQsendQuery(conn->db, query)) {
+		ERROR("Failed to send query: %s", PQerrorMessage(conn->db));
+		return RLM_SQL_RECONNECT;
+	}
+
+	return sql_query_flush(wait_out, conn);
+}
+
+static sql_rcode_t CC_HINT(nonnull) sql_query_continue(sql_io_wait_t *wait_out, rlm_sql_handle_t *handle,
+						       rlm_sql_config_t *config)
+{
+	rlm_sql_postgres_conn_t	*conn = handle->conn;
+	rlm_sql_postgres_t	*inst = config->driver;
+	sql_rcode_t		rcode;
+
+	if (!PQconsumeInput(conn->db)) {
+		ERROR("Failed reading input: %s", PQerrorMessage(conn->db));
+		return RLM_SQL_RECONNECT;
+	}
+
+	rcode = sql_query_flush(wait_out, conn);
+	if ((rcode != RLM_SQL_AGAIN) || (*wait_out & SQL_IO_WAIT_WRITE)) return rcode;
+
+	if (PQisBusy(conn->db)) return RLM_SQL_AGAIN;
+
+	*wait_out = SQL_IO_WAIT_NONE;
 
-	return sql_classify_error(inst, status, conn->result);;
+	return sql_query_result(inst, conn);
 }
 
 static sql_rcode_t sql_select_query(rlm_sql_handle_t * handle, rlm_sql_config_t *config, char const *query)
@@ -672,5 +824,9 @@ rlm_sql_driver_t rlm_sql_postgresql = {
 	.sql_finish_query		= sql_free_result,
 	.sql_finish_select_query	= sql_free_result,
 	.sql_affected_rows		= sql_affected_rows,
-	.sql_escape_func		= sql_escape_func
+	.sql_escape_func		= sql_escape_func,
+	.sql_socket_init_async		= sql_socket_init_async,
+	.sql_socket_continue		= sql_socket_continue,
+	.sql_query_send			= sql_query_send,
+	.sql_query_continue		= sql_query_continue
 };
@@ -29,7 +29,9 @@ RCSID("$Id$")
 #include <freeradius-devel/util/debug.h>
 
 #include <fcntl.h>
+#include <pthread.h>
 #include <sys/stat.h>
+#include <unistd.h>
 
 #include <sqlite3.h>
 
@@ -49,10 +51,35 @@ RCSID("$Id$")
 typedef sqlite_int64 sqlite3_int64;
 #endif
 
+/** Helper thread used to run queries for the non-blocking interface
+ *
+ * SQLite has no non-blocking API, and a busy database can stall for up
+ * to busy_timeout.  So each async connection gets a thread which runs the
+ * blocking calls, and signals completion by writing to a pipe which the
+ * worker thread's event loop is watching.
+ */
+typedef struct {
+	pthread_t		thread;
+	pthread_mutex_t		mutex;
+	pthread_cond_t		cond;
+	bool			running;		//!< Thread has been started.
+	bool			exit;			//!< Tell the thread to exit.
+
+	int			pipe[2];		//!< Thread writes to [1] when a job is done.
+
+	bool			busy;			//!< Thread is running a job.
+	char const		*query;			//!< Query to run, or NULL to open the database.
+	sql_rcode_t		rcode;			//!< Result of the last job.
+
+	rlm_sql_handle_t	*handle;
+	rlm_sql_config_t	*config;
+} rlm_sql_sqlite_async_t;
+
 typedef struct {
 	sqlite3 *db;
 	sqlite3_stmt *statement;
 	int col_count;
+	rlm_sql_sqlite_async_t	*async;		//!< Only used by the non-blocking interface.
 } rlm_sql_sqlite_conn_t;
 
 typedef struct {
@@ -384,6 +411,12 @@ static int _sql_socket_destructor(rlm_sql_sqlite_conn_t *conn)
 
 	DEBUG2("Socket destructor called, closing socket");
 
+	/*
+	 *	Stop the helper thread before closing
+	 *	the database it may be using.
+	 */
+	TALLOC_FREE(conn->async);
+
 	if (conn->db) {
 		status = sqlite3_close(conn->db);
 		if (status != SQLITE_OK) WARN("Got SQLite error when closing socket: %s",
@@ -408,17 +441,13 @@ static void _sql_greatest(sqlite3_context *ctx, int num_values, sqlite3_value **
 	sqlite3_result_int64(ctx, max);
 }
 
-static int CC_HINT(nonnull) sql_socket_init(rlm_sql_handle_t *handle, rlm_sql_config_t *config,
-					    UNUSED fr_time_delta_t timeout)
+/** Open the database and register our custom functions
+ *
+ */
+static sql_rcode_t sql_socket_open(rlm_sql_sqlite_conn_t *conn, rlm_sql_sqlite_t *inst)
 {
-	rlm_sql_sqlite_conn_t *conn;
-	rlm_sql_sqlite_t *inst = config->driver;
-
 	int status;
 
-	MEM(conn = handle->conn = talloc_zero(handle, rlm_sql_sqlite_conn_t));
-	talloc_set_destructor(conn, _sql_socket_destructor);
-
 	INFO("Opening SQLite database \"%s\"", inst->filename);
 #ifdef HAVE_SQLITE3_OPEN_V2
 	status = sqlite3_open_v2(inst->filename, &(conn->db), SQLITE_OPEN_READWRITE | SQLITE_OPEN_NOMUTEX, NULL);
@@ -462,6 +491,17 @@ static int CC_HINT(nonnull) sql_socket_init(rlm_sql_handle_t *handle, rlm_sql_co
 	return RLM_SQL_OK;
 }
 
+static int CC_HINT(nonnull) sql_socket_init(rlm_sql_handle_t *handle, rlm_sql_config_t *config,
+					    UNUSED fr_time_delta_t timeout)
+{
+	rlm_sql_sqlite_conn_t *conn;
+
+	MEM(conn = handle->conn = talloc_zero(handle, rlm_sql_sqlite_conn_t));
+	talloc_set_destructor(conn, _sql_socket_destructor);
+
+	return sql_socket_open(conn, config->driver);
+}
+
 static sql_rcode_t sql_select_query(rlm_sql_handle_t *handle, UNUSED rlm_sql_config_t *config, char const *query)
 {
 	rlm_sql_sqlite_conn_t	*conn = handle->conn;
@@ -500,6 +540,159 @@ static sql_rcode_t sql_query(rlm_sql_handle_t *handle, UNUSED rlm_sql_config_t *
 	return sql_check_error(conn->db, status);
 }
 
+static void *sql_async_thread(void *arg)
+{
+	rlm_sql_sqlite_async_t	*async = arg;
+	rlm_sql_sqlite_conn_t	*conn = async->handle->conn;
+	sql_rcode_t		rcode;
+
+	pthread_mutex_lock(&async->mutex);
+	for (;;) {
+		while (!async->exit && !async->busy) pthread_cond_wait(&async->cond, &async->mutex);
+		if (async->exit) break;
+		pthread_mutex_unlock(&async->mutex);
+
+		if (async->query) {
+			rcode = sql_query(async->handle, async->config, async->query);
+		} else {
+			rcode = sql_socket_open(conn, async->config->driver);
+		}
+
+		pthread_mutex_lock(&async->mutex);
+		async->rcode = rcode;
+		async->busy = false;
+		if (write(async->pipe[1], "", 1) < 0) {
+			ERROR("Failed signalling job completion: %s", fr_syserror(errno));
+		}
+	}
+	pthread_mutex_unlock(&async->mutex);
+
+	return NULL;
+}
+
+static int _sql_async_free(rlm_sql_sqlite_async_t *async)
+{
+	if (async->running) {
+		pthread_mutex_lock(&async->mutex);
+		async->exit = true;
+		pthread_cond_signal(&async->cond);
+		pthread_mutex_unlock(&async->mutex);
+
+		pthread_join(async->thread, NULL);
+	}
+
+	pthread_cond_destroy(&async->cond);
+	pthread_mutex_destroy(&async->mutex);
+
+	if (async->pipe[0] >= 0) close(async->pipe[0]);
+	if (async->pipe[1] >= 0) close(async->pipe[1]);
+
+	return 0;
+}
+
+/** Hand a job to the helper thread
+ *
+ */
+static sql_rcode_t sql_async_start(sql_io_wait_t *wait_out, rlm_sql_sqlite_async_t *async, char const *query)
+{
+	pthread_mutex_lock(&async->mutex);
+	async->query = query;
+	async->busy = true;
+	pthread_cond_signal(&async->cond);
+	pthread_mutex_unlock(&async->mutex);
+
+	*wait_out = SQL_IO_WAIT_READ;
+
+	return RLM_SQL_AGAIN;
+}
+
+/** Check whether the helper thread has finished its job
+ *
+ */
+static sql_rcode_t sql_async_result(sql_io_wait_t *wait_out, rlm_sql_sqlite_async_t *async)
+{
+	char		buffer[16];
+	sql_rcode_t	rcode;
+
+	pthread_mutex_lock(&async->mutex);
+	if (async->busy) {
+		pthread_mutex_unlock(&async->mutex);
+		*wait_out = SQL_IO_WAIT_READ;
+		return RLM_SQL_AGAIN;
+	}
+
+	while (read(async->pipe[0], buffer, sizeof(buffer)) > 0);
+	rcode = async->rcode;
+	pthread_mutex_unlock(&async->mutex);
+
+	*wait_out = SQL_IO_WAIT_NONE;
+
+	return rcode;
+}
+
+static sql_rcode_t CC_HINT(nonnull) sql_socket_init_async(int *fd_out, sql_io_wait_t *wait_out,
+							  rlm_sql_handle_t *handle, rlm_sql_config_t *config)
+{
+	rlm_sql_sqlite_conn_t	*conn;
+	rlm_sql_sqlite_async_t	*async;
+
+	MEM(conn = handle->conn = talloc_zero(handle, rlm_sql_sqlite_conn_t));
+	talloc_set_destructor(conn, _sql_socket_destructor);
+
+	MEM(async = conn->async = talloc_zero(conn, rlm_sql_sqlite_async_t));
+	async->handle = handle;
+	async->config = config;
+	async->pipe[0] = async->pipe[1] = -1;
+
+	pthread_mutex_init(&async->mutex, NULL);
+	pthread_cond_init(&async->cond, NULL);
+	talloc_set_destructor(async, _sql_async_free);
+
+	if (pipe(async->pipe) < 0) {
+		ERROR("Failed creating pipe: %s", fr_syserror(errno));
+		return RLM_SQL_ERROR;
+	}
+
+	if (fr_nonblock(async->pipe[0]) < 0) {
+		PERROR("Failed setting pipe to non-blocking");
+		return RLM_SQL_ERROR;
+	}
+
+	if (pthread_create(&async->thread, NULL, sql_async_thread, async) != 0) {
+		ERROR("Failed creating helper thread: %s", fr_syserror(errno));
+		return RLM_SQL_ERROR;
+	}
+	async->running = true;
+
+	*fd_out = async->pipe[0];
+
+	return sql_async_start(wait_out, async, NULL);
+}
+
+static sql_rcode_t CC_HINT(nonnull) sql_socket_continue(UNUSED int *fd_out, sql_io_wait_t *wait_out,
+							rlm_sql_handle_t *handle, UNUSED rlm_sql_config_t *config)
+{
+	rlm_sql_sqlite_conn_t *conn = handle->conn;
+
+	return sql_async_result(wait_out, conn->async);
+}
+
+static sql_rcode_t CC_HINT(nonnull) sql_query_send(sql_io_wait_t *wait_out, rlm_sql_handle_t *handle,
+						   UNUSED rlm_sql_config_t *config, char const *query)
+{
+	rlm_sql_sqlite_conn_t *conn = handle->conn;
+
+	return sql_async_start(wait_out, conn->async, query);
+}
+
+static sql_rcode_t CC_HINT(nonnull) sql_query_continue(sql_io_wait_t *wait_out, rlm_sql_handle_t *handle,
+						       UNUSED rlm_sql_config_t *config)
+{
+	rlm_sql_sqlite_conn_t *conn = handle->conn;
+
+	return sql_async_result(wait_out, conn->async);
+}
+
 static int sql_num_fields(rlm_sql_handle_t *handle, UNUSED rlm_sql_config_t *config)
 {
 	rlm_sql_sqlite_conn_t *conn = handle->conn;
@@ -820,5 +1013,9 @@ rlm_sql_driver_t rlm_sql_sqlite = {
 	.sql_free_result		= sql_free_result,
 	.sql_error			= sql_error,
 	.sql_finish_query		= sql_finish_query,
-	.sql_finish_select_query	= sql_finish_query
+	.sql_finish_select_query	= sql_finish_query,
+	.sql_socket_init_async		= sql_socket_init_async,
+	.sql_socket_continue		= sql_socket_continue,
+	.sql_query_send			= sql_query_send,
+	.sql_query_continue		= sql_query_continue
 };
@@ -36,6 +36,7 @@ RCSID("$Id$")
 #include <freeradius-devel/server/map_proc.h>
 #include <freeradius-devel/server/module.h>
 #include <freeradius-devel/server/pairmove.h>
+#include <freeradius-devel/unlang/base.h>
 #include <freeradius-devel/util/debug.h>
 #include <freeradius-devel/util/table.h>
 
@@ -110,6 +111,14 @@ static const CONF_PARSER module_config[] = {
 	 */
 	{ FR_CONF_OFFSET("query_timeout", FR_TYPE_UINT32, rlm_sql_config_t, query_timeout) },
 
+	/*
+	 *	Run accounting and post-auth queries over
+	 *	non-blocking connections, if the driver
+	 *	supports it.
+	 */
+	{ FR_CONF_OFFSET("async", FR_TYPE_BOOL, rlm_sql_config_t, async), .dflt = "no" },
+	{ FR_CONF_OFFSET("trunk", FR_TYPE_SUBSECTION, rlm_sql_config_t, trunk_conf), .subcs = (void const *) fr_trunk_config },
+
 	{ FR_CONF_POINTER("accounting", FR_TYPE_SUBSECTION, NULL), .subcs = (void const *) acct_config },
 
 	{ FR_CONF_POINTER("post-auth", FR_TYPE_SUBSECTION, NULL), .subcs = (void const *) postauth_config },
@@ -1157,6 +1166,30 @@ static int mod_instantiate(void *instance, CONF_SECTION *conf)
 				inst->driver->sql_escape_func :
 				sql_escape_func;
 
+	if (inst->config->async) {
+		if (!inst->driver->sql_socket_init_async || !inst->driver->sql_socket_continue ||
+		    !inst->driver->sql_query_send || !inst->driver->sql_query_continue) {
+			cf_log_err(conf, "Driver \"%s\" does not support async queries", inst->driver->name);
+			return -1;
+		}
+
+		/*
+		 *	None of the client libraries can pipeline
+		 *	queries, so there's only ever one query
+		 *	in progress on each connection.
+		 */
+		inst->config->trunk_conf.max_req_per_conn = 1;
+		inst->config->trunk_conf.target_req_per_conn = 1;
+		inst->config->trunk_conf.always_writable = true;
+
+		/*
+		 *	Accounting and post-auth queries now yield,
+		 *	so calls to this instance must never be run
+		 *	on an offload thread.
+		 */
+		module_instance_type_set(instance, RLM_TYPE_THREAD_SAFE | RLM_TYPE_RESUMABLE);
+	}
+
 	inst->ef = module_exfile_init(inst, conf, 256, 30, true, NULL, NULL);
 	if (!inst->ef) {
 		cf_log_err(conf, "Failed creating log file context");
@@ -1174,6 +1207,22 @@ static int mod_instantiate(void *instance, CONF_SECTION *conf)
 	return RLM_MODULE_OK;
 }
 
+/** Allocate the per-thread trunk used for async queries
+ *
+ */
+static int mod_thread_instantiate(UNUSED CONF_SECTION const *cs, void *instance, fr_event_list_t *el, void *thread)
+{
+	rlm_sql_t const		*inst = talloc_get_type_abort_const(instance, rlm_sql_t);
+	rlm_sql_thread_t	*t = talloc_get_type_abort(thread, rlm_sql_thread_t);
+
+	t->inst = inst;
+	t->el = el;
+
+	if (!inst->config->async) return 0;
+
+	return sql_trunk_thread_instantiate(t, inst, el);
+}
+
 static rlm_rcode_t mod_authorize(void *instance, UNUSED void *thread, REQUEST *request) CC_HINT(nonnull);
 static rlm_rcode_t mod_authorize(void *instance, UNUSED void *thread, REQUEST *request)
 {
@@ -1419,41 +1468,28 @@ release:
 	return rcode;
 }
 
-/*
- *	Generic function for failing between a bunch of queries.
- *
- *	Uses the same principle as rlm_linelog, expanding the 'reference' config
- *	item using xlat to figure out what query it should execute.
- *
- *	If the reference matches multiple config items, and a query fails or
- *	doesn't update any rows, the next matching config item is used.
+/** Find the query pair the section's reference points to
  *
+ * @param[out] out	Where to write the first matching query pair.
+ * @param[in] request	The current request.
+ * @param[in] section	to expand the reference of.
+ * @return
+ *	- RLM_MODULE_OK if a query pair was found.
+ *	- RLM_MODULE_NOOP if the reference doesn't point to a query pair.
+ *	- RLM_MODULE_FAIL if the reference couldn't be expanded.
  */
-static int acct_redundant(rlm_sql_t const *inst, REQUEST *request, sql_acct_section_t *section)
+static rlm_rcode_t acct_query_find(CONF_PAIR **out, REQUEST *request, sql_acct_section_t *section)
 {
-	rlm_rcode_t		rcode = RLM_MODULE_OK;
-
-	rlm_sql_handle_t	*handle = NULL;
-	int			sql_ret;
-	int			numaffected = 0;
-
 	CONF_ITEM		*item;
-	CONF_PAIR 		*pair;
-	char const		*attr = NULL;
-	char const		*value;
-
 	char			path[FR_MAX_STRING_LEN];
 	char			*p = path;
-	char			*expanded = NULL;
 
 	fr_assert(section);
 
 	if (section->reference[0] != '.') *p++ = '.';
 
 	if (xlat_eval(p, sizeof(path) - (p - path), request, section->reference, NULL, NULL) < 0) {
-		rcode = RLM_MODULE_FAIL;
-
-		goto finish;
+		return RLM_MODULE_FAIL;
 	}
 
 	/*
@@ -1463,21 +1499,48 @@ static int acct_redundant(rlm_sql_t const *inst, REQUEST *request, sql_acct_sect
 	item = cf_reference_item(NULL, section->cs, path);
 	if (!item) {
 		RWDEBUG("No such configuration item %s", path);
-		rcode = RLM_MODULE_NOOP;
-
-		goto finish;
+		return RLM_MODULE_NOOP;
 	}
 	if (cf_item_is_section(item)){
 		RWDEBUG("Sections are not supported as references");
-		rcode = RLM_MODULE_NOOP;
-
-		goto finish;
+		return RLM_MODULE_NOOP;
 	}
 
-	pair = cf_item_to_pair(item);
-	attr = cf_pair_attr(pair);
+	*out = cf_item_to_pair(item);
 
-	RDEBUG2("Using query template '%s'", attr);
+	RDEBUG2("Using query template '%s'", cf_pair_attr(*out));
+
+	return RLM_MODULE_OK;
+}
+
+/*
+ *	Generic function for failing between a bunch of queries.
+ *
+ *	Uses the same principle as rlm_linelog, expanding the 'reference' config
+ *	item using xlat to figure out what query it should execute.
+ *
+ *	If the reference matches multiple config items, and a query fails or
+ *	doesn't update any rows, the next matching config item is used.
+ *
+ */
+static int acct_redundant(rlm_sql_t const *inst, REQUEST *request, sql_acct_section_t *section)
+{
+	rlm_rcode_t		rcode;
+
+	rlm_sql_handle_t	*handle = NULL;
+	int			sql_ret;
+	int			numaffected = 0;
+
+	CONF_PAIR 		*pair = NULL;
+	char const		*attr;
+	char const		*value;
+
+	char			*expanded = NULL;
+
+	rcode = acct_query_find(&pair, request, section);
+	if (rcode != RLM_MODULE_OK) return rcode;
+
+	attr = cf_pair_attr(pair);
 
 	handle = fr_pool_connection_get(inst->pool, request);
 	if (!handle) {
@@ -1587,17 +1650,167 @@ finish:
 	return rcode;
 }
 
+/** Resume context for accounting and post-auth queries run over the trunk
+ *
+ */
+typedef struct {
+	rlm_sql_t const		*inst;			//!< Instance of rlm_sql.
+	rlm_sql_thread_t	*thread;		//!< Thread the query was enqueued on.
+	sql_acct_section_t	*section;		//!< Section we're running queries from.
+	CONF_PAIR		*pair;			//!< Query currently being run.
+	char const		*attr;			//!< Name of the query, alternatives share it.
+	sql_query_t		*query;			//!< Query in progress.
+} sql_acct_rctx_t;
+
+static rlm_rcode_t acct_redundant_resume(void *instance, void *thread, REQUEST *request, void *rctx);
+
+/** Cancel the query if the request is stopped while it's in progress
+ *
+ */
+static void acct_redundant_signal(UNUSED void *instance, UNUSED void *thread, UNUSED REQUEST *request,
+				  void *rctx, fr_state_signal_t action)
+{
+	sql_acct_rctx_t		*acct = talloc_get_type_abort(rctx, sql_acct_rctx_t);
+
+	if (action != FR_SIGNAL_CANCEL) return;
+
+	sql_trunk_query_cancel(acct->query);
+	talloc_free(acct);
+}
+
+/** Enqueue the current query and yield until it completes
+ *
+ */
+static rlm_rcode_t acct_redundant_enqueue(REQUEST *request, sql_acct_rctx_t *acct)
+{
+	rlm_sql_t const		*inst = acct->inst;
+	char const		*value;
+	rlm_rcode_t		rcode;
+
+	value = cf_pair_value(acct->pair);
+	if (!value) {
+		RDEBUG2("Ignoring null query");
+		rcode = RLM_MODULE_NOOP;
+		goto finish;
+	}
+
+	TALLOC_FREE(acct->query);
+	acct->query = sql_trunk_query_alloc(acct, request, acct->section, value);
+	if (sql_trunk_query_enqueue(acct->thread, acct->query) < 0) {
+		rcode = RLM_MODULE_FAIL;
+		goto finish;
+	}
+
+	return unlang_module_yield(request, acct_redundant_resume, acct_redundant_signal, acct);
+
+finish:
+	sql_unset_user(inst, request);
+	talloc_free(acct);
+
+	return rcode;
+}
+
+/** Process the result of a query run over the trunk
+ *
+ * Follows the same logic as acct_redundant().
+ */
+static rlm_rcode_t acct_redundant_resume(UNUSED void *instance, UNUSED void *thread, REQUEST *request, void *rctx)
+{
+	sql_acct_rctx_t		*acct = talloc_get_type_abort(rctx, sql_acct_rctx_t);
+	sql_query_t		*query = acct->query;
+	rlm_sql_t const		*inst = acct->inst;
+	rlm_rcode_t		rcode;
+
+	if (query->empty) {
+		RDEBUG2("Ignoring null query");
+		rcode = RLM_MODULE_NOOP;
+		goto finish;
+	}
+
+	RDEBUG2("SQL query returned: %s", fr_table_str_by_value(sql_rcode_description_table, query->rcode, "<INVALID>"));
+
+	switch (query->rcode) {
+	case RLM_SQL_OK:
+		break;
+
+	case RLM_SQL_QUERY_INVALID:
+		rcode = RLM_MODULE_INVALID;
+		goto finish;
+
+	case RLM_SQL_ALT_QUERY:
+		goto next;
+
+	default:
+		rcode = RLM_MODULE_FAIL;
+		goto finish;
+	}
+
+	RDEBUG2("%i record(s) updated", query->affected_rows);
+
+	if (query->affected_rows > 0) {
+		rcode = RLM_MODULE_OK;
+		goto finish;
+	}
+
+next:
+	acct->pair = cf_pair_find_next(acct->section->cs, acct->pair, acct->attr);
+	if (!acct->pair) {
+		RDEBUG2("No additional queries configured");
+		rcode = RLM_MODULE_NOOP;
+		goto finish;
+	}
+
+	RDEBUG2("Trying next query...");
+
+	return acct_redundant_enqueue(request, acct);
+
+finish:
+	sql_unset_user(inst, request);
+	talloc_free(acct);
+
+	return rcode;
+}
+
+/** Run accounting or post-auth queries over the thread's trunk
+ *
+ * Same as acct_redundant(), but the request yields while the
+ * query is running instead of blocking the worker.
+ */
+static rlm_rcode_t acct_redundant_async(rlm_sql_t const *inst, rlm_sql_thread_t *thread,
+					REQUEST *request, sql_acct_section_t *section)
+{
+	sql_acct_rctx_t		*acct;
+	CONF_PAIR		*pair = NULL;
+	rlm_rcode_t		rcode;
+
+	rcode = acct_query_find(&pair, request, section);
+	if (rcode != RLM_MODULE_OK) return rcode;
+
+	MEM(acct = talloc_zero(request, sql_acct_rctx_t));
+	acct->inst = inst;
+	acct->thread = thread;
+	acct->section = section;
+	acct->pair = pair;
+	acct->attr = cf_pair_attr(pair);
+
+	sql_set_user(inst, request, NULL);
+
+	return acct_redundant_enqueue(request, acct);
+}
+
 #ifdef WITH_ACCOUNTING
 
 /*
  *	Accounting: Insert or update session data in our sql table
  */
-static rlm_rcode_t mod_accounting(void *instance, UNUSED void *thread, REQUEST *request) CC_HINT(nonnull);
-static rlm_rcode_t mod_accounting(void *instance, UNUSED void *thread, REQUEST *request)
+static rlm_rcode_t mod_accounting(void *instance, void *thread, REQUEST *request) CC_HINT(nonnull);
+static rlm_rcode_t mod_accounting(void *instance, void *thread, REQUEST *request)
 {
 	rlm_sql_t const *inst = instance;
 
 	if (inst->config->accounting.reference_cp) {
+		if (inst->config->async) return acct_redundant_async(inst, thread, request, &inst->config->accounting);
+
 		return acct_redundant(inst, request, &inst->config->accounting);
 	}
 
@@ -1609,12 +1822,14 @@ static rlm_rcode_t mod_accounting(void *instance, UNUSED void *thread, REQUEST *
 /*
  *	Postauth: Write a record of the authentication attempt
  */
-static rlm_rcode_t mod_post_auth(void *instance, UNUSED void *thread, REQUEST *request) CC_HINT(nonnull);
-static rlm_rcode_t mod_post_auth(void *instance, UNUSED void *thread, REQUEST *request)
+static rlm_rcode_t mod_post_auth(void *instance, void *thread, REQUEST *request) CC_HINT(nonnull);
+static rlm_rcode_t mod_post_auth(void *instance, void *thread, REQUEST *request)
 {
 	rlm_sql_t const *inst = talloc_get_type_abort_const(instance, rlm_sql_t);
 
 	if (inst->config->postauth.reference_cp) {
+		if (inst->config->async) return acct_redundant_async(inst, thread, request, &inst->config->postauth);
+
 		return acct_redundant(inst, request, &inst->config->postauth);
 	}
 
@@ -1628,14 +1843,17 @@ static rlm_rcode_t mod_post_auth(void *instance, UNUSED void *thread, REQUEST *r
 
 /* globally exported name */
 module_t rlm_sql = {
-	.magic		= RLM_MODULE_INIT,
-	.name		= "sql",
-	.type		= RLM_TYPE_THREAD_SAFE,
-	.inst_size	= sizeof(rlm_sql_t),
-	.config		= module_config,
-	.bootstrap	= mod_bootstrap,
-	.instantiate	= mod_instantiate,
-	.detach		= mod_detach,
+	.magic			= RLM_MODULE_INIT,
+	.name			= "sql",
+	.type			= RLM_TYPE_THREAD_SAFE | RLM_TYPE_BLOCKING,
+	.inst_size		= sizeof(rlm_sql_t),
+	.thread_inst_size	= sizeof(rlm_sql_thread_t),
+	.thread_inst_type	= "rlm_sql_thread_t",
+	.config			= module_config,
+	.bootstrap		= mod_bootstrap,
+	.instantiate		= mod_instantiate,
+	.thread_instantiate	= mod_thread_instantiate,
+	.detach			= mod_detach,
 	.methods = {
 		[MOD_AUTHORIZE]		= mod_authorize,
 #ifdef WITH_ACCOUNTING
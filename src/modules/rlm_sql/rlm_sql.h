@@ -31,6 +31,7 @@ RCSIDH(rlm_sql_h, "$Id$")
 #include <freeradius-devel/server/pool.h>
 #include <freeradius-devel/server/modpriv.h>
 #include <freeradius-devel/server/exfile.h>
+#include <freeradius-devel/server/trunk.h>
 
 #define FR_ITEM_CHECK 0
 #define FR_ITEM_REPLY 1
@@ -46,8 +47,19 @@ typedef enum {
 	RLM_SQL_RECONNECT = 1,		//!< Stale connection, should reconnect.
 	RLM_SQL_ALT_QUERY,		//!< Key constraint violation, use an alternative query.
 	RLM_SQL_NO_MORE_ROWS,		//!< No more rows available
+	RLM_SQL_AGAIN,			//!< Operation in progress, call again when the
+					///< connection's file descriptor is ready.
 } sql_rcode_t;
 
+/** What an asynchronous driver operation is waiting for
+ *
+ */
+typedef enum {
+	SQL_IO_WAIT_NONE = 0,		//!< Not waiting for I/O.
+	SQL_IO_WAIT_READ = 0x01,	//!< Waiting for the fd to become readable.
+	SQL_IO_WAIT_WRITE = 0x02	//!< Waiting for the fd to become writable.
+} sql_io_wait_t;
+
 typedef enum {
 	FALL_THROUGH_NO = 0,
 	FALL_THROUGH_YES,
@@ -128,6 +140,10 @@ typedef struct {
 	void			*driver;			//!< Where drivers should write a
 								//!< pointer to their configurations.
 
+	bool			async;				//!< Run accounting and post-auth queries
+								///< over non-blocking trunk connections.
+	fr_trunk_conf_t		trunk_conf;			//!< Configuration for the per-thread trunk.
+
 	/*
 	 *	@todo The rest of the queries should also be moved into
 	 *	their own sections.
@@ -211,6 +227,22 @@ typedef struct {
 	sql_rcode_t (*sql_finish_select_query)(rlm_sql_handle_t *handle, rlm_sql_config_t *config);
 
 	xlat_escape_t	sql_escape_func;
+
+	/*
+	 *	Optional non-blocking interface.  Each function returns
+	 *	RLM_SQL_AGAIN, and writes what it's waiting for to wait_out,
+	 *	until the operation completes.  Results are then retrieved
+	 *	with sql_affected_rows and released with sql_finish_query
+	 *	as for the synchronous interface.
+	 */
+	sql_rcode_t (*sql_socket_init_async)(int *fd_out, sql_io_wait_t *wait_out,
+					     rlm_sql_handle_t *handle, rlm_sql_config_t *config);
+	sql_rcode_t (*sql_socket_continue)(int *fd_out, sql_io_wait_t *wait_out,
+					   rlm_sql_handle_t *handle, rlm_sql_config_t *config);
+	sql_rcode_t (*sql_query_send)(sql_io_wait_t *wait_out,
+				      rlm_sql_handle_t *handle, rlm_sql_config_t *config, char const *query);
+	sql_rcode_t (*sql_query_continue)(sql_io_wait_t *wait_out,
+					  rlm_sql_handle_t *handle, rlm_sql_config_t *config);
 } rlm_sql_driver_t;
 
 struct sql_inst {
@@ -236,6 +268,29 @@ struct sql_inst {
 	fr_dict_attr_t const	*group_da;		//!< Group dictionary attribute.
 };
 
+/** Per-thread instance data, only used when async is enabled
+ *
+ */
+typedef struct {
+	rlm_sql_t const		*inst;			//!< Instance of rlm_sql.
+	fr_event_list_t		*el;			//!< This thread's event list.
+	fr_trunk_t		*trunk;			//!< Trunk of non-blocking connections.
+} rlm_sql_thread_t;
+
+/** A query being executed over a trunk connection
+ *
+ */
+typedef struct {
+	REQUEST			*request;		//!< Request the query is being run for.
+	sql_acct_section_t	*section;		//!< Section the query came from.
+	char const		*query_str;		//!< Unexpanded query.
+	fr_trunk_request_t	*treq;			//!< Trunk request, NULL once the query is done.
+
+	sql_rcode_t		rcode;			//!< Result of running the query.
+	int			affected_rows;		//!< Number of rows the query modified.
+	bool			empty;			//!< Query expanded to an empty string.
+} sql_query_t;
+
 typedef struct rlm_sql_grouplist_s rlm_sql_grouplist_t;
 struct rlm_sql_grouplist_s {
 	char			*name;
@@ -254,6 +309,14 @@ int		rlm_sql_fetch_row(rlm_sql_row_t *out, rlm_sql_t const *inst, REQUEST *reque
 void		rlm_sql_print_error(rlm_sql_t const *inst, REQUEST *request, rlm_sql_handle_t *handle, bool force_debug);
 int		sql_set_user(rlm_sql_t const *inst, REQUEST *request, char const *username);
 
+/*
+ *	sql_trunk.c
+ */
+int		sql_trunk_thread_instantiate(rlm_sql_thread_t *t, rlm_sql_t const *inst, fr_event_list_t *el);
+sql_query_t	*sql_trunk_query_alloc(TALLOC_CTX *ctx, REQUEST *request, sql_acct_section_t *section, char const *query_str);
+int		sql_trunk_query_enqueue(rlm_sql_thread_t *t, sql_query_t *query);
+void		sql_trunk_query_cancel(sql_query_t *query);
+
 /*
  *	sql_state.c
  */
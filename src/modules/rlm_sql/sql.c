@@ -47,6 +47,7 @@ fr_table_num_sorted_t const sql_rcode_description_table[] = {
 	{ "need alt query",	RLM_SQL_ALT_QUERY	},
 	{ "no connection",	RLM_SQL_RECONNECT	},
 	{ "no more rows",	RLM_SQL_NO_MORE_ROWS	},
+	{ "operation pending",	RLM_SQL_AGAIN		},
 	{ "query invalid",	RLM_SQL_QUERY_INVALID	},
 	{ "server error",	RLM_SQL_ERROR		},
 	{ "success",		RLM_SQL_OK		}
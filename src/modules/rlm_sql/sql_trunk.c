@@ -0,0 +1,637 @@
+/*
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or (at
+ *   your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ */
+
+/**
+ * $Id$
+ * @file sql_trunk.c
+ * @brief Run queries over non-blocking driver connections managed by a trunk.
+ *
+ * Each worker thread gets its own trunk of connections.  Drivers which
+ * export the non-blocking interface are asked to start an operation, and
+ * return #RLM_SQL_AGAIN along with the I/O they're waiting for.  We insert
+ * the connection's fd into the thread's event list, and call the driver
+ * again when it becomes ready.
+ *
+ * Only one query runs on a connection at a time, as none of the client
+ * libraries support pipelining queries.  If a request is cancelled while
+ * its query is executing, the connection continues draining the result,
+ * and any query assigned to it in the meantime is sent once that completes.
+ *
+ * @copyright 2020 The FreeRADIUS server project
+ */
+RCSID("$Id$")
+
+#define LOG_PREFIX "rlm_sql (%s) - "
+#define LOG_PREFIX_ARGS inst->name
+
+#include <freeradius-devel/server/base.h>
+#include <freeradius-devel/server/trunk.h>
+#include <freeradius-devel/unlang/base.h>
+#include <freeradius-devel/util/debug.h>
+
+#include "rlm_sql.h"
+
+typedef enum {
+	SQL_CONN_CONNECTING = 0,			//!< Driver is establishing the connection.
+	SQL_CONN_OPEN_QUERY,				//!< Running the open_query.
+	SQL_CONN_READY					//!< Connection can accept queries.
+} sql_conn_state_t;
+
+/** Connection handle, persists across reconnections
+ *
+ */
+typedef struct {
+	rlm_sql_thread_t	*thread;		//!< Thread this connection belongs to.
+	fr_trunk_connection_t	*tconn;			//!< Trunk connection wrapping this connection.
+	fr_connection_t		*conn;			//!< Connection state machine.
+
+	rlm_sql_handle_t	*handle;		//!< Driver handle, allocated on each connection attempt.
+	int			fd;			//!< Driver's file descriptor.
+	sql_io_wait_t		wait;			//!< What the driver is waiting for.
+	sql_conn_state_t	state;			//!< Where we are in setting up the connection.
+
+	sql_query_t		*query;			//!< Query currently executing.
+	char			*expanded;		//!< Expanded query string.  Drivers may need it
+							///< until the query completes.
+	sql_query_t		*next;			//!< Query waiting for a cancelled query to drain.
+	bool			draining;		//!< Discard the result of the current query.
+
+	fr_event_timer_t const	*ev;			//!< query_timeout timer.
+} sql_conn_t;
+
+static void _sql_conn_io(fr_event_list_t *el, int fd, int flags, void *uctx);
+
+/** The connection's fd errored, or was closed by the server
+ *
+ */
+static void _sql_conn_error(UNUSED fr_event_list_t *el, UNUSED int fd, UNUSED int flags, int fd_errno, void *uctx)
+{
+	sql_conn_t		*sc = talloc_get_type_abort(uctx, sql_conn_t);
+	rlm_sql_t const		*inst = sc->thread->inst;
+
+	ERROR("Connection failed: %s", fr_syserror(fd_errno));
+
+	fr_connection_signal_reconnect(sc->conn, FR_CONNECTION_FAILED);
+}
+
+/** Update the event registrations to match what the driver is waiting for
+ *
+ */
+static int sql_conn_events_update(sql_conn_t *sc)
+{
+	rlm_sql_t const		*inst = sc->thread->inst;
+	fr_event_list_t		*el = sc->thread->el;
+
+	if (sc->wait == SQL_IO_WAIT_NONE) {
+		(void) fr_event_fd_delete(el, sc->fd, FR_EVENT_FILTER_IO);
+		return 0;
+	}
+
+	if (fr_event_fd_insert(sc, el, sc->fd,
+			       (sc->wait & SQL_IO_WAIT_READ) ? _sql_conn_io : NULL,
+			       (sc->wait & SQL_IO_WAIT_WRITE) ? _sql_conn_io : NULL,
+			       _sql_conn_error, sc) < 0) {
+		PERROR("Failed inserting connection fd into event loop");
+		return -1;
+	}
+
+	return 0;
+}
+
+/** Query took longer than query_timeout
+ *
+ * We can't reliably abort a query part way through with all drivers
+ * so fail the query and tear down the connection.
+ */
+static void _sql_conn_query_timeout(UNUSED fr_event_list_t *el, UNUSED fr_time_t now, void *uctx)
+{
+	sql_conn_t		*sc = talloc_get_type_abort(uctx, sql_conn_t);
+	rlm_sql_t const		*inst = sc->thread->inst;
+	sql_query_t		*query = sc->query;
+
+	ERROR("Query timed out after %u seconds, reconnecting", inst->config->query_timeout);
+
+	if (query) {
+		query->rcode = RLM_SQL_ERROR;
+		fr_trunk_request_signal_fail(query->treq);
+	}
+
+	fr_trunk_connection_signal_reconnect(sc->tconn, FR_CONNECTION_FAILED);
+}
+
+/** Expand a query and start running it on a connection
+ *
+ * @return
+ *	- 0 if the query was sent.
+ *	- -1 if the query couldn't be sent.  query->rcode will be set.
+ */
+static int sql_conn_query_send(sql_conn_t *sc, sql_query_t *query)
+{
+	rlm_sql_t const		*inst = sc->thread->inst;
+	REQUEST			*request = query->request;
+	char			*expanded = NULL;
+	sql_rcode_t		rcode;
+
+	if (xlat_aeval(request, &expanded, request, query->query_str, inst->sql_escape_func, sc->handle) < 0) {
+		query->rcode = RLM_SQL_QUERY_INVALID;
+		return -1;
+	}
+
+	if (!*expanded) {
+		query->empty = true;
+		query->rcode = RLM_SQL_OK;
+		talloc_free(expanded);
+		return -1;
+	}
+
+	rlm_sql_query_log(inst, request, query->section, expanded);
+
+	RDEBUG2("Executing query: %s", expanded);
+
+	talloc_free(sc->expanded);
+	sc->expanded = talloc_steal(sc, expanded);
+
+	rcode = inst->driver->sql_query_send(&sc->wait, sc->handle, inst->config, expanded);
+
+	switch (rcode) {
+	case RLM_SQL_OK:
+		/*
+		 *	Completed without needing any I/O,
+		 *	call the driver again on the next
+		 *	trip through the event loop.
+		 */
+		sc->wait = SQL_IO_WAIT_WRITE;
+		break;
+
+	case RLM_SQL_AGAIN:
+		break;
+
+	default:
+		rlm_sql_print_error(inst, request, sc->handle, false);
+		(inst->driver->sql_finish_query)(sc->handle, inst->config);
+		query->rcode = rcode;
+		return -1;
+	}
+
+	if (sql_conn_events_update(sc) < 0) {
+		query->rcode = RLM_SQL_RECONNECT;
+		return -1;
+	}
+
+	if (inst->config->query_timeout &&
+	    (fr_event_timer_in(sc, sc->thread->el, &sc->ev, fr_time_delta_from_sec(inst->config->query_timeout),
+			       _sql_conn_query_timeout, sc) < 0)) {
+		PERROR("Failed inserting query timeout");
+	}
+
+	sc->query = query;
+
+	return 0;
+}
+
+/** Record the result of a query, mirroring the logic in rlm_sql_query()
+ *
+ */
+static void sql_conn_query_result(sql_conn_t *sc, sql_query_t *query, sql_rcode_t rcode)
+{
+	rlm_sql_t const		*inst = sc->thread->inst;
+	REQUEST			*request = query->request;
+
+	switch (rcode) {
+	case RLM_SQL_OK:
+		query->affected_rows = (inst->driver->sql_affected_rows)(sc->handle, inst->config);
+		break;
+
+	case RLM_SQL_ERROR:
+		if (inst->driver->flags & RLM_SQL_RCODE_FLAGS_ALT_QUERY) {
+			rlm_sql_print_error(inst, request, sc->handle, false);
+			break;
+		}
+		rcode = RLM_SQL_ALT_QUERY;
+		FALL_THROUGH;
+
+	case RLM_SQL_ALT_QUERY:
+		rlm_sql_print_error(inst, request, sc->handle, true);
+		break;
+
+	default:
+		rlm_sql_print_error(inst, request, sc->handle, false);
+		break;
+	}
+
+	(inst->driver->sql_finish_query)(sc->handle, inst->config);
+
+	query->rcode = rcode;
+}
+
+/** Continue running the current query, or a query being drained
+ *
+ */
+static void sql_conn_query_continue(sql_conn_t *sc)
+{
+	rlm_sql_t const		*inst = sc->thread->inst;
+	sql_query_t		*query = sc->query;
+	sql_rcode_t		rcode;
+
+	rcode = inst->driver->sql_query_continue(&sc->wait, sc->handle, inst->config);
+	if (rcode == RLM_SQL_AGAIN) {
+		if (sql_conn_events_update(sc) < 0) fr_connection_signal_reconnect(sc->conn, FR_CONNECTION_FAILED);
+		return;
+	}
+
+	if (sc->ev) fr_event_timer_delete(&sc->ev);
+	sc->wait = SQL_IO_WAIT_NONE;
+	(void) sql_conn_events_update(sc);
+
+	/*
+	 *	The server went away, leave the query on
+	 *	the connection so the trunk moves it to a
+	 *	new one.
+	 */
+	if (rcode == RLM_SQL_RECONNECT) {
+		fr_connection_signal_reconnect(sc->conn, FR_CONNECTION_FAILED);
+		return;
+	}
+
+	/*
+	 *	The request that sent this query has gone
+	 *	away.  Throw away the result and run
+	 *	anything that was queued behind it.
+	 */
+	if (sc->draining) {
+		(inst->driver->sql_finish_query)(sc->handle, inst->config);
+		sc->draining = false;
+
+		query = sc->next;
+		if (!query) return;
+
+		sc->next = NULL;
+		if (sql_conn_query_send(sc, query) < 0) fr_trunk_request_signal_complete(query->treq);
+		return;
+	}
+
+	sc->query = NULL;
+	sql_conn_query_result(sc, query, rcode);
+	fr_trunk_request_signal_complete(query->treq);
+}
+
+/** Finish connecting, running the open_query if one is configured
+ *
+ */
+static void sql_conn_connect_continue(sql_conn_t *sc)
+{
+	rlm_sql_t const		*inst = sc->thread->inst;
+	sql_rcode_t		rcode;
+
+	if (sc->state == SQL_CONN_CONNECTING) {
+		int fd = sc->fd;
+
+		rcode = inst->driver->sql_socket_continue(&fd, &sc->wait, sc->handle, inst->config);
+		if (fd != sc->fd) {
+			(void) fr_event_fd_delete(sc->thread->el, sc->fd, FR_EVENT_FILTER_IO);
+			sc->fd = fd;
+		}
+		if (rcode == RLM_SQL_AGAIN) goto again;
+		if (rcode != RLM_SQL_OK) goto fail;
+
+		if (!inst->config->connect_query) goto connected;
+
+		DEBUG2("Executing open_query: %s", inst->config->connect_query);
+
+		sc->state = SQL_CONN_OPEN_QUERY;
+		rcode = inst->driver->sql_query_send(&sc->wait, sc->handle, inst->config, inst->config->connect_query);
+		if (rcode == RLM_SQL_OK) sc->wait = SQL_IO_WAIT_WRITE;
+		if ((rcode == RLM_SQL_OK) || (rcode == RLM_SQL_AGAIN)) goto again;
+		goto fail;
+	}
+
+	rcode = inst->driver->sql_query_continue(&sc->wait, sc->handle, inst->config);
+	if (rcode == RLM_SQL_AGAIN) goto again;
+	(inst->driver->sql_finish_query)(sc->handle, inst->config);
+	if (rcode != RLM_SQL_OK) goto fail;
+
+connected:
+	sc->state = SQL_CONN_READY;
+	sc->wait = SQL_IO_WAIT_NONE;
+	(void) sql_conn_events_update(sc);
+	fr_connection_signal_connected(sc->conn);
+	return;
+
+again:
+	if (sql_conn_events_update(sc) == 0) return;
+
+fail:
+	/*
+	 *	Drivers log their own connection errors
+	 */
+	if (sc->state == SQL_CONN_OPEN_QUERY) rlm_sql_print_error(inst, NULL, sc->handle, false);
+	fr_connection_signal_reconnect(sc->conn, FR_CONNECTION_FAILED);
+}
+
+/** The driver's fd is ready
+ *
+ */
+static void _sql_conn_io(UNUSED fr_event_list_t *el, UNUSED int fd, UNUSED int flags, void *uctx)
+{
+	sql_conn_t		*sc = talloc_get_type_abort(uctx, sql_conn_t);
+
+	if (sc->state != SQL_CONN_READY) {
+		sql_conn_connect_continue(sc);
+		return;
+	}
+
+	fr_trunk_connection_signal_readable(sc->tconn);
+}
+
+/** Start connecting to the database
+ *
+ */
+static fr_connection_state_t _sql_conn_init(void **h_out, fr_connection_t *conn, void *uctx)
+{
+	sql_conn_t		*sc = talloc_get_type_abort(uctx, sql_conn_t);
+	rlm_sql_t const		*inst = sc->thread->inst;
+	rlm_sql_handle_t	*handle;
+	sql_rcode_t		rcode;
+
+	MEM(handle = talloc_zero(sc, rlm_sql_handle_t));
+	MEM(handle->log_ctx = talloc_pool(handle, 2048));
+	handle->inst = inst;
+
+	sc->handle = handle;
+	sc->conn = conn;
+	sc->fd = -1;
+	sc->wait = SQL_IO_WAIT_NONE;
+	sc->state = SQL_CONN_CONNECTING;
+
+	rcode = inst->driver->sql_socket_init_async(&sc->fd, &sc->wait, handle, inst->config);
+	switch (rcode) {
+	/*
+	 *	Connected immediately, run anything else
+	 *	we need to from the event loop.
+	 */
+	case RLM_SQL_OK:
+		sc->wait = SQL_IO_WAIT_WRITE;
+		FALL_THROUGH;
+
+	case RLM_SQL_AGAIN:
+		if (sql_conn_events_update(sc) < 0) break;
+
+		*h_out = sc;
+		return FR_CONNECTION_STATE_CONNECTING;
+
+	default:
+		break;
+	}
+
+	TALLOC_FREE(sc->handle);
+	sc->fd = -1;
+
+	return FR_CONNECTION_STATE_FAILED;
+}
+
+/** Close the driver connection, leaving the handle ready for the next attempt
+ *
+ */
+static void _sql_conn_close(fr_event_list_t *el, void *h, UNUSED void *uctx)
+{
+	sql_conn_t		*sc = talloc_get_type_abort(h, sql_conn_t);
+
+	if (sc->ev) fr_event_timer_delete(&sc->ev);
+	if (sc->fd >= 0) (void) fr_event_fd_delete(el, sc->fd, FR_EVENT_FILTER_IO);
+
+	/*
+	 *	Driver destructor closes the connection
+	 */
+	TALLOC_FREE(sc->handle);
+
+	sc->fd = -1;
+	sc->wait = SQL_IO_WAIT_NONE;
+	sc->query = NULL;
+	sc->next = NULL;
+	sc->draining = false;
+	TALLOC_FREE(sc->expanded);
+}
+
+static fr_connection_t *sql_trunk_connection_alloc(fr_trunk_connection_t *tconn, fr_event_list_t *el,
+						   fr_connection_conf_t const *conf,
+						   char const *log_prefix, void *uctx)
+{
+	rlm_sql_thread_t	*t = talloc_get_type_abort(uctx, rlm_sql_thread_t);
+	rlm_sql_t const		*inst = t->inst;
+	sql_conn_t		*sc;
+	fr_connection_t		*conn;
+
+	MEM(sc = talloc_zero(tconn, sql_conn_t));
+	sc->thread = t;
+	sc->tconn = tconn;
+	sc->fd = -1;
+
+	conn = fr_connection_alloc(tconn, el,
+				   &(fr_connection_funcs_t){
+					.init = _sql_conn_init,
+					.close = _sql_conn_close
+				   },
+				   conf,
+				   log_prefix,
+				   sc);
+	if (!conn) {
+		PERROR("Failed allocating state handler for new connection");
+		talloc_free(sc);
+		return NULL;
+	}
+	talloc_steal(conn, sc);
+
+	return conn;
+}
+
+/** Send the next query on a connection
+ *
+ */
+static void sql_trunk_request_mux(UNUSED fr_event_list_t *el, fr_trunk_connection_t *tconn,
+				  fr_connection_t *conn, UNUSED void *uctx)
+{
+	sql_conn_t		*sc = talloc_get_type_abort(conn->h, sql_conn_t);
+	fr_trunk_request_t	*treq;
+	sql_query_t		*query;
+
+	while (!sc->query && !sc->next) {
+		if (fr_trunk_connection_pop_request(&treq, tconn) < 0) return;
+		if (!treq) return;
+
+		query = talloc_get_type_abort(treq->preq, sql_query_t);
+
+		/*
+		 *	Connection is still reading the result
+		 *	of a cancelled query.
+		 */
+		if (sc->draining) {
+			sc->next = query;
+			fr_trunk_request_signal_sent(treq);
+			return;
+		}
+
+		if (sql_conn_query_send(sc, query) < 0) {
+			fr_trunk_request_signal_fail(treq);
+			continue;
+		}
+
+		fr_trunk_request_signal_sent(treq);
+	}
+}
+
+static void sql_trunk_request_demux(UNUSED fr_trunk_connection_t *tconn, fr_connection_t *conn, UNUSED void *uctx)
+{
+	sql_conn_t		*sc = talloc_get_type_abort(conn->h, sql_conn_t);
+
+	if (!sc->query && !sc->draining) return;
+
+	sql_conn_query_continue(sc);
+}
+
+/** Query is being removed from the connection, either because it's done or because it was cancelled
+ *
+ */
+static void sql_trunk_request_conn_release(fr_connection_t *conn, void *preq, UNUSED void *uctx)
+{
+	sql_conn_t		*sc;
+	sql_query_t		*query = talloc_get_type_abort(preq, sql_query_t);
+
+	if (!conn->h) return;
+	sc = talloc_get_type_abort(conn->h, sql_conn_t);
+
+	if (sc->query == query) {
+		sc->query = NULL;
+		sc->draining = true;
+	} else if (sc->next == query) {
+		sc->next = NULL;
+	}
+}
+
+static void sql_trunk_request_fail(REQUEST *request, void *preq, UNUSED void *rctx,
+				   UNUSED fr_trunk_request_state_t state, UNUSED void *uctx)
+{
+	sql_query_t		*query = talloc_get_type_abort(preq, sql_query_t);
+
+	query->treq = NULL;
+
+	unlang_interpret_resumable(request);
+}
+
+static void sql_trunk_request_complete(REQUEST *request, void *preq, UNUSED void *rctx, UNUSED void *uctx)
+{
+	sql_query_t		*query = talloc_get_type_abort(preq, sql_query_t);
+
+	query->treq = NULL;
+
+	unlang_interpret_resumable(request);
+}
+
+/** Allocate a trunk for this thread
+ *
+ * @param[in] t		Thread instance to populate.
+ * @param[in] inst	Module instance.
+ * @param[in] el	This thread's event list.
+ * @return
+ *	- 0 on success.
+ *	- -1 on failure.
+ */
+int sql_trunk_thread_instantiate(rlm_sql_thread_t *t, rlm_sql_t const *inst, fr_event_list_t *el)
+{
+	static fr_trunk_io_funcs_t	io_funcs = {
+						.connection_alloc = sql_trunk_connection_alloc,
+						.request_mux = sql_trunk_request_mux,
+						.request_demux = sql_trunk_request_demux,
+						.request_conn_release = sql_trunk_request_conn_release,
+						.request_complete = sql_trunk_request_complete,
+						.request_fail = sql_trunk_request_fail
+					};
+
+	t->inst = inst;
+	t->el = el;
+
+	t->trunk = fr_trunk_alloc(t, el, &io_funcs, &inst->config->trunk_conf, inst->name, t, false);
+	if (!t->trunk) return -1;
+
+	return 0;
+}
+
+/** Allocate a query to run over the trunk
+ *
+ * @param[in] ctx	to allocate the query in.  Must outlive the query.
+ * @param[in] request	the query is being run for.
+ * @param[in] section	the query came from.  Used for query logging.
+ * @param[in] query_str	to expand and run.
+ * @return a new query.
+ */
+sql_query_t *sql_trunk_query_alloc(TALLOC_CTX *ctx, REQUEST *request, sql_acct_section_t *section,
+				   char const *query_str)
+{
+	sql_query_t *query;
+
+	MEM(query = talloc_zero(ctx, sql_query_t));
+	query->request = request;
+	query->section = section;
+	query->query_str = query_str;
+	query->rcode = RLM_SQL_RECONNECT;	/* If the trunk fails the query, there was no usable connection */
+
+	return query;
+}
+
+/** Enqueue a query, the request is marked resumable when it completes
+ *
+ * @param[in] t		Thread instance.
+ * @param[in] query	to enqueue.
+ * @return
+ *	- 0 on success.
+ *	- -1 on failure.
+ */
+int sql_trunk_query_enqueue(rlm_sql_thread_t *t, sql_query_t *query)
+{
+	REQUEST			*request = query->request;
+	fr_trunk_request_t	*treq;
+
+	treq = fr_trunk_request_alloc(t->trunk, request);
+	if (!treq) {
+		REDEBUG("Failed allocating trunk request");
+		return -1;
+	}
+
+	switch (fr_trunk_request_enqueue(&treq, t->trunk, request, query, NULL)) {
+	case FR_TRUNK_ENQUEUE_OK:
+	case FR_TRUNK_ENQUEUE_IN_BACKLOG:
+		break;
+
+	default:
+		REDEBUG("Failed enqueueing query");
+		fr_trunk_request_free(&treq);
+		return -1;
+	}
+	query->treq = treq;
+
+	return 0;
+}
+
+/** Cancel a query which has not yet completed
+ *
+ * @param[in] query	to cancel.
+ */
+void sql_trunk_query_cancel(sql_query_t *query)
+{
+	if (!query->treq) return;
+
+	fr_trunk_request_signal_cancel(query->treq);
+	query->treq = NULL;
+}
@@ -750,7 +750,7 @@ extern module_t rlm_sqlippool;
 module_t rlm_sqlippool = {
 	.magic		= RLM_MODULE_INIT,
 	.name		= "sqlippool",
-	.type		= RLM_TYPE_THREAD_SAFE,
+	.type		= RLM_TYPE_THREAD_SAFE | RLM_TYPE_BLOCKING,
 	.inst_size	= sizeof(rlm_sqlippool_t),
 	.config		= module_config,
 	.instantiate	= mod_instantiate,
@@ -28,6 +28,7 @@ RCSID("$Id$")
 
 #include <freeradius-devel/server/base.h>
 #include <freeradius-devel/server/module.h>
+#include <freeradius-devel/unlang/base.h>
 #include <freeradius-devel/util/debug.h>
 
 /*
@@ -105,6 +106,9 @@ typedef struct {
 
 	fr_time_delta_t	time_delta;
 	fr_time_delta_t	*time_delta_m;
+
+	bool		blocking;	//!< Mark this instance as blocking.
+	bool		yield;		//!< Yield once before returning.
 } rlm_test_t;
 
 typedef struct {
@@ -169,6 +173,9 @@ static const CONF_PARSER module_config[] = {
 	{ FR_CONF_OFFSET("time_delta", FR_TYPE_TIME_DELTA, rlm_test_t, time_delta) },
 	{ FR_CONF_OFFSET("time_delta_t", FR_TYPE_TIME_DELTA | FR_TYPE_MULTI, rlm_test_t, time_delta_m) },
 
+	{ FR_CONF_OFFSET("blocking", FR_TYPE_BOOL, rlm_test_t, blocking), .dflt = "no" },
+	{ FR_CONF_OFFSET("yield", FR_TYPE_BOOL, rlm_test_t, yield), .dflt = "no" },
+
 	CONF_PARSER_TERMINATOR
 };
 
@@ -231,12 +238,17 @@ static int mod_thread_detach(UNUSED fr_event_list_t *el, void *thread)
  *	that must be referenced in later calls, store a handle to it
  *	in *instance otherwise put a null pointer there.
  */
-static int mod_bootstrap(void *instance, UNUSED CONF_SECTION *conf)
+static int mod_bootstrap(void *instance, CONF_SECTION *conf)
 {
 	rlm_test_t *inst = instance;
 
-	if (paircmp_register_by_name("Test-Paircmp", attr_user_name, false,
-					rlm_test_cmp, inst) < 0) {
+	/*
+	 *	Only one instance can register the comparison,
+	 *	so leave it to the unnamed one.
+	 */
+	if (!cf_section_name2(conf) &&
+	    (paircmp_register_by_name("Test-Paircmp", attr_user_name, false,
+				      rlm_test_cmp, inst) < 0)) {
 		PERROR("Failed registering \"Test-Paircmp\"");
 		return -1;
 	}
@@ -252,6 +264,12 @@ static int mod_bootstrap(void *instance, UNUSED CONF_SECTION *conf)
 	DEBUG3("Debug3 message");
 	DEBUG4("Debug4 message");
 
+	/*
+	 *	Lets "parallel offload" be tested without
+	 *	needing a real blocking module.
+	 */
+	if (inst->blocking) module_instance_type_set(instance, RLM_TYPE_THREAD_SAFE | RLM_TYPE_BLOCKING);
+
 	return 0;
 }
 
@@ -329,12 +347,41 @@ static rlm_rcode_t CC_HINT(nonnull) mod_accounting(UNUSED void *instance, void *
 }
 #endif
 
+static void mod_yield_timeout(UNUSED void *instance, UNUSED void *thread, REQUEST *request,
+			      UNUSED void *rctx, UNUSED fr_time_t fired)
+{
+	unlang_interpret_resumable(request);
+}
+
+static rlm_rcode_t mod_yield_resume(UNUSED void *instance, UNUSED void *thread,
+				    UNUSED REQUEST *request, UNUSED void *rctx)
+{
+	return RLM_MODULE_OK;
+}
+
+static void mod_yield_signal(UNUSED void *instance, UNUSED void *thread, REQUEST *request,
+			     void *rctx, fr_state_signal_t action)
+{
+	if (action != FR_SIGNAL_CANCEL) return;
+
+	(void) unlang_module_timeout_delete(request, rctx);
+}
+
 /*
  *	Write accounting information to this modules database.
  */
-static rlm_rcode_t CC_HINT(nonnull) mod_return(UNUSED void *instance, UNUSED void *thread, UNUSED REQUEST *request)
+static rlm_rcode_t CC_HINT(nonnull) mod_return(void *instance, UNUSED void *thread, REQUEST *request)
 {
-	return RLM_MODULE_OK;
+	rlm_test_t const *inst = instance;
+
+	if (!inst->yield) return RLM_MODULE_OK;
+
+	/*
+	 *	Resume as soon as the event loop runs.
+	 */
+	if (unlang_module_timeout_add(request, mod_yield_timeout, instance, fr_time()) < 0) return RLM_MODULE_FAIL;
+
+	return unlang_module_yield(request, mod_yield_resume, mod_yield_signal, instance);
 }
 
 static int mod_detach(UNUSED void *instance)
@@ -0,0 +1,234 @@
+#include <freeradius-devel/util/acutest.h>
+#include <freeradius-devel/util/rand.h>
+#include <freeradius-devel/radius/radius.h>
+
+#define VERIFY_TEST_MAX_LEN	(256)
+
+static uint8_t const verify_test_secret[] = "testing123";
+
+/** Build a signed packet
+ *
+ * @param[out] packet		to write.
+ * @param[in] code		of the packet.
+ * @param[in] original		request, if packet is a response.
+ * @param[in] ma_len		length of the Message-Authenticator.  0 for none.
+ * @return the length of the packet.
+ */
+static size_t verify_test_packet(uint8_t packet[VERIFY_TEST_MAX_LEN], uint8_t code, uint8_t const *original,
+				 size_t ma_len)
+{
+	uint8_t	*p = packet + RADIUS_HEADER_LENGTH;
+	size_t	i, len;
+
+	packet[0] = code;
+	packet[1] = fr_rand();
+	for (i = 0; i < RADIUS_AUTH_VECTOR_LENGTH; i++) packet[4 + i] = fr_rand();
+
+	/*
+	 *	A User-Name, and some random attributes either side
+	 *	of the Message-Authenticator.
+	 */
+	*p++ = FR_USER_NAME;
+	*p++ = 6;
+	memcpy(p, "user", 4);
+	p += 4;
+
+	if (ma_len) {
+		*p++ = FR_MESSAGE_AUTHENTICATOR;
+		*p++ = ma_len;
+		memset(p, 0, ma_len - 2);
+		p += ma_len - 2;
+	}
+
+	len = 2 + (fr_rand() % 30);
+	*p++ = FR_CLASS;
+	*p++ = len;
+	for (i = 2; i < len; i++) *p++ = fr_rand();
+
+	len = p - packet;
+	packet[2] = len >> 8;
+	packet[3] = len & 0xff;
+
+	TEST_CHECK(fr_radius_sign(packet, original, verify_test_secret, sizeof(verify_test_secret) - 1) == 0);
+
+	return len;
+}
+
+/** Check fr_radius_verify_multi() and fr_radius_verify() agree on a packet
+ *
+ */
+static void verify_test_compare(uint8_t const *packet, uint8_t const *original, decode_fail_t expected)
+{
+	fr_radius_verify_job_t	job;
+	uint8_t			copy[VERIFY_TEST_MAX_LEN];
+	size_t			len = (packet[2] << 8) | packet[3];
+	int			ret;
+
+	job = (fr_radius_verify_job_t){
+		.packet = packet,
+		.original = original,
+		.secret = verify_test_secret,
+		.secret_len = sizeof(verify_test_secret) - 1
+	};
+	TEST_CHECK(fr_radius_verify_multi(&job, 1) == (expected == DECODE_FAIL_NONE ? 0 : 1));
+	TEST_CHECK(job.reason == expected);
+	TEST_MSG("code %u - expected reason %u, got %u", packet[0], expected, job.reason);
+
+	memcpy(copy, packet, len);
+	ret = fr_radius_verify(copy, original, verify_test_secret, sizeof(verify_test_secret) - 1);
+	TEST_CHECK((ret == 0) == (expected == DECODE_FAIL_NONE));
+	TEST_MSG("code %u - fr_radius_verify() returned %d", packet[0], ret);
+
+	/*
+	 *	fr_radius_verify() signs the packet in place,
+	 *	but must leave it as it was.
+	 */
+	TEST_CHECK(memcmp(copy, packet, len) == 0);
+}
+
+typedef struct {
+	uint8_t		code;		//!< of the packet.
+	uint8_t		original;	//!< Code of the request, if the packet is a response.
+	bool		has_auth;	//!< Whether the authenticator is checked.
+} verify_test_case_t;
+
+static verify_test_case_t const verify_test_cases[] = {
+	{ .code = FR_CODE_ACCESS_REQUEST },
+	{ .code = FR_CODE_STATUS_SERVER },
+	{ .code = FR_CODE_ACCESS_ACCEPT, .original = FR_CODE_ACCESS_REQUEST, .has_auth = true },
+	{ .code = FR_CODE_ACCESS_CHALLENGE, .original = FR_CODE_ACCESS_REQUEST, .has_auth = true },
+	{ .code = FR_CODE_ACCESS_ACCEPT, .original = FR_CODE_STATUS_SERVER, .has_auth = true },
+	{ .code = FR_CODE_ACCOUNTING_REQUEST, .has_auth = true },
+	{ .code = FR_CODE_ACCOUNTING_RESPONSE, .original = FR_CODE_ACCOUNTING_REQUEST, .has_auth = true },
+	{ .code = FR_CODE_ACCOUNTING_RESPONSE, .original = FR_CODE_STATUS_SERVER, .has_auth = true },
+	{ .code = FR_CODE_COA_REQUEST, .has_auth = true },
+	{ .code = FR_CODE_COA_ACK, .original = FR_CODE_COA_REQUEST, .has_auth = true },
+	{ .code = FR_CODE_DISCONNECT_NAK, .original = FR_CODE_DISCONNECT_REQUEST, .has_auth = true },
+};
+
+static void test_verify_multi_good(void)
+{
+	uint8_t		original[VERIFY_TEST_MAX_LEN], packet[VERIFY_TEST_MAX_LEN];
+	size_t		i, ma_len;
+
+	for (i = 0; i < NUM_ELEMENTS(verify_test_cases); i++) {
+		verify_test_case_t const *tc = &verify_test_cases[i];
+
+		/*
+		 *	No Message-Authenticator, the normal one,
+		 *	and one which is longer than it should be.
+		 */
+		for (ma_len = 0; ma_len <= 20; ma_len += (ma_len ? 2 : 18)) {
+			TEST_CASE(fr_packet_codes[tc->code]);
+
+			if (tc->original) verify_test_packet(original, tc->original, NULL, 18);
+			verify_test_packet(packet, tc->code, tc->original ? original : NULL, ma_len);
+
+			verify_test_compare(packet, tc->original ? original : NULL, DECODE_FAIL_NONE);
+		}
+	}
+}
+
+static void test_verify_multi_bad(void)
+{
+	uint8_t		original[VERIFY_TEST_MAX_LEN], packet[VERIFY_TEST_MAX_LEN];
+	size_t		i;
+
+	for (i = 0; i < NUM_ELEMENTS(verify_test_cases); i++) {
+		verify_test_case_t const *tc = &verify_test_cases[i];
+		uint8_t const *orig = tc->original ? original : NULL;
+
+		TEST_CASE(fr_packet_codes[tc->code]);
+
+		if (tc->original) verify_test_packet(original, tc->original, NULL, 18);
+
+		/*
+		 *	Corrupt Message-Authenticator.
+		 */
+		verify_test_packet(packet, tc->code, orig, 18);
+		packet[RADIUS_HEADER_LENGTH + 6 + 2 + (fr_rand() % RADIUS_AUTH_VECTOR_LENGTH)] ^= 0x01;
+		verify_test_compare(packet, orig, DECODE_FAIL_MA_INVALID);
+
+		/*
+		 *	Corrupt attribute data, covered by both
+		 *	the Message-Authenticator and the authenticator.
+		 */
+		verify_test_packet(packet, tc->code, orig, 18);
+		packet[RADIUS_HEADER_LENGTH + 2] ^= 0x01;
+		verify_test_compare(packet, orig, DECODE_FAIL_MA_INVALID);
+
+		/*
+		 *	Message-Authenticator which is too short.
+		 */
+		verify_test_packet(packet, tc->code, orig, 18);
+		packet[RADIUS_HEADER_LENGTH + 6 + 1] = 17;
+		verify_test_compare(packet, orig, DECODE_FAIL_MA_INVALID_LENGTH);
+
+		if (!tc->has_auth) continue;
+
+		/*
+		 *	Corrupt Request / Response Authenticator.
+		 */
+		verify_test_packet(packet, tc->code, orig, 0);
+		packet[4 + (fr_rand() % RADIUS_AUTH_VECTOR_LENGTH)] ^= 0x01;
+		verify_test_compare(packet, orig, DECODE_FAIL_VERIFY);
+
+		/*
+		 *	Corrupt attribute data, without a
+		 *	Message-Authenticator.
+		 */
+		verify_test_packet(packet, tc->code, orig, 0);
+		packet[RADIUS_HEADER_LENGTH + 2] ^= 0x01;
+		verify_test_compare(packet, orig, DECODE_FAIL_VERIFY);
+	}
+}
+
+/** Verify a large batch of good and bad packets at once
+ *
+ */
+static void test_verify_multi_batch(void)
+{
+	static uint8_t		original[200][VERIFY_TEST_MAX_LEN], packet[200][VERIFY_TEST_MAX_LEN];
+	fr_radius_verify_job_t	jobs[200];
+	size_t			i, failed = 0;
+
+	for (i = 0; i < NUM_ELEMENTS(jobs); i++) {
+		verify_test_case_t const *tc = &verify_test_cases[fr_rand() % NUM_ELEMENTS(verify_test_cases)];
+		uint8_t const *orig = tc->original ? original[i] : NULL;
+
+		if (tc->original) verify_test_packet(original[i], tc->original, NULL, 18);
+		verify_test_packet(packet[i], tc->code, orig, (fr_rand() & 0x01) ? 18 : 0);
+
+		if ((i % 3) == 0) {
+			packet[i][RADIUS_HEADER_LENGTH + 2] ^= 0x01;
+			if (tc->has_auth || (packet[i][RADIUS_HEADER_LENGTH + 6] == FR_MESSAGE_AUTHENTICATOR)) failed++;
+		}
+
+		jobs[i] = (fr_radius_verify_job_t){
+			.packet = packet[i],
+			.original = orig,
+			.secret = verify_test_secret,
+			.secret_len = sizeof(verify_test_secret) - 1
+		};
+	}
+
+	TEST_CHECK(fr_radius_verify_multi(jobs, NUM_ELEMENTS(jobs)) == failed);
+
+	for (i = 0; i < NUM_ELEMENTS(jobs); i++) {
+		uint8_t	copy[VERIFY_TEST_MAX_LEN];
+		int	ret;
+
+		memcpy(copy, packet[i], sizeof(copy));
+		ret = fr_radius_verify(copy, jobs[i].original, verify_test_secret, sizeof(verify_test_secret) - 1);
+		TEST_CHECK((ret == 0) == (jobs[i].reason == DECODE_FAIL_NONE));
+		TEST_MSG("packet %zu - fr_radius_verify() returned %d, reason %u", i, ret, jobs[i].reason);
+	}
+}
+
+TEST_LIST = {
+	{ "verify_multi_good",		test_verify_multi_good },
+	{ "verify_multi_bad",		test_verify_multi_bad },
+	{ "verify_multi_batch",		test_verify_multi_batch },
+
+	{ NULL }
+};
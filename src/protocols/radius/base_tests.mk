@@ -0,0 +1,8 @@
+TARGET		:= radius_base_tests
+
+SOURCES		:= base_tests.c
+
+TGT_LDLIBS	:= $(LIBS)
+TGT_LDFLAGS	:= $(LDFLAGS)
+
+TGT_PREREQS	+= libfreeradius-util.a libfreeradius-radius.a
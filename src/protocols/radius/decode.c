@@ -61,7 +61,7 @@ static void memcpy_bounded(void * restrict dst, const void * restrict src, size_
 ssize_t fr_radius_decode_tunnel_password(uint8_t *passwd, size_t *pwlen,
 					 char const *secret, uint8_t const *vector, bool tunnel_password_zeros)
 {
-	fr_md5_ctx_t	*md5_ctx, *md5_ctx_old;
+	fr_md5_ctx_t	*md5_ctx;
 	uint8_t		digest[RADIUS_AUTH_VECTOR_LENGTH];
 	int		secretlen;
 	size_t		i, n, encrypted_len, embedded_len;
@@ -99,11 +99,8 @@ ssize_t fr_radius_decode_tunnel_password(uint8_t *passwd, size_t *pwlen,
 	 */
 	secretlen = talloc_array_length(secret) - 1;
 
-	md5_ctx = fr_md5_ctx_alloc(false);
-	md5_ctx_old = fr_md5_ctx_alloc(true);
-
-	fr_md5_update(md5_ctx, (uint8_t const *) secret, secretlen);
-	fr_md5_ctx_copy(md5_ctx_old, md5_ctx); /* save intermediate work */
+	md5_ctx = fr_md5_ctx_alloc(true);
+	fr_radius_secret_md5_init(md5_ctx, (uint8_t const *) secret, secretlen);
 
 	/*
 	 *	Set up the initial key:
@@ -129,7 +126,7 @@ ssize_t fr_radius_decode_tunnel_password(uint8_t *passwd, size_t *pwlen,
 			base = 1;
 
 			fr_md5_final(digest, md5_ctx);
-			fr_md5_ctx_copy(md5_ctx, md5_ctx_old);
+			fr_radius_secret_md5_init(md5_ctx, (uint8_t const *) secret, secretlen);
 
 			/*
 			 *	A quick check: decrypt the first octet
@@ -141,7 +138,6 @@ ssize_t fr_radius_decode_tunnel_password(uint8_t *passwd, size_t *pwlen,
 				fr_strerror_printf("Tunnel Password is too long for the attribute "
 						   "(shared secret is probably incorrect!)");
 				fr_md5_ctx_free(&md5_ctx);
-				fr_md5_ctx_free(&md5_ctx_old);
 				return -1;
 			}
 
@@ -152,7 +148,7 @@ ssize_t fr_radius_decode_tunnel_password(uint8_t *passwd, size_t *pwlen,
 
 			fr_md5_final(digest, md5_ctx);
 
-			fr_md5_ctx_copy(md5_ctx, md5_ctx_old);
+			fr_radius_secret_md5_init(md5_ctx, (uint8_t const *) secret, secretlen);
 			fr_md5_update(md5_ctx, passwd + n + 2, block_len);
 		}
 
@@ -162,7 +158,6 @@ ssize_t fr_radius_decode_tunnel_password(uint8_t *passwd, size_t *pwlen,
 	}
 
 	fr_md5_ctx_free(&md5_ctx);
-	fr_md5_ctx_free(&md5_ctx_old);
 
 	/*
 	 *	Check trailing bytes
@@ -188,7 +183,7 @@ ssize_t fr_radius_decode_tunnel_password(uint8_t *passwd, size_t *pwlen,
  */
 ssize_t fr_radius_decode_password(char *passwd, size_t pwlen, char const *secret, uint8_t const *vector)
 {
-	fr_md5_ctx_t	*md5_ctx, *md5_ctx_old;
+	fr_md5_ctx_t	*md5_ctx;
 	uint8_t		digest[RADIUS_AUTH_VECTOR_LENGTH];
 	int		i;
 	size_t		n, secretlen;
@@ -210,11 +205,8 @@ ssize_t fr_radius_decode_password(char *passwd, size_t pwlen, char const *secret
 	 */
 	secretlen = talloc_array_length(secret) - 1;
 
-	md5_ctx = fr_md5_ctx_alloc(false);
-	md5_ctx_old = fr_md5_ctx_alloc(true);
-
-	fr_md5_update(md5_ctx, (uint8_t const *) secret, secretlen);
-	fr_md5_ctx_copy(md5_ctx_old, md5_ctx);	/* save intermediate work */
+	md5_ctx = fr_md5_ctx_alloc(true);
+	fr_radius_secret_md5_init(md5_ctx, (uint8_t const *) secret, secretlen);
 
 	/*
 	 *	The inverse of the code above.
@@ -224,14 +216,14 @@ ssize_t fr_radius_decode_password(char *passwd, size_t pwlen, char const *secret
 			fr_md5_update(md5_ctx, vector, RADIUS_AUTH_VECTOR_LENGTH);
 			fr_md5_final(digest, md5_ctx);
 
-			fr_md5_ctx_copy(md5_ctx, md5_ctx_old);
+			fr_radius_secret_md5_init(md5_ctx, (uint8_t const *) secret, secretlen);
 			if (pwlen > AUTH_PASS_LEN) {
 				fr_md5_update(md5_ctx, (uint8_t *) passwd, AUTH_PASS_LEN);
 			}
 		} else {
 			fr_md5_final(digest, md5_ctx);
 
-			fr_md5_ctx_copy(md5_ctx, md5_ctx_old);
+			fr_radius_secret_md5_init(md5_ctx, (uint8_t const *) secret, secretlen);
 			if (pwlen > (n + AUTH_PASS_LEN)) {
 				fr_md5_update(md5_ctx, (uint8_t *) passwd + n, AUTH_PASS_LEN);
 			}
@@ -241,7 +233,6 @@ ssize_t fr_radius_decode_password(char *passwd, size_t pwlen, char const *secret
 	}
 
 	fr_md5_ctx_free(&md5_ctx);
-	fr_md5_ctx_free(&md5_ctx_old);
 
  done:
 	passwd[pwlen] = '\0';
@@ -87,11 +87,12 @@ void fr_radius_encode_chap_password(uint8_t out[static 1 + RADIUS_CHAP_CHALLENGE
 static ssize_t encode_password(uint8_t *out, ssize_t outlen, uint8_t const *input, size_t inlen,
 			       char const *secret, uint8_t const *vector)
 {
-	fr_md5_ctx_t	*md5_ctx, *md5_ctx_old;
+	fr_md5_ctx_t	*md5_ctx;
 	uint8_t		digest[RADIUS_AUTH_VECTOR_LENGTH];
 	uint8_t		passwd[RADIUS_MAX_PASS_LENGTH];
 	size_t		i, n;
 	size_t		len;
+	size_t		secret_len = talloc_array_length(secret) - 1;
 
 	/*
 	 *	If the length is zero, round it up.
@@ -109,11 +110,8 @@ static ssize_t encode_password(uint8_t *out, ssize_t outlen, uint8_t const *inpu
 		len &= ~0x0f;
 	}
 
-	md5_ctx = fr_md5_ctx_alloc(false);
-	md5_ctx_old = fr_md5_ctx_alloc(true);
-
-	fr_md5_update(md5_ctx, (uint8_t const *) secret, talloc_array_length(secret) - 1);
-	fr_md5_ctx_copy(md5_ctx_old, md5_ctx);
+	md5_ctx = fr_md5_ctx_alloc(true);
+	fr_radius_secret_md5_init(md5_ctx, (uint8_t const *) secret, secret_len);
 
 	/*
 	 *	Do first pass.
@@ -122,7 +120,7 @@ static ssize_t encode_password(uint8_t *out, ssize_t outlen, uint8_t const *inpu
 
 	for (n = 0; n < len; n += AUTH_PASS_LEN) {
 		if (n > 0) {
-			fr_md5_ctx_copy(md5_ctx, md5_ctx_old);
+			fr_radius_secret_md5_init(md5_ctx, (uint8_t const *) secret, secret_len);
 			fr_md5_update(md5_ctx, passwd + n - AUTH_PASS_LEN, AUTH_PASS_LEN);
 		}
 
@@ -131,7 +129,6 @@ static ssize_t encode_password(uint8_t *out, ssize_t outlen, uint8_t const *inpu
 	}
 
 	fr_md5_ctx_free(&md5_ctx);
-	fr_md5_ctx_free(&md5_ctx_old);
 
 	/*
 	 *	Return how many bytes we would have needed
@@ -147,7 +144,7 @@ static ssize_t encode_password(uint8_t *out, ssize_t outlen, uint8_t const *inpu
 static ssize_t encode_tunnel_password(uint8_t *out, size_t outlen,
 				      uint8_t const *in, size_t inlen, void *encoder_ctx)
 {
-	fr_md5_ctx_t	*md5_ctx, *md5_ctx_old;
+	fr_md5_ctx_t	*md5_ctx;
 	uint8_t		digest[RADIUS_AUTH_VECTOR_LENGTH];
 	uint8_t		tpasswd[RADIUS_MAX_STRING_LENGTH];
 	size_t		i, n;
@@ -220,11 +217,9 @@ static ssize_t encode_tunnel_password(uint8_t *out, size_t outlen,
 	tpasswd[1] = r & 0xff;
 	tpasswd[2] = inlen;	/* length of the password string */
 
-	md5_ctx = fr_md5_ctx_alloc(false);
-	md5_ctx_old = fr_md5_ctx_alloc(true);
-
-	fr_md5_update(md5_ctx, (uint8_t const *) packet_ctx->secret, talloc_array_length(packet_ctx->secret) - 1);
-	fr_md5_ctx_copy(md5_ctx_old, md5_ctx);
+	md5_ctx = fr_md5_ctx_alloc(true);
+	fr_radius_secret_md5_init(md5_ctx, (uint8_t const *) packet_ctx->secret,
+				  talloc_array_length(packet_ctx->secret) - 1);
 
 	fr_md5_update(md5_ctx, packet_ctx->vector, RADIUS_AUTH_VECTOR_LENGTH);
 	fr_md5_update(md5_ctx, &tpasswd[0], 2);
@@ -233,7 +228,8 @@ static ssize_t encode_tunnel_password(uint8_t *out, size_t outlen,
 		size_t block_len;
 
 		if (n > 0) {
-			fr_md5_ctx_copy(md5_ctx, md5_ctx_old);
+			fr_radius_secret_md5_init(md5_ctx, (uint8_t const *) packet_ctx->secret,
+						  talloc_array_length(packet_ctx->secret) - 1);
 			fr_md5_update(md5_ctx, tpasswd + 2 + n - AUTH_PASS_LEN, AUTH_PASS_LEN);
 		}
 		fr_md5_final(digest, md5_ctx);
@@ -248,7 +244,6 @@ static ssize_t encode_tunnel_password(uint8_t *out, size_t outlen,
 	}
 
 	fr_md5_ctx_free(&md5_ctx);
-	fr_md5_ctx_free(&md5_ctx_old);
 
 	memcpy(out, tpasswd, len);
 
@@ -28,6 +28,7 @@
 #include <freeradius-devel/util/packet.h>
 #include <freeradius-devel/util/rand.h>
 #include <freeradius-devel/util/log.h>
+#include <freeradius-devel/util/md5.h>
 
 #define RADIUS_AUTH_VECTOR_OFFSET      		4
 #define RADIUS_HEADER_LENGTH			20
@@ -74,10 +75,22 @@ typedef enum {
 	DECODE_FAIL_TOO_MANY_ATTRIBUTES,
 	DECODE_FAIL_MA_MISSING,
 	DECODE_FAIL_MA_INVALID,
+	DECODE_FAIL_VERIFY,
 	DECODE_FAIL_UNKNOWN,
 	DECODE_FAIL_MAX
 } decode_fail_t;
 
+/** A packet to be verified as part of a batch
+ *
+ */
+typedef struct {
+	uint8_t const		*packet;	//!< Raw packet.  Must have been checked with fr_radius_ok().
+	uint8_t const		*original;	//!< Raw original request, if packet is a response.
+	uint8_t const		*secret;	//!< Shared secret.
+	size_t			secret_len;	//!< Length of the shared secret.
+	decode_fail_t		reason;		//!< Set to DECODE_FAIL_NONE if the packet is valid.
+} fr_radius_verify_job_t;
+
 /** subtype values for RADIUS
  *
  */
@@ -98,9 +111,15 @@ int		fr_radius_sign(uint8_t *packet, uint8_t const *original,
 			       uint8_t const *secret, size_t secret_len) CC_HINT(nonnull (1,3));
 int		fr_radius_verify(uint8_t *packet, uint8_t const *original,
 				 uint8_t const *secret, size_t secret_len) CC_HINT(nonnull (1,3));
+size_t		fr_radius_verify_multi(fr_radius_verify_job_t *jobs, size_t num);
 bool		fr_radius_ok(uint8_t const *packet, size_t *packet_len_p,
 			     uint32_t max_attributes, bool require_ma, decode_fail_t *reason) CC_HINT(nonnull (1,2));
 
+void		fr_radius_secret_md5_init(fr_md5_ctx_t *md5_ctx, uint8_t const *secret, size_t secret_len);
+
+void		fr_radius_secret_hmac_md5(uint8_t digest[static MD5_DIGEST_LENGTH], uint8_t const *in, size_t inlen,
+					  uint8_t const *secret, size_t secret_len);
+
 ssize_t		fr_radius_ascend_secret(uint8_t *out, size_t outlen, uint8_t const *in, size_t inlen,
 					char const *secret, uint8_t const *vector);
 
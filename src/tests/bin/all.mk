@@ -5,6 +5,7 @@ FILES	:= \
 	dhcpclient		\
 	message_set_test	\
 	radclient		\
+	raddetail		\
 	radict 			\
 	radmin			\
 	radsniff 		\
@@ -43,6 +43,9 @@ endef
 #	build/tests/$(MODULE_DIR)/FOO.out	updated if the test succeeds
 #	build/tests/$(MODULE_DIR)/FOO.log	debug output for the test
 #
+#  Tests which write files should put them in $ENV{MODULE_TEST_OUTPUT_DIR},
+#  which is build/tests/$(MODULE_DIR)/, and not in the source tree.
+#
 #  If the test fails, then look for ERROR in the input.  No error
 #  means it's unexpected, so we die.
 #
@@ -52,11 +55,11 @@ endef
 $(BUILD_DIR)/tests/modules/%: src/tests/modules/%.unlang $(BUILD_DIR)/tests/modules/%.attrs $(TESTBINDIR)/unit_test_module | build.raddb
 	@echo "MODULE-TEST $(lastword $(subst /, ,$(dir $@))) $(basename $(notdir $@))"
 	${Q}mkdir -p $(dir $@)
-	${Q}if ! MODULE_TEST_DIR=$(dir $<) MODULE_TEST_UNLANG=$< $(TESTBIN)/unit_test_module -D share/dictionary -d src/tests/modules/ -i "$@.attrs" -f "$@.attrs" -r "$@" -xxx > "$@.log" 2>&1 || ! test -f "$@"; then \
+	${Q}if ! MODULE_TEST_DIR=$(dir $<) MODULE_TEST_OUTPUT_DIR=$(dir $@) MODULE_TEST_UNLANG=$< $(TESTBIN)/unit_test_module -D share/dictionary -d src/tests/modules/ -i "$@.attrs" -f "$@.attrs" -r "$@" -xxx > "$@.log" 2>&1 || ! test -f "$@"; then \
 		if ! grep ERROR $< 2>&1 > /dev/null; then \
 			cat "$@.log"; \
 			echo "# $@.log"; \
-			echo "MODULE_TEST_DIR=$(dir $<) MODULE_TEST_UNLANG=$< $(TESTBIN)/unit_test_module -D share/dictionary -d src/tests/modules/ -i \"$@.attrs\" -f \"$@.attrs\" -r \"$@\" -xx"; \
+			echo "MODULE_TEST_DIR=$(dir $<) MODULE_TEST_OUTPUT_DIR=$(dir $@) MODULE_TEST_UNLANG=$< $(TESTBIN)/unit_test_module -D share/dictionary -d src/tests/modules/ -i \"$@.attrs\" -f \"$@.attrs\" -r \"$@\" -xx"; \
 			exit 1; \
 		fi; \
 		FOUND=$$(grep ^$< $@.log | head -1 | sed 's/:.*//;s/.*\[//;s/\].*//'); \
@@ -64,7 +67,7 @@ $(BUILD_DIR)/tests/modules/%: src/tests/modules/%.unlang $(BUILD_DIR)/tests/modu
 		if [ "$$EXPECTED" != "$$FOUND" ]; then \
 			cat "$@.log"; \
 			echo "# $@.log"; \
-			echo "MODULE_TEST_DIR=$(dir $<) MODULE_TEST_UNLANG=$< $(TESTBIN)/unit_test_module -D share/dictionary -d src/tests/modules/ -i \"$@.attrs\" -f \"$@.attrs\" -r \"$@\" -xx"; \
+			echo "MODULE_TEST_DIR=$(dir $<) MODULE_TEST_OUTPUT_DIR=$(dir $@) MODULE_TEST_UNLANG=$< $(TESTBIN)/unit_test_module -D share/dictionary -d src/tests/modules/ -i \"$@.attrs\" -f \"$@.attrs\" -r \"$@\" -xx"; \
 			exit 1; \
 		else \
 			touch "$@"; \